@@ -827,6 +827,10 @@ avoid taking any actions which might trigger a warning or disabling @@core_file.
 */
 static bool buf_pool_should_madvise = false;
 
+bool buf_pool_madvise_hugepage = false;
+
+bool buf_pool_prefault = false;
+
 // Doxygen gets confused by buf_chunk_t somehow.
 
 //! @cond
@@ -887,6 +891,19 @@ bool buf_pool_t::allocate_chunk(ulonglong mem_size, buf_chunk_t *chunk) {
   if (chunk->mem == nullptr) {
     return false;
   }
+#ifdef MADV_HUGEPAGE
+  /* Before the chunk is touched, so that it is faulted in with huge pages */
+  if (buf_pool_madvise_hugepage) {
+    const auto low_level_info = ut::large_page_low_level_info(
+        chunk->mem, ut::fallback_to_normal_page_t{});
+    if (madvise(low_level_info.base_ptr, low_level_info.allocation_size,
+                MADV_HUGEPAGE)) {
+      ib::warn(ER_IB_MSG_MADVISE_FAILED, low_level_info.base_ptr,
+               low_level_info.allocation_size, "MADV_HUGEPAGE",
+               strerror(errno));
+    }
+  }
+#endif /* MADV_HUGEPAGE */
   /* Dump core without large memory buffers */
   if (buf_pool_should_madvise) {
     if (!chunk->madvise_dont_dump()) {
@@ -1433,6 +1450,70 @@ static void buf_pool_free() {
   buf_pool_ptr = nullptr;
 }
 
+/** Get the memory of all the chunks of the buffer pool.
+@return start and size of the memory of every chunk */
+static std::vector<std::pair<byte *, size_t>> buf_pool_chunk_ranges() {
+  std::vector<std::pair<byte *, size_t>> ranges;
+
+  for (ulint i = 0; i < srv_buf_pool_instances; i++) {
+    const buf_pool_t *buf_pool = &buf_pool_ptr[i];
+    for (ulint j = 0; j < buf_pool->n_chunks; j++) {
+      const auto low_level_info = ut::large_page_low_level_info(
+          buf_pool->chunks[j].mem, ut::fallback_to_normal_page_t{});
+      ranges.emplace_back(static_cast<byte *>(low_level_info.base_ptr),
+                          low_level_info.allocation_size);
+    }
+  }
+
+  return ranges;
+}
+
+/** Fault in the memory of all the chunks of the buffer pool, so that the
+page faults are taken by several threads at once instead of by the first
+users of the pages. The contents of the chunks are kept, their block
+descriptors are initialized already.
+@param[in]      n_threads       number of threads */
+static void buf_pool_prefault_chunks(ulint n_threads) {
+  const auto ranges = buf_pool_chunk_ranges();
+
+  const auto start_time = std::chrono::steady_clock::now();
+  const size_t os_page_size = sysconf(_SC_PAGESIZE);
+
+  auto prefault = [&](ulint n_thread) {
+    for (size_t i = n_thread; i < ranges.size(); i += n_threads) {
+      byte *ptr = ranges[i].first;
+      const size_t len = ranges[i].second;
+#ifdef MADV_POPULATE_WRITE
+      if (madvise(ptr, len, MADV_POPULATE_WRITE) == 0) {
+        continue;
+      }
+#endif /* MADV_POPULATE_WRITE */
+      /* write every page back as it is, nothing else uses the chunks yet */
+      for (size_t offset = 0; offset < len; offset += os_page_size) {
+        volatile byte *page = ptr + offset;
+        *page = *page;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (ulint n = 1; n < n_threads; n++) {
+    threads.emplace_back(prefault, n);
+  }
+  prefault(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  ib::info() << "Faulted in the " << ranges.size()
+             << " chunks of the buffer pool with " << n_threads
+             << " threads in "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start_time)
+                    .count()
+             << " ms";
+}
+
 /** Creates the buffer pool.
 @param[in]  total_size    Size of the total pool in bytes.
 @param[in]  n_instances   Number of buffer pool instances to create.
@@ -1525,6 +1606,19 @@ dberr_t buf_pool_init(ulint total_size, ulint n_instances) {
   buf_pool_set_sizes();
   buf_LRU_old_ratio_update(100 * 3 / 8, false);
 
+  if (buf_pool_prefault) {
+    /* page faults scale further than the initialization of the instances,
+    which also touches little more than the block descriptors */
+    buf_pool_prefault_chunks(n_cores * 2);
+  }
+
+  if (srv_use_native_aio && srv_use_io_uring) {
+    /* The pages are read into and written from the frames of the chunks.
+    srv_use_io_uring is only set by xtrabackup, which does not resize the
+    buffer pool, so the registered chunks stay valid. */
+    os_aio_register_buffers(buf_pool_chunk_ranges());
+  }
+
   btr_search_sys_create(buf_pool_get_curr_size() / sizeof(void *) / 64);
 
   buf_stat_per_index = ut::new_withkey<buf_stat_per_index_t>(
@@ -127,7 +127,41 @@ using Moved = std::tuple<dd::Object_id, space_id_t, std::string, std::string,
 using Tablespaces = std::vector<Moved>;
 }  // namespace dd_fil
 
+#ifdef XTRABACKUP
+/** Minimum number of files scanned by a thread when the scan is scaled with
+--parallel. The validation of a first page is a synchronous read, a
+datadir with many small tablespaces is bound by the latency of these reads
+and not by the CPU, so the threads are not limited by the cores. */
+static constexpr size_t XB_FIL_SCAN_MIN_TABLESPACES_PER_THREAD = 64;
+
+/** Number of first pages read ahead of the one validated by a scan thread */
+static constexpr size_t XB_FIL_SCAN_READ_AHEAD = 32;
+
+/** Ask the kernel to read the first page of a tablespace file in the
+background, so that the validation of the file does not wait for the disk.
+@param[in]  path  path of the file */
+static void fil_read_ahead_first_page(const std::string &path) {
+#ifdef POSIX_FADV_WILLNEED
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  posix_fadvise(fd, 0, UNIV_PAGE_SIZE_MAX, POSIX_FADV_WILLNEED);
+  ::close(fd);
+#endif /* POSIX_FADV_WILLNEED */
+}
+#endif /* XTRABACKUP */
+
 size_t fil_get_scan_threads(size_t num_files) {
+#ifdef XTRABACKUP
+  if (xb_fil_scan_threads > 1) {
+    /* the calling thread scans a slice of the files too */
+    return std::min<size_t>(
+        xb_fil_scan_threads - 1,
+        num_files / XB_FIL_SCAN_MIN_TABLESPACES_PER_THREAD);
+  }
+#endif /* XTRABACKUP */
+
   /* Number of additional threads required to scan all the files.
   n_threads == 0 means that the main thread itself will do all the
   work instead of spawning any additional threads. */
@@ -518,8 +552,11 @@ class Tablespace_dirs {
   void set_scan_dirs(const std::string &directories);
 
   /** Discover tablespaces by reading the header from .ibd files.
+  @param[in]  populate_fil_cache  Whether to load tablespaces into fil cache
+  @param[in]  undo_only           Only look for undo files at the top of the
+                                  directories
   @return DB_SUCCESS if all goes well */
-  [[nodiscard]] dberr_t scan(bool populate_fil_cache);
+  [[nodiscard]] dberr_t scan(bool populate_fil_cache, bool undo_only);
 
   /** Clear all the tablespace file data but leave the list of
   scanned directories in place. */
@@ -1700,8 +1737,8 @@ class Fil_system {
 
   /** Scan the directories to build the tablespace ID to file name
   mapping table. */
-  dberr_t scan(bool populate_fil_cache) {
-    return (m_dirs.scan(populate_fil_cache));
+  dberr_t scan(bool populate_fil_cache, bool undo_only) {
+    return (m_dirs.scan(populate_fil_cache, undo_only));
   }
 
   /** Open all known tablespaces. */
@@ -4096,6 +4133,43 @@ void fil_node_close_file(fil_node_t *file) {
   shard->mutex_release();
 }
 
+bool fil_node_open_private(fil_node_t *file, pfs_os_file_t &handle) {
+  fil_space_t *space = file->space;
+
+  auto shard = fil_system->shard_by_id(space->id);
+
+  shard->mutex_acquire();
+
+  bool was_open = file->is_open;
+  bool success = false;
+
+  if (was_open) {
+    /* Take over the file opened when the tablespace was loaded, it still
+    refers to the file that was validated */
+    handle = file->handle;
+    handle.m_file = dup(file->handle.m_file);
+#ifdef UNIV_PFS_IO
+    handle.m_psi = nullptr;
+#endif /* UNIV_PFS_IO */
+    success = handle.m_file != OS_FILE_CLOSED;
+
+    /* Give the slot of the file back to the LRU */
+    if (success && file->can_be_closed()) {
+      shard->close_file(file);
+    }
+  }
+
+  shard->mutex_release();
+
+  if (!was_open) {
+    handle = os_file_create_simple_no_error_handling(
+        innodb_data_file_key, file->name, OS_FILE_OPEN, OS_FILE_READ_ONLY,
+        true, &success);
+  }
+
+  return success;
+}
+
 #endif /* XTRABACKUP */
 
 /** Iterate through all tablespaces
@@ -11565,6 +11639,70 @@ std::tuple<dberr_t, space_id_t> fil_open_for_xtrabackup(
   return {DB_SUCCESS, space_id};
 }
 
+dberr_t fil_register_for_xtrabackup(const std::string &path,
+                                    const std::string &name,
+                                    space_id_t space_id, uint32_t flags,
+                                    page_no_t n_pages) {
+  if (fil_space_get(space_id)) {
+    return DB_TABLESPACE_EXISTS;
+  }
+
+  fil_space_t *space =
+      fil_space_create(name.c_str(), space_id, flags, FIL_TYPE_TABLESPACE);
+
+  ut_a(space != NULL);
+
+  char *fn = fil_node_create(path.c_str(), n_pages, space, false, false);
+  if (fn == nullptr) {
+    return DB_ERROR;
+  }
+
+  return DB_SUCCESS;
+}
+
+dberr_t fil_validate_for_xtrabackup(fil_space_t *space) {
+  const fil_node_t &node = space->files.front();
+
+  Datafile file;
+  file.set_name(space->name);
+  file.set_filepath(node.name);
+
+  dberr_t err = file.open_read_only(true);
+  if (err != DB_SUCCESS) {
+    return err;
+  }
+
+  lsn_t flush_lsn;
+  err = file.validate_first_page(space->id, &flush_lsn, false);
+  if (err == DB_PAGE_IS_BLANK) {
+    /* zero-filled first page, restored from the redo log on prepare */
+    err = DB_SUCCESS;
+  } else if (err == DB_SUCCESS && FSP_FLAGS_GET_ENCRYPTION(file.flags())) {
+    /* the dictionary does not tell whether the keys are in the file */
+    byte *key = file.m_encryption_key;
+    byte *iv = file.m_encryption_iv;
+
+    fsp_flags_set_encryption(space->flags);
+    if (key && iv) {
+      err = fil_set_encryption(space->id, Encryption::AES, key, iv);
+    }
+
+    ut_ad(err == DB_SUCCESS);
+  }
+  file.close();
+
+  if (err != DB_SUCCESS) {
+    return err;
+  }
+
+  if (srv_backup_mode && !srv_close_files && !fil_space_open(space->id)) {
+    xb::error() << "Failed to open tablespace " << space->name;
+    return DB_ERROR;
+  }
+
+  return DB_SUCCESS;
+}
+
 /** Open IBD tablespaces and load them to cache
 @param[in]  start   Start of slice
 @param[in]  end   End of slice
@@ -11574,6 +11712,8 @@ void Tablespace_dirs::open_ibd(const Const_iter &start, const Const_iter &end,
                                size_t thread_id, bool &result) {
   if (!result) return;
 
+  auto ahead = start;
+
   for (auto it = start; it != end; ++it) {
     const std::string filename = it->second;
     const auto &files = m_dirs[it->first];
@@ -11583,6 +11723,17 @@ void Tablespace_dirs::open_ibd(const Const_iter &start, const Const_iter &end,
       continue;
     }
 
+    /* keep the first pages of the next files in flight while this one is
+    validated */
+    for (; ahead != end &&
+           static_cast<size_t>(std::distance(it, ahead)) <
+               XB_FIL_SCAN_READ_AHEAD;
+         ++ahead) {
+      if (ahead == it || !check_if_skip_table(ahead->second.c_str())) {
+        fil_read_ahead_first_page(m_dirs[ahead->first].path() + ahead->second);
+      }
+    }
+
     /* cannot use auto [err, space_id] = fil_open_for_xtrabackup() as space_id
     is unused here and we get unused variable error during compilation */
     dberr_t err;
@@ -11631,11 +11782,24 @@ void Tablespace_dirs::duplicate_check(const Const_iter &start,
   bool printed_msg = false;
   auto start_time = std::chrono::steady_clock::now();
 
+#ifdef XTRABACKUP
+  auto ahead = start;
+#endif /* XTRABACKUP */
+
   for (auto it = start; it != end; ++it, ++m_checked) {
     const std::string filename = it->second;
     auto &files = m_dirs[it->first];
     const std::string phy_filename = files.path() + filename;
 
+#ifdef XTRABACKUP
+    for (; ahead != end &&
+           static_cast<size_t>(std::distance(it, ahead)) <
+               XB_FIL_SCAN_READ_AHEAD;
+         ++ahead) {
+      fil_read_ahead_first_page(m_dirs[ahead->first].path() + ahead->second);
+    }
+#endif /* XTRABACKUP */
+
     space_id_t space_id;
 
     space_id = Fil_system::get_tablespace_id(phy_filename);
@@ -11863,7 +12027,7 @@ void Tablespace_dirs::set_scan_dirs(const std::string &in_directories) {
 /** Discover tablespaces by reading the header from .ibd files.
 @param[in]      in_directories  Directories to scan
 @return DB_SUCCESS if all goes well */
-dberr_t Tablespace_dirs::scan(bool populate_fil_cache) {
+dberr_t Tablespace_dirs::scan(bool populate_fil_cache, bool undo_only) {
   Scanned_files ibd_files;
   Scanned_files undo_files;
   uint16_t count = 0;
@@ -11880,12 +12044,17 @@ dberr_t Tablespace_dirs::scan(bool populate_fil_cache) {
 
     /* Walk the sub-tree of dir. */
 
-    Dir_Walker::walk(real_path_dir, true, [&](const std::string &path) {
+    Dir_Walker::walk(real_path_dir, !undo_only, [&](const std::string &path) {
       /* If it is a file and the suffix matches ".ibd"
       or the undo file name format then store it for
       determining the space ID. */
 
       ut_a(path.length() > real_path_dir.length());
+
+      /* a walk that is not recursive reports the subdirectories too */
+      if (undo_only && Fil_path::get_file_type(path) == OS_FILE_TYPE_DIR) {
+        return;
+      }
       ut_a(Fil_path::get_file_type(path) != OS_FILE_TYPE_DIR);
 
       /* Make the filename relative to the directory that was scanned. */
@@ -11898,7 +12067,9 @@ dberr_t Tablespace_dirs::scan(bool populate_fil_cache) {
       using Value = Scanned_files::value_type;
 
       if (Fil_path::has_suffix(IBD, file.c_str())) {
-        ibd_files.push_back(Value{count, file});
+        if (!undo_only) {
+          ibd_files.push_back(Value{count, file});
+        }
 
       } else if (Fil_path::is_undo_tablespace_name(file)) {
         undo_files.push_back(Value{count, file});
@@ -11999,8 +12170,8 @@ void fil_set_scan_dirs(const std::string &directories) {
 /** Discover tablespaces by reading the header from .ibd files.
 @param[in]  populate_fil_cache Whether to load tablespaces into fil cache
 @return DB_SUCCESS if all goes well */
-dberr_t fil_scan_for_tablespaces(bool populate_fil_cache) {
-  return (fil_system->scan(populate_fil_cache));
+dberr_t fil_scan_for_tablespaces(bool populate_fil_cache, bool undo_only) {
+  return (fil_system->scan(populate_fil_cache, undo_only));
 }
 
 /** Open all known tablespaces. */
@@ -113,6 +113,15 @@ constexpr ulint MAX_PAGE_HASH_LOCKS = 1024;
 /** The buffer pools of the database */
 extern buf_pool_t *buf_pool_ptr;
 
+/** Advise the OS to back the buffer pool chunks with transparent huge pages,
+set by xtrabackup --prepare-huge-pages */
+extern bool buf_pool_madvise_hugepage;
+
+/** Fault in all the memory of the buffer pool with several threads when it is
+created, so that the page faults are not taken one by one on first use. Set
+by xtrabackup --prepare-huge-pages. */
+extern bool buf_pool_prefault;
+
 #ifdef UNIV_HOTBACKUP
 /** first block, for --apply-log */
 extern buf_block_t *back_block1;
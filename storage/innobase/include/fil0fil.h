@@ -1458,6 +1458,15 @@ bool fil_node_open_file(fil_node_t *file);
 @param[in] node file to close. */
 void fil_node_close_file(fil_node_t *node);
 
+/** Open a file of a tablespace with a handle owned by the caller. The handle
+does not count against the open files limit and is never closed by the LRU,
+the caller closes it with os_file_close(). If the file is open in the cache,
+its handle is duplicated and the cached one is closed.
+@param[in,out]  file    Tablespace file
+@param[out]     handle  file handle
+@return false if the file can't be opened, otherwise true */
+bool fil_node_open_private(fil_node_t *file, pfs_os_file_t &handle);
+
 #endif /* XTRABACKUP */
 /** Opens all log files and system tablespace data files.
 They stay open until the database server shutdown. This should be called
@@ -2169,6 +2178,26 @@ ignore redo log records during the apply phase */
 std::tuple<dberr_t, space_id_t> fil_open_for_xtrabackup(
     const std::string &path, const std::string &name);
 
+/** Add a tablespace known from the data dictionary of the server to the
+cache for backup, without reading its first page. The first page is checked
+by fil_validate_for_xtrabackup() before the tablespace is copied.
+@param[in]  path      file path
+@param[in]  name      space name
+@param[in]  space_id  tablespace ID
+@param[in]  flags     tablespace flags
+@param[in]  n_pages   file size in pages
+@return DB_SUCCESS, or DB_TABLESPACE_EXISTS if the space is cached already */
+dberr_t fil_register_for_xtrabackup(const std::string &path,
+                                    const std::string &name,
+                                    space_id_t space_id, uint32_t flags,
+                                    page_no_t n_pages);
+
+/** Check the first page of a tablespace added by
+fil_register_for_xtrabackup(), set up its encryption and open it.
+@param[in]  space  tablespace
+@return DB_SUCCESS or error code */
+dberr_t fil_validate_for_xtrabackup(fil_space_t *space);
+
 /** Open all known tablespaces. */
 void fil_open_ibds();
 
@@ -2184,8 +2213,12 @@ void fil_set_scan_dirs(const std::string &directories);
 
 /** Discover tablespaces by reading the header from .ibd files.
 @param[in]  populate_fil_cache Whether to load tablespaces into fil cache
+@param[in]  undo_only          Only look for undo files at the top of the
+                               directories, the .ibd files are known from
+                               the data dictionary
 @return DB_SUCCESS if all goes well */
-dberr_t fil_scan_for_tablespaces(bool populate_fil_cache);
+dberr_t fil_scan_for_tablespaces(bool populate_fil_cache,
+                                 bool undo_only = false);
 
 /** Open the tablespace and also get the tablespace filenames, space_id must
 already be known.
@@ -79,24 +79,36 @@ struct recv_sys_t {
   };
 
   struct space_page_t {
-    /** Default constructor */
-    space_page_t() : m_pages(), m_blocks() {}
-    std::unordered_set<page_no_t> m_pages;
-    std::vector<mem_block_t *> m_blocks;
+    /** Constructor
+    @param[in]	n	size of the first block of the heap. */
+    explicit space_page_t(ulint n) : m_pages(), m_n_pages(), m_block(n) {}
+
+    /** bitmap of the pages which have records, indexed by page number.
+    A bit per page of the tablespace stays small on long backups, where a
+    set of page numbers grew with every page modified. */
+    std::vector<bool> m_pages;
+
+    /** number of bits set in m_pages */
+    ulint m_n_pages;
+
+    /** last block of the heap, its total_size accounts for all the blocks */
+    mem_block_t m_block;
   };
 
   using Spaces =
-      std::unordered_map<space_id_t, space_page_t *, std::hash<space_id_t>,
+      std::unordered_map<space_id_t, space_page_t, std::hash<space_id_t>,
                          std::equal_to<space_id_t>>;
   Spaces *spaces;
+
+  /** space of the last parsed record, most records are for the same space
+  as the one before them */
+  space_page_t *last_space;
+
+  /** id of last_space */
+  space_id_t last_space_id;
+
   ~recv_sys_t() {
     if (this->spaces != nullptr) {
-      for (auto &space : *this->spaces) {
-        for (auto &block : space.second->m_blocks) {
-          delete (block);
-        }
-        delete (space.second);
-      }
       ut::delete_(this->spaces);
     }
   }
@@ -106,6 +118,10 @@ struct recv_sys_t {
 @retval amount of memory required for hash table of parsed records
 @retval number of database frames */
 std::pair<size_t, ulint> recv_backup_heap_used();
+
+/** calculates the memory used by --backup to estimate the memory of prepare
+@return size in bytes */
+size_t recv_backup_estimate_size();
 }  // namespace xtrabackup
 
 #endif /* XTRABACKUP */
@@ -61,6 +61,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA
 
 #include <functional>
 #include <stack>
+#include <utility>
+#include <vector>
 
 /** Prefix all files and directory created under data directory with special
 string so that it never conflicts with MySQL schema directory. */
@@ -1616,6 +1618,13 @@ bool os_aio_init(ulint n_readers, ulint n_writers);
 /** Starts one thread for each segment created in os_aio_init */
 void os_aio_start_threads();
 
+/** Register memory blocks with the kernel for the Linux native aio, so that
+the pages of the requests within them are not mapped for every request. Only
+the io_uring interface does it, see srv_use_io_uring.
+@param[in]      blocks  start and size of the memory blocks */
+void os_aio_register_buffers(
+    const std::vector<std::pair<byte *, size_t>> &blocks);
+
 /**
 Frees the asynchronous io system. */
 void os_aio_free();
@@ -392,6 +392,11 @@ OS (provided we compiled Innobase with it in), otherwise we will
 use simulated aio we build below with threads.
 Currently we support native aio on windows and linux */
 extern bool srv_use_native_aio;
+
+/** If this flag is true and srv_use_native_aio is set, the Linux native aio
+is done through io_uring instead of libaio, when InnoDB is compiled with
+liburing and the kernel supports it. */
+extern bool srv_use_io_uring;
 extern bool srv_numa_interleave;
 
 /* The innodb_directories variable value. This a list of directories
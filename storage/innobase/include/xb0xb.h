@@ -28,6 +28,7 @@ extern bool opt_lock_ddl_per_table;
 extern bool opt_lock_ddl;
 extern bool redo_catchup_completed;
 extern bool opt_page_tracking;
+extern bool xtrabackup_incremental_redo_scan;
 extern char *xtrabackup_incremental;
 extern lsn_t incremental_start_checkpoint_lsn;
 extern lsn_t xtrabackup_start_checkpoint;
@@ -86,12 +87,48 @@ extern size_t real_redo_memory;
 /** Number of total frames that will be required for prepare */
 extern ulint real_redo_frames;
 
+/** Number of batches planned at --prepare to apply the redo log in the buffer
+pool, from the estimation of the backup */
+extern ulint xb_recv_planned_batches;
+
+/** Number of batches of redo log records applied at --prepare */
+extern ulint xb_recv_applied_batches;
+
+/** Number of threads validating the first pages of the tablespaces found by
+the scan of the data directory, from --parallel. 0 or 1 keeps the default
+heuristics of InnoDB. */
+extern ulint xb_fil_scan_threads;
+
 /** This variables holds the result of all conditions that must be set in order
 to enable estimate memory functionality. Used at --prepare */
 extern bool estimate_memory;
 
 /** Parameter to enable estimate memory. Used at --backup */
 extern bool xtrabackup_estimate_memory;
+
+/** Called for the page of every page redo log record parsed at --backup while
+set. Used by --incremental-redo-scan to collect the pages changed before the
+start checkpoint */
+extern void (*xb_redo_page_hook)(space_id_t space_id, page_no_t page_no);
+
+/** Called for every MLOG_INDEX_LOAD record parsed at --backup after the redo
+catch-up while set, with the lsn of the record. Returns true if the pages the
+DDL bulk loaded into the tablespace are re-copied under the backup lock, the
+backup fails on the record otherwise */
+extern bool (*xb_index_load_hook)(space_id_t space_id, lsn_t lsn);
+
+/** Called for every MLOG_FILE_DELETE record of an undo tablespace parsed at
+--backup after the backup started while set, with the lsn of the record. An
+undo truncation deletes the file and creates it again with another space id.
+Returns true if the undo tablespace is re-copied under the backup lock, the
+backup fails on the record otherwise */
+extern bool (*xb_undo_truncate_hook)(space_id_t space_id, lsn_t lsn);
+
+/** Number of threads applying the redo log records at --prepare */
+extern uint xtrabackup_apply_log_threads;
+
+/** Number of threads rolling back the uncommitted transactions at --prepare */
+extern uint xtrabackup_rollback_threads;
 #define SQUOTE(str) "'" << str << "'"
 
 const std::string KEYRING_NOT_LOADED =
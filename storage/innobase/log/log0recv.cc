@@ -361,6 +361,7 @@ void recv_sys_create() {
       ut::zalloc_withkey(UT_NEW_THIS_FILE_PSI_KEY, sizeof(*pxb_recv_sys)));
 
   pxb_recv_sys->spaces = nullptr;
+  pxb_recv_sys->last_space = nullptr;
 #endif
 }
 
@@ -575,7 +576,7 @@ void recv_sys_init() {
 
 #ifdef XTRABACKUP
   if (estimate_memory) {
-    if (srv_buf_pool_curr_size >= (long long)real_redo_memory) {
+    if (xb_recv_planned_batches == 1) {
       if (recv_n_pool_free_frames < real_redo_frames) {
         xb::info() << "Setting free frames to " << real_redo_frames;
         recv_n_pool_free_frames = real_redo_frames;
@@ -602,6 +603,7 @@ void recv_sys_init() {
 #ifdef XTRABACKUP
   pxb_recv_sys->spaces =
       ut::new_withkey<xtrabackup::recv_sys_t::Spaces>(UT_NEW_THIS_FILE_PSI_KEY);
+  pxb_recv_sys->last_space = nullptr;
 #endif
   recv_sys->n_addrs = 0;
 
@@ -655,13 +657,14 @@ static void recv_sys_empty_hash() {
 
 #ifdef XTRABACKUP
 
-  if (estimate_memory && srv_buf_pool_curr_size < (long long)real_redo_memory) {
+  if (estimate_memory && xb_recv_planned_batches > 1) {
     recv_n_pool_free_frames = 0;
   }
   if (pxb_recv_sys->spaces == nullptr) return;
   ut::delete_(pxb_recv_sys->spaces);
   pxb_recv_sys->spaces =
       ut::new_withkey<xtrabackup::recv_sys_t::Spaces>(UT_NEW_THIS_FILE_PSI_KEY);
+  pxb_recv_sys->last_space = nullptr;
 
 #endif
 }
@@ -1199,6 +1202,8 @@ dberr_t recv_apply_hashed_log_recs(log_t &log, bool allow_ibuf) {
   recv_sys->apply_log_recs = true;
   recv_sys->apply_batch_on = true;
 
+  ++xb_recv_applied_batches;
+
   auto batch_size = recv_sys->n_addrs;
 
   ib::info(ER_IB_MSG_707, ulonglong{batch_size});
@@ -1216,6 +1221,8 @@ dberr_t recv_apply_hashed_log_recs(log_t &log, bool allow_ibuf) {
 
   auto start_time = std::chrono::steady_clock::now();
 
+  /* Open the tablespaces before the pages are applied, possibly by several
+  threads, and discard the pages of the dropped ones */
   for (const auto &space : *recv_sys->spaces) {
     bool dropped;
 
@@ -1241,33 +1248,95 @@ dberr_t recv_apply_hashed_log_recs(log_t &log, bool allow_ibuf) {
       }
     }
 
-    for (auto pages : space.second.m_pages) {
-      ut_ad(pages.second->space == space.first);
+    if (dropped) {
+      for (auto pages : space.second.m_pages) {
+        ut_ad(pages.second->space == space.first);
 
-      if (dropped) {
         pages.second->state = RECV_DISCARDED;
       }
+    }
+  }
+
+  /* Apply the pages of the n_thread-th out of n_threads partitions. The
+  partitions are made of the read ahead areas, so that recv_read_in_area()
+  reads the pages of a single thread. The pages of a tablespace are applied
+  in page number order, which issues the reads of the pages that are not in
+  the buffer pool in file offset order, up to an area at a time, ahead of
+  their application by the I/O completion. Called and returns with the mutex
+  held, which recv_apply_log_rec() releases while a page is read or
+  applied. */
+  auto apply = [&](size_t n_thread, size_t n_threads) {
+    std::vector<recv_addr_t *> recv_addrs;
+
+    for (const auto &space : *recv_sys->spaces) {
+      recv_addrs.clear();
+
+      for (auto pages : space.second.m_pages) {
+        ut_ad(pages.second->space == space.first);
+
+        if (n_threads > 1 &&
+            ut::hash_uint64_pair(space.first,
+                                 pages.first / RECV_READ_AHEAD_AREA) %
+                    n_threads !=
+                n_thread) {
+          continue;
+        }
+
+        recv_addrs.push_back(pages.second);
+      }
 
-      recv_apply_log_rec(pages.second);
+      std::sort(recv_addrs.begin(), recv_addrs.end(),
+                [](const recv_addr_t *a, const recv_addr_t *b) {
+                  return (a->page_no < b->page_no);
+                });
 
-      ++applied;
+      for (auto recv_addr : recv_addrs) {
+        recv_apply_log_rec(recv_addr);
 
-      if (unit == 0 || (applied % unit) == 0) {
-        ib::info(ER_IB_MSG_708) << pct << "%";
+        ++applied;
 
-        pct += PCT;
+        if (unit == 0 || (applied % unit) == 0) {
+          ib::info(ER_IB_MSG_708) << pct << "%";
 
-        start_time = std::chrono::steady_clock::now();
+          pct += PCT;
 
-      } else if (std::chrono::steady_clock::now() - start_time >=
-                 PRINT_INTERVAL) {
-        start_time = std::chrono::steady_clock::now();
+          start_time = std::chrono::steady_clock::now();
 
-        ib::info(ER_IB_MSG_709)
-            << std::setprecision(2)
-            << ((double)applied * 100) / (double)batch_size << "%";
+        } else if (std::chrono::steady_clock::now() - start_time >=
+                   PRINT_INTERVAL) {
+          start_time = std::chrono::steady_clock::now();
+
+          ib::info(ER_IB_MSG_709)
+              << std::setprecision(2)
+              << ((double)applied * 100) / (double)batch_size << "%";
+        }
       }
     }
+  };
+
+  const size_t n_threads = std::max(xtrabackup_apply_log_threads, 1U);
+
+  if (n_threads == 1) {
+    apply(0, 1);
+  } else {
+    std::vector<IB_thread> threads;
+
+    mutex_exit(&recv_sys->mutex);
+
+    for (size_t i = 0; i < n_threads; ++i) {
+      threads.push_back(os_thread_create(PFS_NOT_INSTRUMENTED, i, [&, i]() {
+        mutex_enter(&recv_sys->mutex);
+        apply(i, n_threads);
+        mutex_exit(&recv_sys->mutex);
+      }));
+      threads.back().start();
+    }
+
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    mutex_enter(&recv_sys->mutex);
   }
 
   /* Wait until all the pages have been processed */
@@ -1663,9 +1732,12 @@ static byte *recv_parse_or_apply_log_rec_body(
     case MLOG_FILE_DELETE:
 
 #ifdef XTRABACKUP
-      /* error out backup if undo truncation happens during backup */
+      /* error out backup if undo truncation happens during backup, unless
+      the truncated undo tablespace can be re-copied under the backup lock */
       if (srv_backup_mode && fsp_is_undo_tablespace(space_id) &&
-          backup_redo_log_flushed_lsn < recv_sys->recovered_lsn) {
+          backup_redo_log_flushed_lsn < recv_sys->recovered_lsn &&
+          (xb_undo_truncate_hook == nullptr ||
+           !xb_undo_truncate_hook(space_id, recv_sys->recovered_lsn))) {
         xb::info() << "Last flushed lsn: " << backup_redo_log_flushed_lsn
                    << " undo_delete lsn " << recv_sys->recovered_lsn;
 
@@ -1744,7 +1816,11 @@ static byte *recv_parse_or_apply_log_rec_body(
       of offline backup and continue. */
       if (!recv_recovery_on) {
         if (redo_catchup_completed) {
-          if (backup_redo_log_flushed_lsn < recv_sys->recovered_lsn) {
+          /* the pages of a DDL which finished during the copy of the
+          datafiles can also be re-copied under the backup lock */
+          if (backup_redo_log_flushed_lsn < recv_sys->recovered_lsn &&
+              (xb_index_load_hook == nullptr ||
+               !xb_index_load_hook(space_id, recv_sys->recovered_lsn))) {
             xb::info() << "Last flushed lsn: " << backup_redo_log_flushed_lsn
                        << " load_index lsn " << recv_sys->recovered_lsn;
 
@@ -1784,7 +1860,8 @@ static byte *recv_parse_or_apply_log_rec_body(
           // redo logging is skipped, PXB will fail to get those changed pages
           // (on disk .ibd but yet not on pagetracking). hence, we rely on
           // re-copying the datafiles.
-          if (opt_page_tracking && xtrabackup_incremental != nullptr &&
+          if ((opt_page_tracking || xtrabackup_incremental_redo_scan) &&
+              xtrabackup_incremental != nullptr &&
               recv_sys->recovered_lsn > incremental_start_checkpoint_lsn) {
             full_scan_tables.insert(space_id);
           }
@@ -1824,7 +1901,8 @@ static byte *recv_parse_or_apply_log_rec_body(
           incremental backup. This way we would have the latest state of
           tablespace and redo apply will skip all the redo generated on the
           tablespace. */
-          if (opt_page_tracking && xtrabackup_incremental != nullptr &&
+          if ((opt_page_tracking || xtrabackup_incremental_redo_scan) &&
+              xtrabackup_incremental != nullptr &&
               recv_sys->recovered_lsn > incremental_start_checkpoint_lsn) {
             full_scan_tables.insert(space_id);
           }
@@ -2582,16 +2660,23 @@ std::pair<size_t, ulint> recv_backup_heap_used() {
   size_t size = 0;
   ulint pages = 0;
   for (auto &space : *pxb_recv_sys->spaces) {
-    pxb_mem_block *block = space.second->m_blocks.back();
-    size += block->total_size;
-    if (space.second->m_pages.size() >= 1) {
-      pages += space.second->m_pages.size();
-    }
+    size += space.second.m_block.total_size;
+    pages += space.second.m_n_pages;
   }
 
   return std::make_pair(size, pages);
 }
 
+size_t recv_backup_estimate_size() {
+  size_t size = sizeof(pxb_spaces);
+  for (auto &space : *pxb_recv_sys->spaces) {
+    size += sizeof(pxb_spaces::value_type) +
+            space.second.m_pages.capacity() / CHAR_BIT;
+  }
+
+  return (size);
+}
+
 /*
  * This function mimics the calculation done at
  * recv_add_to_hash_table->mem_heap_alloc. We call this during --backup from
@@ -2601,11 +2686,9 @@ std::pair<size_t, ulint> recv_backup_heap_used() {
  * required based on log records parsed so far.
  */
 static pxb_mem_block *add_new_block(pxb_space_page *space, ulint size) {
-  pxb_mem_block *block;
-  pxb_mem_block *new_block = new pxb_mem_block();
+  pxb_mem_block *new_block = &space->m_block;
   ulint new_size;
-  block = space->m_blocks.back();
-  new_size = 2 * block->len;
+  new_size = 2 * new_block->len;
   if (new_size > MEM_MAX_ALLOC_IN_BUF) {
     new_size = MEM_MAX_ALLOC_IN_BUF;
   }
@@ -2617,9 +2700,8 @@ static pxb_mem_block *add_new_block(pxb_space_page *space, ulint size) {
   if (len >= UNIV_PAGE_SIZE / 2) len = UNIV_PAGE_SIZE;
 
   new_block->len = len;
-  new_block->total_size = block->total_size + len;
+  new_block->total_size += len;
   new_block->free = MEM_BLOCK_HEADER_SIZE;
-  space->m_blocks.push_back(new_block);
 
   return new_block;
 }
@@ -2628,23 +2710,24 @@ static pxb_mem_block *add_new_block(pxb_space_page *space, ulint size) {
 @param[in]	space_id	Tablespace ID for which page map required.
 @return the space data  */
 static pxb_space_page *recv_get_page_map(space_id_t space_id) {
+  if (pxb_recv_sys->last_space != nullptr &&
+      pxb_recv_sys->last_space_id == space_id) {
+    return (pxb_recv_sys->last_space);
+  }
+
   auto it = pxb_recv_sys->spaces->find(space_id);
 
-  if (it != pxb_recv_sys->spaces->end()) {
-    return (it->second);
-  }
+  if (it == pxb_recv_sys->spaces->end()) {
+    ulint len = MEM_BLOCK_HEADER_SIZE + MEM_SPACE_NEEDED(256);
 
-  ulint len = MEM_BLOCK_HEADER_SIZE + MEM_SPACE_NEEDED(256);
-  pxb_mem_block *block = new pxb_mem_block(len);
-  pxb_space_page *space_page = new pxb_space_page();
-  space_page->m_blocks.push_back(block);
-  using Space = xtrabackup::recv_sys_t::space_page_t *;
-  using Value = xtrabackup::recv_sys_t::Spaces::value_type;
+    it = pxb_recv_sys->spaces->emplace(space_id, pxb_space_page(len)).first;
+  }
 
-  auto where =
-      pxb_recv_sys->spaces->insert(it, Value({space_id, Space(space_page)}));
+  /* the elements of an unordered_map are not moved by a rehash */
+  pxb_recv_sys->last_space = &it->second;
+  pxb_recv_sys->last_space_id = space_id;
 
-  return (where->second);
+  return (pxb_recv_sys->last_space);
 }
 
 /*
@@ -2669,19 +2752,24 @@ static void recv_calculate_hash_heap(mlog_id_t type, space_id_t space_id,
   /* check if we already have a Heap for this space id */
   auto space = xtrabackup::recv_get_page_map(space_id);
 
-  pxb_mem_block *last_block = space->m_blocks.back();
+  pxb_mem_block *last_block = &space->m_block;
   if (last_block->len < (last_block->free + MEM_SPACE_NEEDED(sizeof(recv_t)))) {
     last_block = xtrabackup::add_new_block(space, sizeof(recv_t));
   }
   last_block->free = last_block->free + MEM_SPACE_NEEDED(sizeof(recv_t));
 
-  if (space->m_pages.find(page_no) == space->m_pages.end()) {
+  if (page_no >= space->m_pages.size()) {
+    space->m_pages.resize(page_no + 1);
+  }
+
+  if (!space->m_pages[page_no]) {
     if (last_block->len <
         (last_block->free + MEM_SPACE_NEEDED(sizeof(recv_addr_t)))) {
       last_block = xtrabackup::add_new_block(space, sizeof(recv_addr_t));
     }
     last_block->free = last_block->free + MEM_SPACE_NEEDED(sizeof(recv_addr_t));
-    space->m_pages.insert(page_no);
+    space->m_pages[page_no] = true;
+    ++space->m_n_pages;
   }
 
   while (rec_end > body) {
@@ -3367,6 +3455,8 @@ static bool recv_single_rec(byte *ptr, byte *end_ptr) {
           recv_sys->missing_ids.insert(space_id);
         }
 #endif /* !UNIV_HOTBACKUP */
+      } else if (xb_redo_page_hook != nullptr) {
+        xb_redo_page_hook(space_id, page_no);
       } else if (xtrabackup_estimate_memory) {
         xtrabackup::recv_calculate_hash_heap(type, space_id, page_no, body,
                                              ptr + len, old_lsn);
@@ -3553,6 +3643,8 @@ static bool recv_multi_rec(byte *ptr, byte *end_ptr) {
             recv_sys->missing_ids.insert(space_id);
           }
 #endif /* !UNIV_HOTBACKUP */
+        } else if (xb_redo_page_hook != nullptr) {
+          xb_redo_page_hook(space_id, page_no);
         } else if (xtrabackup_estimate_memory) {
           xtrabackup::recv_calculate_hash_heap(type, space_id, page_no, body,
                                                ptr + len, old_lsn);
@@ -50,6 +50,11 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA
 #include "mysqld.h"
 #if defined(XTRABACKUP)
 #include "xb0xb.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
 #endif
 
 namespace innobase {
@@ -276,6 +281,35 @@ void Encryption::create_master_key(byte **master_key) noexcept {
 #endif /* !UNIV_HOTBACKUP */
 }
 
+#if defined(XTRABACKUP)
+/** Master keys fetched from the keyring, by key name. A backup decrypts the
+key of every encrypted tablespace with the few master keys that encrypted
+them, one keyring request per tablespace would make it bound by the latency
+of a remote keyring. A master key never changes once created, a rotation
+creates a key with a new id. */
+static std::map<std::string, std::vector<byte>> master_key_cache;
+static std::mutex master_key_cache_mutex;
+
+/** Copy a cached master key.
+@param[in]      key_name        name of the master key
+@param[out]     master_key      copy of the key, to be freed with my_free()
+@return true if the key was cached */
+static bool master_key_cache_get(const char *key_name, byte **master_key) {
+  std::lock_guard<std::mutex> lock(master_key_cache_mutex);
+  auto it = master_key_cache.find(key_name);
+  if (it == master_key_cache.end()) {
+    return false;
+  }
+  *master_key = static_cast<byte *>(
+      my_malloc(PSI_INSTRUMENT_ME, it->second.size(), MYF(MY_WME)));
+  if (*master_key == nullptr) {
+    return false;
+  }
+  memcpy(*master_key, it->second.data(), it->second.size());
+  return true;
+}
+#endif /* XTRABACKUP */
+
 void Encryption::get_master_key(uint32_t master_key_id, char *srv_uuid,
                                 byte **master_key) noexcept {
   size_t key_len = 0;
@@ -297,6 +331,12 @@ void Encryption::get_master_key(uint32_t master_key_id, char *srv_uuid,
              MASTER_KEY_PREFIX, server_id, master_key_id);
   }
 
+#if defined(XTRABACKUP)
+  if (master_key_cache_get(key_name, master_key)) {
+    return;
+  }
+#endif /* XTRABACKUP */
+
 #ifndef UNIV_HOTBACKUP
   /* We call keyring API to get master key here. */
   int ret =
@@ -326,6 +366,14 @@ void Encryption::get_master_key(uint32_t master_key_id, char *srv_uuid,
                              << " please check the keyring is loaded.";
   }
 
+#if defined(XTRABACKUP)
+  if (ret == 0 && *master_key != nullptr && key_len > 0) {
+    std::lock_guard<std::mutex> lock(master_key_cache_mutex);
+    master_key_cache.emplace(
+        key_name, std::vector<byte>(*master_key, *master_key + key_len));
+  }
+#endif /* XTRABACKUP */
+
 #ifdef UNIV_ENCRYPT_DEBUG
   if (ret == 0 && *master_key != nullptr) {
     std::ostringstream msg;
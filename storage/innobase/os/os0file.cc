@@ -76,6 +76,17 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA
 #endif /* !UNIV_HOTBACKUP */
 #endif /* LINUX_NATIVE_AIO */
 
+/* io_uring is an alternative interface of the Linux native aio */
+#ifdef HAVE_LIBURING
+#ifdef LINUX_NATIVE_AIO
+#include <liburing.h>
+#include <algorithm>
+#include <mutex>
+#else /* LINUX_NATIVE_AIO */
+#undef HAVE_LIBURING
+#endif /* LINUX_NATIVE_AIO */
+#endif /* HAVE_LIBURING */
+
 #ifdef HAVE_FALLOC_PUNCH_HOLE_AND_KEEP_SIZE
 #include <fcntl.h>
 #include <linux/falloc.h>
@@ -553,6 +564,37 @@ class AIO {
   [[nodiscard]] static bool is_linux_native_aio_supported();
 #endif /* LINUX_NATIVE_AIO */
 
+#ifdef HAVE_LIBURING
+  /** Submit an AIO request to the io_uring of its segment.
+  @param[in,out]        slot    an already reserved slot
+  @param[in]    segment local segment of the slot
+  @return 0 on success, -errno on failure */
+  [[nodiscard]] int uring_submit(Slot *slot, ulint segment);
+
+  /** Accessor for the io_uring
+  @param[in]    segment Segment for which to get the io_uring
+  @return the io_uring of the segment */
+  [[nodiscard]] io_uring *uring(ulint segment) {
+    ut_ad(segment < get_n_segments());
+
+    return (&m_urings[segment].ring);
+  }
+
+  /** Checks if the kernel supports io_uring with the features that the
+  io-threads need to wait for completions with a timeout.
+  @return true if supported, false otherwise. */
+  [[nodiscard]] static bool is_io_uring_supported();
+
+  /** Register memory blocks with the io_urings of all the arrays.
+  @param[in]    blocks  memory blocks
+  @return true on success */
+  static bool uring_register_buffers(
+      const std::vector<std::pair<byte *, size_t>> &blocks);
+
+  /** Unregister the memory blocks registered with the io_urings. */
+  static void uring_unregister_buffers();
+#endif /* HAVE_LIBURING */
+
 #ifdef WIN_ASYNC_IO
   /** Wakes up all async i/o threads in the array in Windows async I/O at
   shutdown. */
@@ -710,6 +752,18 @@ class AIO {
   [[nodiscard]] dberr_t init_linux_native_aio();
 #endif /* LINUX_NATIVE_AIO */
 
+#ifdef HAVE_LIBURING
+  /** Initialise the io_urings of the Linux native AIO
+  @return DB_SUCCESS or error code */
+  [[nodiscard]] dberr_t init_linux_io_uring();
+
+  /** Find the registered buffer holding the buffer of a request.
+  @param[in]    ptr     start of the buffer of the request
+  @param[in]    len     length of the buffer of the request
+  @return index of the registered buffer, or -1 if none holds it */
+  [[nodiscard]] static int uring_buffer_index(const byte *ptr, ulint len);
+#endif /* HAVE_LIBURING */
+
  private:
   typedef std::vector<Slot> Slots;
 
@@ -765,6 +819,28 @@ class AIO {
   IOEvents m_events;
 #endif /* LINUX_NATIV_AIO */
 
+#ifdef HAVE_LIBURING
+  /** io_uring of a segment, used instead of its io_context when
+  srv_use_io_uring is set */
+  struct Uring {
+    /** submission and completion queues */
+    io_uring ring;
+
+    /** serializes the submissions. The completions are reaped by the
+    io-thread of the segment only. */
+    std::mutex mutex;
+  };
+
+  /** One io_uring per segment, nullptr when libaio is used */
+  Uring *m_urings;
+
+  /** Memory blocks registered with all the io_urings, sorted by address */
+  static std::vector<iovec> s_uring_buffers;
+
+  /** true if s_uring_buffers are registered and can be used */
+  static std::atomic<bool> s_uring_buffers_registered;
+#endif /* HAVE_LIBURING */
+
   /** The aio arrays for non-ibuf i/o and ibuf i/o. These are NULL when the
   module has not yet been initialized. */
 
@@ -782,6 +858,10 @@ class AIO {
 AIO *AIO::s_reads;
 AIO *AIO::s_writes;
 AIO *AIO::s_ibuf;
+#ifdef HAVE_LIBURING
+std::vector<iovec> AIO::s_uring_buffers;
+std::atomic<bool> AIO::s_uring_buffers_registered;
+#endif /* HAVE_LIBURING */
 
 #if defined(LINUX_NATIVE_AIO)
 /** timeout for each io_getevents() call = 500ms. */
@@ -2160,6 +2240,17 @@ class LinuxAIOHandler {
   each wakeup and that is why we use timed wait in io_getevents(). */
   void collect();
 
+#ifdef HAVE_LIBURING
+  /** Same as collect(), for the io_uring of the segment. The io-thread
+  waits for completions with a timeout instead of in io_getevents(). */
+  void collect_uring();
+#endif /* HAVE_LIBURING */
+
+  /** Mark the request of a slot as completed by the kernel.
+  @param[in,out]        slot    slot of the completed request
+  @param[in]    res     number of bytes read or written, or -errno */
+  void complete(Slot *slot, ssize_t res);
+
  private:
   /** Slot array */
   AIO *m_array;
@@ -2201,6 +2292,19 @@ dberr_t LinuxAIOHandler::resubmit(Slot *slot) {
 
   /* make sure that slot->offset fits in off_t */
   ut_ad(sizeof(off_t) >= sizeof(os_offset_t));
+
+#ifdef HAVE_LIBURING
+  if (srv_use_io_uring) {
+    int ret = m_array->uring_submit(slot, m_segment);
+
+    if (ret < 0) {
+      errno = -ret;
+    }
+
+    return (ret < 0 ? DB_IO_PARTIAL_FAILED : DB_SUCCESS);
+  }
+#endif /* HAVE_LIBURING */
+
   struct iocb *iocb = &slot->control;
   if (slot->type.is_read()) {
     io_prep_pread(iocb, slot->file.m_file, slot->ptr, slot->len, slot->offset);
@@ -2348,43 +2452,14 @@ void LinuxAIOHandler::collect() {
       /* We have not overstepped to next segment. */
       ut_a(slot->pos < end_pos);
 
-      /** If write of the page is compressed (compression is enabled, it is not
-      the first page, it is not a redolog, not a doublewrite buffer) and punch
-      holes are enabled, call AIOHandler::io_complete to check if hole punching
-      is needed.
-      Keep in sync with os_aio_windows_handler(). */
-      if (slot->offset > 0 && !slot->skip_punch_hole &&
-          slot->type.is_compression_enabled() && !slot->type.is_log() &&
-          slot->type.is_write() && slot->type.is_compressed() &&
-          slot->type.punch_hole() && !slot->type.is_dblwr()) {
-        slot->err = AIOHandler::io_complete(slot);
-      } else {
-        slot->err = DB_SUCCESS;
-      }
-
-      /* Mark this request as completed. The error handling
-      will be done in the calling function. */
-      m_array->acquire();
-
       /* events[i].res2 should always be ZERO */
       ut_ad(events[i].res2 == 0);
-      slot->io_already_done = true;
 
       /* Even though events[i].res is an unsigned number in libaio, it is
       used to return a negative value (negated errno value) to indicate
       error and a positive value to indicate number of bytes read or
       written. */
-
-      if (events[i].res > slot->len) {
-        /* failure */
-        slot->n_bytes = 0;
-        slot->ret = events[i].res;
-      } else {
-        /* success */
-        slot->n_bytes = events[i].res;
-        slot->ret = 0;
-      }
-      m_array->release();
+      complete(slot, static_cast<ssize_t>(events[i].res));
     }
 
     if (srv_shutdown_state.load() == SRV_SHUTDOWN_EXIT_THREADS ||
@@ -2421,6 +2496,119 @@ void LinuxAIOHandler::collect() {
   }
 }
 
+/** Mark the request of a slot as completed by the kernel.
+@param[in,out]  slot            slot of the completed request
+@param[in]      res             number of bytes read or written, or -errno */
+void LinuxAIOHandler::complete(Slot *slot, ssize_t res) {
+  /** If write of the page is compressed (compression is enabled, it is not
+  the first page, it is not a redolog, not a doublewrite buffer) and punch
+  holes are enabled, call AIOHandler::io_complete to check if hole punching
+  is needed.
+  Keep in sync with os_aio_windows_handler(). */
+  if (slot->offset > 0 && !slot->skip_punch_hole &&
+      slot->type.is_compression_enabled() && !slot->type.is_log() &&
+      slot->type.is_write() && slot->type.is_compressed() &&
+      slot->type.punch_hole() && !slot->type.is_dblwr()) {
+    slot->err = AIOHandler::io_complete(slot);
+  } else {
+    slot->err = DB_SUCCESS;
+  }
+
+  /* Mark this request as completed. The error handling
+  will be done in the calling function. */
+  m_array->acquire();
+
+  slot->io_already_done = true;
+
+  if (res < 0 || static_cast<ulint>(res) > slot->len) {
+    /* failure */
+    slot->n_bytes = 0;
+    slot->ret = static_cast<int>(res);
+  } else {
+    /* success */
+    slot->n_bytes = res;
+    slot->ret = 0;
+  }
+  m_array->release();
+}
+
+#ifdef HAVE_LIBURING
+/** Same as LinuxAIOHandler::collect(), for the io_uring of the segment.
+The io-thread waits for completions with a timeout, which the kernel handles
+without a timeout request in the submission queue, see
+AIO::is_io_uring_supported(). */
+void LinuxAIOHandler::collect_uring() {
+  ut_ad(m_n_slots > 0);
+  ut_ad(m_segment < m_array->get_n_segments());
+
+  io_uring *ring = m_array->uring(m_segment);
+
+  /* Starting point of the m_segment we will be working on. */
+  ulint start_pos = m_segment * m_n_slots;
+
+  /* End point. */
+  ulint end_pos = start_pos + m_n_slots;
+
+  for (;;) {
+    struct __kernel_timespec timeout;
+
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = OS_AIO_REAP_TIMEOUT;
+
+    struct io_uring_cqe *cqe;
+
+    auto ret = io_uring_wait_cqe_timeout(ring, &cqe, &timeout);
+
+    if (ret == 0) {
+      unsigned head;
+      unsigned n_cqes = 0;
+
+      io_uring_for_each_cqe(ring, head, cqe) {
+        auto slot = static_cast<Slot *>(io_uring_cqe_get_data(cqe));
+
+        /* Some sanity checks. */
+        ut_a(slot != nullptr);
+        ut_a(slot->is_reserved);
+
+        /* We are not scribbling previous segment. */
+        ut_a(slot->pos >= start_pos);
+
+        /* We have not overstepped to next segment. */
+        ut_a(slot->pos < end_pos);
+
+        complete(slot, cqe->res);
+
+        ++n_cqes;
+      }
+
+      io_uring_cq_advance(ring, n_cqes);
+    }
+
+    if (srv_shutdown_state.load() == SRV_SHUTDOWN_EXIT_THREADS ||
+        !buf_flush_page_cleaner_is_active() || ret == 0) {
+      break;
+    }
+
+    switch (ret) {
+      case -ETIME:
+        /* No completed request! Go back and check again. */
+
+      case -EAGAIN:
+      case -EINTR:
+
+        continue;
+    }
+
+    /* All other errors should cause a trap for now. */
+    ib::fatal(UT_LOCATION_HERE, ER_IB_MSG_755)
+        << "Unexpected ret_code[" << ret
+        << "] from io_uring_wait_cqe_timeout()!";
+
+    break;
+  }
+}
+#endif /* HAVE_LIBURING */
+
 /** Process a Linux AIO request
 @param[out]     m1              the messages passed with the
 @param[out]     m2              AIO request; note that in case the
@@ -2476,6 +2664,13 @@ dberr_t LinuxAIOHandler::poll(fil_node_t **m1, void **m2, IORequest *request) {
       srv_set_io_thread_op_info(m_global_segment,
                                 "waiting for completed aio requests");
 
+#ifdef HAVE_LIBURING
+      if (srv_use_io_uring) {
+        collect_uring();
+        continue;
+      }
+#endif /* HAVE_LIBURING */
+
       collect();
     }
   }
@@ -2552,6 +2747,18 @@ bool AIO::linux_dispatch(Slot *slot) {
 
   io_ctx_index = (slot->pos * m_n_segments) / m_slots.size();
 
+#ifdef HAVE_LIBURING
+  if (srv_use_io_uring) {
+    int ret = uring_submit(slot, io_ctx_index);
+
+    if (ret < 0) {
+      errno = -ret;
+    }
+
+    return (ret == 0);
+  }
+#endif /* HAVE_LIBURING */
+
   int ret = io_submit(m_aio_ctx[io_ctx_index], 1, &iocb);
 
   /* io_submit() returns number of successfully queued requests
@@ -2564,6 +2771,197 @@ bool AIO::linux_dispatch(Slot *slot) {
   return (ret == 1);
 }
 
+#ifdef HAVE_LIBURING
+/** Submit an AIO request to the io_uring of its segment. The request is
+described by the fields of the slot, the iocb of libaio is not used.
+@param[in,out]  slot            an already reserved slot
+@param[in]      segment         local segment of the slot
+@return 0 on success, -errno on failure */
+int AIO::uring_submit(Slot *slot, ulint segment) {
+  ut_a(slot->is_reserved);
+  ut_ad(segment == (slot->pos * m_n_segments) / m_slots.size());
+
+  Uring &uring = m_urings[segment];
+
+  const int buf_index = uring_buffer_index(slot->ptr, slot->len);
+
+  std::lock_guard<std::mutex> guard(uring.mutex);
+
+  /* The submission queue has an entry for every slot of the segment and
+  the entries are consumed by io_uring_submit() below. */
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&uring.ring);
+
+  if (sqe == nullptr) {
+    return (-EBUSY);
+  }
+
+  if (slot->type.is_read()) {
+    if (buf_index >= 0) {
+      io_uring_prep_read_fixed(sqe, slot->file.m_file, slot->ptr, slot->len,
+                               slot->offset, buf_index);
+    } else {
+      io_uring_prep_read(sqe, slot->file.m_file, slot->ptr, slot->len,
+                         slot->offset);
+    }
+  } else {
+    ut_a(slot->type.is_write());
+
+    if (buf_index >= 0) {
+      io_uring_prep_write_fixed(sqe, slot->file.m_file, slot->ptr, slot->len,
+                                slot->offset, buf_index);
+    } else {
+      io_uring_prep_write(sqe, slot->file.m_file, slot->ptr, slot->len,
+                          slot->offset);
+    }
+  }
+
+  io_uring_sqe_set_data(sqe, slot);
+
+  /* io_uring_submit() returns the number of submitted requests or
+  -errno. */
+  int ret = io_uring_submit(&uring.ring);
+
+  return (ret == 1 ? 0 : (ret < 0 ? ret : -EIO));
+}
+
+/** Find the registered buffer holding the buffer of a request.
+@param[in]      ptr             start of the buffer of the request
+@param[in]      len             length of the buffer of the request
+@return index of the registered buffer, or -1 if none holds it */
+int AIO::uring_buffer_index(const byte *ptr, ulint len) {
+  if (!s_uring_buffers_registered.load(std::memory_order_acquire)) {
+    return (-1);
+  }
+
+  auto it = std::upper_bound(
+      s_uring_buffers.begin(), s_uring_buffers.end(), ptr,
+      [](const byte *p, const iovec &buffer) {
+        return (p < static_cast<const byte *>(buffer.iov_base));
+      });
+
+  if (it == s_uring_buffers.begin()) {
+    return (-1);
+  }
+
+  --it;
+
+  const byte *base = static_cast<const byte *>(it->iov_base);
+
+  if (ptr + len > base + it->iov_len) {
+    return (-1);
+  }
+
+  return (static_cast<int>(it - s_uring_buffers.begin()));
+}
+
+/** Checks if the kernel supports io_uring with the features that the
+io-threads need to wait for completions with a timeout. Without
+IORING_FEAT_EXT_ARG, io_uring_wait_cqe_timeout() queues a timeout request
+which would race with the submissions of the other threads.
+@return true if supported, false otherwise. */
+bool AIO::is_io_uring_supported() {
+  struct io_uring ring;
+
+  int ret = io_uring_queue_init(1, &ring, 0);
+
+  if (ret < 0) {
+    ib::warn() << "io_uring_queue_init() failed: " << strerror(-ret);
+
+    return (false);
+  }
+
+#ifdef IORING_FEAT_EXT_ARG
+  const bool supported = (ring.features & IORING_FEAT_EXT_ARG) != 0;
+#else  /* IORING_FEAT_EXT_ARG */
+  const bool supported = false;
+#endif /* IORING_FEAT_EXT_ARG */
+
+  io_uring_queue_exit(&ring);
+
+  if (!supported) {
+    ib::warn() << "io_uring of this kernel cannot wait for completions with"
+                  " a timeout, Linux 5.11 or newer is needed.";
+  }
+
+  return (supported);
+}
+
+/** Register memory blocks with the io_urings of all the arrays. The kernel
+then maps the pages of the blocks once, instead of for every request.
+@param[in]      blocks          memory blocks
+@return true on success */
+bool AIO::uring_register_buffers(
+    const std::vector<std::pair<byte *, size_t>> &blocks) {
+  /* The kernel takes at most 1GiB per buffer */
+  static constexpr size_t MAX_BUFFER_SIZE = 1024 * 1024 * 1024;
+
+  ut_a(!s_uring_buffers_registered.load());
+
+  s_uring_buffers.clear();
+
+  for (const auto &block : blocks) {
+    for (size_t offset = 0; offset < block.second;
+         offset += MAX_BUFFER_SIZE) {
+      iovec buffer;
+
+      buffer.iov_base = block.first + offset;
+      buffer.iov_len = std::min(block.second - offset, MAX_BUFFER_SIZE);
+
+      s_uring_buffers.push_back(buffer);
+    }
+  }
+
+  std::sort(s_uring_buffers.begin(), s_uring_buffers.end(),
+            [](const iovec &a, const iovec &b) {
+              return (a.iov_base < b.iov_base);
+            });
+
+  for (AIO *array : {s_ibuf, s_reads, s_writes}) {
+    if (array == nullptr || array->m_urings == nullptr) {
+      continue;
+    }
+
+    for (ulint i = 0; i < array->m_n_segments; ++i) {
+      int ret = io_uring_register_buffers(&array->m_urings[i].ring,
+                                          s_uring_buffers.data(),
+                                          s_uring_buffers.size());
+
+      if (ret < 0) {
+        ib::warn() << "io_uring_register_buffers() failed: "
+                   << strerror(-ret) << ", the " << s_uring_buffers.size()
+                   << " buffers are not registered.";
+
+        uring_unregister_buffers();
+
+        return (false);
+      }
+    }
+  }
+
+  s_uring_buffers_registered.store(true, std::memory_order_release);
+
+  return (true);
+}
+
+/** Unregister the memory blocks registered with the io_urings. */
+void AIO::uring_unregister_buffers() {
+  s_uring_buffers_registered.store(false);
+
+  for (AIO *array : {s_ibuf, s_reads, s_writes}) {
+    if (array == nullptr || array->m_urings == nullptr) {
+      continue;
+    }
+
+    for (ulint i = 0; i < array->m_n_segments; ++i) {
+      /* Fails for the rings whose registration failed, which is fine */
+      io_uring_unregister_buffers(&array->m_urings[i].ring);
+    }
+  }
+
+  s_uring_buffers.clear();
+}
+#endif /* HAVE_LIBURING */
+
 /** Creates an io_context for native linux AIO.
 @param[in]      max_events      number of events
 @param[out]     io_ctx          io_ctx to initialize.
@@ -6098,6 +6496,10 @@ AIO::AIO(latch_id_t id, ulint n, ulint segments)
       ,
       m_aio_ctx(),
       m_events(m_slots.size())
+#ifdef HAVE_LIBURING
+      ,
+      m_urings()
+#endif /* HAVE_LIBURING */
 #elif defined(_WIN32)
       ,
       m_handles()
@@ -6187,6 +6589,38 @@ dberr_t AIO::init_linux_native_aio() {
 }
 #endif /* LINUX_NATIVE_AIO */
 
+#ifdef HAVE_LIBURING
+/** Initialise the io_urings of the Linux native AIO. The queues are as deep
+as the segments, so that all the slots of a segment can be in flight. */
+dberr_t AIO::init_linux_io_uring() {
+  ut_a(m_urings == nullptr);
+
+  m_urings = ut::new_arr_withkey<Uring>(UT_NEW_THIS_FILE_PSI_KEY,
+                                        ut::Count{m_n_segments});
+
+  if (m_urings == nullptr) {
+    return (DB_OUT_OF_MEMORY);
+  }
+
+  ulint max_events = slots_per_segment();
+
+  for (ulint i = 0; i < m_n_segments; ++i) {
+    int ret = io_uring_queue_init(max_events, &m_urings[i].ring, 0);
+
+    if (ret < 0) {
+      /* Same as in init_linux_native_aio(), the server is not going
+      to start up. */
+      ib::error() << "io_uring_queue_init() failed with " << max_events
+                  << " entries: " << strerror(-ret);
+
+      return (DB_IO_ERROR);
+    }
+  }
+
+  return (DB_SUCCESS);
+}
+#endif /* HAVE_LIBURING */
+
 /** Initialise the array */
 dberr_t AIO::init() {
   ut_a(!m_slots.empty());
@@ -6200,7 +6634,12 @@ dberr_t AIO::init() {
 
   if (srv_use_native_aio) {
 #ifdef LINUX_NATIVE_AIO
+#ifdef HAVE_LIBURING
+    dberr_t err =
+        srv_use_io_uring ? init_linux_io_uring() : init_linux_native_aio();
+#else  /* HAVE_LIBURING */
     dberr_t err = init_linux_native_aio();
+#endif /* HAVE_LIBURING */
 
     if (err != DB_SUCCESS) {
       return (err);
@@ -6266,6 +6705,15 @@ AIO::~AIO() {
   }
 #endif /* LINUX_NATIVE_AIO */
 
+#ifdef HAVE_LIBURING
+  if (m_urings != nullptr) {
+    for (ulint i = 0; i < m_n_segments; ++i) {
+      io_uring_queue_exit(&m_urings[i].ring);
+    }
+    ut::delete_arr(m_urings);
+  }
+#endif /* HAVE_LIBURING */
+
   m_slots.clear();
 }
 
@@ -6279,6 +6727,23 @@ bool AIO::start(ulint n_per_seg, ulint n_readers, ulint n_writers) {
   }
 #endif /* LINUX_NATIVE_AIO */
 
+#ifdef HAVE_LIBURING
+  if (srv_use_io_uring && (!srv_use_native_aio || !is_io_uring_supported())) {
+    if (srv_use_native_aio) {
+      ib::warn() << "Using Linux native AIO through libaio instead of"
+                    " io_uring.";
+    }
+
+    srv_use_io_uring = false;
+  }
+
+  if (srv_use_io_uring) {
+    ib::info() << "Using Linux native AIO through io_uring.";
+  }
+#else  /* HAVE_LIBURING */
+  srv_use_io_uring = false;
+#endif /* HAVE_LIBURING */
+
   srv_reset_io_thread_op_info();
 
   const auto n_extra = number_of_extra_threads();
@@ -6541,6 +7006,14 @@ bool os_aio_init(ulint n_readers, ulint n_writers) {
   }
 #endif /* _WIN32 */
 
+#ifdef HAVE_LIBURING
+  /* A ring is as deep as its segment, and its submissions do not take a
+  kernel aio context each, which io_setup() would limit by aio-max-nr */
+  if (srv_use_native_aio && srv_use_io_uring) {
+    limit *= 4;
+  }
+#endif /* HAVE_LIBURING */
+
   /* Get sector size for DIRECT_IO. In this case, we need to
   know the sector size for aligning the write buffer. */
 #if !defined(NO_FALLOCATE) && defined(UNIV_LINUX)
@@ -6552,8 +7025,23 @@ bool os_aio_init(ulint n_readers, ulint n_writers) {
 
 void os_aio_start_threads() { AIO::start_threads(); }
 
+void os_aio_register_buffers(
+    const std::vector<std::pair<byte *, size_t>> &blocks) {
+#ifdef HAVE_LIBURING
+  if (srv_use_native_aio && srv_use_io_uring &&
+      AIO::uring_register_buffers(blocks)) {
+    ib::info() << "Registered " << blocks.size()
+               << " memory blocks with io_uring.";
+  }
+#endif /* HAVE_LIBURING */
+}
+
 /** Frees the asynchronous io system. */
 void os_aio_free() {
+#ifdef HAVE_LIBURING
+  AIO::uring_unregister_buffers();
+#endif /* HAVE_LIBURING */
+
   AIO::shutdown();
 
   for (ulint i = 0; i < os_aio_n_segments; i++) {
@@ -216,6 +216,10 @@ OS (provided we compiled Innobase with it in), otherwise we will
 use simulated aio we build below with threads. */
 bool srv_use_native_aio = false;
 
+/** If this flag is true and srv_use_native_aio is set, the Linux native aio
+is done through io_uring instead of libaio. */
+bool srv_use_io_uring = false;
+
 bool srv_numa_interleave = false;
 
 #ifdef UNIV_DEBUG
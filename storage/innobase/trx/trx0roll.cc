@@ -56,20 +56,25 @@ this program; if not, write to the Free Software Foundation, Inc.,
 #include "usr0sess.h"
 
 #include "current_thd.h"
+#ifdef XTRABACKUP
+#include "xb0xb.h"
+#endif /* XTRABACKUP */
 
 /** This many pages must be undone before a truncate is tried within
 rollback */
 static const ulint TRX_ROLL_TRUNC_THRESHOLD = 1;
 
-/** In crash recovery, the current trx to be rolled back; NULL otherwise */
-static const trx_t *trx_roll_crash_recv_trx = nullptr;
+/** In crash recovery, the current trx to be rolled back; NULL otherwise.
+Recovered transactions may be rolled back by several threads, each thread
+tracks the one it rolls back. */
+static thread_local const trx_t *trx_roll_crash_recv_trx = nullptr;
 
 /** In crash recovery we set this to the undo n:o of the current trx to be
 rolled back. Then we can print how many % the rollback has progressed. */
-static undo_no_t trx_roll_max_undo_no;
+static thread_local undo_no_t trx_roll_max_undo_no;
 
 /** Auxiliary variable which tells the previous progress % we printed */
-static ulint trx_roll_progress_printed_pct;
+static thread_local ulint trx_roll_progress_printed_pct;
 
 /** Finishes a transaction rollback. */
 static void trx_rollback_finish(trx_t *trx); /*!< in: transaction */
@@ -704,6 +709,63 @@ static bool trx_rollback_or_clean_resurrected(
   ut_error;
 }
 
+#ifdef XTRABACKUP
+/** Roll back the recovered active transactions with
+xtrabackup_rollback_threads threads. The transactions held the locks of the
+records they changed until the crash, so no two of them change the same
+record and they can be rolled back concurrently. The transactions with the
+most undo records are started first. */
+static void trx_rollback_recovered_parallel() {
+  std::vector<trx_t *> trxs;
+
+  trx_sys_mutex_enter();
+  for (auto trx : trx_sys->rw_trx_list) {
+    trx_mutex_enter(trx);
+    if (trx->is_recovered &&
+        trx->state.load(std::memory_order_relaxed) == TRX_STATE_ACTIVE) {
+      trxs.push_back(trx);
+    }
+    trx_mutex_exit(trx);
+  }
+  trx_sys_mutex_exit();
+
+  if (trxs.size() < 2) {
+    return;
+  }
+
+  std::sort(trxs.begin(), trxs.end(), [](const trx_t *a, const trx_t *b) {
+    return (a->undo_no > b->undo_no);
+  });
+
+  const size_t n_threads =
+      std::min<size_t>(xtrabackup_rollback_threads, trxs.size());
+
+  ib::info() << "Rolling back " << trxs.size() << " transactions with "
+             << n_threads << " threads";
+
+  std::atomic<size_t> next{0};
+  std::vector<IB_thread> threads;
+
+  for (size_t i = 0; i < n_threads; ++i) {
+    threads.push_back(os_thread_create(PFS_NOT_INSTRUMENTED, i, [&]() {
+      THD *thd = create_internal_thd();
+
+      for (size_t n = next++; n < trxs.size(); n = next++) {
+        trx_rollback_active(trxs[n]);
+        trx_free_for_background(trxs[n]);
+      }
+
+      destroy_internal_thd(thd);
+    }));
+    threads.back().start();
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+#endif /* XTRABACKUP */
+
 /** Rollback or clean up any incomplete transactions which were
  encountered in crash recovery.  If the transaction already was
  committed, then we clean up a possible insert undo log. If the
@@ -727,6 +789,12 @@ void trx_rollback_or_clean_recovered(
   is shutdown and they are still lingering in trx_sys_t::trx_list
   then the shutdown will hang. */
 
+#ifdef XTRABACKUP
+  if (all && xtrabackup_rollback_threads > 1) {
+    trx_rollback_recovered_parallel();
+  }
+#endif /* XTRABACKUP */
+
   /* Loop over the transaction list as long as there are
   recovered transactions to clean up or recover. */
 
@@ -0,0 +1,225 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Benchmark of the redo log apply of --prepare.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <my_rapidjson_size_t.h>
+#include <my_sys.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <sys/resource.h>
+
+#include <univ.i>
+
+#include <buf0buf.h>
+#include <os0file.h>
+#include <srv0srv.h>
+
+#include <string>
+#include <vector>
+
+#include "apply_benchmark.h"
+#include "datasink.h"
+#include "ds_local.h"
+#include "xb0xb.h"
+#include "xtrabackup.h"
+
+namespace xb {
+namespace apply_benchmark {
+
+namespace {
+
+/** Version of the benchmark output format */
+const int BENCHMARK_VERSION = 1;
+
+/** Size of a single read of the copy of a file */
+const size_t CLONE_CHUNK_SIZE = 1024 * 1024;
+
+/** Copy a file of the backup into the datasink of the clone.
+@param[in]  ds     datasink at the root of the clone
+@param[in]  src    path of the file
+@param[in]  name   path of the file relative to the backup
+@param[in]  buf    copy buffer of CLONE_CHUNK_SIZE bytes
+@return false on error */
+bool clone_file(ds_ctxt_t *ds, const char *src, const std::string &name,
+                char *buf) {
+  MY_STAT stat_info;
+  if (my_stat(src, &stat_info, MYF(MY_WME)) == nullptr) {
+    return (false);
+  }
+
+  File fd = my_open(src, O_RDONLY, MYF(MY_WME));
+  if (fd < 0) {
+    return (false);
+  }
+
+  ds_file_t *file = ds_open(ds, name.c_str(), &stat_info);
+  if (file == nullptr) {
+    xb::error() << "cannot create " << name << " in the clone of the backup";
+    my_close(fd, MYF(MY_WME));
+    return (false);
+  }
+
+  bool ok = true;
+  if (!ds_local_clone(file, fd, stat_info.st_size, false)) {
+    size_t n;
+    while ((n = my_read(fd, reinterpret_cast<uchar *>(buf), CLONE_CHUNK_SIZE,
+                        MYF(MY_WME))) > 0 &&
+           n != MY_FILE_ERROR) {
+      if (ds_write(file, buf, n)) {
+        ok = false;
+        break;
+      }
+    }
+    if (n == MY_FILE_ERROR) {
+      ok = false;
+    }
+  }
+
+  if (ds_close(file)) {
+    ok = false;
+  }
+  my_close(fd, MYF(MY_WME));
+
+  return (ok);
+}
+
+/** Clone the files of a directory of the backup and of its subdirectories.
+@param[in]  ds    datasink at the root of the clone
+@param[in]  path  path of the directory
+@param[in]  rel   path of the directory relative to the backup, empty for
+                  the backup directory
+@param[in]  buf   copy buffer of CLONE_CHUNK_SIZE bytes
+@return false on error */
+bool clone_dir(ds_ctxt_t *ds, const std::string &path, const std::string &rel,
+               char *buf) {
+  std::vector<std::pair<std::string, bool>> entries;
+  bool ok = os_file_scan_directory(
+      path.c_str(),
+      [&entries, &path](const char *, const char *name) {
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+          return;
+        }
+        MY_STAT stat_info;
+        const std::string entry = path + "/" + name;
+        if (my_stat(entry.c_str(), &stat_info, MYF(0)) == nullptr) {
+          return;
+        }
+        if (MY_S_ISDIR(stat_info.st_mode)) {
+          entries.emplace_back(name, true);
+        } else if (MY_S_ISREG(stat_info.st_mode)) {
+          entries.emplace_back(name, false);
+        }
+      },
+      false);
+  if (!ok) {
+    xb::error() << "cannot list " << path;
+    return (false);
+  }
+
+  /* empty directories are not cloned, the prepare does not need them */
+  for (const auto &entry : entries) {
+    const std::string src = path + "/" + entry.first;
+    const std::string name =
+        rel.empty() ? entry.first : rel + "/" + entry.first;
+    if (entry.second ? !clone_dir(ds, src, name, buf)
+                     : !clone_file(ds, src.c_str(), name, buf)) {
+      return (false);
+    }
+  }
+
+  return (true);
+}
+
+}  // namespace
+
+bool clone(const char *snapshot, const char *dir) {
+  xb::info() << "Cloning " << snapshot << " to " << dir
+             << " for the apply benchmark";
+
+  ds_ctxt_t *ds = ds_create(dir, DS_TYPE_LOCAL);
+  if (ds == nullptr) {
+    return (false);
+  }
+
+  std::vector<char> buf(CLONE_CHUNK_SIZE);
+  std::string path(snapshot);
+  while (path.size() > 1 && path.back() == '/') {
+    path.pop_back();
+  }
+  const bool ok = clone_dir(ds, path, "", buf.data());
+  ds_destroy(ds);
+
+  if (!ok) {
+    xb::error() << "failed to clone " << snapshot << " to " << dir
+                << ", --apply-benchmark-dir must not contain a backup yet";
+  }
+  return (ok);
+}
+
+void print(uint64_t log_bytes, uint64_t apply_usecs) {
+  buf_pool_stat_t stat;
+  buf_get_total_stat(&stat);
+
+  struct rusage usage;
+  const uint64_t max_rss =
+      getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss * 1024ULL : 0;
+
+  const double secs = apply_usecs / 1000000.0;
+
+  rapidjson::StringBuffer buf;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buf);
+  writer.StartObject();
+  writer.Key("version");
+  writer.Int(BENCHMARK_VERSION);
+  writer.Key("settings");
+  writer.StartObject();
+  writer.Key("use_memory");
+  writer.Uint64(srv_buf_pool_size);
+  writer.Key("buffer_pool_instances");
+  writer.Uint64(srv_buf_pool_instances);
+  writer.Key("parallel");
+  writer.Int(xtrabackup_parallel);
+  writer.Key("read_io_threads");
+  writer.Uint64(srv_n_read_io_threads);
+  writer.Key("write_io_threads");
+  writer.Uint64(srv_n_write_io_threads);
+  writer.EndObject();
+  writer.Key("log_bytes");
+  writer.Uint64(log_bytes);
+  writer.Key("apply_sec");
+  writer.Double(secs);
+  writer.Key("apply_mib_per_sec");
+  writer.Double(secs > 0 ? log_bytes / secs / (1024 * 1024) : 0);
+  writer.Key("pages_read");
+  writer.Uint64(stat.n_pages_read);
+  writer.Key("pages_written");
+  writer.Uint64(stat.n_pages_written);
+  writer.Key("batches");
+  writer.Uint64(xb_recv_applied_batches);
+  writer.Key("peak_memory_bytes");
+  writer.Uint64(max_rss);
+  writer.EndObject();
+
+  if (fprintf(stdout, "%s\n", buf.GetString()) < 0 || fflush(stdout) != 0) {
+    xb::error() << "cannot print the apply benchmark";
+  }
+}
+
+}  // namespace apply_benchmark
+}  // namespace xb
@@ -0,0 +1,49 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Benchmark of the redo log apply of --prepare.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef XB_APPLY_BENCHMARK_H
+#define XB_APPLY_BENCHMARK_H
+
+#include <stdint.h>
+
+/* --prepare --apply-benchmark-dir prepares a clone of the backup, so that
+the backup stays a fixed snapshot every run replays its xtrabackup_logfile
+against. */
+namespace xb {
+namespace apply_benchmark {
+
+/** Clone the files of a backup into a new directory, sharing their extents
+when the filesystem supports reflinks and copying them otherwise.
+@param[in]  snapshot  backup directory
+@param[in]  dir       directory to create, must not contain the files
+@return false on error */
+bool clone(const char *snapshot, const char *dir);
+
+/** Print the redo log apply throughput, the pages read and written by the
+buffer pool, the number of apply batches and the peak memory of the process
+to stdout as JSON. Called while InnoDB still runs after the recovery.
+@param[in]  log_bytes    size of the xtrabackup_logfile applied
+@param[in]  apply_usecs  duration of the recovery in microseconds */
+void print(uint64_t log_bytes, uint64_t apply_usecs);
+
+}  // namespace apply_benchmark
+}  // namespace xb
+
+#endif
@@ -52,26 +52,39 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <ut0mem.h>
 #include <ut0new.h>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <functional>
+#include <map>
 #include <queue>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include "changed_page_tracking.h"
 #include "common.h"
+#include "crc_glue.h"
+#include "ds_decompress_lz4.h"
+#include "ds_decompress_zstd.h"
+#include "ds_local.h"
 #include "fil_cur.h"
 #include "os0event.h"
 #include "space_map.h"
 #include "utils.h"
 #include "xb0xb.h"
 #include "xb_regex.h"
+#include "xb_report.h"
 
 #include <cstdlib>
 #include "backup_copy.h"
 #include "backup_mysql.h"
+#include "file_checksums.h"
 #include "file_utils.h"
+#include "io_throttle.h"
 #include "keyring_components.h"
 #include "keyring_plugins.h"
 #include "sql_thd_internal_api.h"
@@ -100,12 +113,49 @@ extern TYPELIB innodb_flush_method_typelib;
 static std::set<std::string> rsync_list;
 static std::mutex rsync_mutex;
 
+/* state of a non-InnoDB file copied before the backup lock for
+--precopy-non-innodb */
+struct precopy_state_t {
+  off_t size;
+  time_t ctime;
+  time_t copy_time; /* taken before the stat() of the file */
+};
+
+/* files copied before the backup lock, not yet checked under it */
+static std::unordered_map<std::string, precopy_state_t> precopy_list;
+static std::mutex precopy_mutex;
+
 /* compiled regexp for valid filepath */
 xb_regex_t preg_filepath;
 
 /* skip these files on copy-back */
 static std::set<std::string> skip_copy_back_list;
 
+/* directories the files were moved to on move-back, synced once at the end */
+static std::set<std::string> move_back_dirs;
+static std::mutex move_back_dirs_mutex;
+
+/* the backup directory and the datadir are on different devices */
+static bool move_back_cross_device = false;
+
+/* the files copied back are checked against the checksums of
+--file-checksums, files cloned or renamed are not read and not checked */
+static bool copy_back_check_checksums = false;
+static xb::file_checksums::Entries copy_back_expected_checksums;
+static xb::file_checksums::Registry copy_back_checksums;
+
+/** Add the data read by a copy-back into a file to its checksum, before the
+buffer is compacted for the holes.
+@param[in,out]  checksum  checksum of the file
+@param[in]      cursor    cursor of the file */
+static void copy_back_checksum_update(
+    xb::file_checksums::File_checksum *checksum, const datafile_cur_t &cursor) {
+  if (copy_back_check_checksums) {
+    checksum->update(cursor.buf_offset - cursor.buf_read, cursor.buf,
+                     cursor.buf_read);
+  }
+}
+
 class datadir_queue {
   std::queue<datadir_entry_t> queue;
   mysql_mutex_t mutex;
@@ -164,6 +214,88 @@ struct datadir_thread_ctxt_t {
   bool ret;
 };
 
+/************************************************************************
+Progress of a restore phase. While it exists, a thread logs every
+--restore-progress-interval seconds a JSON line with the bytes done and
+planned, the throughput since the previous line and the estimated time left.
+The last line is logged when it is destroyed. */
+class restore_progress_t {
+  const char *phase;
+  std::atomic<uint64_t> bytes_total{0};
+  std::atomic<uint64_t> bytes_done{0};
+  std::chrono::steady_clock::time_point start_time;
+  std::chrono::steady_clock::time_point last_time;
+  uint64_t last_done{0};
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool stopped{false};
+  std::thread reporter;
+
+  void report(bool final) {
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t done = bytes_done;
+    const uint64_t total = std::max<uint64_t>(bytes_total, done);
+    const double secs =
+        std::chrono::duration<double>(now - (final ? start_time : last_time))
+            .count();
+    const double rate =
+        secs > 0 ? (done - (final ? 0 : last_done)) / secs : 0;
+
+    last_time = now;
+    last_done = done;
+
+    std::ostringstream json;
+    json << "{\"phase\": \"" << phase << "\", \"bytes_done\": " << done
+         << ", \"bytes_total\": " << total
+         << ", \"mib_per_sec\": " << rate / 1048576;
+    if (final) {
+      json << ", \"elapsed_sec\": " << static_cast<uint64_t>(secs);
+    } else if (rate > 0) {
+      json << ", \"eta_sec\": " << static_cast<uint64_t>((total - done) / rate);
+    }
+    json << "}";
+
+    xb::info() << "Progress: " << json.str();
+  }
+
+ public:
+  restore_progress_t(const char *phase) : phase(phase) {
+    start_time = last_time = std::chrono::steady_clock::now();
+    reporter = std::thread([this] {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!cond.wait_for(
+          lock, std::chrono::seconds(opt_restore_progress_interval),
+          [this] { return stopped; })) {
+        report(false);
+      }
+    });
+  }
+
+  ~restore_progress_t() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopped = true;
+    }
+    cond.notify_one();
+    reporter.join();
+    report(true);
+  }
+
+  /** Account a file or range found by the walk of the directory */
+  void plan(ssize_t bytes) {
+    if (bytes > 0) bytes_total += bytes;
+  }
+
+  /** Account a file or range restored by a thread */
+  void done(ssize_t bytes) {
+    if (bytes > 0) bytes_done += bytes;
+  }
+};
+
+/* progress of the current restore phase, if --restore-progress-interval
+is set */
+static std::unique_ptr<restore_progress_t> restore_progress;
+
 
 /************************************************************************
 Trim leading slashes from absolute path so it becomes relative */
@@ -358,6 +490,79 @@ static bool datafile_rsync_backup(const char *filepath, bool save_to_list,
   return (true);
 }
 
+/************************************************************************
+Remove the copy of a non-InnoDB file made before the backup lock. */
+static void precopy_remove(const char *filepath) {
+  char dst_path[FN_REFLEN * 2 + 1];
+
+  snprintf(dst_path, sizeof(dst_path), "%s/%s", xtrabackup_target_dir,
+           trim_dotslash(filepath));
+  xb::info() << "Removing " << dst_path;
+  unlink(dst_path);
+}
+
+/************************************************************************
+Same as datafile_copy_backup, for --precopy-non-innodb. Before the backup
+lock the file is copied and its state remembered. Under the lock it is only
+copied again if it changed since.
+@return true if file backed up or skipped successfully. */
+static bool datafile_precopy_backup(const char *filepath, bool prep_mode,
+                                    uint thread_n) {
+  const char *ext_list[] = {"MYD", "MYI", "MAD", "MAI", "MRG", "ARM",
+                            "ARZ", "CSM", "CSV", "opt", "sdi", NULL};
+  MY_STAT stat_info;
+
+  if (check_if_skip_table(filepath)) {
+    xb::info() << "Skipping " << filepath;
+    return (true);
+  }
+
+  if (!filename_matches(filepath, ext_list)) {
+    return (true);
+  }
+
+  const time_t copy_time = time(nullptr);
+  const bool have_stat = my_stat(filepath, &stat_info, MYF(0)) != nullptr;
+
+  if (prep_mode) {
+    if (!copy_file(ds_data, filepath, filepath, thread_n,
+                   FILE_PURPOSE_OTHER)) {
+      return (false);
+    }
+    if (have_stat) {
+      std::lock_guard<std::mutex> guard(precopy_mutex);
+      precopy_list[filepath] = {stat_info.st_size, stat_info.st_ctime,
+                                copy_time};
+    }
+    return (true);
+  }
+
+  bool copied = false;
+  precopy_state_t state;
+  {
+    std::lock_guard<std::mutex> guard(precopy_mutex);
+    auto it = precopy_list.find(filepath);
+    if (it != precopy_list.end()) {
+      copied = true;
+      state = it->second;
+      precopy_list.erase(it);
+    }
+  }
+
+  if (copied) {
+    /* a write in the second of the stat() may leave the ctime as is */
+    if (have_stat && state.size == stat_info.st_size &&
+        state.ctime == stat_info.st_ctime && state.ctime < state.copy_time) {
+      xb::info() << "Skipping " << filepath
+                 << ", not changed since it was copied";
+      return (true);
+    }
+    precopy_remove(filepath);
+  }
+
+  return copy_file(ds_data, filepath, filepath, thread_n, FILE_PURPOSE_OTHER);
+}
+
 static bool backup_ds_print(ds_file_t *dstfile, const char *message, int len) {
   const char *action = xb_get_copy_action("Writing");
   xb::info() << action << " " << dstfile->path;
@@ -427,9 +632,26 @@ bool backup_file_printf(const char *filename, const char *fmt, ...) {
   return (result);
 }
 
+/************************************************************************
+Process the files of the directory by n threads running func.
+@param[in]	dir			directory to process
+@param[in]	func			thread function
+@param[in]	n			number of threads
+@param[in]	thread_description	thread name for the error messages
+@param[in]	largest_first		queue the files by decreasing size, so
+                                        that a large file found late does not
+                                        leave a single thread working at the
+                                        end
+@param[in]	split			if set and largest_first, called for each
+                                        file to queue the ranges it returns
+                                        instead of the whole file
+@return true in case of success. */
 template <typename F>
-static bool run_data_threads(const char *dir, F func, uint n,
-                             const char *thread_description) {
+static bool run_data_threads(
+    const char *dir, F func, uint n, const char *thread_description,
+    bool largest_first = false,
+    std::function<bool(const datadir_entry_t &, std::vector<datadir_entry_t> &)>
+        split = nullptr) {
   datadir_thread_ctxt_t *data_threads;
   uint i, count;
   ib_mutex_t count_mutex;
@@ -452,13 +674,38 @@ static bool run_data_threads(const char *dir, F func, uint n,
     os_thread_create(PFS_NOT_INSTRUMENTED, 0, func, &data_threads[i]).start();
   }
 
-  xb_process_datadir(
-      dir, "",
-      [&](const datadir_entry_t &entry, void *arg) mutable -> bool {
-        queue.push(entry);
-        return true;
-      },
-      nullptr);
+  if (largest_first) {
+    std::vector<datadir_entry_t> entries;
+
+    xb_process_datadir(
+        dir, "",
+        [&](const datadir_entry_t &entry, void *arg) mutable -> bool {
+          if (restore_progress) restore_progress->plan(entry.file_size);
+          if (!split || !split(entry, entries)) {
+            entries.push_back(entry);
+          }
+          return true;
+        },
+        nullptr, n);
+
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const datadir_entry_t &a, const datadir_entry_t &b) {
+                       return a.file_size > b.file_size;
+                     });
+
+    for (const auto &entry : entries) {
+      queue.push(entry);
+    }
+  } else {
+    xb_process_datadir(
+        dir, "",
+        [&](const datadir_entry_t &entry, void *arg) mutable -> bool {
+          if (restore_progress) restore_progress->plan(entry.file_size);
+          queue.push(entry);
+          return true;
+        },
+        nullptr, n);
+  }
 
   queue.complete();
 
@@ -488,22 +735,61 @@ static bool run_data_threads(const char *dir, F func, uint n,
   return (ret);
 }
 
+/** Check if a page is all zeroes. The inner loop is vectorized by the
+compiler, non-zero data is usually found in the first stripe.
+@param[in]  page       page
+@param[in]  page_size  page size, a multiple of 256
+@return true if the page holds only zeroes */
+static bool is_zero_page(const byte *page, size_t page_size) {
+  for (size_t i = 0; i < page_size; i += 256) {
+    uint64_t acc = 0;
+    for (size_t j = 0; j < 256; j += 8) {
+      uint64_t word;
+      memcpy(&word, page + i + j, 8);
+      acc |= word;
+    }
+    if (acc != 0) {
+      return (false);
+    }
+  }
+
+  return (true);
+}
+
 /************************************************************************
-Write buffer into .ibd file and preserve it's sparsiness. */
-bool write_ibd_buffer(ds_file_t *file, unsigned char *buf, size_t buf_len,
-                      size_t page_size, size_t block_size,
-                      bool punch_hole_supported) {
+Write buffer into .ibd file and preserve it's sparsiness, with the page size
+FIXED or page_size if FIXED is 0. */
+template <ulint FIXED>
+static bool write_ibd_buffer_low(ds_file_t *file, unsigned char *buf,
+                                 size_t buf_len, size_t page_size,
+                                 size_t block_size,
+                                 bool punch_hole_supported) {
+  if (FIXED != 0) {
+    page_size = FIXED;
+  }
+
   ut_a(buf_len % page_size == 0);
 
-  if (ds_is_sparse_write_supported(file) && page_size > block_size) {
+  if (ds_is_sparse_write_supported(file) &&
+      (page_size > block_size || opt_sparse_zero_pages)) {
     std::vector<ds_sparse_chunk_t> sparse_map;
     size_t skip = 0, len = 0;
     for (ulint i = 0, page_offs = 0; i < buf_len / page_size;
          ++i, page_offs += page_size) {
       const auto page = buf + page_offs;
 
-      if (Compression::is_compressed_page(page) ||
-          fil_page_get_type(page) == FIL_PAGE_COMPRESSED_AND_ENCRYPTED) {
+      if (opt_sparse_zero_pages && is_zero_page(page, page_size)) {
+        /* the whole page is a hole */
+        if (len > 0) {
+          sparse_map.push_back(ds_sparse_chunk_t{skip, len});
+          skip = 0;
+          len = 0;
+        }
+        skip += page_size;
+      } else if (page_size > block_size &&
+                 (Compression::is_compressed_page(page) ||
+                  fil_page_get_type(page) ==
+                      FIL_PAGE_COMPRESSED_AND_ENCRYPTED)) {
         ut_ad(page_size % block_size == 0);
         size_t compressed_len =
             mach_read_from_2(page + FIL_PAGE_COMPRESS_SIZE_V1) + FIL_PAGE_DATA;
@@ -519,7 +805,7 @@ bool write_ibd_buffer(ds_file_t *file, unsigned char *buf, size_t buf_len,
     }
     sparse_map.push_back(ds_sparse_chunk_t{skip, len});
 
-    if (sparse_map.size() > 1) {
+    if (sparse_map.size() > 1 || sparse_map[0].skip > 0) {
       size_t src_pos = 0, dst_pos = 0;
       for (size_t i = 0; i < sparse_map.size(); ++i) {
         src_pos += sparse_map[i].skip;
@@ -541,6 +827,19 @@ bool write_ibd_buffer(ds_file_t *file, unsigned char *buf, size_t buf_len,
   return (true);
 }
 
+/************************************************************************
+Write buffer into .ibd file and preserve it's sparsiness. */
+bool write_ibd_buffer(ds_file_t *file, unsigned char *buf, size_t buf_len,
+                      size_t page_size, size_t block_size,
+                      bool punch_hole_supported) {
+  const auto write = [&](auto fixed) {
+    return (write_ibd_buffer_low<decltype(fixed)::value>(
+        file, buf, buf_len, page_size, block_size, punch_hole_supported));
+  };
+
+  return (xb_page_size_dispatch(xb_fixed_page_size(page_size, 0), write));
+}
+
 /************************************************************************
 Copy file for backup/restore.
 @return true in case of success. */
@@ -553,6 +852,7 @@ bool copy_file(ds_ctxt_t *datasink, const char *src_file_path,
   xb_fil_cur_result_t res;
   const char *action;
   page_size_t page_size{0, 0, false};
+  xb::file_checksums::File_checksum checksum;
 
   if (!datafile_open(src_file_path, &cursor, true, opt_read_buffer_size)) {
     goto error;
@@ -583,8 +883,33 @@ bool copy_file(ds_ctxt_t *datasink, const char *src_file_path,
     xb::info() << action << " " << src_file_path << " to " << dstfile->path;
   }
 
+  /* restoring to the same filesystem, or backing up files which are not
+  InnoDB to it, needs no copy through user space */
+  if ((xtrabackup_copy_back ||
+       (xtrabackup_backup && file_purpose == FILE_PURPOSE_OTHER)) &&
+      pos < 0 &&
+      datasink->datasink == &datasink_local &&
+      ds_local_clone(dstfile, cursor.fd, cursor.statinfo.st_size,
+                     opt_reflink_only)) {
+    xb::info() << "Done: " << action << " " << src_file_path << " to "
+               << dstfile->path << " without reading it";
+    datafile_close(&cursor);
+    if (ds_close(dstfile)) {
+      goto error_close;
+    }
+    return (true);
+  }
+
+  if (xtrabackup_copy_back && opt_reflink_only) {
+    xb::error() << "cannot clone " << src_file_path << " to " << dstfile->path
+                << ": --reflink-only needs the backup on the same filesystem "
+                   "as the destination, with reflink support";
+    goto error;
+  }
+
   /* The main copy loop */
   while ((res = datafile_read(&cursor)) == XB_FIL_CUR_SUCCESS) {
+    copy_back_checksum_update(&checksum, cursor);
     if (file_purpose == FILE_PURPOSE_DATAFILE) {
       if (cursor.buf_offset == cursor.buf_read)
         page_size.copy_from(fsp_header_get_page_size(cursor.buf));
@@ -596,6 +921,7 @@ bool copy_file(ds_ctxt_t *datasink, const char *src_file_path,
       if (ds_write(dstfile, cursor.buf, cursor.buf_read)) goto error;
     }
     xtrabackup_io_throttling();
+    io_throttle_read.acquire(cursor.buf_read);
   }
 
   /* empty file */
@@ -616,6 +942,10 @@ bool copy_file(ds_ctxt_t *datasink, const char *src_file_path,
   if (ds_close(dstfile)) {
     goto error_close;
   }
+  if (copy_back_check_checksums) {
+    copy_back_checksums.merge(xb::file_checksums::normalize(src_file_path),
+                              checksum);
+  }
   return (true);
 
 error:
@@ -629,6 +959,237 @@ error_close:
   return (false); /*ERROR*/
 }
 
+/************************************************************************
+Copy the range [start, end) of a file into an existing target of the local
+datasink, at the same offset.
+@return true in case of success. */
+bool copy_file_part(ds_ctxt_t *datasink, const char *src_file_path,
+                           const char *dst_file_path,
+                           file_purpose_t file_purpose, uint64_t start,
+                           uint64_t end) {
+  ds_file_t *dstfile = NULL;
+  datafile_cur_t cursor;
+  xb_fil_cur_result_t res;
+  const char *action;
+  page_size_t page_size{0, 0, false};
+  xb::file_checksums::File_checksum checksum;
+
+  if (!datafile_open(src_file_path, &cursor, true, opt_read_buffer_size)) {
+    goto error;
+  }
+
+  if (file_purpose == FILE_PURPOSE_DATAFILE) {
+    /* the page size is in the header page, which may be in another range */
+    if (my_pread(cursor.fd, cursor.buf, UNIV_PAGE_SIZE_MIN, 0,
+                 MYF(MY_WME | MY_NABP))) {
+      goto error;
+    }
+    page_size.copy_from(fsp_header_get_page_size(cursor.buf));
+  }
+
+  if (my_seek(cursor.fd, start, MY_SEEK_SET, MYF(MY_WME)) ==
+      MY_FILEPOS_ERROR) {
+    goto error;
+  }
+  cursor.buf_offset = start;
+  cursor.statinfo.st_size = end;
+
+  dstfile = ds_local_open_at(datasink, trim_dotslash(dst_file_path), start);
+  if (dstfile == NULL) {
+    xb::error() << "cannot open the destination stream for " << dst_file_path;
+    goto error;
+  }
+
+  action = xb_get_copy_action();
+  xb::info() << action << " " << src_file_path << " to " << dstfile->path
+             << " range " << start << "-" << end;
+
+  while ((res = datafile_read(&cursor)) == XB_FIL_CUR_SUCCESS) {
+    copy_back_checksum_update(&checksum, cursor);
+    if (file_purpose == FILE_PURPOSE_DATAFILE) {
+      if (!write_ibd_buffer(dstfile, cursor.buf, cursor.buf_read,
+                            page_size.physical(), cursor.statinfo.st_blksize,
+                            datasink->fs_support_punch_hole))
+        goto error;
+    } else {
+      if (ds_write(dstfile, cursor.buf, cursor.buf_read)) goto error;
+    }
+    xtrabackup_io_throttling();
+    io_throttle_read.acquire(cursor.buf_read);
+  }
+
+  if (res == XB_FIL_CUR_ERROR) {
+    goto error;
+  }
+
+  xb::info() << "Done: " << action << " " << src_file_path << " to "
+             << dstfile->path << " range " << start << "-" << end;
+  datafile_close(&cursor);
+  if (ds_close(dstfile)) {
+    goto error_close;
+  }
+  if (copy_back_check_checksums) {
+    copy_back_checksums.merge(xb::file_checksums::normalize(src_file_path),
+                              checksum);
+  }
+  return (true);
+
+error:
+  datafile_close(&cursor);
+  if (dstfile != NULL) {
+    ds_close(dstfile);
+  }
+
+error_close:
+  xb::error() << "copy_file_part() failed.";
+  return (false); /*ERROR*/
+}
+
+/************************************************************************
+Copy a data file of the full backup with the pages of its .delta file in
+--incremental-dir overlaid on the way, so that the file is written once
+however many pages changed. Pages past the end of the file in the full backup
+are appended, with zeroes for the pages in between that are not in the .delta
+file.
+@return true in case of success. */
+static bool copy_file_with_delta(ds_ctxt_t *datasink, const char *src_file_path,
+                                 const char *dst_file_path, uint thread_n) {
+  char delta_path[FN_REFLEN];
+  char meta_path[FN_REFLEN];
+  xb_delta_info_t info;
+  xb_delta_page_map_t pages;
+  ds_file_t *dstfile = nullptr;
+  datafile_cur_t cursor;
+  xb_fil_cur_result_t res;
+  File delta_file = -1;
+  size_t next = 0;
+  uint64_t file_end;
+  uint64_t batch_size;
+  const char *action;
+
+  snprintf(delta_path, sizeof(delta_path), "%s/%s.delta",
+           xtrabackup_incremental_dir, trim_dotslash(src_file_path));
+  snprintf(meta_path, sizeof(meta_path), "%s/%s.meta",
+           xtrabackup_incremental_dir, trim_dotslash(src_file_path));
+
+  if (!xb_read_delta_metadata(meta_path, &info) ||
+      !xb_delta_read_page_map(delta_path, info.page_size, &pages)) {
+    xb::error() << "copy_file_with_delta() failed.";
+    return (false);
+  }
+
+  const uint64_t page_size = info.page_size;
+
+  /* Read the pages overlapping [start, end) of the data file from the
+  .delta file into buf. Runs of consecutive pages are contiguous in the
+  .delta file, each is read at once. A run crossing end is left for the next
+  batch. */
+  auto overlay = [&](byte *buf, uint64_t start, uint64_t end) {
+    while (next < pages.size()) {
+      const uint64_t run_start = pages[next].first * page_size;
+      if (run_start >= end) {
+        break;
+      }
+
+      size_t n = 1;
+      while (next + n < pages.size() &&
+             pages[next + n].first == pages[next].first + n &&
+             pages[next + n].second == pages[next].second + n * page_size) {
+        n++;
+      }
+
+      const uint64_t run_end = run_start + n * page_size;
+      const uint64_t from = std::max(run_start, start);
+      const uint64_t to = std::min(run_end, end);
+      if (my_pread(delta_file, buf + (from - start), to - from,
+                   pages[next].second + (from - run_start),
+                   MYF(MY_WME | MY_NABP)) != 0) {
+        return (false);
+      }
+
+      if (run_end > end) {
+        break;
+      }
+      next += n;
+    }
+    return (true);
+  };
+
+  delta_file = my_open(delta_path, O_RDONLY, MYF(MY_WME));
+  if (delta_file < 0) {
+    goto error;
+  }
+
+  if (!datafile_open(src_file_path, &cursor, true, opt_read_buffer_size)) {
+    goto error;
+  }
+
+  dstfile = ds_open(datasink, trim_dotslash(dst_file_path), &cursor.statinfo);
+  if (dstfile == nullptr) {
+    xb::error() << "cannot open the destination stream for " << dst_file_path;
+    goto error_close;
+  }
+
+  action = xb_get_copy_action();
+  xb::info() << action << " " << src_file_path << " with " << pages.size()
+             << " pages of " << delta_path << " to " << dstfile->path;
+
+  while ((res = datafile_read(&cursor)) == XB_FIL_CUR_SUCCESS) {
+    if (!overlay(cursor.buf, cursor.buf_offset - cursor.buf_read,
+                 cursor.buf_offset) ||
+        !write_ibd_buffer(dstfile, cursor.buf, cursor.buf_read, page_size,
+                          cursor.statinfo.st_blksize,
+                          datasink->fs_support_punch_hole)) {
+      goto error_close;
+    }
+    xtrabackup_io_throttling();
+    io_throttle_read.acquire(cursor.buf_read);
+  }
+
+  if (res == XB_FIL_CUR_ERROR) {
+    goto error_close;
+  }
+
+  /* the pages the file grew by after the full backup */
+  file_end = cursor.buf_offset;
+  batch_size = ut_uint64_align_down(cursor.buf_size, page_size);
+  while (next < pages.size()) {
+    const uint64_t end = std::min(file_end + batch_size,
+                                  (pages.back().first + 1) * page_size);
+    memset(cursor.buf, 0, end - file_end);
+    if (!overlay(cursor.buf, file_end, end) ||
+        !write_ibd_buffer(dstfile, cursor.buf, end - file_end, page_size,
+                          cursor.statinfo.st_blksize,
+                          datasink->fs_support_punch_hole)) {
+      goto error_close;
+    }
+    file_end = end;
+  }
+
+  xb::info() << "Done: " << action << " " << src_file_path << " to "
+             << dstfile->path;
+  datafile_close(&cursor);
+  my_close(delta_file, MYF(MY_WME));
+  delta_file = -1;
+  if (ds_close(dstfile)) {
+    goto error;
+  }
+  return (true);
+
+error_close:
+  datafile_close(&cursor);
+  if (dstfile != nullptr) {
+    ds_close(dstfile);
+  }
+
+error:
+  if (delta_file >= 0) {
+    my_close(delta_file, MYF(MY_WME));
+  }
+  xb::error() << "copy_file_with_delta() failed.";
+  return (false);
+}
+
 /************************************************************************
 Try to move file by renaming it. If source and destination are on
 different devices fall back to copy and unlink.
@@ -649,8 +1210,17 @@ static bool move_file(ds_ctxt_t *datasink, const char *src_file_path,
 
   dirname_part(dst_dir_abs, dst_file_path_abs, &dirname_length);
 
-  if (!directory_exists(dst_dir_abs, true)) {
-    return (false);
+  bool dir_known;
+  {
+    std::lock_guard<std::mutex> guard(move_back_dirs_mutex);
+    dir_known = move_back_dirs.count(dst_dir_abs) > 0;
+  }
+  if (!dir_known) {
+    if (!directory_exists(dst_dir_abs, true)) {
+      return (false);
+    }
+    std::lock_guard<std::mutex> guard(move_back_dirs_mutex);
+    move_back_dirs.insert(dst_dir_abs);
   }
 
   if (file_exists(dst_file_path_abs)) {
@@ -659,10 +1229,16 @@ static bool move_file(ds_ctxt_t *datasink, const char *src_file_path,
     return (false);
   }
 
-  xb::info() << "Moving " << src_file_path << " to " << dst_file_path_abs;
+  /* a rename into the datadir is known to fail */
+  const bool copy =
+      move_back_cross_device && strcmp(dst_dir, mysql_data_home) == 0;
+
+  if (!copy) {
+    xb::info() << "Moving " << src_file_path << " to " << dst_file_path_abs;
+  }
 
-  if (my_rename(src_file_path, dst_file_path_abs, MYF(0)) != 0) {
-    if (my_errno() == EXDEV) {
+  if (copy || my_rename(src_file_path, dst_file_path_abs, MYF(0)) != 0) {
+    if (copy || my_errno() == EXDEV) {
       bool ret;
       ret = copy_file(datasink, src_file_path, dst_file_path, thread_n,
                       file_purpose);
@@ -934,11 +1510,18 @@ static bool copy_or_move_file(const char *src_file_path,
     dst_dir = external_dir;
   }
 
-  ret =
-      (xtrabackup_copy_back ? copy_file(datasink, src_file_path, dst_file_path,
-                                        thread_n, file_purpose)
-                            : move_file(datasink, src_file_path, dst_file_path,
-                                        dst_dir, thread_n, file_purpose));
+  if (xtrabackup_incremental_dir != nullptr &&
+      (file_purpose == FILE_PURPOSE_DATAFILE ||
+       file_purpose == FILE_PURPOSE_UNDO_LOG)) {
+    ret = copy_file_with_delta(datasink, src_file_path, dst_file_path,
+                               thread_n);
+  } else {
+    ret = (xtrabackup_copy_back
+               ? copy_file(datasink, src_file_path, dst_file_path, thread_n,
+                           file_purpose)
+               : move_file(datasink, src_file_path, dst_file_path, dst_dir,
+                           thread_n, file_purpose));
+  }
 
   if (opt_generate_new_master_key) {
     if (file_purpose == FILE_PURPOSE_DATAFILE ||
@@ -957,7 +1540,8 @@ static bool copy_or_move_file(const char *src_file_path,
 }
 
 static void backup_thread_func(datadir_thread_ctxt_t *ctx, bool prep_mode,
-                               FILE *rsync_tmpfile, Backup_context &context) {
+                               bool precopy, FILE *rsync_tmpfile,
+                               Backup_context &context) {
   bool ret = true;
   datadir_entry_t entry;
   THD *thd = nullptr;
@@ -986,6 +1570,8 @@ static void backup_thread_func(datadir_thread_ctxt_t *ctx, bool prep_mode,
     if (!entry.is_empty_dir) {
       if (opt_rsync) {
         ret = datafile_rsync_backup(path, !prep_mode, rsync_tmpfile);
+      } else if (precopy) {
+        ret = datafile_precopy_backup(path, prep_mode, ctx->n_thread);
       } else {
         ret = datafile_copy_backup(path, ctx->n_thread);
       }
@@ -1026,8 +1612,18 @@ bool backup_files(const char *from, bool prep_mode, Backup_context &context) {
   char rsync_tmpfile_name[FN_REFLEN];
   FILE *rsync_tmpfile = NULL;
   bool ret = true;
+  /* the copies made before the lock can only be replaced in a local
+  directory */
+  const bool precopy = opt_precopy_non_innodb && !opt_rsync &&
+                       ds_data->datasink == &datasink_local;
+
+  if (prep_mode && opt_precopy_non_innodb && !opt_rsync && !precopy) {
+    xb::warn() << "--precopy-non-innodb needs a local --target-dir with no "
+                  "--compress, no --encrypt and no --file-checksums, "
+                  "ignoring it";
+  }
 
-  if (prep_mode && !opt_rsync) {
+  if (prep_mode && !opt_rsync && !precopy) {
     return (true);
   }
 
@@ -1046,9 +1642,17 @@ bool backup_files(const char *from, bool prep_mode, Backup_context &context) {
 
   run_data_threads(from,
                    std::bind(backup_thread_func, std::placeholders::_1,
-                             prep_mode, rsync_tmpfile, context),
+                             prep_mode, precopy, rsync_tmpfile, context),
                    xtrabackup_parallel, "backup");
 
+  if (precopy && !prep_mode) {
+    /* the files removed since they were copied */
+    for (const auto &file : precopy_list) {
+      precopy_remove(file.first.c_str());
+    }
+    precopy_list.clear();
+  }
+
   if (opt_rsync) {
     std::stringstream cmd;
     int err;
@@ -1311,35 +1915,61 @@ static void par_copy_rocksdb_files(const Myrocks_datadir::const_iterator &start,
   }
 }
 
-static void backup_rocksdb_files(const Myrocks_datadir::const_iterator &start,
-                                 const Myrocks_datadir::const_iterator &end,
-                                 size_t thread_n, bool *result) {
-  for (auto it = start; it != end; it++) {
-    if (!copy_file(ds_uncompressed_data, it->path.c_str(), it->rel_path.c_str(),
-                   thread_n, FILE_PURPOSE_OTHER, it->file_size)) {
-      *result = false;
+/************************************************************************
+Copy MyRocks files on --parallel threads. Each thread takes the largest file
+left when it is done with the previous one, so that a large SST file does not
+keep a single thread busy after the others are done.
+@return true in case of success. */
+static bool backup_rocksdb_files(const Myrocks_datadir::file_list &files) {
+  std::vector<std::pair<ssize_t, const datadir_entry_t *>> queue;
+
+  queue.reserve(files.size());
+  for (const auto &f : files) {
+    MY_STAT stat_info;
+    ssize_t size = f.file_size;
+    if (size < 0 && my_stat(f.path.c_str(), &stat_info, MYF(0)) != nullptr) {
+      size = stat_info.st_size;
     }
-    if (!*result) {
-      break;
+    queue.emplace_back(size, &f);
+  }
+  std::stable_sort(queue.begin(), queue.end(),
+                   [](const std::pair<ssize_t, const datadir_entry_t *> &a,
+                      const std::pair<ssize_t, const datadir_entry_t *> &b) {
+                     return a.first > b.first;
+                   });
+
+  std::atomic<size_t> next{0};
+  std::atomic<bool> result{true};
+  auto copy = [&](size_t thread_n) {
+    size_t i;
+    while (result && (i = next++) < queue.size()) {
+      const datadir_entry_t *f = queue[i].second;
+      if (!copy_file(ds_uncompressed_data, f->path.c_str(),
+                     f->rel_path.c_str(), thread_n, FILE_PURPOSE_OTHER,
+                     f->file_size)) {
+        result = false;
+      }
     }
+  };
+
+  const size_t n =
+      std::min<size_t>(std::max(xtrabackup_parallel, 1), queue.size());
+  std::vector<IB_thread> workers;
+  for (size_t i = 1; i < n; i++) {
+    workers.push_back(os_thread_create(PFS_NOT_INSTRUMENTED, i, copy, i));
+    workers.back().start();
   }
+  copy(0);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  return (result);
 }
 
 static bool backup_rocksdb_wal(const Myrocks_checkpoint &checkpoint,
                                const log_status_t &log_status) {
-  bool result = true;
-
-  using std::placeholders::_1;
-  using std::placeholders::_2;
-  using std::placeholders::_3;
-
-  std::function<void(const Myrocks_datadir::const_iterator &,
-                     const Myrocks_datadir::const_iterator &, size_t)>
-      copy = std::bind(&backup_rocksdb_files, _1, _2, _3, &result);
-
-  const auto live_wal_files = checkpoint.wal_files(log_status);
-
-  par_for(PFS_NOT_INSTRUMENTED, live_wal_files, xtrabackup_parallel, copy);
+  const bool result = backup_rocksdb_files(checkpoint.wal_files(log_status));
 
   if (!result) {
     xb::error() << "failed to backup rocksdb WAL files.";
@@ -1348,17 +1978,71 @@ static bool backup_rocksdb_wal(const Myrocks_checkpoint &checkpoint,
   return result;
 }
 
-static bool backup_rocksdb_checkpoint(Backup_context &context, bool final) {
-  bool result = true;
-
-  using std::placeholders::_1;
-  using std::placeholders::_2;
-  using std::placeholders::_3;
+/* SST files of the checkpoint already in --incremental-basedir, with their
+size. An incremental backup lists them in XTRABACKUP_ROCKSDB_REUSED_SST
+instead of copying them again. */
+static std::vector<std::pair<std::string, uint64_t>> rocksdb_reused_sst;
 
-  std::function<void(const Myrocks_datadir::const_iterator &,
-                     const Myrocks_datadir::const_iterator &, size_t)>
-      copy = std::bind(&backup_rocksdb_files, _1, _2, _3, &result);
+/** Read the SST files of the backup in --incremental-basedir, the copied
+ones and the ones it reused from its own base.
+@return file names with their size */
+static std::unordered_map<std::string, uint64_t> rocksdb_base_sst_files() {
+  std::unordered_map<std::string, uint64_t> files;
+  char path[FN_REFLEN];
 
+  snprintf(path, sizeof(path), "%s/%s", xtrabackup_incremental_basedir,
+           ROCKSDB_SUBDIR);
+  if (directory_exists(path, false)) {
+    for (const auto &file : Myrocks_datadir(path).data_files()) {
+      MY_STAT stat_info;
+      if (my_stat(file.path.c_str(), &stat_info, MYF(0)) != nullptr) {
+        files[file.file_name] = stat_info.st_size;
+      }
+    }
+  }
+
+  snprintf(path, sizeof(path), "%s/%s", xtrabackup_incremental_basedir,
+           XTRABACKUP_ROCKSDB_REUSED_SST);
+  std::ifstream list(path);
+  std::string name;
+  uint64_t size;
+  while (list >> name >> size) {
+    files[name] = size;
+  }
+
+  return files;
+}
+
+/** Remove from the files to copy the SST files which --incremental-basedir
+has with the same size. SST files are never modified and RocksDB does not
+reuse their numbers, so the name and the size identify the data.
+@param[in,out]  files  files of the checkpoint */
+static void rocksdb_skip_base_sst_files(Myrocks_datadir::file_list &files) {
+  static const auto base_files = rocksdb_base_sst_files();
+
+  files.erase(
+      std::remove_if(
+          files.begin(), files.end(),
+          [](const datadir_entry_t &f) {
+            if (!ends_with(f.file_name.c_str(), ".sst")) {
+              return (false);
+            }
+            const auto it = base_files.find(f.file_name);
+            MY_STAT stat_info;
+            if (it == base_files.end() ||
+                my_stat(f.path.c_str(), &stat_info, MYF(0)) == nullptr ||
+                static_cast<uint64_t>(stat_info.st_size) != it->second) {
+              return (false);
+            }
+            xb::info() << "Skipping " << f.path
+                       << ", the incremental base has it";
+            rocksdb_reused_sst.emplace_back(f.file_name, it->second);
+            return (true);
+          }),
+      files.end());
+}
+
+static bool backup_rocksdb_checkpoint(Backup_context &context, bool final) {
   auto checkpoint_files =
       final ? context.myrocks_checkpoint.checkpoint_files(log_status)
             : context.myrocks_checkpoint.data_files();
@@ -1375,12 +2059,25 @@ static bool backup_rocksdb_checkpoint(Backup_context &context, bool final) {
     context.rocksdb_files.insert(f.file_name);
   }
 
-  par_for(PFS_NOT_INSTRUMENTED, checkpoint_files, xtrabackup_parallel, copy);
+  if (xtrabackup_incremental_basedir != nullptr) {
+    rocksdb_skip_base_sst_files(checkpoint_files);
+  }
+
+  bool result = backup_rocksdb_files(checkpoint_files);
 
   if (!result) {
     xb::error() << "failed to backup rocksdb datadir.";
   }
 
+  if (result && final && !rocksdb_reused_sst.empty()) {
+    std::ostringstream list;
+    for (const auto &f : rocksdb_reused_sst) {
+      list << f.first << "\t" << f.second << "\n";
+    }
+    result = backup_file_print(XTRABACKUP_ROCKSDB_REUSED_SST,
+                               list.str().c_str(), list.str().size());
+  }
+
   return result;
 }
 
@@ -1396,21 +2093,33 @@ bool backup_start(Backup_context &context) {
       }
     }
 
+    xb::report::Phase precopy_phase("copy_non_innodb");
     if (!backup_files(MySQL_datadir_path.path().c_str(), true, context)) {
       return (false);
     }
+    precopy_phase.end();
+
+    if (!precopy_current_binlog_file(mysql_connection)) {
+      return (false);
+    }
 
     history_lock_time = time(NULL);
 
+    if (!xb_index_load_wait(mysql_connection, context.redo_mgr)) {
+      return (false);
+    }
+
     if (!lock_tables_maybe(mysql_connection, opt_backup_lock_timeout,
                            opt_backup_lock_retry_count)) {
       return (false);
     }
   }
 
+  xb::report::Phase locked_copy_phase("copy_non_innodb_locked");
   if (!backup_files(MySQL_datadir_path.path().c_str(), false, context)) {
     return (false);
   }
+  locked_copy_phase.end();
 
   /* There is no need to stop slave thread before copying non-Innodb data when
   --no-lock option is used because --no-lock option requires that no DDL or
@@ -1455,6 +2164,14 @@ bool backup_start(Backup_context &context) {
   xb_mysql_query(mysql_connection, "FLUSH NO_WRITE_TO_BINLOG BINARY LOGS",
                  false);
 
+  if (!xb_index_load_recopy(mysql_connection, context.redo_mgr)) {
+    return (false);
+  }
+
+  if (!xb_snapshot_create()) {
+    return (false);
+  }
+
   log_status_get(mysql_connection);
 
   /* Wait until we have checkpoint LSN greater than the page tracking start LSN.
@@ -1559,6 +2276,10 @@ bool backup_finish(Backup_context &context) {
     context.myrocks_checkpoint.remove();
   }
 
+#ifdef HAVE_VERSION_CHECK
+  version_check_wait();
+#endif
+
   xb::info() << "Backup created in directory " << SQUOTE(xtrabackup_target_dir);
 
   if (!mysql_binlog_position.empty()) {
@@ -1747,6 +2468,7 @@ bool copy_incremental_over_full() {
       "xtrabackup_info",
       "xtrabackup_keys",
       "xtrabackup_tablespaces",
+      XTRABACKUP_REPORT,
       xtrabackup::components::XTRABACKUP_KEYRING_FILE_CONFIG,
       xtrabackup::components::XTRABACKUP_KEYRING_KMIP_CONFIG,
       xtrabackup::components::XTRABACKUP_KEYRING_KMS_CONFIG,
@@ -1849,18 +2571,39 @@ bool copy_incremental_over_full() {
   if (directory_exists(path, false)) {
     Myrocks_datadir rocksdb(path);
 
+    /* SST files the incremental backup did not copy again */
+    std::unordered_set<std::string> reused;
+    snprintf(path, sizeof(path), "%s/%s", xtrabackup_incremental_dir,
+             XTRABACKUP_ROCKSDB_REUSED_SST);
+    std::ifstream list(path);
+    std::string name;
+    uint64_t size;
+    while (list >> name >> size) {
+      snprintf(path, sizeof(path), "%s/%s", ROCKSDB_SUBDIR, name.c_str());
+      if (!file_exists(path)) {
+        xb::error() << "the full backup has no " << SQUOTE(path)
+                    << ", which the incremental backup reuses";
+        ret = false;
+        goto cleanup;
+      }
+      reused.insert(name);
+    }
+
     if (directory_exists(ROCKSDB_SUBDIR, false)) {
       Myrocks_datadir old_rocksdb(ROCKSDB_SUBDIR);
 
       /* remove .rocksdb from the full backup first */
       for (const auto &file : old_rocksdb.files()) {
+        if (reused.count(file.file_name) > 0) {
+          continue;
+        }
         if (unlink(file.path.c_str())) {
           xb::error() << "unable to unlink file " << SQUOTE(file.path.c_str());
           ret = false;
           goto cleanup;
         }
       }
-      if (rmdir(ROCKSDB_SUBDIR)) {
+      if (reused.empty() && rmdir(ROCKSDB_SUBDIR)) {
         xb::error() << "unable to remove directory " << SQUOTE(ROCKSDB_SUBDIR);
         ret = false;
         goto cleanup;
@@ -1946,41 +2689,48 @@ bool apply_log_finish() {
 
 bool should_skip_file_on_copy_back(const char *filepath) {
   const char *filename;
+  const char *ext;
   char c_tmp;
   int i_tmp;
 
-  const char *ext_list[] = {
+  /* looked up by hash, copy-back calls this for every file */
+  static const std::unordered_set<std::string> name_set = {
       "backup-my.cnf",
       "xtrabackup_logfile",
       "xtrabackup_binary",
       "xtrabackup_binlog_info",
       "xtrabackup_checkpoints",
       "xtrabackup_tablespaces",
+      XTRABACKUP_REPORT,
+      XTRABACKUP_PREPARE_REPORT,
+      XTRABACKUP_ZSTD_DICT,
+      xb::file_checksums::FILENAME,
       xtrabackup::components::XTRABACKUP_KEYRING_FILE_CONFIG,
       xtrabackup::components::XTRABACKUP_KEYRING_KMIP_CONFIG,
-      xtrabackup::components::XTRABACKUP_KEYRING_KMS_CONFIG,
-      ".qp",
-      ".lz4",
-      ".zst",
-      ".pmap",
-      ".tmp",
-      ".xbcrypt",
-      NULL};
+      xtrabackup::components::XTRABACKUP_KEYRING_KMS_CONFIG};
+  static const std::unordered_set<std::string> ext_set = {
+      ".qp", ".lz4", ".zst", ".pmap", ".tmp", ".xbcrypt"};
 
   filename = base_name(filepath);
 
+  if (name_set.count(filename) > 0) {
+    return true;
+  }
+
   /* skip .qp and .xbcrypt files */
-  if (filename_matches(filename, ext_list)) {
+  if ((ext = strrchr(filename, '.')) != nullptr && ext_set.count(ext) > 0) {
     return true;
   }
 
   /* skip undo tablespaces */
-  if (sscanf(filename, "undo_%d%c", &i_tmp, &c_tmp) == 1) {
+  if (strncmp(filename, "undo_", 5) == 0 &&
+      sscanf(filename, "undo_%d%c", &i_tmp, &c_tmp) == 1) {
     return true;
   }
 
   /* skip redo logs */
-  if (sscanf(filename, "ib_logfile%d%c", &i_tmp, &c_tmp) == 1) {
+  if (strncmp(filename, "ib_logfile", 10) == 0 &&
+      sscanf(filename, "ib_logfile%d%c", &i_tmp, &c_tmp) == 1) {
     return true;
   }
 
@@ -2004,6 +2754,275 @@ bool should_skip_file_on_copy_back(const char *filepath) {
   return false;
 }
 
+/** Check if a file of the backup belongs to an InnoDB tablespace.
+@param[in]	entry	datadir entry
+@return true if the file is an InnoDB data file */
+static bool is_innodb_data_file(const datadir_entry_t &entry) {
+  char c_tmp;
+  int i_tmp;
+
+  if (Fil_path::has_suffix(IBD, entry.rel_path) ||
+      Fil_path::has_suffix(IBU, entry.rel_path)) {
+    return (true);
+  }
+
+  if (!entry.db_name.empty()) {
+    return (false);
+  }
+
+  if (sscanf(entry.file_name.c_str(), "undo_%d%c", &i_tmp, &c_tmp) == 1) {
+    return (true);
+  }
+
+  for (auto iter(srv_sys_space.files_begin()), end(srv_sys_space.files_end());
+       iter != end; ++iter) {
+    if (strcmp(iter->name(), entry.file_name.c_str()) == 0) {
+      return (true);
+    }
+  }
+
+  return (false);
+}
+
+/** Read the space id from the header of the first page of a data file.
+@param[in]	path	data file path
+@return space id or SPACE_UNKNOWN if it cannot be read */
+static space_id_t read_first_page_space_id(const char *path) {
+  byte buf[FIL_PAGE_DATA];
+  space_id_t space_id = SPACE_UNKNOWN;
+
+  File fd = my_open(path, O_RDONLY, MYF(MY_WME));
+  if (fd < 0) {
+    return (space_id);
+  }
+
+  if (my_pread(fd, buf, sizeof(buf), 0, MYF(MY_WME | MY_NABP)) == 0) {
+    space_id = mach_read_from_4(buf + FIL_PAGE_SPACE_ID);
+  }
+
+  my_close(fd, MYF(MY_WME));
+
+  return (space_id);
+}
+
+/** Check that the incremental backup in --incremental-dir can be applied
+while copying back. The data files of the full backup and the .delta files
+must match one to one with the same space ids, which does not hold when
+tablespaces were created, dropped or renamed between the two backups. The
+files must also all go to the datadir, where --prepare applies the redo log
+of the incremental backup next.
+@return true if the incremental backup can be applied */
+static bool copy_back_incremental_check() {
+  const char *dirs[] = {srv_undo_dir, innobase_data_home_dir,
+                        srv_log_group_home_dir};
+  bool ret = true;
+
+  for (const char *dir : dirs) {
+    if (dir != nullptr && *dir != 0 &&
+        !Fil_path(mysql_data_home).is_same_as(dir)) {
+      xb::error() << "Option --incremental-dir needs the InnoDB files in the "
+                     "datadir, not in "
+                  << SQUOTE(dir);
+      return (false);
+    }
+  }
+
+  char path[FN_REFLEN];
+  snprintf(path, sizeof(path), "%s/%s", xtrabackup_incremental_dir,
+           ROCKSDB_SUBDIR);
+  if (directory_exists(ROCKSDB_SUBDIR, false) ||
+      directory_exists(path, false)) {
+    xb::error() << "Option --incremental-dir is not supported with MyRocks";
+    return (false);
+  }
+
+  auto unsupported = [](const std::string &rel_path) {
+    xb::error() << "The incremental backup has no matching .delta file "
+                   "for "
+                << SQUOTE(rel_path.c_str())
+                << ", prepare it into the full backup instead";
+  };
+
+  xb_process_datadir(
+      ".", "",
+      [&](const datadir_entry_t &entry, void *) {
+        if (entry.is_empty_dir || !is_innodb_data_file(entry)) {
+          return (true);
+        }
+
+        if (!Tablespace_map::instance().empty() &&
+            Fil_path::has_suffix(IBD, entry.rel_path) &&
+            !Tablespace_map::instance()
+                 .external_file_name(entry.rel_path.substr(
+                     0, entry.rel_path.length() - 4))
+                 .empty()) {
+          xb::error() << "Option --incremental-dir does not support the "
+                         "tablespaces outside of the datadir like "
+                      << SQUOTE(entry.rel_path.c_str());
+          ret = false;
+          return (true);
+        }
+
+        char delta_path[FN_REFLEN];
+        char meta_path[FN_REFLEN];
+        xb_delta_info_t info;
+        snprintf(delta_path, sizeof(delta_path), "%s/%s.delta",
+                 xtrabackup_incremental_dir, entry.rel_path.c_str());
+        snprintf(meta_path, sizeof(meta_path), "%s/%s.meta",
+                 xtrabackup_incremental_dir, entry.rel_path.c_str());
+
+        if (!file_exists(delta_path) ||
+            !xb_read_delta_metadata(meta_path, &info) ||
+            info.space_id !=
+                read_first_page_space_id(entry.rel_path.c_str())) {
+          unsupported(entry.rel_path);
+          ret = false;
+        }
+        return (true);
+      },
+      nullptr);
+
+  xb_process_datadir(
+      xtrabackup_incremental_dir, ".delta",
+      [&](const datadir_entry_t &entry, void *) {
+        const std::string rel_path =
+            entry.rel_path.substr(0, entry.rel_path.length() - 6);
+        if (!file_exists(rel_path.c_str())) {
+          xb::error() << "The full backup has no " << SQUOTE(rel_path.c_str())
+                      << ", prepare the incremental backup into it instead";
+          ret = false;
+        }
+        return (true);
+      },
+      nullptr);
+
+  return (ret);
+}
+
+/** Copy the files of --incremental-dir other than the .delta files that the
+copy back took from the full backup otherwise: the database directories, the
+redo log and the metadata that --prepare reads in the datadir.
+@return true in case of success. */
+static bool copy_back_incremental_files() {
+  const char *meta_files[] = {
+      "backup-my.cnf",
+      XB_LOG_FILENAME,
+      "xtrabackup_binlog_info",
+      "xtrabackup_tablespaces",
+      xtrabackup::components::XTRABACKUP_KEYRING_FILE_CONFIG,
+      xtrabackup::components::XTRABACKUP_KEYRING_KMIP_CONFIG,
+      xtrabackup::components::XTRABACKUP_KEYRING_KMS_CONFIG,
+      nullptr};
+  char path[FN_REFLEN];
+
+  for (int i = 0; meta_files[i] != nullptr; i++) {
+    snprintf(path, sizeof(path), "%s/%s", xtrabackup_incremental_dir,
+             meta_files[i]);
+    if (file_exists(path) &&
+        !copy_file(ds_data, path, meta_files[i], 0, FILE_PURPOSE_OTHER)) {
+      return (false);
+    }
+  }
+
+  return (xb_process_datadir(
+      xtrabackup_incremental_dir, "",
+      [](const datadir_entry_t &entry, void *) {
+        if (entry.is_empty_dir) {
+          char dir[FN_REFLEN];
+          snprintf(dir, sizeof(dir), "%s/%s", mysql_data_home,
+                   entry.rel_path.c_str());
+          return (mkdirp(dir, 0777, MYF(0)) == 0);
+        }
+
+        if (entry.db_name.empty() || is_innodb_data_file(entry) ||
+            ends_with(entry.rel_path.c_str(), ".delta") ||
+            ends_with(entry.rel_path.c_str(), ".meta") ||
+            should_skip_file_on_copy_back(entry.path.c_str())) {
+          return (true);
+        }
+
+        return (copy_file(ds_data, entry.path.c_str(), entry.rel_path.c_str(),
+                          1, FILE_PURPOSE_OTHER));
+      },
+      nullptr));
+}
+
+/************************************************************************
+Find where a file of the backup is copied back to.
+@param[in]	entry		file of the backup
+@param[out]	file_purpose	purpose of the file
+@return destination path, relative to the datadir unless absolute */
+static std::string copy_back_dst_path(const datadir_entry_t &entry,
+                                      file_purpose_t *file_purpose) {
+  if (Fil_path::has_suffix(IBD, entry.path)) {
+    *file_purpose = FILE_PURPOSE_DATAFILE;
+  } else if (Fil_path::has_suffix(IBU, entry.path)) {
+    *file_purpose = FILE_PURPOSE_UNDO_LOG;
+  } else {
+    *file_purpose = FILE_PURPOSE_OTHER;
+  }
+
+  std::string dst_path = entry.rel_path;
+
+  if (*file_purpose == FILE_PURPOSE_UNDO_LOG) {
+    /* undo tablespace can only be in undo_dir or data dir */
+    std::string dst_dir =
+        (srv_undo_dir && *srv_undo_dir) ? srv_undo_dir : mysql_data_home;
+    dst_path = dst_dir + "/" + dst_path;
+  } else if (*file_purpose == FILE_PURPOSE_DATAFILE &&
+             !Tablespace_map::instance().empty()) {
+    /* Remove starting ./ and trailing .ibd/.ibu from tablespace name */
+    const std::string tablespace_name =
+        entry.path.substr(2, entry.path.length() - 6);
+    const std::string &external_file_name =
+        Tablespace_map::instance().external_file_name(tablespace_name);
+    if (!external_file_name.empty()) {
+      /* This is external tablespace. Copy it to it's original
+      location */
+      dst_path = external_file_name;
+    }
+  }
+
+  return (dst_path);
+}
+
+/************************************************************************
+Split a large file to copy back into ranges of --datafile-split-size, so that
+several copy-back threads fill its target concurrently. The target is created
+at its full size here, before any of the ranges is queued.
+@param[in]	entry	file of the backup
+@param[out]	ranges	ranges of the file
+@return true if the file was split */
+static bool copy_back_split_file(const datadir_entry_t &entry,
+                                 std::vector<datadir_entry_t> &ranges) {
+  if (opt_datafile_split_size == 0 || !xtrabackup_copy_back ||
+      opt_reflink_only ||
+      xtrabackup_incremental_dir != nullptr || entry.is_empty_dir ||
+      entry.file_size < 0 ||
+      static_cast<uint64_t>(entry.file_size) < 2 * opt_datafile_split_size ||
+      should_skip_file_on_copy_back(entry.path.c_str())) {
+    return (false);
+  }
+
+  /* only the files which are copied to the datadir itself */
+  file_purpose_t file_purpose;
+  if (copy_back_dst_path(entry, &file_purpose) != entry.rel_path ||
+      !ds_local_create(ds_data, entry.rel_path.c_str(), entry.file_size)) {
+    return (false);
+  }
+
+  const uint64_t size = entry.file_size;
+  for (uint64_t start = 0; start < size; start += opt_datafile_split_size) {
+    datadir_entry_t range(entry);
+    range.range_start = start;
+    range.range_end = std::min<uint64_t>(start + opt_datafile_split_size, size);
+    range.file_size = range.range_end - range.range_start;
+    ranges.push_back(range);
+  }
+
+  return (true);
+}
+
 static void copy_back_thread_func(datadir_thread_ctxt_t *ctx) {
   bool ret = true;
   datadir_entry_t entry;
@@ -2040,33 +3059,29 @@ static void copy_back_thread_func(datadir_thread_ctxt_t *ctx) {
       continue;
     }
 
+    /* the database directories are taken from the incremental backup */
+    if (xtrabackup_incremental_dir != nullptr && !entry.db_name.empty() &&
+        !is_innodb_data_file(entry)) {
+      continue;
+    }
+
     file_purpose_t file_purpose;
-    if (Fil_path::has_suffix(IBD, entry.path)) {
-      file_purpose = FILE_PURPOSE_DATAFILE;
-    } else if (Fil_path::has_suffix(IBU, entry.path)) {
-      file_purpose = FILE_PURPOSE_UNDO_LOG;
-    } else {
-      file_purpose = FILE_PURPOSE_OTHER;
-    }
-
-    std::string dst_path = entry.rel_path;
-
-    if (file_purpose == FILE_PURPOSE_UNDO_LOG) {
-      /* undo tablespace can only be in undo_dir or data dir */
-      std::string dst_dir =
-          (srv_undo_dir && *srv_undo_dir) ? srv_undo_dir : mysql_data_home;
-      dst_path = dst_dir + "/" + dst_path;
-    } else if (file_purpose == FILE_PURPOSE_DATAFILE) {
-      std::string tablespace_name = entry.path;
-      /* Remove starting ./ and trailing .ibd/.ibu from tablespace name */
-      tablespace_name = tablespace_name.substr(2, tablespace_name.length() - 6);
-      std::string external_file_name =
-          Tablespace_map::instance().external_file_name(tablespace_name);
-      if (!external_file_name.empty()) {
-        /* This is external tablespace. Copy it to it's original
-        location */
-        dst_path = external_file_name;
+    std::string dst_path = copy_back_dst_path(entry, &file_purpose);
+
+    if (entry.range_end > 0) {
+      if (!(ret = copy_file_part(ds_data, entry.path.c_str(), dst_path.c_str(),
+                                 file_purpose, entry.range_start,
+                                 entry.range_end))) {
+        goto cleanup;
       }
+      /* the header page is in the first range */
+      if (opt_generate_new_master_key && entry.range_start == 0 &&
+          file_purpose == FILE_PURPOSE_DATAFILE) {
+        reencrypt_datafile_header(mysql_data_home, dst_path.c_str(),
+                                  ctx->n_thread);
+      }
+      if (restore_progress) restore_progress->done(entry.file_size);
+      continue;
     }
 
     if (!(ret = copy_or_move_file(entry.path.c_str(), dst_path.c_str(),
@@ -2074,6 +3089,7 @@ static void copy_back_thread_func(datadir_thread_ctxt_t *ctx) {
                                   file_purpose))) {
       goto cleanup;
     }
+    if (restore_progress) restore_progress->done(entry.file_size);
   }
 
 cleanup:
@@ -2087,6 +3103,144 @@ cleanup:
   ctx->ret = ret;
 }
 
+/************************************************************************
+Sync the directories the files were moved to by --move-back, once each
+rather than after every rename.
+@return true in case of success. */
+static bool sync_move_back_dirs() {
+  for (const auto &dir : move_back_dirs) {
+    File fd = my_open(dir.c_str(), O_RDONLY, MYF(MY_WME));
+    if (fd < 0 || my_sync(fd, MYF(MY_WME)) != 0) {
+      xb::error() << "failed to sync directory " << SQUOTE(dir.c_str());
+      if (fd >= 0) my_close(fd, MYF(MY_WME));
+      return (false);
+    }
+    my_close(fd, MYF(MY_WME));
+  }
+  move_back_dirs.clear();
+
+  return (true);
+}
+
+/** Base name of the relay logs of --pitr-binlog-dir */
+static const char *PITR_RELAY_LOG = "xtrabackup-pitr-relay";
+
+/** Statements replaying the relay logs of --pitr-binlog-dir */
+static const char *PITR_APPLY_SQL = "xtrabackup_pitr_apply.sql";
+
+/** Copy the binary logs of --pitr-binlog-dir from the binary log position of
+the backup on to the datadir as relay logs, and write PITR_APPLY_SQL pointing
+the replication applier at the position. ds_data must write to the datadir.
+@param[in]  src_dir  directory of xtrabackup_binlog_info
+@return false on error */
+static bool copy_back_pitr_relay_logs(const char *src_dir) {
+  const std::string info_path =
+      std::string(src_dir) + "/" + XTRABACKUP_BINLOG_INFO;
+  std::ifstream info(info_path);
+  std::string start_name;
+  uint64_t start_pos;
+
+  if (!(info >> start_name >> start_pos)) {
+    xb::error() << "--pitr-binlog-dir: cannot read the binary log position "
+                   "of the backup from "
+                << info_path;
+    return (false);
+  }
+
+  /* binary logs are named <base>.<sequence number> */
+  const auto dot = start_name.rfind('.');
+  if (dot == std::string::npos) {
+    xb::error() << "--pitr-binlog-dir: unexpected binary log name "
+                << start_name;
+    return (false);
+  }
+  const std::string base = start_name.substr(0, dot + 1);
+  const ulong start_seq = strtoul(start_name.c_str() + dot + 1, nullptr, 10);
+
+  DIR *dir = opendir(opt_pitr_binlog_dir);
+  if (dir == nullptr) {
+    xb::error() << "--pitr-binlog-dir: cannot open " << opt_pitr_binlog_dir;
+    return (false);
+  }
+
+  std::map<ulong, std::string> binlogs;
+  struct dirent *dp;
+  while ((dp = readdir(dir)) != nullptr) {
+    const std::string name(dp->d_name);
+    if (name.compare(0, base.size(), base) != 0 || name.size() == base.size() ||
+        name.find_first_not_of("0123456789", base.size()) !=
+            std::string::npos) {
+      continue;
+    }
+    const ulong seq = strtoul(name.c_str() + base.size(), nullptr, 10);
+    if (seq >= start_seq) {
+      binlogs[seq] = name;
+    }
+  }
+  closedir(dir);
+
+  if (binlogs.empty() || binlogs.begin()->first != start_seq) {
+    xb::error() << "--pitr-binlog-dir: " << start_name
+                << ", the binary log of the backup position, is not in "
+                << opt_pitr_binlog_dir;
+    return (false);
+  }
+
+  std::ofstream index(std::string(mysql_data_home) + "/" + PITR_RELAY_LOG +
+                      ".index");
+  uint relay_seq = 0;
+  ulong prev_seq = start_seq;
+  for (const auto &binlog : binlogs) {
+    if (binlog.first != prev_seq && binlog.first != prev_seq + 1) {
+      xb::warn() << "--pitr-binlog-dir: the binary logs after " << base
+                 << prev_seq << " are missing, replaying up to it";
+      break;
+    }
+    prev_seq = binlog.first;
+
+    char relay_name[FN_REFLEN];
+    snprintf(relay_name, sizeof(relay_name), "%s.%06u", PITR_RELAY_LOG,
+             ++relay_seq);
+    const std::string src =
+        std::string(opt_pitr_binlog_dir) + "/" + binlog.second;
+    if (!copy_file(ds_data, src.c_str(), relay_name, 0, FILE_PURPOSE_BINLOG)) {
+      return (false);
+    }
+    index << "./" << relay_name << std::endl;
+  }
+
+  std::ofstream sql(std::string(mysql_data_home) + "/" + PITR_APPLY_SQL);
+  sql << "-- Replays the binary logs archived after the backup with the "
+         "replication applier.\n"
+         "-- Start the server with --relay-log="
+      << PITR_RELAY_LOG
+      << " --skip-replica-start, and with\n"
+         "-- --replicate-same-server-id if its server_id is the one of the "
+         "binary logs.\n"
+         "CHANGE REPLICATION SOURCE TO SOURCE_HOST='xtrabackup-pitr', "
+         "RELAY_LOG_FILE='"
+      << PITR_RELAY_LOG << ".000001', RELAY_LOG_POS=" << start_pos
+      << ";\n"
+         "SET GLOBAL replica_parallel_workers = "
+      << xtrabackup::utils::host_cpu_count()
+      << ";\n"
+         "SET GLOBAL replica_preserve_commit_order = ON;\n"
+         "-- add UNTIL SQL_BEFORE_GTIDS = '...' to stop at a transaction\n"
+         "START REPLICA SQL_THREAD;\n";
+  if (!index || !sql) {
+    xb::error() << "--pitr-binlog-dir: cannot write " << PITR_RELAY_LOG
+                << ".index or " << PITR_APPLY_SQL;
+    return (false);
+  }
+
+  xb::info() << "Copied " << relay_seq << " binary logs from "
+             << opt_pitr_binlog_dir << " as relay logs, run "
+             << PITR_APPLY_SQL << " to replay them from " << start_name << ":"
+             << start_pos;
+
+  return (true);
+}
+
 bool copy_back(int argc, char **argv) {
   char *innobase_data_file_path_copy;
   bool ret = true, err;
@@ -2095,6 +3249,11 @@ bool copy_back(int argc, char **argv) {
 
   ut_crc32_init();
 
+  if (opt_reflink_only && xtrabackup_incremental_dir != nullptr) {
+    xb::error() << "--reflink-only cannot be used with --incremental-dir";
+    return (false);
+  }
+
   if (!opt_force_non_empty_dirs) {
     if (!directory_exists_and_empty(mysql_data_home, "Original data")) {
       return (false);
@@ -2122,6 +3281,26 @@ bool copy_back(int argc, char **argv) {
     return (false);
   }
 
+  if (file_exists(XB_FAST_PREPARE_FILENAME)) {
+    xb::error() << "A --fast-prepare of " << SQUOTE(xtrabackup_target_dir)
+                << " was interrupted, the backup cannot be copied back. "
+                   "Restore it from a copy and prepare it again.";
+    return (false);
+  }
+
+  /* the files of an incremental backup merged on the way have other
+  checksums */
+  if (file_exists(xb::file_checksums::FILENAME) &&
+      xtrabackup_incremental_dir == nullptr) {
+    crc_init();
+    if (!xb::file_checksums::read(xb::file_checksums::FILENAME,
+                                  &copy_back_expected_checksums)) {
+      xb::error() << "failed to load " << xb::file_checksums::FILENAME;
+      return (false);
+    }
+    copy_back_check_checksums = true;
+  }
+
   my_option backup_options[] = {
       {"innodb_checksum_algorithm", 0, "", &srv_checksum_algorithm,
        &srv_checksum_algorithm, &innodb_checksum_algorithm_typelib, GET_ENUM,
@@ -2208,6 +3387,11 @@ bool copy_back(int argc, char **argv) {
   sync_check_init(srv_max_n_threads);
   ut_crc32_init();
 
+  if (xtrabackup_incremental_dir != nullptr &&
+      !copy_back_incremental_check()) {
+    return (false);
+  }
+
   /* copy undo tablespaces */
   if (srv_undo_tablespaces > 0) {
     dst_dir = (srv_undo_dir && *srv_undo_dir) ? srv_undo_dir : mysql_data_home;
@@ -2278,12 +3462,31 @@ bool copy_back(int argc, char **argv) {
   /* copy the rest of tablespaces */
   ds_data = ds_create(mysql_data_home, DS_TYPE_LOCAL);
 
+  /* the binary log of the incremental backup replaces the full backup one */
+  if (xtrabackup_incremental_dir != nullptr) {
+    binlog_file_location base_binlog;
+    if (binlog_file_location::find_binlog(".", base_binlog, err)) {
+      skip_copy_back_list.insert(base_binlog.name.c_str());
+      skip_copy_back_list.insert(base_binlog.index_name.c_str());
+    }
+    if (err) goto cleanup;
+  }
+
   /* copy binary log and .index files */
-  if (binlog_file_location::find_binlog(".", binlog, err)) {
+  if (binlog_file_location::find_binlog(
+          xtrabackup_incremental_dir != nullptr ? xtrabackup_incremental_dir
+                                                : ".",
+          binlog, err)) {
     const auto target = binlog.target_location(mysql_data_home);
+    const std::string src_dir =
+        xtrabackup_incremental_dir != nullptr
+            ? std::string(xtrabackup_incremental_dir) + "/"
+            : std::string();
+    const std::string binlog_src = src_dir + binlog.name;
+    const std::string index_src = src_dir + binlog.index_name;
 
     if (!target.name.empty()) {
-      if (!(ret = copy_or_move_file(binlog.name.c_str(), target.path.c_str(),
+      if (!(ret = copy_or_move_file(binlog_src.c_str(), target.path.c_str(),
                                     mysql_data_home, 1, FILE_PURPOSE_BINLOG))) {
         goto cleanup;
       }
@@ -2297,7 +3500,7 @@ bool copy_back(int argc, char **argv) {
       skip_copy_back_list.insert(binlog.name.c_str());
     }
     if (!target.index_name.empty()) {
-      if (!(ret = copy_or_move_file(binlog.index_name.c_str(),
+      if (!(ret = copy_or_move_file(index_src.c_str(),
                                     target.index_path.c_str(), mysql_data_home,
                                     1, FILE_PURPOSE_BINLOG))) {
         goto cleanup;
@@ -2323,10 +3526,39 @@ bool copy_back(int argc, char **argv) {
                << " threads for parallel data files transfer";
   }
 
+  if (!xtrabackup_copy_back) {
+    MY_STAT backup_stat;
+    MY_STAT datadir_stat;
+
+    move_back_cross_device =
+        my_stat(".", &backup_stat, MYF(0)) != nullptr &&
+        my_stat(mysql_data_home, &datadir_stat, MYF(0)) != nullptr &&
+        backup_stat.st_dev != datadir_stat.st_dev;
+    if (move_back_cross_device) {
+      xb::info() << "The backup directory and " << mysql_data_home
+                 << " are on different devices, the files are copied "
+                    "instead of renamed";
+    }
+  }
+
+  if (opt_restore_progress_interval > 0) {
+    restore_progress.reset(new restore_progress_t(
+        xtrabackup_copy_back ? "copy-back" : "move-back"));
+  }
+
   ret = run_data_threads(".", copy_back_thread_func, xtrabackup_parallel,
-                         "copy-back");
+                         "copy-back",
+                         xtrabackup_parallel > 1 &&
+                             (xtrabackup_copy_back || move_back_cross_device),
+                         copy_back_split_file);
+  restore_progress.reset();
   if (!ret) goto cleanup;
 
+  if (xtrabackup_incremental_dir != nullptr &&
+      !(ret = copy_back_incremental_files())) {
+    goto cleanup;
+  }
+
   /* copy buffer pool dump */
   if (innobase_buffer_pool_filename) {
     const char *src_name;
@@ -2344,6 +3576,13 @@ bool copy_back(int argc, char **argv) {
     }
   }
 
+  if (opt_pitr_binlog_dir != nullptr &&
+      !(ret = copy_back_pitr_relay_logs(xtrabackup_incremental_dir != nullptr
+                                            ? xtrabackup_incremental_dir
+                                            : "."))) {
+    goto cleanup;
+  }
+
   ds_destroy(ds_data);
   ds_data = NULL;
 
@@ -2418,6 +3657,24 @@ bool copy_back(int argc, char **argv) {
     }
   }
 
+  if (!xtrabackup_copy_back) {
+    ret = sync_move_back_dirs();
+  }
+
+  if (ret && copy_back_check_checksums) {
+    size_t n_checked;
+    if (!xb::file_checksums::check(copy_back_expected_checksums,
+                                   copy_back_checksums.entries(), nullptr,
+                                   &n_checked)) {
+      xb::error() << "files copied from " << xtrabackup_target_dir
+                  << " do not match " << xb::file_checksums::FILENAME;
+      ret = false;
+      goto cleanup;
+    }
+    xb::info() << "Checked " << n_checked << " files against "
+               << xb::file_checksums::FILENAME;
+  }
+
 cleanup:
 
   free(innobase_data_file_path_copy);
@@ -2428,6 +3685,8 @@ cleanup:
 
   ds_data = NULL;
 
+  copy_back_check_checksums = false;
+
   xb_keyring_shutdown();
 
   sync_check_close();
@@ -2450,6 +3709,88 @@ static bool is_valid_filename_path(const char *filepath) {
   return (match == REG_NOMATCH) ? false : true;
 }
 
+/** Get the path a decrypted or decompressed file is written to.
+@param[in]	path	path of the file relative to the backup directory
+@return the path in --decompress-dir if given, else path */
+static std::string decompressed_path(const char *path) {
+  if (opt_decompress_dir == nullptr) {
+    return (path);
+  }
+  return (std::string(opt_decompress_dir) + "/" + trim_dotslash(path));
+}
+
+/* in-process decompression of the unencrypted .lz4 and .zst files, which
+decodes the chunks of a single file by several threads */
+static ds_ctxt_t *ds_decompress_lz4_ctxt = nullptr;
+static ds_ctxt_t *ds_decompress_zstd_ctxt = nullptr;
+
+/** Decompress a file through a decompression datasink into ds_data.
+@param[in]	ds		decompression datasink
+@param[in]	filepath	path of the compressed file
+@return true in case of success. */
+static bool decompress_file(ds_ctxt_t *ds, const char *filepath) {
+  const size_t buf_size = 10 * 1024 * 1024;
+  std::string dest_path = decompressed_path(filepath);
+  MY_STAT stat_info;
+  bool success = false;
+
+  /* strip the .lz4 or .zst extension */
+  dest_path.resize(dest_path.length() - 4);
+
+  xb::info() << "decompressing " << filepath;
+
+  /* like the command pipeline, overwrite an earlier decompressed copy */
+  if (file_exists(dest_path.c_str()) &&
+      my_delete(dest_path.c_str(), MYF(MY_WME)) != 0) {
+    return (false);
+  }
+
+  File fd = my_open(filepath, O_RDONLY, MYF(MY_WME));
+  if (fd < 0) {
+    return (false);
+  }
+
+  auto buf = ut::make_unique<uchar[]>(UT_NEW_THIS_FILE_PSI_KEY, buf_size);
+  ds_file_t *file = my_fstat(fd, &stat_info) != 0
+                        ? nullptr
+                        : ds_open(ds, trim_dotslash(filepath), &stat_info);
+  if (file != nullptr) {
+    while (true) {
+      size_t len = my_read(fd, buf.get(), buf_size, MYF(MY_WME));
+      if (len == MY_FILE_ERROR) break;
+      if (len == 0) {
+        success = true;
+        break;
+      }
+      if (ds_write(file, buf.get(), len)) break;
+    }
+    if (ds_close(file) != 0) success = false;
+  }
+  my_close(fd, MYF(MY_WME));
+
+  if (!success) {
+    xb::error() << "failed to decompress " << filepath;
+    return (false);
+  }
+
+  if (opt_remove_original) {
+    xb::info() << "removing " << filepath;
+    if (my_delete(filepath, MYF(MY_WME)) != 0) {
+      return (false);
+    }
+  }
+
+  if (ds_data->fs_support_punch_hole) {
+    char error[512];
+    if (!restore_sparseness(dest_path.c_str(), opt_read_buffer_size, error)) {
+      xb::warn() << "restore_sparseness failed for file: " << dest_path
+                 << " Error: " << error;
+    }
+  }
+
+  return (true);
+}
+
 bool decrypt_decompress_file(const char *filepath, uint thread_n) {
   std::stringstream cmd, message;
   char buf[FN_LEN];
@@ -2467,6 +3808,15 @@ bool decrypt_decompress_file(const char *filepath, uint thread_n) {
     xb::error() << "Error escaping file : " << filepath;
     return false;
   }
+  if (opt_decompress && ds_decompress_lz4_ctxt != nullptr &&
+      ends_with(filepath, ".lz4")) {
+    return (decompress_file(ds_decompress_lz4_ctxt, filepath));
+  }
+  if (opt_decompress && ds_decompress_zstd_ctxt != nullptr &&
+      ends_with(filepath, ".zst")) {
+    return (decompress_file(ds_decompress_zstd_ctxt, filepath));
+  }
+
   char *dest_filepath = strdup(buf);
   cmd << "cat " << SQUOTE(buf);
 
@@ -2508,6 +3858,15 @@ bool decrypt_decompress_file(const char *filepath, uint thread_n) {
       (ends_with(filepath, ".zst") ||
        (ends_with(filepath, ".zst.xbcrypt") && opt_decrypt))) {
     cmd << " | zstd -d ";
+    /* the dictionary of --compress-zstd-dict-size, frames compressed
+    without it are decompressed as usual */
+    std::string dict = decompressed_path(XTRABACKUP_ZSTD_DICT);
+    if (!file_exists(dict.c_str())) {
+      dict = XTRABACKUP_ZSTD_DICT;
+    }
+    if (file_exists(dict.c_str())) {
+      cmd << "-D " << SQUOTE(dict) << " ";
+    }
     dest_filepath[strlen(dest_filepath) - 4] = 0;
     if (needs_action) {
       message << " and ";
@@ -2516,12 +3875,24 @@ bool decrypt_decompress_file(const char *filepath, uint thread_n) {
     needs_action = true;
   }
 
-  cmd << " > " << SQUOTE(dest_filepath);
+  const std::string dest_path = decompressed_path(dest_filepath);
+  cmd << " > " << SQUOTE(dest_path);
   message << " " << filepath;
 
   if (needs_action) {
     xb::info() << message.str().c_str();
 
+    char dirpath[FN_REFLEN];
+    size_t dirpath_len;
+    dirname_part(dirpath, dest_path.c_str(), &dirpath_len);
+    if (opt_decompress_dir != nullptr && mkdirp(dirpath, 0777, MYF(0)) < 0) {
+      char errbuf[MYSYS_STRERROR_SIZE];
+      xb::error() << "Can not create directory " << dirpath << ": "
+                  << my_strerror(errbuf, sizeof(errbuf), my_errno());
+      free(dest_filepath);
+      return (false);
+    }
+
     if (system(cmd.str().c_str()) != 0) {
       return (false);
     }
@@ -2533,10 +3904,17 @@ bool decrypt_decompress_file(const char *filepath, uint thread_n) {
       }
     }
   }
+  /* e.g. encrypted files without --decrypt */
+  if (!needs_action && opt_decompress_dir != nullptr) {
+    free(dest_filepath);
+    return (copy_file(ds_data, filepath, filepath, thread_n,
+                      FILE_PURPOSE_OTHER));
+  }
+
   if (ds_data->fs_support_punch_hole) {
     char error[512];
-    if (!restore_sparseness(dest_filepath, opt_read_buffer_size, error)) {
-      xb::warn() << "restore_sparseness failed for file: " << dest_filepath
+    if (!restore_sparseness(dest_path.c_str(), opt_read_buffer_size, error)) {
+      xb::warn() << "restore_sparseness failed for file: " << dest_path
                  << " Error: " << error;
     }
   }
@@ -2552,17 +3930,41 @@ static void decrypt_decompress_thread_func(datadir_thread_ctxt_t *ctxt) {
 
   while (ctxt->queue->pop(entry)) {
     if (entry.is_empty_dir) {
+      if (opt_decompress_dir != nullptr &&
+          mkdirp(decompressed_path(entry.path.c_str()).c_str(), 0777,
+                 MYF(0)) < 0) {
+        char errbuf[MYSYS_STRERROR_SIZE];
+        xb::error() << "Can not create directory "
+                    << decompressed_path(entry.path.c_str()) << ": "
+                    << my_strerror(errbuf, sizeof(errbuf), my_errno());
+        ret = false;
+        goto cleanup;
+      }
       continue;
     }
 
     if (!is_compressed_suffix(entry.path.c_str()) &&
         !is_encrypted_suffix(entry.path.c_str())) {
+      /* the dictionary is only needed to decompress the backup */
+      if (opt_decompress_dir != nullptr &&
+          strcmp(base_name(entry.path.c_str()), XTRABACKUP_ZSTD_DICT) != 0 &&
+          !(ret = copy_file(ds_data, entry.path.c_str(), entry.path.c_str(),
+                            ctxt->n_thread, FILE_PURPOSE_OTHER))) {
+        goto cleanup;
+      }
+      continue;
+    }
+
+    /* decrypted before the threads are started */
+    if (strcmp(base_name(entry.path.c_str()),
+               XTRABACKUP_ZSTD_DICT ".xbcrypt") == 0) {
       continue;
     }
 
     if (!(ret = decrypt_decompress_file(entry.path.c_str(), ctxt->n_thread))) {
       goto cleanup;
     }
+    if (restore_progress) restore_progress->done(entry.file_size);
   }
 
 cleanup:
@@ -2581,6 +3983,21 @@ bool decrypt_decompress() {
   os_event_global_init();
   sync_check_init(srv_max_n_threads);
 
+  if (opt_decompress_dir != nullptr) {
+    static char decompress_dir[FN_REFLEN];
+
+    if (opt_force_non_empty_dirs
+            ? !directory_exists(opt_decompress_dir, true)
+            : !directory_exists_and_empty(opt_decompress_dir, "Decompress")) {
+      return (false);
+    }
+    /* relative to the current directory, not to the backup directory */
+    if (my_realpath(decompress_dir, opt_decompress_dir, MYF(MY_WME))) {
+      return (false);
+    }
+    opt_decompress_dir = decompress_dir;
+  }
+
   /* cd to backup directory */
   if (my_setwd(xtrabackup_target_dir, MYF(MY_WME))) {
     xb::error() << "cannot my_setwd " << xtrabackup_target_dir;
@@ -2588,7 +4005,8 @@ bool decrypt_decompress() {
   }
 
   /* copy the rest of tablespaces */
-  ds_data = ds_create(".", DS_TYPE_LOCAL);
+  ds_data = ds_create(
+      opt_decompress_dir != nullptr ? opt_decompress_dir : ".", DS_TYPE_LOCAL);
 
   ut_a(xtrabackup_parallel >= 0);
 
@@ -2601,11 +4019,59 @@ bool decrypt_decompress() {
     xb::error() << "Error compiling filename regex";
     return (false);
   }
+
+  if (opt_decompress_dir != nullptr &&
+      !is_valid_filename_path(opt_decompress_dir)) {
+    xb::error() << "--decompress-dir " << opt_decompress_dir
+                << " has one or more invalid characters.";
+    xb_regfree(&preg_filepath);
+    return (false);
+  }
+
+  /* the zstd dictionary is needed to decompress the other files */
+  if (opt_decrypt && file_exists(XTRABACKUP_ZSTD_DICT ".xbcrypt") &&
+      !decrypt_decompress_file("./" XTRABACKUP_ZSTD_DICT ".xbcrypt", 0)) {
+    xb_regfree(&preg_filepath);
+    return (false);
+  }
+
+  if (opt_decompress) {
+    /* the zstd dictionary, if any, in the root of the datasink */
+    const std::string dict = decompressed_path(XTRABACKUP_ZSTD_DICT);
+    const char *dict_dir = opt_decompress_dir != nullptr &&
+                                   file_exists(dict.c_str())
+                               ? opt_decompress_dir
+                               : ".";
+
+    ds_decompress_lz4_threads = ds_decompress_zstd_threads =
+        std::max(xtrabackup_parallel, 1);
+    ds_decompress_lz4_ctxt = ds_create(".", DS_TYPE_DECOMPRESS_LZ4);
+    ds_set_pipe(ds_decompress_lz4_ctxt, ds_data);
+    ds_decompress_zstd_ctxt = ds_create(dict_dir, DS_TYPE_DECOMPRESS_ZSTD);
+    ds_set_pipe(ds_decompress_zstd_ctxt, ds_data);
+  }
+
+  if (opt_restore_progress_interval > 0) {
+    restore_progress.reset(new restore_progress_t(
+        !opt_decompress ? "decrypt"
+                        : (opt_decrypt ? "decrypt-decompress" : "decompress")));
+  }
+
   ret = run_data_threads(".", decrypt_decompress_thread_func,
                          xtrabackup_parallel, "decrypt and decompress");
+  restore_progress.reset();
 
   debug_sync_point("decrypt_decompress_func");
 
+  if (ds_decompress_lz4_ctxt != nullptr) {
+    ds_destroy(ds_decompress_lz4_ctxt);
+    ds_decompress_lz4_ctxt = nullptr;
+  }
+  if (ds_decompress_zstd_ctxt != nullptr) {
+    ds_destroy(ds_decompress_zstd_ctxt);
+    ds_decompress_zstd_ctxt = nullptr;
+  }
+
   if (ds_data != NULL) {
     ds_destroy(ds_data);
   }
@@ -2620,12 +4086,11 @@ bool decrypt_decompress() {
 }
 
 #ifdef HAVE_VERSION_CHECK
-void version_check() {
-  if (system("which perl > /dev/null 2>&1")) {
-    xb::info() << "perl binary not found. Skipping the version check";
-    return;
-  }
+/* runs the version check while the backup starts, not destroyed if the
+backup exits before joining it */
+static std::thread *version_check_thread = nullptr;
 
+void version_check() {
   if (opt_password != NULL) {
     setenv("option_mysql_password", opt_password, 1);
   }
@@ -2645,13 +4110,32 @@ void version_check() {
   }
   setenv("XTRABACKUP_VERSION", XTRABACKUP_VERSION, 1);
 
-  FILE *pipe = popen("perl", "w");
-  if (pipe == NULL) {
+  /* the environment is set before the thread starts, the script only reads
+  it */
+  version_check_thread = new std::thread([] {
+    if (system("which perl > /dev/null 2>&1")) {
+      xb::info() << "perl binary not found. Skipping the version check";
+      return;
+    }
+
+    FILE *pipe = popen("perl", "w");
+    if (pipe == NULL) {
+      return;
+    }
+
+    fwrite((const char *)version_check_pl, version_check_pl_len, 1, pipe);
+
+    pclose(pipe);
+  });
+}
+
+void version_check_wait() {
+  if (version_check_thread == nullptr) {
     return;
   }
 
-  fwrite((const char *)version_check_pl, version_check_pl_len, 1, pipe);
-
-  pclose(pipe);
+  version_check_thread->join();
+  delete version_check_thread;
+  version_check_thread = nullptr;
 }
 #endif
@@ -29,6 +29,9 @@ struct Backup_context;
 #define XTRABACKUP_GALERA_INFO "xtrabackup_galera_info"
 #define XTRABACKUP_BINLOG_INFO "xtrabackup_binlog_info"
 #define XTRABACKUP_INFO "xtrabackup_info"
+#define XTRABACKUP_ROCKSDB_REUSED_SST "xtrabackup_rocksdb_reused_sst"
+#define XTRABACKUP_REPORT "xtrabackup_report.json"
+#define XTRABACKUP_PREPARE_REPORT "xtrabackup_prepare_report.json"
 
 bool backup_file_print(const char *filename, const char *message, int len);
 
@@ -61,6 +64,14 @@ bool copy_file(ds_ctxt_t *datasink, const char *src_file_path,
                const char *dst_file_path, uint thread_n,
                file_purpose_t file_purpose, ssize_t pos = -1);
 
+/************************************************************************
+Copy the range [start, end) of a file into an existing target of the local
+datasink, at the same offset.
+@return true in case of success. */
+bool copy_file_part(ds_ctxt_t *datasink, const char *src_file_path,
+                    const char *dst_file_path, file_purpose_t file_purpose,
+                    uint64_t start, uint64_t end);
+
 /* Backup non-InnoDB data.
 @return true if success. */
 bool backup_start(Backup_context &context);
@@ -81,7 +92,12 @@ bool apply_log_finish();
 bool copy_back(int argc, char **argv);
 bool decrypt_decompress();
 #ifdef HAVE_VERSION_CHECK
+/** Start the version check on a thread of its own, the backup does not wait
+for it to start copying. */
 void version_check();
+
+/** Wait for the version check started by version_check(). */
+void version_check_wait();
 #endif
 bool directory_exists(const char *dir, bool create);
 
@@ -56,6 +56,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "backup_copy.h"
 #include "common.h"
 #include "components/mysqlbackup/backup_comp_constants.h"
+#include "ds_local.h"
 #include "keyring_plugins.h"
 #include "mysqld.h"
 #include "os0event.h"
@@ -64,11 +65,13 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "typelib.h"
 #include "utils.h"
 #include "xb0xb.h"
+#include "xb_report.h"
 #include "xtrabackup.h"
 #include "xtrabackup_version.h"
 
 #include "backup_mysql.h"
 #include "fsp0fsp.h"
+#include "io_throttle.h"
 #include "xb_regex.h"
 
 /** Possible values for system variable "innodb_checksum_algorithm". */
@@ -104,6 +107,10 @@ bool have_unsafe_ddl_tables = false;
 bool have_rocksdb = false;
 bool have_keyring_component = false;
 
+/* performance_schema is enabled, so its tables describe the running
+queries */
+static bool have_performance_schema = false;
+
 bool slave_auto_position = false;
 
 /* Kill long selects */
@@ -112,6 +119,10 @@ os_event_t kill_query_thread_started;
 os_event_t kill_query_thread_stopped;
 os_event_t kill_query_thread_stop;
 
+/* Adaptive throttling */
+static os_event_t adaptive_throttle_thread_stop;
+static os_event_t adaptive_throttle_thread_stopped;
+
 bool sql_thread_started = false;
 std::string mysql_slave_position;
 std::string mysql_binlog_position;
@@ -133,6 +144,13 @@ during backup */
 static bool tables_locked = false;
 static bool instance_locked = false;
 
+/* when the lock was acquired, to log the time it was held */
+static std::chrono::steady_clock::time_point lock_start_time;
+
+/* binary log variables of the server, read before the lock is taken */
+static std::string server_log_bin_index;
+static std::string server_log_bin_basename;
+
 /* buffer pool dump */
 ssize_t innodb_buffer_pool_dump_start_time;
 static int original_innodb_buffer_pool_dump_pct;
@@ -227,6 +245,51 @@ MYSQL_RES *xb_mysql_query(MYSQL *connection, const char *query, bool use_result,
   return mysql_result;
 }
 
+/*********************************************************************/ /**
+ Execute mysql query and return its result set unbuffered. The rows are
+ fetched from the server one by one, so the result must be read to the end
+ and checked with xb_mysql_stream_end() before the connection is reused. */
+MYSQL_RES *xb_mysql_query_stream(MYSQL *connection, const char *query,
+                                 bool die_on_error) {
+  MYSQL_RES *mysql_result = NULL;
+
+  if (mysql_query(connection, query) ||
+      (mysql_result = mysql_use_result(connection)) == NULL) {
+    xb::error() << "failed to execute query " << SQUOTE(query) << " : "
+                << mysql_errno(connection) << " ("
+                << mysql_errno_to_sqlstate(mysql_errno(connection)) << ") "
+                << mysql_error(connection);
+    if (die_on_error) {
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  return mysql_result;
+}
+
+/*********************************************************************/ /**
+ Free the result set returned by xb_mysql_query_stream() once the rows have
+ been read.
+ @return false if the server failed while sending the rows */
+bool xb_mysql_stream_end(MYSQL *connection, MYSQL_RES *mysql_result,
+                         bool die_on_error) {
+  bool result = true;
+
+  if (mysql_errno(connection) != 0) {
+    xb::error() << "failed to fetch query result : " << mysql_errno(connection)
+                << " (" << mysql_errno_to_sqlstate(mysql_errno(connection))
+                << ") " << mysql_error(connection);
+    if (die_on_error) {
+      exit(EXIT_FAILURE);
+    }
+    result = false;
+  }
+
+  mysql_free_result(mysql_result);
+
+  return (result);
+}
+
 my_ulonglong xb_mysql_numrows(MYSQL *connection, const char *query,
                               bool die_on_error) {
   my_ulonglong rows_count = 0;
@@ -429,6 +492,9 @@ bool get_mysql_vars(MYSQL *connection) {
   char *rocksdb_datadir_var = nullptr;
   char *rocksdb_wal_dir_var = nullptr;
   char *rocksdb_disable_file_deletions_var = nullptr;
+  char *log_bin_index_var = nullptr;
+  char *log_bin_basename_var = nullptr;
+  char *performance_schema_var = nullptr;
 
   unsigned long server_version = mysql_get_server_version(connection);
 
@@ -463,10 +529,18 @@ bool get_mysql_vars(MYSQL *connection) {
       {"rocksdb_datadir", &rocksdb_datadir_var},
       {"rocksdb_wal_dir", &rocksdb_wal_dir_var},
       {"rocksdb_disable_file_deletions", &rocksdb_disable_file_deletions_var},
+      {"log_bin_index", &log_bin_index_var},
+      {"log_bin_basename", &log_bin_basename_var},
+      {"performance_schema", &performance_schema_var},
       {nullptr, nullptr}};
 
   read_mysql_variables(connection, "SHOW VARIABLES", mysql_vars, true);
 
+  /* read only, so not queried again while the instance is locked */
+  server_log_bin_index = log_bin_index_var != nullptr ? log_bin_index_var : "";
+  server_log_bin_basename =
+      log_bin_basename_var != nullptr ? log_bin_basename_var : "";
+
   if (have_backup_locks_var != NULL && !opt_no_backup_locks) {
     have_backup_locks = true;
   }
@@ -479,6 +553,11 @@ bool get_mysql_vars(MYSQL *connection) {
     have_galera_enabled = true;
   }
 
+  if (performance_schema_var != nullptr &&
+      strcmp(performance_schema_var, "ON") == 0) {
+    have_performance_schema = true;
+  }
+
   /* Check server version compatibility and detect server flavor */
 
   if (!(ret = check_server_version(server_version, version_var,
@@ -837,25 +916,95 @@ static bool is_update_query(const char *query) {
   return is_query_from_list(query, query_list);
 }
 
-static bool have_queries_to_wait_for(MYSQL *connection, uint threshold) {
+/** List the queries of the other connections running for at least threshold
+seconds. The filter is applied by the server, so that the idle connections
+are not sent on every poll. With performance_schema, the threads table is
+read instead of the processlist, which does not take the global mutex of the
+connections, and the progress of the current stage is joined.
+@param[in]  connection  connection
+@param[in]  threshold   minimal duration of the queries, in seconds
+@return ID, TIME, INFO and the WORK_COMPLETED and WORK_ESTIMATED of the
+current stage, NULL if the stage has no progress */
+static MYSQL_RES *long_queries_get(MYSQL *connection, uint threshold) {
+  char query[1024];
+
+  if (have_performance_schema) {
+    snprintf(query, sizeof(query),
+             "SELECT t.PROCESSLIST_ID, t.PROCESSLIST_TIME, "
+             "t.PROCESSLIST_INFO, s.WORK_COMPLETED, s.WORK_ESTIMATED "
+             "FROM performance_schema.threads t "
+             "LEFT JOIN performance_schema.events_stages_current s "
+             "USING (THREAD_ID) "
+             "WHERE t.PROCESSLIST_COMMAND <> 'Sleep' AND "
+             "t.PROCESSLIST_INFO IS NOT NULL AND "
+             "t.PROCESSLIST_TIME >= %u AND "
+             "t.PROCESSLIST_ID <> CONNECTION_ID()",
+             threshold);
+  } else {
+    snprintf(query, sizeof(query),
+             "SELECT ID, TIME, INFO, NULL, NULL "
+             "FROM INFORMATION_SCHEMA.PROCESSLIST "
+             "WHERE COMMAND <> 'Sleep' AND INFO IS NOT NULL AND "
+             "TIME >= %u AND ID <> CONNECTION_ID()",
+             threshold);
+  }
+
+  return (xb_mysql_query(connection, query, true));
+}
+
+/** Estimate the seconds left to a query from the progress of its stage.
+@param[in]  row  row of long_queries_get()
+@return seconds left, or 0 if unknown */
+static uint long_query_time_left(MYSQL_ROW row) {
+  if (row[3] == nullptr || row[4] == nullptr) {
+    return (0);
+  }
+
+  const double completed = strtod(row[3], nullptr);
+  const double estimated = strtod(row[4], nullptr);
+  const double duration = strtod(row[1], nullptr);
+
+  if (completed <= 0 || estimated <= completed) {
+    return (0);
+  }
+
+  return (static_cast<uint>(duration * (estimated - completed) / completed));
+}
+
+/** Check for queries to wait for before the lock
+@param[in]   connection  connection
+@param[in]   threshold   minimal duration of the queries, in seconds
+@param[out]  time_left   estimated seconds left to the query waited for, 0 if
+                         unknown
+@return true if there is a query to wait for */
+static bool have_queries_to_wait_for(MYSQL *connection, uint threshold,
+                                     uint *time_left) {
   MYSQL_RES *result;
   MYSQL_ROW row;
   bool all_queries;
 
-  result = xb_mysql_query(connection, "SHOW FULL PROCESSLIST", true);
+  result = long_queries_get(connection, threshold);
+
+  *time_left = 0;
 
   all_queries = (opt_lock_wait_query_type == QUERY_TYPE_ALL);
-  while ((row = mysql_fetch_row(result)) != NULL) {
-    const char *info = row[7];
+  while (result != NULL && (row = mysql_fetch_row(result)) != NULL) {
+    const char *info = row[2];
     char *id = row[0];
     int duration;
 
-    duration = (row[5] != NULL) ? atoi(row[5]) : 0;
+    duration = (row[1] != NULL) ? atoi(row[1]) : 0;
 
     if (info != NULL && duration >= (int)threshold &&
         ((all_queries && is_query(info)) || is_update_query(info))) {
-      xb::info() << "Waiting for query " << id << " (duration " << duration
-                 << " sec): " << info;
+      *time_left = long_query_time_left(row);
+      if (*time_left > 0) {
+        xb::info() << "Waiting for query " << id << " (duration " << duration
+                   << " sec, about " << *time_left << " sec left): " << info;
+      } else {
+        xb::info() << "Waiting for query " << id << " (duration " << duration
+                   << " sec): " << info;
+      }
       mysql_free_result(result);
       return (true);
     }
@@ -872,12 +1021,12 @@ static void kill_long_queries(MYSQL *connection, uint timeout) {
   bool all_queries;
   char kill_stmt[100];
 
-  result = xb_mysql_query(connection, "SHOW FULL PROCESSLIST", true);
+  result = long_queries_get(connection, timeout);
 
   all_queries = (opt_kill_long_query_type == QUERY_TYPE_ALL);
-  while ((row = mysql_fetch_row(result)) != NULL) {
-    const char *info = row[7];
-    int duration = atoi(row[5]);
+  while (result != NULL && (row = mysql_fetch_row(result)) != NULL) {
+    const char *info = row[2];
+    int duration = atoi(row[1]);
     char *id = row[0];
 
     if (info != NULL && duration >= (int)timeout &&
@@ -905,10 +1054,15 @@ static bool wait_for_no_updates(MYSQL *connection, uint timeout,
              << " seconds to finish";
 
   while (time(NULL) <= (time_t)(start_time + timeout)) {
-    if (!have_queries_to_wait_for(connection, threshold)) {
+    uint time_left;
+    if (!have_queries_to_wait_for(connection, threshold, &time_left)) {
       return (true);
     }
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    /* poll less often while the query is far from its end */
+    const time_t timeout_left = start_time + timeout - time(NULL);
+    const time_t sleep_time =
+        std::max<time_t>(1, std::min<time_t>(time_left / 2, timeout_left));
+    std::this_thread::sleep_for(std::chrono::seconds(sleep_time));
   }
 
   xb::info() << "Unable to obtain lock. Please try again later.";
@@ -976,6 +1130,161 @@ static void stop_query_killer() {
   os_event_destroy(kill_query_thread_stopped);
 }
 
+/** Sample the server load.
+@param[in]  mysql       connection to the server
+@param[out] pending_io  pending InnoDB data file reads and writes
+@param[out] history_len InnoDB history list length
+@param[out] age_pct     checkpoint age in percent of the asynchronous flush
+                        age
+@return false if the load could not be read */
+static bool adaptive_throttle_sample(MYSQL *mysql, ulong *pending_io,
+                                     ulong *history_len, ulong *age_pct) {
+  char *pending_reads = NULL;
+  char *pending_writes = NULL;
+  char *history = NULL;
+  char *checkpoint_age = NULL;
+  char *max_modified_age = NULL;
+
+  mysql_variable status[] = {
+      {"Innodb_data_pending_reads", &pending_reads},
+      {"Innodb_data_pending_writes", &pending_writes},
+      {NULL, NULL}};
+  mysql_variable metrics[] = {
+      {"trx_rseg_history_len", &history},
+      {"log_lsn_checkpoint_age", &checkpoint_age},
+      {"log_max_modified_age_async", &max_modified_age},
+      {NULL, NULL}};
+
+  read_mysql_variables(mysql,
+                       "SHOW GLOBAL STATUS WHERE Variable_name IN "
+                       "('Innodb_data_pending_reads', "
+                       "'Innodb_data_pending_writes')",
+                       status, true);
+  read_mysql_variables(mysql,
+                       "SELECT NAME, COUNT FROM "
+                       "information_schema.INNODB_METRICS WHERE NAME IN "
+                       "('trx_rseg_history_len', 'log_lsn_checkpoint_age', "
+                       "'log_max_modified_age_async')",
+                       metrics, true);
+
+  const bool ok = pending_reads != NULL && pending_writes != NULL;
+  if (ok) {
+    *pending_io = strtoul(pending_reads, NULL, 10) +
+                  strtoul(pending_writes, NULL, 10);
+    *history_len = history != NULL ? strtoul(history, NULL, 10) : 0;
+    const ulong max_age =
+        max_modified_age != NULL ? strtoul(max_modified_age, NULL, 10) : 0;
+    *age_pct = checkpoint_age != NULL && max_age > 0
+                   ? strtoul(checkpoint_age, NULL, 10) * 100 / max_age
+                   : 0;
+  }
+
+  free_mysql_variables(status);
+  free_mysql_variables(metrics);
+
+  return (ok);
+}
+
+/** Adjust the datafile copy rate and the number of active copy threads to
+the server load. Under stress the thread count and the rate are halved,
+otherwise they are raised step by step towards --parallel and
+--throttle-rate. */
+static void adaptive_throttle_thread() {
+  MYSQL *mysql = xb_mysql_connect();
+  if (mysql == NULL) {
+    xb::error() << "adaptive throttle thread failed";
+    my_thread_end();
+    os_event_set(adaptive_throttle_thread_stopped);
+    return;
+  }
+
+  const uint max_threads = xtrabackup_parallel;
+  const uint64_t max_rate = opt_throttle_rate;
+  const auto interval = std::chrono::seconds{opt_adaptive_throttle_interval};
+
+  uint threads = max_threads;
+  uint64_t rate = max_rate;
+  uint64_t transferred = io_throttle_read.transferred();
+
+  while (os_event_wait_time(adaptive_throttle_thread_stop, interval) ==
+         OS_SYNC_TIME_EXCEEDED) {
+    const uint64_t now_transferred = io_throttle_read.transferred();
+    const uint64_t measured =
+        (now_transferred - transferred) / opt_adaptive_throttle_interval;
+    transferred = now_transferred;
+
+    ulong pending_io, history_len, age_pct;
+    if (!adaptive_throttle_sample(mysql, &pending_io, &history_len,
+                                  &age_pct)) {
+      continue;
+    }
+
+    const bool stressed =
+        pending_io > opt_adaptive_throttle_max_pending_io ||
+        history_len > opt_adaptive_throttle_max_history_length ||
+        age_pct > opt_adaptive_throttle_max_checkpoint_age;
+
+    const uint prev_threads = threads;
+    const uint64_t prev_rate = rate;
+
+    if (stressed) {
+      threads = std::max(1U, threads / 2);
+      /* at least 1MiB/s, so that the backup always makes progress */
+      rate = std::max<uint64_t>(measured / 2, 1024 * 1024);
+      if (max_rate > 0) {
+        rate = std::min(rate, max_rate);
+      }
+    } else if (threads < max_threads || rate != max_rate) {
+      threads = std::min(max_threads, threads + 1);
+      rate *= 2;
+      if (max_rate > 0) {
+        rate = std::min(rate, max_rate);
+      } else if (threads == max_threads && rate > 2 * measured) {
+        /* the limit no longer slows the copy down */
+        rate = 0;
+      }
+    }
+
+    if (threads == prev_threads && rate == prev_rate) {
+      continue;
+    }
+
+    xtrabackup_copy_threads_limit = threads;
+    io_throttle_read.set_rate(rate);
+    io_throttle_write.set_rate(rate);
+
+    xb::info() << "Adaptive throttle: pending I/O " << pending_io
+               << ", history length " << history_len << ", checkpoint age "
+               << age_pct << "%. Copying with " << threads
+               << " threads at "
+               << (rate > 0 ? std::to_string(rate) + " bytes/s"
+                            : std::string("full speed"));
+  }
+
+  mysql_close(mysql);
+
+  my_thread_end();
+
+  os_event_set(adaptive_throttle_thread_stopped);
+}
+
+void start_adaptive_throttle() {
+  adaptive_throttle_thread_stop = os_event_create();
+  adaptive_throttle_thread_stopped = os_event_create();
+
+  os_thread_create(PSI_NOT_INSTRUMENTED, 0, adaptive_throttle_thread).start();
+}
+
+void stop_adaptive_throttle() {
+  os_event_set(adaptive_throttle_thread_stop);
+  os_event_wait(adaptive_throttle_thread_stopped);
+
+  os_event_destroy(adaptive_throttle_thread_stop);
+  os_event_destroy(adaptive_throttle_thread_stopped);
+
+  xtrabackup_copy_threads_limit = UINT_MAX;
+}
+
 static bool execute_query_with_timeout(MYSQL *mysql, const char *query,
                                        int timeout, int retry_count) {
   bool success = false;
@@ -1011,6 +1320,7 @@ bool lock_tables_for_backup(MYSQL *connection, int timeout, int retry_count) {
     execute_query_with_timeout(connection, "LOCK TABLES FOR BACKUP", timeout,
                                retry_count);
     tables_locked = true;
+    lock_start_time = std::chrono::steady_clock::now();
 
     return (true);
   }
@@ -1018,6 +1328,7 @@ bool lock_tables_for_backup(MYSQL *connection, int timeout, int retry_count) {
   execute_query_with_timeout(connection, "LOCK INSTANCE FOR BACKUP", timeout,
                              retry_count);
   instance_locked = true;
+  lock_start_time = std::chrono::steady_clock::now();
 
   return (true);
 }
@@ -1071,6 +1382,7 @@ bool lock_tables_ftwrl(MYSQL *connection) {
   }
 
   tables_locked = true;
+  lock_start_time = std::chrono::steady_clock::now();
 
   return (true);
 }
@@ -1090,7 +1402,7 @@ bool lock_tables_maybe(MYSQL *connection, int timeout, int retry_count) {
     return (true);
   }
 
-  if (!have_unsafe_ddl_tables && !force_ftwrl) {
+  if (!have_unsafe_ddl_tables && !force_ftwrl && !xb_index_load_pending()) {
     return (true);
   }
 
@@ -1105,6 +1417,8 @@ bool lock_tables_maybe(MYSQL *connection, int timeout, int retry_count) {
  Releases the lock acquired with FTWRL/LOCK TABLES FOR BACKUP, depending on
  the locking strategy being used */
 void unlock_all(MYSQL *connection) {
+  const bool locked = instance_locked || tables_locked;
+
   if (instance_locked) {
     xb::info() << "Executing UNLOCK INSTANCE";
     xb_mysql_query(connection, "UNLOCK INSTANCE", false);
@@ -1117,6 +1431,14 @@ void unlock_all(MYSQL *connection) {
   }
 
   xb::info() << "All tables unlocked";
+
+  if (locked) {
+    using namespace std::chrono;
+    const auto held =
+        duration_cast<microseconds>(steady_clock::now() - lock_start_time);
+    xb::info() << "Lock held for " << held.count() / 1000 << " ms";
+    xb::report::add_phase("locked", held.count(), 0);
+  }
 }
 
 static int get_open_temp_tables(MYSQL *connection) {
@@ -1375,48 +1697,6 @@ cleanup:
   return (result);
 }
 
-/*********************************************************************/ /**
- Retrieves MySQL Galera and
- saves it in a file. It also prints it to stdout. */
-bool write_galera_info(MYSQL *connection) {
-  char *state_uuid = NULL, *state_uuid55 = NULL;
-  char *last_committed = NULL, *last_committed55 = NULL;
-  bool result;
-
-  mysql_variable status[] = {{"Wsrep_local_state_uuid", &state_uuid},
-                             {"wsrep_local_state_uuid", &state_uuid55},
-                             {"Wsrep_last_committed", &last_committed},
-                             {"wsrep_last_committed", &last_committed55},
-                             {NULL, NULL}};
-
-  /* When backup locks are supported by the server, we should skip
-  creating xtrabackup_galera_info file on the backup stage, because
-  wsrep_local_state_uuid and wsrep_last_committed will be inconsistent
-  without blocking commits. The state file will be created on the prepare
-  stage using the WSREP recovery procedure. */
-  if (have_backup_locks) {
-    return (true);
-  }
-
-  read_mysql_variables(connection, "SHOW STATUS", status, true);
-
-  if ((state_uuid == NULL && state_uuid55 == NULL) ||
-      (last_committed == NULL && last_committed55 == NULL)) {
-    xb::error() << "Failed to get master wsrep state from SHOW STATUS.";
-    result = false;
-    goto cleanup;
-  }
-
-  result = backup_file_printf(
-      XTRABACKUP_GALERA_INFO, "%s:%s\n", state_uuid ? state_uuid : state_uuid55,
-      last_committed ? last_committed : last_committed55);
-
-cleanup:
-  free_mysql_variables(status);
-
-  return (result);
-}
-
 /**
  Get encryption header size for given file by reading its magic header
 
@@ -1440,32 +1720,91 @@ size_t binlog_encryption_header_size(const char *filepath) {
  @param      connection  mysql connection
  @return     true if success
 */
-bool write_current_binlog_file(MYSQL *connection) {
-  char *log_bin_dir = nullptr;
+/* binary log copied up to binlog_precopy_end before the lock */
+static std::string binlog_precopy_name;
+static uint64_t binlog_precopy_end = 0;
+
+/** Directory of the binary log files.
+@return directory, with no trailing slash unless it is the only path
+component */
+static std::string binlog_dir() {
+  char dir[FN_REFLEN];
+  size_t dir_length;
+
+  if (opt_log_bin != nullptr && strchr(opt_log_bin, FN_LIBCHAR)) {
+    /* If log_bin is set, it has priority */
+    snprintf(dir, sizeof(dir), "%s", opt_log_bin);
+  } else if (!server_log_bin_basename.empty()) {
+    snprintf(dir, sizeof(dir), "%s", server_log_bin_basename.c_str());
+  } else {
+    /* Default location is MySQL datadir */
+    snprintf(dir, sizeof(dir), "./");
+  }
+
+  dirname_part(dir, dir, &dir_length);
+
+  /* strip final slash if it is not the only path component */
+  if (dir_length > 1 && dir[dir_length - 1] == FN_LIBCHAR) {
+    dir[dir_length - 1] = 0;
+  }
+
+  return (dir);
+}
+
+/**
+ Copy the current binary log file up to its current position before the
+ lock, so that only the part written meanwhile is copied under it. Only done
+ for a local target directory, where the copy can be appended to.
+
+ @param      connection  mysql connection
+ @return     true if success
+*/
+bool precopy_current_binlog_file(MYSQL *connection) {
+  char *file = nullptr;
+  char *position = nullptr;
+  char filepath[FN_REFLEN];
+  bool result = true;
+
+  mysql_variable status[] = {
+      {"File", &file}, {"Position", &position}, {nullptr, nullptr}};
+
+  if (ds_data->datasink != &datasink_local) {
+    return (true);
+  }
+
+  read_mysql_variables(connection, "SHOW MASTER STATUS", status, false);
+
+  if (file != nullptr && position != nullptr) {
+    snprintf(filepath, sizeof(filepath), "%s%c%s", binlog_dir().c_str(),
+             FN_LIBCHAR, file);
+    const uint64_t end = strtoull(position, nullptr, 10) +
+                         binlog_encryption_header_size(filepath);
+    result = copy_file(ds_data, filepath, file, 0, FILE_PURPOSE_BINLOG, end);
+    if (result) {
+      binlog_precopy_name = file;
+      binlog_precopy_end = end;
+    }
+  }
+
+  free_mysql_variables(status);
+
+  return (result);
+}
+
+bool write_current_binlog_file(MYSQL *connection [[maybe_unused]]) {
   char *log_bin_index = nullptr;
   char *log_bin_index_filename = nullptr;
   FILE *f_index = nullptr;
   bool result = true;
   char filepath[FN_REFLEN];
-  size_t log_bin_dir_length;
-
-  mysql_variable vars[] = {{"log_bin_index", &log_bin_index},
-                           {"log_bin_basename", &log_bin_dir},
-                           {nullptr, nullptr}};
+  uint64_t end;
 
   if (log_status.filename.empty()) {
     goto cleanup;
   }
 
-  read_mysql_variables(connection, "SHOW VARIABLES", vars, true);
-
-  if (opt_log_bin != nullptr && strchr(opt_log_bin, FN_LIBCHAR)) {
-    /* If log_bin is set, it has priority */
-    free(log_bin_dir);
-    log_bin_dir = strdup(opt_log_bin);
-  } else if (log_bin_dir == nullptr) {
-    /* Default location is MySQL datadir */
-    log_bin_dir = strdup("./");
+  if (!server_log_bin_index.empty()) {
+    log_bin_index = strdup(server_log_bin_index.c_str());
   }
 
   if (opt_binlog_index_name != nullptr) {
@@ -1490,19 +1829,28 @@ bool write_current_binlog_file(MYSQL *connection) {
     log_bin_index = strdup(index.c_str());
   }
 
-  dirname_part(log_bin_dir, log_bin_dir, &log_bin_dir_length);
+  snprintf(filepath, sizeof(filepath), "%s%c%s", binlog_dir().c_str(),
+           FN_LIBCHAR, log_status.filename.c_str());
+  end = log_status.position + binlog_encryption_header_size(filepath);
 
-  /* strip final slash if it is not the only path component */
-  if (log_bin_dir_length > 1 &&
-      log_bin_dir[log_bin_dir_length - 1] == FN_LIBCHAR) {
-    log_bin_dir[log_bin_dir_length - 1] = 0;
+  if (binlog_precopy_name == log_status.filename &&
+      binlog_precopy_end <= end) {
+    /* only the events written since the copy taken before the lock */
+    result = binlog_precopy_end == end ||
+             copy_file_part(ds_data, filepath, log_status.filename.c_str(),
+                            FILE_PURPOSE_BINLOG, binlog_precopy_end, end);
+  } else {
+    if (!binlog_precopy_name.empty()) {
+      /* the binary log was rotated meanwhile */
+      char dst_path[FN_REFLEN * 2 + 1];
+      snprintf(dst_path, sizeof(dst_path), "%s/%s", xtrabackup_target_dir,
+               binlog_precopy_name.c_str());
+      xb::info() << "Removing " << dst_path;
+      unlink(dst_path);
+    }
+    result = copy_file(ds_data, filepath, log_status.filename.c_str(), 0,
+                       FILE_PURPOSE_BINLOG, end);
   }
-
-  snprintf(filepath, sizeof(filepath), "%s%c%s", log_bin_dir, FN_LIBCHAR,
-           log_status.filename.c_str());
-  result = copy_file(
-      ds_data, filepath, log_status.filename.c_str(), 0, FILE_PURPOSE_BINLOG,
-      log_status.position + binlog_encryption_header_size(filepath));
   if (!result) {
     goto cleanup;
   }
@@ -1549,7 +1897,7 @@ bool write_current_binlog_file(MYSQL *connection) {
   }
 
 cleanup:
-  free_mysql_variables(vars);
+  free(log_bin_index);
 
   return (result);
 }
@@ -1654,13 +2002,14 @@ void log_status_get(MYSQL *conn) {
 
   const char *query =
       "SELECT server_uuid, local, replication, "
-      "storage_engines FROM performance_schema.log_status";
+      "storage_engines, @@GLOBAL.gtid_mode FROM performance_schema.log_status";
   MYSQL_RES *result = xb_mysql_query(conn, query, true, true);
   MYSQL_ROW row;
   if ((row = mysql_fetch_row(result))) {
     const char *local = row[1];
     const char *replication = row[2];
     const char *storage_engines = row[3];
+    const char *gtid_mode = row[4];
     /*
      * log_status_get can be called multiple times with page tracking enabled.
      * Clear method will make sure struct vectors are clean before we start to
@@ -1670,6 +2019,9 @@ void log_status_get(MYSQL *conn) {
     log_status_local_parse(local, log_status);
     log_status_storage_engines_parse(storage_engines, log_status);
     log_status_replication_parse(replication, log_status);
+    if (gtid_mode != nullptr) {
+      log_status.gtid_mode = gtid_mode;
+    }
   }
   mysql_free_result(result);
 }
@@ -1679,25 +2031,21 @@ void log_status_get(MYSQL *conn) {
  saves it in a file. It also prints it to stdout.
  @param[in]   connection  MySQL connection handler
  @return true if success. */
-bool write_binlog_info(MYSQL *connection) {
+bool write_binlog_info(MYSQL *connection [[maybe_unused]]) {
   std::ostringstream s;
-  char *gtid_mode = NULL;
   bool result, gtid;
 
-  mysql_variable vars[] = {{"gtid_mode", &gtid_mode}, {NULL, NULL}};
-  read_mysql_variables(connection, "SHOW VARIABLES", vars, true);
-
   if (log_status.filename.empty() && log_status.gtid_executed.empty()) {
     /* Do not create xtrabackup_binlog_info if binary
     log is disabled */
-    result = true;
-    goto cleanup;
+    return (true);
   }
 
   s << "filename '" << log_status.filename << "', position '"
     << log_status.position << "'";
 
-  gtid = ((gtid_mode != NULL) && (strcmp(gtid_mode, "ON") == 0));
+  /* read with p_s.log_status, in the same round trip */
+  gtid = (log_status.gtid_mode == "ON");
 
   if (!log_status.gtid_executed.empty() && gtid) {
     s << ", GTID of the last change '" << log_status.gtid_executed << "'";
@@ -1716,9 +2064,6 @@ bool write_binlog_info(MYSQL *connection) {
                            log_status.filename.c_str(), log_status.position);
   }
 
-cleanup:
-  free_mysql_variables(vars);
-
   return (result);
 }
 
@@ -2121,13 +2466,46 @@ void backup_cleanup() {
   }
 }
 
-static MYSQL *mdl_con = NULL;
+/* connections holding the MDL of the tables, in a transaction each */
+static std::vector<MYSQL *> mdl_cons;
+
+/* number of tables locked by one statement */
+static const size_t MDL_LOCK_BATCH_SIZE = 1000;
+
+/** Take the MDL of a batch of tables with a single statement. If it fails,
+for example because one of the tables was dropped meanwhile, lock them one by
+one.
+@param[in]  con     connection, in a transaction
+@param[in]  tables  formatted names of the tables */
+static void mdl_lock_batch(MYSQL *con, const std::vector<std::string> &tables) {
+  std::string query;
+
+  for (const auto &table : tables) {
+    if (!query.empty()) {
+      query += " UNION ALL ";
+    }
+    query += "(SELECT 1 FROM " + table + " LIMIT 0)";
+  }
+
+  if (mysql_query(con, query.c_str()) == 0) {
+    return;
+  }
+
+  for (const auto &table : tables) {
+    const std::string lock_query = "SELECT 1 FROM " + table + " LIMIT 0";
+    xb_mysql_query(con, lock_query.c_str(), false, false);
+  }
+}
+
 void mdl_lock_tables() {
+  xb::report::Phase phase("mdl");
   xb::info() << "Initializing MDL on all current tables.";
   MYSQL_RES *mysql_result = NULL;
   MYSQL_ROW row;
-  mdl_con = xb_mysql_connect();
+  std::vector<std::vector<std::string>> batches;
+  MYSQL *mdl_con = xb_mysql_connect();
   if (mdl_con != NULL) {
+    mdl_cons.push_back(mdl_con);
     xb_mysql_query(mdl_con, "BEGIN", false, true);
     mysql_result = xb_mysql_query(mdl_con,
                                   "SELECT NAME, SPACE FROM "
@@ -2156,25 +2534,57 @@ void mdl_lock_tables() {
         }
 
         xb::info() << "Locking MDL for " << full_table_name;
-        char *lock_query;
-        xb_a(
-            asprintf(&lock_query, "SELECT 1 FROM %s LIMIT 0", full_table_name));
-
-        xb_mysql_query(mdl_con, lock_query, false, false);
-
-        free(lock_query);
+        if (batches.empty() || batches.back().size() == MDL_LOCK_BATCH_SIZE) {
+          batches.emplace_back();
+        }
+        batches.back().push_back(full_table_name);
       }
     }
     mysql_free_result(mysql_result);
   }
+
+  if (batches.empty()) {
+    return;
+  }
+
+  /* the locks of a connection are only held by its transaction, so each
+  connection locks its share of the batches in its own transaction */
+  const size_t n_cons =
+      std::min<size_t>(std::max(xtrabackup_parallel, 1), batches.size());
+  while (mdl_cons.size() < n_cons) {
+    MYSQL *con = xb_mysql_connect();
+    if (con == nullptr) {
+      break;
+    }
+    xb_mysql_query(con, "BEGIN", false, true);
+    mdl_cons.push_back(con);
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < mdl_cons.size(); i++) {
+    threads.emplace_back([i, &batches] {
+      my_thread_init();
+      for (size_t j = i; j < batches.size(); j += mdl_cons.size()) {
+        mdl_lock_batch(mdl_cons[i], batches[j]);
+      }
+      my_thread_end();
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  xb::info() << "Locked MDL of the tables in " << batches.size()
+             << " statement(s) on " << mdl_cons.size() << " connection(s)";
 }
 
 void mdl_unlock_all() {
   xb::info() << "Unlocking MDL for all tables";
-  if (mdl_con != NULL) {
-    xb_mysql_query(mdl_con, "COMMIT", false, true);
-    mysql_close(mdl_con);
+  for (MYSQL *con : mdl_cons) {
+    xb_mysql_query(con, "COMMIT", false, true);
+    mysql_close(con);
   }
+  mdl_cons.clear();
 }
 bool is_fts_index(const std::string &table_name) {
   const char *pattern =
@@ -2249,6 +2659,71 @@ bool has_innodb_buffer_pool_dump_pct() {
   return (false);
 }
 
+/* waits for the buffer pool dump while the files are copied, not destroyed
+if the backup exits before joining it */
+static std::thread *innodb_buffer_pool_dump_thread = nullptr;
+
+/** Wait for the buffer pool dump started by dump_innodb_buffer_pool() on a
+connection of its own, then restore innodb_buffer_pool_dump_pct. */
+static void wait_for_innodb_buffer_pool_dump() {
+  const ssize_t timeout = opt_dump_innodb_buffer_pool_timeout;
+  char *innodb_buffer_pool_dump_status = nullptr;
+  char change_bp_dump_pct_query[100];
+  MYSQL *connection;
+
+  my_thread_init();
+
+  if ((connection = xb_mysql_connect()) == nullptr) {
+    xb::warn() << "cannot connect to wait for the InnoDB buffer pool dump";
+    my_thread_end();
+    return;
+  }
+
+  mysql_variable status[] = {
+      {"Innodb_buffer_pool_dump_status", &innodb_buffer_pool_dump_status},
+      {NULL, NULL}};
+
+  read_mysql_variables(connection,
+                       "SHOW STATUS LIKE "
+                       "'Innodb_buffer_pool_dump_status'",
+                       status, true);
+
+  /* check if dump has been completed */
+  while (innodb_buffer_pool_dump_status == nullptr ||
+         !strstr(innodb_buffer_pool_dump_status, "dump completed at")) {
+    if (innodb_buffer_pool_dump_start_time + timeout < (ssize_t)time(nullptr)) {
+      xb::info() << "InnoDB Buffer Pool Dump was not completed after "
+                 << opt_dump_innodb_buffer_pool_timeout << " seconds... Adjust "
+                 << "--dump-innodb-buffer-pool-timeout if you "
+                 << "need higher wait time before copying "
+                 << buffer_pool_filename;
+      break;
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    free_mysql_variables(status);
+    read_mysql_variables(connection,
+                         "SHOW STATUS LIKE 'Innodb_buffer_pool_dump_status'",
+                         status, true);
+  }
+
+  free_mysql_variables(status);
+
+  /* restore original innodb_buffer_pool_dump_pct as soon as the dump is
+  done, not at the end of the backup */
+  if (opt_dump_innodb_buffer_pool_pct != 0 && innodb_buffer_pool_dump_pct) {
+    snprintf(change_bp_dump_pct_query, sizeof(change_bp_dump_pct_query),
+             "SET GLOBAL innodb_buffer_pool_dump_pct = %u",
+             original_innodb_buffer_pool_dump_pct);
+    xb_mysql_query(connection, change_bp_dump_pct_query, false);
+  }
+
+  mysql_close(connection);
+
+  my_thread_end();
+}
+
 void dump_innodb_buffer_pool(MYSQL *connection) {
   innodb_buffer_pool_dump = has_innodb_buffer_pool_dump();
   innodb_buffer_pool_dump_pct = has_innodb_buffer_pool_dump_pct();
@@ -2285,54 +2760,21 @@ void dump_innodb_buffer_pool(MYSQL *connection) {
   xb::info() << "Executing SET GLOBAL innodb_buffer_pool_dump_now=ON...";
   xb_mysql_query(mysql_connection, "SET GLOBAL innodb_buffer_pool_dump_now=ON;",
                  false);
+
+  innodb_buffer_pool_dump_thread =
+      new std::thread(wait_for_innodb_buffer_pool_dump);
 }
 
-void check_dump_innodb_buffer_pool(MYSQL *connection) {
-  if (!innodb_buffer_pool_dump) {
+void check_dump_innodb_buffer_pool(MYSQL *connection [[maybe_unused]]) {
+  if (innodb_buffer_pool_dump_thread == nullptr) {
     return;
   }
-  const ssize_t timeout = opt_dump_innodb_buffer_pool_timeout;
 
-  char *innodb_buffer_pool_dump_status;
-  char change_bp_dump_pct_query[100];
-
-  mysql_variable status[] = {
-      {"Innodb_buffer_pool_dump_status", &innodb_buffer_pool_dump_status},
-      {NULL, NULL}};
-
-  read_mysql_variables(connection,
-                       "SHOW STATUS LIKE "
-                       "'Innodb_buffer_pool_dump_status'",
-                       status, true);
-
-  /* check if dump has been completed */
+  /* the wait started with the dump, it is usually over by now */
   xb::info() << "Checking if InnoDB buffer pool dump has completed";
-  while (!strstr(innodb_buffer_pool_dump_status, "dump completed at")) {
-    if (innodb_buffer_pool_dump_start_time + timeout < (ssize_t)time(nullptr)) {
-      xb::info() << "InnoDB Buffer Pool Dump was not completed after "
-                 << opt_dump_innodb_buffer_pool_timeout << " seconds... Adjust "
-                 << "--dump-innodb-buffer-pool-timeout if you "
-                 << "need higher wait time before copying "
-                 << buffer_pool_filename;
-      break;
-    }
-
-    read_mysql_variables(connection,
-                         "SHOW STATUS LIKE 'Innodb_buffer_pool_dump_status'",
-                         status, true);
-
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-  }
-
-  free_mysql_variables(status);
-
-  /* restore original innodb_buffer_pool_dump_pct */
-  if (opt_dump_innodb_buffer_pool_pct != 0 && innodb_buffer_pool_dump_pct) {
-    snprintf(change_bp_dump_pct_query, sizeof(change_bp_dump_pct_query),
-             "SET GLOBAL innodb_buffer_pool_dump_pct = %u",
-             original_innodb_buffer_pool_dump_pct);
-    xb_mysql_query(mysql_connection, change_bp_dump_pct_query, false);
-  }
+  innodb_buffer_pool_dump_thread->join();
+  delete innodb_buffer_pool_dump_thread;
+  innodb_buffer_pool_dump_thread = nullptr;
 }
 
 /* print tables that have INSTANT ADD/DROP column row version
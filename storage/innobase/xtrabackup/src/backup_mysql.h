@@ -58,6 +58,7 @@ struct log_status_t {
   std::string filename;
   uint64_t position;
   std::string gtid_executed;
+  std::string gtid_mode;
   lsn_t lsn;
   lsn_t lsn_checkpoint;
   std::vector<replication_channel_status_t> channels;
@@ -66,6 +67,7 @@ struct log_status_t {
     filename = "";
     position = 0;
     gtid_executed = "";
+    gtid_mode = "";
     lsn = 0;
     lsn_checkpoint = 0;
     channels.clear();
@@ -188,6 +190,12 @@ MYSQL *xb_mysql_connect();
 MYSQL_RES *xb_mysql_query(MYSQL *connection, const char *query, bool use_result,
                           bool die_on_error = true);
 
+MYSQL_RES *xb_mysql_query_stream(MYSQL *connection, const char *query,
+                                 bool die_on_error = true);
+
+bool xb_mysql_stream_end(MYSQL *connection, MYSQL_RES *mysql_result,
+                         bool die_on_error = true);
+
 my_ulonglong xb_mysql_numrows(MYSQL *connection, const char *query,
                               bool die_on_error);
 
@@ -200,6 +208,8 @@ void free_mysql_variables(mysql_variable *vars);
 
 void unlock_all(MYSQL *connection);
 
+bool precopy_current_binlog_file(MYSQL *connection);
+
 bool write_current_binlog_file(MYSQL *connection);
 
 /** Read binary log position, InnoDB LSN and other storage engine information
@@ -226,8 +236,6 @@ bool lock_tables_maybe(MYSQL *connection, int timeout, int retry_count);
 
 bool wait_for_safe_slave(MYSQL *connection);
 
-bool write_galera_info(MYSQL *connection);
-
 bool write_slave_info(MYSQL *connection);
 
 void parse_show_engine_innodb_status(MYSQL *connection);
@@ -267,6 +275,13 @@ void get_table_name_from_fq(std::string &fq_table_name);
 
 void mdl_unlock_all();
 
+/** Start the thread adjusting the datafile copy rate and the number of
+active copy threads to the server load, see --adaptive-throttle. */
+void start_adaptive_throttle();
+
+/** Stop the thread started by start_adaptive_throttle() */
+void stop_adaptive_throttle();
+
 bool has_innodb_buffer_pool_dump();
 
 bool has_innodb_buffer_pool_dump_pct();
@@ -0,0 +1,490 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Dry run of the backup predicting its duration and resource needs.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <lz4.h>
+#include <my_rapidjson_size_t.h>
+#include <my_sys.h>
+#include <quicklz.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <zstd.h>
+
+#include <univ.i>
+
+#include <fil0types.h>
+#include <mach0data.h>
+#include <page0types.h>
+#include <srv0srv.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "backup_mysql.h"
+#include "backup_plan.h"
+#include "common.h"
+#include "xtrabackup.h"
+
+namespace xb {
+namespace plan {
+
+namespace {
+
+/** Version of the plan format */
+const int PLAN_VERSION = 1;
+
+/** Bytes read at a time from a datafile by the read sample */
+const size_t PLAN_READ_CHUNK_SIZE = 8 * 1024 * 1024;
+
+/** Size of a single read of the read sample */
+const size_t PLAN_READ_SIZE = 1024 * 1024;
+
+/** Seconds every thread count of the read sample runs */
+const uint PLAN_READ_SECONDS = 2;
+
+/** Largest number of threads the read sample tries */
+const uint PLAN_MAX_THREADS = 32;
+
+/** Share of the best read throughput a thread count must reach to be
+recommended, more threads only add load on the server for the other 10% */
+const double PLAN_THREADS_EFFICIENCY = 0.9;
+
+/** Number of pages sampled for the compression estimate */
+const size_t PLAN_SAMPLE_PAGES = 2048;
+
+/** Hands out the chunks of the datafiles to the read sample threads, so
+that no chunk is read twice and the page cache does not inflate the
+throughput of the later thread counts. */
+class Chunk_cursor {
+ public:
+  explicit Chunk_cursor(const std::vector<const Datafile *> &files)
+      : m_files(files) {}
+
+  /** Get the next chunk to read.
+  @param[out] file    datafile of the chunk
+  @param[out] offset  start of the chunk
+  @return false when all the datafiles are read */
+  bool next(const Datafile **file, uint64_t *offset) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (m_file < m_files.size() && m_offset >= m_files[m_file]->size) {
+      m_file++;
+      m_offset = 0;
+    }
+    if (m_file == m_files.size()) {
+      return (false);
+    }
+    *file = m_files[m_file];
+    *offset = m_offset;
+    m_offset += PLAN_READ_CHUNK_SIZE;
+    return (true);
+  }
+
+ private:
+  std::mutex m_mutex;
+  const std::vector<const Datafile *> &m_files;
+  size_t m_file{0};
+  uint64_t m_offset{0};
+};
+
+/** Read chunks of the datafiles with n_threads threads for
+PLAN_READ_SECONDS seconds.
+@param[in,out]  cursor     chunks left to read
+@param[in]      n_threads  number of threads
+@return bytes per second read, 0 if the datafiles ran out */
+double sample_read(Chunk_cursor &cursor, uint n_threads) {
+  const auto start = std::chrono::steady_clock::now();
+  const auto deadline = start + std::chrono::seconds{PLAN_READ_SECONDS};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<bool> exhausted{false};
+
+  std::vector<std::thread> threads;
+  for (uint i = 0; i < n_threads; i++) {
+    threads.emplace_back([&] {
+      my_thread_init();
+      std::unique_ptr<uchar[]> buf(new uchar[PLAN_READ_SIZE]);
+      const Datafile *file;
+      uint64_t offset;
+      while (std::chrono::steady_clock::now() < deadline) {
+        if (!cursor.next(&file, &offset)) {
+          exhausted = true;
+          break;
+        }
+        File fd = my_open(file->path.c_str(), O_RDONLY, MYF(0));
+        if (fd < 0) {
+          continue;
+        }
+        const uint64_t end =
+            std::min(offset + PLAN_READ_CHUNK_SIZE, file->size);
+        for (; offset < end && std::chrono::steady_clock::now() < deadline;
+             offset += PLAN_READ_SIZE) {
+          const size_t n = my_pread(fd, buf.get(), PLAN_READ_SIZE, offset,
+                                    MYF(0));
+          if (n == MY_FILE_ERROR || n == 0) {
+            break;
+          }
+          bytes += n;
+        }
+        my_close(fd, MYF(0));
+      }
+      my_thread_end();
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  const double sec = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+  /* a sample cut short by the end of the datafiles is not comparable */
+  if (exhausted || sec <= 0) {
+    return (0);
+  }
+  return (bytes / sec);
+}
+
+/** Index pages of the sample */
+struct index_pages_t {
+  uint64_t sampled{0};
+  /* pages of the secondary indexes */
+  uint64_t secondary{0};
+};
+
+/** @return ids of the secondary indexes of the server */
+std::unordered_set<uint64_t> secondary_index_ids(MYSQL *connection) {
+  std::unordered_set<uint64_t> ids;
+  MYSQL_RES *result = xb_mysql_query(
+      connection,
+      "SELECT INDEX_ID FROM information_schema.INNODB_INDEXES "
+      "WHERE TYPE & 1 = 0",
+      true, false);
+  if (result == nullptr) {
+    return (ids);
+  }
+  MYSQL_ROW row;
+  while ((row = mysql_fetch_row(result)) != nullptr) {
+    ids.insert(strtoull(row[0], nullptr, 10));
+  }
+  mysql_free_result(result);
+  return (ids);
+}
+
+/** Read pages spread evenly over all datafiles.
+@param[in]   files      datafiles
+@param[in]   total      size of all datafiles
+@param[in]   secondary  ids of the secondary indexes
+@param[out]  index      pages of the sample by kind of index
+@return the pages, one after the other */
+std::vector<char> sample_pages(const std::vector<const Datafile *> &files,
+                               uint64_t total,
+                               const std::unordered_set<uint64_t> &secondary,
+                               index_pages_t *index) {
+  std::vector<char> pages;
+  const uint64_t step = std::max<uint64_t>(1, total / PLAN_SAMPLE_PAGES);
+  uint64_t next = 0;
+  uint64_t file_start = 0;
+
+  for (const Datafile *file : files) {
+    const uint64_t file_end = file_start + file->size;
+    if (next >= file_end) {
+      file_start = file_end;
+      continue;
+    }
+    File fd = my_open(file->path.c_str(), O_RDONLY, MYF(0));
+    if (fd >= 0) {
+      for (; next < file_end; next += step) {
+        const uint64_t offset =
+            ut_uint64_align_down(next - file_start, file->page_size);
+        const size_t pos = pages.size();
+        pages.resize(pos + file->page_size);
+        if (my_pread(fd, reinterpret_cast<uchar *>(&pages[pos]),
+                     file->page_size, offset, MYF(MY_NABP)) != 0) {
+          pages.resize(pos);
+          break;
+        }
+        const byte *page = reinterpret_cast<const byte *>(&pages[pos]);
+        index->sampled++;
+        if (mach_read_from_2(page + FIL_PAGE_TYPE) == FIL_PAGE_INDEX &&
+            secondary.count(
+                mach_read_from_8(page + PAGE_HEADER + PAGE_INDEX_ID)) > 0) {
+          index->secondary++;
+        }
+      }
+      my_close(fd, MYF(0));
+    }
+    next = std::max(next, file_end);
+    file_start = file_end;
+  }
+
+  return (pages);
+}
+
+struct compression_t {
+  const char *name;
+  xtrabackup_compress_t type;
+  /* compressed size divided by the input size */
+  double ratio;
+  /* bytes per second of one compression thread */
+  double rate;
+};
+
+/** Compress the sample in chunks of --compress-chunk-size with every
+algorithm.
+@param[in]  sample  pages to compress
+@return ratio and speed of every algorithm */
+std::vector<compression_t> sample_compression(const std::vector<char> &sample) {
+  const size_t chunk = std::max<size_t>(xtrabackup_compress_chunk_size, 4096);
+  /* quicklz needs 400 bytes on top of the chunk */
+  const size_t out_size = std::max<size_t>(
+      {ZSTD_compressBound(chunk), static_cast<size_t>(LZ4_compressBound(chunk)),
+       chunk + 400});
+  std::vector<char> out(out_size);
+  std::unique_ptr<qlz_state_compress> qlz_state(new qlz_state_compress);
+  ZSTD_CCtx *zstd_ctx = ZSTD_createCCtx();
+
+  std::vector<compression_t> result = {
+      {"quicklz", XTRABACKUP_COMPRESS_QUICKLZ, 1, 0},
+      {"lz4", XTRABACKUP_COMPRESS_LZ4, 1, 0},
+      {"zstd", XTRABACKUP_COMPRESS_ZSTD, 1, 0}};
+
+  for (auto &alg : result) {
+    uint64_t compressed = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t pos = 0; pos < sample.size(); pos += chunk) {
+      const size_t len = std::min(chunk, sample.size() - pos);
+      const char *src = sample.data() + pos;
+      size_t n = 0;
+      switch (alg.type) {
+        case XTRABACKUP_COMPRESS_QUICKLZ:
+          n = qlz_compress(src, out.data(), len, qlz_state.get());
+          break;
+        case XTRABACKUP_COMPRESS_LZ4:
+          n = LZ4_compress_default(src, out.data(), len, out.size());
+          break;
+        default:
+          n = ZSTD_compressCCtx(zstd_ctx, out.data(), out.size(), src, len,
+                                xtrabackup_compress_zstd_level);
+          if (ZSTD_isError(n)) {
+            n = len;
+          }
+          break;
+      }
+      /* incompressible chunks are stored as is */
+      compressed += (n == 0 || n > len) ? len : n;
+    }
+    const double sec = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    if (!sample.empty()) {
+      alg.ratio = static_cast<double>(compressed) / sample.size();
+      alg.rate = sec > 0 ? sample.size() / sec : 0;
+    }
+  }
+
+  ZSTD_freeCCtx(zstd_ctx);
+
+  return (result);
+}
+
+/** @return current LSN of the server */
+lsn_t server_lsn(MYSQL *connection) {
+  char *value = read_mysql_one_value(
+      connection,
+      "SELECT COUNT FROM information_schema.INNODB_METRICS WHERE NAME = "
+      "'log_lsn_current'");
+  const lsn_t lsn = value != nullptr ? strtoull(value, nullptr, 10) : 0;
+  free(value);
+  return (lsn);
+}
+
+}  // namespace
+
+bool run(MYSQL *connection, const std::vector<Datafile> &files,
+         size_t cursor_buffers) {
+  std::vector<const Datafile *> by_size;
+  uint64_t total = 0;
+  for (const auto &file : files) {
+    by_size.push_back(&file);
+    total += file.size;
+  }
+  /* the large files give the longest sequential reads, as most of the
+  backup is spent on them */
+  std::sort(by_size.begin(), by_size.end(),
+            [](const Datafile *a, const Datafile *b) {
+              return a->size > b->size;
+            });
+
+  const auto start = std::chrono::steady_clock::now();
+  const lsn_t start_lsn = server_lsn(connection);
+
+  xb::info() << "Planning the backup of " << files.size() << " datafiles, "
+             << total << " bytes";
+
+  /* read throughput with 1, 2, 4... threads, until it stops growing */
+  const uint n_cpus = std::max(1U, std::thread::hardware_concurrency());
+  const size_t max_threads = std::min<size_t>(
+      {PLAN_MAX_THREADS, 2 * n_cpus, std::max<size_t>(1, files.size())});
+  std::vector<std::pair<uint, double>> reads;
+  Chunk_cursor cursor(by_size);
+  double best_read = 0;
+  for (uint n = 1; n <= max_threads; n *= 2) {
+    const double rate = sample_read(cursor, n);
+    if (rate == 0) {
+      break;
+    }
+    reads.push_back({n, rate});
+    if (rate < best_read) {
+      break;
+    }
+    best_read = rate;
+  }
+
+  uint parallel = xtrabackup_parallel;
+  double read_rate = 0;
+  for (const auto &sample : reads) {
+    if (sample.second >= PLAN_THREADS_EFFICIENCY * best_read) {
+      parallel = sample.first;
+      read_rate = sample.second;
+      break;
+    }
+  }
+
+  index_pages_t index_pages;
+  const std::vector<compression_t> compression = sample_compression(
+      sample_pages(by_size, total, secondary_index_ids(connection),
+                   &index_pages));
+  const double secondary_ratio =
+      index_pages.sampled > 0
+          ? static_cast<double>(index_pages.secondary) / index_pages.sampled
+          : 0;
+
+  const double elapsed = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  const lsn_t end_lsn = server_lsn(connection);
+  const double redo_rate =
+      end_lsn > start_lsn && elapsed > 0 ? (end_lsn - start_lsn) / elapsed : 0;
+
+  /* the copy runs at the read rate when enough threads compress */
+  uint compress_threads = 0;
+  double copy_rate = read_rate;
+  for (const auto &alg : compression) {
+    if (alg.type != xtrabackup_compress || alg.rate <= 0) {
+      continue;
+    }
+    compress_threads = std::min<uint>(
+        n_cpus, std::max<uint>(1, std::ceil(read_rate / alg.rate)));
+    copy_rate = std::min(read_rate, compress_threads * alg.rate);
+  }
+  const double duration = copy_rate > 0 ? total / copy_rate : 0;
+
+  /* copy buffers of every copy thread, the window of compressed chunks of
+  every copy thread, the redo log buffers and the buffer pool */
+  uint64_t memory = static_cast<uint64_t>(parallel) * cursor_buffers +
+                    srv_log_buffer_size + srv_buf_pool_size;
+  if (compress_threads > 0) {
+    memory += static_cast<uint64_t>(parallel) * 2 * compress_threads * 2 *
+              xtrabackup_compress_chunk_size;
+  }
+
+  rapidjson::StringBuffer buf;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buf);
+  writer.StartObject();
+  writer.Key("version");
+  writer.Int(PLAN_VERSION);
+  writer.Key("datafiles");
+  writer.Uint64(files.size());
+  writer.Key("datafile_bytes");
+  writer.Uint64(total);
+  writer.Key("read_samples");
+  writer.StartArray();
+  for (const auto &sample : reads) {
+    writer.StartObject();
+    writer.Key("threads");
+    writer.Uint(sample.first);
+    writer.Key("mib_per_sec");
+    writer.Double(sample.second / (1024 * 1024));
+    writer.EndObject();
+  }
+  writer.EndArray();
+  writer.Key("redo_bytes_per_sec");
+  writer.Double(redo_rate);
+  writer.Key("compression");
+  writer.StartArray();
+  for (const auto &alg : compression) {
+    writer.StartObject();
+    writer.Key("algorithm");
+    writer.String(alg.name);
+    writer.Key("ratio");
+    writer.Double(alg.ratio);
+    writer.Key("output_bytes");
+    writer.Uint64(static_cast<uint64_t>(total * alg.ratio));
+    writer.Key("mib_per_sec_per_thread");
+    writer.Double(alg.rate / (1024 * 1024));
+    writer.EndObject();
+  }
+  writer.EndArray();
+  /* the share of the backup a compact backup would not copy */
+  writer.Key("secondary_indexes");
+  writer.StartObject();
+  writer.Key("ratio");
+  writer.Double(secondary_ratio);
+  writer.Key("bytes");
+  writer.Uint64(static_cast<uint64_t>(total * secondary_ratio));
+  writer.EndObject();
+  writer.Key("recommended");
+  writer.StartObject();
+  writer.Key("parallel");
+  writer.Uint(parallel);
+  if (compress_threads > 0) {
+    writer.Key("compress_threads");
+    writer.Uint(compress_threads);
+  }
+  writer.EndObject();
+  writer.Key("predicted");
+  writer.StartObject();
+  writer.Key("duration_sec");
+  writer.Double(duration);
+  writer.Key("redo_bytes");
+  writer.Uint64(static_cast<uint64_t>(redo_rate * duration));
+  writer.Key("peak_memory_bytes");
+  writer.Uint64(memory);
+  writer.EndObject();
+  writer.EndObject();
+
+  if (fprintf(stdout, "%s\n", buf.GetString()) < 0 || fflush(stdout) != 0) {
+    xb::error() << "cannot print the backup plan";
+    return (false);
+  }
+
+  if (reads.empty()) {
+    xb::warn() << "The datafiles are too small to sample the read "
+                  "throughput, no duration is predicted";
+  }
+
+  return (true);
+}
+
+}  // namespace plan
+}  // namespace xb
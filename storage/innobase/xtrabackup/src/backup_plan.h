@@ -0,0 +1,55 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Dry run of the backup predicting its duration and resource needs.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef XB_BACKUP_PLAN_H
+#define XB_BACKUP_PLAN_H
+
+#include <mysql.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace xb {
+namespace plan {
+
+/** Datafile the backup would copy. */
+struct Datafile {
+  std::string path;
+  uint64_t size;
+  size_t page_size;
+};
+
+/** Sample the read throughput of the datafiles with a growing number of
+threads, the compression of a sample of their pages, the share of them in
+secondary indexes and the redo log generation of the server, then print the
+predicted duration, output size, peak memory and the recommended --parallel
+and --compress-threads to stdout as JSON. Nothing is written to the target
+directory.
+@param[in]  connection      connection to the server
+@param[in]  files           datafiles to copy
+@param[in]  cursor_buffers  datafile buffers of a copy thread, in bytes
+@return false on error */
+bool run(MYSQL *connection, const std::vector<Datafile> &files,
+         size_t cursor_buffers);
+
+}  // namespace plan
+}  // namespace xb
+
+#endif
@@ -18,11 +18,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 /* Changed page tracking implementation */
 #include "changed_page_tracking.h"
+#include <algorithm>
 #include <iostream>
 #include "backup_mysql.h"
 #include "common.h"
 #include "components/mysqlbackup/backup_comp_constants.h"
 #include "srv0srv.h"
+#include "thread_pool.h"
 #include "xb0xb.h"
 #include "xtrabackup.h"
 
@@ -37,6 +39,36 @@ static uint64_t get_uuid_short(MYSQL *connection) {
   return (uuid_short);
 }
 
+/** Add the pages of a chunk of the page tracking file which belong to a shard
+of spaces to the map of the shard
+@param[in]     chunk       chunk of the page tracking file
+@param[in]     num_pages   number of pages in the chunk
+@param[in]     shard       shard number
+@param[in]     n_shards    number of shards
+@param[in,out] space_map   spaces of the shard */
+static void parse_chunk(const byte *chunk, size_t num_pages, size_t shard,
+                        size_t n_shards, xb_space_map *space_map) {
+  for (size_t index = 0; index < num_pages; index++) {
+    const byte *ptr = chunk + Backup_comp_constants::page_number_size * index;
+    space_id_t space_id = mach_read_from_4(ptr);
+
+    if (space_id % n_shards != shard) {
+      continue;
+    }
+
+    page_no_t page_id =
+        mach_read_from_4(ptr + Backup_comp_constants::page_number_size / 2);
+
+    /* insert page_id into existing space or create new space and insert */
+    auto it = space_map->find(space_id);
+    if (it != space_map->end()) {
+      it->second.insert(page_id);
+    } else {
+      space_map->insert({space_id, {page_id}});
+    }
+  }
+}
+
 /** Read the disk page tracking file and build the changed page tracking map for
 the LSN interval incremental_lsn to checkpoint_lsn_start.
 @param[in] checkpoint_lsn_start  start checkpoint lsn
@@ -90,54 +122,109 @@ xb_space_map *init(lsn_t checkpoint_lsn_start, MYSQL *connection)
     return nullptr;
   }
 
-  ut::aligned_array_pointer<byte, UNIV_PAGE_SIZE_MAX> buf;
-  buf.alloc_withkey(UT_NEW_THIS_FILE_PSI_KEY,
-                    ut::Count{page_tracking_read_buffer_size});
+  /* the file is parsed by one thread per shard of spaces while the next
+  chunk is read, the order of the pages within a space is kept */
+  const size_t n_shards = std::max(xtrabackup_parallel, 1);
+  std::vector<xb_space_map> shards(n_shards);
+  Thread_pool pool(n_shards);
+  std::vector<std::future<void>> parsed;
+
+  ut::aligned_array_pointer<byte, UNIV_PAGE_SIZE_MAX> bufs[2];
+  for (auto &buf : bufs) {
+    buf.alloc_withkey(UT_NEW_THIS_FILE_PSI_KEY,
+                      ut::Count{page_tracking_read_buffer_size});
+  }
   size_t hdr_len = page_tracking_read_buffer_size;
-
-  space_map = new xb_space_map;
+  size_t cur = 0;
+  bool error = false;
 
   /* process file to create map of space and it's changed pages */
   while (true) {
-    size_t n_read = my_read(file, buf, hdr_len, MYF(MY_WME));
-
-    ut_a(n_read % Backup_comp_constants::page_number_size == 0);
+    size_t n_read = my_read(file, bufs[cur], hdr_len, MYF(MY_WME));
 
     if (n_read == MY_FILE_ERROR) {
       xb::error() << "pagetracking: cannot read from " << SQUOTE(full_path);
-      my_close(file, MYF(MY_FAE));
-      return nullptr;
+      error = true;
+      break;
     }
 
-    space_id_t space_id;
-    page_no_t page_id;
+    ut_a(n_read % Backup_comp_constants::page_number_size == 0);
 
-    auto num_pages = n_read / Backup_comp_constants::page_number_size;
+    for (auto &f : parsed) {
+      f.get();
+    }
+    parsed.clear();
 
-    for (size_t index = 0; index < num_pages; index++) {
-      space_id = mach_read_from_4(
-          buf + Backup_comp_constants::page_number_size * index);
-      page_id =
-          mach_read_from_4(buf + Backup_comp_constants::page_number_size / 2 +
-                           Backup_comp_constants::page_number_size * index);
+    const byte *chunk = bufs[cur];
+    const auto num_pages = n_read / Backup_comp_constants::page_number_size;
 
-      /* insert page_id into existing space or create new space and insert */
-      if (space_map->count(space_id)) {
-        space_map->at(space_id).insert(page_id);
-      } else {
-        space_map->insert({space_id, {page_id}});
-      }
+    for (size_t shard = 0; shard < n_shards; ++shard) {
+      parsed.push_back(pool.add_task(
+          [chunk, num_pages, shard, n_shards, &shards](size_t) {
+            parse_chunk(chunk, num_pages, shard, n_shards, &shards[shard]);
+          }));
     }
 
+    cur ^= 1;
+
     if (n_read < hdr_len) {
       break;
     }
   }
 
+  for (auto &f : parsed) {
+    f.get();
+  }
+  parsed.clear();
+
   my_close(file, MYF(MY_FAE));
+
+  if (error) {
+    return nullptr;
+  }
+
+  for (auto &shard : shards) {
+    parsed.push_back(pool.add_task([&shard](size_t) {
+      for (auto &space : shard) {
+        space.second.finalize();
+      }
+    }));
+  }
+  for (auto &f : parsed) {
+    f.get();
+  }
+
+  /* the shards have disjoint spaces */
+  space_map = new xb_space_map;
+  for (auto &shard : shards) {
+    space_map->merge(shard);
+  }
+
   return space_map;
 }
 
+void xb_page_set::merge() {
+  std::sort(ranges.begin(), ranges.end(),
+            [](const page_range &a, const page_range &b) {
+              return a.first < b.first;
+            });
+
+  auto last = ranges.begin();
+  for (auto it = ranges.begin() + 1; it < ranges.end(); ++it) {
+    if (uint64_t{it->first} <= uint64_t{last->last} + 1) {
+      last->last = std::max(last->last, it->last);
+    } else {
+      *++last = *it;
+    }
+  }
+  ranges.erase(last + 1, ranges.end());
+}
+
+void xb_page_set::finalize() {
+  merge();
+  ranges.shrink_to_fit();
+}
+
 /** Free the tracking map.
 @param[in/out] space_map      pagetracking map */
 void deinit(xb_space_map *space_map) {
@@ -268,22 +355,20 @@ bool is_component_installed(MYSQL *connection) {
   return mysql_component == 0 ? (false) : (true);
 }
 
-void range_get_next_page(xb_page_set *page_set) {
-  ut_ad(page_set->current_page_it != page_set->pages.end());
+page_no_t range_get_next_page(xb_page_set *page_set, page_no_t max_gap) {
+  ut_ad(page_set->current_range_it != page_set->ranges.end());
 
-  /* loop to find the non continuous page id or end of block */
+  /* loop to find the gap too large to be read over or end of block */
   while (true) {
-    auto current_page = *page_set->current_page_it;
-    page_set->current_page_it++;
-    if (page_set->current_page_it == page_set->pages.end()) {
-      --page_set->current_page_it;
-      break;
-    }
-    auto next_page = *page_set->current_page_it;
-    if (next_page != current_page + 1) {
+    auto next = page_set->current_range_it + 1;
+    if (next == page_set->ranges.end() ||
+        next->first - page_set->current_range_it->last - 1 > max_gap) {
       break;
     }
+    page_set->current_range_it = next;
   }
+
+  return (page_set->current_range_it->last);
 }
 
 /** Start the page tracking
@@ -23,20 +23,45 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #define XB_CHANGED_PAGE_TRACKING_H
 
 #include <fil0fil.h>
+#include <algorithm>
+#include <vector>
 #include "common.h"
 #include "mysql.h"
 
 namespace pagetracking {
-typedef std::set<page_no_t>::iterator page_iterator;
 
+/** Run of contiguous changed pages, both ends included */
+struct page_range {
+  page_no_t first;
+  page_no_t last;
+};
+
+typedef std::vector<page_range>::const_iterator range_iterator;
+
+/** Changed pages of a space as sorted runs of contiguous pages. The tracking
+file mostly lists the pages in order, so a run costs far less than a tree node
+per page. */
 struct xb_page_set {
-  std::set<page_no_t> pages;
+  std::vector<page_range> ranges;
   xb_page_set(page_no_t first_page) {
-    pages.insert(first_page);
-    //    current_page_it = pages.begin();
+    ranges.push_back({first_page, first_page});
+  }
+  /** Add a page, extending the last run when the page follows it. */
+  void insert(page_no_t new_page) {
+    page_range &last = ranges.back();
+    if (new_page >= last.first &&
+        uint64_t{new_page} <= uint64_t{last.last} + 1) {
+      last.last = std::max(last.last, new_page);
+    } else {
+      ranges.push_back({new_page, new_page});
+    }
   }
-  void insert(page_no_t new_page) { pages.insert(new_page); }
-  page_iterator current_page_it;
+  /** Sort the runs and merge the overlapping and adjacent ones. */
+  void merge();
+  /** Merge the runs and release the spare memory, must be called once all
+  the pages are inserted. */
+  void finalize();
+  range_iterator current_range_it;
 };
 
 /** All spaces and their modified pages */
@@ -63,9 +88,13 @@ void deinit(xb_space_map *space_map);
 return true if installed */
 bool is_component_installed(MYSQL *connection);
 
-/** Move the current_page_it iterator to poin the last page id in current block
-@param[in/out] page_set       page_set */
-void range_get_next_page(xb_page_set *page_set);
+/** Move the current_range_it iterator to the last run of the block starting
+at the run it points to. Runs separated by up to max_gap unchanged pages are
+read as one block.
+@param[in/out] page_set       page_set
+@param[in]     max_gap        largest number of unchanged pages in a block
+@return last page of the block */
+page_no_t range_get_next_page(xb_page_set *page_set, page_no_t max_gap);
 
 /** Set the backupid
 @param[in] connection  MySQL connection handler
@@ -0,0 +1,75 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+Incompressible data detection for the compressing datasinks.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef COMPRESS_SAMPLE_H
+#define COMPRESS_SAMPLE_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/* Bytes sampled from a buffer, in COMPRESS_SAMPLE_WINDOWS windows spread
+evenly over it */
+constexpr size_t COMPRESS_SAMPLE_SIZE = 4096;
+constexpr size_t COMPRESS_SAMPLE_WINDOWS = 4;
+
+/* Entropy in bits per byte above which a sample is taken for compressed,
+encrypted or random data. The estimate for uniformly random bytes is about
+7.95 with a sample of COMPRESS_SAMPLE_SIZE bytes. */
+constexpr double COMPRESS_SAMPLE_MAX_ENTROPY = 7.9;
+
+/** Check whether a buffer looks incompressible, judging by the byte entropy
+of a small sample of it. Costs a fraction of the compression of the buffer,
+so that already compressed or encrypted data can be stored as is.
+@param[in]  buf  data to check
+@param[in]  len  data length
+@return true if compressing the data is not worth it */
+static inline bool compress_is_incompressible(const void *buf, size_t len) {
+  const unsigned char *data = static_cast<const unsigned char *>(buf);
+  uint32_t counts[256] = {0};
+  size_t n_sampled = 0;
+
+  /* small buffers are cheap to compress */
+  if (len < COMPRESS_SAMPLE_SIZE) {
+    return false;
+  }
+
+  const size_t window = COMPRESS_SAMPLE_SIZE / COMPRESS_SAMPLE_WINDOWS;
+  const size_t step = (len - window) / (COMPRESS_SAMPLE_WINDOWS - 1);
+  for (size_t i = 0; i < COMPRESS_SAMPLE_WINDOWS; i++) {
+    const unsigned char *p = data + i * step;
+    for (size_t j = 0; j < window; j++) {
+      counts[p[j]]++;
+    }
+    n_sampled += window;
+  }
+
+  double entropy = 0;
+  for (auto count : counts) {
+    if (count > 0) {
+      const double p = static_cast<double>(count) / n_sampled;
+      entropy -= p * std::log2(p);
+    }
+  }
+
+  return entropy > COMPRESS_SAMPLE_MAX_ENTROPY;
+}
+
+#endif
@@ -1,7 +1,7 @@
 /******************************************************
 Copyright (c) 2017 Percona LLC and/or its affiliates.
 
-Zlib compatible CRC-32 implementation.
+Zlib compatible CRC-32 and CRC-32C (Castagnoli) implementations.
 
 This program is free software; you can redistribute it and/or modify
 it under the terms of the GNU General Public License as published by
@@ -25,10 +25,30 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "config.h"
 #include "crc-intel-pclmul.h"
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_X86_64
+#elif defined(__GNUC__) && defined(__aarch64__)
+#include <arm_acle.h>
+#ifdef __linux__
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#define CRC32C_ARM64
+#endif
+
 #if __GNUC__ >= 4 && defined(__x86_64__)
 static int pclmul_enabled = 0;
 #endif
 
+/* CRC-32C (Castagnoli) instructions: SSE4.2 crc32 or ARMv8 crc32c* */
+static int crc32c_hw_enabled = 0;
+
+/* reflected CRC-32C polynomial */
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t crc32c_table[256];
+
 #if defined(__GNUC__) && defined(__x86_64__)
 static uint32_t cpuid(uint32_t *ecx, uint32_t *edx) {
   uint32_t level;
@@ -51,8 +71,25 @@ void crc_init() {
 
   if (cpuid(&ecx, &edx) > 0) {
     pclmul_enabled = ((ecx >> 19) & 1) && ((ecx >> 1) & 1);
+    crc32c_hw_enabled = (ecx >> 20) & 1;
   }
 #endif
+
+#ifdef CRC32C_ARM64
+#if defined(__linux__)
+  crc32c_hw_enabled = (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#elif defined(__APPLE__)
+  crc32c_hw_enabled = 1;
+#endif
+#endif
+
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+    }
+    crc32c_table[i] = crc;
+  }
 }
 
 ulong crc32_iso3309(ulong crc, const uchar *buf, uint len) {
@@ -65,3 +102,118 @@ ulong crc32_iso3309(ulong crc, const uchar *buf, uint len) {
 #endif
   return crc32(crc, buf, len);
 }
+
+#ifdef CRC32C_X86_64
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(
+    uint32_t crc, const uchar *buf, size_t len) {
+  for (; len > 0 && ((uintptr_t)buf & 7) != 0; len--) {
+    crc = _mm_crc32_u8(crc, *buf++);
+  }
+  uint64_t crc64 = crc;
+  for (; len >= 8; len -= 8, buf += 8) {
+    uint64_t word;
+    memcpy(&word, buf, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = (uint32_t)crc64;
+  for (; len > 0; len--) {
+    crc = _mm_crc32_u8(crc, *buf++);
+  }
+  return crc;
+}
+#endif
+
+#ifdef CRC32C_ARM64
+#ifndef __APPLE__
+__attribute__((target("+crc")))
+#endif
+static uint32_t
+crc32c_hw(uint32_t crc, const uchar *buf, size_t len) {
+  for (; len > 0 && ((uintptr_t)buf & 7) != 0; len--) {
+    crc = __crc32cb(crc, *buf++);
+  }
+  for (; len >= 8; len -= 8, buf += 8) {
+    uint64_t word;
+    memcpy(&word, buf, 8);
+    crc = __crc32cd(crc, word);
+  }
+  for (; len > 0; len--) {
+    crc = __crc32cb(crc, *buf++);
+  }
+  return crc;
+}
+#endif
+
+ulong crc32_castagnoli(ulong crc, const uchar *buf, uint len) {
+  uint32_t crc_accum = (uint32_t)crc ^ 0xffffffffU;
+
+#if defined(CRC32C_X86_64) || defined(CRC32C_ARM64)
+  if (crc32c_hw_enabled) {
+    return crc32c_hw(crc_accum, buf, len) ^ 0xffffffffU;
+  }
+#endif
+
+  for (; len > 0; len--) {
+    crc_accum = crc32c_table[(crc_accum ^ *buf++) & 0xff] ^ (crc_accum >> 8);
+  }
+  return crc_accum ^ 0xffffffffU;
+}
+
+/* Multiply a vector by a 32x32 matrix over GF(2) */
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec) {
+  uint32_t sum = 0;
+
+  for (; vec != 0; vec >>= 1, mat++) {
+    if (vec & 1) {
+      sum ^= *mat;
+    }
+  }
+  return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat) {
+  for (int n = 0; n < 32; n++) {
+    square[n] = gf2_matrix_times(mat, mat[n]);
+  }
+}
+
+ulong crc32_castagnoli_combine(ulong crc1, ulong crc2, uint64_t len2) {
+  uint32_t even[32];
+  uint32_t odd[32];
+  uint32_t crc = (uint32_t)crc1;
+
+  if (len2 == 0) {
+    return crc1;
+  }
+
+  /* operator for one zero bit */
+  odd[0] = CRC32C_POLY;
+  for (int n = 1; n < 32; n++) {
+    odd[n] = 1U << (n - 1);
+  }
+
+  /* operators for two and four zero bits */
+  gf2_matrix_square(even, odd);
+  gf2_matrix_square(odd, even);
+
+  /* apply len2 zero bytes to crc1, squaring the operator for each bit of
+  len2 */
+  do {
+    gf2_matrix_square(even, odd);
+    if (len2 & 1) {
+      crc = gf2_matrix_times(even, crc);
+    }
+    len2 >>= 1;
+    if (len2 == 0) {
+      break;
+    }
+
+    gf2_matrix_square(odd, even);
+    if (len2 & 1) {
+      crc = gf2_matrix_times(odd, crc);
+    }
+    len2 >>= 1;
+  } while (len2 != 0);
+
+  return crc ^ (uint32_t)crc2;
+}
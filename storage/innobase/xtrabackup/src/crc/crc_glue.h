@@ -1,7 +1,7 @@
 /******************************************************
 Copyright (c) 2017 Percona LLC and/or its affiliates.
 
-Zlib compatible CRC-32 implementation.
+Zlib compatible CRC-32 and CRC-32C (Castagnoli) implementations.
 
 This program is free software; you can redistribute it and/or modify
 it under the terms of the GNU General Public License as published by
@@ -26,6 +26,12 @@ extern "C" {
 
 void crc_init();
 ulong crc32_iso3309(ulong crc, const uchar *buf, uint len);
+/* CRC-32C, computed with the SSE4.2 or ARMv8 CRC instructions when the CPU
+has them */
+ulong crc32_castagnoli(ulong crc, const uchar *buf, uint len);
+/* CRC-32C of the concatenation of two buffers, from the CRC-32C of each of
+them and the length of the second one */
+ulong crc32_castagnoli_combine(ulong crc1, ulong crc2, uint64_t len2);
 
 #ifdef __cplusplus
 }
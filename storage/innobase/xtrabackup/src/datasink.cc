@@ -20,7 +20,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 #include "datasink.h"
 #include <my_base.h>
+#include <my_sys.h>
+#include <my_thread_local.h>
+#include <mysql/service_mysql_alloc.h>
+#include <mysys_err.h>
+#include <limits.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
 #include "common.h"
+#include "ds_async.h"
 #include "ds_buffer.h"
 #include "ds_compress.h"
 #include "ds_compress_lz4.h"
@@ -33,15 +44,125 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "ds_fifo.h"
 #include "ds_local.h"
 #include "ds_stdout.h"
+#include "ds_tee.h"
 #include "ds_tmpfile.h"
 #include "ds_xbstream.h"
+#include "memory_budget.h"
 #include "msg.h"
+#include "wait_state.h"
+
+/** Maximum number of datasink types with statistics */
+static const size_t DS_STATS_MAX = 32;
+
+struct ds_stats_entry_t {
+  const datasink_t *ds{nullptr};
+  const char *name{nullptr};
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> nsec{0};
+};
+
+static ds_stats_entry_t ds_stats[DS_STATS_MAX];
+static std::atomic<size_t> ds_stats_n{0};
+static std::mutex ds_stats_mutex;
+
+/* time spent by this thread in the datasinks called from the current one */
+static thread_local uint64_t ds_nested_nsec = 0;
+
+/** Register the statistics of a datasink type, once per type */
+static void ds_stats_register(const datasink_t *ds, const char *name) {
+  std::lock_guard<std::mutex> lock(ds_stats_mutex);
+
+  const size_t n = ds_stats_n.load();
+  for (size_t i = 0; i < n; i++) {
+    if (ds_stats[i].ds == ds) {
+      return;
+    }
+  }
+  if (n < DS_STATS_MAX) {
+    ds_stats[n].ds = ds;
+    ds_stats[n].name = name;
+    ds_stats_n.store(n + 1, std::memory_order_release);
+  }
+}
+
+static ds_stats_entry_t *ds_stats_find(const datasink_t *ds) {
+  const size_t n = ds_stats_n.load(std::memory_order_acquire);
+  for (size_t i = 0; i < n; i++) {
+    if (ds_stats[i].ds == ds) {
+      return &ds_stats[i];
+    }
+  }
+  return nullptr;
+}
+
+/** Accounts a call into a datasink to its statistics. The time of nested
+calls into the next datasinks is subtracted, so that every stage only gets
+its own time. The calling thread is in the DS_WRITE wait state meanwhile. */
+class Ds_stage_timer {
+ public:
+  Ds_stage_timer(const datasink_t *ds, size_t len)
+      : m_stats(ds_stats_find(ds)),
+        m_len(len),
+        m_outer_nsec(ds_nested_nsec),
+        m_start(std::chrono::steady_clock::now()) {
+    ds_nested_nsec = 0;
+  }
+
+  ~Ds_stage_timer() {
+    const uint64_t nsec =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_start)
+            .count();
+    if (m_stats != nullptr) {
+      m_stats->calls.fetch_add(1, std::memory_order_relaxed);
+      m_stats->bytes.fetch_add(m_len, std::memory_order_relaxed);
+      m_stats->nsec.fetch_add(nsec - std::min(nsec, ds_nested_nsec),
+                              std::memory_order_relaxed);
+    }
+    ds_nested_nsec = m_outer_nsec + nsec;
+  }
+
+ private:
+  ds_stats_entry_t *m_stats;
+  size_t m_len;
+  uint64_t m_outer_nsec;
+  std::chrono::steady_clock::time_point m_start;
+  xb::wait_state::Scope m_wait{xb::wait_state::DS_WRITE};
+};
+
+static size_t iov_len_total(const struct iovec *iov, int iovcnt) {
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+  return len;
+}
+
+/************************************************************************
+Get the statistics of the datasink types created so far.
+@return number of entries written to stats, at most n. */
+size_t ds_get_stage_stats(ds_stage_stats_t *stats, size_t n) {
+  n = std::min(n, ds_stats_n.load(std::memory_order_acquire));
+  for (size_t i = 0; i < n; i++) {
+    stats[i].name = ds_stats[i].name;
+    stats[i].calls = ds_stats[i].calls.load();
+    stats[i].bytes = ds_stats[i].bytes.load();
+    stats[i].usec = ds_stats[i].nsec.load() / 1000;
+  }
+  return n;
+}
 
 /************************************************************************
 Create a datasink of the specified type */
 ds_ctxt_t *ds_create(const char *root, ds_type_t type) {
+  /* stage names, in the order of ds_type_t */
+  static const char *names[] = {
+      "stdout",     "fifo",       "local",    "xbstream",
+      "compress",   "compress",   "compress", "decompress",
+      "decompress", "decompress", "encrypt",  "decrypt",
+      "tmpfile",    "buffer",     "async",    "tee"};
   datasink_t *ds;
-  ds_ctxt_t *ctxt;
 
   switch (type) {
     case DS_TYPE_STDOUT:
@@ -86,12 +207,29 @@ ds_ctxt_t *ds_create(const char *root, ds_type_t type) {
     case DS_TYPE_BUFFER:
       ds = &datasink_buffer;
       break;
+    case DS_TYPE_ASYNC:
+      ds = &datasink_async;
+      break;
+    case DS_TYPE_TEE:
+      ds = &datasink_tee;
+      break;
     default:
       msg("Unknown datasink type: %d\n", type);
       xb_ad(0);
       return NULL;
   }
 
+  return ds_create_from(root, ds, names[type]);
+}
+
+/************************************************************************
+Create a datasink not known to ds_create(), i.e. one that is only linked into
+some of the binaries. name is the stage name of its statistics. */
+ds_ctxt_t *ds_create_from(const char *root, datasink_t *ds, const char *name) {
+  ds_ctxt_t *ctxt;
+
+  ds_stats_register(ds, name);
+
   ctxt = ds->init(root);
   if (ctxt != NULL) {
     ctxt->datasink = ds;
@@ -120,9 +258,203 @@ ds_file_t *ds_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *stat) {
 Write to a datasink file.
 @return 0 on success, 1 on error. */
 int ds_write(ds_file_t *file, const void *buf, size_t len) {
+  Ds_stage_timer timer(file->datasink, len);
   return file->datasink->write(file, buf, len);
 }
 
+/************************************************************************
+Pass the buffered data of a datasink file down the pipeline.
+@return 0 on success, 1 on error. */
+int ds_flush(ds_file_t *file) {
+  if (file->datasink->flush == nullptr) {
+    return 0;
+  }
+
+  Ds_stage_timer timer(file->datasink, 0);
+  return file->datasink->flush(file);
+}
+
+/************************************************************************
+Write a sequence of buffers to a datasink file. Datasinks without a gather
+write callback get one write per buffer.
+@return 0 on success, 1 on error. */
+static int ds_writev_low(ds_file_t *file, const struct iovec *iov,
+                         int iovcnt) {
+  if (file->datasink->writev != nullptr) {
+    return file->datasink->writev(file, iov, iovcnt);
+  }
+
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > 0 &&
+        file->datasink->write(file, iov[i].iov_base, iov[i].iov_len)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int ds_writev(ds_file_t *file, const struct iovec *iov, int iovcnt) {
+  Ds_stage_timer timer(file->datasink, iov_len_total(iov, iovcnt));
+  return ds_writev_low(file, iov, iovcnt);
+}
+
+/************************************************************************
+Write a sequence of buffers to a file descriptor with as few writev() calls
+as possible, resuming after partial writes.
+@return 0 on success, 1 on error. */
+int ds_writev_fd(int fd, const struct iovec *iov, int iovcnt) {
+  std::vector<struct iovec> vec(iov, iov + iovcnt);
+  size_t i = 0;
+
+  while (i < vec.size()) {
+    const int cnt = std::min<size_t>(vec.size() - i, IOV_MAX);
+    ssize_t written = writev(fd, &vec[i], cnt);
+
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      char errbuf[MYSYS_STRERROR_SIZE];
+      set_my_errno(errno);
+      my_error(EE_WRITE, MYF(0), my_filename(fd), my_errno(),
+               my_strerror(errbuf, sizeof(errbuf), my_errno()));
+      return 1;
+    }
+
+    /* skip the buffers written completely and resume in the middle of the
+    partially written one */
+    while (i < vec.size() && static_cast<size_t>(written) >= vec[i].iov_len) {
+      written -= vec[i].iov_len;
+      i++;
+    }
+    if (written > 0) {
+      vec[i].iov_base = static_cast<char *>(vec[i].iov_base) + written;
+      vec[i].iov_len -= written;
+    }
+  }
+
+  return 0;
+}
+
+/************************************************************************
+Check if a datasink file takes over leased buffers.
+@return 1 if yes. */
+int ds_is_lease_supported(ds_file_t *file) {
+  if (file->datasink->write_lease != nullptr) {
+    return 1;
+  }
+  return 0;
+}
+
+/************************************************************************
+Hand a leased buffer over to a datasink file. Datasinks not supporting leases
+write the data immediately. The lease is released by the datasink in any case,
+also on error.
+@return 0 on success, 1 on error. */
+int ds_write_lease(ds_file_t *file, ds_lease_t *lease) {
+  Ds_stage_timer timer(file->datasink,
+                       iov_len_total(lease->iov, lease->iovcnt));
+
+  if (file->datasink->write_lease != nullptr) {
+    return file->datasink->write_lease(file, lease);
+  }
+
+  int ret = ds_writev_low(file, lease->iov, lease->iovcnt);
+  ds_lease_release(lease);
+
+  return ret;
+}
+
+struct ds_lease_pool_struct {
+  std::mutex mutex;
+  std::vector<ds_lease_t *> free_leases;
+  size_t n_leases{0};
+};
+
+/************************************************************************
+Create a pool of leases. */
+ds_lease_pool_t *ds_lease_pool_new(void) { return new ds_lease_pool_t; }
+
+/************************************************************************
+Get a lease from the pool with at least size bytes of memory and room for
+iovcnt buffers. */
+ds_lease_t *ds_lease_get(ds_lease_pool_t *pool, size_t size, int iovcnt) {
+  ds_lease_t *lease = nullptr;
+
+  pool->mutex.lock();
+  if (!pool->free_leases.empty()) {
+    lease = pool->free_leases.back();
+    pool->free_leases.pop_back();
+  } else {
+    pool->n_leases++;
+  }
+  pool->mutex.unlock();
+
+  if (lease == nullptr) {
+    lease = static_cast<ds_lease_t *>(my_malloc(
+        PSI_NOT_INSTRUMENTED, sizeof(ds_lease_t), MYF(MY_FAE | MY_ZEROFILL)));
+    lease->pool = pool;
+  }
+
+  if (lease->size < size) {
+    xb::memory::charge(xb::memory::DATASINK, size - lease->size);
+    lease->buf = static_cast<char *>(
+        my_realloc(PSI_NOT_INSTRUMENTED, lease->buf, size,
+                   MYF(MY_FAE | MY_ALLOW_ZERO_PTR)));
+    lease->size = size;
+  }
+
+  if (lease->iov_size < iovcnt) {
+    lease->iov = static_cast<struct iovec *>(
+        my_realloc(PSI_NOT_INSTRUMENTED, lease->iov,
+                   sizeof(struct iovec) * iovcnt,
+                   MYF(MY_FAE | MY_ALLOW_ZERO_PTR)));
+    lease->iov_size = iovcnt;
+  }
+
+  lease->iovcnt = 0;
+
+  return lease;
+}
+
+/************************************************************************
+Give a lease back to its pool. */
+void ds_lease_release(ds_lease_t *lease) {
+  ds_lease_pool_t *pool = lease->pool;
+
+  pool->mutex.lock();
+  pool->free_leases.push_back(lease);
+  pool->mutex.unlock();
+}
+
+/************************************************************************
+Get the number of bytes of data described by a lease. */
+size_t ds_lease_len(const ds_lease_t *lease) {
+  size_t len = 0;
+
+  for (int i = 0; i < lease->iovcnt; i++) {
+    len += lease->iov[i].iov_len;
+  }
+
+  return len;
+}
+
+/************************************************************************
+Destroy a pool of leases. All leases must have been released. */
+void ds_lease_pool_free(ds_lease_pool_t *pool) {
+  xb_a(pool->free_leases.size() == pool->n_leases);
+
+  for (auto lease : pool->free_leases) {
+    xb::memory::uncharge(xb::memory::DATASINK, lease->size);
+    my_free(lease->buf);
+    my_free(lease->iov);
+    my_free(lease);
+  }
+
+  delete pool;
+}
+
 /************************************************************************
 Check if sparse files are supported.
 @return 1 if yes. */
@@ -140,6 +472,7 @@ int ds_write_sparse(ds_file_t *file, const void *buf, size_t len,
                     size_t sparse_map_size, const ds_sparse_chunk_t *sparse_map,
                     bool punch_hole_supported) {
   if (file->datasink->write_sparse != nullptr) {
+    Ds_stage_timer timer(file->datasink, len);
     return file->datasink->write_sparse(file, buf, len, sparse_map_size,
                                         sparse_map, punch_hole_supported);
   }
@@ -149,7 +482,10 @@ int ds_write_sparse(ds_file_t *file, const void *buf, size_t len,
 /************************************************************************
 Close a datasink file.
 @return 0 on success, 1, on error. */
-int ds_close(ds_file_t *file) { return file->datasink->close(file); }
+int ds_close(ds_file_t *file) {
+  Ds_stage_timer timer(file->datasink, 0);
+  return file->datasink->close(file);
+}
 
 /************************************************************************
 Destroy a datasink handle */
@@ -22,6 +22,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #define XB_DATASINK_H
 
 #include <my_dir.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -49,6 +51,21 @@ typedef struct {
   size_t len;
 } ds_sparse_chunk_t;
 
+typedef struct ds_lease_pool_struct ds_lease_pool_t;
+
+/* Memory handed over to a datasink with ds_write_lease() instead of being
+copied. The datasink may keep the lease after ds_write_lease() has returned,
+the data must stay valid until the datasink gives it back with
+ds_lease_release(). */
+typedef struct {
+  char *buf;             /* leased memory */
+  size_t size;           /* size of buf */
+  struct iovec *iov;     /* data to write, pointing into buf */
+  int iovcnt;            /* number of buffers in iov */
+  int iov_size;          /* number of buffers iov can hold */
+  ds_lease_pool_t *pool; /* pool the lease comes from */
+} ds_lease_t;
+
 struct datasink_struct {
   ds_ctxt_t *(*init)(const char *root);
   ds_file_t *(*open)(ds_ctxt_t *ctxt, const char *path, MY_STAT *stat);
@@ -57,8 +74,11 @@ struct datasink_struct {
                       size_t sparse_map_size,
                       const ds_sparse_chunk_t *sparse_map,
                       bool punch_hole_supported);
+  int (*writev)(ds_file_t *file, const struct iovec *iov, int iovcnt);
+  int (*write_lease)(ds_file_t *file, ds_lease_t *lease);
   int (*close)(ds_file_t *file);
   void (*deinit)(ds_ctxt_t *ctxt);
+  int (*flush)(ds_file_t *file);
 };
 
 /* Supported datasink types */
@@ -76,13 +96,20 @@ typedef enum {
   DS_TYPE_ENCRYPT,
   DS_TYPE_DECRYPT,
   DS_TYPE_TMPFILE,
-  DS_TYPE_BUFFER
+  DS_TYPE_BUFFER,
+  DS_TYPE_ASYNC,
+  DS_TYPE_TEE
 } ds_type_t;
 
 /************************************************************************
 Create a datasink of the specified type */
 ds_ctxt_t *ds_create(const char *root, ds_type_t type);
 
+/************************************************************************
+Create a datasink not known to ds_create(), i.e. one that is only linked into
+some of the binaries. name is the stage name of its statistics. */
+ds_ctxt_t *ds_create_from(const char *root, datasink_t *ds, const char *name);
+
 /************************************************************************
 Open a datasink file */
 ds_file_t *ds_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *stat);
@@ -92,6 +119,51 @@ Write to a datasink file.
 @return 0 on success, 1 on error. */
 int ds_write(ds_file_t *file, const void *buf, size_t len);
 
+/************************************************************************
+Write a sequence of buffers to a datasink file. Datasinks without a gather
+write callback get one write per buffer.
+@return 0 on success, 1 on error. */
+int ds_writev(ds_file_t *file, const struct iovec *iov, int iovcnt);
+
+/************************************************************************
+Write a sequence of buffers to a file descriptor with as few writev() calls
+as possible, resuming after partial writes.
+@return 0 on success, 1 on error. */
+int ds_writev_fd(int fd, const struct iovec *iov, int iovcnt);
+
+/************************************************************************
+Check if a datasink file takes over leased buffers.
+@return 1 if yes. */
+int ds_is_lease_supported(ds_file_t *file);
+
+/************************************************************************
+Hand a leased buffer over to a datasink file. Datasinks not supporting leases
+write the data immediately. The lease is released by the datasink in any case,
+also on error.
+@return 0 on success, 1 on error. */
+int ds_write_lease(ds_file_t *file, ds_lease_t *lease);
+
+/************************************************************************
+Create a pool of leases. */
+ds_lease_pool_t *ds_lease_pool_new(void);
+
+/************************************************************************
+Get a lease from the pool with at least size bytes of memory and room for
+iovcnt buffers. */
+ds_lease_t *ds_lease_get(ds_lease_pool_t *pool, size_t size, int iovcnt);
+
+/************************************************************************
+Give a lease back to its pool. */
+void ds_lease_release(ds_lease_t *lease);
+
+/************************************************************************
+Get the number of bytes of data described by a lease. */
+size_t ds_lease_len(const ds_lease_t *lease);
+
+/************************************************************************
+Destroy a pool of leases. All leases must have been released. */
+void ds_lease_pool_free(ds_lease_pool_t *pool);
+
 /************************************************************************
 Check if sparse files are supported.
 @return 1 if yes. */
@@ -104,6 +176,13 @@ int ds_write_sparse(ds_file_t *file, const void *buf, size_t len,
                     size_t sparse_map_size, const ds_sparse_chunk_t *sparse_map,
                     bool punch_hole_supported);
 
+/************************************************************************
+Pass the data buffered for a file down the pipeline, so that what was written
+so far reaches the destination before the file is closed. Datasinks without
+a flush callback keep their buffered data.
+@return 0 on success, 1 on error. */
+int ds_flush(ds_file_t *file);
+
 /************************************************************************
 Close a datasink file.
 @return 0 on success, 1, on error. */
@@ -113,6 +192,21 @@ int ds_close(ds_file_t *file);
 Destroy a datasink handle */
 void ds_destroy(ds_ctxt_t *ctxt);
 
+/* Statistics of a datasink type. usec is the time the writers spent in the
+datasink, without the time spent in the datasinks it writes to on the same
+thread, so that it includes waits for its own worker threads. */
+typedef struct {
+  const char *name;
+  uint64_t calls;
+  uint64_t bytes;
+  uint64_t usec;
+} ds_stage_stats_t;
+
+/************************************************************************
+Get the statistics of the datasink types created so far.
+@return number of entries written to stats, at most n. */
+size_t ds_get_stage_stats(ds_stage_stats_t *stats, size_t n);
+
 /************************************************************************
 Set the destination pipe for a datasink (only makes sense for compress and
 tmpfile). */
@@ -0,0 +1,343 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+Asynchronous datasink for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+/* Decouples writers from a slow destination datasink set with ds_set_pipe().
+Every file gets a background thread writing to the destination file, data is
+copied into a queue of buffers holding at most the configured number of bytes
+(DS_DEFAULT_QUEUE_SIZE by default). Writers only block when the queue is full.
+Meant for stream destinations, which have a few long lived files. */
+
+#include "ds_async.h"
+#include <my_base.h>
+#include <mysql/service_mysql_alloc.h>
+#include <mysql_version.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "common.h"
+#include "datasink.h"
+#include "msg.h"
+
+#define DS_DEFAULT_QUEUE_SIZE (64 * 1024 * 1024)
+
+typedef struct {
+  char *buf;
+  size_t size;
+  size_t len;
+} ds_async_buf_t;
+
+typedef struct {
+  size_t queue_size;
+  uint max_wait; /* seconds a write may wait for room, 0 for no limit */
+
+  /* back-pressure statistics */
+  std::atomic<uint64_t> bytes;      /* bytes passed through the queue */
+  std::atomic<uint64_t> waits;      /* writes blocked on a full queue */
+  std::atomic<uint64_t> wait_usec;  /* time writes were blocked */
+  std::atomic<uint64_t> max_queued; /* peak number of bytes queued */
+} ds_async_ctxt_t;
+
+typedef struct {
+  ds_file_t *dst_file;
+  ds_async_ctxt_t *async_ctxt;
+
+  std::mutex mutex;
+  /* signalled when the queue gets new data or the file is closed */
+  std::condition_variable not_empty;
+  /* signalled when data has been written out */
+  std::condition_variable not_full;
+
+  std::deque<ds_async_buf_t *> queue;
+  std::vector<ds_async_buf_t *> free_bufs;
+  size_t queued;
+  bool closing;
+  bool failed;
+  bool stalled; /* a write has waited for more than max_wait */
+
+  std::thread writer;
+} ds_async_file_t;
+
+static ds_ctxt_t *async_init(const char *root);
+static ds_file_t *async_open(ds_ctxt_t *ctxt, const char *path,
+                             MY_STAT *mystat);
+static int async_write(ds_file_t *file, const void *buf, size_t len);
+static int async_writev(ds_file_t *file, const struct iovec *iov, int iovcnt);
+static int async_close(ds_file_t *file);
+static void async_deinit(ds_ctxt_t *ctxt);
+
+datasink_t datasink_async = {&async_init,  &async_open,   &async_write,
+                             nullptr,      &async_writev, nullptr,
+                             &async_close, &async_deinit, nullptr};
+
+/* Change the maximum number of bytes queued per file */
+void ds_async_set_size(ds_ctxt_t *ctxt, size_t size) {
+  ds_async_ctxt_t *async_ctxt = (ds_async_ctxt_t *)ctxt->ptr;
+
+  async_ctxt->queue_size = size;
+}
+
+/* Fail writes waiting for room for more than the given number of seconds */
+void ds_async_set_max_wait(ds_ctxt_t *ctxt, uint seconds) {
+  ds_async_ctxt_t *async_ctxt = (ds_async_ctxt_t *)ctxt->ptr;
+
+  async_ctxt->max_wait = seconds;
+}
+
+static ds_ctxt_t *async_init(const char *root) {
+  ds_ctxt_t *ctxt;
+  ds_async_ctxt_t *async_ctxt;
+
+  ctxt = static_cast<ds_ctxt_t *>(my_malloc(
+      PSI_NOT_INSTRUMENTED, sizeof(ds_ctxt_t), MYF(MY_FAE | MY_ZEROFILL)));
+  async_ctxt = new ds_async_ctxt_t;
+  async_ctxt->queue_size = DS_DEFAULT_QUEUE_SIZE;
+  async_ctxt->max_wait = 0;
+  async_ctxt->bytes = 0;
+  async_ctxt->waits = 0;
+  async_ctxt->wait_usec = 0;
+  async_ctxt->max_queued = 0;
+
+  ctxt->ptr = async_ctxt;
+  ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
+
+  return ctxt;
+}
+
+/* Background thread writing the queued buffers of a file in order */
+static void async_writer_func(ds_async_file_t *async_file) {
+  std::unique_lock<std::mutex> lock(async_file->mutex);
+
+  while (true) {
+    async_file->not_empty.wait(lock, [async_file] {
+      return async_file->closing || !async_file->queue.empty();
+    });
+    if (async_file->queue.empty()) {
+      break;
+    }
+
+    ds_async_buf_t *buf = async_file->queue.front();
+    async_file->queue.pop_front();
+    const bool skip = async_file->failed;
+    lock.unlock();
+
+    /* after an error the remaining data is dropped, writers get the error
+    from their next call */
+    const bool failed =
+        !skip && ds_write(async_file->dst_file, buf->buf, buf->len);
+
+    lock.lock();
+    async_file->queued -= buf->len;
+    async_file->free_bufs.push_back(buf);
+    if (failed) {
+      async_file->failed = true;
+    }
+    async_file->not_full.notify_all();
+  }
+}
+
+static ds_file_t *async_open(ds_ctxt_t *ctxt, const char *path,
+                             MY_STAT *mystat) {
+  ds_ctxt_t *pipe_ctxt;
+  ds_file_t *dst_file;
+  ds_file_t *file;
+  ds_async_file_t *async_file;
+
+  pipe_ctxt = ctxt->pipe_ctxt;
+  xb_a(pipe_ctxt != NULL);
+
+  dst_file = ds_open(pipe_ctxt, path, mystat);
+  if (dst_file == NULL) {
+    return NULL;
+  }
+
+  file = (ds_file_t *)my_malloc(PSI_NOT_INSTRUMENTED, sizeof(ds_file_t),
+                                MYF(MY_FAE));
+
+  async_file = new ds_async_file_t;
+  async_file->dst_file = dst_file;
+  async_file->async_ctxt = (ds_async_ctxt_t *)ctxt->ptr;
+  async_file->queued = 0;
+  async_file->closing = false;
+  async_file->failed = false;
+  async_file->stalled = false;
+  async_file->writer = std::thread(async_writer_func, async_file);
+
+  file->path = dst_file->path;
+  file->ptr = async_file;
+
+  return file;
+}
+
+static int async_writev(ds_file_t *file, const struct iovec *iov, int iovcnt) {
+  ds_async_file_t *async_file = (ds_async_file_t *)file->ptr;
+  ds_async_ctxt_t *async_ctxt = async_file->async_ctxt;
+  ds_async_buf_t *buf;
+  size_t len = 0;
+
+  for (int i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+
+  if (len == 0) {
+    return 0;
+  }
+
+  std::unique_lock<std::mutex> lock(async_file->mutex);
+
+  /* a write larger than the queue is only accepted into an empty queue */
+  auto has_room = [async_file, async_ctxt, len] {
+    return async_file->failed || async_file->queued == 0 ||
+           async_file->queued + len <= async_ctxt->queue_size;
+  };
+
+  if (!has_room()) {
+    const auto start = std::chrono::steady_clock::now();
+    if (async_ctxt->max_wait == 0) {
+      async_file->not_full.wait(lock, has_room);
+    } else if (!async_file->not_full.wait_for(
+                   lock, std::chrono::seconds(async_ctxt->max_wait),
+                   has_room)) {
+      msg_ts("Writes to %s have stalled for more than %u seconds.\n",
+             file->path, async_ctxt->max_wait);
+      async_file->stalled = true;
+      async_file->failed = true;
+    }
+    async_ctxt->waits++;
+    async_ctxt->wait_usec +=
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+  }
+
+  if (async_file->failed) {
+    return 1;
+  }
+
+  if (async_file->free_bufs.empty()) {
+    buf = new ds_async_buf_t{nullptr, 0, 0};
+  } else {
+    buf = async_file->free_bufs.back();
+    async_file->free_bufs.pop_back();
+  }
+
+  /* reserve the room before copying, so that the writer does not wait for the
+  copy */
+  async_file->queued += len;
+
+  uint64_t max_queued = async_ctxt->max_queued;
+  while (async_file->queued > max_queued &&
+         !async_ctxt->max_queued.compare_exchange_weak(max_queued,
+                                                       async_file->queued)) {
+  }
+
+  lock.unlock();
+
+  if (buf->size < len) {
+    buf->buf = static_cast<char *>(
+        my_realloc(PSI_NOT_INSTRUMENTED, buf->buf, len, MYF(MY_FAE)));
+    buf->size = len;
+  }
+
+  buf->len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(buf->buf + buf->len, iov[i].iov_base, iov[i].iov_len);
+    buf->len += iov[i].iov_len;
+  }
+
+  async_ctxt->bytes += len;
+
+  lock.lock();
+  async_file->queue.push_back(buf);
+  async_file->not_empty.notify_one();
+
+  return 0;
+}
+
+static int async_write(ds_file_t *file, const void *buf, size_t len) {
+  struct iovec iov;
+
+  iov.iov_base = const_cast<void *>(buf);
+  iov.iov_len = len;
+
+  return async_writev(file, &iov, 1);
+}
+
+static int async_close(ds_file_t *file) {
+  ds_async_file_t *async_file = (ds_async_file_t *)file->ptr;
+  bool stalled;
+  int ret;
+
+  {
+    std::lock_guard<std::mutex> lock(async_file->mutex);
+    async_file->closing = true;
+    stalled = async_file->stalled;
+  }
+  async_file->not_empty.notify_one();
+
+  if (stalled) {
+    /* The writer may never return from the destination. Abandon it together
+    with the destination file, it only drops the queued data if it ever
+    does. */
+    async_file->writer.detach();
+    my_free(file);
+    return 1;
+  }
+
+  async_file->writer.join();
+
+  ret = async_file->failed ? 1 : 0;
+
+  for (auto buf : async_file->free_bufs) {
+    my_free(buf->buf);
+    delete buf;
+  }
+
+  if (ds_close(async_file->dst_file)) {
+    ret = 1;
+  }
+
+  delete async_file;
+  my_free(file);
+
+  return ret;
+}
+
+static void async_deinit(ds_ctxt_t *ctxt) {
+  ds_async_ctxt_t *async_ctxt = (ds_async_ctxt_t *)ctxt->ptr;
+
+  if (async_ctxt->bytes > 0) {
+    msg_ts(
+        "Stream queue: %llu MB written, peak queue usage %llu MB, writers "
+        "blocked %llu times for %.3f s in total\n",
+        (unsigned long long)(async_ctxt->bytes >> 20),
+        (unsigned long long)(async_ctxt->max_queued >> 20),
+        (unsigned long long)async_ctxt->waits.load(),
+        async_ctxt->wait_usec / 1000000.0);
+  }
+
+  delete async_ctxt;
+  my_free(ctxt->root);
+  my_free(ctxt);
+}
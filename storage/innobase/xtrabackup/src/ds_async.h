@@ -0,0 +1,42 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+Asynchronous datasink for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef DS_ASYNC_H
+#define DS_ASYNC_H
+
+#include "datasink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern datasink_t datasink_async;
+
+/* Change the maximum number of bytes queued per file */
+void ds_async_set_size(ds_ctxt_t *ctxt, size_t size);
+
+/* Fail writes waiting for room for more than the given number of seconds */
+void ds_async_set_max_wait(ds_ctxt_t *ctxt, uint seconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
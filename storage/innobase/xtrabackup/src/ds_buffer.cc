@@ -48,11 +48,16 @@ static ds_ctxt_t *buffer_init(const char *root);
 static ds_file_t *buffer_open(ds_ctxt_t *ctxt, const char *path,
                               MY_STAT *mystat);
 static int buffer_write(ds_file_t *file, const void *buf, size_t len);
+static int buffer_write_lease(ds_file_t *file, ds_lease_t *lease);
 static int buffer_close(ds_file_t *file);
 static void buffer_deinit(ds_ctxt_t *ctxt);
+static int buffer_flush(ds_file_t *file);
 
-datasink_t datasink_buffer = {&buffer_init, &buffer_open,  &buffer_write,
-                              nullptr,      &buffer_close, &buffer_deinit};
+datasink_t datasink_buffer = {&buffer_init,  &buffer_open,
+                              &buffer_write, nullptr,
+                              nullptr,       &buffer_write_lease,
+                              &buffer_close, &buffer_deinit,
+                              &buffer_flush};
 
 /* Change the default buffer size */
 void ds_buffer_set_size(ds_ctxt_t *ctxt, size_t size) {
@@ -152,6 +157,46 @@ static int buffer_write(ds_file_t *file, const void *buf, size_t len) {
   return 0;
 }
 
+static int buffer_write_lease(ds_file_t *file, ds_lease_t *lease) {
+  ds_buffer_file_t *buffer_file;
+  int ret = 0;
+
+  buffer_file = (ds_buffer_file_t *)file->ptr;
+
+  if (!ds_is_lease_supported(buffer_file->dst_file)) {
+    for (int i = 0; i < lease->iovcnt && ret == 0; i++) {
+      ret = buffer_write(file, lease->iov[i].iov_base, lease->iov[i].iov_len);
+    }
+    ds_lease_release(lease);
+    return ret;
+  }
+
+  /* The destination groups leased buffers without copying them, pass the
+  lease on after the bytes buffered so far */
+  if (buffer_file->pos > 0) {
+    if (ds_write(buffer_file->dst_file, buffer_file->buf, buffer_file->pos)) {
+      ds_lease_release(lease);
+      return 1;
+    }
+    buffer_file->pos = 0;
+  }
+
+  return ds_write_lease(buffer_file->dst_file, lease);
+}
+
+static int buffer_flush(ds_file_t *file) {
+  ds_buffer_file_t *buffer_file = (ds_buffer_file_t *)file->ptr;
+
+  if (buffer_file->pos > 0) {
+    if (ds_write(buffer_file->dst_file, buffer_file->buf, buffer_file->pos)) {
+      return 1;
+    }
+    buffer_file->pos = 0;
+  }
+
+  return ds_flush(buffer_file->dst_file);
+}
+
 static int buffer_close(ds_file_t *file) {
   ds_buffer_file_t *buffer_file;
   int ret;
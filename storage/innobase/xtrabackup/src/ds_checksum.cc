@@ -0,0 +1,255 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Checksum datasink for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+/* The data is checksummed as it is passed on, after compression and
+encryption, so that the checksums are those of the files of the backup as
+they are stored. Holes of sparse files count as zeroes. The file of the
+checksums itself is not checksummed. */
+
+#include <my_base.h>
+#include <mysql/service_mysql_alloc.h>
+#include <algorithm>
+#include <string>
+#include "common.h"
+#include "datasink.h"
+#include "ds_checksum.h"
+#include "msg.h"
+
+using xb::file_checksums::File_checksum;
+using xb::file_checksums::Registry;
+
+typedef struct {
+  Registry registry;
+} ds_checksum_ctxt_t;
+
+typedef struct {
+  ds_checksum_ctxt_t *checksum_ctxt;
+  ds_file_t *dest_file;
+  std::string path;
+  /* nullptr for the file of the checksums */
+  File_checksum *checksum;
+  uint64_t offset;
+} ds_checksum_file_t;
+
+static ds_ctxt_t *checksum_init(const char *root);
+static ds_file_t *checksum_open(ds_ctxt_t *ctxt, const char *path,
+                                MY_STAT *mystat);
+static int checksum_write(ds_file_t *file, const void *buf, size_t len);
+static int checksum_write_sparse(ds_file_t *file, const void *buf, size_t len,
+                                 size_t sparse_map_size,
+                                 const ds_sparse_chunk_t *sparse_map,
+                                 bool punch_hole_supported);
+static int checksum_writev(ds_file_t *file, const struct iovec *iov,
+                           int iovcnt);
+static int checksum_write_lease(ds_file_t *file, ds_lease_t *lease);
+static int checksum_close(ds_file_t *file);
+static void checksum_deinit(ds_ctxt_t *ctxt);
+static int checksum_flush(ds_file_t *file);
+
+datasink_t datasink_checksum = {
+    &checksum_init,   &checksum_open,
+    &checksum_write,  &checksum_write_sparse,
+    &checksum_writev, &checksum_write_lease,
+    &checksum_close,  &checksum_deinit,
+    &checksum_flush};
+
+xb::file_checksums::Entries ds_checksum_entries(ds_ctxt_t *ctxt) {
+  ds_checksum_ctxt_t *checksum_ctxt = (ds_checksum_ctxt_t *)ctxt->ptr;
+
+  return checksum_ctxt->registry.entries();
+}
+
+static ds_ctxt_t *checksum_init(const char *root) {
+  ds_ctxt_t *ctxt;
+
+  ctxt = static_cast<ds_ctxt_t *>(my_malloc(
+      PSI_NOT_INSTRUMENTED, sizeof(ds_ctxt_t), MYF(MY_FAE | MY_ZEROFILL)));
+
+  ctxt->ptr = new ds_checksum_ctxt_t;
+  ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
+
+  return ctxt;
+}
+
+static ds_file_t *checksum_open(ds_ctxt_t *ctxt, const char *path,
+                                MY_STAT *mystat) {
+  ds_checksum_ctxt_t *checksum_ctxt = (ds_checksum_ctxt_t *)ctxt->ptr;
+  ds_checksum_file_t *checksum_file;
+  ds_file_t *dest_file;
+  ds_file_t *file;
+
+  xb_a(ctxt->pipe_ctxt != NULL);
+
+  dest_file = ds_open(ctxt->pipe_ctxt, path, mystat);
+  if (dest_file == NULL) {
+    return NULL;
+  }
+
+  checksum_file = new ds_checksum_file_t;
+  checksum_file->checksum_ctxt = checksum_ctxt;
+  checksum_file->dest_file = dest_file;
+  checksum_file->path = xb::file_checksums::normalize(path);
+  checksum_file->checksum = NULL;
+  checksum_file->offset = 0;
+
+  if (checksum_file->path != xb::file_checksums::FILENAME) {
+    /* a file written again replaces its previous checksum */
+    checksum_ctxt->registry.reset(checksum_file->path);
+    checksum_file->checksum = new File_checksum;
+  }
+
+  file = (ds_file_t *)my_malloc(PSI_NOT_INSTRUMENTED, sizeof(ds_file_t),
+                                MYF(MY_FAE | MY_ZEROFILL));
+  file->ptr = checksum_file;
+  file->path = dest_file->path;
+
+  return file;
+}
+
+/** Add data to the checksum of a file.
+@param[in]  checksum_file  checksum file
+@param[in]  iov            data
+@param[in]  iovcnt         number of buffers in iov */
+static void checksum_update(ds_checksum_file_t *checksum_file,
+                            const struct iovec *iov, int iovcnt) {
+  for (int i = 0; i < iovcnt; i++) {
+    if (checksum_file->checksum != NULL) {
+      checksum_file->checksum->update(checksum_file->offset, iov[i].iov_base,
+                                      iov[i].iov_len);
+    }
+    checksum_file->offset += iov[i].iov_len;
+  }
+}
+
+static int checksum_writev(ds_file_t *file, const struct iovec *iov,
+                           int iovcnt) {
+  ds_checksum_file_t *checksum_file = (ds_checksum_file_t *)file->ptr;
+
+  checksum_update(checksum_file, iov, iovcnt);
+
+  return ds_writev(checksum_file->dest_file, iov, iovcnt);
+}
+
+static int checksum_write(ds_file_t *file, const void *buf, size_t len) {
+  struct iovec iov;
+
+  iov.iov_base = const_cast<void *>(buf);
+  iov.iov_len = len;
+
+  return checksum_writev(file, &iov, 1);
+}
+
+/** Write sparse data to a destination without sparse file support, with the
+holes written as zeroes.
+@return 0 on success, 1 on error */
+static int checksum_write_holes(ds_file_t *file, const char *buf,
+                                size_t sparse_map_size,
+                                const ds_sparse_chunk_t *sparse_map) {
+  static const char zeroes[64 * 1024] = {};
+
+  for (size_t i = 0; i < sparse_map_size; i++) {
+    for (size_t skip = sparse_map[i].skip; skip > 0;) {
+      const size_t n = std::min(skip, sizeof(zeroes));
+      if (ds_write(file, zeroes, n)) {
+        return 1;
+      }
+      skip -= n;
+    }
+    if (sparse_map[i].len > 0 && ds_write(file, buf, sparse_map[i].len)) {
+      return 1;
+    }
+    buf += sparse_map[i].len;
+  }
+
+  return 0;
+}
+
+static int checksum_write_sparse(ds_file_t *file, const void *buf, size_t len,
+                                 size_t sparse_map_size,
+                                 const ds_sparse_chunk_t *sparse_map,
+                                 bool punch_hole_supported) {
+  ds_checksum_file_t *checksum_file = (ds_checksum_file_t *)file->ptr;
+  const char *ptr = static_cast<const char *>(buf);
+
+  for (size_t i = 0; i < sparse_map_size; i++) {
+    if (checksum_file->checksum != NULL) {
+      checksum_file->checksum->update_zeros(checksum_file->offset,
+                                            sparse_map[i].skip);
+      checksum_file->checksum->update(
+          checksum_file->offset + sparse_map[i].skip, ptr, sparse_map[i].len);
+    }
+    checksum_file->offset += sparse_map[i].skip + sparse_map[i].len;
+    ptr += sparse_map[i].len;
+  }
+
+  if (!ds_is_sparse_write_supported(checksum_file->dest_file)) {
+    return checksum_write_holes(checksum_file->dest_file,
+                                static_cast<const char *>(buf),
+                                sparse_map_size, sparse_map);
+  }
+
+  return ds_write_sparse(checksum_file->dest_file, buf, len, sparse_map_size,
+                         sparse_map, punch_hole_supported);
+}
+
+/* The data of the lease is checksummed before the lease is handed over,
+the next datasink may release it at any time after that */
+static int checksum_write_lease(ds_file_t *file, ds_lease_t *lease) {
+  ds_checksum_file_t *checksum_file = (ds_checksum_file_t *)file->ptr;
+
+  checksum_update(checksum_file, lease->iov, lease->iovcnt);
+
+  return ds_write_lease(checksum_file->dest_file, lease);
+}
+
+static int checksum_flush(ds_file_t *file) {
+  ds_checksum_file_t *checksum_file = (ds_checksum_file_t *)file->ptr;
+
+  return ds_flush(checksum_file->dest_file);
+}
+
+static int checksum_close(ds_file_t *file) {
+  ds_checksum_file_t *checksum_file = (ds_checksum_file_t *)file->ptr;
+  int ret;
+
+  ret = ds_close(checksum_file->dest_file);
+
+  /* only the files written completely are recorded */
+  if (checksum_file->checksum != NULL) {
+    if (ret == 0) {
+      checksum_file->checksum_ctxt->registry.merge(checksum_file->path,
+                                                   *checksum_file->checksum);
+    }
+    delete checksum_file->checksum;
+  }
+
+  delete checksum_file;
+  my_free(file);
+
+  return ret;
+}
+
+static void checksum_deinit(ds_ctxt_t *ctxt) {
+  ds_checksum_ctxt_t *checksum_ctxt = (ds_checksum_ctxt_t *)ctxt->ptr;
+
+  delete checksum_ctxt;
+  my_free(ctxt->root);
+  my_free(ctxt);
+}
@@ -0,0 +1,35 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Checksum datasink for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef DS_CHECKSUM_H
+#define DS_CHECKSUM_H
+
+#include "datasink.h"
+#include "file_checksums.h"
+
+/* Computes the CRC-32C of the data of every file passed to the next datasink,
+for --file-checksums. Only linked into xtrabackup, so it is created with
+ds_create_from(). */
+extern datasink_t datasink_checksum;
+
+/* Get the checksums of the files closed so far */
+xb::file_checksums::Entries ds_checksum_entries(ds_ctxt_t *ctxt);
+
+#endif
@@ -25,16 +25,24 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <mysql_version.h>
 #include <quicklz.h>
 #include <zlib.h>
+#include <chrono>
 #include "common.h"
+#include "compress_sample.h"
 #include "datasink.h"
+#include "ds_compress.h"
+#include "memory_budget.h"
 #include "msg.h"
 #include "thread_pool.h"
+#include "trace.h"
 
 #define COMPRESS_CHUNK_SIZE ((size_t)(xtrabackup_compress_chunk_size))
 #define MY_QLZ_COMPRESS_OVERHEAD 400
+/* Chunks of a file in flight, enough to keep every compression thread busy
+while the caller produces more data */
+#define COMPRESS_WINDOW ((size_t)(2 * xtrabackup_compress_threads))
 
 typedef struct {
-  const char *from;
+  char *from;
   size_t from_len;
   char *to;
   size_t to_len;
@@ -44,23 +52,29 @@ typedef struct {
 } comp_thread_ctxt_t;
 
 typedef struct {
-  Thread_pool *thread_pool;
+  Numa_thread_pool *thread_pool;
 } ds_compress_ctxt_t;
 
 typedef struct {
   ds_file_t *dest_file;
   ds_compress_ctxt_t *comp_ctxt;
   size_t bytes_processed;
-  char *comp_buf;
-  size_t comp_buf_size;
+  /* ring of COMPRESS_WINDOW chunks: n_busy chunks in flight starting at head,
+  followed by the chunk being filled */
   std::vector<std::future<void>> tasks;
   std::vector<comp_thread_ctxt_t> contexts;
+  size_t head;
+  size_t n_busy;
+  bool error;
 } ds_compress_file_t;
 
+std::atomic<uint64_t> ds_compress_chunks_in_flight{0};
+
 /* Compression options */
 extern char *xtrabackup_compress_alg;
 extern uint xtrabackup_compress_threads;
 extern ulonglong xtrabackup_compress_chunk_size;
+extern bool xtrabackup_compress_skip_incompressible;
 
 static ds_ctxt_t *compress_init(const char *root);
 static ds_file_t *compress_open(ds_ctxt_t *ctxt, const char *path,
@@ -71,14 +85,42 @@ static void compress_deinit(ds_ctxt_t *ctxt);
 
 datasink_t datasink_compress = {&compress_init,  &compress_open,
                                 &compress_write, nullptr,
-                                &compress_close, &compress_deinit};
+                                nullptr,         nullptr,
+                                &compress_close, &compress_deinit, nullptr};
 
 static inline int write_uint32_le(ds_file_t *file, uint32_t n);
 static inline int write_uint64_le(ds_file_t *file, ulonglong n);
 
+/** Store a chunk in a quicklz block without compressing it, the same way
+qlz_compress() does when compression does not pay off.
+@param[in]   from      chunk data
+@param[out]  to        block buffer, at least from_len + 9 bytes
+@param[in]   from_len  chunk length
+@return block length */
+static size_t qlz_store(const char *from, char *to, size_t from_len) {
+  static_assert(QLZ_STREAMING_BUFFER == 0, "quicklz streaming mode is off");
+  const size_t base = (from_len < 216) ? 3 : 9;
+  const size_t to_len = base + from_len;
+
+  /* header flags 01SSLLHC: streaming buffer size, compression level,
+  header length and the compressed bit */
+  to[0] = (1 << 6) | (QLZ_COMPRESSION_LEVEL << 2) | (base == 9 ? 2 : 0);
+  if (base == 3) {
+    to[1] = (char)to_len;
+    to[2] = (char)from_len;
+  } else {
+    int4store(to + 1, to_len);
+    int4store(to + 5, from_len);
+  }
+  memcpy(to + base, from, from_len);
+
+  return to_len;
+}
+
 static ds_ctxt_t *compress_init(const char *root) {
   ds_compress_ctxt_t *compress_ctxt = new ds_compress_ctxt_t;
-  compress_ctxt->thread_pool = new Thread_pool(xtrabackup_compress_threads);
+  compress_ctxt->thread_pool =
+      new Numa_thread_pool(xtrabackup_compress_threads, "compress");
 
   ds_ctxt_t *ctxt = new ds_ctxt_t;
   ctxt->ptr = compress_ctxt;
@@ -107,8 +149,11 @@ static ds_file_t *compress_open(ds_ctxt_t *ctxt, const char *path,
   comp_file->dest_file = dest_file;
   comp_file->comp_ctxt = comp_ctxt;
   comp_file->bytes_processed = 0;
-  comp_file->comp_buf = nullptr;
-  comp_file->comp_buf_size = 0;
+  comp_file->tasks.resize(COMPRESS_WINDOW);
+  comp_file->contexts.resize(COMPRESS_WINDOW);
+  comp_file->head = 0;
+  comp_file->n_busy = 0;
+  comp_file->error = false;
 
   /* Write the qpress archive header */
   if (ds_write(dest_file, "qpress10", 8) ||
@@ -138,99 +183,162 @@ static ds_file_t *compress_open(ds_ctxt_t *ctxt, const char *path,
   return file;
 }
 
-static int compress_write(ds_file_t *file, const void *buf, size_t len) {
-  ds_compress_file_t *comp_file = (ds_compress_file_t *)file->ptr;
-  ds_compress_ctxt_t *comp_ctxt = comp_file->comp_ctxt;
-  ds_file_t *dest_file = comp_file->dest_file;
-
-  /* make sure we have enough memory for compression */
-  const size_t comp_size = COMPRESS_CHUNK_SIZE + MY_QLZ_COMPRESS_OVERHEAD;
-  const size_t n_chunks =
-      (len / COMPRESS_CHUNK_SIZE * COMPRESS_CHUNK_SIZE == len)
-          ? (len / COMPRESS_CHUNK_SIZE)
-          : (len / COMPRESS_CHUNK_SIZE + 1);
-  const size_t comp_buf_size = comp_size * n_chunks;
-  if (comp_file->comp_buf_size < comp_buf_size) {
-    comp_file->comp_buf = static_cast<char *>(
-        my_realloc(PSI_NOT_INSTRUMENTED, comp_file->comp_buf, comp_buf_size,
-                   MYF(MY_FAE | MY_ALLOW_ZERO_PTR)));
+/** Write the compressed block of the oldest chunk in flight, waiting for its
+compression to finish. After an error the chunks are only reaped.
+@param[in,out]  comp_file  compressed file
+@return 0 on success, 1 on error */
+static int compress_reap(ds_compress_file_t *comp_file) {
+  const size_t window = comp_file->contexts.size();
+  auto &thd = comp_file->contexts[comp_file->head];
+
+  {
+    xb::wait_state::Scope wait(xb::wait_state::POOL_WAIT);
+    comp_file->tasks[comp_file->head].wait();
   }
+  comp_file->head = (comp_file->head + 1) % window;
+  comp_file->n_busy--;
 
-  /* parallel compress using trhead pool */
-  if (comp_file->tasks.size() < n_chunks) {
-    comp_file->tasks.resize(n_chunks);
-  }
-  if (comp_file->contexts.size() < n_chunks) {
-    comp_file->contexts.resize(n_chunks);
+  const size_t from_len = thd.from_len;
+  thd.from_len = 0;
+
+  if (comp_file->error) {
+    return 1;
   }
 
-  for (size_t i = 0; i < n_chunks; i++) {
-    size_t chunk_len =
-        std::min(len - i * COMPRESS_CHUNK_SIZE, COMPRESS_CHUNK_SIZE);
-    auto &thd = comp_file->contexts[i];
-    thd.from = ((const char *)buf) + COMPRESS_CHUNK_SIZE * i;
-    thd.from_len = chunk_len;
-    thd.to_size = comp_size;
-    thd.to = comp_file->comp_buf + comp_size * i;
-
-    comp_file->tasks[i] =
-        comp_ctxt->thread_pool->add_task([&thd](size_t thread_id) {
-
-          thd.to_len = qlz_compress(thd.from, thd.to, thd.from_len, &thd.state);
-
-          /* qpress uses 0x00010000 as the initial value, but its own
-          Adler-32 implementation treats the value differently:
-            1. higher order bits are the sum of all bytes in the sequence
-            2. lower order bits are the sum of resulting values at every
-               step.
-          So it's the other way around as compared to zlib's adler32().
-          That's why  0x00000001 is being passed here to be compatible
-          with qpress implementation. */
-
-          thd.adler = adler32(0x00000001, (uchar *)thd.to, thd.to_len);
-        });
+  if (thd.to_len > 0) {
+    /* block header: marker, offset and checksum */
+    uchar header[8 + 8 + 4];
+    memcpy(header, "NEWBNEWB", 8);
+    int8store(header + 8, comp_file->bytes_processed);
+
+    comp_file->bytes_processed += from_len;
+
+    int4store(header + 16, thd.adler);
+
+    /* the header and the compressed block leave in a single write */
+    const struct iovec iov[] = {{header, sizeof(header)},
+                                {thd.to, thd.to_len}};
+    if (ds_writev(comp_file->dest_file, iov, array_elements(iov))) {
+      msg("compress: write to the destination stream failed.\n");
+      comp_file->error = true;
+      return 1;
+    }
   }
 
-  bool error = false;
+  comp_file->bytes_processed += from_len;
 
-  /* write compressed blocks */
-  for (size_t i = 0; i < n_chunks; i++) {
-    const auto &thd = comp_file->contexts[i];
+  return 0;
+}
 
-    /* reap */
-    comp_file->tasks[i].wait();
+/** Start compressing the chunk being filled and write the blocks of the
+chunks that are done, in order. Only waits for a compression to finish when
+the whole window is in flight.
+@param[in,out]  comp_file  compressed file
+@return 0 on success, 1 on error */
+static int compress_submit(ds_compress_file_t *comp_file) {
+  const size_t window = comp_file->contexts.size();
+  const size_t i = (comp_file->head + comp_file->n_busy) % window;
+  auto &thd = comp_file->contexts[i];
+
+  ds_compress_chunks_in_flight++;
+  comp_file->tasks[i] =
+      comp_file->comp_ctxt->thread_pool->add_task([&thd](size_t thread_id) {
+        xb::trace::Span span("compress", thd.from_len);
+        if (xtrabackup_compress_skip_incompressible &&
+            compress_is_incompressible(thd.from, thd.from_len)) {
+          thd.to_len = qlz_store(thd.from, thd.to, thd.from_len);
+        } else {
+          thd.to_len =
+              qlz_compress(thd.from, thd.to, thd.from_len, &thd.state);
+        }
+
+        /* qpress uses 0x00010000 as the initial value, but its own
+        Adler-32 implementation treats the value differently:
+          1. higher order bits are the sum of all bytes in the sequence
+          2. lower order bits are the sum of resulting values at every
+             step.
+        So it's the other way around as compared to zlib's adler32().
+        That's why  0x00000001 is being passed here to be compatible
+        with qpress implementation. */
+
+        thd.adler = adler32(0x00000001, (uchar *)thd.to, thd.to_len);
+        ds_compress_chunks_in_flight--;
+      });
+  comp_file->n_busy++;
+
+  while (comp_file->n_busy > 0) {
+    const auto &task = comp_file->tasks[comp_file->head];
+    if (comp_file->n_busy < window &&
+        task.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      break;
+    }
+    if (compress_reap(comp_file)) {
+      return 1;
+    }
+  }
 
-    if (error) continue;
+  return 0;
+}
 
-    if (thd.to_len > 0) {
-      if (ds_write(dest_file, "NEWBNEWB", 8) ||
-          write_uint64_le(dest_file, comp_file->bytes_processed)) {
-        error = true;
-        goto err;
-      }
+/* The data is collected in chunks of COMPRESS_CHUNK_SIZE, each compressed by
+the thread pool as soon as it is full. Up to COMPRESS_WINDOW chunks of a file
+are in flight across writes, so the compression threads keep working while
+the caller reads the next data. The blocks are written in order. */
+static int compress_write(ds_file_t *file, const void *buf, size_t len) {
+  ds_compress_file_t *comp_file = (ds_compress_file_t *)file->ptr;
+  const size_t window = comp_file->contexts.size();
+  const char *ptr = static_cast<const char *>(buf);
 
-      comp_file->bytes_processed += thd.from_len;
+  if (comp_file->error) {
+    return 1;
+  }
 
-      if (write_uint32_le(dest_file, thd.adler) ||
-          ds_write(dest_file, thd.to, thd.to_len)) {
-        error = true;
-        goto err;
-      }
+  while (len > 0) {
+    auto &thd =
+        comp_file->contexts[(comp_file->head + comp_file->n_busy) % window];
+
+    /* chunk buffers are allocated on first use, small files need few */
+    if (thd.from == nullptr) {
+      thd.from = static_cast<char *>(
+          my_malloc(PSI_NOT_INSTRUMENTED, COMPRESS_CHUNK_SIZE, MYF(MY_FAE)));
+      thd.to_size = COMPRESS_CHUNK_SIZE + MY_QLZ_COMPRESS_OVERHEAD;
+      thd.to = static_cast<char *>(
+          my_malloc(PSI_NOT_INSTRUMENTED, thd.to_size, MYF(MY_FAE)));
+      xb::memory::charge(xb::memory::COMPRESS,
+                         COMPRESS_CHUNK_SIZE + thd.to_size);
     }
 
-    comp_file->bytes_processed += thd.from_len;
+    const size_t n = std::min(len, COMPRESS_CHUNK_SIZE - thd.from_len);
+    memcpy(thd.from + thd.from_len, ptr, n);
+    thd.from_len += n;
+    ptr += n;
+    len -= n;
+
+    if (thd.from_len == COMPRESS_CHUNK_SIZE && compress_submit(comp_file)) {
+      return 1;
+    }
   }
 
   return 0;
-
-err:
-  msg("compress: write to the destination stream failed.\n");
-  return 1;
 }
 
 static int compress_close(ds_file_t *file) {
   ds_compress_file_t *comp_file = (ds_compress_file_t *)file->ptr;
   ds_file_t *dest_file = comp_file->dest_file;
+  const size_t window = comp_file->contexts.size();
+  int rc = 0;
+
+  /* compress the last partial chunk and drain the window */
+  const auto &last =
+      comp_file->contexts[(comp_file->head + comp_file->n_busy) % window];
+  if (!comp_file->error && last.from_len > 0 && compress_submit(comp_file)) {
+    rc = 1;
+  }
+  while (comp_file->n_busy > 0) {
+    if (compress_reap(comp_file)) {
+      rc = 1;
+    }
+  }
 
   /* Write the qpress file trailer */
   ds_write(dest_file, "ENDSENDS", 8);
@@ -241,9 +349,18 @@ static int compress_close(ds_file_t *file) {
 
   write_uint64_le(dest_file, 0);
 
-  int rc = ds_close(dest_file);
+  if (ds_close(dest_file)) {
+    rc = 1;
+  }
 
-  my_free(comp_file->comp_buf);
+  for (auto &thd : comp_file->contexts) {
+    if (thd.from != nullptr) {
+      xb::memory::uncharge(xb::memory::COMPRESS,
+                           COMPRESS_CHUNK_SIZE + thd.to_size);
+    }
+    my_free(thd.from);
+    my_free(thd.to);
+  }
   delete file;
   delete comp_file;
 
@@ -21,8 +21,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #ifndef DS_COMPRESS_H
 #define DS_COMPRESS_H
 
+#include <stdint.h>
+#include <atomic>
 #include "datasink.h"
 
 extern datasink_t datasink_compress;
 
+/* Chunks queued for or being compressed by the compression threads of the
+quicklz and lz4 datasinks. zstd compresses on its own worker pool and is not
+counted. */
+extern std::atomic<uint64_t> ds_compress_chunks_in_flight;
+
 #endif
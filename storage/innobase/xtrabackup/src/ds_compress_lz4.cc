@@ -25,15 +25,23 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <mysql/service_mysql_alloc.h>
 #include <mysql_version.h>
 #include "common.h"
+#include "compress_sample.h"
 #include "datasink.h"
+#include "ds_compress.h"
+#include "ds_encrypt.h"
+#include "memory_budget.h"
 #include "msg.h"
 #include "my_xxhash.h"
 #include "thread_pool.h"
+#include "trace.h"
 
 #define COMPRESS_CHUNK_SIZE ((size_t)(xtrabackup_compress_chunk_size))
+#define COMPRESS_FRAME_SIZE ((size_t)(xtrabackup_compress_lz4_frame_size))
 
 #define LZ4F_MAGICNUMBER 0x184d2204U
 #define LZ4F_UNCOMPRESSED_BIT (1U << 31)
+#define LZ4F_HEADER_SIZE 15
+#define LZ4F_TRAILER_SIZE 8
 
 typedef struct {
   const char *from;
@@ -41,10 +49,11 @@ typedef struct {
   char *to;
   size_t to_len;
   size_t to_size;
+  size_t chunk_len; /* length of the encrypted chunk of the block */
 } comp_thread_ctxt_t;
 
 typedef struct {
-  Thread_pool *thread_pool;
+  Numa_thread_pool *thread_pool;
 } ds_compress_ctxt_t;
 
 typedef struct {
@@ -53,6 +62,11 @@ typedef struct {
   size_t bytes_processed;
   char *comp_buf;
   size_t comp_buf_size;
+  std::vector<struct iovec> iov;
+  ds_lease_pool_t *leases; /* frames are leased to the destination if
+                           not NULL */
+  bool encrypt;            /* the blocks are encrypted by the compression
+                           threads for an encrypt destination */
   std::vector<std::future<void>> tasks;
   std::vector<comp_thread_ctxt_t> contexts;
 } ds_compress_file_t;
@@ -61,6 +75,9 @@ typedef struct {
 extern char *xtrabackup_compress_alg;
 extern uint xtrabackup_compress_threads;
 extern ulonglong xtrabackup_compress_chunk_size;
+extern bool xtrabackup_compress_skip_incompressible;
+extern bool xtrabackup_compress_lz4_linked_blocks;
+extern ulonglong xtrabackup_compress_lz4_frame_size;
 
 static ds_ctxt_t *compress_init(const char *root);
 static ds_file_t *compress_open(ds_ctxt_t *ctxt, const char *path,
@@ -71,13 +88,13 @@ static void compress_deinit(ds_ctxt_t *ctxt);
 
 datasink_t datasink_compress_lz4 = {&compress_init,  &compress_open,
                                     &compress_write, nullptr,
-                                    &compress_close, &compress_deinit};
-
-static inline int write_uint32_le(ds_file_t *file, uint32_t n);
+                                    nullptr,         nullptr,
+                                    &compress_close, &compress_deinit, nullptr};
 
 static ds_ctxt_t *compress_init(const char *root) {
   ds_compress_ctxt_t *compress_ctxt = new ds_compress_ctxt_t;
-  compress_ctxt->thread_pool = new Thread_pool(xtrabackup_compress_threads);
+  compress_ctxt->thread_pool =
+      new Numa_thread_pool(xtrabackup_compress_threads, "compress");
 
   ds_ctxt_t *ctxt = new ds_ctxt_t;
   ctxt->ptr = compress_ctxt;
@@ -109,6 +126,10 @@ static ds_file_t *compress_open(ds_ctxt_t *ctxt, const char *path,
   comp_file->bytes_processed = 0;
   comp_file->comp_buf = nullptr;
   comp_file->comp_buf_size = 0;
+  comp_file->encrypt = ds_is_encrypt_file(dest_file);
+  comp_file->leases = (!comp_file->encrypt && ds_is_lease_supported(dest_file))
+                          ? ds_lease_pool_new()
+                          : nullptr;
 
   ds_file_t *file = new ds_file_t;
   file->ptr = comp_file;
@@ -117,22 +138,307 @@ static ds_file_t *compress_open(ds_ctxt_t *ctxt, const char *path,
   return file;
 }
 
+/** Check if a chunk is stored in a compressed block.
+@param[in]  thd  compression context of the chunk
+@return false if compression did not pay off or was skipped */
+static inline bool compress_block_compressed(const comp_thread_ctxt_t &thd) {
+  /* Compressing encrypted or already compressed data the length of
+  compression should exceed, in such case skip the compression */
+  return thd.to_len > 0 && thd.to_len < COMPRESS_CHUNK_SIZE;
+}
+
+/** Turn the block of a chunk into an encrypted chunk, on the compression
+thread that compressed it. The block is preceded by the room for the chunk
+header.
+@param[in,out]  thd  compression context of the chunk
+@return encrypted chunk length, 0 on error */
+static size_t compress_encrypt_block(comp_thread_ctxt_t &thd) {
+  char *block = thd.to - 4;
+  size_t block_len;
+
+  if (compress_block_compressed(thd)) {
+    int4store(block, thd.to_len);
+    block_len = 4 + thd.to_len;
+  } else {
+    int4store(block, thd.from_len | LZ4F_UNCOMPRESSED_BIT);
+    memcpy(thd.to, thd.from, thd.from_len);
+    block_len = 4 + thd.from_len;
+  }
+
+  return ds_encrypt_chunk(block - ds_encrypt_chunk_head_size(), block_len);
+}
+
+/** Get the BD byte of the frames, which gives the maximum block size.
+@return BD byte, 0 if the chunk size is too large for LZ4 frames */
+static uint8_t compress_frame_bd() {
+  uint8_t max_block_size_code = 0;
+
+  if (COMPRESS_CHUNK_SIZE <= 64 * 1024) {
+    max_block_size_code = 4;
+  } else if (COMPRESS_CHUNK_SIZE <= 256 * 1024) {
+    max_block_size_code = 5;
+  } else if (COMPRESS_CHUNK_SIZE <= 1 * 1024 * 1024) {
+    max_block_size_code = 6;
+  } else if (COMPRESS_CHUNK_SIZE <= 4 * 1024 * 1024) {
+    max_block_size_code = 7;
+  } else {
+    msg("compress: compress chunk size is too large for LZ4 compressor.\n");
+  }
+
+  return (max_block_size_code << 4);
+}
+
+/** Format an LZ4 frame header (4 bytes magic, 1 byte FLG, 1 byte BD,
+8 bytes uncompressed content size, 1 byte HC).
+@param[out]  header       LZ4F_HEADER_SIZE bytes
+@param[in]   content_len  uncompressed content size
+@param[in]   independent  false if the blocks of the frame are linked
+@param[in]   bd           BD byte */
+static void compress_frame_header(uint8_t *header, size_t content_len,
+                                  bool independent, uint8_t bd) {
+  /* Magic Number */
+  int4store(header, LZ4F_MAGICNUMBER);
+
+  /* FLG Byte */
+  const uint8_t flg =
+      (1 << 6) | /* version = 01 */
+      ((independent ? 1 : 0) << 5) | /* block independence (1 means blocks
+                                        are independent) */
+      (0 << 4) | /* block checksum (0 means no block checksum, we rely on
+                    xbstream checksums) */
+      (1 << 3) | /* content size (include uncompressed content size) */
+      (1 << 2) | /* content checksum (include checksum of uncompressed data) */
+      (0 << 1) | /* reserved */
+      (0 << 0) /* dict id */;
+  header[4] = flg;
+
+  /* BD Byte */
+  header[5] = bd;
+
+  /* uncompressed content size */
+  int8store(header + 6, content_len);
+
+  /* HC Byte */
+  header[14] = (MY_XXH32(header + 4, 10, 0) >> 8) & 0xff;
+}
+
+/** Compress a frame of linked blocks of COMPRESS_CHUNK_SIZE, every block may
+refer to the data of the blocks before it. Formats the whole frame at thd.to:
+the frame header, the blocks and the frame trailer.
+@param[in,out]  thd  compression context of the frame
+@param[in]      bd   BD byte */
+static void compress_linked_frame(comp_thread_ctxt_t &thd, uint8_t bd) {
+  LZ4_stream_t lz4_stream;
+  uint8_t *header = reinterpret_cast<uint8_t *>(thd.to);
+  char *ptr = thd.to + LZ4F_HEADER_SIZE;
+
+  LZ4_initStream(&lz4_stream, sizeof(lz4_stream));
+
+  compress_frame_header(header, thd.from_len, false, bd);
+
+  for (size_t pos = 0; pos < thd.from_len; pos += COMPRESS_CHUNK_SIZE) {
+    const char *from = thd.from + pos;
+    const size_t from_len = std::min(thd.from_len - pos, COMPRESS_CHUNK_SIZE);
+    int to_len = 0;
+
+    if (xtrabackup_compress_skip_incompressible &&
+        compress_is_incompressible(from, from_len)) {
+      /* the next block may still refer to this one, as the decompressor
+      does */
+      LZ4_loadDict(&lz4_stream, from, from_len);
+    } else {
+      to_len = LZ4_compress_fast_continue(&lz4_stream, from, ptr + 4, from_len,
+                                          LZ4_compressBound(from_len), 1);
+    }
+
+    if (to_len > 0 && static_cast<size_t>(to_len) < from_len) {
+      int4store(ptr, to_len);
+      ptr += 4 + to_len;
+    } else {
+      int4store(ptr, from_len | LZ4F_UNCOMPRESSED_BIT);
+      memcpy(ptr + 4, from, from_len);
+      ptr += 4 + from_len;
+    }
+  }
+
+  /* end mark and content checksum */
+  int4store(ptr, 0);
+  int4store(ptr + 4, MY_XXH32(thd.from, thd.from_len, 0));
+  ptr += LZ4F_TRAILER_SIZE;
+
+  thd.to_len = ptr - thd.to;
+}
+
+/** Write data as frames of linked blocks, compressed in parallel. A frame
+covers up to COMPRESS_FRAME_SIZE bytes of the data. */
+static int compress_write_linked(ds_file_t *file, const void *buf,
+                                 size_t len) {
+  ds_compress_file_t *comp_file = (ds_compress_file_t *)file->ptr;
+  ds_compress_ctxt_t *comp_ctxt = comp_file->comp_ctxt;
+  ds_file_t *dest_file = comp_file->dest_file;
+
+  const uint8_t bd = compress_frame_bd();
+  if (bd == 0) {
+    return 1;
+  }
+
+  /* every frame is followed by the room for its encrypted chunk */
+  const bool encrypt = comp_file->encrypt;
+  const size_t head = encrypt ? ds_encrypt_chunk_head_size() : 0;
+  const size_t tail = encrypt ? ds_encrypt_chunk_tail_size() : 0;
+  const size_t frame_len = std::min(len, COMPRESS_FRAME_SIZE);
+  const size_t n_frames = (len + frame_len - 1) / frame_len;
+  const size_t n_blocks =
+      (frame_len + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE;
+  const size_t frame_size =
+      head + LZ4F_HEADER_SIZE +
+      n_blocks * (4 + LZ4_compressBound(COMPRESS_CHUNK_SIZE)) +
+      LZ4F_TRAILER_SIZE + tail;
+  const size_t comp_buf_size = frame_size * n_frames;
+
+  ds_lease_t *lease = nullptr;
+  char *comp_buf;
+  struct iovec *iov;
+  if (comp_file->leases != nullptr) {
+    lease = ds_lease_get(comp_file->leases, comp_buf_size, n_frames);
+    comp_buf = lease->buf;
+    iov = lease->iov;
+  } else {
+    if (comp_file->comp_buf_size < comp_buf_size) {
+      xb::memory::charge(xb::memory::COMPRESS,
+                         comp_buf_size - comp_file->comp_buf_size);
+      comp_file->comp_buf = static_cast<char *>(
+          my_realloc(PSI_NOT_INSTRUMENTED, comp_file->comp_buf, comp_buf_size,
+                     MYF(MY_FAE | MY_ALLOW_ZERO_PTR)));
+      comp_file->comp_buf_size = comp_buf_size;
+    }
+    if (comp_file->iov.size() < n_frames) {
+      comp_file->iov.resize(n_frames);
+    }
+    comp_buf = comp_file->comp_buf;
+    iov = comp_file->iov.data();
+  }
+
+  if (comp_file->tasks.size() < n_frames) {
+    comp_file->tasks.resize(n_frames);
+  }
+  if (comp_file->contexts.size() < n_frames) {
+    comp_file->contexts.resize(n_frames);
+  }
+
+  for (size_t i = 0; i < n_frames; i++) {
+    auto &thd = comp_file->contexts[i];
+    thd.from = static_cast<const char *>(buf) + frame_len * i;
+    thd.from_len = std::min(len - i * frame_len, frame_len);
+    thd.to = comp_buf + frame_size * i + head;
+    thd.to_size = frame_size - head - tail;
+
+    ds_compress_chunks_in_flight++;
+    comp_file->tasks[i] = comp_ctxt->thread_pool->add_task(
+        [&thd, bd, head, encrypt](size_t thread_id) {
+          xb::trace::Span span("compress", thd.from_len);
+          compress_linked_frame(thd, bd);
+          if (encrypt) {
+            thd.chunk_len = ds_encrypt_chunk(thd.to - head, thd.to_len);
+          }
+          ds_compress_chunks_in_flight--;
+        });
+  }
+
+  bool error = false;
+  for (size_t i = 0; i < n_frames; i++) {
+    const auto &thd = comp_file->contexts[i];
+
+    {
+      xb::wait_state::Scope wait(xb::wait_state::POOL_WAIT);
+      comp_file->tasks[i].wait();
+    }
+
+    if (encrypt) {
+      error = error || (thd.chunk_len == 0);
+      iov[i] = {thd.to - head, thd.chunk_len};
+    } else {
+      iov[i] = {thd.to, thd.to_len};
+    }
+
+    comp_file->bytes_processed += thd.from_len;
+  }
+
+  if (error) {
+    return 1;
+  }
+
+  if (encrypt) {
+    if (ds_encrypt_write_chunks(dest_file, iov, n_frames)) goto err;
+  } else if (lease != nullptr) {
+    lease->iovcnt = n_frames;
+    if (ds_write_lease(dest_file, lease)) goto err;
+  } else if (ds_writev(dest_file, iov, n_frames)) {
+    goto err;
+  }
+
+  return 0;
+
+err:
+  msg("compress: write to the destination stream failed.\n");
+  return 1;
+}
+
 static int compress_write(ds_file_t *file, const void *buf, size_t len) {
   ds_compress_file_t *comp_file = (ds_compress_file_t *)file->ptr;
   ds_compress_ctxt_t *comp_ctxt = comp_file->comp_ctxt;
   ds_file_t *dest_file = comp_file->dest_file;
 
-  /* make sure we have enough memory for compression */
+  if (xtrabackup_compress_lz4_linked_blocks) {
+    return compress_write_linked(file, buf, len);
+  }
+
+  const uint8_t bd = compress_frame_bd();
+  if (bd == 0) {
+    return 1;
+  }
+
+  /* make sure we have enough memory for compression. The whole frame is
+  formatted in the buffer: the frame header, every block preceded by its
+  length and the frame trailer. For an encrypt destination each of them
+  is surrounded by the room for its encrypted chunk. */
+  const bool encrypt = comp_file->encrypt;
+  const size_t head = encrypt ? ds_encrypt_chunk_head_size() : 0;
+  const size_t tail = encrypt ? ds_encrypt_chunk_tail_size() : 0;
   const size_t comp_size = LZ4_compressBound(COMPRESS_CHUNK_SIZE);
   const size_t n_chunks =
       (len / COMPRESS_CHUNK_SIZE * COMPRESS_CHUNK_SIZE == len)
           ? (len / COMPRESS_CHUNK_SIZE)
           : (len / COMPRESS_CHUNK_SIZE + 1);
-  const size_t comp_buf_size = comp_size * n_chunks;
-  if (comp_file->comp_buf_size < comp_buf_size) {
-    comp_file->comp_buf = static_cast<char *>(
-        my_realloc(PSI_NOT_INSTRUMENTED, comp_file->comp_buf, comp_buf_size,
-                   MYF(MY_FAE | MY_ALLOW_ZERO_PTR)));
+  const size_t header_size = head + LZ4F_HEADER_SIZE + tail;
+  const size_t block_size = head + 4 + comp_size + tail;
+  const size_t trailer_size = head + LZ4F_TRAILER_SIZE + tail;
+  const size_t comp_buf_size =
+      header_size + block_size * n_chunks + trailer_size;
+  const int max_iovcnt = 2 * n_chunks + 2;
+
+  ds_lease_t *lease = nullptr;
+  char *comp_buf;
+  struct iovec *iov;
+  if (comp_file->leases != nullptr) {
+    /* the frame is handed over to the destination instead of being copied */
+    lease = ds_lease_get(comp_file->leases, comp_buf_size, max_iovcnt);
+    comp_buf = lease->buf;
+    iov = lease->iov;
+  } else {
+    if (comp_file->comp_buf_size < comp_buf_size) {
+      xb::memory::charge(xb::memory::COMPRESS,
+                         comp_buf_size - comp_file->comp_buf_size);
+      comp_file->comp_buf = static_cast<char *>(
+          my_realloc(PSI_NOT_INSTRUMENTED, comp_file->comp_buf, comp_buf_size,
+                     MYF(MY_FAE | MY_ALLOW_ZERO_PTR)));
+      comp_file->comp_buf_size = comp_buf_size;
+    }
+    if (comp_file->iov.size() < static_cast<size_t>(max_iovcnt)) {
+      comp_file->iov.resize(max_iovcnt);
+    }
+    comp_buf = comp_file->comp_buf;
+    iov = comp_file->iov.data();
   }
 
   /* parallel compress using trhead pool */
@@ -150,12 +456,24 @@ static int compress_write(ds_file_t *file, const void *buf, size_t len) {
     thd.from = ((const char *)buf) + COMPRESS_CHUNK_SIZE * i;
     thd.from_len = chunk_len;
     thd.to_size = comp_size;
-    thd.to = comp_file->comp_buf + comp_size * i;
+    thd.to = comp_buf + header_size + block_size * i + head + 4;
 
+    ds_compress_chunks_in_flight++;
     comp_file->tasks[i] =
-        comp_ctxt->thread_pool->add_task([&thd](size_t thread_id) {
-          thd.to_len =
-              LZ4_compress_default(thd.from, thd.to, thd.from_len, thd.to_size);
+        comp_ctxt->thread_pool->add_task([&thd, encrypt](size_t thread_id) {
+          xb::trace::Span span("compress", thd.from_len);
+          /* incompressible chunks are stored as uncompressed blocks */
+          if (xtrabackup_compress_skip_incompressible &&
+              compress_is_incompressible(thd.from, thd.from_len)) {
+            thd.to_len = 0;
+          } else {
+            thd.to_len = LZ4_compress_default(thd.from, thd.to, thd.from_len,
+                                              thd.to_size);
+          }
+          if (encrypt) {
+            thd.chunk_len = compress_encrypt_block(thd);
+          }
+          ds_compress_chunks_in_flight--;
         });
   }
 
@@ -163,107 +481,82 @@ static int compress_write(ds_file_t *file, const void *buf, size_t len) {
   const uint32_t checksum = MY_XXH32(buf, len, 0);
 
   /* write LZ4 frame */
+  uint8_t *header = reinterpret_cast<uint8_t *>(comp_buf + head);
+  compress_frame_header(header, len, true, bd);
 
-  /* Frame header (4 bytes magic, 1 byte FLG, 1 byte BD,
-     8 bytes uncompressed content size, 1 byte HC) */
-  uint8_t header[15];
-
-  /* Magic Number */
-  int4store(header, LZ4F_MAGICNUMBER);
-
-  /* FLG Byte */
-  const uint8_t flg =
-      (1 << 6) | /* version = 01 */
-      (1 << 5) | /* block independence (1 means blocks are independent) */
-      (0 << 4) | /* block checksum (0 means no block checksum, we rely on
-                    xbstream checksums) */
-      (1 << 3) | /* content size (include uncompressed content size) */
-      (1 << 2) | /* content checksum (include checksum of uncompressed data) */
-      (0 << 1) | /* reserved */
-      (0 << 0) /* dict id */;
-  header[4] = flg;
-
-  /* BD Byte (set maximum uncompressed block size to 4M) */
-  uint8_t max_block_size_code = 0;
-  if (COMPRESS_CHUNK_SIZE <= 64 * 1024) {
-    max_block_size_code = 4;
-  } else if (COMPRESS_CHUNK_SIZE <= 256 * 1024) {
-    max_block_size_code = 5;
-  } else if (COMPRESS_CHUNK_SIZE <= 1 * 1204 * 1024) {
-    max_block_size_code = 6;
-  } else if (COMPRESS_CHUNK_SIZE <= 4 * 1024 * 1024) {
-    max_block_size_code = 7;
-  } else {
-    msg("compress: compress chunk size is too large for LZ4 compressor.\n");
-    return 1;
-  }
-  const uint8_t bd = (max_block_size_code << 4);
-  header[5] = bd;
-
-  /* uncompressed content size */
-  int8store(header + 6, len);
-
-  /* HC Byte */
-  header[14] = (MY_XXH32(header + 4, 10, 0) >> 8) & 0xff;
+  /* LZ4 frame trailer: empty mark is zero-sized block, then content
+  checksum */
+  uchar *trailer = reinterpret_cast<uchar *>(comp_buf) + comp_buf_size -
+                   trailer_size + head;
+  int4store(trailer, 0);
+  int4store(trailer + 4, checksum);
 
   bool error = false;
-
-  /* write frame header */
-  if (ds_write(dest_file, header, sizeof(header))) {
-    error = true;
+  int iovcnt = 0;
+  if (encrypt) {
+    const size_t chunk_len = ds_encrypt_chunk(comp_buf, LZ4F_HEADER_SIZE);
+    error = (chunk_len == 0);
+    iov[iovcnt++] = {comp_buf, chunk_len};
+  } else {
+    iov[iovcnt++] = {header, LZ4F_HEADER_SIZE};
   }
 
-  /* write compressed blocks */
+  /* collect compressed blocks */
   for (size_t i = 0; i < n_chunks; i++) {
     const auto &thd = comp_file->contexts[i];
+    char *block = thd.to - 4;
 
     /* reap */
-    comp_file->tasks[i].wait();
-
-    if (error) continue;
-
-    /* Compressing encrypted or already compressed
-    data the length of compression should exceed, in such case
-    skip the compression */
-    if (thd.to_len > 0 && thd.to_len < COMPRESS_CHUNK_SIZE) {
-      /* compressed block length */
-      if (write_uint32_le(dest_file, thd.to_len)) {
-        error = true;
-        continue;
-      }
+    {
+      xb::wait_state::Scope wait(xb::wait_state::POOL_WAIT);
+      comp_file->tasks[i].wait();
+    }
 
-      /* block contents */
-      if (ds_write(dest_file, thd.to, thd.to_len)) {
-        error = true;
-      }
+    if (encrypt) {
+      /* encrypted by the compression thread */
+      error = error || (thd.chunk_len == 0);
+      iov[iovcnt++] = {block - head, thd.chunk_len};
+    } else if (compress_block_compressed(thd)) {
+      /* compressed block length and contents */
+      int4store(block, thd.to_len);
+      iov[iovcnt++] = {block, 4 + thd.to_len};
     } else {
       /* uncompressed block length */
-      if (write_uint32_le(dest_file, thd.from_len | LZ4F_UNCOMPRESSED_BIT)) {
-        error = true;
-        continue;
-      }
-
-      /* block contents */
-      if (ds_write(dest_file, thd.from, thd.from_len)) {
-        error = true;
-        continue;
+      int4store(block, thd.from_len | LZ4F_UNCOMPRESSED_BIT);
+
+      if (lease != nullptr) {
+        /* the input buffer is not ours to lease */
+        memcpy(thd.to, thd.from, thd.from_len);
+        iov[iovcnt++] = {block, 4 + thd.from_len};
+      } else {
+        iov[iovcnt++] = {block, 4};
+        iov[iovcnt++] = {const_cast<char *>(thd.from), thd.from_len};
       }
     }
 
     comp_file->bytes_processed += thd.from_len;
   }
 
-  if (error) goto err;
-
-  /* LZ4 frame trailer */
+  if (encrypt) {
+    const size_t chunk_len = ds_encrypt_chunk(
+        reinterpret_cast<char *>(trailer) - head, LZ4F_TRAILER_SIZE);
+    error = error || (chunk_len == 0);
+    iov[iovcnt++] = {trailer - head, chunk_len};
+  } else {
+    iov[iovcnt++] = {trailer, LZ4F_TRAILER_SIZE};
+  }
 
-  /* empty mark is zero-sized block */
-  if (write_uint32_le(dest_file, 0)) {
-    goto err;
+  if (error) {
+    return 1;
   }
 
-  /* content checksum */
-  if (write_uint32_le(dest_file, checksum)) {
+  /* the whole frame leaves in a single write */
+  if (encrypt) {
+    if (ds_encrypt_write_chunks(dest_file, iov, iovcnt)) goto err;
+  } else if (lease != nullptr) {
+    lease->iovcnt = iovcnt;
+    if (ds_write_lease(dest_file, lease)) goto err;
+  } else if (ds_writev(dest_file, iov, iovcnt)) {
     goto err;
   }
 
@@ -280,6 +573,11 @@ static int compress_close(ds_file_t *file) {
 
   int rc = ds_close(dest_file);
 
+  /* closing the destination gives all leases back */
+  if (comp_file->leases != nullptr) {
+    ds_lease_pool_free(comp_file->leases);
+  }
+  xb::memory::uncharge(xb::memory::COMPRESS, comp_file->comp_buf_size);
   my_free(comp_file->comp_buf);
   delete file;
   delete comp_file;
@@ -298,9 +596,3 @@ static void compress_deinit(ds_ctxt_t *ctxt) {
   my_free(ctxt->root);
   delete ctxt;
 }
-
-static inline int write_uint32_le(ds_file_t *file, uint32_t n) {
-  uchar tmp[4];
-  int4store(tmp, n);
-  return ds_write(file, tmp, sizeof(tmp));
-}
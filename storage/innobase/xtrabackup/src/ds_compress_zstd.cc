@@ -23,27 +23,43 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <mysql/service_mysql_alloc.h>
 #define ZSTD_STATIC_LINKING_ONLY  // Thread pool
 #include <zstd.h>
+#include <my_byteorder.h>
 #include "common.h"
+#include "compress_sample.h"
 #include "datasink.h"
+#include "memory_budget.h"
 #include "msg.h"
+#include "trace.h"
 
 typedef struct {
   ZSTD_threadPool *thread_pool;
+  uint level;
+  ZSTD_CDict *cdict; /* dictionary for the files, or nullptr */
 } ds_compress_ctxt_t;
 
 typedef struct {
   ds_file_t *dest_file;
   char *comp_buf;
   size_t comp_buf_size;
-  size_t raw_bytes;
   size_t comp_bytes;
   ZSTD_CCtx *cctx;
+  ds_lease_pool_t *leases; /* compressed data is leased to the
+                           destination if not NULL */
+  ds_lease_t *lease;       /* lease of comp_buf */
 } ds_compress_file_t;
 
 /* Compression options */
 extern char *xtrabackup_compress_alg;
 extern uint xtrabackup_compress_threads;
 extern uint xtrabackup_compress_zstd_level;
+extern bool xtrabackup_compress_skip_incompressible;
+
+#define ZSTD_RAW_FRAME_HEADER_SIZE 13
+#define ZSTD_RAW_BLOCK_HEADER_SIZE 3
+
+/* Writes are split into frames of this much data. Every frame can be decoded
+on its own, so the frames of a write are decompressed in parallel. */
+#define ZSTD_FRAME_SIZE (1024 * 1024)
 
 static ds_ctxt_t *compress_init(const char *root);
 static ds_file_t *compress_open(ds_ctxt_t *ctxt, const char *path,
@@ -51,15 +67,121 @@ static ds_file_t *compress_open(ds_ctxt_t *ctxt, const char *path,
 static int compress_write(ds_file_t *file, const void *buf, size_t len);
 static int compress_close(ds_file_t *file);
 static void compress_deinit(ds_ctxt_t *ctxt);
+static int compress_flush_file(ds_file_t *file);
+
+datasink_t datasink_compress_zstd = {
+    &compress_init,  &compress_open,   &compress_write,
+    nullptr,         nullptr,          nullptr,
+    &compress_close, &compress_deinit, &compress_flush_file};
+
+/** Get the buffer for the compressed data.
+@param[in,out]  comp_file  compressed file
+@param[in]      size       buffer size */
+static void compress_get_buf(ds_compress_file_t *comp_file, size_t size) {
+  if (comp_file->leases != nullptr) {
+    comp_file->lease = ds_lease_get(comp_file->leases, size, 1);
+    comp_file->comp_buf = comp_file->lease->buf;
+  } else if (comp_file->comp_buf_size < size) {
+    xb::memory::charge(xb::memory::COMPRESS, size - comp_file->comp_buf_size);
+    comp_file->comp_buf = static_cast<char *>(
+        my_realloc(PSI_NOT_INSTRUMENTED, comp_file->comp_buf, size,
+                   MYF(MY_FAE | MY_ALLOW_ZERO_PTR)));
+    comp_file->comp_buf_size = size;
+  }
+}
+
+/** Write the compressed data collected in the buffer. A leased buffer is
+handed over to the destination and must be replaced with compress_get_buf()
+before compressing more data.
+@param[in,out]  comp_file  compressed file
+@return 0 on success, 1 on error */
+static int compress_flush(ds_compress_file_t *comp_file) {
+  if (comp_file->lease == nullptr) {
+    return ds_write(comp_file->dest_file, comp_file->comp_buf,
+                    comp_file->comp_bytes);
+  }
+
+  ds_lease_t *lease = comp_file->lease;
+  lease->iov[0] = {lease->buf, comp_file->comp_bytes};
+  lease->iovcnt = 1;
+
+  comp_file->lease = nullptr;
+  comp_file->comp_buf = nullptr;
 
-datasink_t datasink_compress_zstd = {&compress_init,  &compress_open,
-                                     &compress_write, nullptr,
-                                     &compress_close, &compress_deinit};
+  return ds_write_lease(comp_file->dest_file, lease);
+}
+
+/** Get the maximum size of the frame of a part of a write.
+@param[in]  len  data length
+@return size of the compressed or the raw frame, whichever is larger */
+static size_t compress_frame_bound(size_t len) {
+  const size_t n_blocks =
+      std::max<size_t>(1, (len + ZSTD_BLOCKSIZE_MAX - 1) / ZSTD_BLOCKSIZE_MAX);
+
+  return std::max(ZSTD_compressBound(len),
+                  ZSTD_RAW_FRAME_HEADER_SIZE +
+                      n_blocks * ZSTD_RAW_BLOCK_HEADER_SIZE + len);
+}
+
+/** Store data in a zstd frame of raw blocks at the end of the buffer, without
+compressing it. Like the compressed frames it carries the content size, but
+no checksum, the xbstream chunks are checksummed already.
+@param[in,out]  comp_file  compressed file
+@param[in]      buf        data to store
+@param[in]      len        data length */
+static void compress_store_raw(ds_compress_file_t *comp_file, const void *buf,
+                               size_t len) {
+  const size_t n_blocks =
+      std::max<size_t>(1, (len + ZSTD_BLOCKSIZE_MAX - 1) / ZSTD_BLOCKSIZE_MAX);
+
+  uchar *const start =
+      reinterpret_cast<uchar *>(comp_file->comp_buf + comp_file->comp_bytes);
+  uchar *out = start;
+
+  /* magic number, frame header descriptor: 8 bytes of content size, single
+  segment, no checksum, no dictionary */
+  int4store(out, ZSTD_MAGICNUMBER);
+  out[4] = (3 << 6) | (1 << 5);
+  int8store(out + 5, len);
+  out += ZSTD_RAW_FRAME_HEADER_SIZE;
+
+  const uchar *from = static_cast<const uchar *>(buf);
+  for (size_t i = 0; i < n_blocks; i++) {
+    const size_t block_len = std::min<size_t>(len, ZSTD_BLOCKSIZE_MAX);
+    /* block header: last block bit, raw block type (0) and block size */
+    int3store(out, (uint32_t)(block_len << 3) | (i + 1 == n_blocks ? 1 : 0));
+    memcpy(out + ZSTD_RAW_BLOCK_HEADER_SIZE, from, block_len);
+    out += ZSTD_RAW_BLOCK_HEADER_SIZE + block_len;
+    from += block_len;
+    len -= block_len;
+  }
+
+  comp_file->comp_bytes += out - start;
+}
+
+/* Change the compression level of the files opened from now on */
+void ds_compress_zstd_set_level(ds_ctxt_t *ctxt, uint level) {
+  ds_compress_ctxt_t *comp_ctxt = (ds_compress_ctxt_t *)ctxt->ptr;
+
+  comp_ctxt->level = level;
+}
+
+/* Compress the files opened from now on with a dictionary, at the current
+compression level */
+void ds_compress_zstd_set_dict(ds_ctxt_t *ctxt, const void *dict,
+                               size_t size) {
+  ds_compress_ctxt_t *comp_ctxt = (ds_compress_ctxt_t *)ctxt->ptr;
+
+  ZSTD_freeCDict(comp_ctxt->cdict);
+  comp_ctxt->cdict = ZSTD_createCDict(dict, size, comp_ctxt->level);
+}
 
 static ds_ctxt_t *compress_init(const char *root) {
   ds_compress_ctxt_t *compress_ctxt = new ds_compress_ctxt_t;
   compress_ctxt->thread_pool =
       ZSTD_createThreadPool(xtrabackup_compress_threads);
+  compress_ctxt->level = xtrabackup_compress_zstd_level;
+  compress_ctxt->cdict = nullptr;
 
   ds_ctxt_t *ctxt = new ds_ctxt_t;
   ctxt->ptr = compress_ctxt;
@@ -89,14 +211,18 @@ static ds_file_t *compress_open(ds_ctxt_t *ctxt, const char *path,
   comp_file->dest_file = dest_file;
   comp_file->comp_buf = nullptr;
   comp_file->comp_buf_size = 0;
-  comp_file->raw_bytes = 0;
   comp_file->comp_bytes = 0;
+  comp_file->leases =
+      ds_is_lease_supported(dest_file) ? ds_lease_pool_new() : nullptr;
+  comp_file->lease = nullptr;
   ZSTD_CCtx *cctx = ZSTD_createCCtx();
   ZSTD_CCtx_refThreadPool(cctx, comp_ctxt->thread_pool);
-  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
-                         xtrabackup_compress_zstd_level);
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, comp_ctxt->level);
   ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, xtrabackup_compress_threads);
   ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+  if (comp_ctxt->cdict != nullptr) {
+    ZSTD_CCtx_refCDict(cctx, comp_ctxt->cdict);
+  }
 
   comp_file->cctx = cctx;
 
@@ -109,70 +235,64 @@ static ds_file_t *compress_open(ds_ctxt_t *ctxt, const char *path,
 
 static int compress_write(ds_file_t *file, const void *buf, size_t len) {
   ds_compress_file_t *comp_file = (ds_compress_file_t *)file->ptr;
-  ds_file_t *dest_file = comp_file->dest_file;
 
-  /* make sure we have enough memory for compression */
-  const size_t comp_size = ZSTD_CStreamOutSize();
-  size_t n_chunks = (len / comp_size * comp_size == len)
-                        ? (len / comp_size)
-                        : (len / comp_size + 1);
-  /* empty file */
-  if (n_chunks == 0) n_chunks = 1;
-  const size_t comp_buf_size = comp_size * n_chunks;
-  if (comp_file->comp_buf_size < comp_buf_size) {
-    comp_file->comp_buf = static_cast<char *>(
-        my_realloc(PSI_NOT_INSTRUMENTED, comp_file->comp_buf, comp_buf_size,
-                   MYF(MY_FAE | MY_ALLOW_ZERO_PTR)));
+  /* an empty write is an empty frame */
+  const size_t n_frames =
+      std::max<size_t>(1, (len + ZSTD_FRAME_SIZE - 1) / ZSTD_FRAME_SIZE);
+
+  size_t comp_buf_size = 0;
+  for (size_t i = 0; i < n_frames; i++) {
+    comp_buf_size += compress_frame_bound(
+        std::min<size_t>(len - i * ZSTD_FRAME_SIZE, ZSTD_FRAME_SIZE));
   }
+  compress_get_buf(comp_file, comp_buf_size);
+  comp_file->comp_bytes = 0;
 
-  size_t read_chunk_size = ZSTD_CStreamInSize();
-  if (read_chunk_size > len) read_chunk_size = len;
-  bool last_chunk = false;
-  while (1) {
-    if (len - comp_file->raw_bytes <= read_chunk_size) {
-      read_chunk_size = len - comp_file->raw_bytes;
-      last_chunk = true;
-    }
-    if (comp_file->comp_bytes > 0 &&
-        comp_file->comp_bytes + comp_size > comp_buf_size) {
-      /* buffer full */
-      if (ds_write(dest_file, comp_file->comp_buf, comp_file->comp_bytes)) {
-        goto err;
-      }
-      comp_file->comp_bytes = 0;
-    }
-    ZSTD_EndDirective const mode = last_chunk ? ZSTD_e_end : ZSTD_e_continue;
-    ZSTD_inBuffer input = {((const char *)buf + comp_file->raw_bytes),
-                           read_chunk_size, 0};
-    bool finished = false;
-    ZSTD_outBuffer output = {comp_file->comp_buf + comp_file->comp_bytes,
-                             comp_size, 0};
-    size_t const remaining =
-        ZSTD_compressStream2(comp_file->cctx, &output, &input, mode);
-
-    if (ZSTD_isError(remaining)) goto err;
-
-    comp_file->raw_bytes += input.pos;
-    comp_file->comp_bytes += output.pos;
-    finished = last_chunk ? (remaining == 0) : false;
-
-    if (finished) {
-      break;
+  const char *from = static_cast<const char *>(buf);
+  for (size_t i = 0; i < n_frames; i++) {
+    const size_t frame_len = std::min<size_t>(len, ZSTD_FRAME_SIZE);
+
+    /* incompressible data is stored in a frame of raw blocks */
+    if (xtrabackup_compress_skip_incompressible &&
+        compress_is_incompressible(from, frame_len)) {
+      compress_store_raw(comp_file, from, frame_len);
+    } else {
+      xb::trace::Span span("compress", frame_len);
+      const size_t ret = ZSTD_compress2(
+          comp_file->cctx, comp_file->comp_buf + comp_file->comp_bytes,
+          comp_buf_size - comp_file->comp_bytes, from, frame_len);
+      if (ZSTD_isError(ret)) goto err;
+      comp_file->comp_bytes += ret;
     }
+
+    from += frame_len;
+    len -= frame_len;
   }
-  /* last write */
-  if (ds_write(dest_file, comp_file->comp_buf, comp_file->comp_bytes)) {
+
+  if (compress_flush(comp_file)) {
     goto err;
   }
-  comp_file->raw_bytes = 0;
   comp_file->comp_bytes = 0;
   return 0;
 
 err:
+  if (comp_file->lease != nullptr) {
+    ds_lease_release(comp_file->lease);
+    comp_file->lease = nullptr;
+    comp_file->comp_buf = nullptr;
+  }
   msg("compress: write to the destination stream failed.\n");
   return 1;
 }
 
+/* every write is compressed and written through, only the destination may
+hold data */
+static int compress_flush_file(ds_file_t *file) {
+  ds_compress_file_t *comp_file = (ds_compress_file_t *)file->ptr;
+
+  return ds_flush(comp_file->dest_file);
+}
+
 static int compress_close(ds_file_t *file) {
   ds_compress_file_t *comp_file = (ds_compress_file_t *)file->ptr;
   ds_file_t *dest_file = comp_file->dest_file;
@@ -181,6 +301,11 @@ static int compress_close(ds_file_t *file) {
 
   int rc = ds_close(dest_file);
 
+  /* closing the destination gives all leases back */
+  if (comp_file->leases != nullptr) {
+    ds_lease_pool_free(comp_file->leases);
+  }
+  xb::memory::uncharge(xb::memory::COMPRESS, comp_file->comp_buf_size);
   my_free(comp_file->comp_buf);
   delete file;
   delete comp_file;
@@ -194,6 +319,7 @@ static void compress_deinit(ds_ctxt_t *ctxt) {
   ds_compress_ctxt_t *comp_ctxt = (ds_compress_ctxt_t *)ctxt->ptr;
 
   ZSTD_freeThreadPool(comp_ctxt->thread_pool);
+  ZSTD_freeCDict(comp_ctxt->cdict);
   delete comp_ctxt;
 
   my_free(ctxt->root);
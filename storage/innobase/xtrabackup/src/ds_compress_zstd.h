@@ -25,4 +25,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 extern datasink_t datasink_compress_zstd;
 
+/* Change the compression level of the files opened from now on, the default
+is --compress-zstd-level */
+void ds_compress_zstd_set_level(ds_ctxt_t *ctxt, uint level);
+
+/* Compress the files opened from now on with a dictionary, at the current
+compression level */
+void ds_compress_zstd_set_dict(ds_ctxt_t *ctxt, const void *dict, size_t size);
+
 #endif
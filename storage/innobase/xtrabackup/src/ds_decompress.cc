@@ -86,7 +86,9 @@ static void decompress_deinit(ds_ctxt_t *ctxt);
 
 datasink_t datasink_decompress = {&decompress_init,  &decompress_open,
                                   &decompress_write, nullptr,
-                                  &decompress_close, &decompress_deinit};
+                                  nullptr,           nullptr,
+                                  &decompress_close, &decompress_deinit,
+                                  nullptr};
 
 static int decompress_process_metadata(ds_decompress_file_t *file,
                                        const char **ptr, size_t *len);
@@ -32,8 +32,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "my_xxhash.h"
 #include "thread_pool.h"
 
+#include <mutex>
+
 #define LZ4F_MAGICNUMBER 0x184d2204U
 #define LZ4F_UNCOMPRESSED_BIT (1U << 31)
+/* Window of the blocks of a frame of linked blocks */
+#define LZ4_HISTORY_SIZE (64 * 1024)
+/* Decompressed data a batch of a file may hold per thread */
+#define LZ4_DECODE_AHEAD (16 * 1024 * 1024)
 
 class LZ4_stream {
  public:
@@ -58,6 +64,7 @@ class LZ4_stream {
     size_t header_size;
     size_t content_size;
     size_t block_max_size;
+    bool has_content_size;
     bool block_checksum;
     bool content_checksum;
     bool independent_blocks;
@@ -66,6 +73,7 @@ class LZ4_stream {
         : header_size(0),
           content_size(0),
           block_max_size(0),
+          has_content_size(false),
           block_checksum(false),
           content_checksum(false),
           independent_blocks(false),
@@ -89,10 +97,16 @@ class LZ4_stream {
 
   size_t block_max_size() const { return frame_info.block_max_size; }
 
+  bool has_content_size() const { return frame_info.has_content_size; }
+
+  size_t content_size() const { return frame_info.content_size; }
+
   uint32_t content_checksum() const { return frame_info.stored_checksum; }
 
   bool has_content_checksum() const { return frame_info.content_checksum; }
 
+  bool independent_blocks() const { return frame_info.independent_blocks; }
+
  private:
   Datasink_istream stream;
   frame_info_t frame_info;
@@ -194,6 +208,7 @@ LZ4_stream::err_t LZ4_stream::parse_frame_header() {
       return LZ4_INCOMPLETE;
     }
     frame_info.content_size = uint8korr(ptr);
+    frame_info.has_content_size = true;
     ptr += 8;
   }
 
@@ -255,17 +270,36 @@ LZ4_stream::err_t LZ4_stream::parse_block(block_info_t &block_info) {
   return LZ4_OK;
 }
 
-typedef struct {
-  const char *from;
-  size_t from_len;
-  char *to;
-  size_t to_len;
-  size_t to_size;
-  bool uncompressed;
-} decomp_lz4_thread_ctxt_t;
+/* Work of a decompression task: a single block of a frame of independent
+blocks, or consecutive blocks of a frame of linked blocks, decompressed one
+after another to to. */
+struct decomp_lz4_thread_ctxt_t {
+  std::vector<LZ4_stream::block_info_t> blocks;
+  bool linked{false};
+  /* bytes of the frame decompressed before the first block, kept right in
+  front of to */
+  size_t history_len{0};
+  char *to{nullptr};
+  size_t to_len{0};
+  /* bytes of decomp_buf reserved at to */
+  size_t to_cap{0};
+  bool content_checksum{false};
+  /* the frame ends with the blocks of this task */
+  bool frame_end{false};
+  uint32_t stored_checksum{0};
+  bool error{false};
+};
 
 typedef struct {
   Thread_pool *thread_pool;
+  /* largest decomp_buf and number of tasks of a batch */
+  size_t max_buf_size;
+  size_t max_tasks;
+  /* decomp_buf of closed files, reused by the files opened later */
+  std::mutex pool_mutex;
+  std::vector<std::pair<char *, size_t>> pool;
+  size_t pool_size;
+  size_t max_pool_size;
 } ds_decompress_lz4_ctxt_t;
 
 typedef struct {
@@ -276,6 +310,18 @@ typedef struct {
   size_t decomp_buf_size;
   std::vector<std::future<void>> tasks;
   std::vector<decomp_lz4_thread_ctxt_t> contexts;
+  /* tasks of the batch decompressed to decomp_buf */
+  size_t n_tasks;
+  size_t decomp_len;
+  /* the last task of the batch takes further blocks of its frame */
+  bool task_open;
+  /* the current frame has a task in the batch */
+  bool frame_started;
+  /* bytes at the start of decomp_buf of a frame of linked blocks going on
+  from the previous batch */
+  size_t history_len;
+  /* bytes of the current frame reserved in decomp_buf */
+  size_t frame_len;
   LZ4_stream stream;
   XXH32_state_t xxh;
 } ds_decompress_lz4_file_t;
@@ -292,11 +338,21 @@ static void decompress_deinit(ds_ctxt_t *ctxt);
 
 datasink_t datasink_decompress_lz4 = {&decompress_init,  &decompress_open,
                                       &decompress_write, nullptr,
-                                      &decompress_close, &decompress_deinit};
+                                      nullptr,           nullptr,
+                                      &decompress_close, &decompress_deinit,
+                                      nullptr};
 
 static ds_ctxt_t *decompress_init(const char *root) {
   ds_decompress_lz4_ctxt_t *decompress_ctxt = new ds_decompress_lz4_ctxt_t;
   decompress_ctxt->thread_pool = new Thread_pool(ds_decompress_lz4_threads);
+  /* with room for the history of a frame of linked blocks in front */
+  decompress_ctxt->max_buf_size =
+      LZ4_DECODE_AHEAD * ds_decompress_lz4_threads + LZ4_HISTORY_SIZE;
+  decompress_ctxt->max_tasks =
+      ds_decompress_lz4_threads * (LZ4_DECODE_AHEAD / LZ4_HISTORY_SIZE);
+  decompress_ctxt->pool_size = 0;
+  decompress_ctxt->max_pool_size =
+      LZ4_DECODE_AHEAD * ds_decompress_lz4_threads;
 
   ds_ctxt_t *ctxt = new ds_ctxt_t;
   ctxt->ptr = decompress_ctxt;
@@ -305,6 +361,50 @@ static ds_ctxt_t *decompress_init(const char *root) {
   return ctxt;
 }
 
+/** Get a decompression buffer, the smallest pooled one large enough or a
+new one.
+@param[in]   ctxt  datasink context
+@param[in]   n     minimum size
+@param[out]  len   size of the buffer
+@return buffer */
+static char *buf_acquire(ds_decompress_lz4_ctxt_t *ctxt, size_t n,
+                         size_t *len) {
+  std::lock_guard<std::mutex> guard(ctxt->pool_mutex);
+  auto best = ctxt->pool.end();
+  for (auto it = ctxt->pool.begin(); it != ctxt->pool.end(); ++it) {
+    if (it->second >= n &&
+        (best == ctxt->pool.end() || it->second < best->second)) {
+      best = it;
+    }
+  }
+  if (best != ctxt->pool.end()) {
+    char *buf = best->first;
+    *len = best->second;
+    ctxt->pool_size -= best->second;
+    *best = ctxt->pool.back();
+    ctxt->pool.pop_back();
+    return buf;
+  }
+  *len = n;
+  return static_cast<char *>(my_malloc(PSI_NOT_INSTRUMENTED, n, MYF(MY_FAE)));
+}
+
+/** Give back a decompression buffer, kept in the pool while it has room.
+Buffers smaller than the history of a frame are cheap to allocate again. */
+static void buf_release(ds_decompress_lz4_ctxt_t *ctxt, char *buf,
+                        size_t len) {
+  if (buf == nullptr) return;
+  if (len >= LZ4_HISTORY_SIZE) {
+    std::lock_guard<std::mutex> guard(ctxt->pool_mutex);
+    if (ctxt->pool_size + len <= ctxt->max_pool_size) {
+      ctxt->pool.emplace_back(buf, len);
+      ctxt->pool_size += len;
+      return;
+    }
+  }
+  my_free(buf);
+}
+
 static ds_file_t *decompress_open(ds_ctxt_t *ctxt, const char *path,
                                   MY_STAT *mystat) {
   char new_name[FN_REFLEN];
@@ -337,15 +437,21 @@ static ds_file_t *decompress_open(ds_ctxt_t *ctxt, const char *path,
   ds_decompress_lz4_file_t *decomp_file = new ds_decompress_lz4_file_t;
   decomp_file->dest_file = dest_file;
   decomp_file->decomp_ctxt = decomp_ctxt;
-  decomp_file->decomp_buf_size = 4 * 1024 * 1024 * ds_decompress_lz4_threads;
-  decomp_file->decomp_buf = (char *)my_malloc(
-      PSI_NOT_INSTRUMENTED, decomp_file->decomp_buf_size, MYF(MY_FAE));
+  /* allocated by the first batch, most files are small */
+  decomp_file->decomp_buf = nullptr;
+  decomp_file->decomp_buf_size = 0;
+  decomp_file->n_tasks = 0;
+  decomp_file->decomp_len = 0;
+  decomp_file->task_open = false;
+  decomp_file->frame_started = false;
+  decomp_file->history_len = 0;
+  decomp_file->frame_len = 0;
 
   XXH32_reset(&decomp_file->xxh, 0);
 
-  /* reserve space for as  */
-  decomp_file->contexts.resize(ds_decompress_lz4_threads * (4 * 1024 / 64));
-  decomp_file->tasks.resize(ds_decompress_lz4_threads * (4 * 1024 / 64));
+  /* a task per thread, more once a batch has used them up */
+  decomp_file->contexts.resize(ds_decompress_lz4_threads);
+  decomp_file->tasks.resize(ds_decompress_lz4_threads);
 
   file->ptr = decomp_file;
   file->path = dest_file->path;
@@ -353,9 +459,66 @@ static ds_file_t *decompress_open(ds_ctxt_t *ctxt, const char *path,
   return file;
 }
 
-static int reap_and_write(ds_decompress_lz4_file_t *file, size_t n_blocks,
-                          bool error) {
-  for (size_t i = 0; i < n_blocks; ++i) {
+/** Decompress the blocks of a task. Blocks of a frame of linked blocks may
+refer to the data decompressed right in front of them. */
+static void decompress_blocks(decomp_lz4_thread_ctxt_t &thd) {
+  thd.to_len = 0;
+
+  for (const auto &block : thd.blocks) {
+    char *to = thd.to + thd.to_len;
+    const size_t to_cap = thd.to_cap - thd.to_len;
+    int len;
+
+    if (block.uncompressed && !thd.linked) {
+      /* a single block, no need to copy it */
+      thd.to = const_cast<char *>(block.data);
+      thd.to_len = block.data_size;
+      return;
+    } else if (block.uncompressed) {
+      if (block.data_size > to_cap) {
+        thd.error = true;
+        return;
+      }
+      memcpy(to, block.data, block.data_size);
+      len = block.data_size;
+    } else if (thd.linked) {
+      const size_t dict_len =
+          std::min(thd.history_len + thd.to_len, (size_t)LZ4_HISTORY_SIZE);
+      len = LZ4_decompress_safe_usingDict(block.data, to, block.data_size,
+                                          to_cap, to - dict_len, dict_len);
+    } else {
+      len = LZ4_decompress_safe(block.data, to, block.data_size, to_cap);
+    }
+
+    if (len < 0) {
+      thd.error = true;
+      return;
+    }
+    thd.to_len += len;
+  }
+}
+
+static void submit_task(ds_decompress_lz4_file_t *file, size_t i) {
+  auto &thd = file->contexts[i];
+
+  file->tasks[i] = file->decomp_ctxt->thread_pool->add_task(
+      [&thd](size_t n) { decompress_blocks(thd); });
+}
+
+/** Write the data of the tasks of the batch in order and verify the content
+checksums of the frames ending in the batch. The tail of a frame of linked
+blocks going on in the next batch is kept at the start of decomp_buf. */
+static int reap_and_write(ds_decompress_lz4_file_t *file, bool error) {
+  /* nothing in the batch, a history is kept as it is */
+  if (file->n_tasks == 0) {
+    return error ? 1 : 0;
+  }
+
+  if (file->task_open) {
+    submit_task(file, file->n_tasks - 1);
+  }
+
+  for (size_t i = 0; i < file->n_tasks; ++i) {
     const auto &thd = file->contexts[i];
 
     /* reap */
@@ -363,27 +526,146 @@ static int reap_and_write(ds_decompress_lz4_file_t *file, size_t n_blocks,
 
     if (error) continue;
 
-    if (ds_write(file->dest_file, thd.to, thd.to_len)) {
+    if (thd.error) {
+      msg("decompress: failed to decompress an LZ4 block.\n");
       error = true;
+      continue;
     }
 
-    if (file->stream.has_content_checksum()) {
+    if (thd.to_len > 0 && ds_write(file->dest_file, thd.to, thd.to_len)) {
+      error = true;
+    }
+
+    if (thd.content_checksum) {
       MY_XXH32_update(&file->xxh, thd.to, thd.to_len);
     }
+
+    if (thd.frame_end) {
+      if (thd.content_checksum &&
+          XXH32_digest(&file->xxh) != thd.stored_checksum) {
+        msg("decompress: content checksum mismatch.\n");
+        error = true;
+      }
+      XXH32_reset(&file->xxh, 0);
+    }
   }
 
+  file->history_len = 0;
+  if (file->task_open && !error) {
+    const auto &thd = file->contexts[file->n_tasks - 1];
+    const size_t len =
+        std::min(thd.history_len + thd.to_len, (size_t)LZ4_HISTORY_SIZE);
+    memmove(file->decomp_buf, thd.to + thd.to_len - len, len);
+    file->history_len = len;
+  }
+
+  file->n_tasks = 0;
+  file->decomp_len = file->history_len;
+  file->task_open = false;
+  file->frame_started = false;
+
   return error ? 1 : 0;
 }
 
+/** Grow decomp_buf or the tasks of a file used up by its previous batch,
+doubling them up to the limits of the datasink, so that big files are
+decompressed further ahead. Called between batches only, the tasks refer to
+decomp_buf and to their contexts.
+@param[in,out]  file        file
+@param[in]      need        bytes of the next block
+@param[in]      tasks_full  the previous batch used up the tasks */
+static void grow_batch(ds_decompress_lz4_file_t *file, size_t need,
+                       bool tasks_full) {
+  ds_decompress_lz4_ctxt_t *ctxt = file->decomp_ctxt;
+
+  if (tasks_full && file->contexts.size() < ctxt->max_tasks) {
+    const size_t n = std::min(2 * file->contexts.size(), ctxt->max_tasks);
+    file->contexts.resize(n);
+    file->tasks.resize(n);
+  }
+
+  if (file->decomp_buf_size >= file->decomp_len + need) {
+    return;
+  }
+
+  /* the first batch has a block for every thread */
+  const size_t size = std::max(
+      file->decomp_len + need,
+      std::min(std::max(2 * file->decomp_buf_size,
+                        need * ds_decompress_lz4_threads),
+               ctxt->max_buf_size));
+  size_t len;
+  char *buf = buf_acquire(ctxt, size, &len);
+  if (file->history_len > 0) {
+    memcpy(buf, file->decomp_buf, file->history_len);
+  }
+  buf_release(ctxt, file->decomp_buf, file->decomp_buf_size);
+  file->decomp_buf = buf;
+  file->decomp_buf_size = len;
+}
+
+/** @return bytes of decomp_buf to reserve for a block of the current frame:
+the uncompressed size of the block, bounded by the declared content size of
+the frame */
+static size_t block_reserve(const ds_decompress_lz4_file_t *file,
+                            const LZ4_stream::block_info_t &block,
+                            bool linked) {
+  if (block.uncompressed) {
+    /* a single block is written from the stream buffer */
+    return linked ? block.data_size : 0;
+  }
+  const size_t block_max_size = file->stream.block_max_size();
+  if (!file->stream.has_content_size()) {
+    return block_max_size;
+  }
+  const size_t content_size = file->stream.content_size();
+  return content_size > file->frame_len
+             ? std::min(content_size - file->frame_len, block_max_size)
+             : 0;
+}
+
+/** Start a task for the next blocks of the current frame, writing the batch
+first when decomp_buf or the tasks are used up.
+@param[in,out]  file    file
+@param[in]      linked  true for a frame of linked blocks
+@param[in]      need    bytes of decomp_buf of the first block of the task */
+static int start_task(ds_decompress_lz4_file_t *file, bool linked,
+                      size_t need) {
+  const bool tasks_full = file->n_tasks >= file->contexts.size();
+
+  if (tasks_full || file->decomp_buf_size < file->decomp_len + need) {
+    if (reap_and_write(file, false)) {
+      return 1;
+    }
+    grow_batch(file, need, tasks_full);
+  }
+
+  auto &thd = file->contexts[file->n_tasks++];
+  thd.blocks.clear();
+  thd.linked = linked;
+  thd.history_len = linked ? file->history_len : 0;
+  thd.to = file->decomp_buf + file->decomp_len;
+  thd.to_len = 0;
+  thd.to_cap = 0;
+  thd.content_checksum = file->stream.has_content_checksum();
+  thd.frame_end = false;
+  thd.error = false;
+
+  file->history_len = 0;
+  file->task_open = linked;
+  file->frame_started = true;
+
+  return 0;
+}
+
+/* The blocks of frames of independent blocks are decompressed in parallel.
+The blocks of a frame of linked blocks depend on each other, they are
+decompressed by a single task, in parallel with the other frames. */
 static int decompress_write(ds_file_t *file, const void *buf, size_t len) {
   ds_decompress_lz4_file_t *decomp_file = (ds_decompress_lz4_file_t *)file->ptr;
-  ds_decompress_lz4_ctxt_t *decomp_ctxt = decomp_file->decomp_ctxt;
 
   decomp_file->stream.set_buffer(static_cast<const char *>(buf), len);
 
-  size_t n_blocks = 0;
-  size_t decomp_len = 0;
-
   bool error = false;
 
   while (true) {
@@ -397,57 +679,50 @@ static int decompress_write(ds_file_t *file, const void *buf, size_t len) {
     } else if (err == LZ4_stream::LZ4_INCOMPLETE) {
       break;
     } else if (err == LZ4_stream::LZ4_LAST_BLOCK) {
-      if (reap_and_write(decomp_file, n_blocks, error)) {
+      /* empty frame or no block of the frame in the batch */
+      if (!decomp_file->frame_started && start_task(decomp_file, false, 0)) {
         error = true;
         break;
       }
-      n_blocks = 0;
-      decomp_len = 0;
 
-      if (decomp_file->stream.has_content_checksum() &&
-          XXH32_digest(&decomp_file->xxh) !=
-              decomp_file->stream.content_checksum()) {
-        msg("decompress: content checksum mismatch.\n");
-        error = true;
-        break;
+      const size_t i = decomp_file->n_tasks - 1;
+      auto &thd = decomp_file->contexts[i];
+      thd.frame_end = true;
+      thd.stored_checksum = decomp_file->stream.content_checksum();
+      if (decomp_file->task_open || thd.blocks.empty()) {
+        submit_task(decomp_file, i);
       }
-      XXH32_reset(&decomp_file->xxh, 0);
+
+      decomp_file->task_open = false;
+      decomp_file->frame_started = false;
+      decomp_file->history_len = 0;
+      decomp_file->frame_len = 0;
     } else if (err == LZ4_stream::LZ4_OK) {
-      if (decomp_file->decomp_buf_size < decomp_len + block_info.data_size ||
-          n_blocks >= decomp_file->contexts.size()) {
-        /* decomp buffer is full, write the data */
-        if (reap_and_write(decomp_file, n_blocks, error)) {
-          error = true;
-          break;
-        }
-        n_blocks = 0;
-        decomp_len = 0;
+      const bool linked = !decomp_file->stream.independent_blocks();
+      const size_t need = block_reserve(decomp_file, block_info, linked);
+
+      if ((!linked || !decomp_file->task_open ||
+           decomp_file->decomp_buf_size < decomp_file->decomp_len + need) &&
+          start_task(decomp_file, linked, need)) {
+        error = true;
+        break;
       }
 
       /* decompress the block using thread pool */
-      auto &thd = decomp_file->contexts[n_blocks];
-      thd.uncompressed = block_info.uncompressed;
-      thd.from = block_info.data;
-      thd.from_len = block_info.data_size;
-      thd.to = decomp_file->decomp_buf + decomp_len;
-      thd.to_size = decomp_file->stream.block_max_size();
-      decomp_file->tasks[n_blocks] =
-          decomp_ctxt->thread_pool->add_task([&thd](size_t n) {
-            if (!thd.uncompressed) {
-              thd.to_len = LZ4_decompress_safe(thd.from, thd.to, thd.from_len,
-                                               thd.to_size);
-            } else {
-              thd.to = (char *)thd.from;
-              thd.to_len = thd.from_len;
-            }
-          });
-      decomp_len += thd.to_size;
-      ++n_blocks;
+      const size_t i = decomp_file->n_tasks - 1;
+      decomp_file->contexts[i].blocks.push_back(block_info);
+      decomp_file->contexts[i].to_cap += need;
+      decomp_file->decomp_len += need;
+      decomp_file->frame_len +=
+          block_info.uncompressed ? block_info.data_size : need;
+      if (!linked) {
+        submit_task(decomp_file, i);
+      }
     }
   }
 
   /* write remaining data */
-  if (reap_and_write(decomp_file, n_blocks, error)) {
+  if (reap_and_write(decomp_file, error)) {
     error = true;
   }
 
@@ -467,7 +742,8 @@ static int decompress_close(ds_file_t *file) {
 
   int rc = ds_close(dest_file);
 
-  my_free(comp_file->decomp_buf);
+  buf_release(comp_file->decomp_ctxt, comp_file->decomp_buf,
+              comp_file->decomp_buf_size);
 
   delete file;
   delete comp_file;
@@ -481,6 +757,9 @@ static void decompress_deinit(ds_ctxt_t *ctxt) {
   ds_decompress_lz4_ctxt_t *comp_ctxt = (ds_decompress_lz4_ctxt_t *)ctxt->ptr;
 
   delete comp_ctxt->thread_pool;
+  for (const auto &buf : comp_ctxt->pool) {
+    my_free(buf.first);
+  }
   delete comp_ctxt;
 
   my_free(ctxt->root);
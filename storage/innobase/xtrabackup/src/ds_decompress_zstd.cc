@@ -23,16 +23,27 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #define ZSTD_STATIC_LINKING_ONLY  // Advanced API - ZSTD_frameHeader
 #include <zstd.h>
 #include <zstd_errors.h>
+#include <my_dir.h>
+#include <future>
+#include <mutex>
+#include <vector>
 #include "common.h"
 #include "datasink.h"
+#include "ds_decompress_zstd.h"
 #include "ds_istream.h"
 #include "msg.h"
+#include "thread_pool.h"
 #define XXH_STATIC_LINKING_ONLY
 #include "my_xxhash.h"
 
 #define LAST_BLOCK_MASK ((1 << 1) - 1)
 #define BLOCK_TYPE_MASK ((1 << 2) - 1)
 
+/* Frames with a known content size up to this size are decompressed in
+parallel, larger ones and the frames of old backups, which do not carry the
+content size, are streamed on the calling thread */
+#define ZSTD_PARALLEL_FRAME_MAX_SIZE (4 * 1024 * 1024)
+
 class ZSTD_stream {
  public:
   enum err_t { ZSTD_OK, ZSTD_ERROR, ZSTD_INCOMPLETE };
@@ -72,14 +83,40 @@ ZSTD_stream::err_t ZSTD_stream::next_frame(size_t &frame_size) {
   return ZSTD_ERROR;
 }
 
+typedef struct {
+  const char *from;
+  size_t from_len;
+  char *to;
+  size_t to_len;
+  size_t to_size;
+  ZSTD_DCtx *dctx;
+  const ZSTD_DDict *ddict;
+  bool error;
+} decomp_zstd_thread_ctxt_t;
+
+typedef struct {
+  const char *root; /* root of the datasink context */
+  Thread_pool *thread_pool;
+  std::mutex mutex;
+  ZSTD_DDict *ddict; /* XTRABACKUP_ZSTD_DICT, loaded on first use */
+  bool ddict_loaded;
+} ds_decompress_zstd_ctxt_t;
+
 typedef struct {
   ds_file_t *dest_file;
+  ds_decompress_zstd_ctxt_t *decomp_ctxt;
   char *decomp_buf;
   size_t decomp_buf_size;
+  std::vector<std::future<void>> tasks;
+  std::vector<decomp_zstd_thread_ctxt_t> contexts;
   ZSTD_stream stream;
   ZSTD_DCtx *dctx;
+  bool has_ddict; /* dctx refers to the dictionary */
 } ds_decompress_zstd_file_t;
 
+/* User-configurable decompression options */
+uint ds_decompress_zstd_threads = 1;
+
 static ds_ctxt_t *decompress_init(const char *root);
 static ds_file_t *decompress_open(ds_ctxt_t *ctxt, const char *path,
                                   MY_STAT *mystat);
@@ -89,15 +126,66 @@ static void decompress_deinit(ds_ctxt_t *ctxt);
 
 datasink_t datasink_decompress_zstd = {&decompress_init,  &decompress_open,
                                        &decompress_write, nullptr,
-                                       &decompress_close, &decompress_deinit};
+                                       nullptr,           nullptr,
+                                       &decompress_close, &decompress_deinit,
+                                       nullptr};
 
 static ds_ctxt_t *decompress_init(const char *root) {
   ds_ctxt_t *ctxt = new ds_ctxt_t;
+  ds_decompress_zstd_ctxt_t *decomp_ctxt = new ds_decompress_zstd_ctxt_t;
+  decomp_ctxt->thread_pool = new Thread_pool(ds_decompress_zstd_threads);
+  decomp_ctxt->ddict = nullptr;
+  decomp_ctxt->ddict_loaded = false;
+
+  ctxt->ptr = decomp_ctxt;
   ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
+  decomp_ctxt->root = ctxt->root;
 
   return ctxt;
 }
 
+/** Load the dictionary of the backup from XTRABACKUP_ZSTD_DICT in the
+datasink root. It is extracted ahead of the files compressed with it.
+@param[in,out]  decomp_ctxt  decompression datasink context
+@return dictionary or nullptr if it cannot be loaded */
+static ZSTD_DDict *decompress_load_dict(
+    ds_decompress_zstd_ctxt_t *decomp_ctxt) {
+  std::lock_guard<std::mutex> lock(decomp_ctxt->mutex);
+
+  if (decomp_ctxt->ddict_loaded) {
+    return decomp_ctxt->ddict;
+  }
+  decomp_ctxt->ddict_loaded = true;
+
+  char path[FN_REFLEN];
+  MY_STAT stat_info;
+  fn_format(path, XTRABACKUP_ZSTD_DICT, decomp_ctxt->root, "",
+            MYF(MY_RELATIVE_PATH));
+
+  File fd = my_open(path, O_RDONLY, MYF(0));
+  if (fd < 0 || my_fstat(fd, &stat_info) != 0) {
+    msg("decompress: cannot open the zstd dictionary %s.\n", path);
+    if (fd >= 0) my_close(fd, MYF(0));
+    return nullptr;
+  }
+
+  const size_t size = stat_info.st_size;
+  char *buf =
+      static_cast<char *>(my_malloc(PSI_NOT_INSTRUMENTED, size, MYF(MY_FAE)));
+  if (my_read(fd, reinterpret_cast<uchar *>(buf), size,
+              MYF(MY_WME | MY_NABP)) == 0) {
+    decomp_ctxt->ddict = ZSTD_createDDict(buf, size);
+  }
+  my_close(fd, MYF(0));
+  my_free(buf);
+
+  if (decomp_ctxt->ddict == nullptr) {
+    msg("decompress: cannot load the zstd dictionary %s.\n", path);
+  }
+
+  return decomp_ctxt->ddict;
+}
+
 static ds_file_t *decompress_open(ds_ctxt_t *ctxt, const char *path,
                                   MY_STAT *mystat) {
   char new_name[FN_REFLEN];
@@ -127,22 +215,91 @@ static ds_file_t *decompress_open(ds_ctxt_t *ctxt, const char *path,
   ds_file_t *file = new ds_file_t;
   ds_decompress_zstd_file_t *decomp_file = new ds_decompress_zstd_file_t;
   decomp_file->dest_file = dest_file;
+  decomp_file->decomp_ctxt = (ds_decompress_zstd_ctxt_t *)ctxt->ptr;
   decomp_file->dctx = ZSTD_createDCtx();
+  decomp_file->has_ddict = false;
   decomp_file->decomp_buf_size = 8 * 1024 * 1024;
   decomp_file->decomp_buf = (char *)my_malloc(
       PSI_NOT_INSTRUMENTED, decomp_file->decomp_buf_size, MYF(MY_FAE));
 
+  /* two frames per thread keep the threads busy while the decompressed
+  frames are written */
+  decomp_file->contexts.resize(2 * ds_decompress_zstd_threads);
+  decomp_file->tasks.resize(2 * ds_decompress_zstd_threads);
+  for (auto &thd : decomp_file->contexts) {
+    thd.to = nullptr;
+    thd.to_size = 0;
+    thd.dctx = ZSTD_createDCtx();
+  }
+
   file->ptr = decomp_file;
   file->path = dest_file->path;
 
   return file;
 }
 
+/** Wait for the frames decompressed in parallel and write them in order.
+@param[in,out]  file      decompressed file
+@param[in]      n_frames  number of frames being decompressed
+@param[in]      error     true if the write has failed already
+@return 0 on success, 1 on error */
+static int reap_and_write(ds_decompress_zstd_file_t *file, size_t n_frames,
+                          bool error) {
+  for (size_t i = 0; i < n_frames; ++i) {
+    const auto &thd = file->contexts[i];
+
+    /* reap */
+    file->tasks[i].wait();
+
+    if (error) continue;
+
+    if (thd.error) {
+      msg("decompress: cannot decompress a zstd frame.\n");
+      error = true;
+      continue;
+    }
+
+    if (ds_write(file->dest_file, thd.to, thd.to_len)) {
+      error = true;
+    }
+  }
+
+  return error ? 1 : 0;
+}
+
+/** Decompress a frame on the calling thread, streaming the output through
+the decompression buffer.
+@param[in,out]  decomp_file  decompressed file
+@param[in]      frame        frame
+@param[in]      frame_size   frame size
+@return 0 on success, 1 on error */
+static int decompress_stream_frame(ds_decompress_zstd_file_t *decomp_file,
+                                   const char *frame, size_t frame_size) {
+  ZSTD_inBuffer input = {frame, frame_size, 0};
+
+  while (input.pos < input.size) {
+    ZSTD_outBuffer output = {decomp_file->decomp_buf,
+                             decomp_file->decomp_buf_size, 0};
+    size_t const ret =
+        ZSTD_decompressStream(decomp_file->dctx, &output, &input);
+    if (ZSTD_isError(ret) ||
+        ds_write(decomp_file->dest_file, decomp_file->decomp_buf,
+                 output.pos)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
 static int decompress_write(ds_file_t *file, const void *buf, size_t len) {
   ds_decompress_zstd_file_t *decomp_file =
       (ds_decompress_zstd_file_t *)file->ptr;
+  ds_decompress_zstd_ctxt_t *decomp_ctxt = decomp_file->decomp_ctxt;
   decomp_file->stream.set_buffer(static_cast<const char *>(buf), len);
 
+  size_t n_frames = 0;
+
   bool error = false;
 
   while (true) {
@@ -155,22 +312,79 @@ static int decompress_write(ds_file_t *file, const void *buf, size_t len) {
       break;
     } else if (err == ZSTD_stream::ZSTD_OK) {
       // found a full frame
-      ZSTD_inBuffer input = {decomp_file->stream.ptr(frame_size), frame_size,
-                             0};
-      while (input.pos < input.size) {
-        ZSTD_outBuffer output = {decomp_file->decomp_buf,
-                                 decomp_file->decomp_buf_size, 0};
-        size_t const ret =
-            ZSTD_decompressStream(decomp_file->dctx, &output, &input);
-        if (ZSTD_isError(ret)) {
+      const char *frame = decomp_file->stream.ptr(frame_size);
+
+      const ZSTD_DDict *ddict = nullptr;
+      if (ZSTD_getDictID_fromFrame(frame, frame_size) != 0) {
+        ddict = decompress_load_dict(decomp_ctxt);
+        if (ddict == nullptr) {
+          error = true;
+          break;
+        }
+      }
+
+      const auto content_size = ZSTD_getFrameContentSize(frame, frame_size);
+      if (content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+          content_size == ZSTD_CONTENTSIZE_ERROR ||
+          content_size > ZSTD_PARALLEL_FRAME_MAX_SIZE) {
+        /* keep the order of the data */
+        if (reap_and_write(decomp_file, n_frames, error)) {
+          error = true;
+          break;
+        }
+        n_frames = 0;
+
+        if (ddict != nullptr && !decomp_file->has_ddict) {
+          ZSTD_DCtx_refDDict(decomp_file->dctx, ddict);
+          decomp_file->has_ddict = true;
+        }
+        if (decompress_stream_frame(decomp_file, frame, frame_size)) {
           error = true;
           break;
         }
-        ds_write(decomp_file->dest_file, decomp_file->decomp_buf, output.pos);
+        continue;
       }
+
+      if (n_frames >= decomp_file->contexts.size()) {
+        if (reap_and_write(decomp_file, n_frames, error)) {
+          error = true;
+          break;
+        }
+        n_frames = 0;
+      }
+
+      /* decompress the frame using thread pool */
+      auto &thd = decomp_file->contexts[n_frames];
+      if (thd.to_size < content_size) {
+        thd.to_size = content_size;
+        thd.to = static_cast<char *>(
+            my_realloc(PSI_NOT_INSTRUMENTED, thd.to, thd.to_size,
+                       MYF(MY_FAE | MY_ALLOW_ZERO_PTR)));
+      }
+      thd.from = frame;
+      thd.from_len = frame_size;
+      thd.to_len = content_size;
+      thd.ddict = ddict;
+      decomp_file->tasks[n_frames] =
+          decomp_ctxt->thread_pool->add_task([&thd](size_t n) {
+            const size_t ret =
+                thd.ddict != nullptr
+                    ? ZSTD_decompress_usingDDict(thd.dctx, thd.to, thd.to_len,
+                                                 thd.from, thd.from_len,
+                                                 thd.ddict)
+                    : ZSTD_decompressDCtx(thd.dctx, thd.to, thd.to_len,
+                                          thd.from, thd.from_len);
+            thd.error = ZSTD_isError(ret) || ret != thd.to_len;
+          });
+      ++n_frames;
     }
   }
 
+  /* write remaining data */
+  if (reap_and_write(decomp_file, n_frames, error)) {
+    error = true;
+  }
+
   decomp_file->stream.reset();
   return error ? 1 : 0;
 }
@@ -188,6 +402,10 @@ static int decompress_close(ds_file_t *file) {
   int rc = ds_close(dest_file);
 
   ZSTD_freeDCtx(comp_file->dctx);
+  for (auto &thd : comp_file->contexts) {
+    ZSTD_freeDCtx(thd.dctx);
+    my_free(thd.to);
+  }
   my_free(comp_file->decomp_buf);
 
   delete file;
@@ -199,6 +417,12 @@ static int decompress_close(ds_file_t *file) {
 static void decompress_deinit(ds_ctxt_t *ctxt) {
   xb_ad(ctxt->pipe_ctxt != nullptr);
 
+  ds_decompress_zstd_ctxt_t *decomp_ctxt =
+      (ds_decompress_zstd_ctxt_t *)ctxt->ptr;
+  delete decomp_ctxt->thread_pool;
+  ZSTD_freeDDict(decomp_ctxt->ddict);
+  delete decomp_ctxt;
+
   my_free(ctxt->root);
   delete ctxt;
 }
@@ -23,6 +23,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 #include "datasink.h"
 
+/* Dictionary the zstd compressed files of a backup may refer to, stored in
+the backup root by --compress-zstd-dict-size */
+#define XTRABACKUP_ZSTD_DICT "xtrabackup_zstd_dict"
+
+extern uint ds_decompress_zstd_threads;
+
 extern datasink_t datasink_decompress_zstd;
 
 #endif
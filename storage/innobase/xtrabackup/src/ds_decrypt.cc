@@ -41,7 +41,10 @@ struct decrypt_thread_ctxt_t {
   const uchar *iv{nullptr};
   size_t iv_len{0};
   bool hash_appended{false};
+  bool gcm{false};
   gcry_cipher_hd_t cipher_handle{nullptr};
+  /* opened with the first version 4 chunk */
+  gcry_cipher_hd_t gcm_handle{nullptr};
   bool failed{false};
   decrypt_thread_ctxt_t() {
     if (xb_crypt_cipher_open(&cipher_handle)) {
@@ -59,9 +62,12 @@ struct decrypt_thread_ctxt_t {
     iv = thd.iv;
     iv_len = thd.iv_len;
     hash_appended = thd.hash_appended;
+    gcm = thd.gcm;
     cipher_handle = thd.cipher_handle;
+    gcm_handle = thd.gcm_handle;
     failed = thd.failed;
     thd.cipher_handle = nullptr;
+    thd.gcm_handle = nullptr;
     thd.to = nullptr;
     thd.to_size = 0;
     return *this;
@@ -70,6 +76,9 @@ struct decrypt_thread_ctxt_t {
     if (cipher_handle != nullptr) {
       xb_crypt_cipher_close(cipher_handle);
     }
+    if (gcm_handle != nullptr) {
+      xb_crypt_cipher_close(gcm_handle);
+    }
     my_free(to);
   }
   void resize_to(size_t n) {
@@ -121,8 +130,9 @@ static int decrypt_write(ds_file_t *file, const void *buf, size_t len);
 static int decrypt_close(ds_file_t *file);
 static void decrypt_deinit(ds_ctxt_t *ctxt);
 
-datasink_t datasink_decrypt = {&decrypt_init, &decrypt_open,  &decrypt_write,
-                               nullptr,       &decrypt_close, &decrypt_deinit};
+datasink_t datasink_decrypt = {&decrypt_init,  &decrypt_open,   &decrypt_write,
+                               nullptr,        nullptr,         nullptr,
+                               &decrypt_close, &decrypt_deinit, nullptr};
 
 static ds_ctxt_t *decrypt_init(const char *root) {
   if (xb_crypt_init(NULL)) {
@@ -205,7 +215,10 @@ xb_rcrypt_result_t Xbcrypt_stream::next_chunk(decrypt_thread_ctxt_t *thd) {
     return XB_CRYPT_READ_INCOMPLETE;
   }
 
-  if (memcmp(ptr, XB_CRYPT_CHUNK_MAGIC3, XB_CRYPT_CHUNK_MAGIC_SIZE) == 0) {
+  if (memcmp(ptr, XB_CRYPT_CHUNK_MAGIC4, XB_CRYPT_CHUNK_MAGIC_SIZE) == 0) {
+    version = 4;
+  } else if (memcmp(ptr, XB_CRYPT_CHUNK_MAGIC3, XB_CRYPT_CHUNK_MAGIC_SIZE) ==
+             0) {
     version = 3;
   } else if (memcmp(ptr, XB_CRYPT_CHUNK_MAGIC2, XB_CRYPT_CHUNK_MAGIC_SIZE) ==
              0) {
@@ -246,7 +259,13 @@ xb_rcrypt_result_t Xbcrypt_stream::next_chunk(decrypt_thread_ctxt_t *thd) {
   }
   thd->from_len = (size_t)tmp;
 
-  xb_a(thd->from_len <= thd->to_len + XB_CRYPT_HASH_LEN);
+  /* the authentication tag follows the data of version 4 chunks */
+  if (version == 4 && thd->from_len != thd->to_len + XB_CRYPT_GCM_TAG_LEN) {
+    msg("%s:%s: invalid encrypted size.\n", my_progname, __FUNCTION__);
+    return XB_CRYPT_READ_ERROR;
+  }
+
+  xb_a(version == 4 || thd->from_len <= thd->to_len + XB_CRYPT_HASH_LEN);
 
   /* checksum */
   if (!stream.read_u32_le(&checksum_exp)) {
@@ -293,9 +312,11 @@ xb_rcrypt_result_t Xbcrypt_stream::next_chunk(decrypt_thread_ctxt_t *thd) {
     }
   }
 
-  xb_ad(thd->from_len <= thd->to_len);
+  xb_ad(version == 4 || thd->from_len <= thd->to_len);
 
-  checksum = crc32_iso3309(0, thd->from, thd->from_len);
+  /* the tag of version 4 chunks is verified instead of a checksum */
+  checksum = version == 4 ? checksum_exp
+                          : crc32_iso3309(0, thd->from, thd->from_len);
   if (checksum != checksum_exp) {
     msg("%s:%s invalid checksum, expected 0x%" PRIx32 ", actual 0x%" PRIx32
         ".\n",
@@ -303,7 +324,8 @@ xb_rcrypt_result_t Xbcrypt_stream::next_chunk(decrypt_thread_ctxt_t *thd) {
     return XB_CRYPT_READ_ERROR;
   }
 
-  thd->hash_appended = version > 2;
+  thd->hash_appended = version == 3;
+  thd->gcm = version == 4;
   thd->resize_to(thd->to_len + XB_CRYPT_HASH_LEN);
 
   return XB_CRYPT_READ_CHUNK;
@@ -327,9 +349,18 @@ static int decrypt_write(ds_file_t *file, const void *buf, size_t len) {
     if (r == XB_CRYPT_READ_CHUNK) {
       crypt_file->tasks[i] =
           crypt_ctxt->thread_pool->add_task([&thd](size_t n) {
-            if (xb_crypt_decrypt(thd.cipher_handle, thd.from, thd.from_len,
-                                 thd.to, &thd.to_len, thd.iv, thd.iv_len,
-                                 thd.hash_appended)) {
+            if (thd.gcm) {
+              if ((thd.gcm_handle == nullptr &&
+                   xb_crypt_cipher_open_gcm(&thd.gcm_handle)) ||
+                  xb_crypt_decrypt_gcm(thd.gcm_handle, thd.from, thd.from_len,
+                                       thd.to, &thd.to_len, thd.iv,
+                                       thd.iv_len)) {
+                thd.failed = true;
+              }
+            } else if (xb_crypt_decrypt(thd.cipher_handle, thd.from,
+                                        thd.from_len, thd.to, &thd.to_len,
+                                        thd.iv, thd.iv_len,
+                                        thd.hash_appended)) {
               thd.failed = true;
             }
           });
@@ -23,38 +23,53 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <mysql/service_mysql_alloc.h>
 #include "common.h"
 #include "datasink.h"
+#include "ds_encrypt.h"
+#include "memory_budget.h"
 #include "msg.h"
 #include "thread_pool.h"
+#include "trace.h"
 #include "xbcrypt.h"
 #include "xbcrypt_common.h"
 
 #define XB_CRYPT_CHUNK_SIZE ((size_t)(ds_encrypt_encrypt_chunk_size))
+/* Chunks of a file in flight, enough to keep every encryption thread busy
+while the caller produces more data */
+#define ENCRYPT_WINDOW ((size_t)(2 * ds_encrypt_encrypt_threads))
+/* Length of the iv and of what follows the data in the chunks written */
+#define ENCRYPT_IV_LEN \
+  ((size_t)(ds_encrypt_gcm ? XB_CRYPT_GCM_IV_LEN : encrypt_iv_len))
+#define ENCRYPT_TAIL_LEN \
+  ((size_t)(ds_encrypt_gcm ? XB_CRYPT_GCM_TAG_LEN : XB_CRYPT_HASH_LEN))
+/* Memory of the buffers of a chunk */
+#define ENCRYPT_CHUNK_MEMORY \
+  (XB_CRYPT_CHUNK_SIZE + ENCRYPT_TAIL_LEN + ENCRYPT_IV_LEN)
+
+static uint encrypt_iv_len = 0;
 
 struct encrypt_thread_ctxt_t {
-  const uchar *from{nullptr};
   size_t from_len{0};
-  uchar *to{nullptr};
+  uchar *to{nullptr}; /* the data is encrypted in place */
   uchar *iv{nullptr};
-  size_t to_size{0};
   size_t to_len{0};
   gcry_cipher_hd_t cipher_handle{nullptr};
   bool error{false};
   encrypt_thread_ctxt_t() {
-    if (xb_crypt_cipher_open(&cipher_handle)) {
+    if (ds_encrypt_gcm ? xb_crypt_cipher_open_gcm(&cipher_handle)
+                       : xb_crypt_cipher_open(&cipher_handle)) {
       error = true;
     }
   }
   encrypt_thread_ctxt_t(const encrypt_thread_ctxt_t &thd) = delete;
   encrypt_thread_ctxt_t(encrypt_thread_ctxt_t &&thd) { *this = std::move(thd); }
   encrypt_thread_ctxt_t &operator=(encrypt_thread_ctxt_t &&thd) {
-    from = thd.from;
     from_len = thd.from_len;
     to = thd.to;
     to_len = thd.to_len;
-    to_size = thd.to_size;
     iv = thd.iv;
     cipher_handle = thd.cipher_handle;
     error = thd.error;
+    thd.to = nullptr;
+    thd.iv = nullptr;
     thd.cipher_handle = nullptr;
     return *this;
   }
@@ -62,11 +77,16 @@ struct encrypt_thread_ctxt_t {
     if (cipher_handle != nullptr) {
       xb_crypt_cipher_close(cipher_handle);
     }
+    if (to != nullptr) {
+      xb::memory::uncharge(xb::memory::ENCRYPT, ENCRYPT_CHUNK_MEMORY);
+    }
+    my_free(to);
+    my_free(iv);
   }
 };
 
 typedef struct {
-  Thread_pool *thread_pool;
+  Numa_thread_pool *thread_pool;
 } ds_encrypt_ctxt_t;
 
 typedef struct {
@@ -74,18 +94,45 @@ typedef struct {
   ds_encrypt_ctxt_t *crypt_ctxt;
   size_t bytes_processed;
   ds_file_t *dest_file;
-  char *crypt_buf;
-  size_t crypt_buf_size;
-  char *iv_buf;
-  size_t iv_buf_size;
+  /* ring of ENCRYPT_WINDOW chunks: n_busy chunks in flight starting at head,
+  followed by the chunk being filled */
   std::vector<std::future<void>> tasks;
   std::vector<encrypt_thread_ctxt_t> contexts;
+  size_t head;
+  size_t n_busy;
+  bool error;
 } ds_encrypt_file_t;
 
 /* Encryption options */
 uint ds_encrypt_encrypt_threads;
 ulonglong ds_encrypt_encrypt_chunk_size;
 bool ds_encrypt_modify_file_extension = true;
+bool ds_encrypt_gcm = false;
+
+/** Encrypt a chunk with the configured cipher mode.
+@param[in,out]  thd       context of the chunk
+@param[in]      from      data to encrypt, may be thd.to
+@param[in]      from_len  data length
+@param[out]     to        encrypted data followed by the hash or tag
+@param[out]     to_len    length of the encrypted data with the hash or tag
+@param[out]     iv        iv used
+@return 0 on success */
+static gcry_error_t encrypt_chunk_data(encrypt_thread_ctxt_t &thd,
+                                       const uchar *from, size_t from_len,
+                                       uchar *to, size_t *to_len, uchar *iv) {
+  if (ds_encrypt_gcm) {
+    return xb_crypt_encrypt_gcm(thd.cipher_handle, from, from_len, to, to_len,
+                                iv);
+  }
+  return xb_crypt_encrypt(thd.cipher_handle, from, from_len, to, to_len, iv);
+}
+
+/** Original length recorded in the chunk header. Version 3 chunks account
+for the hash appended to the data, the tag of version 4 chunks is not part of
+the original data. */
+static size_t encrypt_chunk_olen(size_t from_len) {
+  return ds_encrypt_gcm ? from_len : from_len + XB_CRYPT_HASH_LEN;
+}
 
 static ds_ctxt_t *encrypt_init(const char *root);
 static ds_file_t *encrypt_open(ds_ctxt_t *ctxt, const char *path,
@@ -94,10 +141,9 @@ static int encrypt_write(ds_file_t *file, const void *buf, size_t len);
 static int encrypt_close(ds_file_t *file);
 static void encrypt_deinit(ds_ctxt_t *ctxt);
 
-datasink_t datasink_encrypt = {&encrypt_init, &encrypt_open,  &encrypt_write,
-                               nullptr,       &encrypt_close, &encrypt_deinit};
-
-static uint encrypt_iv_len = 0;
+datasink_t datasink_encrypt = {&encrypt_init,  &encrypt_open,   &encrypt_write,
+                               nullptr,        nullptr,         nullptr,
+                               &encrypt_close, &encrypt_deinit, nullptr};
 
 static ssize_t my_xb_crypt_write_callback(void *userdata, const void *buf,
                                           size_t len) {
@@ -114,6 +160,24 @@ static ssize_t my_xb_crypt_write_callback(void *userdata, const void *buf,
   return -1;
 }
 
+static ssize_t my_xb_crypt_writev_callback(void *userdata,
+                                           const struct iovec *iov,
+                                           int iovcnt) {
+  ds_encrypt_file_t *encrypt_file;
+
+  encrypt_file = (ds_encrypt_file_t *)userdata;
+
+  xb_ad(encrypt_file != NULL);
+  xb_ad(encrypt_file->dest_file != NULL);
+
+  if (!ds_writev(encrypt_file->dest_file, iov, iovcnt)) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+    return len;
+  }
+  return -1;
+}
+
 static ds_ctxt_t *encrypt_init(const char *root) {
   if (xb_crypt_init(&encrypt_iv_len)) {
     return NULL;
@@ -122,7 +186,8 @@ static ds_ctxt_t *encrypt_init(const char *root) {
   ds_ctxt_t *ctxt = new ds_ctxt_t;
 
   ds_encrypt_ctxt_t *encrypt_ctxt = new ds_encrypt_ctxt_t;
-  encrypt_ctxt->thread_pool = new Thread_pool(ds_encrypt_encrypt_threads);
+  encrypt_ctxt->thread_pool =
+      new Numa_thread_pool(ds_encrypt_encrypt_threads, "encrypt");
 
   ctxt->ptr = encrypt_ctxt;
   ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
@@ -166,13 +231,13 @@ static ds_file_t *encrypt_open(ds_ctxt_t *ctxt, const char *path,
     goto err;
   }
 
-  crypt_file->crypt_buf = nullptr;
-  crypt_file->crypt_buf_size = 0;
-  crypt_file->iv_buf = nullptr;
-  crypt_file->iv_buf_size = 0;
   crypt_file->crypt_ctxt = crypt_ctxt;
-  crypt_file->xbcrypt_file =
-      xb_crypt_write_open(crypt_file, my_xb_crypt_write_callback);
+  crypt_file->bytes_processed = 0;
+  crypt_file->head = 0;
+  crypt_file->n_busy = 0;
+  crypt_file->error = false;
+  crypt_file->xbcrypt_file = xb_crypt_write_open(
+      crypt_file, my_xb_crypt_write_callback, my_xb_crypt_writev_callback);
 
   if (crypt_file->xbcrypt_file == NULL) {
     msg("encrypt: xb_crypt_write_open() failed.\n");
@@ -193,91 +258,207 @@ err:
   return NULL;
 }
 
-static int encrypt_write(ds_file_t *file, const void *buf, size_t len) {
-  ds_encrypt_file_t *crypt_file = (ds_encrypt_file_t *)file->ptr;
-  ds_encrypt_ctxt_t *crypt_ctxt = crypt_file->crypt_ctxt;
-
-  /* make sure we have enough memory for encryption */
-  const size_t crypt_size = XB_CRYPT_CHUNK_SIZE + XB_CRYPT_HASH_LEN;
-  const size_t n_chunks =
-      (len / XB_CRYPT_CHUNK_SIZE * XB_CRYPT_CHUNK_SIZE == len)
-          ? (len / XB_CRYPT_CHUNK_SIZE)
-          : (len / XB_CRYPT_CHUNK_SIZE + 1);
-  const size_t crypt_buf_size = crypt_size * n_chunks;
-  const size_t iv_buf_size = encrypt_iv_len * n_chunks;
-  if (crypt_file->crypt_buf_size < crypt_buf_size) {
-    crypt_file->crypt_buf = static_cast<char *>(
-        my_realloc(PSI_NOT_INSTRUMENTED, crypt_file->crypt_buf, crypt_buf_size,
-                   MYF(MY_FAE | MY_ALLOW_ZERO_PTR)));
+/** Write the chunk of the oldest chunk in flight, waiting for its encryption
+to finish. After an error the chunks are only reaped.
+@param[in,out]  crypt_file  encrypted file
+@return 0 on success, 1 on error */
+static int encrypt_reap(ds_encrypt_file_t *crypt_file) {
+  const size_t window = crypt_file->contexts.size();
+  auto &thd = crypt_file->contexts[crypt_file->head];
+
+  {
+    xb::wait_state::Scope wait(xb::wait_state::POOL_WAIT);
+    crypt_file->tasks[crypt_file->head].wait();
+  }
+  crypt_file->head = (crypt_file->head + 1) % window;
+  crypt_file->n_busy--;
+
+  const size_t from_len = thd.from_len;
+  thd.from_len = 0;
+
+  if (crypt_file->error) {
+    return 1;
+  }
+
+  if (thd.error) {
+    msg("encrypt: encryption failed.\n");
+    crypt_file->error = true;
+    return 1;
+  }
+
+  if (xb_crypt_write_chunk(crypt_file->xbcrypt_file, thd.to,
+                           encrypt_chunk_olen(from_len), thd.to_len, thd.iv,
+                           ENCRYPT_IV_LEN, ds_encrypt_gcm)) {
+    msg("encrypt: write to the destination file failed.\n");
+    crypt_file->error = true;
+    return 1;
+  }
+
+  crypt_file->bytes_processed += from_len;
+
+  return 0;
+}
+
+/** Start encrypting the chunk being filled and write the chunks that are
+done, in order. Only waits for an encryption to finish when the whole window
+is in flight.
+@param[in,out]  crypt_file  encrypted file
+@return 0 on success, 1 on error */
+static int encrypt_submit(ds_encrypt_file_t *crypt_file) {
+  const size_t window = crypt_file->contexts.size();
+  const size_t i = (crypt_file->head + crypt_file->n_busy) % window;
+  auto &thd = crypt_file->contexts[i];
+
+  crypt_file->tasks[i] =
+      crypt_file->crypt_ctxt->thread_pool->add_task([&thd](size_t thread_id) {
+        xb::trace::Span span("encrypt", thd.from_len);
+        if (encrypt_chunk_data(thd, thd.to, thd.from_len, thd.to, &thd.to_len,
+                               thd.iv)) {
+          thd.error = true;
+        }
+      });
+  crypt_file->n_busy++;
+
+  while (crypt_file->n_busy > 0) {
+    const auto &task = crypt_file->tasks[crypt_file->head];
+    if (crypt_file->n_busy < window &&
+        task.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      break;
+    }
+    if (encrypt_reap(crypt_file)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/** Encrypt the last partial chunk and write all chunks in flight.
+@param[in,out]  crypt_file  encrypted file
+@return 0 on success, 1 on error */
+static int encrypt_flush(ds_encrypt_file_t *crypt_file) {
+  const size_t window = crypt_file->contexts.size();
+  int rc = 0;
+
+  /* nothing written yet */
+  if (window == 0) {
+    return crypt_file->error ? 1 : 0;
+  }
+
+  const auto &last =
+      crypt_file->contexts[(crypt_file->head + crypt_file->n_busy) % window];
+  if (!crypt_file->error && last.from_len > 0 && encrypt_submit(crypt_file)) {
+    rc = 1;
   }
-  if (crypt_file->iv_buf_size < iv_buf_size) {
-    crypt_file->iv_buf = static_cast<char *>(
-        my_realloc(PSI_NOT_INSTRUMENTED, crypt_file->iv_buf, iv_buf_size,
-                   MYF(MY_FAE | MY_ALLOW_ZERO_PTR)));
+  while (crypt_file->n_busy > 0) {
+    if (encrypt_reap(crypt_file)) {
+      rc = 1;
+    }
   }
 
-  /* parallel encrypt using trhead pool */
-  if (crypt_file->tasks.size() < n_chunks) {
-    crypt_file->tasks.resize(n_chunks);
+  return crypt_file->error ? 1 : rc;
+}
+
+/* The data is collected in chunks of XB_CRYPT_CHUNK_SIZE, each encrypted in
+place by the thread pool as soon as it is full. Up to ENCRYPT_WINDOW chunks of
+a file are in flight across writes, so the encryption threads keep working
+while the caller produces the next data. The chunks are written in order. */
+static int encrypt_write(ds_file_t *file, const void *buf, size_t len) {
+  ds_encrypt_file_t *crypt_file = (ds_encrypt_file_t *)file->ptr;
+  const uchar *ptr = static_cast<const uchar *>(buf);
+
+  if (crypt_file->error) {
+    return 1;
   }
-  if (crypt_file->contexts.size() < n_chunks) {
-    size_t n = crypt_file->contexts.size();
-    crypt_file->contexts.reserve(n_chunks);
-    for (size_t i = n; i < n_chunks; i++) {
+
+  /* the cipher handles are opened with the window */
+  if (crypt_file->contexts.empty()) {
+    crypt_file->tasks.resize(ENCRYPT_WINDOW);
+    crypt_file->contexts.reserve(ENCRYPT_WINDOW);
+    for (size_t i = 0; i < ENCRYPT_WINDOW; i++) {
       crypt_file->contexts.emplace_back();
       if (crypt_file->contexts[i].error) {
+        crypt_file->error = true;
         return 1;
       }
     }
   }
+  const size_t window = crypt_file->contexts.size();
+
+  while (len > 0) {
+    auto &thd =
+        crypt_file->contexts[(crypt_file->head + crypt_file->n_busy) % window];
+
+    /* chunk buffers are allocated on first use, small files need few */
+    if (thd.to == nullptr) {
+      thd.to = static_cast<uchar *>(
+          my_malloc(PSI_NOT_INSTRUMENTED,
+                    XB_CRYPT_CHUNK_SIZE + ENCRYPT_TAIL_LEN, MYF(MY_FAE)));
+      thd.iv = static_cast<uchar *>(
+          my_malloc(PSI_NOT_INSTRUMENTED, ENCRYPT_IV_LEN, MYF(MY_FAE)));
+      xb::memory::charge(xb::memory::ENCRYPT, ENCRYPT_CHUNK_MEMORY);
+    }
 
-  for (size_t i = 0; i < n_chunks; ++i) {
-    size_t chunk_len =
-        std::min(len - i * XB_CRYPT_CHUNK_SIZE, XB_CRYPT_CHUNK_SIZE);
-    auto &thd = crypt_file->contexts[i];
-    thd.from = ((const uchar *)buf) + XB_CRYPT_CHUNK_SIZE * i;
-    thd.from_len = chunk_len;
-    thd.to_size = crypt_size;
-    thd.to = (uchar *)(crypt_file->crypt_buf) + crypt_size * i;
-    thd.iv = (uchar *)(crypt_file->iv_buf) + encrypt_iv_len * i;
-
-    crypt_file->tasks[i] =
-        crypt_ctxt->thread_pool->add_task([&thd](size_t thread_id) {
-          if (xb_crypt_encrypt(thd.cipher_handle, thd.from, thd.from_len,
-                               thd.to, &thd.to_len, thd.iv)) {
-            thd.error = true;
-          }
-        });
+    const size_t n = std::min(len, XB_CRYPT_CHUNK_SIZE - thd.from_len);
+    memcpy(thd.to + thd.from_len, ptr, n);
+    thd.from_len += n;
+    ptr += n;
+    len -= n;
+
+    if (thd.from_len == XB_CRYPT_CHUNK_SIZE && encrypt_submit(crypt_file)) {
+      return 1;
+    }
   }
 
-  bool error = false;
+  return 0;
+}
 
-  for (size_t i = 0; i < n_chunks; ++i) {
-    const auto &thd = crypt_file->contexts[i];
+bool ds_is_encrypt_file(const ds_file_t *file) {
+  return file->datasink == &datasink_encrypt;
+}
 
-    /* reap */
-    crypt_file->tasks[i].wait();
+size_t ds_encrypt_chunk_head_size() {
+  return XB_CRYPT_CHUNK_HEADER_SIZE + ENCRYPT_IV_LEN;
+}
 
-    if (error) continue;
+size_t ds_encrypt_chunk_tail_size() { return ENCRYPT_TAIL_LEN; }
 
-    if (thd.error) {
-      msg("encrypt: encryption failed.\n");
-      error = true;
-      continue;
-    }
+size_t ds_encrypt_chunk(char *buf, size_t len) {
+  /* cipher handle of the calling thread, closed when the thread exits */
+  static thread_local encrypt_thread_ctxt_t thd;
 
-    if (xb_crypt_write_chunk(crypt_file->xbcrypt_file, thd.to,
-                             thd.from_len + XB_CRYPT_HASH_LEN, thd.to_len,
-                             thd.iv, encrypt_iv_len)) {
-      msg("encrypt: write to the destination file failed.\n");
-      error = true;
-      continue;
-    }
+  uchar *chunk = reinterpret_cast<uchar *>(buf);
+  uchar *iv = chunk + XB_CRYPT_CHUNK_HEADER_SIZE;
+  uchar *data = iv + ENCRYPT_IV_LEN;
+  size_t data_len;
 
-    crypt_file->bytes_processed += thd.from_len;
+  if (thd.error || encrypt_chunk_data(thd, data, len, data, &data_len, iv)) {
+    msg("encrypt: encryption failed.\n");
+    return 0;
   }
 
-  return error ? 1 : 0;
+  xb_crypt_format_chunk_header(chunk, data, encrypt_chunk_olen(len), data_len,
+                               ENCRYPT_IV_LEN, ds_encrypt_gcm);
+
+  return ds_encrypt_chunk_head_size() + data_len;
+}
+
+int ds_encrypt_write_chunks(ds_file_t *file, const struct iovec *iov,
+                            int iovcnt) {
+  ds_encrypt_file_t *crypt_file = (ds_encrypt_file_t *)file->ptr;
+
+  /* keep the order of the data written to the file */
+  if (encrypt_flush(crypt_file)) {
+    return 1;
+  }
+
+  if (ds_writev(crypt_file->dest_file, iov, iovcnt)) {
+    msg("encrypt: write to the destination file failed.\n");
+    crypt_file->error = true;
+    return 1;
+  }
+
+  return 0;
 }
 
 static int encrypt_close(ds_file_t *file) {
@@ -288,14 +469,17 @@ static int encrypt_close(ds_file_t *file) {
   crypt_file = (ds_encrypt_file_t *)file->ptr;
   dest_file = crypt_file->dest_file;
 
-  rc = xb_crypt_write_close(crypt_file->xbcrypt_file);
+  if (encrypt_flush(crypt_file)) {
+    rc = 1;
+  }
 
-  if (ds_close(dest_file)) {
+  if (xb_crypt_write_close(crypt_file->xbcrypt_file)) {
     rc = 1;
   }
 
-  my_free(crypt_file->crypt_buf);
-  my_free(crypt_file->iv_buf);
+  if (ds_close(dest_file)) {
+    rc = 1;
+  }
 
   delete crypt_file;
   delete file;
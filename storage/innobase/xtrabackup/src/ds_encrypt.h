@@ -30,5 +30,34 @@ extern uint ds_encrypt_encrypt_threads;
 extern ulonglong ds_encrypt_encrypt_chunk_size;
 /* Switch that controls if `.xbcrypt` extension is appended to the file name. */
 extern bool ds_encrypt_modify_file_extension;
+/* Write version 4 chunks, encrypted and authenticated with AES-GCM */
+extern bool ds_encrypt_gcm;
+
+/* The stage in front of an encrypt datasink file may encrypt its data on its
+own worker threads, right after producing it, instead of having it copied and
+dispatched again. A chunk is laid out in a buffer with
+ds_encrypt_chunk_head_size() bytes of room in front of the data and
+ds_encrypt_chunk_tail_size() bytes after it, encrypted in place with
+ds_encrypt_chunk() and written with ds_encrypt_write_chunks(). */
+
+/* Check if the file is an encrypt datasink file */
+bool ds_is_encrypt_file(const ds_file_t *file);
+
+/* Room needed in front of the data of a chunk */
+size_t ds_encrypt_chunk_head_size();
+
+/* Room needed after the data of a chunk */
+size_t ds_encrypt_chunk_tail_size();
+
+/* Turn the len bytes of data at buf + ds_encrypt_chunk_head_size() into an
+encrypted chunk starting at buf. Can be called from any thread.
+@return chunk length, 0 on error */
+size_t ds_encrypt_chunk(char *buf, size_t len);
+
+/* Write chunks made with ds_encrypt_chunk() to an encrypt datasink file, after
+the data written to it so far.
+@return 0 on success, 1 on error */
+int ds_encrypt_write_chunks(ds_file_t *file, const struct iovec *iov,
+                            int iovcnt);
 
 #endif
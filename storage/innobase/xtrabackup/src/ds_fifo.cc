@@ -25,6 +25,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <mysys_err.h>
 #include <mutex>
 #include <unordered_map>
+#include <vector>
 #include "common.h"
 #include "datasink.h"
 #include "file_utils.h"
@@ -77,14 +78,16 @@ typedef struct {
 
 extern uint xtrabackup_fifo_streams;
 extern uint xtrabackup_fifo_timeout;
+extern char *xtrabackup_stream_fds;
 static ds_ctxt_t *fifo_init(const char *root);
 static ds_file_t *fifo_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat);
 static int fifo_write(ds_file_t *file, const void *buf, size_t len);
 static int fifo_close(ds_file_t *file);
 static void fifo_deinit(ds_ctxt_t *ctxt);
 
-datasink_t datasink_fifo = {&fifo_init, &fifo_open,  &fifo_write,
-                            nullptr,    &fifo_close, &fifo_deinit};
+datasink_t datasink_fifo = {&fifo_init, &fifo_open, &fifo_write, nullptr,
+                            nullptr,    nullptr,    &fifo_close, &fifo_deinit,
+                            nullptr};
 
 static void cleanup_on_error(const char *root, ds_fifo_ctxt_t *ctxt) {
   std::string path;
@@ -111,6 +114,23 @@ static ds_ctxt_t *fifo_init(const char *root) {
   ds_ctxt_t *ctxt = new ds_ctxt_t;
   char fullpath[FN_REFLEN];
 
+  /* Streams to descriptors inherited from the shell, e.g. pipes to ssh or
+  sockets, instead of FIFO files */
+  if (xtrabackup_stream_fds != nullptr) {
+    std::vector<File> fds;
+    if (!parse_fd_list(xtrabackup_stream_fds, &fds)) {
+      return NULL;
+    }
+    xb_a(fds.size() == xtrabackup_fifo_streams);
+    for (auto stream_fd : fds) {
+      fifo_context->populate_list("fd_" + std::to_string(stream_fd),
+                                  stream_fd);
+    }
+    ctxt->ptr = fifo_context;
+    ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
+    return ctxt;
+  }
+
   if (my_mkdir(root, 0777, MYF(0)) < 0 && my_errno() != EEXIST &&
       my_errno() != EISDIR) {
     char errbuf[MYSYS_STRERROR_SIZE];
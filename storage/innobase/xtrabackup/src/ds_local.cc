@@ -25,19 +25,49 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <mysql/service_mysql_alloc.h>
 #include <mysql_version.h>
 #include <mysys_err.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
 
 #ifdef HAVE_FALLOC_PUNCH_HOLE_AND_KEEP_SIZE
 #include <linux/falloc.h>
 #endif
 
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
 #include "common.h"
 #include "datasink.h"
+#include "ds_local.h"
 #include "file_utils.h"
+#include "io_throttle.h"
+#include "msg.h"
 
 #define PUNCH_HOLE_PLACEHOLDER_FILE "xtrabackup_punch_hole"
+
+/* O_DIRECT writes are staged in a buffer of this size, aligned to
+DS_LOCAL_DIRECT_ALIGN */
+#define DS_LOCAL_DIRECT_BUF_SIZE (1024 * 1024)
+#define DS_LOCAL_DIRECT_ALIGN 4096
+
+typedef struct {
+  bool preallocate;
+  bool direct;
+  std::atomic<bool> direct_failed; /* O_DIRECT refused by the filesystem */
+} ds_local_ctxt_t;
+
 typedef struct {
   File fd;
-  size_t last_seek;  // to track last page sparse_file
+  size_t last_seek;   // to track last page sparse_file
+  my_off_t prealloc;  // bytes preallocated at open
+  bool direct;        // written with O_DIRECT
+  uchar *direct_buf;  // aligned staging buffer for O_DIRECT writes
+  size_t direct_len;  // bytes pending in direct_buf
 } ds_local_file_t;
 
 static ds_ctxt_t *local_init(const char *root);
@@ -48,11 +78,14 @@ static int local_write_sparse(ds_file_t *file, const void *buf, size_t len,
                               size_t sparse_map_size,
                               const ds_sparse_chunk_t *sparse_map,
                               bool punch_hole_supported);
+static int local_writev(ds_file_t *file, const struct iovec *iov, int iovcnt);
 static int local_close(ds_file_t *file);
 static void local_deinit(ds_ctxt_t *ctxt);
+static ds_file_t *local_file_new(File fd, const char *fullpath);
 
-datasink_t datasink_local = {&local_init,         &local_open,  &local_write,
-                             &local_write_sparse, &local_close, &local_deinit};
+datasink_t datasink_local = {&local_init,         &local_open,   &local_write,
+                             &local_write_sparse, &local_writev, nullptr,
+                             &local_close,        &local_deinit, nullptr};
 
 /**
   Checks if punch hole via fallocate is supported
@@ -99,19 +132,165 @@ static ds_ctxt_t *local_init(const char *root) {
 
   ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
 
+  ds_local_ctxt_t *local_ctxt = new ds_local_ctxt_t;
+  local_ctxt->preallocate = false;
+  local_ctxt->direct = false;
+  local_ctxt->direct_failed = false;
+  ctxt->ptr = local_ctxt;
+
   is_fallocate_punch_hole_supported(ctxt);
 
   return ctxt;
 }
 
+/* Reserve the size of the source file for the files created from now on, so
+the filesystem can allocate them in one go instead of extending them with
+every write */
+void ds_local_set_preallocate(ds_ctxt_t *ctxt, bool preallocate) {
+  ds_local_ctxt_t *local_ctxt = (ds_local_ctxt_t *)ctxt->ptr;
+
+  local_ctxt->preallocate = preallocate;
+}
+
+/* Write the files created from now on with O_DIRECT, bypassing the page
+cache */
+void ds_local_set_direct(ds_ctxt_t *ctxt, bool direct) {
+  ds_local_ctxt_t *local_ctxt = (ds_local_ctxt_t *)ctxt->ptr;
+
+  local_ctxt->direct = direct;
+}
+
+/** Preallocate a new file without changing its size.
+@param[in]  fd    file descriptor
+@param[in]  size  expected file size
+@return number of bytes preallocated */
+static my_off_t local_preallocate(File fd [[maybe_unused]],
+                                  my_off_t size [[maybe_unused]]) {
+#ifdef HAVE_FALLOC_PUNCH_HOLE_AND_KEEP_SIZE
+  if (size > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0) {
+    return size;
+  }
+#endif
+  return 0;
+}
+
+/** Switch a new file to O_DIRECT writes.
+@param[in,out]  local_ctxt  local datasink context
+@param[in,out]  local_file  local file
+@param[in]      fullpath    file path for messages */
+static void local_direct_start(ds_local_ctxt_t *local_ctxt,
+                               ds_local_file_t *local_file,
+                               const char *fullpath [[maybe_unused]]) {
+#ifdef O_DIRECT
+  const int flags = fcntl(local_file->fd, F_GETFL);
+  void *buf;
+
+  if (flags == -1 || fcntl(local_file->fd, F_SETFL, flags | O_DIRECT) == -1) {
+    if (!local_ctxt->direct_failed.exchange(true)) {
+      msg("Warning: cannot write %s with O_DIRECT, falling back to buffered "
+          "writes: %s\n",
+          fullpath, strerror(errno));
+    }
+    return;
+  }
+
+  if (posix_memalign(&buf, DS_LOCAL_DIRECT_ALIGN, DS_LOCAL_DIRECT_BUF_SIZE)) {
+    fcntl(local_file->fd, F_SETFL, flags);
+    return;
+  }
+
+  local_file->direct = true;
+  local_file->direct_buf = static_cast<uchar *>(buf);
+  local_file->direct_len = 0;
+#endif
+}
+
+/** Append data to a file written with O_DIRECT. Full aligned blocks are
+written from the caller buffers when possible, the rest is staged in the
+aligned buffer of the file.
+@param[in,out]  local_file  local file
+@param[in]      iov         buffers to write
+@param[in]      iovcnt      number of buffers
+@return 0 on success */
+static int local_direct_append(ds_local_file_t *local_file,
+                               const struct iovec *iov, int iovcnt) {
+  for (int i = 0; i < iovcnt; i++) {
+    const uchar *ptr = static_cast<const uchar *>(iov[i].iov_base);
+    size_t len = iov[i].iov_len;
+
+    while (len > 0) {
+      size_t n;
+
+      if (local_file->direct_len == 0 &&
+          (uintptr_t)ptr % DS_LOCAL_DIRECT_ALIGN == 0 &&
+          len >= DS_LOCAL_DIRECT_ALIGN) {
+        n = len - len % DS_LOCAL_DIRECT_ALIGN;
+        if (my_write(local_file->fd, ptr, n, MYF(MY_WME | MY_NABP))) {
+          return 1;
+        }
+      } else {
+        n = std::min(len, DS_LOCAL_DIRECT_BUF_SIZE - local_file->direct_len);
+        memcpy(local_file->direct_buf + local_file->direct_len, ptr, n);
+        local_file->direct_len += n;
+        if (local_file->direct_len == DS_LOCAL_DIRECT_BUF_SIZE) {
+          if (my_write(local_file->fd, local_file->direct_buf,
+                       DS_LOCAL_DIRECT_BUF_SIZE, MYF(MY_WME | MY_NABP))) {
+            return 1;
+          }
+          local_file->direct_len = 0;
+        }
+      }
+
+      ptr += n;
+      len -= n;
+    }
+  }
+
+  return 0;
+}
+
+/** Leave O_DIRECT mode and write the data still staged, which need not be
+aligned. Called before the unaligned tail of the file and before sparse
+writes, which seek to unaligned offsets.
+@param[in,out]  local_file  local file
+@return 0 on success */
+static int local_direct_stop(ds_local_file_t *local_file) {
+  int ret = 0;
+
+  if (!local_file->direct) {
+    return 0;
+  }
+
+#ifdef O_DIRECT
+  const int flags = fcntl(local_file->fd, F_GETFL);
+  if (flags == -1 ||
+      fcntl(local_file->fd, F_SETFL, flags & ~O_DIRECT) == -1) {
+    msg("Error: cannot disable O_DIRECT for a destination file: %s\n",
+        strerror(errno));
+    ret = 1;
+  }
+#endif
+
+  if (ret == 0 && local_file->direct_len > 0 &&
+      my_write(local_file->fd, local_file->direct_buf, local_file->direct_len,
+               MYF(MY_WME | MY_NABP))) {
+    ret = 1;
+  }
+
+  free(local_file->direct_buf);
+  local_file->direct_buf = nullptr;
+  local_file->direct_len = 0;
+  local_file->direct = false;
+
+  return ret;
+}
+
 static ds_file_t *local_open(ds_ctxt_t *ctxt, const char *path,
-                             MY_STAT *mystat __attribute__((unused))) {
+                             MY_STAT *mystat) {
+  ds_local_ctxt_t *local_ctxt = (ds_local_ctxt_t *)ctxt->ptr;
   char fullpath[FN_REFLEN];
   char dirpath[FN_REFLEN];
   size_t dirpath_len;
-  size_t path_len;
-  ds_local_file_t *local_file;
-  ds_file_t *file;
   File fd;
 
   fn_format(fullpath, path, ctxt->root, "", MYF(MY_RELATIVE_PATH));
@@ -130,6 +309,123 @@ static ds_file_t *local_open(ds_ctxt_t *ctxt, const char *path,
     return NULL;
   }
 
+  ds_file_t *file = local_file_new(fd, fullpath);
+  auto local_file = ((ds_local_file_t *)file->ptr);
+
+  if (local_ctxt->preallocate && mystat != nullptr) {
+    local_file->prealloc = local_preallocate(fd, mystat->st_size);
+  }
+
+  if (local_ctxt->direct) {
+    local_direct_start(local_ctxt, local_file, fullpath);
+  }
+
+  return file;
+}
+
+ds_file_t *ds_local_open_at(ds_ctxt_t *ctxt, const char *path,
+                            my_off_t offset) {
+  char fullpath[FN_REFLEN];
+  ds_file_t *file;
+  File fd;
+
+  fn_format(fullpath, path, ctxt->root, "", MYF(MY_RELATIVE_PATH));
+
+  fd = my_open(fullpath, O_WRONLY | O_NOFOLLOW, MYF(MY_WME));
+  if (fd < 0) {
+    return NULL;
+  }
+
+  if (my_seek(fd, offset, MY_SEEK_SET, MYF(MY_WME)) == MY_FILEPOS_ERROR) {
+    my_close(fd, MYF(MY_WME));
+    return NULL;
+  }
+
+  file = local_file_new(fd, fullpath);
+  file->datasink = &datasink_local;
+
+  return file;
+}
+
+bool ds_local_create(ds_ctxt_t *ctxt, const char *path, my_off_t size) {
+  ds_file_t *file = local_open(ctxt, path, nullptr);
+  if (file == NULL) {
+    return false;
+  }
+
+  auto local_file = ((ds_local_file_t *)file->ptr);
+  local_preallocate(local_file->fd, size);
+
+  if (ftruncate(local_file->fd, size) != 0) {
+    msg("Error: cannot extend %s to %llu bytes: %s\n", file->path,
+        (unsigned long long)size, strerror(errno));
+    my_delete(file->path, MYF(MY_WME));
+    local_close(file);
+    return false;
+  }
+
+  return local_close(file) == 0;
+}
+
+bool ds_local_clone(ds_file_t *file, File src_fd, my_off_t size,
+                    bool reflink_only [[maybe_unused]]) {
+  auto local_file = ((ds_local_file_t *)file->ptr);
+  File fd = local_file->fd;
+
+  if (local_direct_stop(local_file)) {
+    return false;
+  }
+
+#ifdef FICLONE
+  /* share the extents of the source, both files must be on the same
+  filesystem supporting reflinks (XFS, btrfs) */
+  if (ioctl(fd, FICLONE, src_fd) == 0) {
+    return true;
+  }
+#endif
+
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+  /* copy_file_range() may fill the holes of a sparse source */
+  MY_STAT stat_info;
+  if (reflink_only || my_fstat(src_fd, &stat_info) != 0 ||
+      (my_off_t)stat_info.st_blocks * 512 < size) {
+    return false;
+  }
+
+  loff_t src_off = 0;
+  loff_t dst_off = 0;
+  while ((my_off_t)src_off < size) {
+    size_t len = std::min<my_off_t>(size - src_off, 64 * 1024 * 1024);
+
+    io_throttle_write.acquire(len);
+
+    ssize_t n = copy_file_range(src_fd, &src_off, fd, &dst_off, len, 0);
+    if (n <= 0) {
+      /* unsupported, e.g. across filesystems: the caller writes the file
+      again from offset 0 */
+      if (ftruncate(fd, 0) != 0) {
+        msg("Warning: cannot truncate %s: %s\n", file->path, strerror(errno));
+      }
+      return false;
+    }
+  }
+
+  return true;
+#else
+  return false;
+#endif
+}
+
+/** Allocate datasink file for an opened descriptor.
+@param[in]  fd        file descriptor
+@param[in]  fullpath  file path
+@return datasink file */
+static ds_file_t *local_file_new(File fd, const char *fullpath) {
+  size_t path_len;
+  ds_local_file_t *local_file;
+  ds_file_t *file;
+
   path_len = strlen(fullpath) + 1; /* terminating '\0' */
 
   file = (ds_file_t *)my_malloc(
@@ -139,6 +435,10 @@ static ds_file_t *local_open(ds_ctxt_t *ctxt, const char *path,
 
   local_file->fd = fd;
   local_file->last_seek = 0;
+  local_file->prealloc = 0;
+  local_file->direct = false;
+  local_file->direct_buf = nullptr;
+  local_file->direct_len = 0;
 
   file->path = (char *)local_file + sizeof(ds_local_file_t);
   memcpy(file->path, fullpath, path_len);
@@ -153,6 +453,15 @@ static int local_write(ds_file_t *file, const void *buf, size_t len) {
   File fd = local_file->fd;
   local_file->last_seek = 0;
 
+  io_throttle_write.acquire(len);
+
+  if (local_file->direct) {
+    struct iovec iov;
+    iov.iov_base = const_cast<void *>(buf);
+    iov.iov_len = len;
+    return local_direct_append(local_file, &iov, 1);
+  }
+
   if (!my_write(fd, static_cast<const uchar *>(buf), len,
                 MYF(MY_WME | MY_NABP))) {
     posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
@@ -162,6 +471,31 @@ static int local_write(ds_file_t *file, const void *buf, size_t len) {
   return 1;
 }
 
+static int local_writev(ds_file_t *file, const struct iovec *iov,
+                        int iovcnt) {
+  auto local_file = ((ds_local_file_t *)file->ptr);
+  File fd = local_file->fd;
+  local_file->last_seek = 0;
+
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+
+  io_throttle_write.acquire(len);
+
+  if (local_file->direct) {
+    return local_direct_append(local_file, iov, iovcnt);
+  }
+
+  if (!ds_writev_fd(fd, iov, iovcnt)) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    return 0;
+  }
+
+  return 1;
+}
+
 static int local_write_sparse(ds_file_t *file, const void *buf, size_t len,
                               size_t sparse_map_size,
                               const ds_sparse_chunk_t *sparse_map,
@@ -172,6 +506,12 @@ static int local_write_sparse(ds_file_t *file, const void *buf, size_t len,
 
   const uchar *ptr = static_cast<const uchar *>(buf);
 
+  if (local_direct_stop(local_file)) {
+    return 1;
+  }
+
+  io_throttle_write.acquire(len);
+
   for (size_t i = 0; i < sparse_map_size; ++i) {
     my_off_t rc;
 
@@ -208,6 +548,10 @@ static int local_close(ds_file_t *file) {
   auto local_file = ((ds_local_file_t *)file->ptr);
   File fd = local_file->fd;
 
+  if (local_direct_stop(local_file)) {
+    return 1;
+  }
+
   /* Write the last page complete in full size. We achieve this by writing the
    * last byte of page as zero, this can only happen in case of sparse file */
   if (local_file->last_seek > 0) {
@@ -223,6 +567,16 @@ static int local_close(ds_file_t *file) {
     }
   }
 
+  /* Release the preallocated space not used, e.g. by compressed files */
+  if (local_file->prealloc > 0) {
+    MY_STAT stat_info;
+    if (my_fstat(fd, &stat_info) == 0 &&
+        (my_off_t)stat_info.st_size < local_file->prealloc &&
+        ftruncate(fd, stat_info.st_size) != 0) {
+      return 1;
+    }
+  }
+
   my_free(file);
 
   my_sync(fd, MYF(MY_WME));
@@ -231,6 +585,7 @@ static int local_close(ds_file_t *file) {
 }
 
 static void local_deinit(ds_ctxt_t *ctxt) {
+  delete (ds_local_ctxt_t *)ctxt->ptr;
   my_free(ctxt->root);
   my_free(ctxt);
 }
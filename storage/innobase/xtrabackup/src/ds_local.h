@@ -25,4 +25,42 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 extern datasink_t datasink_local;
 
+/** Open an existing file created by the local datasink for writing at the
+given offset. Lets several threads fill disjoint ranges of the same file.
+@param[in]  ctxt    local datasink context
+@param[in]  path    file path relative to the datasink root
+@param[in]  offset  offset to start writing at
+@return datasink file or NULL on error */
+ds_file_t *ds_local_open_at(ds_ctxt_t *ctxt, const char *path,
+                            my_off_t offset);
+
+/** Create a file of the given size, to be filled in ranges through
+ds_local_open_at(). The space is preallocated when the filesystem supports it.
+@param[in]  ctxt  local datasink context
+@param[in]  path  file path relative to the datasink root
+@param[in]  size  file size
+@return true on success */
+bool ds_local_create(ds_ctxt_t *ctxt, const char *path, my_off_t size);
+
+/** Copy a whole file into a file just opened by the local datasink without
+reading it into user space: share its extents with FICLONE when the
+filesystem supports reflinks, otherwise copy it with copy_file_range() unless
+the source is sparse.
+@param[in]  file          destination file, nothing written yet
+@param[in]  src_fd        source file descriptor
+@param[in]  size          source file size
+@param[in]  reflink_only  do not fall back to copy_file_range()
+@return false if the file was not copied and is still empty */
+bool ds_local_clone(ds_file_t *file, File src_fd, my_off_t size,
+                    bool reflink_only);
+
+/* Reserve the size of the source file for the files created from now on, so
+the filesystem can allocate them in one go instead of extending them with
+every write */
+void ds_local_set_preallocate(ds_ctxt_t *ctxt, bool preallocate);
+
+/* Write the files created from now on with O_DIRECT, bypassing the page
+cache */
+void ds_local_set_direct(ds_ctxt_t *ctxt, bool direct);
+
 #endif
@@ -0,0 +1,484 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+Object store datasink implementation for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+/* Every xbstream chunk of a file becomes object
+<backup name>/<file path>.<chunk index>, exactly like "xbcloud put" names the
+chunks it reads from the stream. The chunks are uploaded asynchronously from
+the copy threads, the number of uploads in flight is limited by
+--cloud-parallel. Closing a file waits until all its chunks are stored. */
+
+#include <my_base.h>
+#include <my_sys.h>
+#include <mysql/service_mysql_alloc.h>
+#include <atomic>
+#include <condition_variable>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common.h"
+#include "datasink.h"
+#include "ds_object_store.h"
+#include "msg.h"
+#include "trace.h"
+#include "xbcloud/http.h"
+#include "xbcloud/object_store.h"
+#include "xbcloud/s3.h"
+#include "xbcloud/s3_ec2.h"
+#include "xbstream.h"
+
+using namespace xbcloud;
+
+/* Same as in xbcloud, which relies on it to order the chunks */
+#define DS_OBJECT_STORE_CHUNK_INDEX_LEN 20
+
+std::atomic<uint64_t> ds_object_store_uploads_in_flight{0};
+
+extern char *opt_cloud_put;
+extern uint opt_cloud_parallel;
+extern uint opt_cloud_max_retries;
+extern uint opt_cloud_max_backoff;
+extern char *opt_cloud_cacert;
+extern bool opt_cloud_insecure;
+extern char *opt_s3_bucket;
+extern char *opt_s3_region;
+extern char *opt_s3_endpoint;
+extern char *opt_s3_access_key;
+extern char *opt_s3_secret_key;
+extern char *opt_s3_session_token;
+extern char *opt_s3_storage_class;
+extern ulong opt_s3_bucket_lookup;
+extern ulong opt_s3_api_version;
+
+struct ds_object_store_ctxt_t {
+  Http_client http_client;
+  std::unique_ptr<Object_store> store;
+  std::string container;
+  std::string backup_name;
+
+  Event_handler *handler{nullptr};
+  std::thread event_loop;
+
+  /* set by any failed upload, fails all following writes */
+  std::atomic<bool> has_errors{false};
+  std::atomic<uint64_t> objects{0};
+  std::atomic<uint64_t> bytes{0};
+};
+
+struct ds_object_store_file_t {
+  ds_object_store_ctxt_t *store_ctxt;
+  /* xbstream writer of this file only, so that copy threads do not serialize
+  on the stream mutex while queueing uploads */
+  xb_wstream_t *xbstream;
+  xb_wstream_file_t *xbstream_file;
+  std::string path;
+  my_off_t chunk_idx{0};
+
+  std::mutex mutex;
+  std::condition_variable uploaded;
+  uint in_flight{0};
+  bool failed{false};
+};
+
+static ds_ctxt_t *object_store_init(const char *root);
+static ds_file_t *object_store_open(ds_ctxt_t *ctxt, const char *path,
+                                    MY_STAT *mystat);
+static int object_store_write(ds_file_t *file, const void *buf, size_t len);
+static int object_store_write_sparse(ds_file_t *file, const void *buf,
+                                     size_t len, size_t sparse_map_size,
+                                     const ds_sparse_chunk_t *sparse_map,
+                                     bool punch_hole_supported);
+static int object_store_writev(ds_file_t *file, const struct iovec *iov,
+                               int iovcnt);
+static int object_store_write_lease(ds_file_t *file, ds_lease_t *lease);
+static int object_store_close(ds_file_t *file);
+static void object_store_deinit(ds_ctxt_t *ctxt);
+static int object_store_flush(ds_file_t *file);
+
+datasink_t datasink_object_store = {
+    &object_store_init,   &object_store_open,
+    &object_store_write,  &object_store_write_sparse,
+    &object_store_writev, &object_store_write_lease,
+    &object_store_close,  &object_store_deinit,
+    &object_store_flush};
+
+/** Build the object name of a chunk the same way as xbcloud does.
+@param[in]  store_ctxt  datasink context
+@param[in]  path        file path
+@param[in]  idx         chunk index
+@return object name */
+static std::string object_store_chunk_name(
+    const ds_object_store_ctxt_t *store_ctxt, const std::string &path,
+    my_off_t idx) {
+  std::stringstream name;
+  name << store_ctxt->backup_name << "/" << path << "."
+       << std::setw(DS_OBJECT_STORE_CHUNK_INDEX_LEN) << std::setfill('0')
+       << idx;
+  return name.str();
+}
+
+/* Uploads one xbstream chunk, called by the xbstream writer */
+static ssize_t object_store_upload_chunk(xb_wstream_file_t *f
+                                         __attribute__((unused)),
+                                         void *userdata,
+                                         const struct iovec *iov, int iovcnt) {
+  ds_object_store_file_t *store_file = (ds_object_store_file_t *)userdata;
+  ds_object_store_ctxt_t *store_ctxt = store_file->store_ctxt;
+  Http_buffer contents;
+  size_t len = 0;
+
+  if (store_ctxt->has_errors) {
+    return -1;
+  }
+
+  for (int i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+  contents.reserve(len);
+  for (int i = 0; i < iovcnt; i++) {
+    contents.append(static_cast<const char *>(iov[i].iov_base),
+                    iov[i].iov_len);
+  }
+
+  const std::string name = object_store_chunk_name(
+      store_ctxt, store_file->path, store_file->chunk_idx++);
+
+  {
+    std::lock_guard<std::mutex> lock(store_file->mutex);
+    store_file->in_flight++;
+  }
+  ds_object_store_uploads_in_flight++;
+
+  /* the upload is traced as a request ending on the thread of the handler */
+  const bool traced = xb::trace::is_enabled();
+  const uint64_t trace_start = traced ? xb::trace::now() : 0;
+  const uint64_t trace_id = traced ? xb::trace::next_id++ : 0;
+
+  /* blocks while --cloud-parallel uploads are queued already */
+  bool ok = store_ctxt->store->async_upload_object(
+      store_ctxt->container, name, contents, store_ctxt->handler,
+      [store_file, store_ctxt, name, len, trace_start, trace_id](
+          bool success, const Http_buffer &) {
+        if (trace_id != 0) {
+          xb::trace::record("upload", trace_start, len, trace_id);
+        }
+        if (success) {
+          store_ctxt->objects++;
+          store_ctxt->bytes += len;
+        } else {
+          msg_ts("%s: error: failed to upload chunk: %s, size: %zu\n",
+                 my_progname, name.c_str(), len);
+          store_ctxt->has_errors = true;
+        }
+
+        std::lock_guard<std::mutex> lock(store_file->mutex);
+        if (!success) {
+          store_file->failed = true;
+        }
+        store_file->in_flight--;
+        ds_object_store_uploads_in_flight--;
+        store_file->uploaded.notify_all();
+      });
+
+  if (!ok) {
+    std::lock_guard<std::mutex> lock(store_file->mutex);
+    store_file->in_flight--;
+    ds_object_store_uploads_in_flight--;
+    store_ctxt->has_errors = true;
+    return -1;
+  }
+
+  return len;
+}
+
+static ssize_t object_store_upload_buf(xb_wstream_file_t *f, void *userdata,
+                                       const void *buf, size_t len) {
+  struct iovec iov;
+
+  iov.iov_base = const_cast<void *>(buf);
+  iov.iov_len = len;
+
+  return object_store_upload_chunk(f, userdata, &iov, 1);
+}
+
+/** Create the object store client from the S3 options.
+@param[in,out]  store_ctxt  datasink context
+@return false in case of error */
+static bool object_store_connect(ds_object_store_ctxt_t *store_ctxt) {
+  std::shared_ptr<S3_ec2_instance> ec2_instance =
+      std::make_shared<S3_ec2_instance>(&store_ctxt->http_client);
+  std::string access_key =
+      opt_s3_access_key != nullptr ? opt_s3_access_key : "";
+  std::string secret_key =
+      opt_s3_secret_key != nullptr ? opt_s3_secret_key : "";
+  std::string session_token =
+      opt_s3_session_token != nullptr ? opt_s3_session_token : "";
+
+  if (opt_s3_bucket == nullptr) {
+    msg_ts("%s: S3 bucket is not specified.\n", my_progname);
+    return false;
+  }
+
+  if (access_key.empty() && secret_key.empty() && session_token.empty() &&
+      ec2_instance->fetch_metadata() &&
+      ec2_instance->get_is_ec2_instance_with_profile()) {
+    access_key = ec2_instance->get_access_key();
+    secret_key = ec2_instance->get_secret_key();
+    session_token = ec2_instance->get_session_token();
+    msg_ts("%s: Using instance metadata for access and secret key\n",
+           my_progname);
+  }
+
+  if (access_key.empty()) {
+    msg_ts("%s: S3 access key is not specified.\n", my_progname);
+    return false;
+  }
+  if (secret_key.empty()) {
+    msg_ts("%s: S3 secret key is not specified.\n", my_progname);
+    return false;
+  }
+
+  std::string region =
+      opt_s3_region != nullptr ? opt_s3_region : default_s3_region;
+  std::string storage_class =
+      opt_s3_storage_class != nullptr ? opt_s3_storage_class : "";
+
+  S3_object_store *s3_store = new S3_object_store(
+      &store_ctxt->http_client, region, access_key, secret_key, session_token,
+      storage_class, opt_cloud_max_retries, opt_cloud_max_backoff,
+      opt_s3_endpoint != nullptr ? opt_s3_endpoint : "",
+      static_cast<s3_bucket_lookup_t>(opt_s3_bucket_lookup),
+      static_cast<s3_api_version_t>(opt_s3_api_version));
+  store_ctxt->store = std::unique_ptr<Object_store>(s3_store);
+  store_ctxt->container = opt_s3_bucket;
+
+  if (!s3_store->probe_api_version_and_lookup(store_ctxt->container)) {
+    return false;
+  }
+  if (ec2_instance->get_is_ec2_instance_with_profile()) {
+    s3_store->set_ec2_instance(ec2_instance);
+  }
+
+  return true;
+}
+
+static ds_ctxt_t *object_store_init(const char *root) {
+  ds_object_store_ctxt_t *store_ctxt = new ds_object_store_ctxt_t;
+  std::vector<std::string> objects;
+  bool exists;
+
+  xb_a(opt_cloud_put != nullptr);
+  store_ctxt->backup_name = opt_cloud_put;
+
+  http_init();
+
+  if (opt_cloud_insecure) {
+    store_ctxt->http_client.set_insecure(true);
+  }
+  if (opt_cloud_cacert != nullptr) {
+    store_ctxt->http_client.set_cacaert(opt_cloud_cacert);
+  }
+
+  if (!object_store_connect(store_ctxt)) {
+    goto err;
+  }
+
+  if (!store_ctxt->store->container_exists(store_ctxt->container, exists)) {
+    goto err;
+  }
+  if (!exists && !store_ctxt->store->create_container(store_ctxt->container)) {
+    goto err;
+  }
+
+  if (!store_ctxt->store->list_objects_in_directory(
+          store_ctxt->container, store_ctxt->backup_name, objects)) {
+    goto err;
+  }
+  if (!objects.empty()) {
+    msg_ts("%s: error: backup named %s already exists!\n", my_progname,
+           store_ctxt->backup_name.c_str());
+    goto err;
+  }
+
+  store_ctxt->handler = new Event_handler(opt_cloud_parallel);
+  if (!store_ctxt->handler->init()) {
+    msg_ts("%s: Failed to initialize event handler.\n", my_progname);
+    goto err;
+  }
+  store_ctxt->event_loop = store_ctxt->handler->run();
+
+  msg_ts("%s: Uploading backup %s to bucket %s\n", my_progname,
+         store_ctxt->backup_name.c_str(), store_ctxt->container.c_str());
+
+  {
+    ds_ctxt_t *ctxt = new ds_ctxt_t;
+    ctxt->ptr = store_ctxt;
+    ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
+    ctxt->pipe_ctxt = NULL;
+    return ctxt;
+  }
+
+err:
+  delete store_ctxt->handler;
+  delete store_ctxt;
+  http_cleanup();
+  return NULL;
+}
+
+static ds_file_t *object_store_open(ds_ctxt_t *ctxt, const char *path,
+                                    MY_STAT *mystat) {
+  ds_object_store_ctxt_t *store_ctxt = (ds_object_store_ctxt_t *)ctxt->ptr;
+  ds_object_store_file_t *store_file;
+  ds_file_t *file;
+
+  store_file = new ds_object_store_file_t;
+  store_file->store_ctxt = store_ctxt;
+  store_file->path = path;
+  store_file->xbstream = xb_stream_write_new();
+  store_file->xbstream_file = xb_stream_write_open(
+      store_file->xbstream, path, mystat, store_file, object_store_upload_buf,
+      object_store_upload_chunk);
+  if (store_file->xbstream_file == NULL) {
+    msg("xb_stream_write_open() failed.\n");
+    xb_stream_write_done(store_file->xbstream);
+    delete store_file;
+    return NULL;
+  }
+
+  file = (ds_file_t *)my_malloc(PSI_NOT_INSTRUMENTED, sizeof(ds_file_t),
+                                MYF(MY_FAE));
+  file->ptr = store_file;
+  file->path = const_cast<char *>(store_file->path.c_str());
+
+  return file;
+}
+
+static int object_store_write(ds_file_t *file, const void *buf, size_t len) {
+  ds_object_store_file_t *store_file = (ds_object_store_file_t *)file->ptr;
+
+  if (xb_stream_write_data(store_file->xbstream_file, buf, len)) {
+    msg("xb_stream_write_data() failed.\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/* the buffered data becomes a chunk object of its own */
+static int object_store_flush(ds_file_t *file) {
+  ds_object_store_file_t *store_file = (ds_object_store_file_t *)file->ptr;
+
+  if (xb_stream_write_flush(store_file->xbstream_file)) {
+    msg("xb_stream_write_flush() failed.\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+static int object_store_write_sparse(ds_file_t *file, const void *buf,
+                                     size_t len, size_t sparse_map_size,
+                                     const ds_sparse_chunk_t *sparse_map,
+                                     bool punch_hole_supported
+                                     __attribute__((unused))) {
+  ds_object_store_file_t *store_file = (ds_object_store_file_t *)file->ptr;
+
+  if (xb_stream_write_sparse_data(store_file->xbstream_file, buf, len,
+                                  sparse_map_size, sparse_map)) {
+    msg("xb_stream_write_sparse_data() failed.\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+static int object_store_writev(ds_file_t *file, const struct iovec *iov,
+                               int iovcnt) {
+  ds_object_store_file_t *store_file = (ds_object_store_file_t *)file->ptr;
+
+  if (xb_stream_write_datav(store_file->xbstream_file, iov, iovcnt)) {
+    msg("xb_stream_write_datav() failed.\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+static int object_store_write_lease(ds_file_t *file, ds_lease_t *lease) {
+  ds_object_store_file_t *store_file = (ds_object_store_file_t *)file->ptr;
+
+  if (xb_stream_write_lease(store_file->xbstream_file, lease)) {
+    msg("xb_stream_write_lease() failed.\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+static int object_store_close(ds_file_t *file) {
+  ds_object_store_file_t *store_file = (ds_object_store_file_t *)file->ptr;
+  int ret;
+
+  /* uploads the last chunks including the EOF one */
+  ret = xb_stream_write_close(store_file->xbstream_file);
+
+  {
+    std::unique_lock<std::mutex> lock(store_file->mutex);
+    store_file->uploaded.wait(
+        lock, [store_file] { return store_file->in_flight == 0; });
+    if (store_file->failed) {
+      ret = 1;
+    }
+  }
+
+  xb_stream_write_done(store_file->xbstream);
+
+  delete store_file;
+  my_free(file);
+
+  return ret;
+}
+
+static void object_store_deinit(ds_ctxt_t *ctxt) {
+  ds_object_store_ctxt_t *store_ctxt = (ds_object_store_ctxt_t *)ctxt->ptr;
+
+  store_ctxt->handler->stop();
+  store_ctxt->event_loop.join();
+
+  if (store_ctxt->has_errors) {
+    msg_ts("%s: Upload of backup %s failed.\n", my_progname,
+           store_ctxt->backup_name.c_str());
+  } else {
+    msg_ts("%s: Uploaded %llu chunks, %llu MB of backup %s.\n", my_progname,
+           (unsigned long long)store_ctxt->objects.load(),
+           (unsigned long long)(store_ctxt->bytes >> 20),
+           store_ctxt->backup_name.c_str());
+  }
+
+  delete store_ctxt->handler;
+  delete store_ctxt;
+  http_cleanup();
+
+  my_free(ctxt->root);
+  delete ctxt;
+}
@@ -0,0 +1,37 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+Object store datasink interface for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef DS_OBJECT_STORE_H
+#define DS_OBJECT_STORE_H
+
+#include <stdint.h>
+#include <atomic>
+#include "datasink.h"
+
+/* Uploads the xbstream chunks of every file directly to an S3 compatible
+object store, laid out the same way as "xbcloud put" does, so that the backup
+can be downloaded with "xbcloud get". Only linked into xtrabackup, so it is
+created with ds_create_from(). */
+extern datasink_t datasink_object_store;
+
+/* Chunk uploads started and not completed yet, of all files */
+extern std::atomic<uint64_t> ds_object_store_uploads_in_flight;
+
+#endif
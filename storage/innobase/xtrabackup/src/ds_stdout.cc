@@ -19,37 +19,71 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 *******************************************************/
 
 #include <my_base.h>
+#include <my_sys.h>
+#include <my_thread_local.h>
 #include <mysql/service_mysql_alloc.h>
 #include <mysys_err.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
 #include "common.h"
 #include "datasink.h"
+#include "ds_stdout.h"
+#include "msg.h"
+
+typedef struct {
+  bool zero_copy;
+} ds_stdout_ctxt_t;
 
 typedef struct {
   File fd;
+  bool vmsplice; /* stdout is a pipe the buffers are moved into */
 } ds_stdout_file_t;
 
 static ds_ctxt_t *stdout_init(const char *root);
 static ds_file_t *stdout_open(ds_ctxt_t *ctxt, const char *path,
                               MY_STAT *mystat);
 static int stdout_write(ds_file_t *file, const void *buf, size_t len);
+static int stdout_writev(ds_file_t *file, const struct iovec *iov,
+                         int iovcnt);
 static int stdout_close(ds_file_t *file);
 static void stdout_deinit(ds_ctxt_t *ctxt);
 
-datasink_t datasink_stdout = {&stdout_init, &stdout_open,  &stdout_write,
-                              nullptr,      &stdout_close, &stdout_deinit};
+datasink_t datasink_stdout = {&stdout_init,  &stdout_open,   &stdout_write,
+                              nullptr,       &stdout_writev, nullptr,
+                              &stdout_close, &stdout_deinit, nullptr};
 
 static ds_ctxt_t *stdout_init(const char *root) {
   ds_ctxt_t *ctxt;
 
   ctxt = static_cast<ds_ctxt_t *>(
-      my_malloc(PSI_NOT_INSTRUMENTED, sizeof(ds_ctxt_t), MYF(MY_FAE)));
+      my_malloc(PSI_NOT_INSTRUMENTED,
+                sizeof(ds_ctxt_t) + sizeof(ds_stdout_ctxt_t), MYF(MY_FAE)));
 
   ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
 
+  ds_stdout_ctxt_t *stdout_ctxt = (ds_stdout_ctxt_t *)(ctxt + 1);
+  stdout_ctxt->zero_copy = false;
+  ctxt->ptr = stdout_ctxt;
+
   return ctxt;
 }
 
-static ds_file_t *stdout_open(ds_ctxt_t *ctxt __attribute__((unused)),
+void ds_stdout_set_zero_copy(ds_ctxt_t *ctxt, bool zero_copy) {
+  ds_stdout_ctxt_t *stdout_ctxt = (ds_stdout_ctxt_t *)ctxt->ptr;
+
+  stdout_ctxt->zero_copy = zero_copy;
+}
+
+static ds_file_t *stdout_open(ds_ctxt_t *ctxt,
                               const char *path __attribute__((unused)),
                               MY_STAT *mystat __attribute__((unused))) {
   ds_stdout_file_t *stdout_file;
@@ -69,6 +103,21 @@ static ds_file_t *stdout_open(ds_ctxt_t *ctxt __attribute__((unused)),
 #endif
 
   stdout_file->fd = fileno(stdout);
+  stdout_file->vmsplice = false;
+
+  if (((ds_stdout_ctxt_t *)ctxt->ptr)->zero_copy) {
+#ifdef __linux__
+    struct stat stat_info;
+    if (fstat(stdout_file->fd, &stat_info) == 0 &&
+        S_ISFIFO(stat_info.st_mode)) {
+      stdout_file->vmsplice = true;
+    }
+#endif
+    if (!stdout_file->vmsplice) {
+      msg("Warning: STDOUT is not a pipe, the stream is "
+          "written with copies.\n");
+    }
+  }
 
   file->path = (char *)stdout_file + sizeof(ds_stdout_file_t);
   memcpy(file->path, fullpath, pathlen);
@@ -90,6 +139,81 @@ static int stdout_write(ds_file_t *file, const void *buf, size_t len) {
   return 1;
 }
 
+#ifdef __linux__
+/** Move a sequence of buffers into a pipe with vmsplice(). The pipe keeps
+referencing the memory of the buffers instead of a copy, so the reader must
+have consumed them before they can be reused: wait until the pipe is empty.
+@return 0 on success, 1 on error, -1 if the pipe does not take the buffers */
+static int stdout_vmsplice(File fd, const struct iovec *iov, int iovcnt) {
+  std::vector<struct iovec> vec(iov, iov + iovcnt);
+  size_t i = 0;
+  bool moved = false;
+
+  while (i < vec.size()) {
+    const int cnt = std::min<size_t>(vec.size() - i, IOV_MAX);
+    ssize_t written = vmsplice(fd, &vec[i], cnt, 0);
+
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (!moved && (errno == EINVAL || errno == ENOSYS)) {
+        return -1;
+      }
+      char errbuf[MYSYS_STRERROR_SIZE];
+      set_my_errno(errno);
+      my_error(EE_WRITE, MYF(0), my_filename(fd), my_errno(),
+               my_strerror(errbuf, sizeof(errbuf), my_errno()));
+      return 1;
+    }
+    moved = true;
+
+    while (i < vec.size() && static_cast<size_t>(written) >= vec[i].iov_len) {
+      written -= vec[i].iov_len;
+      i++;
+    }
+    if (written > 0) {
+      vec[i].iov_base = static_cast<char *>(vec[i].iov_base) + written;
+      vec[i].iov_len -= written;
+    }
+  }
+
+  /* what the pipe can hold is left when vmsplice() returns, a pipe buffer
+  is only read once so an empty pipe has no references left */
+  int unread;
+  while (ioctl(fd, FIONREAD, &unread) == 0 && unread > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+
+  return 0;
+}
+#endif
+
+static int stdout_writev(ds_file_t *file, const struct iovec *iov,
+                         int iovcnt) {
+  ds_stdout_file_t *stdout_file = (ds_stdout_file_t *)file->ptr;
+  File fd = stdout_file->fd;
+
+#ifdef __linux__
+  if (stdout_file->vmsplice) {
+    const int rc = stdout_vmsplice(fd, iov, iovcnt);
+    if (rc >= 0) {
+      return rc;
+    }
+    msg("Warning: STDOUT does not support vmsplice(), the "
+        "stream is written with copies.\n");
+    stdout_file->vmsplice = false;
+  }
+#endif
+
+  if (!ds_writev_fd(fd, iov, iovcnt)) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    return 0;
+  }
+
+  return 1;
+}
+
 static int stdout_close(ds_file_t *file) {
   my_free(file);
 
@@ -25,4 +25,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 extern datasink_t datasink_stdout;
 
+/* Move the buffers written to stdout into it with vmsplice() instead of
+copying them when stdout is a pipe. Applies to the files opened afterwards. */
+void ds_stdout_set_zero_copy(ds_ctxt_t *ctxt, bool zero_copy);
+
 #endif
@@ -0,0 +1,298 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+Tee datasink for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+/* Writes the same data to several destination datasinks added with
+ds_tee_add_pipe(). By default a failing destination fails the write. In the
+best effort mode a destination failing for one file is dropped for all files,
+the others go on as long as one of them is left. Slow destinations are only
+decoupled from each other if they are preceded by an async datasink. */
+
+#include "ds_tee.h"
+#include <my_base.h>
+#include <mysql/service_mysql_alloc.h>
+#include <mysql_version.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "datasink.h"
+#include "msg.h"
+
+typedef struct {
+  ds_ctxt_t *ctxt;
+  std::string name; /* used in messages */
+  std::atomic<bool> dropped;
+} ds_tee_pipe_t;
+
+typedef struct {
+  std::vector<ds_tee_pipe_t *> pipes;
+  bool best_effort;
+} ds_tee_ctxt_t;
+
+typedef struct {
+  ds_tee_ctxt_t *tee_ctxt;
+  /* destination files, NULL for dropped destinations */
+  std::vector<ds_file_t *> files;
+} ds_tee_file_t;
+
+static ds_ctxt_t *tee_init(const char *root);
+static ds_file_t *tee_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat);
+static int tee_write(ds_file_t *file, const void *buf, size_t len);
+static int tee_write_sparse(ds_file_t *file, const void *buf, size_t len,
+                            size_t sparse_map_size,
+                            const ds_sparse_chunk_t *sparse_map,
+                            bool punch_hole_supported);
+static int tee_writev(ds_file_t *file, const struct iovec *iov, int iovcnt);
+static int tee_close(ds_file_t *file);
+static void tee_deinit(ds_ctxt_t *ctxt);
+static int tee_flush(ds_file_t *file);
+
+datasink_t datasink_tee = {&tee_init,         &tee_open,   &tee_write,
+                           &tee_write_sparse, &tee_writev, nullptr,
+                           &tee_close,        &tee_deinit, &tee_flush};
+
+/* Add a destination datasink, used instead of ds_set_pipe(). The name
+describes the destination in messages. */
+void ds_tee_add_pipe(ds_ctxt_t *ctxt, ds_ctxt_t *pipe_ctxt, const char *name) {
+  ds_tee_ctxt_t *tee_ctxt = (ds_tee_ctxt_t *)ctxt->ptr;
+  ds_tee_pipe_t *pipe = new ds_tee_pipe_t;
+
+  pipe->ctxt = pipe_ctxt;
+  pipe->name = name;
+  pipe->dropped = false;
+  tee_ctxt->pipes.push_back(pipe);
+}
+
+/* Keep writing to the remaining destinations when one of them fails, instead
+of failing the write */
+void ds_tee_set_best_effort(ds_ctxt_t *ctxt, bool best_effort) {
+  ds_tee_ctxt_t *tee_ctxt = (ds_tee_ctxt_t *)ctxt->ptr;
+
+  tee_ctxt->best_effort = best_effort;
+}
+
+static ds_ctxt_t *tee_init(const char *root) {
+  ds_ctxt_t *ctxt;
+  ds_tee_ctxt_t *tee_ctxt;
+
+  ctxt = static_cast<ds_ctxt_t *>(my_malloc(
+      PSI_NOT_INSTRUMENTED, sizeof(ds_ctxt_t), MYF(MY_FAE | MY_ZEROFILL)));
+  tee_ctxt = new ds_tee_ctxt_t;
+  tee_ctxt->best_effort = false;
+
+  ctxt->ptr = tee_ctxt;
+  ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
+
+  return ctxt;
+}
+
+/** Handle the failure of a destination.
+@param[in]  tee_file  tee file
+@param[in]  i         number of the failed destination
+@return true if the failure must be reported to the caller */
+static bool tee_fail(ds_tee_file_t *tee_file, size_t i) {
+  ds_tee_ctxt_t *tee_ctxt = tee_file->tee_ctxt;
+
+  if (!tee_ctxt->best_effort) {
+    return true;
+  }
+
+  if (!tee_ctxt->pipes[i]->dropped.exchange(true)) {
+    msg_ts("Dropping backup destination %s, its copy of the backup is "
+           "incomplete.\n",
+           tee_ctxt->pipes[i]->name.c_str());
+  }
+
+  for (auto pipe : tee_ctxt->pipes) {
+    if (!pipe->dropped) {
+      return false;
+    }
+  }
+
+  msg_ts("All backup destinations have failed.\n");
+  return true;
+}
+
+static ds_file_t *tee_open(ds_ctxt_t *ctxt, const char *path,
+                           MY_STAT *mystat) {
+  ds_tee_ctxt_t *tee_ctxt = (ds_tee_ctxt_t *)ctxt->ptr;
+  ds_tee_file_t *tee_file;
+  ds_file_t *file;
+
+  xb_a(!tee_ctxt->pipes.empty());
+
+  tee_file = new ds_tee_file_t;
+  tee_file->tee_ctxt = tee_ctxt;
+  tee_file->files.resize(tee_ctxt->pipes.size(), NULL);
+
+  file = (ds_file_t *)my_malloc(PSI_NOT_INSTRUMENTED, sizeof(ds_file_t),
+                                MYF(MY_FAE | MY_ZEROFILL));
+  file->ptr = tee_file;
+
+  for (size_t i = 0; i < tee_ctxt->pipes.size(); i++) {
+    if (tee_ctxt->pipes[i]->dropped) {
+      continue;
+    }
+    tee_file->files[i] = ds_open(tee_ctxt->pipes[i]->ctxt, path, mystat);
+    if (tee_file->files[i] == NULL && tee_fail(tee_file, i)) {
+      tee_close(file);
+      return NULL;
+    }
+    if (file->path == NULL && tee_file->files[i] != NULL) {
+      file->path = tee_file->files[i]->path;
+    }
+  }
+
+  return file;
+}
+
+static int tee_writev(ds_file_t *file, const struct iovec *iov, int iovcnt) {
+  ds_tee_file_t *tee_file = (ds_tee_file_t *)file->ptr;
+  ds_tee_ctxt_t *tee_ctxt = tee_file->tee_ctxt;
+
+  for (size_t i = 0; i < tee_file->files.size(); i++) {
+    if (tee_file->files[i] == NULL || tee_ctxt->pipes[i]->dropped) {
+      continue;
+    }
+    if (ds_writev(tee_file->files[i], iov, iovcnt) && tee_fail(tee_file, i)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int tee_write(ds_file_t *file, const void *buf, size_t len) {
+  struct iovec iov;
+
+  iov.iov_base = const_cast<void *>(buf);
+  iov.iov_len = len;
+
+  return tee_writev(file, &iov, 1);
+}
+
+/** Write sparse data to a destination without sparse file support, with the
+holes written as zeroes.
+@return 0 on success, 1 on error */
+static int tee_write_holes(ds_file_t *file, const char *buf,
+                           size_t sparse_map_size,
+                           const ds_sparse_chunk_t *sparse_map) {
+  static const char zeroes[64 * 1024] = {};
+
+  for (size_t i = 0; i < sparse_map_size; i++) {
+    for (size_t skip = sparse_map[i].skip; skip > 0;) {
+      const size_t n = std::min(skip, sizeof(zeroes));
+      if (ds_write(file, zeroes, n)) {
+        return 1;
+      }
+      skip -= n;
+    }
+    if (sparse_map[i].len > 0 && ds_write(file, buf, sparse_map[i].len)) {
+      return 1;
+    }
+    buf += sparse_map[i].len;
+  }
+
+  return 0;
+}
+
+/* Destinations supporting sparse files get the payload of the pages and the
+sparse map, the others get the holes as zeroes. */
+static int tee_write_sparse(ds_file_t *file, const void *buf, size_t len,
+                            size_t sparse_map_size,
+                            const ds_sparse_chunk_t *sparse_map,
+                            bool punch_hole_supported) {
+  ds_tee_file_t *tee_file = (ds_tee_file_t *)file->ptr;
+  ds_tee_ctxt_t *tee_ctxt = tee_file->tee_ctxt;
+
+  for (size_t i = 0; i < tee_file->files.size(); i++) {
+    ds_file_t *dest_file = tee_file->files[i];
+    if (dest_file == NULL || tee_ctxt->pipes[i]->dropped) {
+      continue;
+    }
+    const int err =
+        ds_is_sparse_write_supported(dest_file)
+            ? ds_write_sparse(dest_file, buf, len, sparse_map_size, sparse_map,
+                              punch_hole_supported)
+            : tee_write_holes(dest_file, static_cast<const char *>(buf),
+                              sparse_map_size, sparse_map);
+    if (err && tee_fail(tee_file, i)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int tee_flush(ds_file_t *file) {
+  ds_tee_file_t *tee_file = (ds_tee_file_t *)file->ptr;
+  ds_tee_ctxt_t *tee_ctxt = tee_file->tee_ctxt;
+
+  for (size_t i = 0; i < tee_file->files.size(); i++) {
+    if (tee_file->files[i] == NULL || tee_ctxt->pipes[i]->dropped) {
+      continue;
+    }
+    if (ds_flush(tee_file->files[i]) && tee_fail(tee_file, i)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int tee_close(ds_file_t *file) {
+  ds_tee_file_t *tee_file = (ds_tee_file_t *)file->ptr;
+  ds_tee_ctxt_t *tee_ctxt = tee_file->tee_ctxt;
+  int ret = 0;
+
+  for (size_t i = 0; i < tee_file->files.size(); i++) {
+    if (tee_file->files[i] == NULL) {
+      continue;
+    }
+    /* files of dropped destinations are closed as well to release them, the
+    result does not matter anymore */
+    const bool dropped = tee_ctxt->pipes[i]->dropped;
+    if (ds_close(tee_file->files[i]) && !dropped && tee_fail(tee_file, i)) {
+      ret = 1;
+    }
+  }
+
+  delete tee_file;
+  my_free(file);
+
+  return ret;
+}
+
+static void tee_deinit(ds_ctxt_t *ctxt) {
+  ds_tee_ctxt_t *tee_ctxt = (ds_tee_ctxt_t *)ctxt->ptr;
+
+  for (auto pipe : tee_ctxt->pipes) {
+    if (pipe->dropped) {
+      msg_ts("Warning: the copy of the backup sent to %s is incomplete.\n",
+             pipe->name.c_str());
+    }
+    delete pipe;
+  }
+
+  delete tee_ctxt;
+  my_free(ctxt->root);
+  my_free(ctxt);
+}
@@ -0,0 +1,44 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+Tee datasink for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef DS_TEE_H
+#define DS_TEE_H
+
+#include "datasink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern datasink_t datasink_tee;
+
+/* Add a destination datasink, used instead of ds_set_pipe(). The name
+describes the destination in messages. */
+void ds_tee_add_pipe(ds_ctxt_t *ctxt, ds_ctxt_t *pipe_ctxt, const char *name);
+
+/* Keep writing to the remaining destinations when one of them fails, instead
+of failing the write */
+void ds_tee_set_best_effort(ds_ctxt_t *ctxt, bool best_effort);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
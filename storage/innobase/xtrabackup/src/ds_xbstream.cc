@@ -22,10 +22,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <my_io.h>
 #include <mysql/service_mysql_alloc.h>
 #include <mysql_version.h>
+#include <algorithm>
+#include <atomic>
 #include <list>
 #include <mutex>
+#include <random>
 #include "common.h"
 #include "datasink.h"
+#include "ds_xbstream.h"
 #include "msg.h"
 #include "xbstream.h"
 
@@ -33,6 +37,11 @@ typedef struct {
   xb_wstream_t *xbstream;
   ds_file_t *dest_file;
   std::mutex mutex;
+  /* files open on the stream, protected by the parallel stream mutex */
+  uint n_files;
+  /* bytes left to write of the files open on the stream, according to
+  their size when they were opened */
+  std::atomic<uint64_t> queued_bytes;
 } ds_stream_ctxt_t;
 
 typedef struct {
@@ -43,9 +52,18 @@ typedef struct {
 typedef struct {
   xb_wstream_file_t *xbstream_file;
   ds_stream_ctxt_t *stream_ctxt;
+  ds_parallel_stream_ctxt_t *parallel_stream_ctxt;
+  /* bytes of the file counted in stream_ctxt->queued_bytes */
+  uint64_t queued_bytes;
 } ds_stream_file_t;
 
 extern uint xtrabackup_fifo_streams;
+extern bool xtrabackup_stream_crc32c;
+extern bool xtrabackup_stream_index;
+extern ulonglong xtrabackup_stream_chunk_size;
+extern bool xtrabackup_stream_detect_holes;
+extern bool xtrabackup_stream_skip_checksum;
+extern ulong xtrabackup_stream_balance;
 /***********************************************************************
 General streaming interface */
 
@@ -57,12 +75,18 @@ static int xbstream_write_sparse(ds_file_t *file, const void *buf, size_t len,
                                  size_t sparse_map_size,
                                  const ds_sparse_chunk_t *sparse_map,
                                  bool punch_hole_supported);
+static int xbstream_writev(ds_file_t *file, const struct iovec *iov,
+                           int iovcnt);
+static int xbstream_write_lease(ds_file_t *file, ds_lease_t *lease);
 static int xbstream_close(ds_file_t *file);
 static void xbstream_deinit(ds_ctxt_t *ctxt);
+static int xbstream_flush(ds_file_t *file);
 
-datasink_t datasink_xbstream = {&xbstream_init,  &xbstream_open,
-                                &xbstream_write, &xbstream_write_sparse,
-                                &xbstream_close, &xbstream_deinit};
+datasink_t datasink_xbstream = {&xbstream_init,   &xbstream_open,
+                                &xbstream_write,  &xbstream_write_sparse,
+                                &xbstream_writev, &xbstream_write_lease,
+                                &xbstream_close,  &xbstream_deinit,
+                                &xbstream_flush};
 
 static ssize_t my_xbstream_write_callback(xb_wstream_file_t *f
                                           __attribute__((unused)),
@@ -81,10 +105,35 @@ static ssize_t my_xbstream_write_callback(xb_wstream_file_t *f
   return -1;
 }
 
+static ssize_t my_xbstream_writev_callback(xb_wstream_file_t *f
+                                           __attribute__((unused)),
+                                           void *userdata,
+                                           const struct iovec *iov,
+                                           int iovcnt) {
+  ds_stream_ctxt_t *stream_ctxt;
+
+  stream_ctxt = (ds_stream_ctxt_t *)userdata;
+
+  xb_ad(stream_ctxt != NULL);
+  xb_ad(stream_ctxt->dest_file != NULL);
+
+  if (!ds_writev(stream_ctxt->dest_file, iov, iovcnt)) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+    return len;
+  }
+  return -1;
+}
+
 static ds_ctxt_t *xbstream_init(const char *root __attribute__((unused))) {
   ds_ctxt_t *ctxt;
   ds_parallel_stream_ctxt_t *parallel_stream_ctxt =
       new ds_parallel_stream_ctxt_t;
+  char backup_id[32];
+
+  /* tells the streams of this backup apart from the ones of other backups */
+  snprintf(backup_id, sizeof(backup_id), "%08lx%08x", (ulong)time(nullptr),
+           (uint)std::random_device()());
 
   ctxt = static_cast<ds_ctxt_t *>(
       my_malloc(PSI_NOT_INSTRUMENTED,
@@ -100,8 +149,21 @@ static ds_ctxt_t *xbstream_init(const char *root __attribute__((unused))) {
       msg("xb_stream_write_new() failed.\n");
       goto err;
     }
+    xb_stream_write_set_crc32c(xbstream, xtrabackup_stream_crc32c);
+    xb_stream_write_set_skip_checksum(xbstream,
+                                      xtrabackup_stream_skip_checksum);
+    xb_stream_write_set_index(xbstream, xtrabackup_stream_index);
+    xb_stream_write_set_chunk_size(xbstream, xtrabackup_stream_chunk_size);
+    xb_stream_write_set_detect_holes(xbstream,
+                                     xtrabackup_stream_detect_holes);
+    if (xtrabackup_fifo_streams > 1) {
+      xb_stream_write_set_manifest(xbstream, backup_id,
+                                   xtrabackup_fifo_streams, i);
+    }
     stream_ctxt->xbstream = xbstream;
     stream_ctxt->dest_file = NULL;
+    stream_ctxt->n_files = 0;
+    stream_ctxt->queued_bytes = 0;
     parallel_stream_ctxt->ctx_list.push_back(stream_ctxt);
   }
 
@@ -129,8 +191,32 @@ static ds_file_t *xbstream_open(ds_ctxt_t *ctxt, const char *path,
 
   parallel_stream_ctxt = (ds_parallel_stream_ctxt_t *)ctxt->ptr;
   parallel_stream_ctxt->mutex.lock();
-  stream_ctxt = parallel_stream_ctxt->ctx_list.front();
-  parallel_stream_ctxt->ctx_list.pop_front();
+  auto stream_it = parallel_stream_ctxt->ctx_list.begin();
+  if (xtrabackup_stream_balance == DS_XBSTREAM_BALANCE_LEAST_LOADED) {
+    /* the first one of the least loaded, they are rotated like with
+    round-robin in case of a tie */
+    for (auto it = stream_it; it != parallel_stream_ctxt->ctx_list.end();
+         ++it) {
+      if ((*it)->n_files < (*stream_it)->n_files) {
+        stream_it = it;
+      }
+    }
+  } else if (xtrabackup_stream_balance == DS_XBSTREAM_BALANCE_LEAST_BYTES) {
+    for (auto it = stream_it; it != parallel_stream_ctxt->ctx_list.end();
+         ++it) {
+      if ((*it)->queued_bytes < (*stream_it)->queued_bytes) {
+        stream_it = it;
+      }
+    }
+  }
+  stream_ctxt = *stream_it;
+  stream_ctxt->n_files++;
+  /* the size of the source file, the data written may be smaller once
+  compressed but it is about the same for all the streams */
+  const uint64_t queued_bytes =
+      mystat != nullptr && mystat->st_size > 0 ? mystat->st_size : 0;
+  stream_ctxt->queued_bytes += queued_bytes;
+  parallel_stream_ctxt->ctx_list.erase(stream_it);
   parallel_stream_ctxt->ctx_list.push_back(stream_ctxt);
   parallel_stream_ctxt->mutex.unlock();
 
@@ -151,7 +237,8 @@ static ds_file_t *xbstream_open(ds_ctxt_t *ctxt, const char *path,
   xbstream = stream_ctxt->xbstream;
 
   xbstream_file = xb_stream_write_open(xbstream, path, mystat, stream_ctxt,
-                                       my_xbstream_write_callback);
+                                       my_xbstream_write_callback,
+                                       my_xbstream_writev_callback);
 
   if (xbstream_file == NULL) {
     msg("xb_stream_write_open() failed.\n");
@@ -160,12 +247,18 @@ static ds_file_t *xbstream_open(ds_ctxt_t *ctxt, const char *path,
 
   stream_file->xbstream_file = xbstream_file;
   stream_file->stream_ctxt = stream_ctxt;
+  stream_file->parallel_stream_ctxt = parallel_stream_ctxt;
+  stream_file->queued_bytes = queued_bytes;
   file->ptr = stream_file;
   file->path = stream_ctxt->dest_file->path;
 
   return file;
 
 err:
+  parallel_stream_ctxt->mutex.lock();
+  stream_ctxt->n_files--;
+  parallel_stream_ctxt->mutex.unlock();
+  stream_ctxt->queued_bytes -= queued_bytes;
   if (stream_ctxt->dest_file) {
     ds_close(stream_ctxt->dest_file);
     stream_ctxt->dest_file = NULL;
@@ -175,6 +268,18 @@ err:
   return NULL;
 }
 
+/** Account for data written to a file in the bytes queued on its stream.
+@param[in,out]  stream_file  file
+@param[in]      len          bytes written */
+static void xbstream_dequeue(ds_stream_file_t *stream_file, uint64_t len) {
+  const uint64_t n = std::min(len, stream_file->queued_bytes);
+
+  if (n > 0) {
+    stream_file->queued_bytes -= n;
+    stream_file->stream_ctxt->queued_bytes -= n;
+  }
+}
+
 static int xbstream_write(ds_file_t *file, const void *buf, size_t len) {
   ds_stream_file_t *stream_file;
   xb_wstream_file_t *xbstream_file;
@@ -188,6 +293,19 @@ static int xbstream_write(ds_file_t *file, const void *buf, size_t len) {
     return 1;
   }
 
+  xbstream_dequeue(stream_file, len);
+
+  return 0;
+}
+
+static int xbstream_flush(ds_file_t *file) {
+  ds_stream_file_t *stream_file = (ds_stream_file_t *)file->ptr;
+
+  if (xb_stream_write_flush(stream_file->xbstream_file)) {
+    msg("xb_stream_write_flush() failed.\n");
+    return 1;
+  }
+
   return 0;
 }
 
@@ -208,6 +326,60 @@ static int xbstream_write_sparse(ds_file_t *file, const void *buf, size_t len,
     return 1;
   }
 
+  /* the holes count as written */
+  uint64_t file_len = 0;
+  for (size_t i = 0; i < sparse_map_size; i++) {
+    file_len += sparse_map[i].skip + sparse_map[i].len;
+  }
+  xbstream_dequeue(stream_file, file_len);
+
+  return 0;
+}
+
+static int xbstream_writev(ds_file_t *file, const struct iovec *iov,
+                           int iovcnt) {
+  ds_stream_file_t *stream_file;
+  xb_wstream_file_t *xbstream_file;
+
+  stream_file = (ds_stream_file_t *)file->ptr;
+
+  xbstream_file = stream_file->xbstream_file;
+
+  if (xb_stream_write_datav(xbstream_file, iov, iovcnt)) {
+    msg("xb_stream_write_datav() failed.\n");
+    return 1;
+  }
+
+  uint64_t len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+  xbstream_dequeue(stream_file, len);
+
+  return 0;
+}
+
+static int xbstream_write_lease(ds_file_t *file, ds_lease_t *lease) {
+  ds_stream_file_t *stream_file;
+  xb_wstream_file_t *xbstream_file;
+
+  stream_file = (ds_stream_file_t *)file->ptr;
+
+  xbstream_file = stream_file->xbstream_file;
+
+  /* the lease may be given back before xb_stream_write_lease() returns */
+  uint64_t len = 0;
+  for (int i = 0; i < lease->iovcnt; i++) {
+    len += lease->iov[i].iov_len;
+  }
+
+  if (xb_stream_write_lease(xbstream_file, lease)) {
+    msg("xb_stream_write_lease() failed.\n");
+    return 1;
+  }
+
+  xbstream_dequeue(stream_file, len);
+
   return 0;
 }
 
@@ -219,6 +391,12 @@ static int xbstream_close(ds_file_t *file) {
 
   rc = xb_stream_write_close(stream_file->xbstream_file);
 
+  stream_file->parallel_stream_ctxt->mutex.lock();
+  stream_file->stream_ctxt->n_files--;
+  stream_file->parallel_stream_ctxt->mutex.unlock();
+  /* the file may have shrunk since it was opened */
+  stream_file->stream_ctxt->queued_bytes -= stream_file->queued_bytes;
+
   my_free(file);
 
   return rc;
@@ -25,4 +25,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 extern datasink_t datasink_xbstream;
 
+/* How the files are distributed over the streams of --fifo-streams or
+--stream-fds */
+enum ds_xbstream_balance_t {
+  /* each file goes to the next stream */
+  DS_XBSTREAM_BALANCE_ROUND_ROBIN,
+  /* each file goes to the stream with the fewest files being written, so
+  that slow streams get fewer files */
+  DS_XBSTREAM_BALANCE_LEAST_LOADED,
+  /* each file goes to the stream with the fewest bytes left to write of
+  the files being written, so that huge files do not pile up on a stream */
+  DS_XBSTREAM_BALANCE_LEAST_BYTES
+};
+
 #endif
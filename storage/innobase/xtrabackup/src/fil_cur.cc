@@ -24,31 +24,53 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 #include <my_base.h>
 
+#include <buf0checksum.h>
 #include <fil0fil.h>
 #include <fsp0sysspace.h>
+#include <log0recv.h>
 #include <srv0start.h>
 #include <trx0sys.h>
 #include <univ.i>
 
 #include "common.h"
 #include "fil_cur.h"
+#include "fil_cur_aio.h"
+#include "io_buffer_pool.h"
+#include "io_throttle.h"
+#include "keyring_plugins.h"
 #include "read_filt.h"
+#include "trace.h"
+#include "wait_state.h"
 #include "xb0xb.h"
 #include "xb_dict.h"
 #include "xtrabackup.h"
 
+std::atomic<uint64_t> xb_fil_cur_read_direct{0};
+std::atomic<uint64_t> xb_fil_cur_read_dropped{0};
+std::atomic<uint64_t> xb_fil_cur_read_cached{0};
+std::atomic<uint64_t> xb_fil_cur_read_usecs{0};
+
 /***********************************************************************
 Reads the space flags from a given data file and returns the
-page size and whether the file is compressable. */
+page size and whether the file is compressable. Tries to read len bytes from
+the beginning of the file into buf and sets n_read to len if that succeeded,
+otherwise reads just the first page and sets n_read to 0. */
 static bool xb_get_zip_size(const char *file_name, pfs_os_file_t file,
-                            byte *buf, page_size_t &page_size,
-                            bool &is_encrypted) {
+                            byte *buf, ulint len, ulint &n_read,
+                            page_size_t &page_size, bool &is_encrypted) {
   IORequest read_request(IORequest::READ | IORequest::NO_COMPRESSION);
-  const auto ret =
-      os_file_read(read_request, file_name, file, buf, 0, UNIV_PAGE_SIZE_MIN);
-  if (!ret) {
-    xb::warn() << "Failed to read file from server directory " << file_name;
-    return (false);
+  if (len > UNIV_PAGE_SIZE_MIN &&
+      os_file_read_no_error_handling(read_request, file_name, file, buf, 0, len,
+                                     nullptr) == DB_SUCCESS) {
+    n_read = len;
+  } else {
+    n_read = 0;
+    const auto ret = os_file_read(read_request, file_name, file, buf, 0,
+                                  UNIV_PAGE_SIZE_MIN);
+    if (!ret) {
+      xb::warn() << "Failed to read file from server directory " << file_name;
+      return (false);
+    }
   }
 
   space_id_t space = mach_read_from_4(buf + FIL_PAGE_ARCH_LOG_NO_OR_SPACE_ID);
@@ -105,6 +127,43 @@ const char *xb_get_relative_path(
   }
 }
 
+/** Set up the page cache policy for a source file as requested by
+--source-read-mode.
+@param[in]  fd    source file descriptor
+@param[in]  name  source file name
+@return true if the file is read with O_DIRECT */
+static bool xb_fil_cur_set_read_mode(int fd, const char *name) {
+  switch (opt_source_read_mode) {
+    case SOURCE_READ_MODE_AUTO:
+      if (srv_unix_file_flush_method == SRV_UNIX_O_DIRECT ||
+          srv_unix_file_flush_method == SRV_UNIX_O_DIRECT_NO_FSYNC) {
+        os_file_set_nocache(fd, name, "OPEN");
+      }
+      break;
+    case SOURCE_READ_MODE_DIRECT:
+      os_file_set_nocache(fd, name, "OPEN");
+      break;
+    case SOURCE_READ_MODE_BUFFERED:
+#ifdef O_DIRECT
+    {
+      /* the handle may have been opened with O_DIRECT by InnoDB */
+      const int flags = fcntl(fd, F_GETFL);
+      if (flags != -1 && (flags & O_DIRECT) != 0) {
+        fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+      }
+    }
+#endif
+      break;
+  }
+
+#ifdef O_DIRECT
+  const int flags = fcntl(fd, F_GETFL);
+  return (flags != -1 && (flags & O_DIRECT) != 0);
+#else
+  return (false);
+#endif
+}
+
 /************************************************************************
 Open a source file cursor and initialize the associated read filter.
 
@@ -123,7 +182,10 @@ xb_fil_cur_result_t xb_fil_cur_open(
   /* Initialize these first so xb_fil_cur_close() handles them correctly
   in case of error */
   cursor->orig_buf = NULL;
+  cursor->scratch = NULL;
+  cursor->decrypt = NULL;
   cursor->node = NULL;
+  cursor->aio = NULL;
 
   cursor->space_id = node->space->id;
   cursor->space_flags = node->space->flags;
@@ -139,13 +201,24 @@ xb_fil_cur_result_t xb_fil_cur_open(
   strncpy(cursor->rel_path, xb_get_relative_path(node->space, cursor->abs_path),
           sizeof(cursor->rel_path) - 1);
 
-  /* In the backup mode we should already have a tablespace handle created
-  by fil_load_single_table_tablespace() unless it is a system
-  tablespace or srv_close_files is true. Otherwise we open the file here.
-  srv_close_files has an effect only on IBD tablespaces. */
-  if (cursor->is_system || !srv_backup_mode ||
-      (srv_close_files && cursor->is_ibd)) {
-    if (!fil_node_open_file(node)) {
+  /* The cursor owns its file handle for the whole copy. A handle of the
+  tablespace cache could be closed by the LRU whenever the open files limit
+  is reached, which reopens files over and over with many tablespaces. In
+  the backup mode the handle created by fil_load_single_table_tablespace()
+  is taken over, unless it is a system tablespace or srv_close_files is
+  true. The datafiles copied from a storage snapshot are opened in the
+  snapshot instead, the tablespace cache refers to the live datafiles. */
+  if (opt_snapshot_dir != nullptr) {
+    if (!xb_snapshot_path(node->name, cursor->abs_path,
+                          sizeof(cursor->abs_path))) {
+      return (XB_FIL_CUR_ERROR);
+    }
+
+    bool success;
+    cursor->file = os_file_create_simple_no_error_handling(
+        innodb_data_file_key, cursor->abs_path, OS_FILE_OPEN,
+        OS_FILE_READ_ONLY, true, &success);
+    if (!success) {
       /* The following call prints an error message */
       os_file_get_last_error(true);
 
@@ -153,12 +226,16 @@ xb_fil_cur_result_t xb_fil_cur_open(
 
       return (XB_FIL_CUR_ERROR);
     }
-  }
+  } else if (!fil_node_open_private(node, cursor->file)) {
+    /* The following call prints an error message */
+    os_file_get_last_error(true);
 
-  ut_ad(node->is_open);
+    xb::error() << "cannot open tablespace " << cursor->abs_path;
+
+    return (XB_FIL_CUR_ERROR);
+  }
 
   cursor->node = node;
-  cursor->file = node->handle;
 
   if (my_fstat(cursor->file.m_file, &cursor->statinfo)) {
     xb::error() << "cannot stat " << cursor->abs_path;
@@ -168,22 +245,39 @@ xb_fil_cur_result_t xb_fil_cur_open(
     return (XB_FIL_CUR_ERROR);
   }
 
-  if (srv_unix_file_flush_method == SRV_UNIX_O_DIRECT ||
-      srv_unix_file_flush_method == SRV_UNIX_O_DIRECT_NO_FSYNC) {
-    os_file_set_nocache(cursor->file.m_file, node->name, "OPEN");
-  }
+  cursor->direct_io = xb_fil_cur_set_read_mode(cursor->file.m_file, node->name);
 
-  posix_fadvise(cursor->file.m_file, 0, 0, POSIX_FADV_SEQUENTIAL);
+  /* small files are read with a single read, there is no read-ahead to tune */
+  const uint64_t file_size = cursor->statinfo.st_size;
+  const bool is_small =
+      opt_small_datafile_size > 0 && file_size <= opt_small_datafile_size;
 
-  /* Allocate read buffer */
-  ut_a(opt_read_buffer_size >= UNIV_PAGE_SIZE);
-  cursor->buf_size = opt_read_buffer_size;
-  cursor->orig_buf = static_cast<byte *>(ut::malloc_withkey(
-      UT_NEW_THIS_FILE_PSI_KEY, cursor->buf_size + UNIV_PAGE_SIZE));
-  cursor->buf = static_cast<byte *>(ut_align(cursor->orig_buf, UNIV_PAGE_SIZE));
+  if (!is_small) {
+    posix_fadvise(cursor->file.m_file, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
 
-  /* Determine the page size */
-  if (!xb_get_zip_size(cursor->rel_path, cursor->file, cursor->buf, page_size,
+  /* Allocate read buffer. Files smaller than the buffer only need a buffer
+  as big as the file. */
+  ut_a(opt_read_buffer_size >= UNIV_PAGE_SIZE);
+  cursor->buf_size = std::max<ulint>(opt_read_buffer_size,
+                                     opt_read_buffer_max_size);
+  cursor->buf_size = std::min<ulint>(
+      cursor->buf_size,
+      std::max<uint64_t>(ut_uint64_align_up(cursor->statinfo.st_size,
+                                            UNIV_PAGE_SIZE_MAX),
+                         UNIV_PAGE_SIZE_MAX));
+  cursor->orig_buf = Io_buffer_pool::instance().acquire(cursor->buf_size);
+  cursor->buf = cursor->orig_buf;
+
+  /* Determine the page size. The first batch of a small file is read here
+  as well, so that the first cursor read does not have to read it again. */
+  const ulint prefetch_len =
+      is_small ? std::min<uint64_t>(
+                     ut_uint64_align_down(file_size, UNIV_PAGE_SIZE_MIN),
+                     opt_read_buffer_size)
+               : 0;
+  if (!xb_get_zip_size(cursor->rel_path, cursor->file, cursor->buf,
+                       prefetch_len, cursor->buf_prefetched, page_size,
                        cursor->is_encrypted)) {
     xb_fil_cur_close(cursor);
     return (XB_FIL_CUR_SKIP);
@@ -202,6 +296,8 @@ xb_fil_cur_result_t xb_fil_cur_open(
   cursor->page_size = page_size.physical();
   cursor->page_size_shift = page_size_shift;
   cursor->zip_size = page_size.is_compressed() ? page_size.physical() : 0;
+  cursor->fixed_page_size =
+      xb_fixed_page_size(cursor->page_size, cursor->zip_size);
 
   cursor->buf_read = 0;
   cursor->buf_npages = 0;
@@ -215,10 +311,21 @@ xb_fil_cur_result_t xb_fil_cur_open(
   cursor->read_filter = read_filter;
   cursor->read_filter->init(&cursor->read_filter_ctxt, cursor, node->space->id);
 
-  cursor->scratch = static_cast<byte *>(
-      ut::malloc_withkey(UT_NEW_THIS_FILE_PSI_KEY, cursor->page_size * 2));
-  cursor->decrypt = static_cast<byte *>(
-      ut::malloc_withkey(UT_NEW_THIS_FILE_PSI_KEY, cursor->page_size));
+  /* start adaptive batches at --read-buffer-size */
+  cursor->batch_min = std::min<ulint>(
+      cursor->buf_size,
+      ut_uint64_align_up(opt_read_buffer_size / 4, UNIV_PAGE_SIZE_MAX));
+  cursor->batch_samples = 0;
+  cursor->batch_bytes = 0;
+  cursor->batch_usecs = 0;
+  cursor->batch_prev_rate = 0;
+  cursor->batch_grow = true;
+  cursor->read_filter_ctxt.buffer_capacity =
+      std::min<ulint>(cursor->buf_size, opt_read_buffer_size);
+
+  cursor->scratch =
+      Io_buffer_pool::instance().acquire(cursor->page_size * 2);
+  cursor->decrypt = Io_buffer_pool::instance().acquire(cursor->page_size);
 
   memcpy(cursor->encryption_key, node->space->m_encryption_metadata.m_key,
          sizeof(cursor->encryption_key));
@@ -227,9 +334,48 @@ xb_fil_cur_result_t xb_fil_cur_open(
   cursor->encryption_klen = node->space->m_encryption_metadata.m_key_len;
   cursor->block_size = node->block_size;
 
+  cursor->reencrypt =
+      opt_reencrypt_tablespaces &&
+      node->space->m_encryption_metadata.m_type != Encryption::NONE;
+  if (cursor->reencrypt &&
+      !xb_reencryption_key(cursor->space_id, cursor->encryption_key,
+                           cursor->encryption_iv, cursor->reencryption_key,
+                           cursor->reencryption_iv)) {
+    xb::error() << "the key of " << cursor->abs_path
+                << " changed during the backup, it cannot be re-encrypted";
+    return (XB_FIL_CUR_ERROR);
+  }
+
+  cursor->aio = Fil_cur_aio::create(cursor);
+
   return (XB_FIL_CUR_SUCCESS);
 }
 
+void xb_fil_cur_open_shared(xb_fil_cur_t *cursor, const xb_fil_cur_t *parent,
+                            uint thread_n) {
+  *cursor = *parent;
+
+  /* the node handle is owned by the parent */
+  cursor->node = NULL;
+  cursor->aio = NULL;
+  cursor->thread_n = thread_n;
+
+  cursor->orig_buf = Io_buffer_pool::instance().acquire(cursor->buf_size);
+  cursor->buf = cursor->orig_buf;
+  cursor->scratch =
+      Io_buffer_pool::instance().acquire(cursor->page_size * 2);
+  cursor->decrypt = Io_buffer_pool::instance().acquire(cursor->page_size);
+
+  cursor->buf_prefetched = 0;
+  cursor->buf_read = 0;
+  cursor->buf_npages = 0;
+  cursor->buf_offset = 0;
+  cursor->buf_page_no = 0;
+
+  cursor->read_filter->init(&cursor->read_filter_ctxt, cursor,
+                            cursor->space_id);
+}
+
 static bool is_page_corrupted(bool check_lsn, const byte *read_buf,
                               const page_size_t &page_size,
                               bool skip_checksum) {
@@ -238,6 +384,118 @@ static bool is_page_corrupted(bool check_lsn, const byte *read_buf,
   return reporter.is_corrupted();
 }
 
+/** Check if the cursor pages can be verified with xb_page_batch_crc32().
+@param[in]  cursor  source file cursor
+@return true if the crc32 fast path applies */
+static bool xb_page_batch_crc32_enabled(const xb_fil_cur_t *cursor) {
+  /* BlockReporter also checks page LSNs against the current LSN when
+  recv_lsn_checks_on is set, leave this to the generic path */
+  return (cursor->zip_size == 0 && cursor->page_size == UNIV_PAGE_SIZE &&
+          !recv_lsn_checks_on &&
+          (srv_checksum_algorithm == SRV_CHECKSUM_ALGORITHM_CRC32 ||
+           srv_checksum_algorithm == SRV_CHECKSUM_ALGORITHM_STRICT_CRC32));
+}
+
+/** Verify a run of uncompressed pages stored with crc32 checksums.
+@param[in]  buf        first page to check
+@param[in]  npages     number of pages
+@param[in]  page_size  page size
+@tparam     FIXED      page size, or 0 to use page_size
+@return number of leading pages which are known to be valid */
+template <ulint FIXED>
+static ulint xb_page_batch_crc32_low(const byte *buf, ulint npages,
+                                     ulint page_size) {
+  ulint i;
+
+  if (FIXED != 0) {
+    page_size = FIXED;
+  }
+
+  for (i = 0; i < npages; i++, buf += page_size) {
+    if (memcmp(buf + FIL_PAGE_LSN + 4,
+               buf + page_size - FIL_PAGE_END_LSN_OLD_CHKSUM + 4, 4) != 0) {
+      break;
+    }
+
+    const auto page_type = mach_read_from_2(buf + FIL_PAGE_TYPE);
+    if (page_type == FIL_PAGE_ENCRYPTED ||
+        page_type == FIL_PAGE_COMPRESSED_AND_ENCRYPTED ||
+        page_type == FIL_PAGE_ENCRYPTED_RTREE ||
+        page_type == FIL_PAGE_COMPRESSED) {
+      break;
+    }
+
+    const auto checksum_field1 =
+        mach_read_from_4(buf + FIL_PAGE_SPACE_OR_CHKSUM);
+    const auto checksum_field2 =
+        mach_read_from_4(buf + page_size - FIL_PAGE_END_LSN_OLD_CHKSUM);
+
+    if (checksum_field1 != checksum_field2 ||
+        checksum_field1 != buf_calc_page_crc32(buf, false)) {
+      break;
+    }
+  }
+
+  return (i);
+}
+
+ulint xb_page_batch_crc32(const byte *buf, ulint npages, ulint page_size) {
+  const auto check = [&](auto fixed) {
+    return (xb_page_batch_crc32_low<decltype(fixed)::value>(buf, npages,
+                                                            page_size));
+  };
+
+  return (xb_page_size_dispatch(xb_fixed_page_size(page_size, 0), check));
+}
+
+/** Encrypt the encrypted pages read by the cursor with the key of the backup
+instead of the key of the tablespace. The pages are decrypted to
+cursor->decrypt and encrypted back into the read buffer. The other pages,
+including the first page with the encryption information of the tablespace,
+are left as they are.
+@param[in,out]  cursor        source file cursor
+@param[in]      read_request  read request with the key of the tablespace
+@return false on error */
+static bool xb_fil_cur_reencrypt(xb_fil_cur_t *cursor,
+                                 const IORequest &read_request) {
+  Encryption_metadata encryption_metadata;
+
+  Encryption::set_or_generate(Encryption::AES, cursor->reencryption_key,
+                              cursor->reencryption_iv, encryption_metadata);
+
+  IORequest write_request(IORequest::WRITE);
+  write_request.get_encryption_info().set(encryption_metadata);
+  write_request.block_size(cursor->block_size);
+
+  const Encryption decryption(read_request.encryption_algorithm());
+  const Encryption encryption(write_request.encryption_algorithm());
+
+  byte *page = cursor->buf;
+  for (ulint i = 0; i < cursor->buf_npages; page += cursor->page_size, i++) {
+    if (!Encryption::is_encrypted_page(page)) {
+      continue;
+    }
+
+    memcpy(cursor->decrypt, page, cursor->page_size);
+    if (decryption.decrypt(read_request, cursor->decrypt, cursor->page_size,
+                           cursor->scratch, cursor->page_size) != DB_SUCCESS) {
+      xb::error() << "cannot decrypt page " << cursor->buf_page_no + i
+                  << " of " << cursor->abs_path;
+      return (false);
+    }
+
+    ulint len = cursor->page_size;
+    if (encryption.encrypt(write_request, cursor->decrypt, cursor->page_size,
+                           page, &len) != page) {
+      xb::error() << "cannot re-encrypt page " << cursor->buf_page_no + i
+                  << " of " << cursor->abs_path;
+      return (false);
+    }
+  }
+
+  return (true);
+}
+
 /** Reads and verifies the next block of pages from the source
 file. Positions the cursor after the last read non-corrupted page.
 @param[in/out]	cursor	 	source file cursor
@@ -253,6 +511,9 @@ xb_fil_cur_result_t xb_fil_cur_read_from_offset(xb_fil_cur_t *cursor,
   ulint i;
   ulint npages;
   ulint retry_count;
+  ulint batch_next;
+  ulint batch_end;
+  const bool batch_crc32 = xb_page_batch_crc32_enabled(cursor);
   xb_fil_cur_result_t ret;
   ulong n_read;
   page_size_t page_size(
@@ -283,20 +544,36 @@ xb_fil_cur_result_t xb_fil_cur_read_from_offset(xb_fil_cur_t *cursor,
 
   xb_a(to_read % cursor->page_size == 0);
 
+  xb::trace::Span span("read", to_read);
+
   retry_count = 10;
   ret = XB_FIL_CUR_SUCCESS;
 
 read_retry:
-  xtrabackup_io_throttling();
+  batch_next = 0;
+  batch_end = 0;
 
   cursor->buf_read = 0;
   cursor->buf_npages = 0;
   cursor->buf_offset = offset;
   cursor->buf_page_no = (ulint)(offset >> cursor->page_size_shift);
 
-  err = os_file_read_no_error_handling(read_request, cursor->rel_path,
-                                       cursor->file, cursor->buf, offset,
-                                       to_read, &n_read);
+  if (offset == 0 && cursor->buf_prefetched >= to_read) {
+    /* the batch has been read when the cursor was opened */
+    n_read = to_read;
+    err = DB_SUCCESS;
+  } else if (cursor->aio != NULL &&
+             cursor->aio->fetch(offset, to_read, &n_read)) {
+    err = DB_SUCCESS;
+  } else {
+    xtrabackup_io_throttling();
+    io_throttle_read.acquire(to_read);
+
+    xb::wait_state::Scope wait(xb::wait_state::READ_IO);
+    err = os_file_read_no_error_handling(read_request, cursor->rel_path,
+                                         cursor->file, cursor->buf, offset,
+                                         to_read, &n_read);
+  }
   if (err != DB_SUCCESS) {
     if (err == DB_IO_ERROR) {
       /* If the file is truncated by MySQL, os_file_read will
@@ -313,6 +590,15 @@ read_retry:
     }
     return (XB_FIL_CUR_ERROR);
   }
+
+  /* retries must read the file again */
+  cursor->buf_prefetched = 0;
+
+  /* keep the next batches in flight while validating this one */
+  if (cursor->aio != NULL) {
+    cursor->aio->schedule(offset + to_read);
+  }
+
   Encryption_metadata encryption_metadata;
 
   Encryption::set_or_generate(Encryption::AES, cursor->encryption_key,
@@ -327,6 +613,19 @@ read_retry:
   /* check pages for corruption and re-read if necessary. i.e. in case of
   partially written pages */
   for (page = cursor->buf, i = 0; i < npages; page += cursor->page_size, i++) {
+    if (batch_crc32 && i == batch_next) {
+      /* verify the following run of pages at once, stopping at the first
+      page that needs a closer look */
+      batch_end = i + xb_page_batch_crc32(page, npages - i, cursor->page_size);
+      batch_next = batch_end + 1;
+    }
+
+    if (i < batch_end) {
+      cursor->buf_read += cursor->page_size;
+      cursor->buf_npages++;
+      continue;
+    }
+
     page_to_check = page;
     if (Encryption::is_encrypted_page(page)) {
       Encryption encryption(read_request.encryption_algorithm());
@@ -389,13 +688,69 @@ read_retry:
     cursor->buf_npages++;
   }
 
+  if (ret == XB_FIL_CUR_SUCCESS && cursor->reencrypt &&
+      !xb_fil_cur_reencrypt(cursor, read_request)) {
+    ret = XB_FIL_CUR_ERROR;
+  }
+
   cursor->read_filter->update(&cursor->read_filter_ctxt, n_read, cursor);
 
-  posix_fadvise(cursor->file.m_file, offset, to_read, POSIX_FADV_DONTNEED);
+  if (cursor->direct_io) {
+    xb_fil_cur_read_direct += n_read;
+  } else if (opt_source_read_mode != SOURCE_READ_MODE_BUFFERED) {
+    posix_fadvise(cursor->file.m_file, offset, to_read, POSIX_FADV_DONTNEED);
+    xb_fil_cur_read_dropped += n_read;
+  } else {
+    xb_fil_cur_read_cached += n_read;
+  }
 
   return (ret);
 }
 
+/** Number of reads used to measure the throughput of a batch size */
+static const uint XB_FIL_CUR_BATCH_SAMPLES = 4;
+
+/** Adjust the read batch size of the cursor to the measured throughput.
+The batch size is doubled or halved every XB_FIL_CUR_BATCH_SAMPLES reads,
+and the direction flips when the throughput drops compared to the previous
+batch size.
+@param[in,out]  cursor  source file cursor
+@param[in]      usecs   duration of the last read */
+static void xb_fil_cur_adapt_batch(xb_fil_cur_t *cursor, uint64_t usecs) {
+  uint64_t &batch = cursor->read_filter_ctxt.buffer_capacity;
+
+  /* reads shorter than the batch (end of file, page tracking ranges) tell
+  nothing about the batch size */
+  if (cursor->buf_read < batch) {
+    return;
+  }
+
+  cursor->batch_bytes += cursor->buf_read;
+  cursor->batch_usecs += std::max<uint64_t>(usecs, 1);
+
+  if (++cursor->batch_samples < XB_FIL_CUR_BATCH_SAMPLES) {
+    return;
+  }
+
+  const double rate =
+      static_cast<double>(cursor->batch_bytes) / cursor->batch_usecs;
+
+  if (rate < cursor->batch_prev_rate) {
+    cursor->batch_grow = !cursor->batch_grow;
+  }
+
+  cursor->batch_prev_rate = rate;
+  cursor->batch_samples = 0;
+  cursor->batch_bytes = 0;
+  cursor->batch_usecs = 0;
+
+  if (cursor->batch_grow) {
+    batch = std::min<uint64_t>(batch * 2, cursor->buf_size);
+  } else {
+    batch = std::max<uint64_t>(batch / 2, cursor->batch_min);
+  }
+}
+
 /** Reads and verifies the next block of pages from the source
 file. Positions the cursor after the last read non-corrupted page.
 @param[in/out] cursor	source file cursor
@@ -405,7 +760,19 @@ xb_fil_cur_result_t xb_fil_cur_read(xb_fil_cur_t *cursor) {
   uint64_t offset;
   uint64_t to_read;
   cursor->read_filter->get_next_batch(cursor, &offset, &to_read);
-  return xb_fil_cur_read_from_offset(cursor, offset, to_read);
+
+  const auto start = std::chrono::steady_clock::now();
+  const auto ret = xb_fil_cur_read_from_offset(cursor, offset, to_read);
+  const uint64_t usecs = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  xb_fil_cur_read_usecs.fetch_add(usecs, std::memory_order_relaxed);
+
+  if (ret == XB_FIL_CUR_SUCCESS && opt_read_buffer_max_size != 0) {
+    xb_fil_cur_adapt_batch(cursor, usecs);
+  }
+  return ret;
 }
 
 /************************************************************************
@@ -417,11 +784,16 @@ void xb_fil_cur_close(
 {
   cursor->read_filter->deinit(&cursor->read_filter_ctxt);
 
-  ut::free(cursor->scratch);
-  ut::free(cursor->decrypt);
-  ut::free(cursor->orig_buf);
+  /* in-flight reads may target any of the cursor buffers */
+  delete cursor->aio;
+  cursor->aio = NULL;
+
+  auto &pool = Io_buffer_pool::instance();
+  pool.release(cursor->scratch, cursor->page_size * 2);
+  pool.release(cursor->decrypt, cursor->page_size);
+  pool.release(cursor->orig_buf, cursor->buf_size);
   if (cursor->node != NULL) {
-    fil_node_close_file(cursor->node);
+    os_file_close(cursor->file);
     cursor->file = XB_FILE_UNDEFINED;
   }
 }
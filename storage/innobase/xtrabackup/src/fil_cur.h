@@ -26,9 +26,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #define FIL_CUR_H
 
 #include <my_dir.h>
+#include <atomic>
+#include <type_traits>
 #include "file_utils.h"
 #include "read_filt.h"
 
+class Fil_cur_aio;
+
 struct xb_fil_cur_t {
   pfs_os_file_t file; /*!< source file handle */
   fil_node_t *node;   /*!< source tablespace node */
@@ -43,6 +47,8 @@ struct xb_fil_cur_t {
                                UNIV_PAGE_SIZE for uncompressed ones */
   ulint page_size_shift;       /*!< bit shift corresponding to
                                page_size */
+  ulint fixed_page_size;       /*!< page_size if the page loops are
+                               compiled for it, 0 otherwise */
   bool is_system;              /*!< true for system tablespace, false
                                otherwise */
   bool is_ibd;                 /*!< true for IBD tablespace tablespace,
@@ -61,6 +67,20 @@ struct xb_fil_cur_t {
   byte *decrypt;          /*!< page to use for temporary
                           decrypt */
   ulint buf_size;         /*!< buffer size in bytes */
+  ulint batch_min;        /*!< smallest adaptive batch size */
+  uint batch_samples;     /*!< reads done at the current batch
+                          size */
+  uint64_t batch_bytes;   /*!< bytes read at the current batch
+                          size */
+  uint64_t batch_usecs;   /*!< time spent reading at the current
+                          batch size */
+  double batch_prev_rate; /*!< throughput at the previous batch
+                          size, bytes per microsecond */
+  bool batch_grow;        /*!< true if the batch size is
+                          increasing */
+  ulint buf_prefetched;   /*!< number of bytes from the beginning
+                          of the file read into buffer when the
+                          cursor was opened */
   ulint buf_read;         /*!< number of read bytes in buffer
                           after the last cursor read */
   ulint buf_npages;       /*!< number of pages in buffer after the
@@ -81,8 +101,30 @@ struct xb_fil_cur_t {
   /*!< encryption key length */
   unsigned char encryption_iv[32];
   /*!< encryption iv */
+  bool reencrypt; /*!< true if the pages are encrypted with
+                  the key of the backup */
+  unsigned char reencryption_key[32];
+  /*!< key of the backup */
+  unsigned char reencryption_iv[32];
+  /*!< iv of the backup */
+  Fil_cur_aio *aio; /*!< read-ahead engine or NULL if
+                    reads are synchronous */
+  bool direct_io;   /*!< true if the file is read with
+                    O_DIRECT */
 };
 
+/** Bytes of datafiles read with O_DIRECT */
+extern std::atomic<uint64_t> xb_fil_cur_read_direct;
+
+/** Bytes of datafiles read through the page cache and dropped from it */
+extern std::atomic<uint64_t> xb_fil_cur_read_dropped;
+
+/** Bytes of datafiles read through the page cache and left there */
+extern std::atomic<uint64_t> xb_fil_cur_read_cached;
+
+/** Time spent reading datafiles, in microseconds */
+extern std::atomic<uint64_t> xb_fil_cur_read_usecs;
+
 
 /************************************************************************
 Open a source file cursor and initialize the associated read filter.
@@ -96,6 +138,16 @@ xb_fil_cur_result_t xb_fil_cur_open(
     fil_node_t *node,            /*!< in: source tablespace node */
     uint thread_n);              /*!< thread number for diagnostics */
 
+/** Open a source file cursor sharing the file handle of an already opened
+cursor, so that several threads can read disjoint ranges of the same
+datafile. The new cursor does not own the tablespace node and must be closed
+before the parent cursor.
+@param[out]  cursor    source file cursor
+@param[in]   parent    opened source file cursor
+@param[in]   thread_n  thread number for diagnostics */
+void xb_fil_cur_open_shared(xb_fil_cur_t *cursor, const xb_fil_cur_t *parent,
+                            uint thread_n);
+
 /************************************************************************
 Reads and verifies the next block of pages from the source
 file. Positions the cursor after the last read non-corrupted page.
@@ -138,4 +190,55 @@ if there are no more pages to read and XB_FIL_CUR_ERROR on error */
 xb_fil_cur_result_t xb_fil_cur_read_from_offset(xb_fil_cur_t *cursor,
                                                 uint64_t offset,
                                                 uint64_t to_read);
+
+/** Get the page size for which the page loops have a variant compiled with
+a constant page size: the uncompressed page sizes from 4KiB to 64KiB.
+@param[in]  page_size  physical page size
+@param[in]  zip_size   compressed page size or 0
+@return page_size, or 0 if the generic loops must be used */
+constexpr ulint xb_fixed_page_size(ulint page_size, ulint zip_size) {
+  return (zip_size == 0 && page_size >= 4096 && page_size <= 65536 &&
+                  (page_size & (page_size - 1)) == 0
+              ? page_size
+              : 0);
+}
+
+/** Call a page loop compiled for a constant page size. The loops are
+templates on the page size, 0 standing for the generic loop reading the page
+size at run time. With a constant page size the offsets of the page trailer
+and the strides are immediates.
+@param[in]  fixed_page_size  result of xb_fixed_page_size()
+@param[in]  f                generic callable, taking a
+                             std::integral_constant<ulint, N> with N being
+                             the page size or 0
+@return the result of f */
+template <typename F>
+inline auto xb_page_size_dispatch(ulint fixed_page_size, F &&f) {
+  switch (fixed_page_size) {
+    case 4096:
+      return (f(std::integral_constant<ulint, 4096>()));
+    case 8192:
+      return (f(std::integral_constant<ulint, 8192>()));
+    case 16384:
+      return (f(std::integral_constant<ulint, 16384>()));
+    case 32768:
+      return (f(std::integral_constant<ulint, 32768>()));
+    case 65536:
+      return (f(std::integral_constant<ulint, 65536>()));
+  }
+  return (f(std::integral_constant<ulint, 0>()));
+}
+
+/** Verify a run of uncompressed pages stored with crc32 checksums. Only the
+common case is handled: plain pages having matching LSN fields and both
+checksum fields equal to the crc32 of the page. ut_crc32() uses the hardware
+CRC32C instructions. Every page not accepted here must be verified by
+BlockReporter, which knows about empty pages, legacy checksums and
+encrypted or compressed pages.
+@param[in]  buf        first page to check
+@param[in]  npages     number of pages
+@param[in]  page_size  page size, UNIV_PAGE_SIZE
+@return number of leading pages which are known to be valid */
+ulint xb_page_batch_crc32(const byte *buf, ulint npages, ulint page_size);
+
 #endif
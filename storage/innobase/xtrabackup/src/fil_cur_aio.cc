@@ -0,0 +1,346 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+/* Source file cursor read-ahead implementation */
+
+#include "xtrabackup_config.h"
+
+#include <my_base.h>
+
+#include <fil0fil.h>
+#include <univ.i>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+#include "common.h"
+#include "fil_cur.h"
+#include "fil_cur_aio.h"
+#include "io_buffer_pool.h"
+#include "io_throttle.h"
+#include "read_filt.h"
+#include "wait_state.h"
+#include "xtrabackup.h"
+
+Fil_cur_aio::~Fil_cur_aio() {
+  ut_ad(in_flight.empty());
+  for (auto buf : orig_bufs) {
+    Io_buffer_pool::instance().release(buf, cursor->buf_size);
+  }
+}
+
+void Fil_cur_aio::alloc_slots(uint depth) {
+  ut_ad(slots.empty());
+
+  slots.resize(depth);
+  for (auto &slot : slots) {
+    byte *buf = Io_buffer_pool::instance().acquire(cursor->buf_size);
+    orig_bufs.push_back(buf);
+    slot.buf = buf;
+    free_slots.push_back(&slot);
+  }
+}
+
+void Fil_cur_aio::drain() {
+  for (auto slot : in_flight) {
+    wait(slot);
+    free_slots.push_back(slot);
+  }
+  in_flight.clear();
+}
+
+bool Fil_cur_aio::fetch(uint64_t offset, uint64_t len, ulong *n_read) {
+  while (!in_flight.empty()) {
+    slot_t *slot = in_flight.front();
+
+    if (slot->offset > offset) {
+      /* re-read of an already consumed batch */
+      return (false);
+    }
+
+    in_flight.pop_front();
+    {
+      xb::wait_state::Scope wait_io(xb::wait_state::READ_IO);
+      wait(slot);
+    }
+    free_slots.push_back(slot);
+
+    if (slot->offset < offset) {
+      /* the cursor has skipped this batch */
+      continue;
+    }
+
+    if (slot->res < 0 || static_cast<uint64_t>(slot->res) < len) {
+      /* let the synchronous read deal with errors and short reads */
+      return (false);
+    }
+
+    /* buffers are interchangeable, all of them are allocated with the cursor
+    buffer size */
+    std::swap(slot->buf, cursor->buf);
+    *n_read = len;
+
+    return (true);
+  }
+
+  return (false);
+}
+
+void Fil_cur_aio::schedule(uint64_t offset) {
+  if (!in_flight.empty()) {
+    const slot_t *last = in_flight.back();
+    offset = std::max(offset, last->offset + last->len);
+  }
+
+  const uint64_t file_size = cursor->statinfo.st_size;
+
+  while (!free_slots.empty() && offset < file_size) {
+    slot_t *slot = free_slots.back();
+
+    slot->offset = offset;
+    /* O_DIRECT reads must be block aligned including the one at the end of
+    the file */
+    slot->len = std::min<uint64_t>(
+        cursor->read_filter_ctxt.buffer_capacity,
+        ut_uint64_align_up(file_size - offset, UNIV_PAGE_SIZE_MIN));
+    slot->res = 0;
+    slot->done = false;
+
+    xtrabackup_io_throttling();
+    io_throttle_read.acquire(slot->len);
+
+    if (!submit(slot)) {
+      break;
+    }
+
+    free_slots.pop_back();
+    in_flight.push_back(slot);
+
+    offset += slot->len;
+  }
+}
+
+#ifdef HAVE_LIBURING
+
+/** io_uring based read-ahead engine, one ring per cursor */
+class Fil_cur_uring : public Fil_cur_aio {
+ public:
+  explicit Fil_cur_uring(xb_fil_cur_t *cursor) : Fil_cur_aio(cursor) {}
+
+  ~Fil_cur_uring() override {
+    drain();
+    if (initialized) {
+      io_uring_queue_exit(&ring);
+    }
+  }
+
+  /** Set up the ring and the read-ahead buffers.
+  @param[in]  depth  number of batches to keep in flight
+  @return false if io_uring is not usable */
+  bool init(uint depth) {
+    int ret = io_uring_queue_init(depth, &ring, 0);
+    if (ret < 0) {
+      static std::atomic<bool> warned{false};
+      if (!warned.exchange(true)) {
+        xb::warn() << "io_uring_queue_init() failed: " << strerror(-ret)
+                   << ". Falling back to synchronous reads.";
+      }
+      return (false);
+    }
+    initialized = true;
+    alloc_slots(depth);
+    return (true);
+  }
+
+ protected:
+  bool submit(slot_t *slot) override {
+    if (broken) {
+      return (false);
+    }
+
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    if (sqe == nullptr) {
+      return (false);
+    }
+
+    io_uring_prep_read(sqe, cursor->file.m_file, slot->buf, slot->len,
+                       slot->offset);
+    io_uring_sqe_set_data(sqe, slot);
+
+    int ret;
+    while ((ret = io_uring_submit(&ring)) == -EINTR) {
+    }
+
+    if (ret < 0) {
+      /* The request stays in the submission queue. Never submit again, so it
+      cannot complete into a reused buffer. */
+      xb::warn() << "io_uring_submit() failed for " << cursor->abs_path << ": "
+                 << strerror(-ret) << ". Falling back to synchronous reads.";
+      broken = true;
+      return (false);
+    }
+
+    return (true);
+  }
+
+  void wait(slot_t *slot) override {
+    while (!slot->done) {
+      struct io_uring_cqe *cqe;
+      int ret = io_uring_wait_cqe(&ring, &cqe);
+      if (ret == -EINTR) {
+        continue;
+      }
+      if (ret < 0) {
+        xb::error() << "io_uring_wait_cqe() failed for " << cursor->abs_path
+                    << ": " << strerror(-ret);
+        ut_error;
+      }
+
+      slot_t *completed = static_cast<slot_t *>(io_uring_cqe_get_data(cqe));
+      completed->res = cqe->res;
+      completed->done = true;
+      io_uring_cqe_seen(&ring, cqe);
+    }
+  }
+
+ private:
+  struct io_uring ring;
+  bool initialized{false};
+  bool broken{false};
+};
+
+#endif /* HAVE_LIBURING */
+
+/** Read-ahead engine doing the reads from a helper thread, one thread per
+cursor. Turns the copy loop into a two stage pipeline: the helper reads the
+next batches while the copy thread validates and writes the current one. */
+class Fil_cur_thread : public Fil_cur_aio {
+ public:
+  explicit Fil_cur_thread(xb_fil_cur_t *cursor, uint depth)
+      : Fil_cur_aio(cursor) {
+    alloc_slots(depth);
+    reader = std::thread(&Fil_cur_thread::reader_func, this);
+  }
+
+  ~Fil_cur_thread() override {
+    drain();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    cond.notify_all();
+    reader.join();
+  }
+
+ protected:
+  bool submit(slot_t *slot) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push(slot);
+    }
+    cond.notify_all();
+    return (true);
+  }
+
+  void wait(slot_t *slot) override {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [slot] { return slot->done; });
+  }
+
+ private:
+  void reader_func() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cond.wait(lock, [this] { return stop || !queue.empty(); });
+      if (queue.empty()) {
+        break;
+      }
+      slot_t *slot = queue.front();
+      queue.pop();
+      lock.unlock();
+
+      int64_t res = 0;
+      while (static_cast<uint64_t>(res) < slot->len) {
+        ssize_t n = pread(cursor->file.m_file, slot->buf + res, slot->len - res,
+                          slot->offset + res);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n < 0) {
+          res = -errno;
+          break;
+        }
+        if (n == 0) {
+          break;
+        }
+        res += n;
+      }
+
+      lock.lock();
+      slot->res = res;
+      slot->done = true;
+      cond.notify_all();
+    }
+  }
+
+  std::thread reader;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::queue<slot_t *> queue;
+  bool stop{false};
+};
+
+Fil_cur_aio *Fil_cur_aio::create(xb_fil_cur_t *cursor) {
+  if (opt_read_io_engine == READ_IO_ENGINE_SYNC) {
+    return (nullptr);
+  }
+
+  /* only sequential reads can be predicted */
+  if (cursor->read_filter != &rf_pass_through) {
+    return (nullptr);
+  }
+
+  /* nothing to overlap with if the file fits into a single batch */
+  if (static_cast<uint64_t>(cursor->statinfo.st_size) <= cursor->buf_size) {
+    return (nullptr);
+  }
+
+#ifdef HAVE_LIBURING
+  if (opt_read_io_engine == READ_IO_ENGINE_IO_URING) {
+    auto aio = new Fil_cur_uring(cursor);
+    if (aio->init(opt_read_io_depth)) {
+      return (aio);
+    }
+    delete aio;
+  }
+#endif
+
+  if (opt_read_io_engine == READ_IO_ENGINE_THREAD) {
+    return (new Fil_cur_thread(cursor, opt_read_io_depth));
+  }
+
+  return (nullptr);
+}
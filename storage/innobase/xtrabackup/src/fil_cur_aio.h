@@ -0,0 +1,98 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+/* Source file cursor read-ahead interface */
+
+#ifndef FIL_CUR_AIO_H
+#define FIL_CUR_AIO_H
+
+#include <univ.i>
+
+#include <deque>
+#include <vector>
+
+struct xb_fil_cur_t;
+
+/** Read-ahead engine attached to a source file cursor. Keeps several
+sequential read batches in flight, so that validation of the current batch
+overlaps with the I/O of the following ones. */
+class Fil_cur_aio {
+ public:
+  /** Create read-ahead engine for the cursor as requested by
+  --read-io-engine.
+  @param[in]  cursor  source file cursor
+  @return read-ahead engine or nullptr if the cursor must read synchronously */
+  static Fil_cur_aio *create(xb_fil_cur_t *cursor);
+
+  virtual ~Fil_cur_aio();
+
+  /** Take the result of the batch read ahead at the given offset. On success
+  the batch is exchanged with the cursor buffer.
+  @param[in]   offset  batch offset
+  @param[in]   len     batch length
+  @param[out]  n_read  number of bytes read
+  @return true if the batch has been read ahead, false if the caller must read
+  it synchronously */
+  bool fetch(uint64_t offset, uint64_t len, ulong *n_read);
+
+  /** Queue reads of the batches following the given offset.
+  @param[in]  offset  offset of the first batch to read ahead */
+  void schedule(uint64_t offset);
+
+ protected:
+  struct slot_t {
+    byte *buf;       /*!< aligned read buffer */
+    uint64_t offset; /*!< batch offset */
+    uint64_t len;    /*!< batch length */
+    int64_t res;     /*!< bytes read or -errno */
+    bool done;       /*!< true when the read has completed */
+  };
+
+  explicit Fil_cur_aio(xb_fil_cur_t *cursor) : cursor(cursor) {}
+
+  /** Allocate read-ahead buffers.
+  @param[in]  depth  number of batches to keep in flight */
+  void alloc_slots(uint depth);
+
+  /** Wait for all in-flight reads and release the read-ahead buffers. Must be
+  called from the destructor of the engine implementation. */
+  void drain();
+
+  /** Start reading the batch described by the slot.
+  @return false if the read could not be started */
+  virtual bool submit(slot_t *slot) = 0;
+
+  /** Block until the read of the slot is done. */
+  virtual void wait(slot_t *slot) = 0;
+
+  xb_fil_cur_t *cursor;
+
+ private:
+  /** read-ahead buffers, owned by the engine */
+  std::vector<byte *> orig_bufs;
+
+  std::vector<slot_t> slots;
+
+  /** slots ready to be submitted */
+  std::vector<slot_t *> free_slots;
+
+  /** submitted slots in the file order */
+  std::deque<slot_t *> in_flight;
+};
+
+#endif
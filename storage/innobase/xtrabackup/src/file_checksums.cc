@@ -0,0 +1,280 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Checksums of the files of a backup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+
+#include "crc_glue.h"
+#include "file_checksums.h"
+#include "msg.h"
+
+namespace xb {
+namespace file_checksums {
+
+const char *FILENAME = "xtrabackup_checksums";
+
+/** First line of FILENAME, with the version of its format */
+static const char *HEADER = "# xtrabackup file checksums 1";
+
+/** Largest buffer crc32_castagnoli() is given at once, it takes a uint */
+static const size_t MAX_CRC_LEN = 1024 * 1024 * 1024;
+
+void File_checksum::update(uint64_t offset, const void *buf, size_t len) {
+  const uchar *ptr = static_cast<const uchar *>(buf);
+  uint32_t crc = 0;
+
+  if (len == 0) {
+    return;
+  }
+
+  for (size_t done = 0; done < len;) {
+    const size_t n = std::min(len - done, MAX_CRC_LEN);
+    crc = crc32_castagnoli(crc, ptr + done, n);
+    done += n;
+  }
+
+  add(offset, len, crc);
+}
+
+void File_checksum::update_zeros(uint64_t offset, uint64_t len) {
+  if (len == 0) {
+    return;
+  }
+
+  /* the CRC of the zeroes is the initial value of the register, all ones,
+  combined with itself over len bytes */
+  add(offset, len, crc32_castagnoli_combine(0xffffffffU, 0xffffffffU, len));
+}
+
+void File_checksum::add(uint64_t offset, uint64_t len, uint32_t crc) {
+  if (len == 0) {
+    return;
+  }
+
+  /* append to the range ending at offset */
+  auto next = ranges_.lower_bound(offset);
+  if (next != ranges_.end() && next->first < offset + len) {
+    overlap_ = true;
+  }
+  if (next != ranges_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second.len > offset) {
+      overlap_ = true;
+    } else if (prev->first + prev->second.len == offset) {
+      prev->second.crc = crc32_castagnoli_combine(prev->second.crc, crc, len);
+      prev->second.len += len;
+      offset = prev->first;
+      len = prev->second.len;
+      crc = prev->second.crc;
+      ranges_.erase(prev);
+    }
+  }
+
+  /* and prepend to the range starting where this one ends */
+  if (next != ranges_.end() && next->first == offset + len) {
+    crc = crc32_castagnoli_combine(crc, next->second.crc, next->second.len);
+    len += next->second.len;
+    next = ranges_.erase(next);
+  }
+
+  ranges_.emplace_hint(next, offset, Range{len, crc});
+}
+
+void File_checksum::merge(const File_checksum &other) {
+  overlap_ = overlap_ || other.overlap_;
+  for (const auto &range : other.ranges_) {
+    add(range.first, range.second.len, range.second.crc);
+  }
+}
+
+bool File_checksum::get(Entry *entry) const {
+  entry->size = 0;
+  entry->crc = 0;
+
+  if (overlap_) {
+    return (false);
+  }
+
+  for (const auto &range : ranges_) {
+    if (range.first != entry->size) {
+      return (false);
+    }
+    entry->crc = crc32_castagnoli_combine(entry->crc, range.second.crc,
+                                          range.second.len);
+    entry->size += range.second.len;
+  }
+
+  return (true);
+}
+
+void Registry::reset(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  files_.erase(path);
+}
+
+void Registry::merge(const std::string &path, const File_checksum &checksum) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  files_[path].merge(checksum);
+}
+
+Entries Registry::entries() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entries entries;
+
+  for (const auto &file : files_) {
+    Entry entry;
+    if (!file.second.get(&entry)) {
+      msg_ts("Warning: the checksum of %s is incomplete, it is not "
+             "recorded.\n",
+             file.first.c_str());
+      continue;
+    }
+    entries.emplace(file.first, entry);
+  }
+
+  return (entries);
+}
+
+std::string normalize(const char *path) {
+  std::string out;
+
+  while (path[0] == '.' && path[1] == '/') {
+    path += 2;
+    while (*path == '/') {
+      path++;
+    }
+  }
+
+  for (; *path != '\0'; path++) {
+    if (*path == '/' && !out.empty() && out.back() == '/') {
+      continue;
+    }
+    out += *path;
+  }
+
+  return (out);
+}
+
+std::string serialize(const Entries &entries) {
+  std::string text(HEADER);
+  char line[64];
+
+  text += '\n';
+  for (const auto &it : entries) {
+    snprintf(line, sizeof(line), "%08" PRIx32 " %" PRIu64 " ", it.second.crc,
+             it.second.size);
+    text += line;
+    text += it.first;
+    text += '\n';
+  }
+
+  return (text);
+}
+
+bool parse(const std::string &text, Entries *entries) {
+  std::istringstream in(text);
+  std::string line;
+
+  if (!std::getline(in, line) || line != HEADER) {
+    msg_ts("%s does not start with \"%s\".\n", FILENAME, HEADER);
+    return (false);
+  }
+
+  entries->clear();
+  while (std::getline(in, line)) {
+    uint32_t crc;
+    uint64_t size;
+    int n = 0;
+    if (sscanf(line.c_str(), "%8" SCNx32 " %" SCNu64 " %n", &crc, &size, &n) !=
+            2 ||
+        n == 0 || static_cast<size_t>(n) >= line.size()) {
+      msg_ts("Invalid line in %s: %s\n", FILENAME, line.c_str());
+      return (false);
+    }
+    (*entries)[line.substr(n)] = Entry{size, crc};
+  }
+
+  return (true);
+}
+
+bool read(const char *path, Entries *entries) {
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) {
+    msg_ts("Cannot open %s, errno = %d.\n", path, errno);
+    return (false);
+  }
+
+  std::string text;
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    text.append(buf, n);
+  }
+  const bool failed = ferror(f);
+  fclose(f);
+
+  if (failed) {
+    msg_ts("Cannot read %s.\n", path);
+    return (false);
+  }
+
+  return (parse(text, entries));
+}
+
+bool check(const Entries &expected, const Entries &actual,
+           const std::function<bool(const std::string &)> &required,
+           size_t *n_checked) {
+  bool ok = true;
+
+  *n_checked = 0;
+  for (const auto &it : expected) {
+    const auto found = actual.find(it.first);
+    if (found == actual.end()) {
+      if (required && required(it.first)) {
+        msg_ts("%s is listed in %s but was not read.\n", it.first.c_str(),
+               FILENAME);
+        ok = false;
+      }
+      continue;
+    }
+    if (found->second.size != it.second.size ||
+        found->second.crc != it.second.crc) {
+      msg_ts("%s does not match %s: %" PRIu64 " bytes with CRC-32C %08" PRIx32
+             ", expected %" PRIu64 " bytes with CRC-32C %08" PRIx32 ".\n",
+             it.first.c_str(), FILENAME, found->second.size,
+             found->second.crc, it.second.size, it.second.crc);
+      ok = false;
+    }
+    (*n_checked)++;
+  }
+
+  return (ok);
+}
+
+}  // namespace file_checksums
+}  // namespace xb
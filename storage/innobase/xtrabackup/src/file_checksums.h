@@ -0,0 +1,163 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Checksums of the files of a backup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef XB_FILE_CHECKSUMS_H
+#define XB_FILE_CHECKSUMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+/* --file-checksums writes the CRC-32C and the size of every file of the
+backup, as written by xtrabackup, to xtrabackup_checksums. The checksums are
+computed while the files are copied, so that xbstream -x and --copy-back can
+check the files they read without an extra pass over them. Files written by
+several threads in ranges get a checksum per range, which are combined. */
+namespace xb {
+namespace file_checksums {
+
+/** Name of the file of the checksums in the backup */
+extern const char *FILENAME;
+
+/** Checksum of a whole file */
+struct Entry {
+  /** size of the file */
+  uint64_t size;
+
+  /** CRC-32C of the contents of the file */
+  uint32_t crc;
+};
+
+/** Checksums by path relative to the backup directory */
+using Entries = std::map<std::string, Entry>;
+
+/** Checksum of a file built from the checksums of its ranges, which can be
+computed in any order. crc_init() must have been called. */
+class File_checksum {
+ public:
+  /** Add data to the checksum.
+  @param[in]  offset  offset of the data in the file
+  @param[in]  buf     data
+  @param[in]  len     length of the data */
+  void update(uint64_t offset, const void *buf, size_t len);
+
+  /** Add zeroes to the checksum, for the holes of sparse files.
+  @param[in]  offset  offset of the zeroes in the file
+  @param[in]  len     number of zeroes */
+  void update_zeros(uint64_t offset, uint64_t len);
+
+  /** Add a range of which the checksum is already known.
+  @param[in]  offset  offset of the range in the file
+  @param[in]  len     length of the range
+  @param[in]  crc     CRC-32C of the range */
+  void add(uint64_t offset, uint64_t len, uint32_t crc);
+
+  /** Add the ranges of another checksum of the same file.
+  @param[in]  other  checksum of other ranges */
+  void merge(const File_checksum &other);
+
+  /** Get the checksum of the whole file.
+  @param[out]  entry  checksum and size
+  @return false if the ranges do not cover the file from its start without
+  gaps or overlaps */
+  bool get(Entry *entry) const;
+
+  /** @return true if no data was added */
+  bool empty() const { return ranges_.empty(); }
+
+ private:
+  /** Checksum of a range */
+  struct Range {
+    uint64_t len;
+    uint32_t crc;
+  };
+
+  /** ranges by offset, ranges following each other are coalesced */
+  std::map<uint64_t, Range> ranges_;
+
+  /** true if ranges overlapping each other were added */
+  bool overlap_{false};
+};
+
+/** Checksums of the files written by several threads */
+class Registry {
+ public:
+  /** Forget the checksum of a file, when it is written again.
+  @param[in]  path  path of the file */
+  void reset(const std::string &path);
+
+  /** Add the ranges of a file written by a thread.
+  @param[in]  path      path of the file
+  @param[in]  checksum  checksum of the ranges */
+  void merge(const std::string &path, const File_checksum &checksum);
+
+  /** Get the checksums of the files. Files of which the checksum is
+  incomplete are reported and left out.
+  @return checksums by path */
+  Entries entries() const;
+
+ private:
+  mutable std::mutex mutex_;
+
+  std::map<std::string, File_checksum> files_;
+};
+
+/** Normalize a path relative to the backup directory, so that the paths of
+the same files compare equal.
+@param[in]  path  path
+@return path without leading "./" and duplicated slashes */
+std::string normalize(const char *path);
+
+/** Serialize checksums as the contents of FILENAME.
+@param[in]  entries  checksums
+@return contents of the file */
+std::string serialize(const Entries &entries);
+
+/** Parse the contents of FILENAME.
+@param[in]   text     contents of the file
+@param[out]  entries  checksums
+@return false if the contents are not valid */
+bool parse(const std::string &text, Entries *entries);
+
+/** Read FILENAME.
+@param[in]   path     path of the file
+@param[out]  entries  checksums
+@return false if the file cannot be read or is not valid */
+bool read(const char *path, Entries *entries);
+
+/** Check the checksums of the files read against the checksums recorded in
+the backup. Files not recorded are not checked.
+@param[in]   expected   checksums recorded in the backup
+@param[in]   actual     checksums of the files read
+@param[in]   required   files that must have been read, nullptr if none
+@param[out]  n_checked  number of files checked
+@return false if a file does not match or a required file was not read */
+bool check(const Entries &expected, const Entries &actual,
+           const std::function<bool(const std::string &)> &required,
+           size_t *n_checked);
+
+}  // namespace file_checksums
+}  // namespace xb
+
+#endif
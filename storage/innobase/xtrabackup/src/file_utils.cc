@@ -276,18 +276,57 @@ xb_fil_cur_result_t datafile_read(datafile_cur_t *cursor) {
   return (XB_FIL_CUR_SUCCESS);
 }
 
+/** Check if a page is all zeroes, e.g. a page allocated but never used. The
+overlapping memcmp() lets the vectorized libc routine do the scan.
+@param[in]  page       page
+@param[in]  page_size  page size
+@return true if the page holds only zeroes */
+static bool is_zero_page(const byte *page, size_t page_size) {
+  return (page[0] == 0 && memcmp(page, page + 1, page_size - 1) == 0);
+}
+
 bool restore_sparseness(const char *src_file_path, uint buffer_size,
                         char error[512]) {
   datafile_cur_t cursor;
   size_t page_size = 0;
   size_t seek = 0;
+  /* the hole not punched yet, it grows while the next hole is adjacent */
+  size_t hole_start = 0;
+  size_t hole_end = 0;
   if (!file_has_suffix("ibd", src_file_path)) return true;
 
   if (!datafile_open(src_file_path, &cursor, false, buffer_size)) {
     strcpy(error, "Cannot open file");
     return false;
   }
-  auto punch_hole_func = [&](const auto page) {
+  auto punch_hole_func = [&]() {
+    if (hole_end == hole_start) {
+      return true;
+    }
+#ifdef HAVE_FALLOC_PUNCH_HOLE_AND_KEEP_SIZE
+    int ret = fallocate(cursor.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                        hole_start, hole_end - hole_start);
+    if (ret != 0) {
+      strcpy(error, "fallocate returned ");
+      std::string err = std::to_string(errno);
+      strcat(error, err.c_str());
+      return false;
+    }
+#endif  // HAVE_FALLOC_PUNCH_HOLE_AND_KEEP_SIZE
+    hole_start = hole_end = 0;
+    return true;
+  };
+  auto add_hole_func = [&](size_t start, size_t end) {
+    if (start != hole_end && !punch_hole_func()) {
+      return false;
+    }
+    if (hole_end == hole_start) {
+      hole_start = start;
+    }
+    hole_end = end;
+    return true;
+  };
+  auto page_hole_func = [&](const auto page) {
     if (fil_page_get_type(page) == XB_FIL_PAGE_COMPRESSED) {
 #ifdef UNIV_DEBUG
       assert(page_size % (size_t)cursor.statinfo.st_blksize == 0);
@@ -297,23 +336,16 @@ bool restore_sparseness(const char *src_file_path, uint buffer_size,
                             XB_FIL_PAGE_DATA,
                         cursor.statinfo.st_blksize);
       if (compressed_len < page_size) {
-#ifdef HAVE_FALLOC_PUNCH_HOLE_AND_KEEP_SIZE
-        int ret =
-            fallocate(cursor.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
-                      seek + compressed_len, page_size - compressed_len);
-        if (ret != 0) {
-          strcpy(error, "fallocate returned ");
-          std::string err = std::to_string(errno);
-          strcat(error, err.c_str());
-          return false;
-        }
-#endif  // HAVE_FALLOC_PUNCH_HOLE_AND_KEEP_SIZE
+        return add_hole_func(seek + compressed_len, seek + page_size);
       }
+    } else if (is_zero_page(page, page_size)) {
+      return add_hole_func(seek, seek + page_size);
     }
     return true;
   };
 
-  while (datafile_read(&cursor) == XB_FIL_CUR_SUCCESS) {
+  bool success = true;
+  while (success && datafile_read(&cursor) == XB_FIL_CUR_SUCCESS) {
     size_t buf_offset = 0;
     if (cursor.buf_offset == cursor.buf_read) {
       const uint32_t flags = fsp_header_get_flags(cursor.buf);
@@ -331,16 +363,17 @@ bool restore_sparseness(const char *src_file_path, uint buffer_size,
 #endif
     }
 
-    for (ulint i = 0; i < cursor.buf_read / page_size; ++i) {
+    for (ulint i = 0; success && i < cursor.buf_read / page_size; ++i) {
       const auto page = cursor.buf + buf_offset;
-      if (!punch_hole_func(page)) return false;
+      success = page_hole_func(page);
 
       buf_offset += page_size;
       seek += page_size;
     }
   }
+  success = success && punch_hole_func();
   datafile_close(&cursor);
-  return true;
+  return success;
 }
 
 File open_fifo_for_write_with_timeout(const char *path, uint timeout) {
@@ -438,3 +471,27 @@ File open_fifo_for_read_with_timeout(const char *path, uint timeout) {
 
   return fd;
 }
+
+bool parse_fd_list(const char *list, std::vector<File> *fds) {
+  const char *ptr = list;
+
+  fds->clear();
+  do {
+    char *end;
+    errno = 0;
+    const long fd = strtol(ptr, &end, 10);
+    if (end == ptr || errno != 0 || fd < 0 || fd > INT_MAX ||
+        (*end != ',' && *end != '\0')) {
+      msg("invalid file descriptor list '%s'\n", list);
+      return false;
+    }
+    if (fcntl(fd, F_GETFD) == -1) {
+      msg("file descriptor %ld is not open\n", fd);
+      return false;
+    }
+    fds->push_back(static_cast<File>(fd));
+    ptr = *end == ',' ? end + 1 : end;
+  } while (*ptr != '\0');
+
+  return true;
+}
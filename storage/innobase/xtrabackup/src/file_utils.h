@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <my_io.h>
 #include <cstring>
 #include <string>
+#include <vector>
 #include "datasink.h"
 
 typedef unsigned char byte;
@@ -200,4 +201,14 @@ File open_fifo_for_write_with_timeout(const char *path, uint timeout);
   @return file descriptor in case of success, -1 otherwise
 */
 File open_fifo_for_read_with_timeout(const char *path, uint timeout);
+
+/**
+  Parse a comma separated list of open file descriptors, e.g. "3,4,5".
+
+  @param [in]       list      list to parse
+  @param [out]      fds       file descriptors
+
+  @return false if an entry is not a number or not an open file descriptor
+*/
+bool parse_fd_list(const char *list, std::vector<File> *fds);
 #endif
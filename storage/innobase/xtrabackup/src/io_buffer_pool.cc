@@ -0,0 +1,110 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <my_base.h>
+
+#include <univ.i>
+#include <ut0new.h>
+
+#include "io_buffer_pool.h"
+
+size_t Io_buffer_pool::cache_limit = 0;
+std::atomic<size_t> Io_buffer_pool::allocated{0};
+std::atomic<size_t> Io_buffer_pool::peak{0};
+
+Io_buffer_pool &Io_buffer_pool::instance() {
+  static thread_local Io_buffer_pool pool;
+  return pool;
+}
+
+void Io_buffer_pool::set_cache_limit(size_t bytes) { cache_limit = bytes; }
+
+size_t Io_buffer_pool::peak_usage() { return peak.load(); }
+
+size_t Io_buffer_pool::usage() { return allocated.load(); }
+
+Io_buffer_pool::~Io_buffer_pool() { trim(); }
+
+void Io_buffer_pool::trim() {
+  for (auto &entry : free_bufs) {
+    ut::aligned_free(entry.second);
+    allocated -= entry.first;
+  }
+  free_bufs.clear();
+  cached = 0;
+}
+
+size_t Io_buffer_pool::capacity(size_t size) {
+  constexpr size_t MB = 1024 * 1024;
+
+  /* power of two classes for small buffers, 1M steps for large ones. This
+  keeps the number of distinct sizes low, file size capped cursor buffers
+  vary a lot. */
+  if (size > MB) {
+    return ut_uint64_align_up(size, MB);
+  }
+
+  size_t cap = UNIV_PAGE_SIZE_MIN;
+  while (cap < size) {
+    cap *= 2;
+  }
+  return cap;
+}
+
+byte *Io_buffer_pool::acquire(size_t size) {
+  const size_t cap = capacity(size);
+
+  auto it = free_bufs.find(cap);
+  if (it != free_bufs.end()) {
+    byte *buf = it->second;
+    free_bufs.erase(it);
+    cached -= cap;
+    return buf;
+  }
+
+  byte *buf = static_cast<byte *>(
+      ut::aligned_alloc_withkey(UT_NEW_THIS_FILE_PSI_KEY, cap, UNIV_PAGE_SIZE));
+  ut_a(buf != nullptr);
+
+  /* fault the pages in now, the buffer is going to be reused */
+  memset(buf, 0, cap);
+
+  const size_t total = (allocated += cap);
+  size_t prev = peak.load();
+  while (total > prev && !peak.compare_exchange_weak(prev, total)) {
+  }
+
+  return buf;
+}
+
+void Io_buffer_pool::release(byte *buf, size_t size) {
+  if (buf == nullptr) {
+    return;
+  }
+
+  const size_t cap = capacity(size);
+
+  if (cached + cap > cache_limit) {
+    ut::aligned_free(buf);
+    allocated -= cap;
+    return;
+  }
+
+  free_bufs.emplace(cap, buf);
+  cached += cap;
+}
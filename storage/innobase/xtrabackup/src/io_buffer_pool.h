@@ -0,0 +1,81 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+/* Pool of aligned I/O buffers reused across datafile cursors */
+
+#ifndef IO_BUFFER_POOL_H
+#define IO_BUFFER_POOL_H
+
+#include <univ.i>
+
+#include <atomic>
+#include <map>
+
+/** Per thread cache of page aligned, pre-faulted buffers. Cursors opened one
+after the other by a copy thread get the buffers released by the previous
+cursor instead of going through malloc and page faults for every datafile. */
+class Io_buffer_pool {
+ public:
+  /** @return the pool of the calling thread */
+  static Io_buffer_pool &instance();
+
+  /** Set the number of bytes of free buffers every thread may keep.
+  @param[in]  bytes  cache limit */
+  static void set_cache_limit(size_t bytes);
+
+  /** @return peak amount of memory held by all pools, in bytes */
+  static size_t peak_usage();
+
+  /** @return amount of memory currently held by all pools, in bytes */
+  static size_t usage();
+
+  ~Io_buffer_pool();
+
+  /** Get a buffer aligned to UNIV_PAGE_SIZE.
+  @param[in]  size  buffer size
+  @return buffer */
+  byte *acquire(size_t size);
+
+  /** Return a buffer obtained with acquire().
+  @param[in]  buf   buffer
+  @param[in]  size  size passed to acquire() */
+  void release(byte *buf, size_t size);
+
+  /** Free the cached buffers of the pool. */
+  void trim();
+
+ private:
+  Io_buffer_pool() = default;
+
+  /** Round size up to the size of the buffer actually allocated.
+  @param[in]  size  requested size
+  @return buffer size */
+  static size_t capacity(size_t size);
+
+  /** free buffers by their capacity */
+  std::multimap<size_t, byte *> free_bufs;
+
+  /** bytes held in free_bufs */
+  size_t cached{0};
+
+  static size_t cache_limit;
+  static std::atomic<size_t> allocated;
+  static std::atomic<size_t> peak;
+};
+
+#endif
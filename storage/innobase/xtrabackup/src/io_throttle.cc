@@ -0,0 +1,247 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "io_throttle.h"
+#include "msg.h"
+#include "wait_state.h"
+
+Io_throttle io_throttle_read;
+Io_throttle io_throttle_write;
+
+/** Token bucket in the group file of io_throttle_join_group() */
+struct Io_throttle_shared {
+  /** process shared robust mutex protecting the other members */
+  pthread_mutex_t mutex;
+
+  /** bytes per second, 0 for unlimited */
+  uint64_t rate;
+
+  /** bucket size, tokens accumulated over 100 milliseconds */
+  double burst;
+
+  /** available tokens, negative if in debt */
+  double tokens;
+
+  /** CLOCK_MONOTONIC time of the last refill in nanoseconds, the clock is
+  the same for all the processes of the host */
+  int64_t refilled_ns;
+};
+
+/** Contents of the group file */
+struct Io_throttle_group {
+  /** GROUP_MAGIC once the buckets are initialized */
+  uint64_t magic;
+
+  /** bucket of io_throttle_read */
+  Io_throttle_shared read;
+
+  /** bucket of io_throttle_write */
+  Io_throttle_shared write;
+};
+
+/** Tells initialized group files, changes with the layout of the file */
+static const uint64_t GROUP_MAGIC =
+    0x7862746731000000ULL | sizeof(Io_throttle_group);
+
+/** @return CLOCK_MONOTONIC time in nanoseconds */
+static int64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+}
+
+/** Refill a bucket and take tokens from it.
+@param[in,out]  tokens         available tokens
+@param[in]      burst          bucket size
+@param[in]      elapsed        seconds since the last refill
+@param[in]      bytes_per_sec  rate
+@param[in]      len            tokens to take
+@return time to sleep to pay the debt back, zero if none */
+static std::chrono::microseconds take_tokens(double *tokens, double burst,
+                                             double elapsed,
+                                             double bytes_per_sec,
+                                             size_t len) {
+  *tokens = std::min(burst, *tokens + elapsed * bytes_per_sec) - len;
+  if (*tokens >= 0) {
+    return (std::chrono::microseconds(0));
+  }
+
+  return (std::chrono::microseconds(
+      static_cast<int64_t>(-*tokens * 1000000 / bytes_per_sec)));
+}
+
+/** Lock the mutex of a shared bucket, recovering it when its owner died.
+@param[in,out]  bucket  shared bucket */
+static void lock_shared(Io_throttle_shared *bucket) {
+  if (pthread_mutex_lock(&bucket->mutex) == EOWNERDEAD) {
+    /* the members are updated together, a stale update is harmless */
+    pthread_mutex_consistent(&bucket->mutex);
+  }
+}
+
+void Io_throttle::set_rate(uint64_t bytes_per_sec) {
+  std::lock_guard<std::mutex> lock(mutex);
+  rate = bytes_per_sec;
+  burst = bytes_per_sec / 10.0;
+  tokens = burst;
+  refilled = std::chrono::steady_clock::now();
+
+  /* a process which stops throttling leaves the rate of the group to the
+  others */
+  if (shared != nullptr && bytes_per_sec != 0) {
+    lock_shared(shared);
+    if (shared->rate != bytes_per_sec) {
+      shared->rate = bytes_per_sec;
+      shared->burst = burst;
+      shared->tokens = std::min(shared->tokens, burst);
+    }
+    pthread_mutex_unlock(&shared->mutex);
+  }
+}
+
+void Io_throttle::share(Io_throttle_shared *bucket) {
+  std::lock_guard<std::mutex> lock(mutex);
+  shared = bucket;
+}
+
+void Io_throttle::acquire(size_t len) {
+  total.fetch_add(len, std::memory_order_relaxed);
+
+  if (rate.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+
+  std::chrono::microseconds delay;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const double bytes_per_sec = rate.load();
+    if (bytes_per_sec == 0) {
+      return;
+    }
+
+    if (shared != nullptr) {
+      lock_shared(shared);
+      const int64_t now = monotonic_ns();
+      const double elapsed = (now - shared->refilled_ns) / 1e9;
+      shared->refilled_ns = now;
+      delay = shared->rate == 0
+                  ? std::chrono::microseconds(0)
+                  : take_tokens(&shared->tokens, shared->burst, elapsed,
+                                shared->rate, len);
+      pthread_mutex_unlock(&shared->mutex);
+    } else {
+      const auto now = std::chrono::steady_clock::now();
+      const double elapsed =
+          std::chrono::duration<double>(now - refilled).count();
+      refilled = now;
+
+      delay = take_tokens(&tokens, burst, elapsed, bytes_per_sec, len);
+    }
+
+    if (delay.count() == 0) {
+      return;
+    }
+  }
+
+  slept.fetch_add(delay.count(), std::memory_order_relaxed);
+  xb::wait_state::Scope wait(xb::wait_state::THROTTLE);
+  std::this_thread::sleep_for(delay);
+}
+
+/** Initialize a shared bucket.
+@param[out]  bucket  bucket in the group file
+@return false on error */
+static bool init_shared(Io_throttle_shared *bucket) {
+  pthread_mutexattr_t attr;
+
+  if (pthread_mutexattr_init(&attr) != 0) {
+    return (false);
+  }
+  const bool ok =
+      pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) == 0 &&
+      pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) == 0 &&
+      pthread_mutex_init(&bucket->mutex, &attr) == 0;
+  pthread_mutexattr_destroy(&attr);
+
+  bucket->rate = 0;
+  bucket->burst = 0;
+  bucket->tokens = 0;
+  bucket->refilled_ns = monotonic_ns();
+
+  return (ok);
+}
+
+bool io_throttle_join_group(const char *path) {
+  const int fd = open(path, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    msg_ts("Cannot open the throttle group file %s, errno = %d.\n", path,
+           errno);
+    return (false);
+  }
+
+  /* the first process initializes the file, the others wait for it */
+  if (flock(fd, LOCK_EX) != 0 ||
+      ftruncate(fd, sizeof(Io_throttle_group)) != 0) {
+    msg_ts("Cannot set up the throttle group file %s, errno = %d.\n", path,
+           errno);
+    close(fd);
+    return (false);
+  }
+
+  void *ptr = mmap(nullptr, sizeof(Io_throttle_group), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) {
+    msg_ts("Cannot map the throttle group file %s, errno = %d.\n", path,
+           errno);
+    close(fd);
+    return (false);
+  }
+
+  auto group = static_cast<Io_throttle_group *>(ptr);
+  if (group->magic != GROUP_MAGIC) {
+    if (!init_shared(&group->read) || !init_shared(&group->write)) {
+      msg_ts("Cannot initialize the throttle group file %s.\n", path);
+      munmap(ptr, sizeof(Io_throttle_group));
+      close(fd);
+      return (false);
+    }
+    group->magic = GROUP_MAGIC;
+  }
+
+  /* the mapping stays valid after the file is closed */
+  close(fd);
+
+  io_throttle_read.share(&group->read);
+  io_throttle_write.share(&group->write);
+
+  return (true);
+}
@@ -0,0 +1,102 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+/* Byte rate limit of backup I/O */
+
+#ifndef IO_THROTTLE_H
+#define IO_THROTTLE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+struct Io_throttle_shared;
+
+/** Token bucket limiting the number of bytes transferred per second. The
+bucket is refilled continuously, so the I/O is spread evenly instead of
+being done in bursts. A request larger than the bucket goes into debt and
+the caller sleeps until the debt is paid back, which keeps the long term
+rate exact for any request size. */
+class Io_throttle {
+ public:
+  /** Set the rate limit.
+  @param[in]  bytes_per_sec  limit, 0 for unlimited */
+  void set_rate(uint64_t bytes_per_sec);
+
+  /** Take the tokens for a transfer, sleeping until they are available.
+  @param[in]  len  number of bytes to transfer */
+  void acquire(size_t len);
+
+  /** @return number of bytes passed through acquire(), throttled or not */
+  uint64_t transferred() const { return total.load(); }
+
+  /** @return current limit in bytes per second, 0 for unlimited */
+  uint64_t get_rate() const { return rate.load(); }
+
+  /** @return microseconds spent sleeping in acquire() by all callers */
+  uint64_t slept_usecs() const { return slept.load(); }
+
+  /** Take the tokens from a bucket shared with other processes instead of
+  the bucket of this process. The rate set with set_rate() becomes the rate
+  of the shared bucket.
+  @param[in]  bucket  shared bucket */
+  void share(Io_throttle_shared *bucket);
+
+ private:
+  std::mutex mutex;
+
+  /** bucket shared with other processes, nullptr if none */
+  Io_throttle_shared *shared{nullptr};
+
+  /** bytes per second, 0 for unlimited */
+  std::atomic<uint64_t> rate{0};
+
+  /** bucket size, tokens accumulated over 100 milliseconds */
+  double burst{0};
+
+  /** available tokens, negative if in debt */
+  double tokens{0};
+
+  /** time of the last refill */
+  std::chrono::steady_clock::time_point refilled;
+
+  /** bytes passed through acquire() */
+  std::atomic<uint64_t> total{0};
+
+  /** microseconds slept in acquire() */
+  std::atomic<uint64_t> slept{0};
+};
+
+/** limits the datafile reads */
+extern Io_throttle io_throttle_read;
+
+/** limits the writes of the local datasink */
+extern Io_throttle io_throttle_write;
+
+/** Share io_throttle_read and io_throttle_write with the other processes
+using the same group file, e.g. the xtrabackup processes backing up the
+instances of a host. The buckets live in the file, which is mapped by every
+process, so that the rate limits apply to the processes together and the
+idle ones leave their share to the busy ones.
+@param[in]  path  group file, created if it does not exist
+@return false on error */
+bool io_throttle_join_group(const char *path);
+
+#endif
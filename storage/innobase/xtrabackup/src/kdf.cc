@@ -17,7 +17,14 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 *******************************************************/
 
 #include "kdf.h"
+#include <fcntl.h>
 #include <gcrypt.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common.h"
 #include "xtrabackup_config.h"
 
 const int XB_KDF_ITERATIONS = 32768;
@@ -198,3 +205,142 @@ bool xb_derive_key(const char *passphrase, size_t passphraselen,
 }
 
 #endif
+
+namespace {
+
+/** Key derived from a passphrase and a salt */
+struct derived_key_t {
+  std::string passphrase;
+  std::vector<byte> salt;
+  std::vector<byte> key;
+};
+
+/* keys derived by this process, every xtrabackup_keys file of a restore
+has a salt of its own */
+std::mutex derived_keys_mutex;
+std::vector<derived_key_t> derived_keys;
+
+/** Record of the cache file: salt length, key length, salt and key */
+const size_t CACHE_RECORD_HEADER = 2;
+
+/** Open the cache file of the derived keys, refusing one that other users
+can read or write, as it gives the keys of the backups.
+@param[in]	path	cache file
+@param[in]	flags	open() flags
+@return file descriptor or -1 */
+int cache_open(const char *path, int flags) {
+  int fd = open(path, flags | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    return (-1);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_uid != geteuid() || (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+    xb::warn() << "ignoring the key derivation cache " << path
+               << ", it must be a regular file only accessible by its owner";
+    close(fd);
+    return (-1);
+  }
+
+  return (fd);
+}
+
+/** Look up a derived key in the cache file.
+@return true if found */
+bool cache_read(const char *path, const byte *salt, size_t saltlen,
+                size_t keysize, byte *keybuffer) {
+  int fd = cache_open(path, O_RDONLY);
+  if (fd < 0) {
+    return (false);
+  }
+
+  std::vector<byte> record(CACHE_RECORD_HEADER + saltlen + keysize);
+  bool found = false;
+  byte header[CACHE_RECORD_HEADER];
+  while (!found && read(fd, header, sizeof(header)) == sizeof(header)) {
+    const size_t len = header[0] + header[1];
+    if (header[0] != saltlen || header[1] != keysize) {
+      if (lseek(fd, len, SEEK_CUR) < 0) {
+        break;
+      }
+      continue;
+    }
+    if (read(fd, &record[0], len) != static_cast<ssize_t>(len)) {
+      break;
+    }
+    if (memcmp(&record[0], salt, saltlen) == 0) {
+      memcpy(keybuffer, &record[saltlen], keysize);
+      found = true;
+    }
+  }
+  memset(&record[0], 0, record.size());
+
+  close(fd);
+  return (found);
+}
+
+/** Append a derived key to the cache file, a single write of a record is
+not interleaved with the ones of other processes. */
+void cache_write(const char *path, const byte *salt, size_t saltlen,
+                 size_t keysize, const byte *keybuffer) {
+  int fd = cache_open(path, O_WRONLY | O_APPEND | O_CREAT);
+  if (fd < 0) {
+    return;
+  }
+
+  std::vector<byte> record(CACHE_RECORD_HEADER + saltlen + keysize);
+  record[0] = static_cast<byte>(saltlen);
+  record[1] = static_cast<byte>(keysize);
+  memcpy(&record[CACHE_RECORD_HEADER], salt, saltlen);
+  memcpy(&record[CACHE_RECORD_HEADER + saltlen], keybuffer, keysize);
+
+  if (write(fd, &record[0], record.size()) !=
+      static_cast<ssize_t>(record.size())) {
+    xb::warn() << "cannot write the key derivation cache " << path;
+  }
+  memset(&record[0], 0, record.size());
+
+  close(fd);
+}
+
+}  // namespace
+
+bool xb_derive_key_cached(const char *passphrase, size_t passphraselen,
+                          const byte *salt, size_t saltlen, size_t keysize,
+                          byte *keybuffer, const char *cache_file) {
+  if (saltlen > 255 || keysize > 255) {
+    return (xb_derive_key(passphrase, passphraselen, salt, saltlen, keysize,
+                          keybuffer));
+  }
+
+  std::lock_guard<std::mutex> lock(derived_keys_mutex);
+
+  for (const auto &derived : derived_keys) {
+    if (derived.key.size() == keysize &&
+        derived.passphrase.compare(0, std::string::npos, passphrase,
+                                   passphraselen) == 0 &&
+        derived.salt.size() == saltlen &&
+        memcmp(&derived.salt[0], salt, saltlen) == 0) {
+      memcpy(keybuffer, &derived.key[0], keysize);
+      return (true);
+    }
+  }
+
+  if (cache_file == nullptr ||
+      !cache_read(cache_file, salt, saltlen, keysize, keybuffer)) {
+    if (!xb_derive_key(passphrase, passphraselen, salt, saltlen, keysize,
+                       keybuffer)) {
+      return (false);
+    }
+    if (cache_file != nullptr) {
+      cache_write(cache_file, salt, saltlen, keysize, keybuffer);
+    }
+  }
+
+  derived_keys.push_back({std::string(passphrase, passphraselen),
+                          std::vector<byte>(salt, salt + saltlen),
+                          std::vector<byte>(keybuffer, keybuffer + keysize)});
+
+  return (true);
+}
@@ -17,4 +17,20 @@ bool xb_derive_key(const char *passphrase, size_t passphraselen,
                    const byte *salt, size_t saltlen, size_t keysize,
                    byte *keybuffer);
 
+/** Derive key from the passphrase using PBKDF2, once per passphrase and
+salt in this process. The keys found in the cache file are not derived
+again, the ones derived are added to it.
+@param[in]	passphrase	passphrase.
+@param[in]	passphraselen	passphrase length.
+@param[in]	salt		random salt.
+@param[in]	saltlen		random salt length.
+@param[in]	keysize		desired derived key length.
+@param[out]	keybuffer	buffer to store derived key.
+@param[in]	cache_file	file caching the keys derived by other
+                                processes, or nullptr
+@return	true on success. */
+bool xb_derive_key_cached(const char *passphrase, size_t passphraselen,
+                          const byte *salt, size_t saltlen, size_t keysize,
+                          byte *keybuffer, const char *cache_file);
+
 #endif
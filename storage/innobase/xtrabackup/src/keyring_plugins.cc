@@ -46,6 +46,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include "xtrabackup.h"
 
 #include <map>
+#include <mutex>
 
 struct tablespace_encryption_info {
   byte key[Encryption::KEY_LEN];
@@ -54,6 +55,16 @@ struct tablespace_encryption_info {
 
 static std::map<ulint, tablespace_encryption_info> encryption_info;
 
+/* Keys of the tablespaces re-encrypted by --reencrypt-tablespaces: the key
+of the source tablespace and the key of the backup */
+struct tablespace_reencryption_info {
+  tablespace_encryption_info source;
+  tablespace_encryption_info backup;
+};
+
+static std::mutex reencryption_mutex;
+static std::map<ulint, tablespace_reencryption_info> reencryption_info;
+
 extern st_mysql_plugin *mysql_optional_plugins[];
 extern st_mysql_plugin *mysql_mandatory_plugins[];
 
@@ -160,6 +171,29 @@ void xb_insert_tablespace_key(ulint space_id, const byte *key, const byte *iv) {
   encryption_info[space_id] = info;
 }
 
+bool xb_reencryption_key(ulint space_id, const byte *key, const byte *iv,
+                         byte *new_key, byte *new_iv) {
+  std::lock_guard<std::mutex> guard(reencryption_mutex);
+
+  auto it = reencryption_info.find(space_id);
+  if (it == reencryption_info.end()) {
+    tablespace_reencryption_info info;
+    memcpy(info.source.key, key, Encryption::KEY_LEN);
+    memcpy(info.source.iv, iv, Encryption::KEY_LEN);
+    Encryption::random_value(info.backup.key);
+    Encryption::random_value(info.backup.iv);
+    it = reencryption_info.emplace(space_id, info).first;
+  } else if (memcmp(it->second.source.key, key, Encryption::KEY_LEN) != 0 ||
+             memcmp(it->second.source.iv, iv, Encryption::KEY_LEN) != 0) {
+    return (false);
+  }
+
+  memcpy(new_key, it->second.backup.key, Encryption::KEY_LEN);
+  memcpy(new_iv, it->second.backup.iv, Encryption::KEY_LEN);
+
+  return (true);
+}
+
 /** Save the encryption metadata of redo log into encryption keys hash.
 This hash is later used to dump the saved keys into xtrabackup_keys file
 @param[in]   e_m   Encryption metadata of redo log */
@@ -568,8 +602,9 @@ bool xb_tablespace_keys_load_one(const char *dir, const char *transition_key,
   }
 
   xb_libgcrypt_init();
-  ret = xb_derive_key(transition_key, transition_key_len, salt, sizeof(salt),
-                      sizeof(derived_key), derived_key);
+  ret = xb_derive_key_cached(transition_key, transition_key_len, salt,
+                             sizeof(salt), sizeof(derived_key), derived_key,
+                             opt_transition_key_cache);
 
   if (!ret) {
     xb::error() << "Error reading " << XTRABACKUP_KEYS_FILE
@@ -760,9 +795,24 @@ bool xb_tablespace_keys_dump(ds_ctxt_t *ds_ctxt, const char *transition_key,
     if (space->m_encryption_metadata.m_type == Encryption::NONE) {
       return (DB_SUCCESS);
     }
-    if (!xb_tablespace_keys_write_single(stream, derived_key, space->id,
-                                         space->m_encryption_metadata.m_key,
-                                         space->m_encryption_metadata.m_iv)) {
+    const byte *key = space->m_encryption_metadata.m_key;
+    const byte *iv = space->m_encryption_metadata.m_iv;
+    const auto it = reencryption_info.find(space->id);
+    if (it != reencryption_info.end()) {
+      /* the pages in the backup are encrypted with the key of the backup */
+      if (memcmp(it->second.source.key, key, Encryption::KEY_LEN) != 0 ||
+          memcmp(it->second.source.iv, iv, Encryption::KEY_LEN) != 0) {
+        xb::error() << "Error writing " << XTRABACKUP_KEYS_FILE
+                    << ": the key of tablespace " << space->name
+                    << " changed during the backup, it cannot be "
+                    << "re-encrypted.";
+        return (DB_ERROR);
+      }
+      key = it->second.backup.key;
+      iv = it->second.backup.iv;
+    }
+    if (!xb_tablespace_keys_write_single(stream, derived_key, space->id, key,
+                                         iv)) {
       xb::error() << "Error writing " << XTRABACKUP_KEYS_FILE
                   << ": failed to save tablespace key.";
       return (DB_ERROR);
@@ -776,6 +826,13 @@ bool xb_tablespace_keys_dump(ds_ctxt_t *ds_ctxt, const char *transition_key,
 
   if (recv_sys->keys != nullptr) {
     for (auto &key : *recv_sys->keys) {
+      if (reencryption_info.count(key.space_id) > 0) {
+        xb::error() << "Error writing " << XTRABACKUP_KEYS_FILE
+                    << ": the key of tablespace " << key.space_id
+                    << " changed during the backup, it cannot be "
+                    << "re-encrypted.";
+        goto error;
+      }
       if (!xb_tablespace_keys_write_single(stream, derived_key, key.space_id,
                                            key.ptr, key.iv)) {
         xb::error() << "Error writing " << XTRABACKUP_KEYS_FILE
@@ -794,6 +851,11 @@ bool xb_tablespace_keys_dump(ds_ctxt_t *ds_ctxt, const char *transition_key,
     }
   }
 
+  if (!reencryption_info.empty()) {
+    xb::info() << "Re-encrypted " << reencryption_info.size()
+               << " tablespaces with keys of the backup";
+  }
+
   ds_close(stream);
   return (true);
 
@@ -65,6 +65,18 @@ bool xb_tablespace_keys_exist();
 bool xb_tablespace_keys_load(const char *dir, const char *transition_key,
                              size_t transition_key_len);
 
+/** Get the key the pages of a tablespace are re-encrypted with in the backup
+by --reencrypt-tablespaces, generated on first use and dumped into
+"xtrabackup_keys" instead of the key of the tablespace.
+@param[in]	space_id	tablespace id
+@param[in]	key		tablespace key
+@param[in]	iv		tablespace iv
+@param[out]	new_key		key of the backup
+@param[out]	new_iv		iv of the backup
+@return false if the tablespace was re-encrypted from another key */
+bool xb_reencryption_key(ulint space_id, const byte *key, const byte *iv,
+                         byte *new_key, byte *new_iv);
+
 /** Dump tablespace keys into encrypted "xtrabackup_keys" file.
 @param[in]	ds_ctxt			datasink context to output file into
 @param[in]	transition_key		transition key used to encrypt
@@ -0,0 +1,54 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Accounting of the memory held by the backup buffers.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <univ.i>
+
+#include <sstream>
+
+#include "memory_budget.h"
+
+namespace xb {
+namespace memory {
+
+static const char *component_names[N_COMPONENTS] = {
+    "stream", "compress", "encrypt", "datasink", "redo", "datafile"};
+
+void report() {
+  std::ostringstream s;
+  size_t total_peak;
+  size_t max;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = 0; i < N_COMPONENTS; i++) {
+      s << (i > 0 ? ", " : "") << component_names[i] << " "
+        << component_peak[i];
+    }
+    total_peak = peak;
+    max = limit;
+  }
+
+  xb::info() << "Peak memory of the backup buffers: " << total_peak
+             << " bytes" << (max != 0 ? " of --max-memory " : "")
+             << (max != 0 ? std::to_string(max) : std::string())
+             << ". Peak by component, in bytes: " << s.str();
+}
+
+}  // namespace memory
+}  // namespace xb
@@ -0,0 +1,152 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Accounting of the memory held by the backup buffers.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <stddef.h>
+#include <condition_variable>
+#include <mutex>
+
+/* Buffers allocated by the datasinks, the redo log copy and the copy threads
+are charged to the component owning them. Charges never fail: the buffers of
+a running pipeline are needed to make progress. The number of copy threads
+reading datafiles is what adapts to the limit instead, every copy thread
+reserves the memory of its datafile buffers before it opens a datafile and
+waits while the reservation does not fit. Header only, so that the datasinks
+shared with xbstream and xbcrypt can be accounted. */
+namespace xb {
+namespace memory {
+
+enum Component {
+  /* xbstream chunk buffers */
+  STREAM,
+  /* compression chunks and frames */
+  COMPRESS,
+  /* encryption chunks */
+  ENCRYPT,
+  /* leases handed between datasinks */
+  DATASINK,
+  /* redo log read buffers */
+  REDO,
+  /* datafile buffers reserved by the copy threads */
+  DATAFILE,
+  N_COMPONENTS
+};
+
+inline std::mutex mutex;
+inline std::condition_variable released;
+
+/* 0 means unlimited */
+inline size_t limit = 0;
+inline size_t used = 0;
+inline size_t peak = 0;
+inline size_t component_used[N_COMPONENTS]{};
+inline size_t component_peak[N_COMPONENTS]{};
+
+inline void add(Component component, size_t bytes) {
+  used += bytes;
+  component_used[component] += bytes;
+  if (used > peak) {
+    peak = used;
+  }
+  if (component_used[component] > component_peak[component]) {
+    component_peak[component] = component_used[component];
+  }
+}
+
+inline void sub(Component component, size_t bytes) {
+  used -= bytes;
+  component_used[component] -= bytes;
+  released.notify_all();
+}
+
+/** Set the maximum memory of the accounted buffers.
+@param[in]  bytes  limit, 0 for unlimited */
+inline void set_limit(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  limit = bytes;
+}
+
+/** Account bytes allocated by a component. */
+inline void charge(Component component, size_t bytes) {
+  if (bytes == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  add(component, bytes);
+}
+
+/** Account bytes freed by a component. */
+inline void uncharge(Component component, size_t bytes) {
+  if (bytes == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  sub(component, bytes);
+}
+
+/** Reserve datafile buffers if they fit in the limit. A reservation is
+always granted when no other one is held, so that the backup makes progress
+with a single copy thread whatever the limit is.
+@param[in]  bytes  reservation
+@return true if reserved */
+inline bool try_reserve(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (limit != 0 && used + bytes > limit && component_used[DATAFILE] != 0) {
+    return false;
+  }
+  add(DATAFILE, bytes);
+  return true;
+}
+
+/** Reserve datafile buffers, waiting until they fit in the limit.
+@param[in]  bytes  reservation */
+inline void reserve(size_t bytes) {
+  std::unique_lock<std::mutex> lock(mutex);
+  released.wait(lock, [bytes] {
+    return limit == 0 || used + bytes <= limit ||
+           component_used[DATAFILE] == 0;
+  });
+  add(DATAFILE, bytes);
+}
+
+/** Give back a reservation made with reserve() or try_reserve(). */
+inline void unreserve(size_t bytes) { uncharge(DATAFILE, bytes); }
+
+/** @return true if the accounted memory exceeds the limit */
+inline bool over_limit() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return limit != 0 && used > limit;
+}
+
+/** @return accounted memory, in bytes */
+inline size_t usage() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return used;
+}
+
+/** Log the peak memory of every component. Only linked into xtrabackup. */
+void report();
+
+}  // namespace memory
+}  // namespace xb
+
+#endif
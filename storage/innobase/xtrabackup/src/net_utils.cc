@@ -0,0 +1,189 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+TCP connections of xtrabackup --stream-to and xbstream --listen.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include "net_utils.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include "common.h"
+#include "msg.h"
+
+/** Split an address into host and port.
+@param[in]   address  [host:]port or [IPv6 address]:port
+@param[out]  host     host, empty if not given
+@param[out]  port     port
+@return false if the address is malformed */
+static bool net_parse_address(const char *address, std::string *host,
+                              std::string *port) {
+  const char *sep = strrchr(address, ':');
+
+  if (sep == nullptr) {
+    host->clear();
+    *port = address;
+  } else if (address[0] == '[') {
+    if (sep == address || sep[-1] != ']') {
+      return false;
+    }
+    host->assign(address + 1, sep - address - 2);
+    *port = sep + 1;
+  } else {
+    host->assign(address, sep - address);
+    *port = sep + 1;
+  }
+
+  return !port->empty() &&
+         port->find_first_not_of("0123456789") == std::string::npos;
+}
+
+/** Resolve the address of a stream connection.
+@param[in]  address  address as given by the user
+@param[in]  passive  true to listen on it
+@return list of addresses to be freed with freeaddrinfo(), nullptr on error */
+static struct addrinfo *net_resolve(const char *address, bool passive) {
+  std::string host;
+  std::string port;
+  struct addrinfo hints;
+  struct addrinfo *res;
+
+  if (!net_parse_address(address, &host, &port)) {
+    msg("invalid address '%s', expected host:port\n", address);
+    return nullptr;
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+  const int err = getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                              port.c_str(), &hints, &res);
+  if (err != 0) {
+    msg("failed to resolve '%s': %s\n", address, gai_strerror(err));
+    return nullptr;
+  }
+
+  return res;
+}
+
+/** Request large socket buffers, before connecting or listening so that
+window scaling is negotiated for them. */
+static void net_set_buffers(int fd) {
+  const int size = XB_NET_SOCKET_BUFFER_SIZE;
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+File net_connect(const char *address, uint timeout) {
+  struct addrinfo *res = net_resolve(address, false);
+  int fd = -1;
+  uint attempt = 0;
+
+  if (res == nullptr) {
+    return -1;
+  }
+
+  do {
+    for (struct addrinfo *ai = res; ai != nullptr; ai = ai->ai_next) {
+      fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0) {
+        continue;
+      }
+      net_set_buffers(fd);
+      if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+        break;
+      }
+      close(fd);
+      fd = -1;
+    }
+    if (fd < 0) {
+      attempt++;
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+  } while (fd < 0 && attempt < timeout);
+
+  if (fd < 0) {
+    msg("failed to connect to %s: %s\n", address, strerror(errno));
+  }
+
+  freeaddrinfo(res);
+
+  return fd;
+}
+
+bool net_accept(const char *address, uint n_conns, std::vector<File> *fds) {
+  struct addrinfo *res = net_resolve(address, true);
+  int listen_fd = -1;
+
+  if (res == nullptr) {
+    return false;
+  }
+
+  for (struct addrinfo *ai = res; ai != nullptr; ai = ai->ai_next) {
+    listen_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (listen_fd < 0) {
+      continue;
+    }
+    const int on = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    /* inherited by the accepted sockets */
+    net_set_buffers(listen_fd);
+    if (bind(listen_fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+        listen(listen_fd, n_conns) == 0) {
+      break;
+    }
+    close(listen_fd);
+    listen_fd = -1;
+  }
+
+  freeaddrinfo(res);
+
+  if (listen_fd < 0) {
+    msg("failed to listen on %s: %s\n", address, strerror(errno));
+    return false;
+  }
+
+  fds->clear();
+  while (fds->size() < n_conns) {
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      msg("failed to accept a connection on %s: %s\n", address,
+          strerror(errno));
+      for (auto conn : *fds) {
+        close(conn);
+      }
+      fds->clear();
+      close(listen_fd);
+      return false;
+    }
+    fds->push_back(fd);
+  }
+
+  close(listen_fd);
+
+  return true;
+}
@@ -0,0 +1,55 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+TCP connections of xtrabackup --stream-to and xbstream --listen.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef NET_UTILS_H
+#define NET_UTILS_H
+
+#include <my_io.h>
+#include <vector>
+
+/** Socket buffer size requested for stream connections. Latency between
+datacenters needs a large window to keep the link busy, the kernel caps it
+to net.core.wmem_max / rmem_max. */
+constexpr int XB_NET_SOCKET_BUFFER_SIZE = 16 * 1024 * 1024;
+
+/**
+  Connect to a stream receiver. Connection attempts are repeated for up to
+  timeout seconds, so that the receiver can be started after the sender.
+
+  @param [in]       address   host:port, [IPv6 address]:port
+  @param [in]       timeout   timeout in seconds
+
+  @return connected socket, -1 on error
+*/
+File net_connect(const char *address, uint timeout);
+
+/**
+  Listen on an address and accept a number of connections of a stream
+  sender.
+
+  @param [in]       address   [host:]port, [IPv6 address]:port
+  @param [in]       n_conns   connections to accept
+  @param [out]      fds       accepted sockets
+
+  @return false on error
+*/
+bool net_accept(const char *address, uint n_conns, std::vector<File> *fds);
+
+#endif
@@ -23,9 +23,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 /* Data file read filter implementation */
 
 #include "read_filt.h"
+#include <buf0checksum.h>
+#include <fsp0fsp.h>
 #include "common.h"
 #include "dict0dict.h"
 #include "fil_cur.h"
+#include "io_buffer_pool.h"
 #include "xb0xb.h"
 #include "xtrabackup.h"
 
@@ -42,6 +45,8 @@ static void common_init(
   ctxt->buffer_capacity = cursor->buf_size;
   ctxt->page_size = cursor->page_size;
   ctxt->space_id = cursor->space_id;
+  ctxt->skipped = 0;
+  ctxt->free_extents = nullptr;
 }
 
 /****************************************************************/ /**
@@ -114,6 +119,38 @@ static void rf_page_tracking_init(xb_read_filt_ctxt_t *ctxt,
   ctxt->filter_batch_end = 0;
 }
 
+/** Hint the kernel to read ahead the runs of changed pages up to
+opt_page_tracking_read_ahead runs past the current one, so that the device
+keeps busy while the sparse batches are copied. At most a read buffer of each
+run is hinted, the sequential read-ahead takes care of the rest.
+@param[in/out] cursor   read cursor
+@param[in/out] space    changed pages of the space */
+static void rf_page_tracking_read_ahead(xb_fil_cur_t *cursor,
+                                        pagetracking::xb_page_set *space) {
+  xb_read_filt_ctxt_t *ctxt = &cursor->read_filter_ctxt;
+
+  /* the current run is read right away */
+  if (ctxt->read_ahead_it <= space->current_range_it) {
+    ctxt->read_ahead_it = space->current_range_it + 1;
+  }
+
+  if (cursor->direct_io || opt_page_tracking_read_ahead == 0) {
+    return;
+  }
+
+  while (ctxt->read_ahead_it != space->ranges.end() &&
+         ctxt->read_ahead_it - space->current_range_it <=
+             static_cast<ptrdiff_t>(opt_page_tracking_read_ahead)) {
+    const uint64_t start = uint64_t{ctxt->read_ahead_it->first} *
+                           ctxt->page_size;
+    const uint64_t len = std::min<uint64_t>(
+        (uint64_t{ctxt->read_ahead_it->last} + 1) * ctxt->page_size - start,
+        ctxt->buffer_capacity);
+    posix_fadvise(cursor->file.m_file, start, len, POSIX_FADV_WILLNEED);
+    ++ctxt->read_ahead_it;
+  }
+}
+
 /** Get the next batch of pages for the page tracking based filter.
 @param[in/out] cursor            source file cursor
 @param[out]    read_batch_start  starting read offset for the next pages batch
@@ -194,17 +231,18 @@ static void rf_page_tracking_get_next_batch(xb_fil_cur_t *cursor,
       auto space = &changed_page_tracking->at(ctxt->space_id);
 
       if (ctxt->offset == 0) {
-        space->current_page_it = space->pages.begin();
+        space->current_range_it = space->ranges.begin();
+        ctxt->read_ahead_it = space->current_range_it;
       } else {
-        /* find the page where we end the last block */
-        ut_ad(space->current_page_it != space->pages.end());
-        space->current_page_it++;
-        if (space->current_page_it == space->pages.end()) {
+        /* move past the block we ended at */
+        ut_ad(space->current_range_it != space->ranges.end());
+        space->current_range_it++;
+        if (space->current_range_it == space->ranges.end()) {
           *read_batch_len = 0;
           return;
         }
       }
-      next_page_id = *space->current_page_it;
+      next_page_id = space->current_range_it->first;
 
 #ifdef UNIV_DEBUG
       verify_skipped_pages();
@@ -212,11 +250,12 @@ static void rf_page_tracking_get_next_batch(xb_fil_cur_t *cursor,
 
       ctxt->offset = next_page_id * ctxt->page_size;
       /* Find the end of the current page tracking block */
-      pagetracking::range_get_next_page(space);
-      ut_ad(space->current_page_it != space->pages.end());
-
-      ctxt->filter_batch_end = (*space->current_page_it) + 1;
+      ctxt->filter_batch_end =
+          pagetracking::range_get_next_page(space, opt_page_tracking_max_gap) +
+          1;
       ut_ad(next_page_id <= ctxt->filter_batch_end);
+
+      rf_page_tracking_read_ahead(cursor, space);
     }
 
     *read_batch_start = ctxt->offset;
@@ -246,6 +285,151 @@ static void rf_page_tracking_get_next_batch(xb_fil_cur_t *cursor,
 static void rf_page_tracking_deinit(xb_read_filt_ctxt_t *ctxt
                                     __attribute__((unused))) {}
 
+/** Read the extent descriptor pages of the file and return the map of the
+extents which can be skipped. An extent is skipped only when its descriptor
+page has not been modified since the backup start checkpoint and says the
+extent is free: in that case none of its pages is in the redo log, unless it
+gets allocated later, and then its pages are initialized by the redo log from
+scratch. Descriptor pages that cannot be read or verified leave all of their
+extents to be copied.
+@param[in]  cursor  read cursor
+@return free extents map */
+static std::vector<bool> *rf_free_extents_build(const xb_fil_cur_t *cursor) {
+  const ulint page_size = cursor->page_size;
+  const page_size_t page_size_ext(
+      cursor->zip_size != 0 ? cursor->zip_size : cursor->page_size,
+      cursor->page_size, cursor->zip_size != 0);
+  const ulint n_pages = cursor->statinfo.st_size / page_size;
+  const ulint n_extents = n_pages / FSP_EXTENT_SIZE;
+
+  auto free_extents = ut::new_withkey<std::vector<bool>>(
+      UT_NEW_THIS_FILE_PSI_KEY, n_extents, false);
+
+  if (n_extents < 2 || backup_start_checkpoint_lsn == 0) {
+    return (free_extents);
+  }
+
+  IORequest read_request(IORequest::READ | IORequest::NO_COMPRESSION);
+  byte *page = Io_buffer_pool::instance().acquire(page_size);
+  ulint n_free = 0;
+
+  /* the descriptor page of the extent i is i * FSP_EXTENT_SIZE rounded down
+  to a multiple of the physical page size */
+  for (ulint xdes_page_no = 0; xdes_page_no < n_pages;
+       xdes_page_no += page_size) {
+    if (os_file_read_no_error_handling(read_request, cursor->rel_path,
+                                       cursor->file, page,
+                                       xdes_page_no * page_size, page_size,
+                                       nullptr) != DB_SUCCESS) {
+      break;
+    }
+
+    const auto page_type = fil_page_get_type(page);
+    if ((page_type != FIL_PAGE_TYPE_FSP_HDR &&
+         page_type != FIL_PAGE_TYPE_XDES) ||
+        mach_read_from_4(page + FIL_PAGE_OFFSET) != xdes_page_no ||
+        mach_read_from_8(page + FIL_PAGE_LSN) > backup_start_checkpoint_lsn ||
+        BlockReporter(false, page, page_size_ext, false).is_corrupted()) {
+      continue;
+    }
+
+    for (ulint i = 0; i < page_size / FSP_EXTENT_SIZE; i++) {
+      const ulint extent = xdes_page_no / FSP_EXTENT_SIZE + i;
+      if (extent >= n_extents) {
+        break;
+      }
+
+      const byte *descr = page + XDES_ARR_OFFSET + i * XDES_SIZE;
+      if (mach_read_from_4(descr + XDES_STATE) == XDES_FREE) {
+        (*free_extents)[extent] = true;
+        n_free++;
+      }
+    }
+  }
+
+  Io_buffer_pool::instance().release(page, page_size);
+
+  /* the file must end with copied data, so that its size is preserved */
+  if ((*free_extents)[n_extents - 1]) {
+    (*free_extents)[n_extents - 1] = false;
+    n_free--;
+  }
+
+  if (n_free > 0) {
+    xb::info() << "Skipping " << n_free << " free extents of "
+               << cursor->abs_path;
+  }
+
+  return (free_extents);
+}
+
+/** Initialize the free extent skipping read filter.
+@param[in/out] ctxt     read filter context
+@param[in]     cursor   read cursor
+@param[in]     space_id space id */
+static void rf_free_extents_init(xb_read_filt_ctxt_t *ctxt,
+                                 const xb_fil_cur_t *cursor,
+                                 ulint space_id [[maybe_unused]]) {
+  common_init(ctxt, cursor);
+
+  /* descriptor pages of encrypted tablespaces are encrypted as well */
+  if (!cursor->is_encrypted) {
+    ctxt->free_extents = rf_free_extents_build(cursor);
+  }
+}
+
+/** Get the next batch of pages for the free extent skipping filter. Free
+extents in front of the batch are skipped and reported in ctxt->skipped, the
+batch ends at the next free extent.
+@param[in/out] cursor            source file cursor
+@param[out]    read_batch_start  starting read offset for the next pages batch
+@param[out]    read_batch_len    length in bytes of next batch of pages */
+static void rf_free_extents_get_next_batch(xb_fil_cur_t *cursor,
+                                           uint64_t *read_batch_start,
+                                           uint64_t *read_batch_len) {
+  xb_read_filt_ctxt_t *ctxt = &cursor->read_filter_ctxt;
+  const uint64_t extent_len = FSP_EXTENT_SIZE * ctxt->page_size;
+  const auto free_extents = ctxt->free_extents;
+  const uint64_t n_extents = free_extents != nullptr ? free_extents->size() : 0;
+
+  uint64_t extent = ctxt->offset / extent_len;
+  uint64_t offset = ctxt->offset;
+
+  if (offset % extent_len == 0) {
+    while (extent < n_extents && (*free_extents)[extent]) {
+      extent++;
+    }
+    offset = extent * extent_len;
+  }
+
+  ctxt->skipped = offset - ctxt->offset;
+  ctxt->offset = offset;
+
+  *read_batch_start = offset;
+  if (offset >= ctxt->data_file_size) {
+    *read_batch_len = 0;
+    return;
+  }
+
+  uint64_t end = ctxt->data_file_size;
+  while (++extent < n_extents && extent * extent_len - offset <
+                                     ctxt->buffer_capacity) {
+    if ((*free_extents)[extent]) {
+      end = extent * extent_len;
+      break;
+    }
+  }
+
+  *read_batch_len = std::min(end - offset, ctxt->buffer_capacity);
+}
+
+/** Deinitialize the free extent skipping read filter.
+@param[in] ctxt   read filter context */
+static void rf_free_extents_deinit(xb_read_filt_ctxt_t *ctxt) {
+  ut::delete_(ctxt->free_extents);
+  ctxt->free_extents = nullptr;
+}
+
 /* The pass-through read filter */
 xb_read_filt_t rf_pass_through = {&rf_pass_through_init,
                                   &rf_pass_through_get_next_batch,
@@ -255,3 +439,8 @@ xb_read_filt_t rf_pass_through = {&rf_pass_through_init,
 xb_read_filt_t rf_page_tracking = {&rf_page_tracking_init,
                                    &rf_page_tracking_get_next_batch,
                                    &rf_page_tracking_deinit, &common_update};
+
+/* The free extent skipping read filter */
+xb_read_filt_t rf_free_extents = {&rf_free_extents_init,
+                                  &rf_free_extents_get_next_batch,
+                                  &rf_free_extents_deinit, &common_update};
@@ -25,6 +25,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #ifndef XB_READ_FILT_H
 #define XB_READ_FILT_H
 
+#include <vector>
+
 #include "changed_page_tracking.h"
 
 struct xb_fil_cur_t;
@@ -39,6 +41,13 @@ struct xb_read_filt_ctxt_t {
   ulint filter_batch_end;             /*!< the ending page id of the
                                       current changed page block in
                                       the page tracking */
+  uint64_t skipped;                   /*!< bytes of free extents skipped
+                                      right before the current batch */
+  std::vector<bool> *free_extents;    /*!< extents to skip, indexed by
+                                      extent number */
+  pagetracking::range_iterator read_ahead_it; /*!< first run of changed
+                                      pages not hinted for read-ahead
+                                      yet */
 };
 
 /* The read filter */
@@ -54,5 +63,6 @@ struct xb_read_filt_t {
 
 extern xb_read_filt_t rf_pass_through;
 extern xb_read_filt_t rf_page_tracking;
+extern xb_read_filt_t rf_free_extents;
 
 #endif
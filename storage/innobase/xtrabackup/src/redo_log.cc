@@ -26,6 +26,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <ut0ut.h>
 #include <univ.i>
 
+#include <limits>
 #include <sstream>
 
 #include "backup_copy.h"
@@ -34,12 +35,20 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "file_utils.h"
 #include "log0encryption.h"
 #include "log0pre_8_0_30.h"
+#include "memory_budget.h"
 #include "os0event.h"
 #include "sql_thd_internal_api.h"
 #include "xb0xb.h"
 #include "xtrabackup.h"
 
 extern ds_ctxt_t *ds_redo;
+
+/** longest time the copied redo stays in the datasink buffers. */
+static constexpr std::chrono::seconds redo_log_flush_interval{10};
+
+/** longest time between two advances of the redo log consumer. */
+static constexpr std::chrono::milliseconds redo_log_consumer_interval{1000};
+
 /* first block of redo archive file which is all zero in 8.0.22  */
 constexpr size_t HEADER_BLOCK_SIZE = 4096;
 static bool archive_first_block_zero = false;
@@ -48,15 +57,95 @@ lsn_t Redo_Log_Reader::checkpoint_lsn_start;
 os_offset_t Redo_Log_Reader::checkpoint_offset_start;
 IF_DEBUG(bool force_reopen = false;);
 
+void (*xb_redo_page_hook)(space_id_t space_id, page_no_t page_no) = nullptr;
+
+bool (*xb_index_load_hook)(space_id_t space_id, lsn_t lsn) = nullptr;
+
+bool (*xb_undo_truncate_hook)(space_id_t space_id, lsn_t lsn) = nullptr;
+
+/** pages collected by Redo_Log_Data_Manager::scan_changed_pages() */
+static pagetracking::xb_space_map *redo_scan_pages = nullptr;
+
+/** Add the page of a parsed redo log record to redo_scan_pages.
+@param[in] space_id             space id
+@param[in] page_no              page number */
+static void redo_scan_add_page(space_id_t space_id, page_no_t page_no) {
+  auto it = redo_scan_pages->find(space_id);
+  if (it == redo_scan_pages->end()) {
+    redo_scan_pages->emplace(space_id, pagetracking::xb_page_set(page_no));
+    return;
+  }
+
+  auto &page_set = it->second;
+  if (page_set.ranges.size() == page_set.ranges.capacity()) {
+    /* the same pages are modified over and over, merge the runs before
+    growing the vector and grow it only if that did not free enough */
+    page_set.merge();
+    if (page_set.ranges.size() > page_set.ranges.capacity() / 2) {
+      page_set.ranges.reserve(page_set.ranges.capacity() * 2);
+    }
+  }
+  page_set.insert(page_no);
+}
+
+/** Whether the redo log is read and written encrypted with the same key, so
+that its blocks can be copied to xtrabackup_logfile as they are on disk and
+only a copy of them is decrypted for the parser.
+@return true if the redo log is encrypted */
+static bool redo_log_copy_encrypted() {
+  return (srv_redo_log_encrypt && log_sys->m_encryption_metadata.can_encrypt());
+}
+
+/** Decrypt a copy of encrypted log blocks in one pass.
+@param[in]   src                encrypted blocks
+@param[in]   len                length of the blocks
+@param[out]  dst                decrypted blocks
+@return false if error. */
+static bool log_blocks_decrypt_copy(const byte *src, size_t len, byte *dst) {
+  memcpy(dst, src, len);
+
+  IORequest req_type(IORequest::READ);
+  req_type.get_encryption_info().set(log_sys->m_encryption_metadata);
+  Encryption encryption(req_type.encryption_algorithm());
+
+  return (encryption.decrypt_log(dst, len) == DB_SUCCESS);
+}
+
+/** Open a redo log file for reading.
+@param[in]  file                log file
+@param[in]  raw                 read the blocks without decrypting them
+@return file handle */
+static Log_file_handle log_file_open_read(const Log_file &file, bool raw) {
+  /* reads with an empty metadata are not decrypted */
+  static Encryption_metadata no_encryption;
+
+  if (raw) {
+    return (Log_file::open(file.m_files_ctx, file.m_id,
+                           Log_file_access_mode::READ_ONLY, no_encryption,
+                           Log_file_type::NORMAL));
+  }
+  return (file.open(Log_file_access_mode::READ_ONLY));
+}
+
 Redo_Log_Reader::Redo_Log_Reader() {
   log_hdr_buf.alloc_withkey(UT_NEW_THIS_FILE_PSI_KEY,
                             ut::Count{LOG_FILE_HDR_SIZE});
   log_buf.alloc_withkey(UT_NEW_THIS_FILE_PSI_KEY,
                         ut::Count{redo_log_read_buffer_size});
+  xb::memory::charge(xb::memory::REDO,
+                     LOG_FILE_HDR_SIZE + redo_log_read_buffer_size);
 
   m_error = false;
 }
 
+Redo_Log_Reader::~Redo_Log_Reader() {
+  xb::memory::uncharge(xb::memory::REDO,
+                       LOG_FILE_HDR_SIZE + redo_log_read_buffer_size);
+  if (encrypted) {
+    xb::memory::uncharge(xb::memory::REDO, redo_log_read_buffer_size);
+  }
+}
+
 bool Redo_Log_Reader::find_start_checkpoint_lsn() {
   if (log_sys->m_files.ctx().m_files_ruleset == Log_files_ruleset::CURRENT) {
     /* Look for the latest checkpoint */
@@ -119,6 +208,10 @@ byte *Redo_Log_Reader::get_header() const { return log_hdr_buf; }
 
 byte *Redo_Log_Reader::get_buffer() const { return log_buf; }
 
+const byte *Redo_Log_Reader::get_encrypted_buffer() const {
+  return (encrypted ? static_cast<const byte *>(encrypted_buf) : nullptr);
+}
+
 lsn_t Redo_Log_Reader::get_scanned_lsn() const { return (log_scanned_lsn); }
 
 lsn_t Redo_Log_Reader::get_contiguous_lsn() const {
@@ -131,6 +224,8 @@ lsn_t Redo_Log_Reader::get_start_checkpoint_lsn() const {
 
 bool Redo_Log_Reader::is_error() const { return (m_error); }
 
+void Redo_Log_Reader::clear_error() { m_error = false; }
+
 /** scan redo log files form server directory and update log.m_files.
 @param[in,out]  desired_lsn             LSN that triggered file reopening.
 if LSN == 0, PXB opens the redo log file and checks if the redo is disabled or
@@ -192,7 +287,8 @@ static bool reopen_log_files(lsn_t desired_lsn) {
 }
 
 lsn_t Redo_Log_Reader::read_log_seg_pre8030(log_t &log, byte *buf,
-                                            lsn_t start_lsn, lsn_t end_lsn) {
+                                            lsn_t start_lsn, lsn_t end_lsn,
+                                            bool raw) {
   const size_t n_files = log_files_number_of_existing_files(log.m_files);
   const auto logfile0 = log.m_files.file(0);
   const os_offset_t file_size = logfile0->m_size_in_bytes;
@@ -206,7 +302,7 @@ lsn_t Redo_Log_Reader::read_log_seg_pre8030(log_t &log, byte *buf,
 
     auto file = log.m_files.file(file_id);
 
-    auto file_handle = file->open(Log_file_access_mode::READ_ONLY);
+    auto file_handle = log_file_open_read(*file, raw);
 
     if (!file_handle.is_open()) {
       // file not found
@@ -248,7 +344,7 @@ lsn_t Redo_Log_Reader::read_log_seg_pre8030(log_t &log, byte *buf,
 }
 
 lsn_t Redo_Log_Reader::read_log_seg_8030(log_t &log, byte *buf, lsn_t start_lsn,
-                                    lsn_t end_lsn) {
+                                    lsn_t end_lsn, bool raw) {
   ut_a(start_lsn < end_lsn);
 
   // update the in-memory structure log files by scanning
@@ -273,7 +369,7 @@ lsn_t Redo_Log_Reader::read_log_seg_8030(log_t &log, byte *buf, lsn_t start_lsn,
 
   ut_ad(file != log.m_files.end());
 
-  auto file_handle = file->open(Log_file_access_mode::READ_ONLY);
+  auto file_handle = log_file_open_read(*file, raw);
 
   if (!file_handle.is_open()) {
     // file not found
@@ -322,7 +418,7 @@ lsn_t Redo_Log_Reader::read_log_seg_8030(log_t &log, byte *buf, lsn_t start_lsn,
 
       file = next_file;
 
-      file_handle = file->open(Log_file_access_mode::READ_ONLY);
+      file_handle = log_file_open_read(*file, raw);
       ut_a(file_handle.is_open());
     }
 
@@ -334,11 +430,11 @@ lsn_t Redo_Log_Reader::read_log_seg_8030(log_t &log, byte *buf, lsn_t start_lsn,
 }
 
 lsn_t Redo_Log_Reader::read_log_seg(log_t &log, byte *buf, lsn_t start_lsn,
-                                    lsn_t end_lsn) {
+                                    lsn_t end_lsn, bool raw) {
   if (log.m_files.ctx().m_files_ruleset == Log_files_ruleset::CURRENT) {
-        return(read_log_seg_8030(log, buf, start_lsn, end_lsn));
+        return(read_log_seg_8030(log, buf, start_lsn, end_lsn, raw));
   } else {
-        return(read_log_seg_pre8030(log, buf, start_lsn, end_lsn));
+        return(read_log_seg_pre8030(log, buf, start_lsn, end_lsn, raw));
   }
 }
 
@@ -351,11 +447,47 @@ ssize_t Redo_Log_Reader::read_logfile(bool is_last, bool *finished) {
 
   size_t len = 0;
 
+  /* The log is read straight into log_buf in segments spanning several
+  RECV_SCAN_SIZE slices, which are then scanned in place. The segment size
+  starts at one slice and doubles while the server keeps the segments full,
+  so an idle server costs one small read per call and a busy one is read with
+  few large I/Os. An encrypted redo log is read as it is on disk into
+  encrypted_buf instead, and each segment is decrypted into log_buf in one
+  pass, so that the writer copies the encrypted blocks. */
+  size_t read_size = RECV_SCAN_SIZE;
+  lsn_t read_end_lsn = start_lsn;
+
+  if (!encrypted && redo_log_copy_encrypted()) {
+    encrypted_buf.alloc_withkey(UT_NEW_THIS_FILE_PSI_KEY,
+                                ut::Count{redo_log_read_buffer_size});
+    xb::memory::charge(xb::memory::REDO, redo_log_read_buffer_size);
+    encrypted = true;
+  }
+
   *finished = false;
 
   while (!*finished && len <= redo_log_read_buffer_size - RECV_SCAN_SIZE) {
-    const lsn_t end_lsn =
-        read_log_seg(log, log_buf + len, start_lsn, start_lsn + RECV_SCAN_SIZE);
+    if (start_lsn >= read_end_lsn) {
+      read_size = std::min(read_size, ut_uint64_align_down(
+                                          redo_log_read_buffer_size - len,
+                                          RECV_SCAN_SIZE));
+      read_end_lsn =
+          read_log_seg(log, encrypted ? encrypted_buf + len : log_buf + len,
+                       start_lsn, start_lsn + read_size, encrypted);
+      if (read_end_lsn == 0) {
+        xb::error() << "read_logfile() failed.";
+        return (-1);
+      }
+      if (encrypted &&
+          !log_blocks_decrypt_copy(encrypted_buf + len,
+                                   read_end_lsn - start_lsn, log_buf + len)) {
+        xb::error() << "Failed to decrypt redo log";
+        return (-1);
+      }
+      read_size *= 2;
+    }
+
+    const lsn_t end_lsn = std::min(read_end_lsn, start_lsn + RECV_SCAN_SIZE);
 
     auto size = scan_log_recs(log_buf + len, is_last, start_lsn, &scanned_lsn,
                               log_scanned_lsn, finished);
@@ -363,7 +495,7 @@ ssize_t Redo_Log_Reader::read_logfile(bool is_last, bool *finished) {
       break;
     }
 
-    if (size < 0 || end_lsn == 0) {
+    if (size < 0) {
       xb::error() << "read_logfile() failed.";
       return (-1);
     }
@@ -496,6 +628,50 @@ ssize_t Redo_Log_Reader::scan_log_recs_pre8030(byte *buf, bool is_last,
   return (write_size);
 }
 
+/** Validate a run of full log blocks in one call. A block passes when its
+checksum matches, its header number is the one of its lsn, it is full and
+its epoch is the one of the previous block or the next one. The checksum
+function is looked up once for the run, ut_crc32() uses the CRC32 instructions
+of the CPU when the server has them.
+@param[in]      buf             first block of the run
+@param[in]      n_blocks        number of blocks in the run
+@param[in]      start_lsn       lsn of the first block
+@param[in,out]  epoch_no        epoch of the block before the run, 0 if not
+                                known, set to the epoch of the last block
+                                which passed
+@return index of the first block which does not pass, n_blocks if all do */
+static size_t log_blocks_validate(const byte *buf, size_t n_blocks,
+                                  lsn_t start_lsn, ulint *epoch_no) {
+  const auto calc_checksum = log_checksum_algorithm_ptr.load();
+  const bool checksums = srv_log_checksums;
+  uint32_t hdr_no = log_block_convert_lsn_to_hdr_no(start_lsn);
+  ulint epoch = *epoch_no;
+  size_t i = 0;
+
+  for (const byte *block = buf; i < n_blocks;
+       ++i, block += OS_FILE_LOG_BLOCK_SIZE) {
+    if (log_block_get_data_len(block) != OS_FILE_LOG_BLOCK_SIZE ||
+        log_block_get_hdr_no(block) != hdr_no ||
+        (checksums &&
+         log_block_get_checksum(block) != calc_checksum(block))) {
+      break;
+    }
+
+    const uint32_t block_epoch = log_block_get_epoch_no(block);
+    if (epoch > 0 && !log_block_epoch_no_is_valid(block_epoch, epoch)) {
+      break;
+    }
+    epoch = block_epoch;
+
+    hdr_no = log_block_convert_lsn_to_hdr_no(start_lsn +
+                                             (i + 1) * OS_FILE_LOG_BLOCK_SIZE);
+  }
+
+  *epoch_no = epoch;
+
+  return (i);
+}
+
 ssize_t Redo_Log_Reader::scan_log_recs_8030(byte *buf, bool is_last,
                                             lsn_t start_lsn,
                                             lsn_t *read_upto_lsn,
@@ -509,6 +685,18 @@ ssize_t Redo_Log_Reader::scan_log_recs_8030(byte *buf, bool is_last,
   ulint scanned_epoch_no{0};
 
   while (log_block < buf + RECV_SCAN_SIZE && !*finished) {
+    /* the full blocks are validated in bulk, the block ending the run is
+    looked at one by one below */
+    const size_t n_valid = log_blocks_validate(
+        log_block, (buf + RECV_SCAN_SIZE - log_block) / OS_FILE_LOG_BLOCK_SIZE,
+        scanned_lsn, &scanned_epoch_no);
+    log_block += n_valid * OS_FILE_LOG_BLOCK_SIZE;
+    scanned_lsn += n_valid * OS_FILE_LOG_BLOCK_SIZE;
+
+    if (log_block >= buf + RECV_SCAN_SIZE) {
+      break;
+    }
+
     Log_data_block_header block_header;
     log_data_block_header_deserialize(log_block, block_header);
 
@@ -699,6 +887,11 @@ bool Redo_Log_Parser::parse_log(const byte *buf, size_t len, lsn_t start_lsn) {
 Redo_Log_Writer::Redo_Log_Writer() {
   scratch_buf.alloc_withkey(UT_NEW_THIS_FILE_PSI_KEY,
                             ut::Count{16 * 1024 * 1024});
+  xb::memory::charge(xb::memory::REDO, 16 * 1024 * 1024);
+}
+
+Redo_Log_Writer::~Redo_Log_Writer() {
+  xb::memory::uncharge(xb::memory::REDO, 16 * 1024 * 1024);
 }
 
 bool Redo_Log_Writer::create_logfile(const char *name) {
@@ -732,6 +925,38 @@ bool Redo_Log_Writer::write_header(byte *hdr) {
   return (true);
 }
 
+bool Redo_Log_Writer::flush_logfile() {
+  if (ds_flush(log_file) != 0) {
+    xb::error() << "failed to flush logfile";
+    return (false);
+  }
+  return (true);
+}
+
+bool Redo_Log_Writer::rotate_logfile(lsn_t start_lsn) {
+  if (!close_logfile()) {
+    return (false);
+  }
+
+  char name[FN_REFLEN];
+  snprintf(name, sizeof(name), "%s.%llu", XB_LOG_FILENAME,
+           static_cast<unsigned long long>(start_lsn));
+
+  MY_STAT stat_info;
+  memset(&stat_info, 0, sizeof(MY_STAT));
+  log_file = ds_open(ds_redo, name, &stat_info);
+  if (log_file == NULL) {
+    xb::error() << "failed to open the target stream for " << SQUOTE(name);
+    return (false);
+  }
+  written = 0;
+
+  xb::info() << "Archiving the redo log from lsn " << start_lsn << " into "
+             << name;
+
+  return (true);
+}
+
 bool Redo_Log_Writer::close_logfile() {
   if (ds_close(log_file) != 0) {
     xb::error() << "failed to close logfile";
@@ -741,10 +966,13 @@ bool Redo_Log_Writer::close_logfile() {
 }
 
 
-bool Redo_Log_Writer::write_buffer(byte *buf, size_t len) {
-  byte *write_buf = buf;
+bool Redo_Log_Writer::write_buffer(byte *buf, size_t len,
+                                   const byte *encrypted) {
+  const byte *write_buf = buf;
 
-  if (srv_redo_log_encrypt) {
+  if (encrypted != nullptr) {
+    write_buf = encrypted;
+  } else if (srv_redo_log_encrypt) {
     IORequest req_type(IORequest::WRITE);
     req_type.get_encryption_info().set(log_sys->m_encryption_metadata);
     ut_ad(req_type.is_encrypted());
@@ -761,6 +989,7 @@ bool Redo_Log_Writer::write_buffer(byte *buf, size_t len) {
     xb::error() << "write to logfile failed";
     return (false);
   }
+  written += len;
 
   return (true);
 }
@@ -768,8 +997,14 @@ bool Redo_Log_Writer::write_buffer(byte *buf, size_t len) {
 Archived_Redo_Log_Reader::Archived_Redo_Log_Reader() {
   log_buf.alloc_withkey(UT_NEW_THIS_FILE_PSI_KEY,
                         ut::Count{redo_log_read_buffer_size});
-  scratch_buf.alloc_withkey(UT_NEW_THIS_FILE_PSI_KEY,
-                            ut::Count{UNIV_PAGE_SIZE_MAX});
+  xb::memory::charge(xb::memory::REDO, redo_log_read_buffer_size);
+}
+
+Archived_Redo_Log_Reader::~Archived_Redo_Log_Reader() {
+  xb::memory::uncharge(xb::memory::REDO, redo_log_read_buffer_size);
+  if (encrypted) {
+    xb::memory::uncharge(xb::memory::REDO, redo_log_read_buffer_size);
+  }
 }
 
 void Archived_Redo_Log_Reader::set_fd(File fd) { file = fd; }
@@ -778,7 +1013,17 @@ ssize_t Archived_Redo_Log_Reader::read_logfile(bool *finished) {
   auto read_size =
       ut_uint64_align_down(redo_log_read_buffer_size, OS_FILE_LOG_BLOCK_SIZE);
 
-  auto len = my_read(file, log_buf, read_size, MYF(MY_WME | MY_FULL_IO));
+  /* the archive is encrypted as the redo log, it is read into encrypted_buf
+  then and decrypted into log_buf in one pass */
+  if (!encrypted && srv_redo_log_encrypt) {
+    encrypted_buf.alloc_withkey(UT_NEW_THIS_FILE_PSI_KEY,
+                                ut::Count{redo_log_read_buffer_size});
+    xb::memory::charge(xb::memory::REDO, redo_log_read_buffer_size);
+    encrypted = true;
+  }
+
+  auto len = my_read(file, encrypted ? encrypted_buf : log_buf, read_size,
+                     MYF(MY_WME | MY_FULL_IO));
   if (len == MY_FILE_ERROR) {
     return (-1);
   }
@@ -791,12 +1036,8 @@ ssize_t Archived_Redo_Log_Reader::read_logfile(bool *finished) {
     *finished = true;
   }
 
-  if (srv_redo_log_encrypt) {
-    IORequest req_type(IORequest::READ);
-    req_type.get_encryption_info().set(log_sys->m_encryption_metadata);
-    Encryption encryption(req_type.encryption_algorithm());
-    auto err = encryption.decrypt_log(log_buf, len);
-    ut_a(err == DB_SUCCESS);
+  if (encrypted) {
+    ut_a(log_blocks_decrypt_copy(encrypted_buf, len, log_buf));
   }
 
   for (const byte *log_block = log_buf; log_block < log_buf + len;
@@ -847,6 +1088,10 @@ void Archived_Redo_Log_Reader::set_start_lsn(lsn_t lsn) {
 
 byte *Archived_Redo_Log_Reader::get_buffer() const { return (log_buf); }
 
+const byte *Archived_Redo_Log_Reader::get_encrypted_buffer() const {
+  return (encrypted ? static_cast<const byte *>(encrypted_buf) : nullptr);
+}
+
 lsn_t Archived_Redo_Log_Reader::get_contiguous_lsn() const {
   return (log_scanned_lsn);
 }
@@ -1277,6 +1522,11 @@ bool Redo_Log_Data_Manager::start() {
   xtrabackup_start_checkpoint = start_checkpoint_lsn;
   stop_lsn = 0;
 
+  if (xtrabackup_incremental != nullptr && xtrabackup_incremental_redo_scan &&
+      !xtrabackup_incremental_force_scan && !opt_page_tracking) {
+    changed_pages = scan_changed_pages(incremental_lsn);
+  }
+
   if (opt_lock_ddl_per_table) {
     mdl_lock_tables();
   }
@@ -1311,9 +1561,274 @@ bool Redo_Log_Data_Manager::start() {
 
   error = false;
 
+  /* the server keeps the redo registered consumers and the archive have not
+  read, it is never overwritten then */
+  if ((opt_redo_lag_warn_time > 0 || opt_redo_lag_abort_time > 0) &&
+      !xtrabackup_register_redo_log_consumer &&
+      !xtrabackup_redo_log_arch_only) {
+    lag_monitor_stop = os_event_create();
+    lag_monitor = std::thread(&Redo_Log_Data_Manager::lag_monitor_func, this);
+  }
+
   return (true);
 }
 
+/** Seconds between the samples of the redo lag monitor */
+static const uint REDO_LAG_MONITOR_INTERVAL = 5;
+
+void Redo_Log_Data_Manager::lag_monitor_func() {
+  my_thread_init();
+
+  MYSQL *mysql = xb_mysql_connect();
+  if (mysql == nullptr) {
+    xb::warn() << "redo lag monitor failed to connect, the redo lag is not "
+                  "watched";
+    my_thread_end();
+    return;
+  }
+
+  char *redo_log_capacity = nullptr;
+  char *log_file_size = nullptr;
+  char *log_files_in_group = nullptr;
+  mysql_variable vars[] = {
+      {"innodb_redo_log_capacity", &redo_log_capacity},
+      {"innodb_log_file_size", &log_file_size},
+      {"innodb_log_files_in_group", &log_files_in_group},
+      {NULL, NULL}};
+  read_mysql_variables(mysql,
+                       "SHOW GLOBAL VARIABLES WHERE Variable_name IN "
+                       "('innodb_redo_log_capacity', 'innodb_log_file_size', "
+                       "'innodb_log_files_in_group')",
+                       vars, true);
+  /* innodb_redo_log_capacity replaces the other two in 8.0.30 */
+  lsn_t capacity = 0;
+  if (redo_log_capacity != nullptr) {
+    capacity = strtoull(redo_log_capacity, nullptr, 10);
+  } else if (log_file_size != nullptr && log_files_in_group != nullptr) {
+    capacity = strtoull(log_file_size, nullptr, 10) *
+               strtoull(log_files_in_group, nullptr, 10);
+  }
+  free_mysql_variables(vars);
+
+  if (capacity == 0) {
+    xb::warn() << "redo lag monitor cannot find the redo log capacity of the "
+                  "server, the redo lag is not watched";
+  }
+
+  const auto interval = std::chrono::seconds{REDO_LAG_MONITOR_INTERVAL};
+  bool sampled = false;
+  bool at_risk = false;
+  uint samples_at_risk = 0;
+  lsn_t prev_server_lsn = 0;
+  lsn_t prev_copied_lsn = 0;
+  double generated_rate = 0;
+  double copied_rate = 0;
+
+  while (capacity > 0 && os_event_wait_time(lag_monitor_stop, interval) ==
+                             OS_SYNC_TIME_EXCEEDED) {
+    char *lsn_current = nullptr;
+    char *lsn_checkpoint = nullptr;
+    mysql_variable metrics[] = {{"log_lsn_current", &lsn_current},
+                                {"log_lsn_last_checkpoint", &lsn_checkpoint},
+                                {NULL, NULL}};
+    read_mysql_variables(mysql,
+                         "SELECT NAME, COUNT FROM "
+                         "information_schema.INNODB_METRICS WHERE NAME IN "
+                         "('log_lsn_current', 'log_lsn_last_checkpoint')",
+                         metrics, true);
+    const lsn_t server_lsn =
+        lsn_current != nullptr ? strtoull(lsn_current, nullptr, 10) : 0;
+    const lsn_t checkpoint_lsn =
+        lsn_checkpoint != nullptr ? strtoull(lsn_checkpoint, nullptr, 10) : 0;
+    free_mysql_variables(metrics);
+
+    const lsn_t copied_lsn = reader.get_scanned_lsn();
+    if (server_lsn == 0) {
+      continue;
+    }
+
+    if (!sampled) {
+      prev_server_lsn = server_lsn;
+      prev_copied_lsn = copied_lsn;
+      sampled = true;
+      continue;
+    }
+
+    /* rates averaged over the last few samples, so that a single busy
+    interval of the server does not trigger the actions */
+    const double server_delta =
+        server_lsn > prev_server_lsn ? server_lsn - prev_server_lsn : 0;
+    const double copied_delta =
+        copied_lsn > prev_copied_lsn ? copied_lsn - prev_copied_lsn : 0;
+    generated_rate = (generated_rate + server_delta / interval.count()) / 2;
+    copied_rate = (copied_rate + copied_delta / interval.count()) / 2;
+    prev_server_lsn = server_lsn;
+    prev_copied_lsn = copied_lsn;
+
+    /* the server writes over the unread redo once it is a log capacity
+    ahead of the copy */
+    const lsn_t lag = server_lsn > copied_lsn ? server_lsn - copied_lsn : 0;
+    const double headroom = lag < capacity ? capacity - lag : 0;
+    const double closing_rate = generated_rate - copied_rate;
+    const double time_left = closing_rate > 0
+                                 ? headroom / closing_rate
+                                 : std::numeric_limits<double>::infinity();
+
+    if (opt_redo_lag_abort_time > 0 && time_left < opt_redo_lag_abort_time) {
+      xb::error() << "The redo log is predicted to be overwritten before it "
+                     "is copied in "
+                  << static_cast<uint64_t>(time_left) << " seconds: lag "
+                  << lag << " bytes of " << capacity << ", the server writes "
+                  << static_cast<uint64_t>(generated_rate)
+                  << " bytes/s, the copy reads "
+                  << static_cast<uint64_t>(copied_rate)
+                  << " bytes/s. Giving up on the backup, see "
+                     "--redo-lag-abort-time.";
+      error = true;
+      aborted = true;
+      os_event_set(event);
+      break;
+    }
+
+    if (time_left < opt_redo_lag_warn_time) {
+      /* repeat the warning every minute while the risk lasts */
+      const uint repeat = 60 / REDO_LAG_MONITOR_INTERVAL;
+      if (samples_at_risk++ % repeat == 0) {
+        xb::warn() << "The redo log is predicted to be overwritten before "
+                      "it is copied in "
+                   << static_cast<uint64_t>(time_left) << " seconds: lag "
+                   << lag << " bytes of " << capacity << ", checkpoint age "
+                   << (server_lsn > checkpoint_lsn ? server_lsn - checkpoint_lsn
+                                                   : 0)
+                   << " bytes, the server writes "
+                   << static_cast<uint64_t>(generated_rate)
+                   << " bytes/s, the copy reads "
+                   << static_cast<uint64_t>(copied_rate) << " bytes/s";
+      }
+      /* the datafile copy competes with the redo copy for the disk, halve
+      the copy threads while the lag keeps growing */
+      if (!opt_adaptive_throttle) {
+        const uint threads = std::min<uint>(xtrabackup_copy_threads_limit,
+                                            xtrabackup_parallel);
+        if (threads > 1) {
+          xtrabackup_copy_threads_limit = threads / 2;
+          xb::info() << "Copying the datafiles with " << threads / 2
+                     << " threads to let the redo log copy catch up";
+        }
+      }
+      at_risk = true;
+    } else if (at_risk && time_left > 2.0 * opt_redo_lag_warn_time) {
+      xb::info() << "The redo log copy is keeping up with the server again";
+      if (!opt_adaptive_throttle) {
+        xtrabackup_copy_threads_limit = UINT_MAX;
+      }
+      at_risk = false;
+      samples_at_risk = 0;
+    }
+  }
+
+  if (at_risk && !opt_adaptive_throttle) {
+    xtrabackup_copy_threads_limit = UINT_MAX;
+  }
+
+  mysql_close(mysql);
+
+  my_thread_end();
+}
+
+void Redo_Log_Data_Manager::stop_lag_monitor() {
+  if (!lag_monitor.joinable()) {
+    return;
+  }
+  os_event_set(lag_monitor_stop);
+  lag_monitor.join();
+  os_event_destroy(lag_monitor_stop);
+}
+
+pagetracking::xb_space_map *Redo_Log_Data_Manager::scan_changed_pages(
+    lsn_t from_lsn) {
+  if (log_sys->m_files.ctx().m_files_ruleset != Log_files_ruleset::CURRENT) {
+    xb::info() << "--incremental-redo-scan requires the redo log format of "
+                  "MySQL 8.0.30 or newer";
+    return (nullptr);
+  }
+
+  if (from_lsn >= start_checkpoint_lsn) {
+    return (new pagetracking::xb_space_map);
+  }
+
+  /* parsing starts at the first group of records of the block, the few
+  records before from_lsn only add pages to copy */
+  const lsn_t start_lsn =
+      ut_uint64_align_down(from_lsn, OS_FILE_LOG_BLOCK_SIZE);
+  if (log_sys->m_files.find(start_lsn) == log_sys->m_files.end()) {
+    xb::info() << "The redo log does not reach back to the incremental LSN "
+               << from_lsn;
+    return (nullptr);
+  }
+
+  xb::info() << "Collecting the pages changed from LSN " << from_lsn << " to "
+             << start_checkpoint_lsn << " from the redo log";
+
+  auto space_map = new pagetracking::xb_space_map;
+  redo_scan_pages = space_map;
+  xb_redo_page_hook = redo_scan_add_page;
+
+  /* the file operations before the start checkpoint are in the data files
+  already, only parse them */
+  const lsn_t flushed_lsn = backup_redo_log_flushed_lsn;
+  backup_redo_log_flushed_lsn = LSN_MAX;
+
+  reader.seek_logfile(start_lsn);
+
+  bool success = true;
+  while (success && reader.get_scanned_lsn() < start_checkpoint_lsn) {
+    const lsn_t batch_lsn = reader.get_contiguous_lsn();
+    bool finished = false;
+
+    /* the server may have recycled the file meanwhile, the scan then stops
+    short of the checkpoint and the backup falls back to the full scan */
+    auto len = reader.read_logfile(false, &finished);
+    success = len > 0 && !reader.is_error() &&
+              parser.parse_log(reader.get_buffer(), len, batch_lsn) &&
+              !recv_sys->found_corrupt_log;
+  }
+
+  xb_redo_page_hook = nullptr;
+  redo_scan_pages = nullptr;
+  backup_redo_log_flushed_lsn = flushed_lsn;
+
+  /* the copy parses again from the start checkpoint */
+  recv_sys_close();
+  recv_sys_create();
+  recv_sys_init();
+  reader.seek_logfile(start_checkpoint_lsn);
+  reader.clear_error();
+
+  if (!success) {
+    xb::info() << "Failed to collect the changed pages from the redo log";
+    pagetracking::deinit(space_map);
+    return (nullptr);
+  }
+
+  size_t n_ranges = 0;
+  for (auto &space : *space_map) {
+    space.second.finalize();
+    n_ranges += space.second.ranges.size();
+  }
+
+  xb::info() << "Collected " << n_ranges << " runs of changed pages in "
+             << space_map->size() << " tablespaces from the redo log";
+
+  return (space_map);
+}
+
+pagetracking::xb_space_map *Redo_Log_Data_Manager::take_changed_pages() {
+  auto space_map = changed_pages;
+  changed_pages = nullptr;
+  return (space_map);
+}
+
 void Redo_Log_Data_Manager::track_archived_log(lsn_t start_lsn, const byte *buf,
                                                size_t len) {
   if (!archived_log_monitor.is_ready() ||
@@ -1347,6 +1862,9 @@ void Redo_Log_Data_Manager::track_archived_log(lsn_t start_lsn, const byte *buf,
             reader.get_contiguous_lsn())) {
       xb::info() << "Switched to archived redo log starting with LSN "
                  << reader.get_contiguous_lsn();
+      if (xtrabackup_redo_log_arch_only) {
+        xb::info() << "Copying the archived redo log when the backup stops";
+      }
       archived_log_state = ARCHIVED_LOG_POSITIONED;
     } else {
       ib::warn() << "Failed to seek Archive log file from LSN " << start_lsn;
@@ -1368,11 +1886,8 @@ bool Redo_Log_Data_Manager::copy_once(bool is_last, bool *finished) {
       }
 
       if (len > 0) {
-        if (!parser.parse_log(archive_reader.get_buffer(), len, start_lsn)) {
-          return (false);
-        }
-
-        if (!writer.write_buffer(archive_reader.get_buffer(), len)) {
+        if (!parse_and_write(archive_reader.get_buffer(), len, start_lsn,
+                             archive_reader.get_encrypted_buffer())) {
           return (false);
         }
 
@@ -1399,15 +1914,73 @@ bool Redo_Log_Data_Manager::copy_once(bool is_last, bool *finished) {
 
   track_archived_log(start_lsn, reader.get_buffer(), len);
 
-  if (!parser.parse_log(reader.get_buffer(), len, start_lsn)) {
+  return (parse_and_write(reader.get_buffer(), len, start_lsn,
+                          reader.get_encrypted_buffer()));
+}
+
+bool Redo_Log_Data_Manager::parse_and_write(byte *buf, size_t len,
+                                            lsn_t start_lsn,
+                                            const byte *encrypted) {
+  if (opt_archive_redo &&
+      writer.get_written() >= opt_archive_redo_segment_size &&
+      !writer.rotate_logfile(start_lsn)) {
     return (false);
   }
 
-  if (!writer.write_buffer(reader.get_buffer(), len)) {
-    return (false);
+  /* both only read the buffer, the next batch is read into it after both of
+  them are done */
+  bool written = false;
+  auto write_done = write_pool.add_task(
+      [&](size_t) { written = writer.write_buffer(buf, len, encrypted); });
+
+  bool parsed = parser.parse_log(buf, len, start_lsn);
+  if (parsed) {
+    parsed_lsn = recv_sys->recovered_lsn;
   }
 
-  return (true);
+  write_done.get();
+
+  return (parsed && written);
+}
+
+void Redo_Log_Data_Manager::wait_consumer() {
+  if (consumer_advance.valid()) {
+    consumer_advance.get();
+  }
+}
+
+void Redo_Log_Data_Manager::advance_consumer(lsn_t lsn, bool force) {
+  if (lsn == consumer_lsn) {
+    return;
+  }
+
+  if (lsn - consumer_lsn > max_consumer_lag) {
+    max_consumer_lag = lsn - consumer_lsn;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+
+  if (!force) {
+    /* the server is held up by the consumer only when its redo is full,
+    a read buffer of redo is well below that */
+    if (lsn - consumer_lsn < redo_log_read_buffer_size &&
+        now - consumer_advance_time < redo_log_consumer_interval) {
+      return;
+    }
+    if (consumer_advance.valid() &&
+        consumer_advance.wait_for(std::chrono::seconds{0}) !=
+            std::future_status::ready) {
+      return;
+    }
+  }
+
+  wait_consumer();
+
+  consumer_advance_time = now;
+  consumer_advance = consumer_pool.add_task([this, lsn](size_t) {
+    redo_log_consumer.advance(redo_log_consumer_cnx, lsn);
+    consumer_lsn = lsn;
+  });
 }
 
 void Redo_Log_Data_Manager::copy_func() {
@@ -1418,11 +1991,16 @@ void Redo_Log_Data_Manager::copy_func() {
   aborted = false;
   if (xtrabackup_register_redo_log_consumer &&
       redo_log_consumer_can_advance.load()) {
-    redo_log_consumer.advance(redo_log_consumer_cnx, reader.get_scanned_lsn());
+    advance_consumer(reader.get_scanned_lsn(), true);
   }
 
   bool finished;
-  lsn_t consumer_lsn = 0;
+  /* lsn copied up to at the end of the last wait */
+  lsn_t round_lsn = reader.get_scanned_lsn();
+  auto last_report = std::chrono::steady_clock::now();
+  /* lsn and time of the last flush of xtrabackup_logfile */
+  lsn_t flushed_lsn = reader.get_scanned_lsn();
+  auto last_flush = last_report;
   while (!aborted && (stop_lsn == 0 || stop_lsn > reader.get_scanned_lsn())) {
     xtrabackup_io_throttling();
 
@@ -1435,25 +2013,74 @@ void Redo_Log_Data_Manager::copy_func() {
         redo_log_consumer_can_advance.load()) {
       if (archived_log_monitor.is_ready() &&
           archived_log_state == ARCHIVED_LOG_POSITIONED) {
+        wait_consumer();
         redo_log_consumer.deinit(redo_log_consumer_cnx);
         mysql_close(redo_log_consumer_cnx);
         xtrabackup_register_redo_log_consumer = false;
       } else {
-        if (consumer_lsn != reader.get_scanned_lsn()) {
-          consumer_lsn = reader.get_scanned_lsn();
-          redo_log_consumer.advance(redo_log_consumer_cnx, consumer_lsn);
-        }
+        advance_consumer(reader.get_scanned_lsn(), false);
+      }
+    }
+
+    if (xtrabackup_redo_log_arch_only &&
+        archived_log_state == ARCHIVED_LOG_POSITIONED) {
+      /* the server keeps the archive until the backup stops, it is read in
+      one pass then instead of polling it during the copy of the datafiles */
+      const auto sig_count = os_event_reset(event);
+      if (!aborted && stop_lsn == 0) {
+        os_event_wait_low(event, sig_count);
       }
+      continue;
     }
 
     if (finished) {
-      xb::info() << ">> log scanned up to (" << reader.get_scanned_lsn() << ")";
+      /* redo generated by the server since the last wait, the copy would
+      have been overwritten if it reached the log capacity */
+      const lsn_t lag = reader.get_scanned_lsn() - round_lsn;
+      if (lag > max_lag) {
+        max_lag = lag;
+      }
+
+      /* wake up more often while the server writes more than one read
+      buffer per round, back off to copy_interval when idle */
+      if (lag >= redo_log_read_buffer_size) {
+        wait_interval = std::max<ulint>(wait_interval / 2, 1);
+      } else if (lag < redo_log_read_buffer_size / 4) {
+        wait_interval = std::min<ulint>(wait_interval * 2, copy_interval);
+      }
+
+      const auto now = std::chrono::steady_clock::now();
+      if (wait_interval == copy_interval ||
+          now - last_report >= std::chrono::milliseconds{copy_interval}) {
+        if (xtrabackup_register_redo_log_consumer) {
+          xb::info() << ">> log scanned up to (" << reader.get_scanned_lsn()
+                     << "), lag " << lag << " bytes, consumer lag "
+                     << reader.get_scanned_lsn() - consumer_lsn << " bytes";
+        } else {
+          xb::info() << ">> log scanned up to (" << reader.get_scanned_lsn()
+                     << "), lag " << lag << " bytes";
+        }
+        last_report = now;
+      }
+
+      /* a quiet server would leave the copy in the stream buffers until the
+      end of the backup, ship it as a segment of its own */
+      if (reader.get_scanned_lsn() != flushed_lsn &&
+          now - last_flush >= redo_log_flush_interval) {
+        if (!writer.flush_logfile()) {
+          error = true;
+          return;
+        }
+        flushed_lsn = reader.get_scanned_lsn();
+        last_flush = now;
+      }
 
       debug_sync_point("xtrabackup_copy_logfile_pause");
 
       os_event_reset(event);
-      os_event_wait_time_low(event, std::chrono::milliseconds{copy_interval},
+      os_event_wait_time_low(event, std::chrono::milliseconds{wait_interval},
                              0);
+      round_lsn = reader.get_scanned_lsn();
     }
   }
 
@@ -1477,11 +2104,31 @@ lsn_t Redo_Log_Data_Manager::get_start_checkpoint_lsn() const {
 
 lsn_t Redo_Log_Data_Manager::get_scanned_lsn() const { return (scanned_lsn); }
 
+lsn_t Redo_Log_Data_Manager::get_copied_lsn() const {
+  return (reader.get_scanned_lsn());
+}
+
+bool Redo_Log_Data_Manager::wait_parsed(lsn_t lsn) {
+  while (parsed_lsn < lsn) {
+    if (error || aborted) {
+      return (false);
+    }
+    /* wake up the copying thread waiting for the next round or for the end
+    of the redo log archive */
+    os_event_set(event);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  return (true);
+}
+
 void Redo_Log_Data_Manager::set_copy_interval(ulint interval) {
   copy_interval = interval;
+  wait_interval = interval;
 }
 
 void Redo_Log_Data_Manager::abort() {
+  stop_lag_monitor();
   aborted = true;
   os_event_set(event);
   thread.join();
@@ -1498,12 +2145,20 @@ bool Redo_Log_Data_Manager::stop_at(lsn_t lsn, lsn_t checkpoint_lsn) {
              << SQUOTE(last_checkpoint_lsn);
   xb::info() << "Stopping log copying thread at LSN " << lsn;
 
+  stop_lag_monitor();
+
   stop_lsn = lsn;
   os_event_set(event);
   thread.join();
 
   archived_log_monitor.stop();
 
+  if (xtrabackup_redo_log_arch_only &&
+      archived_log_state != ARCHIVED_LOG_POSITIONED) {
+    xb::warn() << "The redo log archive was not used, the redo log has been "
+                  "copied from the server's redo log files.";
+  }
+
   /* to ensure redo logs are not disabled during the backup, reopen the log
   files to read HEADER. */
   if (opt_lock_ddl == false && archived_log_state == ARCHIVED_LOG_NONE &&
@@ -1515,6 +2170,8 @@ bool Redo_Log_Data_Manager::stop_at(lsn_t lsn, lsn_t checkpoint_lsn) {
 
   scanned_lsn = reader.get_scanned_lsn();
 
+  xb::info() << "Maximum redo log copy lag: " << max_lag << " bytes";
+
   if (last_checkpoint_lsn > scanned_lsn) {
     xb::error() << "last checkpoint LSN (" << last_checkpoint_lsn
                 << ") is larger than last copied LSN (" << scanned_lsn << ").";
@@ -1527,6 +2184,9 @@ bool Redo_Log_Data_Manager::stop_at(lsn_t lsn, lsn_t checkpoint_lsn) {
   }
 
   if (xtrabackup_register_redo_log_consumer) {
+    wait_consumer();
+    xb::info() << "Maximum redo log consumer lag: " << max_consumer_lag
+               << " bytes";
     redo_log_consumer.deinit(redo_log_consumer_cnx);
     mysql_close(redo_log_consumer_cnx);
   }
@@ -26,11 +26,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <os0thread-create.h>
 
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "changed_page_tracking.h"
 #include "datasink.h"
 #include "redo_log_consumer.h"
+#include "thread_pool.h"
 
 #define redo_log_read_buffer_size ((srv_log_buffer_size) / 2)
 
@@ -39,6 +42,8 @@ class Redo_Log_Reader {
  public:
   Redo_Log_Reader();
 
+  ~Redo_Log_Reader();
+
   /** Find start checkpoint lsn.
   @param[out] lsn               start checkpoint lsn
   @return true if success. */
@@ -50,6 +55,11 @@ class Redo_Log_Reader {
   /** Get log buffer. */
   byte *get_buffer() const;
 
+  /** Get the blocks of the last read as they are on disk, when the redo log
+  is encrypted. They are written verbatim to xtrabackup_logfile.
+  @return encrypted blocks, nullptr if the redo log is not encrypted */
+  const byte *get_encrypted_buffer() const;
+
   /** Get scanned LSN. */
   lsn_t get_scanned_lsn() const;
 
@@ -72,6 +82,9 @@ class Redo_Log_Reader {
   /** Whether there was an error. */
   bool is_error() const;
 
+  /** Clear the error flag. */
+  void clear_error();
+
  private:
   /** log header buffer. */
   ut::aligned_array_pointer<byte, UNIV_PAGE_SIZE_MAX> log_hdr_buf;
@@ -79,6 +92,14 @@ class Redo_Log_Reader {
   /** log read buffer. */
   ut::aligned_array_pointer<byte, UNIV_PAGE_SIZE_MAX> log_buf;
 
+  /** encrypted blocks of log_buf, allocated on the first read of an
+  encrypted redo log. */
+  ut::aligned_array_pointer<byte, UNIV_PAGE_SIZE_MAX> encrypted_buf;
+
+  /** whether the redo log is read encrypted, encrypted_buf is allocated
+  then. */
+  bool encrypted{false};
+
   /** Read specified log segment into a buffer.
   @param[in,out] buf            buffer where to read
   @param[in]     start_lsn      read area start
@@ -106,16 +127,18 @@ class Redo_Log_Reader {
   @param[in,out] buf            buffer where to read
   @param[in]     start_lsn      read area start
   @param[in]     end_lsn        read area end
+  @param[in]     raw            read the blocks as they are on disk, without
+                                decrypting them
   @return lsn up to which data was available on disk (ideally end_lsn)
   */
   static lsn_t read_log_seg(log_t &log, byte *buf, lsn_t start_lsn,
-                            const lsn_t end_lsn);
+                            const lsn_t end_lsn, bool raw);
 
   static lsn_t read_log_seg_pre8030(log_t &log, byte *buf, lsn_t start_lsn,
-                                    const lsn_t end_lsn);
+                                    const lsn_t end_lsn, bool raw);
 
   static lsn_t read_log_seg_8030(log_t &log, byte *buf, lsn_t start_lsn,
-                                 const lsn_t end_lsn);
+                                 const lsn_t end_lsn, bool raw);
 
   /** checkpoint LSN at the backup start. */
   static lsn_t checkpoint_lsn_start;
@@ -123,8 +146,8 @@ class Redo_Log_Reader {
   /** offset of checkpoint_lsn_start */
   static os_offset_t checkpoint_offset_start;
 
-  /** last scanned LSN. */
-  lsn_t log_scanned_lsn{0};
+  /** last scanned LSN, read by the metrics thread. */
+  std::atomic<lsn_t> log_scanned_lsn{0};
 
   /** error flag. */
   static std::atomic<bool> m_error;
@@ -146,6 +169,8 @@ class Redo_Log_Writer {
  public:
   Redo_Log_Writer();
 
+  ~Redo_Log_Writer();
+
   /** Create logfile with given path.
   @param[in] path               log file name and path
   @return false if error. */
@@ -156,11 +181,30 @@ class Redo_Log_Writer {
   @return false if error. */
   bool write_header(byte *hdr);
 
-  /** Write buffer contents into logfile.
+  /** Write buffer contents into logfile. The redo log of the server is
+  encrypted with the key of the header of xtrabackup_logfile, the blocks read
+  from it are written as they are instead of encrypting buf again.
   @param[in] buf                buffer where to write from
   @param[in] len                data length
+  @param[in] encrypted          blocks of buf as read from the server,
+                                encrypted, or nullptr
+  @return false if error. */
+  bool write_buffer(byte *buf, size_t len, const byte *encrypted = nullptr);
+
+  /** Pass the buffered log data down the datasink pipeline, so that a
+  stream or an upload gets it before the file is closed.
+  @return false if error. */
+  bool flush_logfile();
+
+  /** Close the logfile and continue in a new segment of the redo log
+  archived by --archive-redo, named after the lsn it starts at. The segment
+  has no header, it is the continuation of the previous one.
+  @param[in] start_lsn          lsn of the first block of the segment
   @return false if error. */
-  bool write_buffer(byte *buf, size_t len);
+  bool rotate_logfile(lsn_t start_lsn);
+
+  /** Get the bytes of log data written to the current logfile. */
+  uint64_t get_written() const { return (written); }
 
   /** Close logfile.
   @return false if error. */
@@ -170,6 +214,9 @@ class Redo_Log_Writer {
   /** Log file. */
   ds_file_t *log_file;
 
+  /** log data written to log_file. */
+  uint64_t written{0};
+
   /** Temporary buffer used for encryption. */
   ut::aligned_array_pointer<byte, UNIV_PAGE_SIZE_MAX> scratch_buf;
 };
@@ -179,6 +226,8 @@ class Archived_Redo_Log_Reader {
  public:
   Archived_Redo_Log_Reader();
 
+  ~Archived_Redo_Log_Reader();
+
   /** Set file descriptor of the archived log file. */
   void set_fd(File fd);
 
@@ -201,6 +250,11 @@ class Archived_Redo_Log_Reader {
   /** Get log buffer. */
   byte *get_buffer() const;
 
+  /** Get the blocks of the last read as they are in the archive, when the
+  redo log is encrypted.
+  @return encrypted blocks, nullptr if the redo log is not encrypted */
+  const byte *get_encrypted_buffer() const;
+
   /** Get contiguous LSN. */
   lsn_t get_contiguous_lsn() const;
 
@@ -211,8 +265,13 @@ class Archived_Redo_Log_Reader {
   /** log read buffer. */
   ut::aligned_array_pointer<byte, UNIV_PAGE_SIZE_MAX> log_buf;
 
-  /** temporary buffer used for encryption. */
-  ut::aligned_array_pointer<byte, UNIV_PAGE_SIZE_MAX> scratch_buf;
+  /** encrypted blocks of log_buf, allocated on the first read of an
+  encrypted redo log. */
+  ut::aligned_array_pointer<byte, UNIV_PAGE_SIZE_MAX> encrypted_buf;
+
+  /** whether the redo log is read encrypted, encrypted_buf is allocated
+  then. */
+  bool encrypted{false};
 
   /** start lsn of archived redo log. */
   lsn_t archive_start_lsn;
@@ -320,6 +379,20 @@ class Redo_Log_Data_Manager {
   /** Get last scanned lsn. */
   lsn_t get_scanned_lsn() const;
 
+  /** Get the lsn the copy has reached so far, while it is running. */
+  lsn_t get_copied_lsn() const;
+
+  /** Wait until the copying thread has parsed the redo log up to an lsn.
+  @param[in]  lsn  lsn to wait for
+  @return false if the copying failed meanwhile */
+  bool wait_parsed(lsn_t lsn);
+
+  /** Get the pages changed between incremental_lsn and the start checkpoint,
+  collected from the redo log with --incremental-redo-scan. The caller owns
+  them.
+  @return changed pages or nullptr if they were not collected */
+  pagetracking::xb_space_map *take_changed_pages();
+
   /** Set copy interval. */
   void set_copy_interval(ulint interval);
 
@@ -335,6 +408,44 @@ class Redo_Log_Data_Manager {
   /** Copy batch of log blocks. */
   bool copy_once(bool is_last, bool *finished);
 
+  /** Parse the redo log from from_lsn up to the start checkpoint and collect
+  the pages it modifies. Nothing is written, the reader and the parser are
+  reset for the copy afterwards.
+  @param[in] from_lsn           lsn to collect the changes from
+  @return changed pages or nullptr if the redo log does not reach back to
+  from_lsn */
+  pagetracking::xb_space_map *scan_changed_pages(lsn_t from_lsn);
+
+  /** Parse a batch of log blocks while the writer thread writes it.
+  @param[in] buf                buffer to parse and write
+  @param[in] len                data length
+  @param[in] start_lsn          start lsn
+  @param[in] encrypted          blocks of buf as read from the server,
+                                encrypted, or nullptr
+  @return false if error. */
+  bool parse_and_write(byte *buf, size_t len, lsn_t start_lsn,
+                       const byte *encrypted);
+
+  /** Let the server purge the redo copied up to lsn. The advance runs on the
+  consumer thread, it is skipped while the previous one is in flight and
+  until enough redo or time has passed since it.
+  @param[in] lsn                lsn up to which the copy is complete
+  @param[in] force              wait for the previous advance and do not
+                                batch */
+  void advance_consumer(lsn_t lsn, bool force);
+
+  /** Wait for the advance of the consumer in flight, if any. */
+  void wait_consumer();
+
+  /** Compare the redo generated by the server with the copy. Warns when the
+  unread redo is predicted to be overwritten within --redo-lag-warn-time and
+  slows the datafile copy down meanwhile, fails the copy when it is predicted
+  within --redo-lag-abort-time. Runs on lag_monitor. */
+  void lag_monitor_func();
+
+  /** Stop lag_monitor, if it runs. */
+  void stop_lag_monitor();
+
   /** Compare archived log block number and lsn with the current lsn
       and seek archived log if needed. */
   void track_archived_log(lsn_t start_lsn, const byte *buf, size_t len);
@@ -366,12 +477,32 @@ class Redo_Log_Data_Manager {
   /** redo log parser. */
   Redo_Log_Parser parser;
 
+  /** writes the batches to xtrabackup_logfile, encryption and the datasink
+  chain run there while the copying thread parses the same batch. */
+  Thread_pool write_pool{1};
+
   /** archived log monitor. */
   Archived_Redo_Log_Monitor archived_log_monitor;
 
   /** time to sleep in ms between log copying batches. */
   ulint copy_interval;
 
+  /** current time to sleep in ms, shortened from copy_interval while the
+  server generates redo faster than a read buffer per round. */
+  ulint wait_interval;
+
+  /** largest redo lag in bytes seen by the copying thread. */
+  std::atomic<lsn_t> max_lag{0};
+
+  /** lsn up to which the copying thread has parsed complete records. */
+  std::atomic<lsn_t> parsed_lsn{0};
+
+  /** thread running lag_monitor_func(). */
+  std::thread lag_monitor;
+
+  /** stop event of lag_monitor. */
+  os_event_t lag_monitor_stop = nullptr;
+
   /** stop event. */
   os_event_t event;
 
@@ -384,6 +515,25 @@ class Redo_Log_Data_Manager {
   /** MySQL connection to register redo log consumer */
   MYSQL *redo_log_consumer_cnx = nullptr;
 
+  /** runs the consumer advances on redo_log_consumer_cnx, so that the
+  round trips never delay the copying thread. */
+  Thread_pool consumer_pool{1, [] { my_thread_init(); }};
+
+  /** advance of the consumer in flight. */
+  std::future<void> consumer_advance;
+
+  /** lsn the consumer has been advanced to. */
+  std::atomic<lsn_t> consumer_lsn{0};
+
+  /** time the last advance of the consumer was started. */
+  std::chrono::steady_clock::time_point consumer_advance_time;
+
+  /** largest distance in bytes between the copied and the consumed lsn. */
+  lsn_t max_consumer_lag{0};
+
+  /** pages changed before the start checkpoint, see take_changed_pages(). */
+  pagetracking::xb_space_map *changed_pages = nullptr;
+
   enum {
     ARCHIVED_LOG_NONE,
     ARCHIVED_LOG_MATCHED,
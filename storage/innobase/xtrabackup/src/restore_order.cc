@@ -0,0 +1,163 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Order in which the files of a backup are restored.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "msg.h"
+#include "restore_order.h"
+
+namespace xb {
+namespace restore_order {
+
+const char *FILENAME = "xtrabackup_restore_order";
+
+/** First line of FILENAME, with the version of its format */
+static const char *HEADER = "# xtrabackup restore order 1";
+
+/** Suffixes of the files added by compression and encryption */
+static const char *SUFFIXES[] = {".xbcrypt", ".zst", ".lz4", ".qp"};
+
+void Registry::add(Kind kind, uint32_t space_id, const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  files_[path] = File{kind, space_id};
+}
+
+std::vector<std::string> Registry::sorted(const Hotness &hotness) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::pair<std::string, File>> files(files_.begin(),
+                                                  files_.end());
+
+  const auto pages = [&hotness](const File &file) -> uint64_t {
+    if (file.kind != TABLE) {
+      return (0);
+    }
+    const auto it = hotness.find(file.space_id);
+    return (it == hotness.end() ? 0 : it->second);
+  };
+
+  /* files_ is sorted by path already */
+  std::stable_sort(files.begin(), files.end(),
+                   [&pages](const std::pair<std::string, File> &a,
+                            const std::pair<std::string, File> &b) {
+                     if (a.second.kind != b.second.kind) {
+                       return (a.second.kind < b.second.kind);
+                     }
+                     return (pages(a.second) > pages(b.second));
+                   });
+
+  std::vector<std::string> paths;
+  paths.reserve(files.size());
+  for (const auto &file : files) {
+    paths.push_back(file.first);
+  }
+
+  return (paths);
+}
+
+bool read_hotness(const char *path, Hotness *hotness) {
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) {
+    msg_ts("Cannot open %s, errno = %d.\n", path, errno);
+    return (false);
+  }
+
+  hotness->clear();
+  char line[64];
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    uint32_t space_id;
+    uint32_t page_no;
+    if (sscanf(line, "%" SCNu32 ",%" SCNu32, &space_id, &page_no) == 2) {
+      (*hotness)[space_id]++;
+    }
+  }
+  const bool failed = ferror(f);
+  fclose(f);
+
+  if (failed) {
+    msg_ts("Cannot read %s.\n", path);
+    return (false);
+  }
+
+  return (true);
+}
+
+std::string serialize(const std::vector<std::string> &paths) {
+  std::string text(HEADER);
+
+  text += '\n';
+  for (const auto &path : paths) {
+    text += path;
+    text += '\n';
+  }
+
+  return (text);
+}
+
+bool parse(const std::string &text, Order *order) {
+  std::istringstream in(text);
+  std::string line;
+
+  if (!std::getline(in, line) || line != HEADER) {
+    msg_ts("%s does not start with \"%s\".\n", FILENAME, HEADER);
+    return (false);
+  }
+
+  order->clear();
+  while (std::getline(in, line)) {
+    if (!line.empty()) {
+      order->emplace(line, order->size());
+    }
+  }
+
+  return (true);
+}
+
+size_t rank(const Order &order, const std::string &path) {
+  std::string name(path);
+
+  while (name.compare(0, 2, "./") == 0) {
+    name.erase(0, 2);
+  }
+
+  for (bool stripped = true; stripped;) {
+    stripped = false;
+    for (const char *suffix : SUFFIXES) {
+      const size_t len = strlen(suffix);
+      if (name.size() > len &&
+          name.compare(name.size() - len, len, suffix) == 0) {
+        name.resize(name.size() - len);
+        stripped = true;
+      }
+    }
+  }
+
+  const auto it = order.find(name);
+  return (it == order.end() ? order.size() : it->second);
+}
+
+}  // namespace restore_order
+}  // namespace xb
@@ -0,0 +1,108 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Order in which the files of a backup are restored.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef XB_RESTORE_ORDER_H
+#define XB_RESTORE_ORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* --restore-order writes to xtrabackup_restore_order the files of the backup
+in the order they are best restored in: the metadata and the redo log needed
+by --prepare, the system tablespace, the undo tablespaces and mysql.ibd, then
+the tables with the most pages in the buffer pool dump first. xbcloud get
+downloads the files in this order and xbstream -x --restore-order extracts
+them in this order from a stream with an index. */
+namespace xb {
+namespace restore_order {
+
+/** Name of the file of the order in the backup */
+extern const char *FILENAME;
+
+/** Kinds of files, in the order they are restored */
+enum Kind { META, SYSTEM, UNDO, DICTIONARY, TABLE };
+
+/** Rank of each file by path relative to the backup directory */
+using Order = std::unordered_map<std::string, size_t>;
+
+/** Pages in the buffer pool dump by space id */
+using Hotness = std::unordered_map<uint32_t, uint64_t>;
+
+/** Files written by the backup threads */
+class Registry {
+ public:
+  /** Add a file of the backup.
+  @param[in]  kind      kind of the file
+  @param[in]  space_id  space id of a tablespace, 0 for the other files
+  @param[in]  path      path relative to the backup directory */
+  void add(Kind kind, uint32_t space_id, const std::string &path);
+
+  /** Get the files in the order they are restored. The files of a kind are
+  sorted by path, tables by decreasing number of pages in the dump first.
+  @param[in]  hotness  pages of each tablespace in the buffer pool dump
+  @return paths */
+  std::vector<std::string> sorted(const Hotness &hotness) const;
+
+ private:
+  struct File {
+    Kind kind;
+    uint32_t space_id;
+  };
+
+  mutable std::mutex mutex_;
+
+  std::map<std::string, File> files_;
+};
+
+/** Count the pages of each tablespace in a buffer pool dump, made of lines
+"space_id,page_no".
+@param[in]   path     path of the dump
+@param[out]  hotness  pages by space id
+@return false if the file cannot be read */
+bool read_hotness(const char *path, Hotness *hotness);
+
+/** Serialize an order as the contents of FILENAME.
+@param[in]  paths  paths in the order they are restored
+@return contents of the file */
+std::string serialize(const std::vector<std::string> &paths);
+
+/** Parse the contents of FILENAME.
+@param[in]   text   contents of the file
+@param[out]  order  ranks of the files
+@return false if the contents are not valid */
+bool parse(const std::string &text, Order *order);
+
+/** Get the rank of a file of a stream. The suffixes added by compression and
+encryption are ignored.
+@param[in]  order  ranks of the files
+@param[in]  path   path of the file in the stream
+@return rank of the file, order.size() if it is not listed */
+size_t rank(const Order &order, const std::string &path);
+
+}  // namespace restore_order
+}  // namespace xb
+
+#endif
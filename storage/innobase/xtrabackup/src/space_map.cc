@@ -85,14 +85,15 @@ void Tablespace_map::scan(MYSQL *connection) {
   MYSQL_RES *mysql_result;
   MYSQL_ROW row;
 
-  mysql_result = xb_mysql_query(connection, query, true);
+  /* stream the rows, the result is as large as the number of tablespaces */
+  mysql_result = xb_mysql_query_stream(connection, query);
 
   while ((row = mysql_fetch_row(mysql_result)) != nullptr) {
     const tablespace_t tablespace(row[0], row[1], TABLESPACE);
     add(tablespace);
   }
 
-  mysql_free_result(mysql_result);
+  xb_mysql_stream_end(connection, mysql_result);
 }
 
 /** Add tablespace to the list.
@@ -153,14 +154,16 @@ std::string Tablespace_map::backup_file_name(
 
 /** Return original file name for given tablespace.
 @param[in]  space_name source tablespace name */
-std::string Tablespace_map::external_file_name(
+const std::string &Tablespace_map::external_file_name(
     const std::string &space_name) const {
+  static const std::string not_external;
+
   auto i = file_by_space.find(space_name);
   if (i != file_by_space.end()) {
     return (i->second.file_name);
   }
 
-  return std::string();
+  return (not_external);
 }
 
 /** Return the list of external tablespaces. */
@@ -292,6 +295,9 @@ bool Tablespace_map::deserialize(const std::string &dir) {
 
   auto list = root["external_tablespaces"].GetArray();
 
+  space_by_file.reserve(space_by_file.size() + list.Size());
+  file_by_space.reserve(file_by_space.size() + list.Size());
+
   for (auto &entry : list) {
     const auto &object = entry.GetObject();
     tablespace_type_t type = TABLESPACE;
@@ -86,8 +86,14 @@ class Tablespace_map {
   std::string backup_file_name(const std::string &file_name) const;
 
   /** Return original file name for given tablespace.
-  @param[in]  space_name source tablespace name */
-  std::string external_file_name(const std::string &space_name) const;
+  @param[in]  space_name source tablespace name
+  @return file name, empty if the tablespace is in the datadir. Valid until
+  the list is modified. */
+  const std::string &external_file_name(const std::string &space_name) const;
+
+  /** @return true if no tablespace is outside of the datadir, external file
+  names need not be looked up then */
+  bool empty() const { return file_by_space.empty(); }
 
   /** Return the list of external tablespaces. */
   vector_t external_files() const;
@@ -21,51 +21,99 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <cstddef>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <vector>
 
+#include "trace.h"
+#include "wait_state.h"
+
+/* NUMA placement of thread pool workers. Only xtrabackup sets it up, the
+defaults keep every pool on a single node. */
+struct Thread_pool_numa {
+  /* number of nodes to split the workers of Numa_thread_pool over */
+  static inline size_t n_nodes = 1;
+  /* binds the calling thread to given node, nullptr if not binding */
+  static inline void (*bind)(size_t node) = nullptr;
+  /* node of the calling thread, selects the pool running its tasks */
+  static inline thread_local size_t node = 0;
+};
+
+/* Pool of worker threads. Every worker has its own queue, add_task() spreads
+the tasks over them round robin and idle workers steal from the queues of
+the others, so producers and workers rarely meet on the same mutex. The task
+slots of the queues are reused, a task only allocates the state of its
+future. */
 class Thread_pool {
  public:
-  Thread_pool(size_t size) {
+  Thread_pool(size_t size, std::function<void()> init = nullptr) {
+    queues.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+      queues.emplace_back(new Worker_queue);
+    }
     workers.reserve(size);
     for (size_t i = 0; i < size; ++i) {
-      workers.emplace_back([this, i] {
-        std::function<void(size_t)> task;
+      workers.emplace_back([this, i, init] {
+        if (init) init();
+        Task task;
         while (true) {
-          {
-            std::unique_lock<std::mutex> lock(this->mutex);
-            this->cond.wait(
-                lock, [this] { return !this->queue.empty() || this->stop; });
-            if (this->stop && this->queue.empty()) break;
-            task = std::move(this->queue.front());
-            this->queue.pop();
+          if (take(i, task)) {
+            try {
+              task.f(i);
+              task.done.set_value();
+            } catch (...) {
+              task.done.set_exception(std::current_exception());
+            }
+            task = Task();
+            continue;
           }
-          task(i);
+          xb::wait_state::Scope idle(xb::wait_state::POOL_IDLE);
+          std::unique_lock<std::mutex> lock(this->sleep_mutex);
+          this->n_sleeping++;
+          this->cond.wait(lock, [this] {
+            return this->n_pending.load() > 0 || this->stop;
+          });
+          this->n_sleeping--;
+          if (this->stop && this->n_pending.load() == 0) break;
         }
+        xb::wait_state::thread_end();
       });
     }
   }
 
   std::future<void> add_task(std::function<void(size_t)> &&f) {
-    auto task = std::make_shared<std::packaged_task<void(size_t)>>(
-        std::bind(f, std::placeholders::_1));
+    Task task;
+    task.f = std::move(f);
+    std::future<void> future = task.done.get_future();
+
+    Worker_queue &queue =
+        *queues[next_queue.fetch_add(1, std::memory_order_relaxed) %
+                queues.size()];
     {
-      std::lock_guard<std::mutex> lock(mutex);
-      queue.emplace([task](size_t i) { (*task)(i); });
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.push(std::move(task));
+    }
+    n_pending.fetch_add(1);
+
+    /* a worker going to sleep sees n_pending if it missed the notification */
+    if (n_sleeping.load() > 0) {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      cond.notify_one();
     }
-    cond.notify_one();
-    return task->get_future();
+
+    return future;
   }
 
   ~Thread_pool() {
     {
-      std::lock_guard<std::mutex> lock(mutex);
+      std::lock_guard<std::mutex> lock(sleep_mutex);
       stop = true;
     }
     cond.notify_all();
@@ -73,11 +121,91 @@ class Thread_pool {
   }
 
  private:
+  struct Task {
+    std::function<void(size_t)> f;
+    std::promise<void> done;
+  };
+
+  /* FIFO of the tasks given to one worker, a ring growing as needed */
+  struct Worker_queue {
+    std::mutex mutex;
+    std::vector<Task> ring;
+    size_t head{0};
+    size_t n_tasks{0};
+
+    void push(Task &&task) {
+      if (n_tasks == ring.size()) {
+        std::vector<Task> bigger(std::max<size_t>(16, 2 * ring.size()));
+        for (size_t i = 0; i < n_tasks; ++i) {
+          bigger[i] = std::move(ring[(head + i) % ring.size()]);
+        }
+        ring.swap(bigger);
+        head = 0;
+      }
+      ring[(head + n_tasks) % ring.size()] = std::move(task);
+      n_tasks++;
+    }
+
+    bool pop(Task &task) {
+      if (n_tasks == 0) return false;
+      task = std::move(ring[head]);
+      head = (head + 1) % ring.size();
+      n_tasks--;
+      return true;
+    }
+  };
+
+  /* Take the next task of worker i, or steal one from another worker */
+  bool take(size_t i, Task &task) {
+    for (size_t j = 0; j < queues.size(); ++j) {
+      Worker_queue &queue = *queues[(i + j) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.pop(task)) {
+        n_pending.fetch_sub(1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<std::unique_ptr<Worker_queue>> queues;
   std::vector<std::thread> workers;
-  std::mutex mutex;
+  std::atomic<size_t> next_queue{0};
+  /* tasks queued and not taken yet */
+  std::atomic<size_t> n_pending{0};
+  /* workers waiting for tasks */
+  std::atomic<size_t> n_sleeping{0};
+  std::mutex sleep_mutex;
   std::condition_variable cond;
-  std::queue<std::function<void(size_t)>> queue;
   bool stop{false};
 };
 
+/* Set of thread pools, one per NUMA node in Thread_pool_numa. Tasks are run
+by the workers bound to the node of the thread adding them. The waits of the
+workers are accounted under name, if given. */
+class Numa_thread_pool {
+ public:
+  Numa_thread_pool(size_t size, const char *name = nullptr) {
+    const size_t n_nodes =
+        std::max<size_t>(1, std::min(Thread_pool_numa::n_nodes, size));
+    for (size_t node = 0; node < n_nodes; ++node) {
+      const size_t n = size / n_nodes + (node < size % n_nodes ? 1 : 0);
+      pools.emplace_back(new Thread_pool(n, [node, name] {
+        if (name != nullptr) xb::wait_state::thread_start(name);
+        if (name != nullptr) xb::trace::set_thread_name(name);
+        Thread_pool_numa::node = node;
+        if (Thread_pool_numa::bind != nullptr) Thread_pool_numa::bind(node);
+      }));
+    }
+  }
+
+  std::future<void> add_task(std::function<void(size_t)> &&f) {
+    return pools[Thread_pool_numa::node % pools.size()]->add_task(
+        std::move(f));
+  }
+
+ private:
+  std::vector<std::unique_ptr<Thread_pool>> pools;
+};
+
 #endif
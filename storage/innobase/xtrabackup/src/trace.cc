@@ -0,0 +1,152 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Event trace of the copy pipeline.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <my_rapidjson_size_t.h>
+#include <rapidjson/filewritestream.h>
+#include <rapidjson/writer.h>
+
+#include <univ.i>
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "trace.h"
+
+namespace xb {
+namespace trace {
+
+void start() {
+  started = std::chrono::steady_clock::now();
+  enabled = true;
+}
+
+using Writer = rapidjson::Writer<rapidjson::FileWriteStream>;
+
+/** Write one trace event.
+@param[in,out]  writer  JSON writer
+@param[in]      ph      event phase
+@param[in]      tid     thread id
+@param[in]      event   event */
+static void write_event(Writer &writer, const char *ph, uint64_t tid,
+                        const Event &event) {
+  writer.StartObject();
+  writer.Key("name");
+  writer.String(event.name);
+  writer.Key("ph");
+  writer.String(ph);
+  writer.Key("pid");
+  writer.Uint(1);
+  writer.Key("tid");
+  writer.Uint64(tid);
+  writer.Key("ts");
+  writer.Uint64(*ph == 'e' ? event.start + event.duration : event.start);
+  if (*ph == 'X') {
+    writer.Key("dur");
+    writer.Uint64(event.duration);
+  } else {
+    writer.Key("cat");
+    writer.String(event.name);
+    writer.Key("id");
+    writer.Uint64(event.id);
+  }
+  if (event.bytes > 0 && *ph != 'e') {
+    writer.Key("args");
+    writer.StartObject();
+    writer.Key("bytes");
+    writer.Uint64(event.bytes);
+    writer.EndObject();
+  }
+  writer.EndObject();
+}
+
+bool write(const char *path) {
+  enabled = false;
+
+  FILE *f = fopen(path, "w");
+  if (f == nullptr) {
+    xb::error() << "cannot open " << path << ", errno = " << errno;
+    return (false);
+  }
+
+  char buf[65536];
+  rapidjson::FileWriteStream stream(f, buf, sizeof(buf));
+  Writer writer(stream);
+
+  uint64_t n_events = 0;
+  uint64_t n_dropped = 0;
+
+  writer.StartObject();
+  writer.Key("displayTimeUnit");
+  writer.String("ms");
+  writer.Key("traceEvents");
+  writer.StartArray();
+  {
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    for (const auto &thread : threads) {
+      std::lock_guard<std::mutex> thread_lock(thread->mutex);
+
+      writer.StartObject();
+      writer.Key("name");
+      writer.String("thread_name");
+      writer.Key("ph");
+      writer.String("M");
+      writer.Key("pid");
+      writer.Uint(1);
+      writer.Key("tid");
+      writer.Uint64(thread->tid);
+      writer.Key("args");
+      writer.StartObject();
+      writer.Key("name");
+      writer.String(thread->name);
+      writer.EndObject();
+      writer.EndObject();
+
+      for (const auto &event : thread->events) {
+        if (event.id == 0) {
+          write_event(writer, "X", thread->tid, event);
+        } else {
+          write_event(writer, "b", thread->tid, event);
+          write_event(writer, "e", thread->tid, event);
+        }
+      }
+      n_events += thread->events.size();
+      n_dropped += thread->dropped;
+    }
+  }
+  writer.EndArray();
+  writer.EndObject();
+  stream.Flush();
+
+  if (fclose(f) != 0) {
+    xb::error() << "cannot write " << path << ", errno = " << errno;
+    return (false);
+  }
+
+  xb::info() << "Wrote " << n_events << " trace events to " << path;
+  if (n_dropped > 0) {
+    xb::warn() << n_dropped << " trace events were dropped, more than "
+               << MAX_THREAD_EVENTS << " events were recorded by a thread";
+  }
+
+  return (true);
+}
+
+}  // namespace trace
+}  // namespace xb
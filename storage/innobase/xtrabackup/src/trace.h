@@ -0,0 +1,165 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Event trace of the copy pipeline.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef XB_TRACE_H
+#define XB_TRACE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* While tracing is enabled, every thread records the spans of the pipeline
+stages it runs in a buffer of its own, written out in the Chrome trace event
+format at the end of the backup. Spans of a thread nest, an asynchronous
+request ending on another thread is recorded with an id instead. Disabled
+tracing costs one relaxed load per span. Header only, so that the datasinks
+and the thread pool shared with xbstream and xbcrypt can be traced. */
+namespace xb {
+namespace trace {
+
+struct Event {
+  /* static string */
+  const char *name;
+  /* microseconds since the start of the trace */
+  uint64_t start;
+  uint64_t duration;
+  uint64_t bytes;
+  /* 0 for spans, id of an asynchronous request otherwise */
+  uint64_t id;
+};
+
+struct Thread_events {
+  const char *name;
+  uint64_t tid;
+  /* only contended when the trace is written */
+  std::mutex mutex;
+  std::vector<Event> events;
+  uint64_t dropped{0};
+};
+
+/* events kept per thread, further ones are counted as dropped */
+constexpr size_t MAX_THREAD_EVENTS = 1 << 20;
+
+inline std::atomic<bool> enabled{false};
+inline std::chrono::steady_clock::time_point started;
+inline std::atomic<uint64_t> next_id{1};
+
+inline std::mutex threads_mutex;
+inline std::vector<std::unique_ptr<Thread_events>> threads;
+
+inline thread_local Thread_events *current = nullptr;
+
+/** @return true if events are recorded */
+inline bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+
+/** @return microseconds since the start of the trace */
+inline uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - started)
+      .count();
+}
+
+/** @return events of the calling thread, registered on first use */
+inline Thread_events *thread_events() {
+  if (current == nullptr) {
+    auto events = std::make_unique<Thread_events>();
+    events->name = "thread";
+    current = events.get();
+
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    events->tid = threads.size() + 1;
+    threads.push_back(std::move(events));
+  }
+  return current;
+}
+
+/** Name the calling thread in the trace.
+@param[in]  name  thread name, must be static */
+inline void set_thread_name(const char *name) {
+  if (is_enabled()) {
+    thread_events()->name = name;
+  }
+}
+
+/** Record an event of the calling thread.
+@param[in]  name   event name, must be static
+@param[in]  start  start time returned by now()
+@param[in]  bytes  bytes processed
+@param[in]  id     0 for a span, request id from next_id otherwise */
+inline void record(const char *name, uint64_t start, uint64_t bytes,
+                   uint64_t id = 0) {
+  Thread_events *events = thread_events();
+  const uint64_t end = now();
+
+  std::lock_guard<std::mutex> lock(events->mutex);
+  if (events->events.size() >= MAX_THREAD_EVENTS) {
+    events->dropped++;
+    return;
+  }
+  events->events.push_back({name, start, end - start, bytes, id});
+}
+
+/** Record the lifetime of the object as a span of the calling thread. */
+class Span {
+ public:
+  /** @param[in]  name   span name, must be static
+  @param[in]    bytes  bytes processed in the span */
+  explicit Span(const char *name, uint64_t bytes = 0)
+      : m_name(name), m_bytes(bytes) {
+    if (is_enabled()) {
+      m_start = now();
+      m_active = true;
+    }
+  }
+
+  ~Span() {
+    if (m_active) {
+      record(m_name, m_start, m_bytes);
+    }
+  }
+
+  void set_bytes(uint64_t bytes) { m_bytes = bytes; }
+
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+ private:
+  const char *m_name;
+  uint64_t m_bytes;
+  uint64_t m_start{0};
+  bool m_active{false};
+};
+
+/** Start recording events. */
+void start();
+
+/** Stop recording and write the events in the Chrome trace event format,
+loadable in chrome://tracing and Perfetto. Only linked into xtrabackup.
+@param[in]  path  file to write
+@return false on error */
+bool write(const char *path);
+
+}  // namespace trace
+}  // namespace xb
+
+#endif
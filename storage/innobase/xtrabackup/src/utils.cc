@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <mach/mach_host.h>
 #include <sys/sysctl.h>
 #else
+#include <sched.h>
 #ifdef HAVE_PROCPS_V3
 #include <proc/sysinfo.h>
 #else
@@ -32,7 +33,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <boost/uuid/uuid.hpp>             // uuid class
 #include <boost/uuid/uuid_generators.hpp>  // generators
 #include <boost/uuid/uuid_io.hpp>          // streaming operators etc.
+#include <algorithm>
+#include <fstream>
 #include <sstream>
+#include <thread>
 #include "common.h"
 #include "msg.h"
 #include "xtrabackup.h"
@@ -117,6 +121,10 @@ unsigned long get_version_number(std::string version_str) {
 }
 
 #ifdef __APPLE__
+unsigned int host_cpu_count() {
+  return std::max(1U, std::thread::hardware_concurrency());
+}
+
 unsigned long host_total_memory() {
   unsigned long total_mem = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
   return total_mem;
@@ -144,7 +152,122 @@ unsigned long host_free_memory() {
   return 0;
 }
 #else
-unsigned long host_total_memory() {
+/** Mount point of the cgroup v2 hierarchy and of the v1 controllers */
+static const char *CGROUP_ROOT = "/sys/fs/cgroup";
+
+/** Read a file of the cgroup of the process. In a container the cgroup
+namespace usually makes the cgroup of the process the root of the hierarchy,
+otherwise the file is found under the path of the cgroup from
+/proc/self/cgroup.
+@param[in]   controller  v1 controller, nullptr for the v2 hierarchy
+@param[in]   file        name of the file in the cgroup directory
+@param[out]  words       words of the file
+@return false if the file cannot be read */
+static bool cgroup_read_file(const char *controller, const char *file,
+                             std::vector<std::string> *words) {
+  std::ifstream self("/proc/self/cgroup");
+  std::string line;
+  std::string dir;
+
+  while (std::getline(self, line)) {
+    /* hierarchy-ID:controller-list:cgroup-path */
+    const auto colon1 = line.find(':');
+    const auto colon2 = line.find(':', colon1 + 1);
+    if (colon1 == std::string::npos || colon2 == std::string::npos) {
+      continue;
+    }
+    const std::string controllers =
+        "," + line.substr(colon1 + 1, colon2 - colon1 - 1) + ",";
+    if (controller == nullptr ? controllers == ",,"
+                              : controllers.find("," + std::string(controller) +
+                                                 ",") != std::string::npos) {
+      dir = line.substr(colon2 + 1);
+      break;
+    }
+  }
+
+  const std::string base =
+      std::string(CGROUP_ROOT) +
+      (controller == nullptr ? "" : "/" + std::string(controller));
+  for (const auto &path : {base + dir + "/" + file, base + "/" + file}) {
+    std::ifstream in(path);
+    std::string word;
+    words->clear();
+    while (in >> word) {
+      words->push_back(word);
+    }
+    if (!words->empty()) {
+      return (true);
+    }
+  }
+
+  return (false);
+}
+
+/** @return memory limit of the cgroup of the process, 0 if none */
+static unsigned long cgroup_memory_limit() {
+  std::vector<std::string> words;
+
+  if (cgroup_read_file(nullptr, "memory.max", &words)) {
+    return (words[0] == "max" ? 0 : strtoul(words[0].c_str(), nullptr, 10));
+  }
+  if (cgroup_read_file("memory", "memory.limit_in_bytes", &words)) {
+    /* no limit is a huge value rounded down to the page size */
+    const unsigned long limit = strtoul(words[0].c_str(), nullptr, 10);
+    return (limit >= (1UL << 62) ? 0 : limit);
+  }
+
+  return (0);
+}
+
+/** @return memory used by the cgroup of the process, 0 if unknown */
+static unsigned long cgroup_memory_usage() {
+  std::vector<std::string> words;
+
+  if (cgroup_read_file(nullptr, "memory.current", &words) ||
+      cgroup_read_file("memory", "memory.usage_in_bytes", &words)) {
+    return (strtoul(words[0].c_str(), nullptr, 10));
+  }
+
+  return (0);
+}
+
+unsigned int host_cpu_count() {
+  unsigned int n_cpus = std::max(1U, std::thread::hardware_concurrency());
+  cpu_set_t set;
+  std::vector<std::string> words;
+  double quota = 0;
+  double period = 0;
+
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+    n_cpus = std::min<unsigned int>(n_cpus, CPU_COUNT(&set));
+  }
+
+  /* "max 100000" or "<quota> <period>" */
+  if (cgroup_read_file(nullptr, "cpu.max", &words) && words.size() == 2 &&
+      words[0] != "max") {
+    quota = strtod(words[0].c_str(), nullptr);
+    period = strtod(words[1].c_str(), nullptr);
+  } else if (cgroup_read_file("cpu", "cpu.cfs_quota_us", &words) &&
+             strtod(words[0].c_str(), nullptr) > 0) {
+    quota = strtod(words[0].c_str(), nullptr);
+    if (cgroup_read_file("cpu", "cpu.cfs_period_us", &words)) {
+      period = strtod(words[0].c_str(), nullptr);
+    }
+  }
+
+  /* threads above the quota only get the process throttled */
+  if (quota > 0 && period > 0) {
+    n_cpus = std::min(
+        n_cpus, std::max(1U, static_cast<unsigned int>(quota / period)));
+  }
+
+  return (n_cpus);
+}
+
+/** @return total memory of the host according to /proc/meminfo */
+static unsigned long meminfo_total_memory() {
 #ifdef HAVE_PROCPS_V3
   meminfo();
   return kb_main_total * 1024;
@@ -158,7 +281,8 @@ unsigned long host_total_memory() {
 #endif  // HAVE_PROCPS_V3
 }
 
-unsigned long host_free_memory() {
+/** @return available memory of the host according to /proc/meminfo */
+static unsigned long meminfo_free_memory() {
 #ifdef HAVE_PROCPS_V3
   meminfo();
   return kb_main_available * 1024;
@@ -171,6 +295,25 @@ unsigned long host_free_memory() {
   return MEMINFO_GET(mem_info, MEMINFO_MEM_AVAILABLE, ul_int) * 1024;
 #endif  // HAVE_PROCPS_V3
 }
+
+unsigned long host_total_memory() {
+  const unsigned long total = meminfo_total_memory();
+  const unsigned long limit = cgroup_memory_limit();
+
+  return (limit != 0 ? std::min(total, limit) : total);
+}
+
+unsigned long host_free_memory() {
+  const unsigned long free = meminfo_free_memory();
+  const unsigned long limit = cgroup_memory_limit();
+
+  if (limit == 0) {
+    return (free);
+  }
+
+  const unsigned long usage = cgroup_memory_usage();
+  return (std::min(free, limit > usage ? limit - usage : 0));
+}
 #endif
 
 std::string generate_uuid() {
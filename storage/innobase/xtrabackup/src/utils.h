@@ -44,7 +44,16 @@ bool read_server_uuid();
 @return version_number like 80022 */
 unsigned long get_version_number(std::string version_str);
 
+/** @return number of CPUs the process can use: the CPUs of its affinity
+mask, limited by the CPU quota of its cgroup, at least 1 */
+unsigned int host_cpu_count();
+
+/** @return total memory of the host, limited by the memory limit of the
+cgroup of the process */
 unsigned long host_total_memory();
+
+/** @return available memory of the host, limited by what is left under the
+memory limit of the cgroup of the process */
 unsigned long host_free_memory();
 
 /** Generates uuid
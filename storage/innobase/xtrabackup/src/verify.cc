@@ -0,0 +1,436 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Verification of the tablespaces of a prepared backup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <my_sys.h>
+
+#include <univ.i>
+
+#include <buf0checksum.h>
+#include <fil0fil.h>
+#include <fsp0fsp.h>
+#include <log0constants.h>
+#include <mach0data.h>
+#include <os0file.h>
+#include <srv0srv.h>
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "fil_cur.h"
+#include "file_utils.h"
+#include "thread_pool.h"
+#include "verify.h"
+
+namespace xb {
+namespace verify {
+
+namespace {
+
+/** Files are split into ranges of this size verified in parallel */
+const os_offset_t RANGE_SIZE = 64 * 1024 * 1024;
+
+/** Size of a single read, a multiple of every page size */
+const size_t READ_SIZE = 4 * 1024 * 1024;
+
+/** Alignment of the reads, large enough for O_DIRECT on any device */
+const size_t READ_ALIGN = 4096;
+
+/** A page failing the verification */
+struct Bad_page {
+  page_no_t page_no;
+  /* lsn of the page if newer than the checkpoint, 0 for a bad checksum */
+  lsn_t lsn;
+
+  bool operator<(const Bad_page &other) const {
+    return (page_no < other.page_no);
+  }
+};
+
+/** State of the verification of a file */
+struct File {
+  std::string path;
+  int fd{-1};
+  os_offset_t size{0};
+  page_size_t page_size{0, 0, false};
+  /* first file of the system tablespace, holding the doublewrite buffer */
+  bool has_doublewrite{false};
+  std::atomic<bool> error{false};
+  std::atomic<uint64_t> n_pages{0};
+  std::atomic<uint64_t> n_encrypted{0};
+  std::mutex mutex;
+  std::vector<Bad_page> bad_pages;
+};
+
+/** Buffers of a thread verifying pages */
+struct Buffers {
+  byte *read{nullptr};
+  byte *page{nullptr};
+  byte *scratch{nullptr};
+};
+
+/** @return true if a file is a tablespace verified by --verify
+@param[in]  name    file name
+@param[in]  is_top  true if the file is in the backup directory */
+bool is_tablespace(const char *name, bool is_top) {
+  if (file_has_suffix(".ibd", name) || file_has_suffix(".ibu", name)) {
+    return (true);
+  }
+  if (!is_top) {
+    return (false);
+  }
+  if (strncmp(name, "ibdata", 6) == 0) {
+    return (true);
+  }
+  return (strncmp(name, "undo_", 5) == 0 && name[5] != '\0' &&
+          strspn(name + 5, "0123456789") == strlen(name + 5));
+}
+
+/** @return true if a file belongs to the system tablespace
+@param[in]  name  path of the file */
+bool is_system(const std::string &name) {
+  const size_t pos = name.rfind('/');
+  return (name.compare(pos == std::string::npos ? 0 : pos + 1, 6,
+                       "ibdata") == 0);
+}
+
+/** List the tablespace files of a directory and of its subdirectories. The
+redo log and temporary tablespace directories are not looked into.
+@param[in]   path    path of the directory
+@param[in]   is_top  true for the backup directory
+@param[out]  paths   paths of the files
+@return false on error */
+bool list_dir(const std::string &path, bool is_top,
+              std::vector<std::string> &paths) {
+  std::vector<std::string> dirs;
+  bool ok = os_file_scan_directory(
+      path.c_str(),
+      [&](const char *, const char *name) {
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strcmp(name, LOG_DIRECTORY_NAME) == 0 ||
+            strcmp(name, "#innodb_temp") == 0) {
+          return;
+        }
+        MY_STAT stat_info;
+        const std::string entry = path + "/" + name;
+        if (my_stat(entry.c_str(), &stat_info, MYF(0)) == nullptr) {
+          return;
+        }
+        if (MY_S_ISDIR(stat_info.st_mode)) {
+          dirs.push_back(entry);
+        } else if (MY_S_ISREG(stat_info.st_mode) &&
+                   is_tablespace(name, is_top)) {
+          paths.push_back(entry);
+        }
+      },
+      false);
+  if (!ok) {
+    xb::error() << "cannot list " << path;
+    return (false);
+  }
+
+  for (const auto &dir : dirs) {
+    if (!list_dir(dir, false, paths)) {
+      return (false);
+    }
+  }
+
+  return (true);
+}
+
+/** Open a file and find its page size from the flags of its first page. The
+files of the system tablespace following the first one have no header and
+use the page size of the backup. Checks that the file holds whole pages and,
+for single file tablespaces, at least the number of pages of the header.
+@param[in,out]  file  file to open
+@return false on error */
+bool open_file(File &file) {
+  MY_STAT stat_info;
+  if (my_stat(file.path.c_str(), &stat_info, MYF(MY_WME)) == nullptr) {
+    return (false);
+  }
+  file.size = stat_info.st_size;
+
+  file.fd = my_open(file.path.c_str(), O_RDONLY, MYF(MY_WME));
+  if (file.fd < 0) {
+    return (false);
+  }
+
+  byte page[UNIV_ZIP_SIZE_MIN];
+  if (file.size < sizeof(page) ||
+      my_pread(file.fd, page, sizeof(page), 0, MYF(MY_WME | MY_NABP)) != 0) {
+    xb::error() << "cannot read the first page of " << file.path;
+    return (false);
+  }
+
+  const bool system = is_system(file.path);
+  const uint32_t flags = fsp_header_get_flags(page);
+  const bool has_header =
+      mach_read_from_4(page + FIL_PAGE_OFFSET) == 0 &&
+      mach_read_from_2(page + FIL_PAGE_TYPE) == FIL_PAGE_TYPE_FSP_HDR;
+
+  if (system) {
+    file.page_size.copy_from(univ_page_size);
+    file.has_doublewrite = has_header;
+  } else if (!fsp_flags_is_valid(flags)) {
+    xb::error() << file.path << " has invalid tablespace flags " << flags;
+    return (false);
+  } else {
+    file.page_size.copy_from(page_size_t(flags));
+  }
+
+  const os_offset_t physical = file.page_size.physical();
+  if (file.size % physical != 0) {
+    xb::error() << "size " << file.size << " of " << file.path
+                << " is not a multiple of the page size " << physical;
+    return (false);
+  }
+
+  const page_no_t header_size = fsp_header_get_field(page, FSP_SIZE);
+  if (!system && file.size / physical < header_size) {
+    xb::error() << file.path << " has " << file.size / physical
+                << " pages, the tablespace header says " << header_size;
+    return (false);
+  }
+
+  /* the first page was read through the page cache, bypass it from now
+  on, os_file_set_nocache() warns if the filesystem refuses */
+  os_file_set_nocache(file.fd, file.path.c_str(), "OPEN");
+
+  return (true);
+}
+
+/** Verify a page which was not accepted by xb_page_batch_crc32().
+@param[in]      file     file of the page
+@param[in]      page     page to verify
+@param[in,out]  buffers  buffers of the calling thread
+@return true if the page is valid */
+bool check_page(File &file, const byte *page, Buffers &buffers) {
+  const ulint physical = file.page_size.physical();
+
+  if (Encryption::is_encrypted_page(page)) {
+    file.n_encrypted++;
+    return (true);
+  }
+
+  if (Compression::is_compressed_page(page)) {
+    memcpy(buffers.page, page, physical);
+    if (os_file_decompress_page(false, buffers.page, buffers.scratch,
+                                physical) != DB_SUCCESS) {
+      return (false);
+    }
+    page = buffers.page;
+  }
+
+  return (!BlockReporter(false, page, file.page_size, false).is_corrupted());
+}
+
+/** Verify the pages of a range of a file.
+@param[in,out]  file     file to verify
+@param[in]      start    offset of the range
+@param[in]      end      offset following the range
+@param[in]      max_lsn  newest lsn a page may have
+@param[in,out]  buffers  buffers of the calling thread */
+void verify_range(File &file, os_offset_t start, os_offset_t end,
+                  lsn_t max_lsn, Buffers &buffers) {
+  const ulint physical = file.page_size.physical();
+  const bool batch_crc32 =
+      !file.page_size.is_compressed() && physical == UNIV_PAGE_SIZE &&
+      (srv_checksum_algorithm == SRV_CHECKSUM_ALGORITHM_CRC32 ||
+       srv_checksum_algorithm == SRV_CHECKSUM_ALGORITHM_STRICT_CRC32);
+  const page_no_t dblwr_start = file.has_doublewrite ? FSP_EXTENT_SIZE : 0;
+  const page_no_t dblwr_end = file.has_doublewrite ? 3 * FSP_EXTENT_SIZE : 0;
+
+  std::vector<Bad_page> bad_pages;
+
+  for (os_offset_t offset = start; offset < end; offset += READ_SIZE) {
+    const size_t len = std::min<os_offset_t>(READ_SIZE, end - offset);
+    /* O_DIRECT reads are block aligned, including the one at the end of the
+    file which is short */
+    const size_t n_read = my_pread(file.fd, buffers.read,
+                                   ut_uint64_align_up(len, READ_ALIGN),
+                                   offset, MYF(0));
+    if (n_read == MY_FILE_ERROR || n_read < len) {
+      xb::error() << "cannot read " << len << " bytes at offset " << offset
+                  << " of " << file.path << ", errno = " << my_errno();
+      file.error = true;
+      return;
+    }
+
+    const ulint npages = len / physical;
+    const page_no_t first = offset / physical;
+    ulint batch_end = 0;
+    ulint batch_next = 0;
+
+    const byte *page = buffers.read;
+    for (ulint i = 0; i < npages; i++, page += physical) {
+      const page_no_t page_no = first + i;
+
+      if (page_no >= dblwr_start && page_no < dblwr_end) {
+        continue;
+      }
+
+      if (batch_crc32 && i == batch_next) {
+        batch_end = i + xb_page_batch_crc32(page, npages - i, physical);
+        batch_next = batch_end + 1;
+      }
+
+      if (i >= batch_end && !check_page(file, page, buffers)) {
+        bad_pages.push_back({page_no, 0});
+        continue;
+      }
+
+      const lsn_t lsn = mach_read_from_8(page + FIL_PAGE_LSN);
+      if (lsn > max_lsn) {
+        bad_pages.push_back({page_no, lsn});
+      }
+    }
+
+    file.n_pages += npages;
+  }
+
+  if (!bad_pages.empty()) {
+    std::lock_guard<std::mutex> lock(file.mutex);
+    file.bad_pages.insert(file.bad_pages.end(), bad_pages.begin(),
+                          bad_pages.end());
+  }
+}
+
+/** Report the pages of a file failing the verification.
+@param[in,out]  file     verified file
+@param[in]      max_lsn  newest lsn a page may have
+@return false if the file is corrupted */
+bool report(File &file, lsn_t max_lsn) {
+  if (file.bad_pages.empty()) {
+    return (!file.error);
+  }
+
+  std::sort(file.bad_pages.begin(), file.bad_pages.end());
+  for (const auto &bad : file.bad_pages) {
+    if (bad.lsn == 0) {
+      xb::error() << file.path << ": page " << bad.page_no
+                  << " is corrupted";
+    } else {
+      xb::error() << file.path << ": page " << bad.page_no << " has lsn "
+                  << bad.lsn << " newer than the checkpoint lsn " << max_lsn;
+    }
+  }
+  xb::error() << file.path << ": " << file.bad_pages.size() << " of "
+              << file.n_pages << " pages failed the verification";
+
+  return (false);
+}
+
+}  // namespace
+
+bool run(const char *dir, lsn_t max_lsn, size_t n_threads) {
+  std::string path(dir);
+  while (path.size() > 1 && path.back() == '/') {
+    path.pop_back();
+  }
+
+  std::vector<std::string> paths;
+  if (!list_dir(path, true, paths)) {
+    return (false);
+  }
+  std::sort(paths.begin(), paths.end());
+
+  xb::info() << "Verifying " << paths.size() << " tablespace files of " << dir
+             << " with " << n_threads << " threads, checkpoint lsn "
+             << max_lsn;
+
+  std::vector<std::unique_ptr<File>> files;
+  files.reserve(paths.size());
+  bool ok = true;
+  for (const auto &file_path : paths) {
+    auto file = std::make_unique<File>();
+    file->path = file_path;
+    if (!open_file(*file)) {
+      ok = false;
+      if (file->fd >= 0) {
+        my_close(file->fd, MYF(MY_WME));
+      }
+      continue;
+    }
+    files.push_back(std::move(file));
+  }
+
+  std::vector<Buffers> buffers(n_threads);
+  for (auto &buf : buffers) {
+    buf.read = static_cast<byte *>(ut::aligned_alloc(READ_SIZE, READ_ALIGN));
+    buf.page = static_cast<byte *>(
+        ut::aligned_alloc(UNIV_PAGE_SIZE_MAX, UNIV_PAGE_SIZE_MAX));
+    buf.scratch = static_cast<byte *>(
+        ut::aligned_alloc(2 * UNIV_PAGE_SIZE_MAX, UNIV_PAGE_SIZE_MAX));
+  }
+
+  {
+    Thread_pool pool(n_threads);
+    std::vector<std::future<void>> futures;
+    for (auto &file : files) {
+      for (os_offset_t start = 0; start < file->size; start += RANGE_SIZE) {
+        const os_offset_t end = std::min(start + RANGE_SIZE, file->size);
+        File *f = file.get();
+        futures.push_back(
+            pool.add_task([f, start, end, max_lsn, &buffers](size_t i) {
+              verify_range(*f, start, end, max_lsn, buffers[i]);
+            }));
+      }
+    }
+    for (auto &future : futures) {
+      future.get();
+    }
+  }
+
+  for (auto &buf : buffers) {
+    ut::aligned_free(buf.read);
+    ut::aligned_free(buf.page);
+    ut::aligned_free(buf.scratch);
+  }
+
+  uint64_t n_pages = 0;
+  uint64_t n_encrypted = 0;
+  for (auto &file : files) {
+    if (!report(*file, max_lsn)) {
+      ok = false;
+    }
+    n_pages += file->n_pages;
+    n_encrypted += file->n_encrypted;
+    my_close(file->fd, MYF(MY_WME));
+  }
+
+  xb::info() << "Verified " << n_pages << " pages of " << files.size()
+             << " files";
+  if (n_encrypted > 0) {
+    xb::warn() << n_encrypted
+               << " encrypted pages were not verified, their checksums "
+                  "can only be checked with the keyring";
+  }
+
+  return (ok);
+}
+
+}  // namespace verify
+}  // namespace xb
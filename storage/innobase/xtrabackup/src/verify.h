@@ -0,0 +1,50 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Verification of the tablespaces of a prepared backup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef XB_VERIFY_H
+#define XB_VERIFY_H
+
+#include <univ.i>
+
+#include <stddef.h>
+
+/* --verify reads every page of the tablespaces of a prepared backup, the
+same way the server would read them after --copy-back. The files are split
+into ranges read with O_DIRECT by --parallel threads, so that the page cache
+neither helps nor gets flushed. */
+namespace xb {
+namespace verify {
+
+/** Verify the checksums and the LSNs of the pages of the system, undo and
+file per table tablespaces of a backup and the size of their files.
+Encrypted pages are counted but cannot be verified without the keyring.
+Page compressed pages are decompressed first. Every corrupted page is
+reported.
+@param[in]  dir        backup directory
+@param[in]  max_lsn    checkpoint lsn of the prepared backup, pages having a
+                       newer lsn are reported
+@param[in]  n_threads  number of threads reading the files
+@return false if a file cannot be read or has corrupted pages */
+bool run(const char *dir, lsn_t max_lsn, size_t n_threads);
+
+}  // namespace verify
+}  // namespace xb
+
+#endif
@@ -0,0 +1,95 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Per-thread accounting of the time spent waiting.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <univ.i>
+
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "wait_state.h"
+
+namespace xb {
+namespace wait_state {
+
+static const char *state_names[N_STATES] = {
+    "read_io", "throttle", "pool_wait", "pool_idle", "stream_wait", "ds_write"};
+
+void dump() {
+  MY_TIMER_INFO timer_info;
+  my_timer_init(&timer_info);
+  const double frequency = timer_info.cycles.frequency;
+  if (frequency == 0) {
+    xb::warn() << "Thread wait states are not available, no cycle timer";
+    return;
+  }
+
+  struct group_t {
+    size_t n_threads{0};
+    ulonglong total{0};
+    ulonglong cycles[N_STATES]{};
+  };
+  std::map<std::string, group_t> groups;
+
+  const ulonglong now = my_timer_cycles();
+  {
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    for (const auto &times : threads) {
+      const ulonglong ended = times->ended.load();
+      auto &group = groups[times->name];
+      group.n_threads++;
+      group.total += (ended != 0 ? ended : now) - times->started;
+      for (int i = 0; i < N_STATES; i++) {
+        group.cycles[i] += times->cycles[i].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  for (const auto &entry : groups) {
+    const group_t &group = entry.second;
+    if (group.total == 0) {
+      continue;
+    }
+
+    std::ostringstream s;
+    char buf[32];
+    ulonglong waited = 0;
+    for (int i = 0; i < N_STATES; i++) {
+      snprintf(buf, sizeof(buf), "%.1f%%",
+               100.0 * group.cycles[i] / group.total);
+      s << state_names[i] << " " << buf << ", ";
+      waited += group.cycles[i];
+    }
+    snprintf(buf, sizeof(buf), "%.1f%%",
+             waited < group.total
+                 ? 100.0 * (group.total - waited) / group.total
+                 : 0.0);
+    s << "other " << buf;
+
+    snprintf(buf, sizeof(buf), "%.1f", group.total / frequency);
+    xb::info() << "Wait states of " << group.n_threads << " " << entry.first
+               << " threads over " << buf << " thread seconds: " << s.str();
+  }
+}
+
+}  // namespace wait_state
+}  // namespace xb
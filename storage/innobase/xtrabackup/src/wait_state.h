@@ -0,0 +1,134 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Per-thread accounting of the time spent waiting.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef WAIT_STATE_H
+#define WAIT_STATE_H
+
+#include <my_rdtsc.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* Threads registered with thread_start() account the cycles they spend in
+every wait state, counted with my_timer_cycles(). The time of a state nested
+in another one is only counted in the inner state. Unregistered threads pay
+one thread local check per Scope. Header only, so that the datasinks and the
+thread pool shared with xbstream and xbcrypt can be instrumented. */
+namespace xb {
+namespace wait_state {
+
+enum State {
+  /* datafile reads */
+  READ_IO,
+  /* sleeping in --throttle and --throttle-rate */
+  THROTTLE,
+  /* waiting for a task given to a thread pool */
+  POOL_WAIT,
+  /* pool worker waiting for tasks */
+  POOL_IDLE,
+  /* waiting for the xbstream writer */
+  STREAM_WAIT,
+  /* writing to the datasinks, excluding the waits above */
+  DS_WRITE,
+  N_STATES
+};
+
+struct Thread_times {
+  const char *name;
+  ulonglong started;
+  /* 0 while the thread runs */
+  std::atomic<ulonglong> ended{0};
+  std::atomic<ulonglong> cycles[N_STATES]{};
+};
+
+inline std::mutex threads_mutex;
+inline std::vector<std::unique_ptr<Thread_times>> threads;
+
+inline thread_local Thread_times *current = nullptr;
+inline thread_local int current_state = N_STATES;
+inline thread_local ulonglong state_started = 0;
+
+/** Start accounting the waits of the calling thread.
+@param[in]  name  thread group the times are summed up in, must be static */
+inline void thread_start(const char *name) {
+  auto times = std::make_unique<Thread_times>();
+  times->name = name;
+  times->started = my_timer_cycles();
+  current = times.get();
+
+  std::lock_guard<std::mutex> lock(threads_mutex);
+  threads.push_back(std::move(times));
+}
+
+/** Stop accounting the waits of the calling thread. */
+inline void thread_end() {
+  if (current == nullptr) {
+    return;
+  }
+  current->ended = my_timer_cycles();
+  current = nullptr;
+}
+
+/** Account the lifetime of the object to a wait state. */
+class Scope {
+ public:
+  explicit Scope(State state) {
+    if (current == nullptr) {
+      return;
+    }
+    const ulonglong now = my_timer_cycles();
+    outer = current_state;
+    if (outer != N_STATES) {
+      current->cycles[outer].fetch_add(now - state_started,
+                                       std::memory_order_relaxed);
+    }
+    current_state = state;
+    state_started = now;
+    active = true;
+  }
+
+  ~Scope() {
+    if (!active) {
+      return;
+    }
+    const ulonglong now = my_timer_cycles();
+    current->cycles[current_state].fetch_add(now - state_started,
+                                             std::memory_order_relaxed);
+    current_state = outer;
+    state_started = now;
+  }
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+ private:
+  bool active{false};
+  int outer{N_STATES};
+};
+
+/** Log the share of every wait state in the time of each thread group. Only
+linked into xtrabackup. */
+void dump();
+
+}  // namespace wait_state
+}  // namespace xb
+
+#endif
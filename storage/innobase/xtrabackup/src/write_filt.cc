@@ -54,6 +54,17 @@ xb_write_filt_t wf_incremental = {&wf_incremental_init, &wf_incremental_process,
                                   &wf_incremental_finalize,
                                   &wf_incremental_deinit};
 
+/************************************************************************
+Incremental page write filter writing the format 2 of .delta files. */
+static bool wf_incremental_v2_process(xb_write_filt_ctxt_t *ctxt,
+                                      ds_file_t *dstfile);
+static bool wf_incremental_v2_finalize(xb_write_filt_ctxt_t *ctxt,
+                                       ds_file_t *dstfile);
+
+xb_write_filt_t wf_incremental_v2 = {
+    &wf_incremental_init, &wf_incremental_v2_process,
+    &wf_incremental_v2_finalize, &wf_incremental_deinit};
+
 /************************************************************************
 Initialize incremental page write filter.
 
@@ -95,37 +106,53 @@ static bool wf_incremental_init(xb_write_filt_ctxt_t *ctxt, char *dst_name,
 
   mach_write_to_4(cp->delta_buf, 0x78747261UL); /*"xtra"*/
   cp->npages = 1;
+  cp->nranges = 0;
 
   return (true);
 }
 
 /************************************************************************
-Run the next batch of pages through incremental page write filter.
+LSN from which the pages of the cursor's space are copied to the .delta file.
+*/
+static lsn_t wf_incremental_from_lsn(const xb_fil_cur_t *cursor) {
+  /*
+   * We use metadata_from_lsn for mysql.ibd because we skip applying logical
+   * redos (MLOG_TABLE_DYNAMIC_META) during the incremental prepare (except
+   * the last prepare). These logical redos are converted to regular redo and
+   * flushed to pages in mysql.ibd when the server process a checkpoint. So
+   * we directly take the physical changes made to innodb_dynamic_metadata
+   * since the last backup. Hence we copy all changes to mysql.ibd since last
+   * backup start_lsn instead of last backup end_lsn.
+   */
+  return (cursor->space_id == dict_sys_t::s_dict_space_id
+              ? std::max(metadata_from_lsn, incremental_lsn)
+              : incremental_lsn);
+}
+
+/************************************************************************
+Run the next batch of pages through incremental page write filter, with the
+page size FIXED or the page size of the cursor if FIXED is 0.
 
 @return true on success, false on error. */
-static bool wf_incremental_process(xb_write_filt_ctxt_t *ctxt,
-                                   ds_file_t *dstfile) {
+template <ulint FIXED>
+static bool wf_incremental_process_low(xb_write_filt_ctxt_t *ctxt,
+                                       ds_file_t *dstfile) {
   ulint i;
   xb_fil_cur_t *cursor = ctxt->cursor;
-  ulint page_size = cursor->page_size;
+  const ulint page_size = FIXED != 0 ? FIXED : cursor->page_size;
   byte *page;
   xb_wf_incremental_ctxt_t *cp = &(ctxt->wf_incremental_ctxt);
-  for (i = 0, page = cursor->buf; i < cursor->buf_npages;
-       i++, page += page_size) {
-    /*
-     * We use metadata_from_lsn for mysql.ibd because we skip applying logical
-     * redos (MLOG_TABLE_DYNAMIC_META) during the incremental prepare (except
-     * the last prepare). These logical redos are converted to regular redo and
-     * flushed to pages in mysql.ibd when the server process a checkpoint. So
-     * we directly take the physical changes made to innodb_dynamic_metadata
-     * since the last backup. Hence we copy all changes to mysql.ibd since last
-     * backup start_lsn instead of last backup end_lsn.
-     */
-    if (cursor->space_id == dict_sys_t::s_dict_space_id &&
-        metadata_from_lsn > mach_read_from_8(page + FIL_PAGE_LSN))
-      continue;
-    else if (incremental_lsn > mach_read_from_8(page + FIL_PAGE_LSN))
+  const lsn_t from_lsn = wf_incremental_from_lsn(cursor);
+  auto is_updated = [from_lsn](const byte *p) {
+    return (from_lsn <= mach_read_from_8(p + FIL_PAGE_LSN));
+  };
+
+  for (i = 0, page = cursor->buf; i < cursor->buf_npages;) {
+    if (!is_updated(page)) {
+      i++;
+      page += page_size;
       continue;
+    }
 
     /* updated page */
     if (cp->npages == page_size / 4) {
@@ -134,22 +161,46 @@ static bool wf_incremental_process(xb_write_filt_ctxt_t *ctxt,
         return (false);
       }
 
-      /* clear buffer */
-      memset(cp->delta_buf, 0, page_size / 4 * page_size);
+      /* clear the page list, the pages are written over */
+      memset(cp->delta_buf, 0, page_size);
       /*"xtra"*/
       mach_write_to_4(cp->delta_buf, 0x78747261UL);
       cp->npages = 1;
     }
 
-    mach_write_to_4(cp->delta_buf + cp->npages * 4, cursor->buf_page_no + i);
-    memcpy(cp->delta_buf + cp->npages * page_size, page, page_size);
-
-    cp->npages++;
+    /* updated pages mostly come in runs, copy the run with one memcpy */
+    const ulint room = page_size / 4 - cp->npages;
+    ulint n = 0;
+    do {
+      mach_write_to_4(cp->delta_buf + (cp->npages + n) * 4,
+                      cursor->buf_page_no + i + n);
+      n++;
+    } while (n < room && i + n < cursor->buf_npages &&
+             is_updated(page + n * page_size));
+
+    memcpy(cp->delta_buf + cp->npages * page_size, page, n * page_size);
+
+    cp->npages += n;
+    i += n;
+    page += n * page_size;
   }
 
   return (true);
 }
 
+/************************************************************************
+Run the next batch of pages through incremental page write filter.
+
+@return true on success, false on error. */
+static bool wf_incremental_process(xb_write_filt_ctxt_t *ctxt,
+                                   ds_file_t *dstfile) {
+  const auto process = [&](auto fixed) {
+    return (wf_incremental_process_low<decltype(fixed)::value>(ctxt, dstfile));
+  };
+
+  return (xb_page_size_dispatch(ctxt->cursor->fixed_page_size, process));
+}
+
 /************************************************************************
 Flush the incremental page write filter's buffer.
 
@@ -175,8 +226,142 @@ static bool wf_incremental_finalize(xb_write_filt_ctxt_t *ctxt,
   return (true);
 }
 
+/* Format 2 of .delta files. A cluster starts with a header of
+XB_DELTA_V2_HDR_SIZE bytes, followed by (first page, number of pages) pairs,
+padded to the alignment below. The pages of the ranges follow the header. The
+header encodes runs of pages in 8 bytes and is only as long as needed, where
+the format 1 header takes a page with a 4 byte number per page. */
+
+/** Alignment of the format 2 header. It keeps the pages aligned for the
+O_DIRECT reads of --prepare. */
+static ulint wf_incremental_v2_align(ulint page_size) {
+  return (std::min<ulint>(page_size, 4096));
+}
+
+/************************************************************************
+Write the cluster buffered by the format 2 incremental page write filter.
+
+@return true on success, false on error. */
+static bool wf_incremental_v2_flush(xb_wf_incremental_ctxt_t *cp,
+                                    ulint page_size, bool last,
+                                    ds_file_t *dstfile) {
+  const ulint hdr_len =
+      ut_calc_align(XB_DELTA_V2_HDR_SIZE + cp->nranges * 8,
+                    wf_incremental_v2_align(page_size));
+
+  mach_write_to_4(cp->delta_buf,
+                  last ? XB_DELTA_V2_LAST_MAGIC : XB_DELTA_V2_MAGIC);
+  mach_write_to_4(cp->delta_buf + 4, hdr_len);
+  mach_write_to_4(cp->delta_buf + 8, cp->nranges);
+
+  if (ds_write(dstfile, cp->delta_buf, hdr_len)) {
+    return (false);
+  }
+
+  if (cp->npages > 1 && ds_write(dstfile, cp->delta_buf + page_size,
+                                 (cp->npages - 1) * page_size)) {
+    return (false);
+  }
+
+  memset(cp->delta_buf, 0, page_size);
+  cp->npages = 1;
+  cp->nranges = 0;
+
+  return (true);
+}
+
 /************************************************************************
-Free the incremental page write filter's buffer. */
+Run the next batch of pages through the format 2 incremental page write
+filter, with the page size FIXED or the page size of the cursor if FIXED is 0.
+
+@return true on success, false on error. */
+template <ulint FIXED>
+static bool wf_incremental_v2_process_low(xb_write_filt_ctxt_t *ctxt,
+                                          ds_file_t *dstfile) {
+  ulint i;
+  xb_fil_cur_t *cursor = ctxt->cursor;
+  const ulint page_size = FIXED != 0 ? FIXED : cursor->page_size;
+  byte *page;
+  xb_wf_incremental_ctxt_t *cp = &(ctxt->wf_incremental_ctxt);
+  const ulint max_ranges = (page_size - XB_DELTA_V2_HDR_SIZE) / 8;
+  const lsn_t from_lsn = wf_incremental_from_lsn(cursor);
+  auto is_updated = [from_lsn](const byte *p) {
+    return (from_lsn <= mach_read_from_8(p + FIL_PAGE_LSN));
+  };
+
+  for (i = 0, page = cursor->buf; i < cursor->buf_npages;) {
+    if (!is_updated(page)) {
+      i++;
+      page += page_size;
+      continue;
+    }
+
+    /* updated page, extend the last range if it ends right before it */
+    const ulint page_no = cursor->buf_page_no + i;
+    byte *range = cp->delta_buf + XB_DELTA_V2_HDR_SIZE + cp->nranges * 8;
+    bool extends = cp->nranges > 0 &&
+                   mach_read_from_4(range - 8) + mach_read_from_4(range - 4) ==
+                       page_no;
+
+    if (cp->npages == page_size / 4 ||
+        (!extends && cp->nranges == max_ranges)) {
+      if (!wf_incremental_v2_flush(cp, page_size, false, dstfile)) {
+        return (false);
+      }
+      range = cp->delta_buf + XB_DELTA_V2_HDR_SIZE;
+      extends = false;
+    }
+
+    const ulint room = page_size / 4 - cp->npages;
+    ulint n = 0;
+    do {
+      n++;
+    } while (n < room && i + n < cursor->buf_npages &&
+             is_updated(page + n * page_size));
+
+    if (extends) {
+      mach_write_to_4(range - 4, mach_read_from_4(range - 4) + n);
+    } else {
+      mach_write_to_4(range, page_no);
+      mach_write_to_4(range + 4, n);
+      cp->nranges++;
+    }
+
+    memcpy(cp->delta_buf + cp->npages * page_size, page, n * page_size);
+
+    cp->npages += n;
+    i += n;
+    page += n * page_size;
+  }
+
+  return (true);
+}
+
+/************************************************************************
+Run the next batch of pages through the format 2 incremental page write
+filter.
+
+@return true on success, false on error. */
+static bool wf_incremental_v2_process(xb_write_filt_ctxt_t *ctxt,
+                                      ds_file_t *dstfile) {
+  const auto process = [&](auto fixed) {
+    return (
+        wf_incremental_v2_process_low<decltype(fixed)::value>(ctxt, dstfile));
+  };
+
+  return (xb_page_size_dispatch(ctxt->cursor->fixed_page_size, process));
+}
+
+/************************************************************************
+Flush the format 2 incremental page write filter's buffer.
+
+@return true on success, false on error. */
+static bool wf_incremental_v2_finalize(xb_write_filt_ctxt_t *ctxt,
+                                       ds_file_t *dstfile) {
+  return (wf_incremental_v2_flush(&ctxt->wf_incremental_ctxt,
+                                  ctxt->cursor->page_size, true, dstfile));
+}
+
 static void wf_incremental_deinit(xb_write_filt_ctxt_t *ctxt) {
   xb_wf_incremental_ctxt_t *cp = &(ctxt->wf_incremental_ctxt);
 
@@ -197,6 +382,36 @@ static bool wf_wt_init(xb_write_filt_ctxt_t *ctxt,
   return (true);
 }
 
+/************************************************************************
+Write a run of pages skipped by the read filter to the destination datasink,
+as a hole when the datasink supports sparse files and as zeroes otherwise.
+
+@return true on success, false on error. */
+static bool wf_wt_write_gap(ds_file_t *dstfile, uint64_t len) {
+  static const byte zeroes[UNIV_PAGE_SIZE_MAX] = {};
+
+  if (ds_is_sparse_write_supported(dstfile)) {
+    /* sparse map entries are stored as 32-bit integers in xbstream */
+    std::vector<ds_sparse_chunk_t> sparse_map;
+    for (; len > 0; len -= sparse_map.back().skip) {
+      sparse_map.push_back(
+          ds_sparse_chunk_t{std::min<size_t>(len, 1ULL << 30), 0});
+    }
+    return (!ds_write_sparse(dstfile, zeroes, 0, sparse_map.size(),
+                             &sparse_map[0], punch_hole_supported));
+  }
+
+  while (len > 0) {
+    const size_t n = std::min<uint64_t>(len, sizeof(zeroes));
+    if (ds_write(dstfile, zeroes, n)) {
+      return (false);
+    }
+    len -= n;
+  }
+
+  return (true);
+}
+
 /************************************************************************
 Write the next batch of pages to the destination datasink.
 
@@ -204,6 +419,11 @@ Write the next batch of pages to the destination datasink.
 static bool wf_wt_process(xb_write_filt_ctxt_t *ctxt, ds_file_t *dstfile) {
   const auto cursor = ctxt->cursor;
 
+  if (cursor->read_filter_ctxt.skipped > 0 &&
+      !wf_wt_write_gap(dstfile, cursor->read_filter_ctxt.skipped)) {
+    return (false);
+  }
+
   return write_ibd_buffer(
       dstfile, cursor->buf, cursor->buf_npages * cursor->page_size,
       cursor->page_size, cursor->block_size, punch_hole_supported);
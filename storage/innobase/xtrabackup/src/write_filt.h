@@ -28,11 +28,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "datasink.h"
 #include "fil_cur.h"
 
+/* Format 2 of .delta files, see write_filt.cc */
+#define XB_DELTA_V2_MAGIC 0x78747232UL      /* "xtr2" */
+#define XB_DELTA_V2_LAST_MAGIC 0x58545232UL /* "XTR2" */
+#define XB_DELTA_V2_HDR_SIZE 12
+
 /* Incremental page filter context */
 typedef struct {
   byte *delta_buf_base;
   byte *delta_buf;
   ulint npages;
+  ulint nranges; /* page ranges in the cluster header, format 2 only */
 } xb_wf_incremental_ctxt_t;
 
 /* Page filter context used as an opaque structure by callers */
@@ -51,6 +57,7 @@ typedef struct {
 
 extern xb_write_filt_t wf_write_through;
 extern xb_write_filt_t wf_incremental;
+extern xb_write_filt_t wf_incremental_v2;
 extern xb_write_filt_t wf_compact;
 
 #endif /* XB_WRITE_FILT_H */
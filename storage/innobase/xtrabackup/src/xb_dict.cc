@@ -20,6 +20,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "xb_dict.h"
 #include <dd/properties.h>
 #include <sql_class.h>
+#include <atomic>
 #include <memory>
 #include <unordered_map>
 #include "backup_mysql.h"
@@ -49,25 +50,28 @@ std::shared_ptr<dd_space_ids> build_space_id_set(MYSQL *connection) {
   std::shared_ptr<dd_space_ids> dd_tab = std::make_shared<dd_space_ids>();
   std::string sql = "SELECT SPACE FROM INFORMATION_SCHEMA.INNODB_TABLESPACES ";
 
-  MYSQL_RES *result = xb_mysql_query(connection, sql.c_str(), true, true);
-  if (result) {
-    auto rows_counts = mysql_num_rows(result);
-    if (rows_counts > 0) {
-      MYSQL_ROW row;
-      while ((row = mysql_fetch_row(result)) != nullptr) {
-        space_id_t space_id = atoi(row[0]);
-        dd_tab->insert(space_id);
-      }
-    } else {
-      xb::warn() << " Query " << sql << " did not return any value ";
-      return nullptr;
-    }
-    mysql_free_result(result);
-  } else {
+  MYSQL_RES *result = xb_mysql_query_stream(connection, sql.c_str(), false);
+  if (result == nullptr) {
+    xb::warn() << "Failed to execute query " << sql;
+    return nullptr;
+  }
+
+  MYSQL_ROW row;
+  while ((row = mysql_fetch_row(result)) != nullptr) {
+    space_id_t space_id = atoi(row[0]);
+    dd_tab->insert(space_id);
+  }
+
+  if (!xb_mysql_stream_end(connection, result, false)) {
     xb::warn() << "Failed to execute query " << sql;
     return nullptr;
   }
 
+  if (dd_tab->empty()) {
+    xb::warn() << " Query " << sql << " did not return any value ";
+    return nullptr;
+  }
+
   return dd_tab;
 }
 }  // namespace backup
@@ -93,12 +97,21 @@ static std::map<std::pair<int, std::string>, uint64> sdi_id_map;
 This map is used to handle duplicate SDI */
 static std::map<std::string, uint64> dd_schema_map;
 
+/** true once the maps above are built, set under dict_sys->mutex */
+static std::atomic<bool> dictionary_built{false};
+
+static void build_dictionary_once(THD *thd);
+
 using dd_Table_Ptr = std::unique_ptr<dd::Table>;
 
 /** @return true if table_id is found in dd map. This map
 is created by scanning mysql.indexes and mysql.index_partitions
 @param[in]  table_id InnoDB table id */
 bool table_exists_in_dd(table_id_t table_id) {
+  ut_ad(dict_sys_mutex_own());
+
+  build_dictionary_once(current_thd);
+
   return (table_id_space_map.find(table_id) != table_id_space_map.end());
 }
 
@@ -270,6 +283,12 @@ function dd_table_open_on_id()
 a - DB_SUCCESS on success, other DB_ on errors
 b - std::vector<dict_table_t*>, empty on errors */
 xb_dict_tuple dict_load_tables_using_table_id(table_id_t table_id) {
+  if (!dictionary_built.load()) {
+    dict_sys_mutex_enter();
+    build_dictionary_once(current_thd);
+    dict_sys_mutex_exit();
+  }
+
   auto it = table_id_space_map.find(table_id);
   if (it == table_id_space_map.end()) {
     // Table_id not present in any space_id. A dropped table
@@ -815,17 +834,30 @@ static dberr_t scan_mysql_index_partitions(THD *thd) {
   return (DB_SUCCESS);
 }
 
-/** Build dictionary required for prepare phase. Currently used
-for rollback of transactions, export of tables (.cfg file creation)
-and --stats features
-@param[in] thd Server thread context
-@return DB_SUCCESS on success or other DB_* codes on errors */
-static dberr_t build_dictionary(THD *thd) {
-  mutex_enter(&dict_sys->mutex);
+/** Build the maps of table ids to tablespaces required for prepare phase.
+They are only needed to open a table by its id, which the rollback of
+transactions does, so they are built on the first such lookup rather than
+at startup. Export of tables (.cfg file creation) and --stats load the
+tables by tablespace and never need them. The caller must hold
+dict_sys->mutex.
+@param[in] thd Server thread context */
+static void build_dictionary_once(THD *thd) {
+  ut_ad(dict_sys_mutex_own());
+
+  if (dictionary_built.load()) {
+    return;
+  }
+
+  auto begin = std::chrono::high_resolution_clock::now();
   scan_mysql_indexes(thd);
   scan_mysql_index_partitions(thd);
-  mutex_exit(&dict_sys->mutex);
-  return (DB_SUCCESS);
+  auto end = std::chrono::high_resolution_clock::now();
+  auto elapsed =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
+  xb::info() << "Time taken to build dictionary: " << elapsed.count() * 1e-9
+             << " seconds";
+
+  dictionary_built.store(true);
 }
 
 /** Load all tables from mysql.ibd. This includes dictionary tables, system
@@ -835,17 +867,12 @@ a - DB_SUCCESS on success, other DB_ on errors
 b - std::vector<dict_table_t*>, empty on errors */
 xb_dict_tuple dict_load_from_mysql_ibd() {
   auto begin = std::chrono::high_resolution_clock::now();
-  THD *thd = current_thd;
-  ut_ad(thd != nullptr);
+  ut_ad(current_thd != nullptr);
   auto result = dict_load_from_spaces_sdi(dict_sys_t::s_dict_space_id);
-  dberr_t err = std::get<0>(result);
-  if (err == DB_SUCCESS) {
-    err = build_dictionary(thd);
-  }
   auto end = std::chrono::high_resolution_clock::now();
   auto elapsed =
       std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
-  xb::info() << "Time taken to build dictionary: " << elapsed.count() * 1e-9
+  xb::info() << "Time taken to load mysql.ibd: " << elapsed.count() * 1e-9
              << " seconds";
 
   return result;
@@ -858,6 +885,7 @@ void clear_dd_cache_maps() {
   part_id_spaces_map.clear();
   sdi_id_map.clear();
   dd_schema_map.clear();
+  dictionary_built.store(false);
 }
 
 }  // namespace prepare
@@ -216,7 +216,8 @@ xb_dict_tuple dict_load_tables_from_space_id(space_id_t space_id,
 xb_dict_tuple dict_load_from_spaces_sdi(space_id_t space_id);
 
 /** @return true if table_id is found in dd map. This map
-is created by scanning mysql.indexes and mysql.index_partitions
+is created by scanning mysql.indexes and mysql.index_partitions on the first
+call. The caller must hold dict_sys->mutex.
 @param[in]  table_id InnoDB table id */
 bool table_exists_in_dd(table_id_t table_id);
 
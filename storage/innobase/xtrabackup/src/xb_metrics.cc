@@ -0,0 +1,142 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Live metrics written for the Prometheus textfile collector.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <univ.i>
+
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <my_sys.h>
+
+#include "xb_metrics.h"
+
+namespace xb {
+namespace metrics {
+
+namespace {
+
+struct metric_t {
+  std::string name;
+  std::string help;
+  Type type;
+  std::function<double()> sample;
+};
+
+std::mutex metrics_mutex;
+std::vector<metric_t> metrics;
+
+std::string metrics_path;
+std::chrono::seconds metrics_interval;
+std::thread *metrics_thread = nullptr;
+std::condition_variable metrics_cond;
+bool metrics_stop = false;
+
+/** Write all metrics to a temporary file and rename it over the target, so
+that the collector never reads a partial file */
+bool write_metrics() {
+  const std::string tmp_path = metrics_path + ".tmp";
+
+  FILE *f = fopen(tmp_path.c_str(), "w");
+  if (f == nullptr) {
+    xb::error() << "cannot open " << tmp_path << ", errno = " << errno;
+    return (false);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    for (const auto &metric : metrics) {
+      fprintf(f, "# HELP %s %s\n", metric.name.c_str(), metric.help.c_str());
+      fprintf(f, "# TYPE %s %s\n", metric.name.c_str(),
+              metric.type == Type::COUNTER ? "counter" : "gauge");
+      fprintf(f, "%s %.17g\n", metric.name.c_str(), metric.sample());
+    }
+  }
+
+  if (fclose(f) != 0 || rename(tmp_path.c_str(), metrics_path.c_str()) != 0) {
+    xb::error() << "cannot write " << metrics_path << ", errno = " << errno;
+    return (false);
+  }
+
+  return (true);
+}
+
+void metrics_thread_func() {
+  my_thread_init();
+
+  std::unique_lock<std::mutex> lock(metrics_mutex);
+  while (!metrics_cond.wait_for(lock, metrics_interval,
+                                [] { return metrics_stop; })) {
+    lock.unlock();
+    write_metrics();
+    lock.lock();
+  }
+
+  my_thread_end();
+}
+
+}  // namespace
+
+void add(const char *name, const char *help, Type type,
+         std::function<double()> sample) {
+  std::lock_guard<std::mutex> lock(metrics_mutex);
+  metrics.push_back({name, help, type, std::move(sample)});
+}
+
+bool start(const char *path, unsigned int interval) {
+  metrics_path = path;
+  metrics_interval = std::chrono::seconds(interval);
+  metrics_stop = false;
+
+  if (!write_metrics()) {
+    return (false);
+  }
+
+  metrics_thread = new std::thread(metrics_thread_func);
+
+  xb::info() << "Writing metrics to " << metrics_path << " every "
+             << interval << " seconds";
+
+  return (true);
+}
+
+void stop() {
+  if (metrics_thread == nullptr) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    metrics_stop = true;
+  }
+  metrics_cond.notify_one();
+  metrics_thread->join();
+  delete metrics_thread;
+  metrics_thread = nullptr;
+
+  write_metrics();
+}
+
+}  // namespace metrics
+}  // namespace xb
@@ -0,0 +1,55 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Live metrics written for the Prometheus textfile collector.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+#ifndef XB_METRICS_H
+#define XB_METRICS_H
+
+#include <functional>
+
+namespace xb {
+namespace metrics {
+
+enum class Type { COUNTER, GAUGE };
+
+/** Register a metric. The sample function is called from the metrics
+thread every time the file is written, so it must only read state that is
+safe to read concurrently.
+@param[in]  name    metric name
+@param[in]  help    description of the metric
+@param[in]  type    Prometheus metric type
+@param[in]  sample  returns the current value */
+void add(const char *name, const char *help, Type type,
+         std::function<double()> sample);
+
+/** Start writing the metrics in the Prometheus text format to a file every
+interval seconds. The file is replaced atomically, as the textfile collector
+of node_exporter expects.
+@param[in]  path      file to write
+@param[in]  interval  seconds between the writes
+@return false if the first write failed */
+bool start(const char *path, unsigned int interval);
+
+/** Write the metrics a last time and stop the metrics thread. Does nothing
+if start() was not called. */
+void stop();
+
+}  // namespace metrics
+}  // namespace xb
+
+#endif
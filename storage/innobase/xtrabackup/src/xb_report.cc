@@ -0,0 +1,206 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Per-phase and per-stage timing report.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <my_rapidjson_size_t.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include <univ.i>
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "xb_report.h"
+#include "xtrabackup_version.h"
+
+namespace xb {
+namespace report {
+
+namespace {
+
+struct entry_t {
+  std::string name;
+  uint64_t calls;
+  uint64_t bytes;
+  uint64_t usec;
+};
+
+/** Version of the report format */
+const int REPORT_VERSION = 1;
+
+/** Maximum number of datasink stages read for the report */
+const size_t REPORT_MAX_DS_STAGES = 32;
+
+std::mutex report_mutex;
+std::vector<entry_t> report_phases;
+std::vector<entry_t> report_stages;
+
+/* the report covers the run from the start of the program */
+const auto report_start = std::chrono::steady_clock::now();
+
+using Writer = rapidjson::Writer<rapidjson::StringBuffer>;
+
+void write_entries(Writer &writer, const char *key,
+                   const std::vector<entry_t> &entries) {
+  writer.Key(key);
+  writer.StartArray();
+  for (const auto &entry : entries) {
+    writer.StartObject();
+    writer.Key("name");
+    writer.String(entry.name.c_str());
+    if (entry.calls > 0) {
+      writer.Key("calls");
+      writer.Uint64(entry.calls);
+    }
+    writer.Key("sec");
+    writer.Double(entry.usec / 1000000.0);
+    writer.Key("bytes");
+    writer.Uint64(entry.bytes);
+    if (entry.bytes > 0 && entry.usec > 0) {
+      writer.Key("mib_per_sec");
+      writer.Double(entry.bytes * 1000000.0 / entry.usec / (1024 * 1024));
+    }
+    writer.EndObject();
+  }
+  writer.EndArray();
+}
+
+/** Add the datasink stages to the other stages. Datasink types sharing a
+name, e.g. the compression algorithms, are summed up. */
+std::vector<entry_t> collect_stages() {
+  std::vector<entry_t> stages = report_stages;
+  ds_stage_stats_t ds_stats[REPORT_MAX_DS_STAGES];
+
+  const size_t n = ds_get_stage_stats(ds_stats, REPORT_MAX_DS_STAGES);
+  for (size_t i = 0; i < n; i++) {
+    if (ds_stats[i].calls == 0) {
+      continue;
+    }
+    const std::string name = ds_stats[i].name;
+    auto it =
+        std::find_if(stages.begin(), stages.end(),
+                     [&name](const entry_t &e) { return e.name == name; });
+    if (it == stages.end()) {
+      stages.push_back({ds_stats[i].name, 0, 0, 0});
+      it = stages.end() - 1;
+    }
+    it->calls += ds_stats[i].calls;
+    it->bytes += ds_stats[i].bytes;
+    it->usec += ds_stats[i].usec;
+  }
+
+  return stages;
+}
+
+void serialize(rapidjson::StringBuffer &buf) {
+  std::lock_guard<std::mutex> lock(report_mutex);
+  Writer writer(buf);
+
+  writer.StartObject();
+  writer.Key("version");
+  writer.Int(REPORT_VERSION);
+  writer.Key("tool_version");
+  writer.String(XTRABACKUP_VERSION);
+  writer.Key("total_sec");
+  writer.Double(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - report_start)
+                    .count() /
+                1000000.0);
+  write_entries(writer, "phases", report_phases);
+  write_entries(writer, "stages", collect_stages());
+  writer.EndObject();
+}
+
+}  // namespace
+
+void Phase::end() {
+  if (m_ended) {
+    return;
+  }
+  m_ended = true;
+  add_phase(m_name,
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - m_start)
+                .count(),
+            m_bytes);
+}
+
+void add_phase(const char *name, uint64_t usec, uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(report_mutex);
+  report_phases.push_back({name, 0, bytes, usec});
+}
+
+void add_stage(const char *name, uint64_t calls, uint64_t bytes,
+               uint64_t usec) {
+  std::lock_guard<std::mutex> lock(report_mutex);
+  report_stages.push_back({name, calls, bytes, usec});
+}
+
+bool write(ds_ctxt_t *ds, const char *name) {
+  rapidjson::StringBuffer buf;
+
+  serialize(buf);
+
+  MY_STAT mystat;
+  mystat.st_size = buf.GetSize();
+  mystat.st_mtime = time(nullptr);
+
+  ds_file_t *stream = ds_open(ds, name, &mystat);
+  if (stream == nullptr) {
+    xb::error() << "cannot open output stream for " << name;
+    return (false);
+  }
+
+  bool rc = true;
+
+  if (ds_write(stream, buf.GetString(), buf.GetSize())) {
+    rc = false;
+  }
+
+  if (ds_close(stream)) {
+    rc = false;
+  }
+
+  return (rc);
+}
+
+bool write(const char *name) {
+  rapidjson::StringBuffer buf;
+
+  serialize(buf);
+
+  std::ofstream f(name);
+  f.write(buf.GetString(), buf.GetSize());
+  f.close();
+
+  if (!f) {
+    xb::error() << "cannot write " << name;
+    return (false);
+  }
+
+  return (true);
+}
+
+}  // namespace report
+}  // namespace xb
@@ -0,0 +1,83 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Per-phase and per-stage timing report.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+#ifndef XB_REPORT_H
+#define XB_REPORT_H
+
+#include <chrono>
+#include <cstdint>
+#include "datasink.h"
+
+namespace xb {
+namespace report {
+
+/** Measures the wall time of a phase from its construction until end() or
+its destruction. Phases may overlap, they are reported in the order they
+ended. */
+class Phase {
+ public:
+  explicit Phase(const char *name)
+      : m_name(name), m_start(std::chrono::steady_clock::now()) {}
+
+  Phase(const Phase &) = delete;
+  Phase &operator=(const Phase &) = delete;
+
+  ~Phase() { end(); }
+
+  void add_bytes(uint64_t bytes) { m_bytes += bytes; }
+
+  void end();
+
+ private:
+  const char *m_name;
+  std::chrono::steady_clock::time_point m_start;
+  uint64_t m_bytes{0};
+  bool m_ended{false};
+};
+
+/** Add a phase measured by the caller.
+@param[in]  name   phase name
+@param[in]  usec   duration in microseconds
+@param[in]  bytes  bytes processed, or 0 */
+void add_phase(const char *name, uint64_t usec, uint64_t bytes);
+
+/** Add a stage that is not a datasink, e.g. the datafile reads. The datasink
+stages are added when the report is written.
+@param[in]  name   stage name
+@param[in]  calls  number of calls, or 0 if not counted
+@param[in]  bytes  bytes processed
+@param[in]  usec   time spent in the stage in microseconds */
+void add_stage(const char *name, uint64_t calls, uint64_t bytes,
+               uint64_t usec);
+
+/** Write the report as JSON into a datasink.
+@param[in]  ds    datasink
+@param[in]  name  file name
+@return false on error */
+bool write(ds_ctxt_t *ds, const char *name);
+
+/** Write the report as JSON into a file of the current directory.
+@param[in]  name  file name
+@return false on error */
+bool write(const char *name);
+
+}  // namespace report
+}  // namespace xb
+
+#endif
@@ -0,0 +1,359 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Microbenchmarks of the compression, encryption and xbstream kernels.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <gtest/gtest.h>
+#include <lz4.h>
+#include <my_sys.h>
+#include <mysql/service_mysql_alloc.h>
+#include <quicklz.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <zstd.h>
+#include <random>
+#include <vector>
+#include "crc_glue.h"
+#include "unittest/gunit/benchmark.h"
+#include "xbcrypt.h"
+#include "xbcrypt_common.h"
+#include "xbstream.h"
+
+namespace {
+
+/* size of the buffers handed to the kernels, as used by the datasinks */
+const size_t CHUNK_SIZE = 64 * 1024;
+
+const size_t PAGE_SIZE = 16 * 1024;
+
+/* number of chunks written to the stream per iteration */
+const size_t STREAM_CHUNKS = 16;
+
+/** @return CHUNK_SIZE bytes resembling InnoDB pages: each page is half
+random bytes and half zero fill, so that it compresses like a partially
+filled page would */
+const std::vector<char> &synthetic_chunk() {
+  static std::vector<char> chunk;
+
+  if (chunk.empty()) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    chunk.resize(CHUNK_SIZE);
+    for (size_t i = 0; i < CHUNK_SIZE; i++) {
+      chunk[i] = (i % PAGE_SIZE < PAGE_SIZE / 2) ? byte(gen) : 0;
+    }
+  }
+
+  return chunk;
+}
+
+void BM_quicklz_compress(size_t num_iterations) {
+  StopBenchmarkTiming();
+
+  const std::vector<char> &from = synthetic_chunk();
+  std::vector<char> to(CHUNK_SIZE + 400);
+  qlz_state_compress state;
+
+  memset(&state, 0, sizeof(state));
+
+  StartBenchmarkTiming();
+  for (size_t i = 0; i < num_iterations; i++) {
+    qlz_compress(from.data(), to.data(), from.size(), &state);
+  }
+  StopBenchmarkTiming();
+
+  SetBytesProcessed(num_iterations * CHUNK_SIZE);
+}
+BENCHMARK(BM_quicklz_compress)
+
+void BM_quicklz_decompress(size_t num_iterations) {
+  StopBenchmarkTiming();
+
+  const std::vector<char> &from = synthetic_chunk();
+  std::vector<char> compressed(CHUNK_SIZE + 400);
+  std::vector<char> to(CHUNK_SIZE);
+  qlz_state_compress state;
+  qlz_state_decompress dstate;
+
+  memset(&state, 0, sizeof(state));
+  memset(&dstate, 0, sizeof(dstate));
+  qlz_compress(from.data(), compressed.data(), from.size(), &state);
+
+  StartBenchmarkTiming();
+  for (size_t i = 0; i < num_iterations; i++) {
+    qlz_decompress(compressed.data(), to.data(), &dstate);
+  }
+  StopBenchmarkTiming();
+
+  SetBytesProcessed(num_iterations * CHUNK_SIZE);
+}
+BENCHMARK(BM_quicklz_decompress)
+
+void BM_lz4_compress(size_t num_iterations) {
+  StopBenchmarkTiming();
+
+  const std::vector<char> &from = synthetic_chunk();
+  std::vector<char> to(LZ4_compressBound(CHUNK_SIZE));
+
+  StartBenchmarkTiming();
+  for (size_t i = 0; i < num_iterations; i++) {
+    LZ4_compress_default(from.data(), to.data(), from.size(), to.size());
+  }
+  StopBenchmarkTiming();
+
+  SetBytesProcessed(num_iterations * CHUNK_SIZE);
+}
+BENCHMARK(BM_lz4_compress)
+
+void BM_lz4_decompress(size_t num_iterations) {
+  StopBenchmarkTiming();
+
+  const std::vector<char> &from = synthetic_chunk();
+  std::vector<char> compressed(LZ4_compressBound(CHUNK_SIZE));
+  std::vector<char> to(CHUNK_SIZE);
+
+  const int len = LZ4_compress_default(from.data(), compressed.data(),
+                                       from.size(), compressed.size());
+
+  StartBenchmarkTiming();
+  for (size_t i = 0; i < num_iterations; i++) {
+    LZ4_decompress_safe(compressed.data(), to.data(), len, to.size());
+  }
+  StopBenchmarkTiming();
+
+  SetBytesProcessed(num_iterations * CHUNK_SIZE);
+}
+BENCHMARK(BM_lz4_decompress)
+
+void BM_zstd_compress(size_t num_iterations) {
+  StopBenchmarkTiming();
+
+  const std::vector<char> &from = synthetic_chunk();
+  std::vector<char> to(ZSTD_compressBound(CHUNK_SIZE));
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+
+  StartBenchmarkTiming();
+  for (size_t i = 0; i < num_iterations; i++) {
+    ZSTD_compressCCtx(cctx, to.data(), to.size(), from.data(), from.size(), 1);
+  }
+  StopBenchmarkTiming();
+
+  ZSTD_freeCCtx(cctx);
+
+  SetBytesProcessed(num_iterations * CHUNK_SIZE);
+}
+BENCHMARK(BM_zstd_compress)
+
+void BM_zstd_decompress(size_t num_iterations) {
+  StopBenchmarkTiming();
+
+  const std::vector<char> &from = synthetic_chunk();
+  std::vector<char> compressed(ZSTD_compressBound(CHUNK_SIZE));
+  std::vector<char> to(CHUNK_SIZE);
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+
+  const size_t len = ZSTD_compress(compressed.data(), compressed.size(),
+                                   from.data(), from.size(), 1);
+
+  StartBenchmarkTiming();
+  for (size_t i = 0; i < num_iterations; i++) {
+    ZSTD_decompressDCtx(dctx, to.data(), to.size(), compressed.data(), len);
+  }
+  StopBenchmarkTiming();
+
+  ZSTD_freeDCtx(dctx);
+
+  SetBytesProcessed(num_iterations * CHUNK_SIZE);
+}
+BENCHMARK(BM_zstd_decompress)
+
+/** Set up AES256 with a fixed key, as --encrypt=AES256 does
+@return iv length */
+uint init_encryption() {
+  static uint iv_len = 0;
+
+  if (iv_len == 0) {
+    ds_encrypt_algo = 3;
+    ds_encrypt_key =
+        my_strdup(PSI_NOT_INSTRUMENTED, "0123456789abcdef0123456789abcdef",
+                  MYF(MY_FAE));
+    EXPECT_EQ(0U, xb_crypt_init(&iv_len));
+  }
+
+  return (iv_len);
+}
+
+void BM_encrypt_ctr(size_t num_iterations) {
+  StopBenchmarkTiming();
+
+  const std::vector<char> &from = synthetic_chunk();
+  std::vector<uchar> to(CHUNK_SIZE + XB_CRYPT_HASH_LEN);
+  std::vector<uchar> iv(init_encryption());
+  gcry_cipher_hd_t cipher;
+  size_t to_len;
+
+  EXPECT_EQ(0U, xb_crypt_cipher_open(&cipher));
+
+  StartBenchmarkTiming();
+  for (size_t i = 0; i < num_iterations; i++) {
+    xb_crypt_encrypt(cipher, reinterpret_cast<const uchar *>(from.data()),
+                     from.size(), to.data(), &to_len, iv.data());
+  }
+  StopBenchmarkTiming();
+
+  xb_crypt_cipher_close(cipher);
+
+  SetBytesProcessed(num_iterations * CHUNK_SIZE);
+}
+BENCHMARK(BM_encrypt_ctr)
+
+void BM_decrypt_ctr(size_t num_iterations) {
+  StopBenchmarkTiming();
+
+  const std::vector<char> &from = synthetic_chunk();
+  std::vector<uchar> encrypted(CHUNK_SIZE + XB_CRYPT_HASH_LEN);
+  std::vector<uchar> to(CHUNK_SIZE + XB_CRYPT_HASH_LEN);
+  std::vector<uchar> iv(init_encryption());
+  gcry_cipher_hd_t cipher;
+  size_t len;
+
+  EXPECT_EQ(0U, xb_crypt_cipher_open(&cipher));
+  xb_crypt_encrypt(cipher, reinterpret_cast<const uchar *>(from.data()),
+                   from.size(), encrypted.data(), &len, iv.data());
+
+  StartBenchmarkTiming();
+  for (size_t i = 0; i < num_iterations; i++) {
+    size_t to_len;
+    xb_crypt_decrypt(cipher, encrypted.data(), len + XB_CRYPT_HASH_LEN,
+                     to.data(), &to_len, iv.data(), iv.size(), true);
+  }
+  StopBenchmarkTiming();
+
+  xb_crypt_cipher_close(cipher);
+
+  SetBytesProcessed(num_iterations * CHUNK_SIZE);
+}
+BENCHMARK(BM_decrypt_ctr)
+
+void BM_encrypt_gcm(size_t num_iterations) {
+  StopBenchmarkTiming();
+
+  init_encryption();
+
+  const std::vector<char> &from = synthetic_chunk();
+  std::vector<uchar> to(CHUNK_SIZE + XB_CRYPT_GCM_TAG_LEN);
+  uchar iv[XB_CRYPT_GCM_IV_LEN];
+  gcry_cipher_hd_t cipher;
+  size_t to_len;
+
+  EXPECT_EQ(0U, xb_crypt_cipher_open_gcm(&cipher));
+
+  StartBenchmarkTiming();
+  for (size_t i = 0; i < num_iterations; i++) {
+    xb_crypt_encrypt_gcm(cipher, reinterpret_cast<const uchar *>(from.data()),
+                         from.size(), to.data(), &to_len, iv);
+  }
+  StopBenchmarkTiming();
+
+  xb_crypt_cipher_close(cipher);
+
+  SetBytesProcessed(num_iterations * CHUNK_SIZE);
+}
+BENCHMARK(BM_encrypt_gcm)
+
+ssize_t discard_write(xb_wstream_file_t *, void *, const void *,
+                      size_t len) {
+  return (len);
+}
+
+ssize_t fd_write(xb_wstream_file_t *, void *userdata, const void *buf,
+                 size_t len) {
+  return (write(*static_cast<int *>(userdata), buf, len));
+}
+
+/** Write STREAM_CHUNKS synthetic chunks as one file of a new stream */
+void write_stream(void *userdata, xb_stream_write_callback *onwrite) {
+  const std::vector<char> &data = synthetic_chunk();
+  xb_wstream_t *stream = xb_stream_write_new();
+  MY_STAT mystat;
+
+  memset(&mystat, 0, sizeof(mystat));
+
+  xb_wstream_file_t *file =
+      xb_stream_write_open(stream, "bench.dat", &mystat, userdata, onwrite,
+                           nullptr);
+  for (size_t i = 0; i < STREAM_CHUNKS; i++) {
+    xb_stream_write_data(file, data.data(), data.size());
+  }
+  xb_stream_write_close(file);
+  xb_stream_write_done(stream);
+}
+
+void BM_xbstream_write(size_t num_iterations) {
+  for (size_t i = 0; i < num_iterations; i++) {
+    write_stream(nullptr, discard_write);
+  }
+
+  SetBytesProcessed(num_iterations * STREAM_CHUNKS * CHUNK_SIZE);
+}
+BENCHMARK(BM_xbstream_write)
+
+void BM_xbstream_read(size_t num_iterations) {
+  StopBenchmarkTiming();
+
+  FILE *tmp = tmpfile();
+  ASSERT_NE(nullptr, tmp);
+  int fd = fileno(tmp);
+  write_stream(&fd, fd_write);
+
+  xb_rstream_chunk_t chunk;
+  memset(&chunk, 0, sizeof(chunk));
+
+  StartBenchmarkTiming();
+  for (size_t i = 0; i < num_iterations; i++) {
+    lseek(fd, 0, SEEK_SET);
+    xb_rstream_t *stream = xb_stream_read_new_fd(dup(fd));
+    while (xb_stream_read_chunk(stream, &chunk) == XB_STREAM_READ_CHUNK &&
+           chunk.type != XB_CHUNK_TYPE_EOF) {
+      EXPECT_EQ(XB_STREAM_READ_CHUNK, xb_stream_validate_checksum(&chunk));
+    }
+    xb_stream_read_done(stream);
+  }
+  StopBenchmarkTiming();
+
+  my_free(chunk.raw_data);
+  my_free(chunk.sparse_map);
+  fclose(tmp);
+
+  SetBytesProcessed(num_iterations * STREAM_CHUNKS * CHUNK_SIZE);
+}
+BENCHMARK(BM_xbstream_read)
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  MY_INIT(argv[0]);
+
+  crc_init();
+  xb_libgcrypt_init();
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return (RUN_ALL_TESTS());
+}
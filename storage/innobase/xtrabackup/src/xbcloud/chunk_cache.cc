@@ -0,0 +1,209 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Local cache of the objects downloaded by xbcloud get.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include "xbcloud/chunk_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "msg.h"
+#include "xbcloud/util.h"
+
+namespace xbcloud {
+
+bool Chunk_cache::init(const std::string &dir, uint64_t max_size) {
+  std::lock_guard<std::mutex> g(m);
+
+  this->dir = dir;
+  this->max_size = max_size;
+
+  if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+    msg_ts("Cannot create the cache directory %s: %s\n", dir.c_str(),
+           strerror(errno));
+    return false;
+  }
+
+  DIR *d = opendir(dir.c_str());
+  if (d == nullptr) {
+    msg_ts("Cannot open the cache directory %s: %s\n", dir.c_str(),
+           strerror(errno));
+    return false;
+  }
+
+  /* entries by time of last use, files of an interrupted put are removed */
+  struct Found {
+    time_t mtime;
+    std::string key;
+    uint64_t size;
+  };
+  std::vector<Found> found;
+  struct dirent *de;
+  while ((de = readdir(d)) != nullptr) {
+    std::string name(de->d_name);
+    if (name == "." || name == "..") continue;
+    struct stat st;
+    if (stat(path(name).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    if (name.find('.') != std::string::npos) {
+      unlink(path(name).c_str());
+      continue;
+    }
+    found.push_back(Found{st.st_mtime, name, uint64_t(st.st_size)});
+  }
+  closedir(d);
+
+  std::sort(found.begin(), found.end(), [](const Found &a, const Found &b) {
+    return a.mtime < b.mtime;
+  });
+  lru.clear();
+  entries.clear();
+  total = 0;
+  for (const auto &f : found) {
+    lru.push_front(f.key);
+    entries[f.key] = Entry{f.size, lru.begin()};
+    total += f.size;
+  }
+
+  evict();
+
+  return true;
+}
+
+bool Chunk_cache::get(const std::string &key, Http_buffer *contents) {
+  uint64_t size;
+  {
+    std::lock_guard<std::mutex> g(m);
+    auto it = entries.find(key);
+    if (it == entries.end()) return false;
+    size = it->second.size;
+    lru.splice(lru.begin(), lru, it->second.lru);
+  }
+
+  int fd = open(path(key).c_str(), O_RDONLY);
+  if (fd < 0) {
+    remove(key);
+    return false;
+  }
+
+  contents->clear();
+  contents->reserve(size);
+  char buf[64 * 1024];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    contents->append(buf, n);
+  }
+  close(fd);
+
+  if (n < 0 || contents->size() != size) {
+    contents->clear();
+    remove(key);
+    return false;
+  }
+
+  /* the modification time keeps the order of use for the next run */
+  utimensat(AT_FDCWD, path(key).c_str(), nullptr, 0);
+
+  return true;
+}
+
+void Chunk_cache::put(const std::string &key, const Http_buffer &contents) {
+  if (contents.size() > max_size) return;
+
+  {
+    std::lock_guard<std::mutex> g(m);
+    if (entries.count(key) > 0) return;
+  }
+
+  /* written aside and renamed, so that a reader never sees a partial file */
+  std::string tmp = path(key) + ".XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) {
+    msg_ts("Cannot create %s in the cache: %s\n", tmp.c_str(),
+           strerror(errno));
+    return;
+  }
+
+  size_t done = 0;
+  while (done < contents.size()) {
+    ssize_t n = write(fd, contents.begin() + done, contents.size() - done);
+    if (n <= 0) break;
+    done += n;
+  }
+  if (close(fd) != 0 || done != contents.size() ||
+      rename(tmp.c_str(), path(key).c_str()) != 0) {
+    msg_ts("Cannot write %s to the cache: %s\n", key.c_str(),
+           strerror(errno));
+    unlink(tmp.c_str());
+    return;
+  }
+
+  std::lock_guard<std::mutex> g(m);
+  if (entries.count(key) > 0) return;
+  lru.push_front(key);
+  entries[key] = Entry{contents.size(), lru.begin()};
+  total += contents.size();
+  evict();
+}
+
+void Chunk_cache::remove(const std::string &key) {
+  std::lock_guard<std::mutex> g(m);
+  auto it = entries.find(key);
+  if (it == entries.end()) return;
+  total -= it->second.size;
+  unlink(path(key).c_str());
+  lru.erase(it->second.lru);
+  entries.erase(it);
+}
+
+uint64_t Chunk_cache::size() const {
+  std::lock_guard<std::mutex> g(m);
+  return total;
+}
+
+std::string Chunk_cache::object_key(const std::string &container,
+                                    const std::string &object) {
+  return hex_encode(sha256(container + "/" + object));
+}
+
+std::string Chunk_cache::path(const std::string &key) const {
+  return dir + "/" + key;
+}
+
+void Chunk_cache::evict() {
+  while (total > max_size && !lru.empty()) {
+    const std::string &key = lru.back();
+    auto it = entries.find(key);
+    total -= it->second.size;
+    unlink(path(key).c_str());
+    entries.erase(it);
+    lru.pop_back();
+  }
+}
+
+}  // namespace xbcloud
@@ -0,0 +1,103 @@
+/******************************************************
+Copyright (c) 2026 Percona LLC and/or its affiliates.
+
+Local cache of the objects downloaded by xbcloud get.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef XBCLOUD_CHUNK_CACHE_H
+#define XBCLOUD_CHUNK_CACHE_H
+
+#include <stdint.h>
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "xbcloud/http.h"
+
+namespace xbcloud {
+
+/** Directory of the objects downloaded by get, by key, so that restoring
+the same files of a backup again reads them from the local disk. The least
+recently used objects are removed when the cache grows over its size. The
+entries are files named by their key, their modification time is the time of
+their last use, so that the order is kept from one run to the next. All
+methods may be called by several threads. */
+class Chunk_cache {
+ public:
+  /** Open the cache and find the objects already cached.
+  @param[in]  dir       cache directory, created if it does not exist
+  @param[in]  max_size  maximum bytes of the cached objects
+  @return false if the directory cannot be created or read */
+  bool init(const std::string &dir, uint64_t max_size);
+
+  /** Get a cached object.
+  @param[in]   key       key of the object
+  @param[out]  contents  contents of the object
+  @return false if the object is not cached or cannot be read */
+  bool get(const std::string &key, Http_buffer *contents);
+
+  /** Cache an object and remove the least recently used ones over the size
+  of the cache. Errors are reported and the object is not cached.
+  @param[in]  key       key of the object
+  @param[in]  contents  contents of the object */
+  void put(const std::string &key, const Http_buffer &contents);
+
+  /** Remove an object from the cache, when its contents are not valid.
+  @param[in]  key  key of the object */
+  void remove(const std::string &key);
+
+  /** @return bytes of the cached objects */
+  uint64_t size() const;
+
+  /** Key of an object of a container that is not content addressed. The
+  object must not be changed once uploaded, as the objects of a backup.
+  @param[in]  container  container
+  @param[in]  object     object name
+  @return key */
+  static std::string object_key(const std::string &container,
+                                const std::string &object);
+
+ private:
+  struct Entry {
+    uint64_t size;
+    std::list<std::string>::iterator lru;
+  };
+
+  /** Path of the file of an entry.
+  @param[in]  key  key of the entry
+  @return path */
+  std::string path(const std::string &key) const;
+
+  /** Remove the least recently used entries until the cache fits in its
+  size. The mutex must be held. */
+  void evict();
+
+  mutable std::mutex m;
+  std::string dir;
+  uint64_t max_size{0};
+  uint64_t total{0};
+
+  /** keys, most recently used first */
+  std::list<std::string> lru;
+  std::unordered_map<std::string, Entry> entries;
+};
+
+}  // namespace xbcloud
+
+#endif  // XBCLOUD_CHUNK_CACHE_H
@@ -0,0 +1,658 @@
+/******************************************************
+Copyright (c) 2023 Percona LLC and/or its affiliates.
+
+Google Cloud Storage JSON API client implementation.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+#include "xbcloud/gcs.h"
+#include "xbcloud/http.h"
+#include "xbcloud/util.h"
+
+#include <my_sys.h>
+
+#include "my_rapidjson_size_t.h"
+
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "common.h"
+#include "msg.h"
+
+namespace xbcloud {
+
+const std::string GCS_HOST = "storage.googleapis.com";
+const std::string GCS_METADATA_HOST = "metadata.google.internal";
+const std::string GCS_TOKEN_PATH =
+    "/computeMetadata/v1/instance/service-accounts/default/token";
+
+/** Get the message of an error response of the JSON API.
+@param[in]  resp  response
+@return error message, or the body of the response if it is not JSON */
+static std::string error_message(const Http_response &resp) {
+  std::string body(resp.body().begin(), resp.body().end());
+  rapidjson::Document doc;
+  doc.Parse(body.c_str());
+  if (doc.IsObject() && doc.HasMember("error") && doc["error"].IsObject() &&
+      doc["error"].HasMember("message") && doc["error"]["message"].IsString()) {
+    return doc["error"]["message"].GetString();
+  }
+  if (body.empty()) {
+    return "http error code " + std::to_string(resp.http_code());
+  }
+  return body;
+}
+
+bool Gcs_signer::refresh_token() {
+  Http_request req(Http_request::GET, Http_request::HTTP, GCS_METADATA_HOST,
+                   GCS_TOKEN_PATH);
+  req.add_header("Metadata-Flavor", "Google");
+
+  Http_response resp;
+  if (!http_client->make_request(req, resp) || !resp.ok()) {
+    msg_ts("%s: Failed to get an access token from the metadata server.\n",
+           my_progname);
+    return false;
+  }
+
+  std::string s(resp.body().begin(), resp.body().end());
+  rapidjson::Document doc;
+  doc.Parse(s.c_str());
+  if (!doc.IsObject() || !doc.HasMember("access_token") ||
+      !doc["access_token"].IsString()) {
+    msg_ts("%s: Metadata server response is missing access_token.\n",
+           my_progname);
+    return false;
+  }
+
+  access_token = doc["access_token"].GetString();
+  long expires_in = 300;
+  if (doc.HasMember("expires_in") && doc["expires_in"].IsInt()) {
+    expires_in = doc["expires_in"].GetInt();
+  }
+  expires = time(0) + expires_in;
+
+  return true;
+}
+
+void Gcs_signer::sign_request(const std::string &hostname,
+                              const std::string &bucket, Http_request &req,
+                              time_t t) {
+  std::lock_guard<std::mutex> lock(mutex);
+  /* refresh a minute before the token expires */
+  if (from_metadata && t + 60 >= expires) {
+    refresh_token();
+  }
+  req.add_header("Authorization", "Bearer " + access_token);
+}
+
+Gcs_client::Gcs_client(const Http_client *client, const std::string &endpoint,
+                       const std::string &access_token,
+                       const std::string &project, const std::string &region,
+                       const std::string &storage_class,
+                       const ulong max_retries, const ulong max_backoff)
+    : http_client(client),
+      protocol(Http_request::HTTPS),
+      host(GCS_HOST),
+      project(project),
+      region(region),
+      storage_class(storage_class),
+      max_retries(max_retries),
+      max_backoff(max_backoff) {
+  if (endpoint.find("https://") == 0) {
+    host = endpoint.substr(8);
+  } else if (endpoint.find("http://") == 0) {
+    protocol = Http_request::HTTP;
+    host = endpoint.substr(7);
+  } else if (!endpoint.empty()) {
+    host = endpoint;
+  }
+  rtrim_slashes(host);
+  signer = std::unique_ptr<Gcs_signer>(new Gcs_signer(client, access_token));
+}
+
+std::string Gcs_client::object_path(const std::string &bucket,
+                                    const std::string &name) {
+  /* the slashes of the object name are part of the name */
+  return "/storage/v1/b/" + uri_escape_string(bucket) + "/o/" +
+         uri_escape_string(name);
+}
+
+void Gcs_client::retry_error(Http_response *resp, bool *retry) {
+  if (resp->http_code() == 401) {
+    /* the token of the metadata server may have been revoked */
+    signer->expire_token();
+    *retry = true;
+  }
+}
+
+bool Gcs_client::delete_object(const std::string &bucket,
+                               const std::string &name) {
+  Http_request req(Http_request::DELETE, protocol, host, "/");
+  req.set_escaped_path(object_path(bucket, name));
+  signer->sign_request(host, bucket, req, time(0));
+
+  Http_response resp;
+  if (!http_client->make_request(req, resp)) {
+    return false;
+  }
+
+  if (resp.ok()) {
+    return true;
+  }
+
+  msg_ts("%s: Failed to delete object. Error message: %s\n", my_progname,
+         error_message(resp).c_str());
+
+  return false;
+}
+
+bool Gcs_client::async_delete_object(const std::string &bucket,
+                                     const std::string &name, Event_handler *h,
+                                     const async_delete_callback_t callback) {
+  Http_request *req =
+      new Http_request(Http_request::DELETE, protocol, host, "/");
+  if (req == nullptr) {
+    msg_ts("%s: Failed to delete object %s/%s. Out of memory.\n", my_progname,
+           bucket.c_str(), name.c_str());
+    return false;
+  }
+  req->set_escaped_path(object_path(bucket, name));
+  signer->sign_request(host, bucket, *req, time(0));
+
+  Http_response *resp = new Http_response();
+  if (resp == nullptr) {
+    msg_ts("%s: Failed to delete object %s/%s. Out of memory.\n", my_progname,
+           bucket.c_str(), name.c_str());
+    delete req;
+    return false;
+  }
+
+  auto f = [callback, bucket, name, req, resp](
+               CURLcode rc, const Http_connection *conn) mutable -> void {
+    if (rc == CURLE_OK && !resp->ok()) {
+      msg_ts("%s: Failed to delete object %s/%s. Error message: %s\n",
+             my_progname, bucket.c_str(), name.c_str(),
+             error_message(*resp).c_str());
+    }
+    if (callback) {
+      callback(rc == CURLE_OK && resp->ok());
+    }
+    delete req;
+    delete resp;
+  };
+
+  http_client->make_async_request(*req, *resp, h, f);
+
+  return true;
+}
+
+Http_buffer Gcs_client::download_object(const std::string &bucket,
+                                        const std::string &name,
+                                        bool &success) {
+  Http_request req(Http_request::GET, protocol, host, "/");
+  req.set_escaped_path(object_path(bucket, name));
+  req.add_param("alt", "media");
+  signer->sign_request(host, bucket, req, time(0));
+
+  Http_response resp;
+  if (!http_client->make_request(req, resp)) {
+    success = false;
+    return Http_buffer();
+  }
+
+  if (!resp.ok()) {
+    success = false;
+    return Http_buffer();
+  }
+
+  success = true;
+  return resp.move_body();
+}
+
+bool Gcs_client::create_bucket(const std::string &name) {
+  if (project.empty()) {
+    msg_ts("%s: Failed to create bucket. Google project is not specified.\n",
+           my_progname);
+    return false;
+  }
+
+  Http_request req(Http_request::POST, protocol, host, "/storage/v1/b");
+  req.add_param("project", project);
+
+  rapidjson::StringBuffer body;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(body);
+  writer.StartObject();
+  writer.Key("name");
+  writer.String(name.c_str());
+  if (!region.empty()) {
+    writer.Key("location");
+    writer.String(region.c_str());
+  }
+  if (!storage_class.empty()) {
+    writer.Key("storageClass");
+    writer.String(storage_class.c_str());
+  }
+  writer.EndObject();
+
+  req.add_header("Content-Type", "application/json");
+  req.append_payload(body.GetString());
+  signer->sign_request(host, name, req, time(0));
+
+  Http_response resp;
+  if (!http_client->make_request(req, resp)) {
+    return false;
+  }
+
+  if (resp.ok()) {
+    return true;
+  }
+
+  msg_ts("%s: Failed to create bucket. Error message: %s\n", my_progname,
+         error_message(resp).c_str());
+
+  return false;
+}
+
+bool Gcs_client::bucket_exists(const std::string &name, bool &exists) {
+  Http_request req(Http_request::GET, protocol, host, "/storage/v1/b/" + name);
+  req.add_param("fields", "name");
+  signer->sign_request(host, name, req, time(0));
+
+  Http_response resp;
+  if (!http_client->make_request(req, resp)) {
+    return false;
+  }
+
+  if (resp.ok()) {
+    exists = true;
+    return true;
+  }
+
+  if (resp.http_code() == 404) {
+    exists = false;
+    return true;
+  }
+
+  msg_ts("%s: Failed to check bucket. Error message: %s\n", my_progname,
+         error_message(resp).c_str());
+
+  return false;
+}
+
+bool Gcs_client::upload_object(const std::string &bucket,
+                               const std::string &name,
+                               const Http_buffer &contents) {
+  Http_request req(Http_request::POST, protocol, host,
+                   "/upload/storage/v1/b/" + bucket + "/o");
+  req.add_param("uploadType", "media");
+  req.add_param("name", name);
+  req.add_header("Content-Type", "application/octet-stream");
+  req.append_payload(contents);
+  signer->sign_request(host, bucket, req, time(0));
+
+  Http_response resp;
+  if (!http_client->make_request(req, resp)) {
+    return false;
+  }
+
+  if (resp.ok()) {
+    return true;
+  }
+
+  msg_ts("%s: Failed to upload object. Error message: %s\n", my_progname,
+         error_message(resp).c_str());
+
+  return false;
+}
+
+void Gcs_client::upload_callback(
+    Gcs_client *client, std::string container, std::string name,
+    Http_request *req, Http_response *resp, const Http_client *http_client,
+    Event_handler *h, Gcs_client::async_upload_callback_t callback,
+    CURLcode rc, const Http_connection *conn, ulong count) {
+  http_client->callback(client, container, name, req, resp, http_client, h,
+                        callback, rc, conn, count);
+}
+
+/* state of a resumable upload, from the request creating the upload session
+to the last request storing the object */
+struct Gcs_client::resumable_upload_t {
+  std::string bucket;
+  std::string name;
+  Http_buffer contents;
+  Http_request::headers_t extra_http_headers;
+  /* path and query string of the upload session */
+  std::string session;
+  /* bytes stored by the server */
+  size_t offset{0};
+  ulong count{1};
+  Event_handler *h;
+  async_upload_callback_t callback;
+};
+
+void Gcs_client::resumable_done(resumable_upload_t *upload, bool success) {
+  if (upload->callback) {
+    upload->callback(success, Http_buffer());
+  }
+  delete upload;
+}
+
+void Gcs_client::resumable_retry(resumable_upload_t *upload, CURLcode rc,
+                                 long http_code) {
+  bool retry = rc != CURLE_OK ? http_client->retriable_curl_error(rc)
+                              : (http_client->retriable_http_error(http_code) ||
+                                 http_code == 429 || http_code == 401);
+  if (rc == CURLE_OK && http_code == 401) signer->expire_token();
+  if (!retry || upload->count > max_retries) {
+    if (retry) {
+      msg_ts("%s: No more retries for %s\n", my_progname,
+             upload->name.c_str());
+    }
+    msg_ts("%s: Failed to upload object %s/%s. Error: %s\n", my_progname,
+           upload->bucket.c_str(), upload->name.c_str(),
+           rc != CURLE_OK ? curl_easy_strerror(rc)
+                          : ("http error code " + std::to_string(http_code))
+                                .c_str());
+    resumable_done(upload, false);
+    return;
+  }
+
+  ulong delay = get_exponential_backoff(upload->count, max_backoff);
+  msg_ts("%s: Sleeping for %lu ms before resuming %s [%lu]\n", my_progname,
+         delay, upload->name.c_str(), upload->count);
+  std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+  upload->count++;
+
+  if (upload->session.empty()) {
+    resumable_start(upload);
+  } else {
+    /* ask how much of the object the server has */
+    resumable_query(upload);
+  }
+}
+
+void Gcs_client::resumable_start(resumable_upload_t *upload) {
+  Http_request *req =
+      new Http_request(Http_request::POST, protocol, host,
+                       "/upload/storage/v1/b/" + upload->bucket + "/o");
+  Http_response *resp = new Http_response();
+  req->add_param("uploadType", "resumable");
+  req->add_param("name", upload->name);
+  for (const auto &h : upload->extra_http_headers) {
+    req->add_header(h.first, h.second);
+  }
+  req->add_header("X-Upload-Content-Type", "application/octet-stream");
+  req->add_header("X-Upload-Content-Length",
+                  std::to_string(upload->contents.size()));
+  req->add_header("Content-Type", "application/json; charset=UTF-8");
+  req->append_payload("{}");
+  signer->sign_request(host, upload->bucket, *req, time(0));
+
+  auto f = [this, upload, req, resp](CURLcode rc,
+                                     const Http_connection *conn) -> void {
+    long http_code = resp->http_code();
+    auto location = resp->headers().find("location");
+    bool ok = rc == CURLE_OK && resp->ok() && location != resp->headers().end();
+    if (ok) {
+      /* the session URL is on the same host */
+      std::string url = location->second;
+      auto pos = url.find("://");
+      pos = url.find('/', pos == std::string::npos ? 0 : pos + 3);
+      upload->session = pos == std::string::npos ? "/" : url.substr(pos);
+      upload->offset = 0;
+    }
+    delete req;
+    delete resp;
+    if (ok) {
+      resumable_put(upload);
+    } else {
+      resumable_retry(upload, rc, http_code);
+    }
+  };
+
+  http_client->make_async_request(*req, *resp, upload->h, f, true);
+}
+
+void Gcs_client::resumable_put(resumable_upload_t *upload) {
+  const size_t size = upload->contents.size();
+  Http_request *req = new Http_request(Http_request::PUT, protocol, host, "/");
+  Http_response *resp = new Http_response();
+  req->set_escaped_path(upload->session);
+  if (upload->offset < size) {
+    req->add_header("Content-Range", "bytes " +
+                                         std::to_string(upload->offset) + "-" +
+                                         std::to_string(size - 1) + "/" +
+                                         std::to_string(size));
+    req->append_payload(&upload->contents[upload->offset],
+                        size - upload->offset);
+  } else {
+    req->add_header("Content-Range", "bytes */" + std::to_string(size));
+  }
+  signer->sign_request(host, upload->bucket, *req, time(0));
+
+  auto f = [this, upload, req, resp](CURLcode rc,
+                                     const Http_connection *conn) -> void {
+    long http_code = resp->http_code();
+    bool ok = rc == CURLE_OK && resp->ok();
+    delete req;
+    delete resp;
+    if (ok) {
+      resumable_done(upload, true);
+    } else if (rc == CURLE_OK && (http_code == 404 || http_code == 410)) {
+      /* the session has expired, start again */
+      upload->session.clear();
+      resumable_retry(upload, CURLE_OK, 503);
+    } else {
+      resumable_retry(upload, rc, http_code);
+    }
+  };
+
+  http_client->make_async_request(*req, *resp, upload->h, f, true);
+}
+
+void Gcs_client::resumable_query(resumable_upload_t *upload) {
+  const size_t size = upload->contents.size();
+  Http_request *req = new Http_request(Http_request::PUT, protocol, host, "/");
+  Http_response *resp = new Http_response();
+  req->set_escaped_path(upload->session);
+  req->add_header("Content-Range", "bytes */" + std::to_string(size));
+  signer->sign_request(host, upload->bucket, *req, time(0));
+
+  auto f = [this, upload, req, resp](CURLcode rc,
+                                     const Http_connection *conn) -> void {
+    long http_code = resp->http_code();
+    bool ok = rc == CURLE_OK && resp->ok();
+    bool incomplete = rc == CURLE_OK && http_code == 308;
+    if (incomplete) {
+      /* "bytes=0-N" when N + 1 bytes are stored, none without the header */
+      upload->offset = 0;
+      auto range = resp->headers().find("range");
+      if (range != resp->headers().end()) {
+        auto pos = range->second.find('-');
+        if (pos != std::string::npos) {
+          upload->offset = atoll(range->second.c_str() + pos + 1) + 1;
+        }
+      }
+    }
+    delete req;
+    delete resp;
+    if (ok) {
+      resumable_done(upload, true);
+    } else if (incomplete) {
+      resumable_put(upload);
+    } else if (rc == CURLE_OK && (http_code == 404 || http_code == 410)) {
+      upload->session.clear();
+      resumable_retry(upload, CURLE_OK, 503);
+    } else {
+      resumable_retry(upload, rc, http_code);
+    }
+  };
+
+  http_client->make_async_request(*req, *resp, upload->h, f, true);
+}
+
+bool Gcs_client::async_upload_object(
+    const std::string &bucket, const std::string &name,
+    const Http_buffer &contents, Event_handler *h,
+    async_upload_callback_t callback,
+    const Http_request::headers_t &extra_http_headers) {
+  if (contents.size() >= resumable_threshold) {
+    resumable_upload_t *upload = new resumable_upload_t();
+    upload->bucket = bucket;
+    upload->name = name;
+    upload->contents.append(contents);
+    upload->extra_http_headers = extra_http_headers;
+    upload->h = h;
+    upload->callback = callback;
+    resumable_start(upload);
+    return true;
+  }
+
+  Http_request *req =
+      new Http_request(Http_request::POST, protocol, host,
+                       "/upload/storage/v1/b/" + bucket + "/o");
+  if (req == nullptr) {
+    msg_ts("%s: Failed to upload object %s/%s. Out of memory.\n", my_progname,
+           bucket.c_str(), name.c_str());
+    return false;
+  }
+  req->add_param("uploadType", "media");
+  req->add_param("name", name);
+  req->add_header("Content-Type", "application/octet-stream");
+  for (const auto &h : extra_http_headers) {
+    req->add_header(h.first, h.second);
+  }
+  req->append_payload(contents);
+  signer->sign_request(host, bucket, *req, time(0));
+
+  Http_response *resp = new Http_response();
+  if (resp == nullptr) {
+    msg_ts("%s: Failed to upload object %s/%s. Out of memory.\n", my_progname,
+           bucket.c_str(), name.c_str());
+    delete req;
+    return false;
+  }
+
+  http_client->make_async_request(
+      *req, *resp, h,
+      std::bind(Gcs_client::upload_callback, this, bucket, name, req, resp,
+                http_client, h, callback, std::placeholders::_1,
+                std::placeholders::_2, 1));
+
+  return true;
+}
+
+void Gcs_client::download_callback(
+    Gcs_client *client, std::string container, std::string name,
+    Http_request *req, Http_response *resp, const Http_client *http_client,
+    Event_handler *h, Gcs_client::async_download_callback_t callback,
+    CURLcode rc, const Http_connection *conn, ulong count) {
+  http_client->callback(client, container, name, req, resp, http_client, h,
+                        callback, rc, conn, count);
+}
+
+bool Gcs_client::async_download_object(
+    const std::string &bucket, const std::string &name, Event_handler *h,
+    async_download_callback_t callback,
+    const Http_request::headers_t &extra_http_headers) {
+  Http_request *req = new Http_request(Http_request::GET, protocol, host, "/");
+  if (req == nullptr) {
+    msg_ts("%s: Failed to download object %s/%s. Out of memory.\n", my_progname,
+           bucket.c_str(), name.c_str());
+    return false;
+  }
+  req->set_escaped_path(object_path(bucket, name));
+  req->add_param("alt", "media");
+  for (const auto &h : extra_http_headers) {
+    req->add_header(h.first, h.second);
+  }
+  signer->sign_request(host, bucket, *req, time(0));
+
+  Http_response *resp = new Http_response();
+  if (resp == nullptr) {
+    msg_ts("%s: Failed to download object %s/%s. Out of memory.\n", my_progname,
+           bucket.c_str(), name.c_str());
+    delete req;
+    return false;
+  }
+
+  http_client->make_async_request(
+      *req, *resp, h,
+      std::bind(Gcs_client::download_callback, this, bucket, name, req, resp,
+                http_client, h, callback, std::placeholders::_1,
+                std::placeholders::_2, 1));
+
+  return true;
+}
+
+bool Gcs_client::list_objects_with_prefix(const std::string &bucket,
+                                          const std::string &prefix,
+                                          std::vector<std::string> &objects) {
+  std::string page_token;
+
+  while (true) {
+    Http_request req(Http_request::GET, protocol, host,
+                     "/storage/v1/b/" + bucket + "/o");
+    req.add_param("prefix", prefix);
+    req.add_param("fields", "items(name),nextPageToken");
+    if (!page_token.empty()) {
+      req.add_param("pageToken", page_token);
+    }
+    signer->sign_request(host, bucket, req, time(0));
+
+    Http_response resp;
+    if (!http_client->make_request(req, resp)) {
+      return false;
+    }
+
+    if (!resp.ok()) {
+      msg_ts("%s: Failed to list objects. Error message: %s\n", my_progname,
+             error_message(resp).c_str());
+      return false;
+    }
+
+    std::string s(resp.body().begin(), resp.body().end());
+    rapidjson::Document doc;
+    doc.Parse(s.c_str());
+    if (!doc.IsObject()) {
+      msg_ts("%s: Failed to parse list objects response.\n", my_progname);
+      return false;
+    }
+
+    if (doc.HasMember("items") && doc["items"].IsArray()) {
+      for (const auto &item : doc["items"].GetArray()) {
+        if (!item.IsObject() || !item.HasMember("name") ||
+            !item["name"].IsString()) {
+          msg_ts("%s: Failed to parse list objects response. Cannot find "
+                 "object name.\n",
+                 my_progname);
+          return false;
+        }
+        objects.push_back(item["name"].GetString());
+      }
+    }
+
+    if (!doc.HasMember("nextPageToken") || !doc["nextPageToken"].IsString()) {
+      break;
+    }
+    page_token = doc["nextPageToken"].GetString();
+  }
+
+  return true;
+}
+
+}  // namespace xbcloud
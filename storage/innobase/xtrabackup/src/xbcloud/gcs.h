@@ -0,0 +1,236 @@
+/******************************************************
+Copyright (c) 2023 Percona LLC and/or its affiliates.
+
+Google Cloud Storage JSON API client implementation.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef __XBCLOUD_GCS_H__
+#define __XBCLOUD_GCS_H__
+
+#include <mutex>
+#include "object_store.h"
+#include "xbcloud/http.h"
+#include "xbcloud/util.h"
+
+#include <time.h>
+namespace xbcloud {
+
+/* Adds the OAuth2 access token to the requests. Without a token given by
+the user, the token of the default service account is fetched from the
+metadata server of the instance and refreshed before it expires. */
+class Gcs_signer {
+ private:
+  const Http_client *http_client;
+  std::mutex mutex;
+  std::string access_token;
+  time_t expires{0};
+  bool from_metadata;
+
+ public:
+  Gcs_signer(const Http_client *client, const std::string &token)
+      : http_client(client),
+        access_token(token),
+        from_metadata(token.empty()) {}
+
+  /** Fetch a new token from the metadata server.
+  @return true in case of success or false otherwise */
+  bool refresh_token();
+
+  /** Forget the token so that the next request fetches a new one. */
+  void expire_token() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (from_metadata) expires = 0;
+  }
+
+  void sign_request(const std::string &hostname, const std::string &bucket,
+                    Http_request &req, time_t t);
+};
+
+class Gcs_client {
+ public:
+  using async_upload_callback_t =
+      std::function<void(bool, const Http_buffer &)>;
+  using async_download_callback_t =
+      std::function<void(bool, const Http_buffer &)>;
+  using async_delete_callback_t = std::function<void(bool)>;
+
+  /* objects from this size are uploaded with a resumable upload, which
+  resumes from the last byte stored instead of restarting after an error */
+  static const size_t resumable_threshold = 8 * 1024 * 1024;
+
+  std::unique_ptr<Gcs_signer> signer;
+
+ private:
+  struct resumable_upload_t;
+
+  const Http_client *http_client;
+
+  Http_request::protocol_t protocol;
+  std::string host;
+  std::string project;
+  std::string region;
+  std::string storage_class;
+
+  ulong max_retries;
+  ulong max_backoff;
+
+  static std::string object_path(const std::string &bucket,
+                                 const std::string &name);
+
+  static void upload_callback(Gcs_client *client, std::string container,
+                              std::string name, Http_request *req,
+                              Http_response *resp,
+                              const Http_client *http_client, Event_handler *h,
+                              Gcs_client::async_upload_callback_t callback,
+                              CURLcode rc, const Http_connection *conn,
+                              ulong count);
+
+  static void download_callback(
+      Gcs_client *client, std::string container, std::string name,
+      Http_request *req, Http_response *resp, const Http_client *http_client,
+      Event_handler *h, Gcs_client::async_download_callback_t callback,
+      CURLcode rc, const Http_connection *conn, ulong count);
+
+  void resumable_start(resumable_upload_t *upload);
+  void resumable_put(resumable_upload_t *upload);
+  void resumable_query(resumable_upload_t *upload);
+  void resumable_retry(resumable_upload_t *upload, CURLcode rc,
+                       long http_code);
+  static void resumable_done(resumable_upload_t *upload, bool success);
+
+ public:
+  Gcs_client(const Http_client *client, const std::string &endpoint,
+             const std::string &access_token, const std::string &project,
+             const std::string &region, const std::string &storage_class,
+             const ulong max_retries, const ulong max_backoff);
+
+  bool delete_object(const std::string &bucket, const std::string &name);
+
+  Http_buffer download_object(const std::string &bucket,
+                              const std::string &name, bool &success);
+
+  bool create_bucket(const std::string &name);
+
+  bool bucket_exists(const std::string &name, bool &exists);
+
+  bool upload_object(const std::string &bucket, const std::string &name,
+                     const Http_buffer &contents);
+
+  bool async_upload_object(
+      const std::string &bucket, const std::string &name,
+      const Http_buffer &contents, Event_handler *h,
+      async_upload_callback_t callback = {},
+      const Http_request::headers_t &extra_http_headers = {});
+
+  bool async_download_object(
+      const std::string &bucket, const std::string &name, Event_handler *h,
+      async_download_callback_t callback = {},
+      const Http_request::headers_t &extra_http_headers = {});
+
+  bool async_delete_object(const std::string &bucket, const std::string &name,
+                           Event_handler *h,
+                           const async_delete_callback_t callback);
+
+  bool list_objects_with_prefix(const std::string &bucket,
+                                const std::string &prefix,
+                                std::vector<std::string> &objects);
+
+  ulong get_max_retries() { return max_retries; }
+
+  ulong get_max_backoff() { return max_backoff; }
+
+  void retry_error(Http_response *resp, bool *retry);
+
+  std::string hostname(const std::string &not_used) const { return host; }
+};
+
+class Gcs_object_store : public Object_store {
+ private:
+  Gcs_client gcs_client;
+  Http_request::headers_t extra_http_headers;
+
+ public:
+  Gcs_object_store(const Http_client *client, const std::string &endpoint,
+                   const std::string &access_token, const std::string &project,
+                   const std::string &region, const std::string &storage_class,
+                   const ulong max_retries, const ulong max_backoff)
+      : gcs_client{client, endpoint,      access_token, project,
+                   region, storage_class, max_retries,  max_backoff} {}
+  void set_extra_http_headers(const Http_request::headers_t &headers) {
+    extra_http_headers = headers;
+  }
+  virtual bool create_container(const std::string &name) override {
+    return gcs_client.create_bucket(name);
+  }
+  virtual bool container_exists(const std::string &name,
+                                bool &exists) override {
+    return gcs_client.bucket_exists(name, exists);
+  }
+  virtual bool list_objects_in_directory(
+      const std::string &container, const std::string &directory,
+      std::vector<std::string> &objects) override {
+    return gcs_client.list_objects_with_prefix(container, directory + "/",
+                                               objects);
+  }
+  virtual bool upload_object(const std::string &container,
+                             const std::string &object,
+                             const Http_buffer &contents) override {
+    return gcs_client.upload_object(container, object, contents);
+  }
+  virtual bool async_upload_object(
+      const std::string &container, const std::string &object,
+      const Http_buffer &contents, Event_handler *h,
+      std::function<void(bool, const Http_buffer &contents)> f = {}) override {
+    return gcs_client.async_upload_object(
+        container, object, contents, h,
+        [f](bool success, const Http_buffer &contents) {
+          if (f) f(success, contents);
+        },
+        extra_http_headers);
+  }
+  virtual bool async_download_object(
+      const std::string &container, const std::string &object, Event_handler *h,
+      const std::function<void(bool, const Http_buffer &contents)> f = {})
+      override {
+    return gcs_client.async_download_object(
+        container, object, h,
+        [f](bool success, const Http_buffer &contents) {
+          if (f) f(success, contents);
+        },
+        extra_http_headers);
+  }
+  virtual bool async_delete_object(const std::string &container,
+                                   const std::string &object, Event_handler *h,
+                                   std::function<void(bool)> f = {}) override {
+    return gcs_client.async_delete_object(container, object, h,
+                                          [f](bool success) {
+                                            if (f) f(success);
+                                          });
+  }
+  virtual bool delete_object(const std::string &container,
+                             const std::string &name) override {
+    return gcs_client.delete_object(container, name);
+  }
+  virtual Http_buffer download_object(const std::string &container,
+                                      const std::string &name,
+                                      bool &success) override {
+    return gcs_client.download_object(container, name, success);
+  }
+};
+}  // namespace xbcloud
+
+#endif
@@ -19,6 +19,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 *******************************************************/
 
 #include <gcrypt.h>
+#include <algorithm>
 #include <vector>
 
 namespace xbcloud {
@@ -51,6 +52,34 @@ std::vector<unsigned char> sha256(const T &s) {
   return md;
 }
 
+/** Compute MD5 and SHA256 of the same data in one pass. The data is fed to
+both digests block by block so that it is read from memory only once.
+@param[in]   s       data
+@param[out]  md5     MD5, or nullptr if not needed
+@param[out]  sha256  SHA256, or nullptr if not needed */
+template <typename T>
+void md5_sha256(const T &s, std::vector<unsigned char> *md5,
+                std::vector<unsigned char> *sha256) {
+  const size_t block_size = 64 * 1024;
+
+  gcry_md_hd_t h;
+  gcry_md_open(&h, 0, GCRY_MD_FLAG_SECURE);
+  if (md5 != nullptr) gcry_md_enable(h, GCRY_MD_MD5);
+  if (sha256 != nullptr) gcry_md_enable(h, GCRY_MD_SHA256);
+  for (size_t pos = 0; pos < s.size(); pos += block_size) {
+    gcry_md_write(h, &s[pos], std::min(block_size, s.size() - pos));
+  }
+  if (md5 != nullptr) {
+    md5->resize(gcry_md_get_algo_dlen(GCRY_MD_MD5));
+    memcpy(&(*md5)[0], gcry_md_read(h, GCRY_MD_MD5), md5->size());
+  }
+  if (sha256 != nullptr) {
+    sha256->resize(gcry_md_get_algo_dlen(GCRY_MD_SHA256));
+    memcpy(&(*sha256)[0], gcry_md_read(h, GCRY_MD_SHA256), sha256->size());
+  }
+  gcry_md_close(h);
+}
+
 template <typename K, typename D>
 std::vector<unsigned char> hmac_sha256(const K &key, const D &data) {
   unsigned int len = gcry_md_get_algo_dlen(GCRY_MD_SHA256);
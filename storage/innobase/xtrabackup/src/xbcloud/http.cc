@@ -30,12 +30,59 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <iostream>
 #include "azure.h"
 #include "common.h"
+#include "gcs.h"
 #include "msg.h"
 #include "s3.h"
 #include "swift.h"
 
 namespace xbcloud {
 
+/* smaller buffers are left to malloc */
+static constexpr size_t BUFFER_POOL_MIN_SIZE = 64 * 1024;
+/* memory kept in the pool when it is idle */
+static constexpr size_t BUFFER_POOL_MAX_SIZE = 64 * 1024 * 1024;
+
+static std::mutex buffer_pool_mutex;
+static std::vector<std::pair<char *, size_t>> buffer_pool;
+static size_t buffer_pool_size = 0;
+
+char *Http_buffer::pool_acquire(size_t n, size_t *len) {
+  if (n >= BUFFER_POOL_MIN_SIZE) {
+    std::lock_guard<std::mutex> guard(buffer_pool_mutex);
+    /* the smallest buffer large enough */
+    auto best = buffer_pool.end();
+    for (auto it = buffer_pool.begin(); it != buffer_pool.end(); ++it) {
+      if (it->second >= n &&
+          (best == buffer_pool.end() || it->second < best->second)) {
+        best = it;
+      }
+    }
+    if (best != buffer_pool.end()) {
+      char *b = best->first;
+      *len = best->second;
+      buffer_pool_size -= best->second;
+      *best = buffer_pool.back();
+      buffer_pool.pop_back();
+      return b;
+    }
+  }
+  *len = n;
+  return static_cast<char *>(my_malloc(PSI_NOT_INSTRUMENTED, n, MYF(MY_FAE)));
+}
+
+void Http_buffer::pool_release(char *b, size_t len) {
+  if (b == nullptr) return;
+  if (len >= BUFFER_POOL_MIN_SIZE) {
+    std::lock_guard<std::mutex> guard(buffer_pool_mutex);
+    if (buffer_pool_size + len <= BUFFER_POOL_MAX_SIZE) {
+      buffer_pool.emplace_back(b, len);
+      buffer_pool_size += len;
+      return;
+    }
+  }
+  my_free(b);
+}
+
 class Global_curl {
  private:
   CURL *curl{nullptr};
@@ -254,21 +301,46 @@ void Event_handler::check_multi_info() {
       char *url = nullptr;
       auto rc = curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &conn);
       assert(rc == CURLE_OK);
+      long http_code = 0;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &http_code);
+      adapt_concurrency(http_code);
       rc = curl_easy_getinfo(msg->easy_handle, CURLINFO_EFFECTIVE_URL, &url);
       if (rc == CURLE_OK) {
         TRACE("DONE: %s => (%d) %s\n", url, msg->data.result, conn->error());
       }
       conn->finalize(msg->data.result);
       curl_multi_remove_handle(curl_multi, msg->easy_handle);
+      release_curl_easy(conn->release_curl());
       delete conn;
       n_queued--;
     }
   }
-  if (n_queued < max_requests) {
+  if (n_queued < concurrency) {
     process_queue();
   }
 }
 
+void Event_handler::adapt_concurrency(long http_code) {
+  if (max_concurrency == max_requests) return;
+  if (n_before_cut > 0) n_before_cut--;
+  if (http_code == 503 || http_code == 429) {
+    /* SlowDown, cut once for all the requests already sent */
+    if (n_before_cut == 0 && concurrency > 1) {
+      concurrency = std::max<size_t>(concurrency / 2, 1);
+      n_before_cut = n_queued;
+      n_succeeded = 0;
+      msg_ts("%s: Throttled by the server, lowering concurrency to %zu\n",
+             my_progname, concurrency.load());
+    }
+    return;
+  }
+  if (http_code < 200 || http_code >= 300) return;
+  if (++n_succeeded >= concurrency && concurrency < max_concurrency) {
+    concurrency++;
+    n_succeeded = 0;
+  }
+}
+
 void Event_handler::ev_socket_callback(EV_P_ struct ev_io *io, int events) {
   int action = (events & (int)EV_READ ? (int)CURL_CSELECT_IN : 0) |
                (events & (int)EV_WRITE ? (int)CURL_CSELECT_OUT : 0);
@@ -326,7 +398,7 @@ void Event_handler::ev_queue_callback(EV_P_ ev_async *ev, int revents) {
 void Event_handler::process_queue() {
   std::lock_guard<std::mutex> guard(queue_mutex);
 
-  while (!queue.empty() && n_queued < max_requests) {
+  while (!queue.empty() && n_queued < concurrency) {
     auto conn = queue.front();
     TRACE("Adding easy %p to multi %p\n", conn->curl_easy(), conn);
     n_queued++;
@@ -367,6 +439,15 @@ bool Event_handler::init() {
                     Event_handler::multi_timer_callback);
   curl_multi_setopt(curl_multi, CURLMOPT_TIMERDATA, this);
 
+  /* keep one connection per request in flight to each endpoint and let
+  HTTP/2 capable endpoints multiplex the requests over them */
+  curl_multi_setopt(curl_multi, CURLMOPT_MAXCONNECTS, (long)max_concurrency);
+  curl_multi_setopt(curl_multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                    (long)max_concurrency);
+#ifdef CURLPIPE_MULTIPLEX
+  curl_multi_setopt(curl_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
   return true;
 }
 
@@ -388,7 +469,7 @@ std::thread Event_handler::run() {
 void Event_handler::add_connection(Http_connection *conn, bool nowait) {
   while (true) {
     queue_mutex.lock();
-    if (nowait || queue.size() < max_requests + 4) {
+    if (nowait || queue.size() < concurrency + 4) {
       queue.push(conn);
       queue_mutex.unlock();
       ev_async_send(loop, &queue_event);
@@ -417,6 +498,46 @@ void Event_handler::stop() {
   }
 }
 
+curl_easy_unique_ptr Event_handler::acquire_curl_easy() {
+  {
+    std::lock_guard<std::mutex> guard(curl_pool_mutex);
+    if (!curl_pool.empty()) {
+      auto curl = std::move(curl_pool.back());
+      curl_pool.pop_back();
+      return curl;
+    }
+  }
+  return make_curl_easy();
+}
+
+void Event_handler::release_curl_easy(curl_easy_unique_ptr curl) {
+  if (!curl) return;
+  /* keeps the connection, DNS and TLS session caches of the handle */
+  curl_easy_reset(curl.get());
+  std::lock_guard<std::mutex> guard(curl_pool_mutex);
+  if (curl_pool.size() < max_concurrency) {
+    curl_pool.push_back(std::move(curl));
+  }
+}
+
+void Event_handler::reserve_memory(size_t bytes) {
+  std::unique_lock<std::mutex> lock(memory_mutex);
+  memory_released.wait(lock, [this, bytes] {
+    return max_memory == 0 || memory == 0 || memory + bytes <= max_memory;
+  });
+  memory += bytes;
+  peak_memory_ = std::max(peak_memory_, memory);
+}
+
+void Event_handler::release_memory(size_t bytes) {
+  {
+    std::lock_guard<std::mutex> guard(memory_mutex);
+    assert(memory >= bytes);
+    memory -= bytes;
+  }
+  memory_released.notify_all();
+}
+
 bool Http_client::retriable_curl_error(const CURLcode &rc) const {
   for (std::vector<CURLcode>::const_iterator it = curl_retriable_errors.begin();
        it != curl_retriable_errors.end(); ++it) {
@@ -481,13 +602,21 @@ void Http_client::setup_request(
   curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
   if (request.method() == Http_request::POST) {
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, &request.payload()[0]);
+    /* curl reads the body from stdin when POSTFIELDS is NULL */
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.payload().size() > 0
+                                                   ? &request.payload()[0]
+                                                   : "");
     curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
                      (long)request.payload().size());
   }
 
   curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
 
+#ifdef CURL_HTTP_VERSION_2TLS
+  /* negotiated with ALPN, falls back to HTTP/1.1 */
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif
+
   curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,
                    Http_response::header_appender);
 
@@ -576,7 +705,7 @@ bool Http_client::make_async_request(const Http_request &request,
                                      bool nowait) const {
   curl_slist *headers = nullptr;
 
-  auto curl = make_curl_easy();
+  auto curl = h->acquire_curl_easy();
   if (!curl) {
     msg("error: cannot initialize curl handler\n");
     return false;
@@ -677,4 +806,11 @@ Http_client::callback<Azure_client, Azure_client::async_download_callback_t>(
     Http_request *req, Http_response *resp, const Http_client *http_client,
     Event_handler *h, Azure_client::async_download_callback_t callback,
     CURLcode rc, const Http_connection *conn, ulong count) const;
+
+template void
+Http_client::callback<Gcs_client, Gcs_client::async_download_callback_t>(
+    Gcs_client *client, std::string container, std::string name,
+    Http_request *req, Http_response *resp, const Http_client *http_client,
+    Event_handler *h, Gcs_client::async_download_callback_t callback,
+    CURLcode rc, const Http_connection *conn, ulong count) const;
 }  // namespace xbcloud
@@ -24,6 +24,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <curl/curl.h>
 #include <ev.h>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <map>
 #include <memory>
@@ -61,6 +63,19 @@ class Http_buffer {
   mutable std::vector<unsigned char> md5_;
   mutable std::vector<unsigned char> sha256_;
 
+  /** Get a buffer kept by pool_release() or allocate one.
+  @param[in]   n    bytes needed
+  @param[out]  len  size of the buffer, at least n
+  @return buffer to free with pool_release() */
+  static char *pool_acquire(size_t n, size_t *len);
+
+  /** Keep a large buffer for the next pool_acquire() or free it. Downloads
+  and objects of the same size come and go at a high rate, and every large
+  allocation would be mapped and faulted in again.
+  @param[in]  b    buffer allocated with my_malloc()
+  @param[in]  len  size of the buffer */
+  static void pool_release(char *b, size_t len);
+
  public:
   using iterator = char *;
   using const_iterator = const char *;
@@ -69,6 +84,8 @@ class Http_buffer {
   Http_buffer(const Http_buffer &) = delete;
   Http_buffer(Http_buffer &&other) { *this = std::move(other); }
   Http_buffer &operator=(Http_buffer &&other) {
+    if (this == &other) return *this;
+    pool_release(buf, buflen);
     buf = other.buf;
     buflen = other.buflen;
     length = other.length;
@@ -78,10 +95,12 @@ class Http_buffer {
     other.length = other.buflen = 0;
     return *this;
   }
-  ~Http_buffer() { my_free(buf); }
+  ~Http_buffer() { pool_release(buf, buflen); }
 
   void append(const char *b, size_t n) {
-    reserve(size() + n);
+    /* grow geometrically, a body received or built piece by piece is not
+    copied again on every append */
+    if (buflen < size() + n) reserve(std::max(size() + n, buflen * 2));
     memcpy(buf + length, b, n);
     length += n;
     if (!md5_.empty()) md5_.clear();
@@ -90,7 +109,15 @@ class Http_buffer {
   void append(const std::string &s) { append(s.c_str(), s.size()); }
   void append(const char *s) { append(s, strlen(s)); }
   void append(const std::vector<char> &v) { append(&v[0], v.size()); }
-  void append(const Http_buffer &b) { append(b.begin(), b.size()); }
+  void append(const Http_buffer &b) {
+    const bool copy = (length == 0);
+    append(b.begin(), b.size());
+    /* a copy keeps the digests already computed */
+    if (copy) {
+      md5_ = b.md5_;
+      sha256_ = b.sha256_;
+    }
+  }
   size_t size() const noexcept { return length; }
   char &operator[](size_t i) { return buf[i]; }
   const char &operator[](size_t i) const { return buf[i]; }
@@ -100,11 +127,14 @@ class Http_buffer {
   const_iterator end() const noexcept { return buf + length; }
   size_t capacity() const noexcept { return buflen; }
   void reserve(size_t n) {
-    if (buflen < n) {
-      buf = static_cast<char *>(
-          my_realloc(PSI_NOT_INSTRUMENTED, buf, n, MYF(MY_FAE)));
-      buflen = n;
+    if (buflen >= n) return;
+    if (buf == nullptr) {
+      buf = pool_acquire(n, &buflen);
+      return;
     }
+    buf = static_cast<char *>(
+        my_realloc(PSI_NOT_INSTRUMENTED, buf, n, MYF(MY_FAE)));
+    buflen = n;
   }
   void clear() noexcept {
     length = 0;
@@ -130,6 +160,16 @@ class Http_buffer {
     }
     return sha256_;
   }
+  /** Compute the digests that will be needed in a single pass.
+  @param[in]  need_md5     compute md5()
+  @param[in]  need_sha256  compute sha256() */
+  void compute_digests(bool need_md5, bool need_sha256) const {
+    need_md5 = need_md5 && md5_.empty();
+    need_sha256 = need_sha256 && sha256_.empty();
+    if (!need_md5 && !need_sha256) return;
+    xbcloud::md5_sha256(*this, need_md5 ? &md5_ : nullptr,
+                        need_sha256 ? &sha256_ : nullptr);
+  }
 };
 
 class Http_request {
@@ -162,6 +202,9 @@ class Http_request {
     headers_[name] = value;
   }
   void remove_header(const std::string &name) { headers_.erase(name); }
+  /* for a path escaped by the caller, like an object name with its slashes
+  escaped or an URL returned by the server with its query string */
+  void set_escaped_path(const std::string &path) { path_ = path; }
   void add_param(const std::string &name, const std::string &value) {
     params_[name] = value;
   }
@@ -267,6 +310,9 @@ class Http_connection {
   upload_state_t *upload_state() { return &upload_state_; }
 
   Http_response &response() const { return response_; }
+
+  /** Take back the easy handle of a completed request to reuse it. */
+  curl_easy_unique_ptr release_curl() { return std::move(curl_); }
 };
 
 class Event_handler {
@@ -280,9 +326,27 @@ class Event_handler {
   std::mutex queue_mutex;
   size_t n_queued{0};
   size_t max_requests;
+
+  /* requests added to the multi handle at a time, between max_requests and
+  max_concurrency, lowered when the server throttles and raised by one
+  after as many successful requests */
+  std::atomic<size_t> concurrency;
+  size_t max_concurrency;
+  size_t n_succeeded{0};
+  /* requests in flight when the concurrency was lowered, their throttled
+  responses do not lower it again */
+  size_t n_before_cut{0};
   bool final{false};
   bool loop_running{false};
 
+  /* bytes of the requests reserved with reserve_memory(), waiting in the
+  queue, in progress or being retried */
+  std::mutex memory_mutex;
+  std::condition_variable memory_released;
+  size_t max_memory{0};
+  size_t memory{0};
+  size_t peak_memory_{0};
+
   struct Curl_socket_info {
     curl_socket_t sockfd;
     CURL *curl_easy;
@@ -294,6 +358,11 @@ class Event_handler {
 
   std::queue<Http_connection *> queue;
 
+  /* easy handles of the completed requests, kept with their DNS and TLS
+  session caches so that the next requests skip a full handshake */
+  std::mutex curl_pool_mutex;
+  std::vector<curl_easy_unique_ptr> curl_pool;
+
   static void mcode_or_die(CURLMcode code);
 
   void remove_socket(Curl_socket_info *socket_info);
@@ -322,8 +391,13 @@ class Event_handler {
 
   void process_queue();
 
+  void adapt_concurrency(long http_code);
+
  public:
-  Event_handler(int max_requests) : max_requests(max_requests) {}
+  Event_handler(int max_requests)
+      : max_requests(max_requests),
+        concurrency(max_requests),
+        max_concurrency(max_requests) {}
 
   ~Event_handler();
 
@@ -334,6 +408,43 @@ class Event_handler {
   void add_connection(Http_connection *conn, bool nowait = false);
 
   void stop();
+
+  /** Get an easy handle for a new request, reused from the pool when
+  possible. */
+  curl_easy_unique_ptr acquire_curl_easy();
+
+  /** Return the easy handle of a completed request to the pool.
+  @param[in]  curl  handle removed from the multi handle */
+  void release_curl_easy(curl_easy_unique_ptr curl);
+
+  /** Let the number of requests in flight adapt to the server, up to the
+  given maximum, starting from max_requests. Must be called before init().
+  @param[in]  max  highest number of requests in flight */
+  void set_max_concurrency(size_t max) {
+    max_concurrency = std::max(max, max_requests);
+  }
+
+  /** @return number of requests in flight chosen last */
+  size_t current_concurrency() const { return concurrency; }
+
+  /** Limit the memory of the requests in flight, 0 for no limit. */
+  void set_max_memory(size_t bytes) { max_memory = bytes; }
+
+  /** Account the payload of a request before creating it. Waits for other
+  requests to release their memory if the limit would be exceeded, a request
+  larger than the limit waits for all others to complete.
+  @param[in]  bytes  payload size */
+  void reserve_memory(size_t bytes);
+
+  /** Release the memory of a request once it is completed or failed.
+  @param[in]  bytes  payload size given to reserve_memory() */
+  void release_memory(size_t bytes);
+
+  /** @return highest memory of the requests in flight */
+  size_t peak_memory() {
+    std::lock_guard<std::mutex> guard(memory_mutex);
+    return peak_memory_;
+  }
 };
 
 class Http_client {
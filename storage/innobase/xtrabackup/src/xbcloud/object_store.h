@@ -53,6 +53,15 @@ class Object_store {
                                    std::function<void(bool)> f = {}) = 0;
   virtual bool delete_object(const std::string &container,
                              const std::string &name) = 0;
+  /* Number of objects async_delete_objects() deletes with one request, 0 if
+  the store deletes objects one at a time only. */
+  virtual size_t delete_batch_size() const { return 0; }
+  virtual bool async_delete_objects(const std::string &container,
+                                    const std::vector<std::string> &objects,
+                                    Event_handler *h,
+                                    std::function<void(bool)> f = {}) {
+    return false;
+  }
   virtual Http_buffer download_object(const std::string &container,
                                       const std::string &name,
                                       bool &success) = 0;
@@ -91,23 +91,26 @@ std::string S3_signerV4::aws_date_format(time_t t) {
 
 std::string S3_signerV4::build_hashed_canonical_request(
     Http_request &request, std::string &signed_headers) {
-  std::stringstream canonical_request;
+  /* reused by the requests signed on the thread, it keeps its capacity */
+  static thread_local std::string canonical_request;
+  canonical_request.clear();
+
   /* canonical request method */
   switch (request.method()) {
     case Http_request::GET:
-      canonical_request << "GET\n";
+      canonical_request.append("GET\n");
       break;
     case Http_request::POST:
-      canonical_request << "POST\n";
+      canonical_request.append("POST\n");
       break;
     case Http_request::PUT:
-      canonical_request << "PUT\n";
+      canonical_request.append("PUT\n");
       break;
     case Http_request::DELETE:
-      canonical_request << "DELETE\n";
+      canonical_request.append("DELETE\n");
       break;
     case Http_request::HEAD:
-      canonical_request << "HEAD\n";
+      canonical_request.append("HEAD\n");
       break;
   }
 
@@ -115,34 +118,34 @@ std::string S3_signerV4::build_hashed_canonical_request(
   request.add_header(AWS_CONTENT_SHA256_HEADER, content_sha256);
 
   /* canonical URI */
-  canonical_request << request.path() << "\n";
+  canonical_request.append(request.path()).append("\n");
 
   /* canonical query string */
-  canonical_request << request.query_string() << "\n";
+  canonical_request.append(request.query_string()).append("\n");
 
-  std::map<std::string, std::string> keys;
+  std::map<std::string, const std::string *> keys;
 
   for (const auto &header : request.headers()) {
     std::string canonical_key = header.first;
     to_lower(canonical_key);
-    keys[canonical_key] = header.first;
+    keys[std::move(canonical_key)] = &header.second;
   }
 
   /* canonical headers */
+  std::string canonical_value;
   for (const auto &key : keys) {
-    std::string canonical_name = key.first;
-    to_lower(canonical_name);
-    std::string canonical_value = request.headers().at(key.second);
+    canonical_value = *key.second;
     canonicalize_http_header_value(canonical_value);
-    canonical_request << canonical_name << ":" << canonical_value << "\n";
+    canonical_request.append(key.first).append(":");
+    canonical_request.append(canonical_value).append("\n");
     if (!signed_headers.empty()) signed_headers.append(";");
-    signed_headers.append(canonical_name);
+    signed_headers.append(key.first);
   }
-  canonical_request << "\n" << signed_headers << "\n";
+  canonical_request.append("\n").append(signed_headers).append("\n");
 
-  canonical_request << content_sha256;
+  canonical_request.append(content_sha256);
 
-  return hex_encode(sha256(canonical_request.str()));
+  return hex_encode(sha256(canonical_request));
 }
 
 std::string S3_signerV4::build_string_to_sign(Http_request &request,
@@ -160,6 +163,19 @@ std::string S3_signerV4::build_string_to_sign(Http_request &request,
   return s;
 }
 
+std::vector<unsigned char> S3_signerV4::get_signing_key(
+    const std::string &date) {
+  std::lock_guard<std::mutex> lock(signing_key_mutex);
+  if (signing_key_date != date) {
+    auto k_date = hmac_sha256("AWS4" + secret_key, date);
+    auto k_region = hmac_sha256(k_date, region);
+    auto k_service = hmac_sha256(k_region, "s3");
+    signing_key = hmac_sha256(k_service, "aws4_request");
+    signing_key_date = date;
+  }
+  return signing_key;
+}
+
 void S3_signerV4::sign_request(const std::string &hostname,
                                const std::string &bucket, Http_request &req,
                                time_t t) {
@@ -180,10 +196,7 @@ void S3_signerV4::sign_request(const std::string &hostname,
   std::string signed_headers;
   auto string_to_sign = build_string_to_sign(req, signed_headers);
 
-  auto k_date = hmac_sha256("AWS4" + secret_key, date);
-  auto k_region = hmac_sha256(k_date, region);
-  auto k_service = hmac_sha256(k_region, "s3");
-  auto k_signing = hmac_sha256(k_service, "aws4_request");
+  auto k_signing = get_signing_key(date);
 
   auto signature = hex_encode(hmac_sha256(k_signing, string_to_sign));
 
@@ -428,6 +441,105 @@ bool S3_client::create_bucket(const std::string &name) {
   return true;
 }
 
+/** Escape an object key for the XML body of a request.
+@param[in]  s  object key
+@return escaped key */
+static std::string xml_escape(const std::string &s) {
+  std::string result;
+  for (char c : s) {
+    switch (c) {
+      case '&':
+        result.append("&amp;");
+        break;
+      case '<':
+        result.append("&lt;");
+        break;
+      case '>':
+        result.append("&gt;");
+        break;
+      case '"':
+        result.append("&quot;");
+        break;
+      case '\'':
+        result.append("&apos;");
+        break;
+      default:
+        result.push_back(c);
+    }
+  }
+  return result;
+}
+
+bool S3_client::async_delete_objects(const std::string &bucket,
+                                     const std::vector<std::string> &names,
+                                     Event_handler *h,
+                                     const async_delete_callback_t callback) {
+  assert(names.size() <= max_delete_objects);
+
+  Http_request *req =
+      new Http_request(Http_request::POST, protocol, hostname(bucket),
+                       bucketname(bucket) + "/");
+  if (req == nullptr) {
+    msg_ts("%s: Failed to delete objects of %s. Out of memory.\n",
+           my_progname, bucket.c_str());
+    return false;
+  }
+  req->add_param("delete", "");
+
+  /* only the keys which fail to be deleted are listed in the response */
+  std::string body = "<Delete><Quiet>true</Quiet>";
+  for (const auto &name : names) {
+    body.append("<Object><Key>" + xml_escape(name) + "</Key></Object>");
+  }
+  body.append("</Delete>");
+  req->append_payload(body);
+  req->add_header("Content-Type", "application/xml");
+  req->add_header("Content-MD5", base64_encode(req->payload().md5()));
+  signer->sign_request(hostname(bucket), bucket, *req, time(0));
+
+  Http_response *resp = new Http_response();
+  if (resp == nullptr) {
+    msg_ts("%s: Failed to delete objects of %s. Out of memory.\n",
+           my_progname, bucket.c_str());
+    delete req;
+    return false;
+  }
+
+  auto f = [callback, bucket, req, resp](
+               CURLcode rc, const Http_connection *conn) mutable -> void {
+    bool success = (rc == CURLE_OK && resp->ok());
+    if (rc == CURLE_OK && resp->body().size() > 0) {
+      using namespace rapidxml;
+      std::string s(resp->body().begin(), resp->body().end());
+      xml_document<> doc;
+      doc.parse<0>(&s[0]);
+      auto root = doc.first_node();
+      auto node = root != nullptr ? root->first_node("Error") : nullptr;
+      if (root != nullptr && strcmp(root->name(), "Error") == 0) {
+        node = root;
+      }
+      for (; node != nullptr; node = node->next_sibling("Error")) {
+        auto key = node->first_node("Key");
+        auto message = node->first_node("Message");
+        msg_ts("%s: Failed to delete object %s/%s. Error message: %s\n",
+               my_progname, bucket.c_str(),
+               key != nullptr ? key->value() : "",
+               message != nullptr ? message->value() : "");
+        success = false;
+      }
+    }
+    if (callback) {
+      callback(success);
+    }
+    delete req;
+    delete resp;
+  };
+
+  http_client->make_async_request(*req, *resp, h, f);
+
+  return true;
+}
+
 bool S3_client::probe_api_version_and_lookup(const std::string &bucket) {
   for (auto lookup : {LOOKUP_DNS, LOOKUP_PATH}) {
     if (bucket_lookup != LOOKUP_AUTO && bucket_lookup != lookup) {
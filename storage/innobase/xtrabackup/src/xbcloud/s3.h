@@ -27,6 +27,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "xbcloud/util.h"
 
 #include <time.h>
+#include <mutex>
+#include <vector>
 
 namespace xbcloud {
 
@@ -70,6 +72,12 @@ class S3_signerV4 : public S3_signer {
   std::string session_token;
   std::string storage_class;
 
+  /* signing key derived from the secret key for signing_key_date, the
+  region and the service only change with the date */
+  std::mutex signing_key_mutex;
+  std::string signing_key_date;
+  std::vector<unsigned char> signing_key;
+
   static std::string aws_date_format(time_t t);
 
   static std::string build_hashed_canonical_request(
@@ -78,6 +86,8 @@ class S3_signerV4 : public S3_signer {
   std::string build_string_to_sign(Http_request &request,
                                    std::string &signed_headers);
 
+  std::vector<unsigned char> get_signing_key(const std::string &date);
+
  public:
   S3_signerV4(s3_bucket_lookup_t lookup, const std::string &region,
               const std::string &access_key, const std::string &secret_key,
@@ -98,6 +108,8 @@ class S3_signerV4 : public S3_signer {
     access_key = _access_key;
     secret_key = _secret_key;
     session_token = _session_token;
+    std::lock_guard<std::mutex> lock(signing_key_mutex);
+    signing_key_date.clear();
   }
 };
 
@@ -226,6 +238,7 @@ class S3_client {
   void set_bucket_lookup(s3_bucket_lookup_t val) { bucket_lookup = val; }
 
   void set_api_version(s3_api_version_t version) { api_version = version; }
+  s3_api_version_t get_api_version() const { return api_version; }
 
   bool probe_api_version_and_lookup(const std::string &bucket);
 
@@ -256,6 +269,14 @@ class S3_client {
                            Event_handler *h,
                            const async_delete_callback_t callback);
 
+  /* maximum number of keys of a DeleteObjects request */
+  static const size_t max_delete_objects = 1000;
+
+  bool async_delete_objects(const std::string &bucket,
+                            const std::vector<std::string> &names,
+                            Event_handler *h,
+                            const async_delete_callback_t callback);
+
   bool list_objects_with_prefix(const std::string &bucket,
                                 const std::string &prefix,
                                 std::vector<std::string> &objects);
@@ -358,6 +379,21 @@ class S3_object_store : public Object_store {
                              const std::string &name) override {
     return s3_client.delete_object(container, name);
   }
+  virtual size_t delete_batch_size() const override {
+    /* signature V2 does not sign the ?delete subresource */
+    return s3_client.get_api_version() == S3_V2
+               ? 0
+               : S3_client::max_delete_objects;
+  }
+  virtual bool async_delete_objects(const std::string &container,
+                                    const std::vector<std::string> &objects,
+                                    Event_handler *h,
+                                    std::function<void(bool)> f = {}) override {
+    return s3_client.async_delete_objects(container, objects, h,
+                                          [f](bool success) {
+                                            if (f) f(success);
+                                          });
+  }
   virtual Http_buffer download_object(const std::string &container,
                                       const std::string &name,
                                       bool &success) override {
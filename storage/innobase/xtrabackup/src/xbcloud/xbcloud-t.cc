@@ -1,7 +1,11 @@
+#include <stdlib.h>
+#include <unistd.h>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
 #include "azure.h"
+#include "chunk_cache.h"
 #include "http.h"
 #include "s3.h"
 #include "swift.h"
@@ -37,6 +41,67 @@ MATCHER_P(PayloadEq, payload, "") {
   return (std::string(&arg.payload()[0], arg.payload().size()) == payload);
 }
 
+TEST(http_buffer, growth) {
+  Http_buffer buf;
+  std::string expected;
+
+  /* appends reallocate a logarithmic number of times */
+  size_t n_grown = 0;
+  for (int i = 0; i < 100000; i++) {
+    const size_t capacity = buf.capacity();
+    buf.append("0123456789");
+    expected.append("0123456789");
+    if (buf.capacity() != capacity) n_grown++;
+  }
+  ASSERT_EQ(std::string(buf.begin(), buf.end()), expected);
+  ASSERT_LT(n_grown, 32u);
+
+  /* a large buffer released to the pool serves the next one */
+  const char *data = buf.begin();
+  const size_t capacity = buf.capacity();
+  buf = Http_buffer();
+  Http_buffer other;
+  other.reserve(capacity);
+  ASSERT_EQ(other.begin(), data);
+  ASSERT_EQ(other.capacity(), capacity);
+}
+
+TEST(chunk_cache, lru) {
+  char dir[] = "/tmp/xbcloud-t-cache.XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+
+  Http_buffer a, b, c, out;
+  a.append(std::string(400, 'a'));
+  b.append(std::string(400, 'b'));
+  c.append(std::string(400, 'c'));
+
+  Chunk_cache cache;
+  ASSERT_TRUE(cache.init(dir, 1000));
+  ASSERT_FALSE(cache.get("a", &out));
+  cache.put("a", a);
+  cache.put("b", b);
+  ASSERT_TRUE(cache.get("a", &out));
+  ASSERT_EQ(std::string(out.begin(), out.end()), std::string(400, 'a'));
+
+  /* b is the least recently used one */
+  cache.put("c", c);
+  ASSERT_EQ(cache.size(), 800u);
+  ASSERT_FALSE(cache.get("b", &out));
+  ASSERT_TRUE(cache.get("c", &out));
+
+  /* the entries are found again by the next run */
+  Chunk_cache reopened;
+  ASSERT_TRUE(reopened.init(dir, 1000));
+  ASSERT_EQ(reopened.size(), 800u);
+  ASSERT_TRUE(reopened.get("a", &out));
+  ASSERT_EQ(std::string(out.begin(), out.end()), std::string(400, 'a'));
+
+  reopened.remove("a");
+  reopened.remove("c");
+  ASSERT_EQ(reopened.size(), 0u);
+  ASSERT_EQ(rmdir(dir), 0);
+}
+
 TEST(s3_client, basicDNSv4) {
   Mock_http_client http_client;
   S3_client c(&http_client, "us-east-1", "my-access-key-id", "my-secret-key", 1,
@@ -241,6 +306,38 @@ TEST(s3v4_signer, storageClass) {
       "fe6c888f22fb23a7a3fe6f663013b5df3cc761c3777ed4368b325114c885320f");
 }
 
+TEST(s3v4_signer, signingKeyCache) {
+  auto make_request = [] {
+    Http_request req(Http_request::GET, Http_request::HTTPS, "hyhost",
+                     "mybucket/myobject/");
+    req.add_header("Content-Length", "4");
+    req.add_header("Content-Type", "application/octet-stream");
+    req.append_payload("test", 4);
+    return req;
+  };
+
+  S3_signerV4 signer(LOOKUP_PATH, "example-region", "access_key", "old_key");
+
+  /* the same day reuses the signing key, the next day and new keys derive
+  another one */
+  const time_t times[] = {1555892546, 1555892546 + 60, 1555892546 + 86400};
+  for (auto key : {"old_key", "secret_key"}) {
+    signer.update_keys("access_key", key, "");
+
+    for (auto t : times) {
+      auto req = make_request();
+      signer.sign_request("myhost", "mybucket", req, t);
+
+      S3_signerV4 fresh(LOOKUP_PATH, "example-region", "access_key", key);
+      auto fresh_req = make_request();
+      fresh.sign_request("myhost", "mybucket", fresh_req, t);
+
+      ASSERT_EQ(req.headers().at("Authorization"),
+                fresh_req.headers().at("Authorization"));
+    }
+  }
+}
+
 TEST(s3v2_signer, basicDNS) {
   Http_request req(Http_request::GET, Http_request::HTTPS, "mybucket.hyhost",
                    "myobject/");
@@ -28,11 +28,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <signal.h>
 #include <typelib.h>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <list>
+#include <map>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include "template_utils.h"
 
 #include <curl/curl.h>
@@ -45,7 +48,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "crc_glue.h"
 
 #include "msg.h"
+#include "restore_order.h"
 #include "xbcloud/azure.h"
+#include "xbcloud/chunk_cache.h"
+#include "xbcloud/gcs.h"
 #include "xbcloud/s3.h"
 #include "xbcloud/s3_ec2.h"
 #include "xbcloud/swift.h"
@@ -114,6 +120,9 @@ static char *opt_google_secret_key = nullptr;
 static char *opt_google_session_token = nullptr;
 static char *opt_google_storage_class = nullptr;
 static char *opt_google_bucket = nullptr;
+static ulong opt_google_api = 0;
+static char *opt_google_oauth_token = nullptr;
+static char *opt_google_project = nullptr;
 
 static char *opt_azure_account = nullptr;
 static char *opt_azure_container = nullptr;
@@ -125,7 +134,10 @@ static bool opt_azure_development_storage = 0;
 static std::string backup_name;
 static char *opt_cacert = nullptr;
 static ulong opt_parallel = 1;
+static ulong opt_parallel_chunks = 1;
+static ulong opt_max_parallel = 0;
 static ulong opt_threads = 1;
+static ulong opt_event_loops = 1;
 static char *opt_fifo_dir = nullptr;
 static ulong opt_fifo_timeout = 60;
 static ulong opt_timeout = 120;
@@ -134,15 +146,53 @@ static u_int32_t opt_max_backoff = 300000;
 
 static bool opt_insecure = false;
 static bool opt_md5 = false;
+static ulonglong opt_object_size = 0;
+static ulonglong opt_max_upload_memory = 0;
+static char *opt_chunk_store = nullptr;
+static char *opt_extract_dir = nullptr;
+static char *opt_xbstream_options = nullptr;
+static char *opt_cache_dir = nullptr;
+static ulonglong opt_cache_size = 10ULL * 1024 * 1024 * 1024;
 static enum { MODE_GET, MODE_PUT, MODE_DELETE } opt_mode;
 
 static std::map<std::string, std::string> extra_http_headers;
 
 const char *s3_api_version_names[] = {"AUTO", "2", "4", NullS};
 
+enum { GOOGLE_XML, GOOGLE_JSON };
+const char *google_api_names[] = {"XML", "JSON", NullS};
+
 /* list of partial files to be downloaded or delete*/
 static std::set<std::string> partial_file_list;
 
+/* objects of --chunk-store known to be stored, shared by the put threads */
+struct chunk_store_t {
+  std::mutex m;
+  std::unordered_set<std::string> objects;
+
+  /**
+  Add an object to the chunk store.
+
+  @param [in]  name  object name.
+
+  @return true if the object was not stored yet, false otherwise */
+  bool add(const std::string &name) {
+    std::lock_guard<std::mutex> g(m);
+    return objects.insert(name).second;
+  }
+};
+
+static chunk_store_t chunk_store;
+
+/* stored objects of the chunks of a backup with a manifest, by chunk name */
+static std::unordered_map<std::string, std::string> manifest_objects;
+
+/* objects downloaded by get, used when --cache-dir is set */
+static Chunk_cache chunk_cache;
+
+/* stdin of the xbstream process of --extract-dir */
+static FILE *extract_pipe = nullptr;
+
 TYPELIB storage_typelib = {array_elements(storage_names) - 1, "", storage_names,
                            nullptr};
 
@@ -152,6 +202,9 @@ TYPELIB s3_bucket_lookup_typelib = {array_elements(s3_bucket_lookup_names) - 1,
 TYPELIB s3_api_version_typelib = {array_elements(s3_api_version_names) - 1, "",
                                   s3_api_version_names, nullptr};
 
+TYPELIB google_api_typelib = {array_elements(google_api_names) - 1, "",
+                              google_api_names, nullptr};
+
 Http_client http_client;
 
 enum {
@@ -199,9 +252,15 @@ enum {
   OPT_GOOGLE_SESSION_TOKEN,
   OPT_GOOGLE_STORAGE_CLASS,
   OPT_GOOGLE_BUCKET,
+  OPT_GOOGLE_API,
+  OPT_GOOGLE_OAUTH_TOKEN,
+  OPT_GOOGLE_PROJECT,
 
   OPT_PARALLEL,
+  OPT_PARALLEL_CHUNKS,
+  OPT_MAX_PARALLEL,
   OPT_THREADS,
+  OPT_EVENT_LOOPS,
   OPT_FIFO_DIR,
   OPT_FIFO_TIMEOUT,
   OPT_TIMEOUT,
@@ -211,6 +270,13 @@ enum {
   OPT_HEADER,
   OPT_INSECURE,
   OPT_MD5,
+  OPT_OBJECT_SIZE,
+  OPT_MAX_UPLOAD_MEMORY,
+  OPT_CHUNK_STORE,
+  OPT_EXTRACT_DIR,
+  OPT_XBSTREAM_OPTIONS,
+  OPT_CACHE_DIR,
+  OPT_CACHE_SIZE,
   OPT_VERBOSE,
   OPT_CURL_RETRIABLE_ERRORS,
   OPT_HTTP_RETRIABLE_ERRORS
@@ -309,10 +375,35 @@ static struct my_option my_long_options[] = {
      &opt_parallel, &opt_parallel, 0, GET_ULONG, REQUIRED_ARG, 1, 1, ULONG_MAX,
      0, 0, 0},
 
+    {"parallel-chunks", OPT_PARALLEL_CHUNKS,
+     "Number of chunks of the same file downloaded in parallel on get mode. "
+     "Chunks completed out of order are kept in memory until the preceding "
+     "ones are written.",
+     &opt_parallel_chunks, &opt_parallel_chunks, 0, GET_ULONG, REQUIRED_ARG, 1,
+     1, ULONG_MAX, 0, 0, 0},
+
+    {"max-parallel", OPT_MAX_PARALLEL,
+     "Let the number of parallel requests adapt to the object store, "
+     "starting from --parallel and up to this value. It is halved when the "
+     "server answers with 503 (SlowDown) or 429 and grows by one after as "
+     "many successful requests. The concurrency reached is reported at the "
+     "end. Default 0 keeps --parallel fixed.",
+     &opt_max_parallel, &opt_max_parallel, 0, GET_ULONG, REQUIRED_ARG, 0, 0,
+     ULONG_MAX, 0, 0, 0},
+
     {"fifo-streams", OPT_THREADS, "Number of parallel fifo stream threads.",
      &opt_threads, &opt_threads, 0, GET_ULONG, REQUIRED_ARG, 1, 1, ULONG_MAX, 0,
      0, 0},
 
+    {"event-loops", OPT_EVENT_LOOPS,
+     "On put mode, number of event loops of each fifo stream thread, every "
+     "one on a thread of its own running the TLS and the callbacks of the "
+     "objects given to it in turn. --parallel, --max-parallel and "
+     "--max-upload-memory are divided between the loops. Raise it when a "
+     "single stream is limited by one CPU core.",
+     &opt_event_loops, &opt_event_loops, 0, GET_ULONG, REQUIRED_ARG, 1, 1,
+     ULONG_MAX, 0, 0, 0},
+
     {"fifo-dir", OPT_FIFO_DIR,
      "Directory to read/write Named Pipe. On put mode, xbcloud read from named "
      "pipes. On get mode, xbcloud writes to named pipes.",
@@ -439,6 +530,25 @@ static struct my_option my_long_options[] = {
      &opt_google_bucket, &opt_google_bucket, 0, GET_STR_ALLOC, REQUIRED_ARG, 0,
      0, 0, 0, 0, 0},
 
+    {"google-api", OPT_GOOGLE_API,
+     "Google cloud storage API. XML uses the S3 compatible API with HMAC "
+     "keys, JSON uses the JSON API with an OAuth2 access token and resumable "
+     "uploads. XML|JSON",
+     &opt_google_api, &opt_google_api, &google_api_typelib, GET_ENUM,
+     REQUIRED_ARG, GOOGLE_XML, 0, 0, 0, 0, 0},
+
+    {"google-oauth-token", OPT_GOOGLE_OAUTH_TOKEN,
+     "OAuth2 access token for --google-api=JSON. When not specified, the "
+     "token of the default service account is requested from the metadata "
+     "server.",
+     &opt_google_oauth_token, &opt_google_oauth_token, 0, GET_STR_ALLOC,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"google-project", OPT_GOOGLE_PROJECT,
+     "Google cloud project of the bucket created by --google-api=JSON.",
+     &opt_google_project, &opt_google_project, 0, GET_STR_ALLOC, REQUIRED_ARG,
+     0, 0, 0, 0, 0, 0},
+
     {"cacert", OPT_CACERT, "CA certificate file.", &opt_cacert, &opt_cacert, 0,
      GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
 
@@ -451,6 +561,67 @@ static struct my_option my_long_options[] = {
     {"md5", OPT_MD5, "Upload MD5 file into the backup dir.", &opt_md5, &opt_md5,
      0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
 
+    {"object-size", OPT_OBJECT_SIZE,
+     "On put mode, group the consecutive chunks of a file into objects of at "
+     "least this size instead of uploading every chunk as its own object, "
+     "which cuts the number of requests of large backups. Every file being "
+     "streamed holds an object in memory until it is uploaded, and get "
+     "downloads --parallel objects at a time, so memory use grows with the "
+     "size. Backups uploaded with any size are downloaded the same way. "
+     "Default 0 uploads every chunk.",
+     &opt_object_size, &opt_object_size, 0, GET_ULL, REQUIRED_ARG, 0, 0,
+     ULLONG_MAX, 0, 0, 0},
+
+    {"max-upload-memory", OPT_MAX_UPLOAD_MEMORY,
+     "On put mode, the maximum bytes of objects being uploaded by each fifo "
+     "stream thread, including the ones waiting to be retried. Reading the "
+     "stream stops while the limit is reached, so that a slow object store "
+     "slows down the backup instead of growing the memory of xbcloud. The "
+     "peak is reported at the end. Default 0 for no limit.",
+     &opt_max_upload_memory, &opt_max_upload_memory, 0, GET_ULL, REQUIRED_ARG,
+     0, 0, ULLONG_MAX, 0, 0, 0},
+
+    {"chunk-store", OPT_CHUNK_STORE,
+     "On put mode, upload the objects into this directory of the container, "
+     "named by the SHA256 of their contents, and skip the ones already "
+     "stored by a previous backup. The backup is then made of a manifest "
+     "uploaded as <backup name>.manifest, which get reads to find the "
+     "objects. Delete of such a backup removes only its manifest.",
+     &opt_chunk_store, &opt_chunk_store, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0,
+     0, 0, 0, 0},
+
+    {"extract-dir", OPT_EXTRACT_DIR,
+     "On get mode, extract the backup into this directory with an xbstream "
+     "process fed by xbcloud, instead of writing the stream to stdout or to "
+     "the named pipes. With --fifo-streams the xbstream process reads all of "
+     "them.",
+     &opt_extract_dir, &opt_extract_dir, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0,
+     0, 0, 0, 0},
+
+    {"xbstream-options", OPT_XBSTREAM_OPTIONS,
+     "Additional options of the xbstream process of --extract-dir, for "
+     "example \"--decompress --decrypt=AES256 --encrypt-key-file=KEYFILE "
+     "--parallel=8\", so that the files are decompressed and decrypted as "
+     "they are downloaded.",
+     &opt_xbstream_options, &opt_xbstream_options, 0, GET_STR_ALLOC,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"cache-dir", OPT_CACHE_DIR,
+     "On get mode, keep the downloaded objects in this local directory and "
+     "read them from it when they are needed again, so that restoring the "
+     "same files of a backup several times downloads them once. Objects of "
+     "--chunk-store are cached by the SHA256 of their contents and shared by "
+     "all the backups using them, and checked when they are read from the "
+     "cache.",
+     &opt_cache_dir, &opt_cache_dir, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0,
+     0, 0, 0},
+
+    {"cache-size", OPT_CACHE_SIZE,
+     "Maximum size of the objects in --cache-dir. The least recently used "
+     "objects are removed when it is reached. Default 10G.",
+     &opt_cache_size, &opt_cache_size, 0, GET_ULL, REQUIRED_ARG,
+     10LL * 1024 * 1024 * 1024, 0, ULLONG_MAX, 0, 1024 * 1024, 0},
+
     {"verbose", OPT_VERBOSE, "Turn ON cURL tracing.", &opt_verbose,
      &opt_verbose, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
 
@@ -519,6 +690,7 @@ static bool get_one_option(int optid,
     case OPT_GOOGLE_ACCESS_KEY:
     case OPT_GOOGLE_SECRET_KEY:
     case OPT_GOOGLE_SESSION_TOKEN:
+    case OPT_GOOGLE_OAUTH_TOKEN:
     case OPT_AZURE_ACCOUNT:
     case OPT_AZURE_ACCESS_KEY:
       if (argument != nullptr) {
@@ -612,6 +784,7 @@ static void get_env_args() {
   get_env_value(opt_google_session_token, "SESSION_TOKEN");
   get_env_value(opt_google_region, "DEFAULT_REGION");
   get_env_value(opt_google_endpoint, "ENDPOINT");
+  get_env_value(opt_google_oauth_token, "GOOGLE_OAUTH_ACCESS_TOKEN");
 }
 
 static char **defaults_argv = nullptr;
@@ -759,6 +932,7 @@ typedef struct {
   uint thread_id;
   std::atomic<bool> *has_errors;
   Http_buffer *buf_md5;
+  Http_buffer *buf_manifest;
   const std::string *container;
   Object_store *store;
 } put_thread_ctxt_t;
@@ -767,6 +941,8 @@ struct file_entry_t {
   my_off_t chunk_idx;
   my_off_t offset;
   std::string path;
+  /* chunks of the next object with --object-size */
+  Http_buffer object;
 };
 
 /**
@@ -801,9 +977,91 @@ static bool skip_file(const std::string &file_name,
   return false;
 }
 
+/**
+  Upload an object of a file, made of one or more of its chunks.
+
+@param [in]    cntx        thread context
+@param [in]    h           event handler of the thread
+@param [in]    file_name   object name in the backup
+@param [in]    buf         object contents */
+static void put_object(put_thread_ctxt_t &cntx, Event_handler *h,
+                       const std::string &file_name, Http_buffer &buf) {
+  std::string object_name = backup_name;
+  object_name.append("/").append(file_name);
+
+  /* digests of the backup and of the store protocol, in one pass: ETag of
+  Swift, Content-MD5 of S3 V2 and payload hash of S3 V4 */
+  const bool s3 = opt_storage == S3 ||
+                  (opt_storage == GOOGLE && opt_google_api == GOOGLE_XML);
+  buf.compute_digests(
+      opt_md5 || opt_storage == SWIFT || (s3 && opt_s3_api_version == S3_V2),
+      opt_chunk_store != nullptr || (s3 && opt_s3_api_version != S3_V2));
+
+  if (opt_md5) {
+    cntx.buf_md5->append(hex_encode(buf.md5()));
+    cntx.buf_md5->append("  ");
+    cntx.buf_md5->append(file_name);
+    cntx.buf_md5->append("\n");
+  }
+
+  if (opt_chunk_store != nullptr) {
+    object_name = opt_chunk_store;
+    object_name.append("/").append(hex_encode(buf.sha256()));
+    cntx.buf_manifest->append(object_name);
+    cntx.buf_manifest->append(" ");
+    cntx.buf_manifest->append(file_name);
+    cntx.buf_manifest->append("\n");
+    if (!chunk_store.add(object_name)) {
+      msg_ts("%s: [%d] chunk %s is already stored as %s\n", my_progname,
+             cntx.thread_id, file_name.c_str(), object_name.c_str());
+      return;
+    }
+  }
+
+  /* blocks the stream reader while too much is being uploaded */
+  h->reserve_memory(buf.size());
+
+  const bool queued = cntx.store->async_upload_object(
+      *cntx.container, object_name, buf, h,
+      std::bind(
+          [](bool ok, std::string path, size_t length, int thread_id,
+             std::atomic<bool> *err, Event_handler *h) {
+            h->release_memory(length);
+            if (ok) {
+              msg_ts("%s: [%d] successfully uploaded chunk: %s, size: %zu\n",
+                     my_progname, thread_id, path.c_str(), length);
+            } else {
+              msg_ts("%s: [%d] error: failed to upload chunk: %s, size: %zu\n",
+                     my_progname, thread_id, path.c_str(), length);
+              err->store(true);
+            }
+          },
+          std::placeholders::_1, object_name, buf.size(), cntx.thread_id,
+          cntx.has_errors, h));
+  if (!queued) {
+    h->release_memory(buf.size());
+    cntx.has_errors->store(true);
+  }
+}
+
 void put_func(put_thread_ctxt_t &cntx) {
-  std::thread ev;
-  Event_handler h(opt_parallel > 0 ? opt_parallel : 1);
+  /* the objects are given to the loops in turn, a request and its retries
+  stay on the loop of the object */
+  const size_t n_loops = opt_event_loops;
+  const size_t parallel = opt_parallel > 0 ? opt_parallel : 1;
+  std::vector<std::unique_ptr<Event_handler>> handlers;
+  std::vector<std::thread> loops;
+  for (size_t i = 0; i < n_loops; i++) {
+    auto h = make_unique<Event_handler>((parallel + n_loops - 1) / n_loops);
+    h->set_max_concurrency((opt_max_parallel + n_loops - 1) / n_loops);
+    if (opt_max_upload_memory > 0) {
+      h->set_max_memory(std::max<size_t>(opt_max_upload_memory / n_loops, 1));
+    }
+    handlers.push_back(std::move(h));
+  }
+  size_t next_loop = 0;
+  size_t peak_memory = 0;
+  size_t concurrency = 0;
   std::unordered_map<std::string, std::unique_ptr<file_entry_t>> filehash;
   xb_rstream_t *stream;
   if (opt_threads > 1) {
@@ -837,21 +1095,33 @@ void put_func(put_thread_ctxt_t &cntx) {
   memset(&chunk, 0, sizeof(chunk));
 
 
-  if (!h.init()) {
-    msg_ts("%s: Failed to initialize event handler.\n", my_progname);
-    goto end;
+  for (auto &h : handlers) {
+    if (!h->init()) {
+      msg_ts("%s: Failed to initialize event handler.\n", my_progname);
+      cntx.has_errors->store(true);
+      break;
+    }
+    loops.push_back(h->run());
   }
-  ev = h.run();
 
   do {
+    if (loops.size() < n_loops) {
+      break;
+    }
+
     res = xb_stream_read_chunk(stream, &chunk);
     if (res != XB_STREAM_READ_CHUNK) {
       my_free(chunk.raw_data);
       my_free(chunk.sparse_map);
       break;
     }
-    if (chunk.type == XB_CHUNK_TYPE_UNKNOWN &&
-        !(chunk.flags & XB_STREAM_FLAG_IGNORABLE)) {
+    /* Chunks without a file, e.g. the index or the manifest of one of the
+    --fifo-streams, are not uploaded */
+    if ((chunk.type == XB_CHUNK_TYPE_UNKNOWN &&
+         (chunk.flags & XB_STREAM_FLAG_IGNORABLE)) ||
+        chunk.type == XB_CHUNK_TYPE_INDEX ||
+        chunk.type == XB_CHUNK_TYPE_INDEX_TRAILER ||
+        chunk.type == XB_CHUNK_TYPE_MANIFEST) {
       continue;
     }
 
@@ -877,62 +1147,89 @@ void put_func(put_thread_ctxt_t &cntx) {
       }
     }
 
-    std::string file_name = build_file_name(chunk.path, entry->chunk_idx);
-    std::string object_name = backup_name;
-    object_name.append("/").append(file_name);
-
-    Http_buffer buf = Http_buffer();
-    buf.assign_buffer(static_cast<char *>(chunk.raw_data), chunk.buflen,
-                      chunk.raw_length);
-
-    if (opt_md5) {
-      cntx.buf_md5->append(hex_encode(buf.md5()));
-      cntx.buf_md5->append("  ");
-      cntx.buf_md5->append(file_name);
-      cntx.buf_md5->append("\n");
-    }
-
-    cntx.store->async_upload_object(
-        *cntx.container, object_name, buf, &h,
-        std::bind(
-            [&](bool ok, std::string path, size_t length,
-                std::atomic<bool> *err) {
-              if (ok) {
-                msg_ts("%s: [%d] successfully uploaded chunk: %s, size: %zu\n",
-                       my_progname, cntx.thread_id, path.c_str(), length);
-              } else {
-                msg_ts(
-                    "%s: [%d] error: failed to upload chunk: %s, size: %zu\n",
-                    my_progname, cntx.thread_id, path.c_str(), length);
-                err->store(true);
-              }
-            },
-            std::placeholders::_1, object_name, chunk.raw_length,
-            cntx.has_errors));
-
     entry->offset += chunk.length;
-    entry->chunk_idx++;
+    const bool eof = chunk.type == XB_CHUNK_TYPE_EOF;
+
+    if (opt_object_size > 0) {
+      /* The objects are named like chunks, download just concatenates the
+      chunks they contain */
+      entry->object.append(static_cast<char *>(chunk.raw_data),
+                           chunk.raw_length);
+      if (entry->object.size() >= opt_object_size || eof) {
+        put_object(cntx, handlers[next_loop++ % n_loops].get(),
+                   build_file_name(chunk.path, entry->chunk_idx),
+                   entry->object);
+        entry->object.clear();
+        entry->chunk_idx++;
+      }
+      /* the chunk buffer is reused for the next chunk */
+    } else {
+      Http_buffer buf = Http_buffer();
+      buf.assign_buffer(static_cast<char *>(chunk.raw_data), chunk.buflen,
+                        chunk.raw_length);
+
+      put_object(cntx, handlers[next_loop++ % n_loops].get(),
+                 build_file_name(chunk.path, entry->chunk_idx), buf);
+      entry->chunk_idx++;
+
+      /* Reset chunk */
+      memset(&chunk, 0, sizeof(chunk));
+    }
 
-    if (chunk.type == XB_CHUNK_TYPE_EOF) {
+    if (eof) {
       filehash.erase(entry->path);
     }
-
-    /* Reset chunk */
-    memset(&chunk, 0, sizeof(chunk));
   } while (!cntx.has_errors->load());
 
-  h.stop();
-  ev.join();
+  for (size_t i = 0; i < loops.size(); i++) {
+    handlers[i]->stop();
+    loops[i].join();
+    peak_memory += handlers[i]->peak_memory();
+    concurrency += handlers[i]->current_concurrency();
+  }
+
+  msg_ts("%s: [%d] peak memory of the uploads in flight: %zu bytes\n",
+         my_progname, cntx.thread_id, peak_memory);
+  if (opt_max_parallel > 0) {
+    msg_ts("%s: [%d] parallel requests: %zu\n", my_progname, cntx.thread_id,
+           concurrency);
+  }
 
 end:
   if (stream != nullptr) xb_stream_read_done(stream);
 }
 
+/**
+  Parse the manifest of a backup uploaded with --chunk-store. Every line
+  holds the stored object and the name of the chunk in the backup.
+
+@param [in]     manifest     manifest contents
+@param [in]     backup_name  backup name
+@param [in,out] object_list  chunk names of the backup
+@param [in,out] objects      stored objects by chunk name */
+static void parse_manifest(
+    const Http_buffer &manifest, const std::string &backup_name,
+    std::vector<std::string> &object_list,
+    std::unordered_map<std::string, std::string> *objects) {
+  std::istringstream lines(std::string(manifest.begin(), manifest.end()));
+  std::string line;
+  while (std::getline(lines, line)) {
+    auto pos = line.find(' ');
+    if (pos == std::string::npos) continue;
+    std::string chunk = backup_name + "/" + line.substr(pos + 1);
+    if (objects != nullptr) {
+      (*objects)[chunk] = line.substr(0, pos);
+    }
+    object_list.push_back(chunk);
+  }
+}
+
 bool xbcloud_put(Object_store *store, const std::string &container,
                  const std::string &backup_name) {
   bool exists;
   std::atomic<bool> has_errors{false};
   Http_buffer buf_md5 = Http_buffer();
+  Http_buffer buf_manifest = Http_buffer();
   std::string last_file_prefix = backup_name + "/xtrabackup_tablespaces";
   auto last_file_size = last_file_prefix.size();
   bool file_found = false;
@@ -957,6 +1254,27 @@ bool xbcloud_put(Object_store *store, const std::string &container,
     return false;
   }
 
+  if (opt_chunk_store != nullptr) {
+    bool manifest_found = false;
+    store->download_object(container, backup_name + ".manifest",
+                           manifest_found);
+    if (manifest_found) {
+      msg_ts("%s: error: backup named %s already exists!\n", my_progname,
+             backup_name.c_str());
+      return false;
+    }
+    std::vector<std::string> stored;
+    if (!store->list_objects_in_directory(container, opt_chunk_store,
+                                          stored)) {
+      return false;
+    }
+    for (const auto &obj : stored) {
+      chunk_store.add(obj);
+    }
+    msg_ts("%s: %zu objects in chunk store %s\n", my_progname, stored.size(),
+           opt_chunk_store);
+  }
+
   /* Create data copying threads */
   put_thread_ctxt_t *data_threads = (put_thread_ctxt_t *)my_malloc(
       PSI_NOT_INSTRUMENTED, sizeof(put_thread_ctxt_t) * (opt_threads + 1),
@@ -968,6 +1286,7 @@ bool xbcloud_put(Object_store *store, const std::string &container,
     data_threads[i].store = store;
     data_threads[i].container = &container;
     data_threads[i].buf_md5 = new Http_buffer();
+    data_threads[i].buf_manifest = new Http_buffer();
 
     threads.push_back(std::thread(put_func, std::ref(data_threads[i])));
   }
@@ -977,6 +1296,9 @@ bool xbcloud_put(Object_store *store, const std::string &container,
     if (!has_errors.load() && opt_md5) {
       buf_md5.append(*data_threads[i].buf_md5);
     }
+    if (!has_errors.load() && opt_chunk_store != nullptr) {
+      buf_manifest.append(*data_threads[i].buf_manifest);
+    }
   }
 
   if (!has_errors.load() && opt_md5) {
@@ -988,8 +1310,22 @@ bool xbcloud_put(Object_store *store, const std::string &container,
     }
   }
 
+  if (!has_errors.load() && opt_chunk_store != nullptr) {
+    msg_ts("%s: Uploading manifest\n", my_progname);
+    if (!store->upload_object(container, backup_name + ".manifest",
+                              buf_manifest)) {
+      msg_ts("%s: Upload failed: Error uploading manifest.\n", my_progname);
+      has_errors.store(true);
+      goto cleanup;
+    }
+    /* objects of the backup are in the chunk store */
+    parse_manifest(buf_manifest, backup_name, object_list, nullptr);
+  }
+
   if (has_errors.load() ||
-      !store->list_objects_in_directory(container, backup_name, object_list) ||
+      (opt_chunk_store == nullptr &&
+       !store->list_objects_in_directory(container, backup_name,
+                                         object_list)) ||
       object_list.size() == 0) {
     msg_ts("%s: Upload failed.\n", my_progname);
     has_errors.store(true);
@@ -1021,6 +1357,7 @@ bool xbcloud_put(Object_store *store, const std::string &container,
 cleanup:
   for (uint i = 0; i < (uint)opt_threads; i++) {
     delete (data_threads[i].buf_md5);
+    delete (data_threads[i].buf_manifest);
     char filename[FN_REFLEN];
     snprintf(filename, sizeof(filename), "%s%s%lu", opt_fifo_dir, "/thread_",
              (ulong)i);
@@ -1047,10 +1384,62 @@ bool chunk_name_to_file_name(const std::string &chunk_name,
   return true;
 }
 
+/**
+  Delete a batch of objects with one request.
+
+@param [in]     store      object store
+@param [in]     container  container of the objects
+@param [in,out] batch      objects to delete, cleared once queued
+@param [in]     h          event handler
+@param [in,out] error      set if the objects are not deleted
+
+@return true if the request has been queued, false otherwise */
+static bool delete_batch(Object_store *store, const std::string &container,
+                         std::vector<std::string> &batch, Event_handler *h,
+                         bool *error) {
+  msg_ts("%s: Deleting %zu objects, %s to %s.\n", my_progname, batch.size(),
+         batch.front().c_str(), batch.back().c_str());
+  if (!store->async_delete_objects(
+          container, batch, h,
+          std::bind(
+              [](bool success, std::string first, std::string last,
+                 bool *error) {
+                if (!success) {
+                  msg_ts("%s: Delete failed. Cannot delete %s to %s.\n",
+                         my_progname, first.c_str(), last.c_str());
+                  *error = true;
+                }
+              },
+              std::placeholders::_1, batch.front(), batch.back(), error))) {
+    return false;
+  }
+  batch.clear();
+  return true;
+}
+
 bool xbcloud_delete(Object_store *store, const std::string &container,
                     const std::string &backup_name) {
   std::vector<std::string> object_list;
 
+  bool manifest_found = false;
+  store->download_object(container, backup_name + ".manifest", manifest_found);
+  if (manifest_found) {
+    /* objects of the chunk store may be used by other backups */
+    if (!partial_file_list.empty()) {
+      msg_ts("%s: Delete failed. Files of %s are in a chunk store.\n",
+             my_progname, backup_name.c_str());
+      return false;
+    }
+    msg_ts("%s: Deleting %s.manifest.\n", my_progname, backup_name.c_str());
+    if (!store->delete_object(container, backup_name + ".manifest")) {
+      msg_ts("%s: Delete failed. Cannot delete %s.manifest.\n", my_progname,
+             backup_name.c_str());
+      return false;
+    }
+    msg_ts("%s: Delete completed.\n", my_progname);
+    return true;
+  }
+
   if (!store->list_objects_in_directory(container, backup_name, object_list)) {
     msg_ts("%s: Delete failed. Cannot list %s.\n", my_progname,
            backup_name.c_str());
@@ -1063,6 +1452,7 @@ bool xbcloud_delete(Object_store *store, const std::string &container,
   }
 
   Event_handler h(opt_parallel > 0 ? opt_parallel : 1);
+  h.set_max_concurrency(opt_max_parallel);
   if (!h.init()) {
     msg_ts("%s: Failed to initialize event handler.\n", my_progname);
     return false;
@@ -1070,6 +1460,8 @@ bool xbcloud_delete(Object_store *store, const std::string &container,
   auto thread = h.run();
 
   bool error = false;
+  const size_t batch_size = store->delete_batch_size();
+  std::vector<std::string> batch;
   for (const auto &obj : object_list) {
     std::string file_name;
     my_off_t idx;
@@ -1080,6 +1472,14 @@ bool xbcloud_delete(Object_store *store, const std::string &container,
     if (skip_file(file_name, backup_name)) {
       continue;
     }
+    if (batch_size > 0) {
+      batch.push_back(obj);
+      if (batch.size() == batch_size &&
+          !delete_batch(store, container, batch, &h, &error)) {
+        return false;
+      }
+      continue;
+    }
     msg_ts("%s: Deleting %s.\n", my_progname, obj.c_str());
     if (!store->async_delete_object(
             container, obj, &h,
@@ -1095,6 +1495,10 @@ bool xbcloud_delete(Object_store *store, const std::string &container,
       return false;
     }
   }
+  if (!error && !batch.empty() &&
+      !delete_batch(store, container, batch, &h, &error)) {
+    return false;
+  }
 
   h.stop();
   thread.join();
@@ -1108,13 +1512,38 @@ bool xbcloud_delete(Object_store *store, const std::string &container,
   return !error;
 }
 
+/** Write a downloaded chunk to the output.
+@param[in]  fd         output file
+@param[in]  contents   chunk contents
+@param[in]  chunk      chunk name
+@param[in]  thread_id  id of the download thread
+@return true in case of success or false otherwise */
+static bool write_chunk(File fd, const Http_buffer &contents,
+                        const std::string &chunk, uint thread_id) {
+  if (my_write(fd,
+               reinterpret_cast<unsigned char *>(
+                   const_cast<char *>(&contents[0])),
+               contents.size(), MYF(MY_WME | MY_NABP))) {
+    msg_ts("%s: [%d] Download of file %s failed. Cannot write to output \n",
+           my_progname, thread_id, chunk.c_str());
+    return false;
+  }
+  msg_ts("%s: [%d] Download successfull %s, size %zu\n", my_progname,
+         thread_id, chunk.c_str(), contents.size());
+  return true;
+}
+
 void download_func(download_thread_ctxt_t &cntx) {
   auto thread_id = cntx.thread_id;
   File fd;
   std::thread ev;
   std::atomic<bool> *error = cntx.has_errors;
-  thread_state_t *thread_state = new struct thread_state_t;
+  thread_state_t *thread_state = new thread_state_t(opt_parallel_chunks);
+  /* chunks read from --cache-dir are written by this thread, the downloaded
+  ones by the event loop */
+  std::mutex write_mutex;
   Event_handler h(opt_parallel > 0 ? opt_parallel : 1);
+  h.set_max_concurrency(opt_max_parallel);
 
   if (opt_threads > 1) {
     char fifo_filename[FN_REFLEN];
@@ -1127,6 +1556,8 @@ void download_func(download_thread_ctxt_t &cntx) {
       error->store(true);
       goto end;
     }
+  } else if (extract_pipe != nullptr) {
+    fd = fileno(extract_pipe);
   } else {
     fd = fileno(stdout);
   }
@@ -1140,7 +1571,7 @@ void download_func(download_thread_ctxt_t &cntx) {
   while (true) {
     /* Do not queue more than what we can handle. If another thread has free
      * workable slots let it queue the file. */
-    if (thread_state->in_progress_files_size() >= opt_parallel) {
+    if (thread_state->in_progress_chunks_size() >= h.current_concurrency()) {
       std::this_thread::sleep_for(std::chrono::milliseconds(50));
       continue;
     }
@@ -1161,69 +1592,247 @@ void download_func(download_thread_ctxt_t &cntx) {
       continue;
     }
 
-    if (!thread_state->start_file(file)) {
-      /* This file is already been downloaded. skipping */
+    my_off_t id;
+    if (!thread_state->start_chunk(file, id)) {
+      /* All chunks of this file are being downloaded. skipping */
       continue;
     }
-    my_off_t id = thread_state->next_chunk(file);
     std::string chunk = build_file_name(file.name, id);
+    auto stored = manifest_objects.find(chunk);
+
+    const std::string object =
+        stored == manifest_objects.end() ? chunk : stored->second;
+
+    auto done = std::bind(
+        [&thread_state, &write_mutex](
+            bool success, const Http_buffer &contents, std::string chunk,
+            my_off_t idx, std::atomic<bool> *error, uint thread_id, File fd,
+            file_metadata_t file) {
+          std::lock_guard<std::mutex> g(write_mutex);
+          if (!success) {
+            error->store(true);
+            msg_ts("%s: [%d] Download failed. Cannot download %s.\n",
+                   my_progname, thread_id, chunk.c_str());
+          } else if (thread_state->buffer_chunk(file, idx, contents)) {
+            msg_ts("%s: [%d] Download successfull %s, size %zu, waiting "
+                   "for the previous chunks\n",
+                   my_progname, thread_id, chunk.c_str(), contents.size());
+          } else if (write_chunk(fd, contents, chunk, thread_id)) {
+            thread_state->chunk_written(file);
+            /* write the following chunks downloaded out of order */
+            Http_buffer next;
+            while (thread_state->next_pending_chunk(file, idx, next)) {
+              if (!write_chunk(fd, next, build_file_name(file.name, idx),
+                               thread_id)) {
+                error->store(true);
+                break;
+              }
+              thread_state->chunk_written(file);
+            }
+          } else {
+            error->store(true);
+          }
+          thread_state->complete_chunk(file);
+        },
+        std::placeholders::_1, std::placeholders::_2, chunk, id,
+        cntx.has_errors, thread_id, fd, file);
+
+    if (opt_cache_dir == nullptr) {
+      msg_ts("%s: [%d] Downloading %s.\n", my_progname, thread_id,
+             chunk.c_str());
+      cntx.store->async_download_object(*cntx.container, object, &h, done);
+      continue;
+    }
+
+    /* objects of --chunk-store are named by the SHA256 of their contents,
+    which is checked when they are read from the cache */
+    const std::string key =
+        stored == manifest_objects.end()
+            ? Chunk_cache::object_key(*cntx.container, object)
+            : object.substr(object.rfind('/') + 1);
+    Http_buffer cached;
+    if (chunk_cache.get(key, &cached)) {
+      if (stored == manifest_objects.end() ||
+          hex_encode(cached.sha256()) == key) {
+        msg_ts("%s: [%d] Reading %s from the cache.\n", my_progname,
+               thread_id, chunk.c_str());
+        done(true, cached);
+        continue;
+      }
+      msg_ts("%s: [%d] %s is corrupted in the cache, downloading it.\n",
+             my_progname, thread_id, chunk.c_str());
+      chunk_cache.remove(key);
+    }
 
     msg_ts("%s: [%d] Downloading %s.\n", my_progname, thread_id, chunk.c_str());
     cntx.store->async_download_object(
-        *cntx.container, chunk, &h,
-        std::bind(
-            [&thread_state](bool success, const Http_buffer &contents,
-                            std::string chunk, my_off_t idx,
-                            std::atomic<bool> *error, uint thread_id, File fd,
-                            file_metadata_t file) {
-              if (!success) {
-                error->store(true);
-                msg_ts("%s: [%d] Download failed. Cannot download %s.\n",
-                       my_progname, thread_id, chunk.c_str());
-
-              } else if (!my_write(fd,
-                                   reinterpret_cast<unsigned char *>(
-                                       const_cast<char *>(&contents[0])),
-                                   contents.size(), MYF(MY_WME | MY_NABP))) {
-                msg_ts("%s: [%d] Download successfull %s, size %zu\n",
-                       my_progname, thread_id, chunk.c_str(), contents.size());
-              } else {
-                msg_ts(
-                    "%s: [%d] Download of file %s failed. Cannot write to "
-                    "output "
-                    "\n",
-                    my_progname, thread_id, chunk.c_str());
-                error->store(true);
-              }
-              thread_state->complete_chunk(file, idx);
-            },
-            std::placeholders::_1, std::placeholders::_2, chunk, id,
-            cntx.has_errors, thread_id, fd, file));
+        *cntx.container, object, &h,
+        [done, key](bool success, const Http_buffer &contents) {
+          if (success) chunk_cache.put(key, contents);
+          done(success, contents);
+        });
   }
 
   h.stop();
   ev.join();
 
+  if (opt_max_parallel > 0) {
+    msg_ts("%s: [%d] parallel requests: %zu\n", my_progname, thread_id,
+           h.current_concurrency());
+  }
+
 end:
   delete (thread_state);
-  if (fd > 2) {
+  if (opt_threads > 1 && fd > 2) {
     my_close(fd, MYF(0));
     fd = -1;
   }
 }
 
+/**
+  Start the xbstream process of --extract-dir. It reads the stream from
+  extract_pipe, or from the named pipes with --fifo-streams.
+
+@return true in case of success or false otherwise */
+static bool start_extract() {
+  /* prefer the xbstream installed next to xbcloud */
+  char dir[FN_REFLEN];
+  size_t dir_len;
+  dirname_part(dir, my_progname, &dir_len);
+
+  std::string cmd = std::string(dir) + "xbstream -x -C '" + opt_extract_dir +
+                    "'";
+  if (opt_threads > 1) {
+    cmd += " --fifo-streams=" + std::to_string(opt_threads) + " --fifo-dir='" +
+           opt_fifo_dir + "' --fifo-timeout=" +
+           std::to_string(opt_fifo_timeout);
+  }
+  if (opt_xbstream_options != nullptr) {
+    cmd.append(" ").append(opt_xbstream_options);
+  }
+
+  msg_ts("%s: Extracting with: %s\n", my_progname, cmd.c_str());
+  extract_pipe = popen(cmd.c_str(), "w");
+  if (extract_pipe == nullptr) {
+    msg_ts("%s: Failed to start xbstream: %s\n", my_progname,
+           strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+/** Read the xtrabackup_restore_order of a backup taken with --restore-order.
+The objects of the file hold xbstream chunks, which are read back from a
+temporary file.
+
+@param [in]  store        object store
+@param [in]  container    container
+@param [in]  object_list  objects of the backup
+@param [out] order        ranks of the files
+
+@return false if the backup has no order or it cannot be read */
+static bool download_restore_order(Object_store *store,
+                                   const std::string &container,
+                                   const std::vector<std::string> &object_list,
+                                   xb::restore_order::Order *order) {
+  const std::string name = backup_name + "/" + xb::restore_order::FILENAME;
+  std::map<my_off_t, std::string> objects;
+  for (const auto &obj : object_list) {
+    my_off_t idx;
+    std::string file_name;
+    if (chunk_name_to_file_name(obj, file_name, idx) && file_name == name) {
+      objects[idx] = obj;
+    }
+  }
+  if (objects.empty()) {
+    return false;
+  }
+
+  FILE *tmp = tmpfile();
+  if (tmp == nullptr) {
+    msg_ts("%s: Cannot create a temporary file: %s\n", my_progname,
+           strerror(errno));
+    return false;
+  }
+  for (const auto &obj : objects) {
+    bool found = false;
+    auto stored = manifest_objects.find(obj.second);
+    Http_buffer contents = store->download_object(
+        container,
+        stored == manifest_objects.end() ? obj.second : stored->second, found);
+    if (!found ||
+        fwrite(contents.begin(), 1, contents.size(), tmp) != contents.size()) {
+      msg_ts("%s: Cannot download %s.\n", my_progname, obj.second.c_str());
+      fclose(tmp);
+      return false;
+    }
+  }
+  fflush(tmp);
+  rewind(tmp);
+
+  xb_rstream_t *stream = xb_stream_read_new_fd(dup(fileno(tmp)));
+  xb_rstream_chunk_t chunk;
+  xb_rstream_result_t res;
+  std::string text;
+  bool ok = true;
+
+  memset(&chunk, 0, sizeof(chunk));
+  while ((res = xb_stream_read_chunk(stream, &chunk)) ==
+         XB_STREAM_READ_CHUNK) {
+    if (chunk.type != XB_CHUNK_TYPE_PAYLOAD) {
+      continue;
+    }
+    if (xb_stream_validate_checksum(&chunk) != XB_STREAM_READ_CHUNK) {
+      ok = false;
+      break;
+    }
+    if (text.size() < chunk.offset + chunk.length) {
+      text.resize(chunk.offset + chunk.length);
+    }
+    memcpy(&text[chunk.offset], chunk.data, chunk.length);
+  }
+  my_free(chunk.raw_data);
+  my_free(chunk.sparse_map);
+  xb_stream_read_done(stream);
+  fclose(tmp);
+
+  if (!ok || res == XB_STREAM_READ_ERROR) {
+    msg_ts("%s: Cannot read %s.\n", my_progname, name.c_str());
+    return false;
+  }
+
+  return xb::restore_order::parse(text, order);
+}
+
 bool xbcloud_download(Object_store *store, const std::string &container,
                       const std::string &backup_name) {
   std::vector<std::string> object_list;
   std::atomic<bool> has_errors{false};
   char fullpath[FN_REFLEN];
-  if (!store->list_objects_in_directory(container, backup_name, object_list) ||
+  bool manifest_found = false;
+  Http_buffer manifest = store->download_object(
+      container, backup_name + ".manifest", manifest_found);
+  if (manifest_found) {
+    parse_manifest(manifest, backup_name, object_list, &manifest_objects);
+  }
+  if ((!manifest_found && !store->list_objects_in_directory(
+                              container, backup_name, object_list)) ||
       object_list.size() == 0) {
     msg_ts("%s: Download failed. Cannot list %s.\n", my_progname,
            backup_name.c_str());
     return false;
   }
+  /* download the files in the order recorded by the backup, if any */
+  xb::restore_order::Order order;
   struct global_list_t *global_list = new struct global_list_t;
+  if (download_restore_order(store, container, object_list, &order)) {
+    msg_ts("%s: Downloading %zu files in the order of %s.\n", my_progname,
+           order.size(), xb::restore_order::FILENAME);
+    const size_t prefix_len = backup_name.length() + 1;
+    global_list->rank = [&order, prefix_len](const std::string &file_name) {
+      return xb::restore_order::rank(order, file_name.substr(prefix_len));
+    };
+  }
   for (const auto &obj : object_list) {
     my_off_t idx;
     std::string file_name;
@@ -1257,6 +1866,18 @@ bool xbcloud_download(Object_store *store, const std::string &container,
         "to open the files for reading.\n",
         opt_threads, opt_fifo_timeout);
   }
+
+  if (opt_cache_dir != nullptr &&
+      !chunk_cache.init(opt_cache_dir, opt_cache_size)) {
+    delete (global_list);
+    return false;
+  }
+
+  if (opt_extract_dir != nullptr && !start_extract()) {
+    delete (global_list);
+    return false;
+  }
+
   /* Create data copying threads */
   download_thread_ctxt_t *data_threads = (download_thread_ctxt_t *)my_malloc(
       PSI_NOT_INSTRUMENTED, sizeof(download_thread_ctxt_t) * (opt_threads + 1),
@@ -1275,11 +1896,25 @@ bool xbcloud_download(Object_store *store, const std::string &container,
     threads.at(i).join();
   }
 
+  if (extract_pipe != nullptr) {
+    int status = pclose(extract_pipe);
+    extract_pipe = nullptr;
+    if (status != 0) {
+      msg_ts("%s: xbstream failed to extract the backup into %s.\n",
+             my_progname, opt_extract_dir);
+      has_errors.store(true);
+    }
+  }
+
   if (has_errors.load()) {
     msg_ts("%s: Download failed.\n", my_progname);
   } else {
     msg_ts("%s: Download completed.\n", my_progname);
   }
+  if (opt_cache_dir != nullptr) {
+    msg_ts("%s: %llu bytes cached in %s.\n", my_progname,
+           (unsigned long long)chunk_cache.size(), opt_cache_dir);
+  }
 
   delete (global_list);
   my_free(data_threads);
@@ -1506,26 +2141,38 @@ int main(int argc, char **argv) {
     std::string storage_class =
         opt_google_storage_class != nullptr ? opt_google_storage_class : "";
 
-    object_store = std::unique_ptr<Object_store>(new S3_object_store(
-        &http_client, region, access_key, secret_key, session_token,
-        storage_class, opt_max_retries, opt_max_backoff,
-        opt_google_endpoint != nullptr ? opt_google_endpoint
-                                       : "https://storage.googleapis.com/",
-        LOOKUP_DNS, S3_V4));
-
     if (opt_google_bucket == nullptr) {
       msg_ts("%s: Google bucket is not specified.\n", my_progname);
       return EXIT_FAILURE;
     }
 
-    reinterpret_cast<S3_object_store *>(object_store.get())
-        ->set_extra_http_headers(extra_http_headers);
-
     container_name = opt_google_bucket;
 
-    if (!reinterpret_cast<S3_object_store *>(object_store.get())
-             ->probe_api_version_and_lookup(container_name)) {
-      return EXIT_FAILURE;
+    if (opt_google_api == GOOGLE_JSON) {
+      object_store = std::unique_ptr<Object_store>(new Gcs_object_store(
+          &http_client,
+          opt_google_endpoint != nullptr ? opt_google_endpoint : "",
+          opt_google_oauth_token != nullptr ? opt_google_oauth_token : "",
+          opt_google_project != nullptr ? opt_google_project : "",
+          opt_google_region != nullptr ? opt_google_region : "",
+          storage_class, opt_max_retries, opt_max_backoff));
+      reinterpret_cast<Gcs_object_store *>(object_store.get())
+          ->set_extra_http_headers(extra_http_headers);
+    } else {
+      object_store = std::unique_ptr<Object_store>(new S3_object_store(
+          &http_client, region, access_key, secret_key, session_token,
+          storage_class, opt_max_retries, opt_max_backoff,
+          opt_google_endpoint != nullptr ? opt_google_endpoint
+                                         : "https://storage.googleapis.com/",
+          LOOKUP_DNS, S3_V4));
+
+      reinterpret_cast<S3_object_store *>(object_store.get())
+          ->set_extra_http_headers(extra_http_headers);
+
+      if (!reinterpret_cast<S3_object_store *>(object_store.get())
+               ->probe_api_version_and_lookup(container_name)) {
+        return EXIT_FAILURE;
+      }
     }
   } else if (opt_storage == AZURE) {
     std::string storage_account =
@@ -21,36 +21,53 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 struct file_metadata_t {
   my_off_t last_chunk;
   my_off_t next_chunk;
+  /* next chunk to write to the output */
+  my_off_t next_write;
   std::string name;
 };
 
-/** struct to hold state of current per thread in progress files. This avoids
- * multiple chunks from the same file to be downloaded in parallel */
+/** struct to hold state of current per thread in progress files. Up to
+ * max_chunks chunks of the same file are downloaded in parallel, chunks
+ * completed out of order are kept until the preceding ones are written */
 struct thread_state_t {
   std::mutex m;
-  /* files with active chunks been downloaded (waiting http client to complete
-   * the download) */
-  std::set<std::string> in_progress_files;
+  /* number of chunks of each file been downloaded (waiting http client to
+   * complete the download) */
+  std::unordered_map<std::string, size_t> in_progress_files;
+
+  /* number of chunks been downloaded for all files */
+  size_t in_progress_chunks{0};
+
+  /* maximum number of chunks of the same file downloaded in parallel */
+  size_t max_chunks{1};
 
   /* list of files allocated for this thread */
   std::unordered_map<std::string, file_metadata_t> file_list;
 
+  /* downloaded chunks waiting for the previous chunks of the file */
+  std::unordered_map<std::string,
+                     std::map<my_off_t, xbcloud::Http_buffer>>
+      pending;
+
+  explicit thread_state_t(size_t max_chunks)
+      : max_chunks(max_chunks > 0 ? max_chunks : 1) {}
+
   /**
-  Check if there is any file been downloaded.
+  Check if there is any chunk been downloaded.
 
-  @return false if there are files been downloaded, true otherwise. */
+  @return false if there are chunks been downloaded, true otherwise. */
   bool in_progress_files_empty() {
     std::lock_guard<std::mutex> g(m);
-    return in_progress_files.empty();
+    return in_progress_chunks == 0;
   }
 
   /**
-  Check the number of files been downloaded.
+  Check the number of chunks been downloaded.
 
-  @return Number of files in in_progress_files list. */
-  my_off_t in_progress_files_size() {
+  @return Number of chunks been downloaded for all files. */
+  my_off_t in_progress_chunks_size() {
     std::lock_guard<std::mutex> g(m);
-    return in_progress_files.size();
+    return in_progress_chunks;
   }
 
   /**
@@ -64,71 +81,119 @@ struct thread_state_t {
 
   /**
   Get the next available file to be downloaded. The file is on file_list
-  (allocated to this thread) and has no in progress chunks been downloaded.
+  (allocated to this thread), has chunks left to request and less than
+  max_chunks chunks been downloaded.
 
   @param [in/out]  file  file available to download.
 
   @return true if a file has been allocated, false otherwise */
   bool next_file(file_metadata_t &file) {
     std::lock_guard<std::mutex> g(m);
-    if (!file_list.empty()) {
-      for (auto it : file_list) {
-        if (in_progress_files.count(it.first) == 0) {
-          file = it.second;
-          return true;
-        }
+    for (const auto &it : file_list) {
+      if (it.second.next_chunk > it.second.last_chunk) continue;
+      auto in_progress = in_progress_files.find(it.first);
+      if (in_progress == in_progress_files.end() ||
+          in_progress->second < max_chunks) {
+        file = it.second;
+        return true;
       }
     }
     return false;
   }
 
   /**
-  Get the next chunk for a given file.
+  Attempt to reserve the next chunk of a file with intend to start
+  downloading it. The file is added into file_list if it is not there yet.
 
-  @param [in]  file  file to get the next chunk.
+  @param [in]   file  file to attempt to reserve.
+  @param [out]  idx   chunk index to download.
 
-  @return id of next available chunk */
-  my_off_t next_chunk(file_metadata_t &file) {
+  @return true if a chunk has been reserved, false otherwise. */
+  bool start_chunk(const file_metadata_t &file, my_off_t &idx) {
     std::lock_guard<std::mutex> g(m);
-    auto it = file_list.find(file.name);
-    assert(it != file_list.end());
-    return it->second.next_chunk;
+    auto it = file_list.insert({file.name, file}).first;
+    size_t &in_progress = in_progress_files[file.name];
+    if (in_progress >= max_chunks ||
+        it->second.next_chunk > it->second.last_chunk) {
+      if (in_progress == 0) in_progress_files.erase(file.name);
+      return false;
+    }
+    idx = it->second.next_chunk++;
+    ++in_progress;
+    ++in_progress_chunks;
+    return true;
   }
 
   /**
-  Attempt to reserve ownsership of a file with intend to start downloading it.
-  This will add the file into both in_progress_files list and file_list list.
+  Keep a downloaded chunk until the preceding chunks of the file are written.
 
-  @param [in]  file  file to attempt to reserve.
+  @param [in]  file      file of the chunk.
+  @param [in]  idx       chunk index.
+  @param [in]  contents  chunk contents.
 
-  @return true if the file is not already in progress, false otherwise. */
-  bool start_file(const file_metadata_t &file) {
+  @return false if the chunk is the next one to write and has not been
+  kept, true otherwise. */
+  bool buffer_chunk(const file_metadata_t &file, const my_off_t &idx,
+                    const xbcloud::Http_buffer &contents) {
     std::lock_guard<std::mutex> g(m);
-    if (in_progress_files.count(file.name) > 0) {
-      return false;
-    }
-    in_progress_files.insert(file.name);
-    file_list.insert({file.name, file});
+    auto it = file_list.find(file.name);
+    assert(it != file_list.end());
+    if (it->second.next_write == idx) return false;
+    xbcloud::Http_buffer copy;
+    copy.append(contents);
+    pending[file.name].emplace(idx, std::move(copy));
     return true;
   }
 
   /**
-  Indicates the current chunk of a given file has been completed.
-  This will remove the file from in_progress_files list. If this is the last
-  chunk for this file, it will remove the file from file_list otherwise advance
-  the next_chunk of the file.
-
-  @param [in]  file  filen to complete chunk.
-  @param [in]  idx   chunk index that we have completed. */
-  void complete_chunk(const file_metadata_t &file, const my_off_t &idx) {
+  Indicates the next chunk of a given file has been written. If this is the
+  last chunk for this file, it will remove the file from file_list.
+
+  @param [in]  file  file of the chunk. */
+  void chunk_written(const file_metadata_t &file) {
     std::lock_guard<std::mutex> g(m);
-    in_progress_files.erase(file.name);
     auto it = file_list.find(file.name);
     assert(it != file_list.end());
-    if (file.last_chunk == idx)
+    if (it->second.next_write++ == file.last_chunk) {
       file_list.erase(it);
-    else
-      it->second.next_chunk++;
+      pending.erase(file.name);
+    }
+  }
+
+  /**
+  Get the next chunk to write of a given file if it has been downloaded
+  already.
+
+  @param [in]   file      file to get the chunk of.
+  @param [out]  idx       chunk index.
+  @param [out]  contents  chunk contents.
+
+  @return true if the chunk has been downloaded, false otherwise. */
+  bool next_pending_chunk(const file_metadata_t &file, my_off_t &idx,
+                          xbcloud::Http_buffer &contents) {
+    std::lock_guard<std::mutex> g(m);
+    auto it = file_list.find(file.name);
+    if (it == file_list.end()) return false;
+    auto chunks = pending.find(file.name);
+    if (chunks == pending.end()) return false;
+    auto chunk = chunks->second.find(it->second.next_write);
+    if (chunk == chunks->second.end()) return false;
+    idx = chunk->first;
+    contents = std::move(chunk->second);
+    chunks->second.erase(chunk);
+    return true;
+  }
+
+  /**
+  Indicates a chunk of a given file is not been downloaded anymore.
+
+  @param [in]  file  file of the chunk. */
+  void complete_chunk(const file_metadata_t &file) {
+    std::lock_guard<std::mutex> g(m);
+    auto it = in_progress_files.find(file.name);
+    assert(it != in_progress_files.end());
+    if (--it->second == 0) in_progress_files.erase(it);
+    --in_progress_chunks;
   }
 };
 
@@ -137,6 +202,10 @@ struct global_list_t {
   std::mutex m;
   /* Global list of files to be downloaded*/
   std::unordered_map<std::string, file_metadata_t> files;
+  /* files by rank, the next one downloaded first */
+  std::set<std::pair<size_t, std::string>> queue;
+  /* rank of a file, the files of the same rank are downloaded by name */
+  std::function<size_t(const std::string &)> rank;
 
   /**
   Check if the file list is empty.
@@ -158,9 +227,11 @@ struct global_list_t {
   bool next_file(file_metadata_t &file) {
     std::lock_guard<std::mutex> g(m);
     if (!files.empty()) {
-      auto it = files.begin();
+      auto next = queue.begin();
+      auto it = files.find(next->second);
       file = it->second;
       files.erase(it);
+      queue.erase(next);
       return true;
     }
     return false;
@@ -178,7 +249,9 @@ struct global_list_t {
       file.name = filename;
       file.last_chunk = idx;
       file.next_chunk = 0;
+      file.next_write = 0;
       files.insert({filename, file});
+      queue.insert({rank ? rank(filename) : 0, filename});
     } else {
       if (files[filename].last_chunk < idx) files[filename].last_chunk = idx;
     }
@@ -27,8 +27,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "common.h"
 #include "crc_glue.h"
 #include "datasink.h"
+#include "ds_async.h"
 #include "ds_decrypt.h"
 #include "ds_encrypt.h"
+#include "ds_local.h"
 #include "msg.h"
 #include "xbcrypt_common.h"
 #include "xtrabackup_version.h"
@@ -54,7 +56,12 @@ static char *opt_encrypt_key = NULL;
 static ulonglong opt_encrypt_chunk_size = 0;
 static bool opt_verbose = false;
 static uint opt_encrypt_threads = 1;
+static bool opt_encrypt_gcm = false;
 static uint opt_read_buffer_size = 0;
+static ulonglong opt_queue_size = 0;
+static bool opt_direct = false;
+
+enum { OPT_QUEUE_SIZE = 256, OPT_DIRECT };
 
 static struct my_option my_long_options[] = {
     {"help", '?', "Display this help and exit.", 0, 0, 0, GET_NO_ARG, NO_ARG, 0,
@@ -101,10 +108,29 @@ static struct my_option my_long_options[] = {
      &opt_encrypt_threads, &opt_encrypt_threads, 0, GET_UINT, OPT_ARG, 1, 1,
      UINT_MAX, 0, 0, 0},
 
+    {"encrypt-gcm", 'g',
+     "Encrypt with AES-GCM, the chunks can only be decrypted by this or newer"
+     " versions. Decryption detects the format of each chunk.",
+     &opt_encrypt_gcm, &opt_encrypt_gcm, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0,
+     0},
+
     {"read-buffer-size", 'r', "Read buffer size. The defaut value is 10Mb.",
      &opt_read_buffer_size, &opt_read_buffer_size, 0, GET_UINT, OPT_ARG,
      10 * 1024 * 1024, 1, UINT_MAX, 0, 0, 0},
 
+    {"queue-size", OPT_QUEUE_SIZE,
+     "Queue up to this many bytes read ahead of the encryption or decryption "
+     "threads, and as many bytes of their output for a writer thread, so "
+     "that reading, the cipher work and writing overlap. 0 runs the three "
+     "one after the other. The default value is 64Mb.",
+     &opt_queue_size, &opt_queue_size, 0, GET_ULL, REQUIRED_ARG,
+     64 * 1024 * 1024, 0, ULLONG_MAX, 0, 1024 * 1024, 0},
+
+    {"direct", OPT_DIRECT,
+     "Write the output file with O_DIRECT, bypassing the page cache. Needs "
+     "--output.",
+     &opt_direct, &opt_direct, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+
     {"verbose", 'v', "Display verbose status output.", &opt_verbose,
      &opt_verbose, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
     {0, 0, 0, 0, 0, 0, GET_NO_ARG, NO_ARG, 0, 0, 0, 0, 0, 0}};
@@ -122,6 +148,7 @@ datasink_t datasink_decompress_zstd;
 datasink_t datasink_tmpfile;
 datasink_t datasink_buffer;
 datasink_t datasink_fifo;
+datasink_t datasink_tee;
 
 static int get_options(int *argc, char ***argv);
 
@@ -141,6 +168,8 @@ int main(int argc, char **argv) {
   ds_ctxt_t *datasink = NULL;
   ds_ctxt_t *output_ds = NULL;
   ds_ctxt_t *crypto_ds = NULL;
+  ds_ctxt_t *read_ahead_ds = NULL;
+  ds_ctxt_t *write_ds = NULL;
   ds_file_t *fileout = NULL;
   char output_file_buf[FN_REFLEN] = {"stdout"};
   const char *output_file = output_file_buf;
@@ -191,8 +220,14 @@ int main(int argc, char **argv) {
 
     dirname_part(dirpath, output_file, &dirpath_len);
     output_ds = ds_create(dirpath, DS_TYPE_LOCAL);
+    if (output_ds && opt_direct) {
+      ds_local_set_direct(output_ds, true);
+    }
   } else {
     if (opt_verbose) msg("%s: output to standard output.\n", my_progname);
+    if (opt_direct) {
+      msg("%s: --direct requires --output, ignored.\n", my_progname);
+    }
     output_ds = ds_create(".", DS_TYPE_STDOUT);
   }
   if (!output_ds) {
@@ -214,6 +249,7 @@ int main(int argc, char **argv) {
     ds_encrypt_encrypt_chunk_size = opt_encrypt_chunk_size;
     ds_encrypt_encrypt_threads = opt_encrypt_threads;
     ds_encrypt_modify_file_extension = false;
+    ds_encrypt_gcm = opt_encrypt_gcm;
     if (!(crypto_ds = ds_create(".", DS_TYPE_ENCRYPT))) {
       goto cleanup;
     }
@@ -225,6 +261,21 @@ int main(int argc, char **argv) {
   ds_set_pipe(crypto_ds, output_ds);
   datasink = crypto_ds;
 
+  if (opt_queue_size > 0) {
+    /* the output of the cipher threads is written while they process the
+    next buffer */
+    write_ds = ds_create(".", DS_TYPE_ASYNC);
+    ds_async_set_size(write_ds, opt_queue_size);
+    ds_set_pipe(write_ds, output_ds);
+    ds_set_pipe(crypto_ds, write_ds);
+
+    /* and the input is read ahead of them */
+    read_ahead_ds = ds_create(".", DS_TYPE_ASYNC);
+    ds_async_set_size(read_ahead_ds, opt_queue_size);
+    ds_set_pipe(read_ahead_ds, crypto_ds);
+    datasink = read_ahead_ds;
+  }
+
   memset(&mystat, 0, sizeof(mystat));
   fileout = ds_open(datasink, output_file, &mystat);
   if (!fileout) {
@@ -246,9 +297,15 @@ cleanup:
   if (fileout && ds_close(fileout)) {
     result = EXIT_FAILURE;
   }
+  if (read_ahead_ds) {
+    ds_destroy(read_ahead_ds);
+  }
   if (crypto_ds) {
     ds_destroy(crypto_ds);
   }
+  if (write_ds) {
+    ds_destroy(write_ds);
+  }
 
   if (output_ds) {
     ds_destroy(output_ds);
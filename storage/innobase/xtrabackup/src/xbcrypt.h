@@ -22,18 +22,31 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #define XBCRYPT_H
 
 #include <my_base.h>
+#include <sys/uio.h>
 #include "common.h"
 #include "template_utils.h"
 
 #define XB_CRYPT_CHUNK_MAGIC1 "XBCRYP01"
 #define XB_CRYPT_CHUNK_MAGIC2 "XBCRYP02"
 #define XB_CRYPT_CHUNK_MAGIC3 "XBCRYP03" /* must be same size as ^^ */
+#define XB_CRYPT_CHUNK_MAGIC4 "XBCRYP04" /* AES-GCM */
 #define XB_CRYPT_CHUNK_MAGIC_CURRENT XB_CRYPT_CHUNK_MAGIC3
 #define XB_CRYPT_CHUNK_MAGIC_SIZE (sizeof(XB_CRYPT_CHUNK_MAGIC1) - 1)
 
 #define XB_CRYPT_HASH GCRY_MD_SHA256
 #define XB_CRYPT_HASH_LEN 32
 
+/* Version 4 chunks are encrypted with AES-GCM instead of AES-CTR. The
+authentication tag replaces the hash of the data and the checksum, which is
+stored as 0, so the data is encrypted and verified in a single pass. */
+#define XB_CRYPT_GCM_IV_LEN 12
+#define XB_CRYPT_GCM_TAG_LEN 16
+
+/* Chunk header: magic, reserved, original size, encrypted size, checksum and
+iv size. The iv and the encrypted data follow. */
+#define XB_CRYPT_CHUNK_HEADER_SIZE \
+  (XB_CRYPT_CHUNK_MAGIC_SIZE + 8 + 8 + 8 + 4 + 8)
+
 /******************************************************************************
 Write interface */
 typedef struct xb_wcrypt_struct xb_wcrypt_t;
@@ -42,14 +55,26 @@ typedef struct xb_wcrypt_struct xb_wcrypt_t;
 typedef ssize_t xb_crypt_write_callback(void *userdata, const void *buf,
                                         size_t len);
 
+/* Gather write callback, must return # of bytes written or -1 on error */
+typedef ssize_t xb_crypt_writev_callback(void *userdata,
+                                         const struct iovec *iov, int iovcnt);
+
+/* Chunks are written with onwritev if given, otherwise with one onwrite call
+per chunk part */
 xb_wcrypt_t *xb_crypt_write_open(void *userdata,
-                                 xb_crypt_write_callback *onwrite);
+                                 xb_crypt_write_callback *onwrite,
+                                 xb_crypt_writev_callback *onwritev);
 
 /* Takes buffer, original length, encrypted length iv and iv length, formats
-   output buffer and calls write callback.
+   output buffer and calls write callback. gcm selects the version 4 format.
    Returns 0 on success, 1 on error */
 int xb_crypt_write_chunk(xb_wcrypt_t *crypt, const void *buf, size_t olen,
-                         size_t elen, const void *iv, size_t ivlen);
+                         size_t elen, const void *iv, size_t ivlen, bool gcm);
+
+/* Formats the XB_CRYPT_CHUNK_HEADER_SIZE bytes of the header of a chunk of
+   encrypted data, for chunks assembled by the caller */
+void xb_crypt_format_chunk_header(uchar *header, const void *buf, size_t olen,
+                                  size_t elen, size_t ivlen, bool gcm);
 
 /* Returns 0 on success, 1 on error */
 int xb_crypt_write_close(xb_wcrypt_t *crypt);
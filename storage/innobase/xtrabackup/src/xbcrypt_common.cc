@@ -157,11 +157,12 @@ gcry_error_t xb_crypt_init(uint *iv_len) {
   return 0;
 }
 
-gcry_error_t xb_crypt_cipher_open(gcry_cipher_hd_t *cipher_handle) {
+static gcry_error_t xb_crypt_cipher_open_mode(gcry_cipher_hd_t *cipher_handle,
+                                              uint mode) {
   if (encrypt_algo != GCRY_CIPHER_NONE) {
     gcry_error_t gcry_error;
 
-    gcry_error = gcry_cipher_open(cipher_handle, encrypt_algo, encrypt_mode, 0);
+    gcry_error = gcry_cipher_open(cipher_handle, encrypt_algo, mode, 0);
     if (gcry_error) {
       msg("encryption: unable to open libgcrypt cipher - %s : %s\n",
           gcry_strsource(gcry_error), gcry_strerror(gcry_error));
@@ -182,6 +183,14 @@ gcry_error_t xb_crypt_cipher_open(gcry_cipher_hd_t *cipher_handle) {
   return 0;
 }
 
+gcry_error_t xb_crypt_cipher_open(gcry_cipher_hd_t *cipher_handle) {
+  return xb_crypt_cipher_open_mode(cipher_handle, encrypt_mode);
+}
+
+gcry_error_t xb_crypt_cipher_open_gcm(gcry_cipher_hd_t *cipher_handle) {
+  return xb_crypt_cipher_open_mode(cipher_handle, GCRY_CIPHER_MODE_GCM);
+}
+
 /************************************************************************
 Mask the argument value. This is to avoid showing secret data on command
 line output
@@ -270,7 +279,10 @@ gcry_error_t xb_crypt_encrypt(gcry_cipher_hd_t cipher_handle, const uchar *from,
   of XB_CRYPT_HASH hashing algorithm output */
   xb_ad(gcry_md_get_algo_dlen(XB_CRYPT_HASH) == XB_CRYPT_HASH_LEN);
 
-  memcpy(to, from, from_len);
+  /* the data may be encrypted in place */
+  if (to != from) {
+    memcpy(to, from, from_len);
+  }
   gcry_md_hash_buffer(XB_CRYPT_HASH, to + from_len, from, from_len);
 
   *to_len = from_len;
@@ -306,6 +318,97 @@ gcry_error_t xb_crypt_encrypt(gcry_cipher_hd_t cipher_handle, const uchar *from,
   return 0;
 }
 
+gcry_error_t xb_crypt_encrypt_gcm(gcry_cipher_hd_t cipher_handle,
+                                  const uchar *from, size_t from_len,
+                                  uchar *to, size_t *to_len, uchar *iv) {
+  gcry_error_t gcry_error;
+
+  *to_len = from_len + XB_CRYPT_GCM_TAG_LEN;
+
+  xb_crypt_create_iv(iv, XB_CRYPT_GCM_IV_LEN);
+
+  if (encrypt_algo == GCRY_CIPHER_NONE) {
+    if (to != from) {
+      memcpy(to, from, from_len);
+    }
+    memset(to + from_len, 0, XB_CRYPT_GCM_TAG_LEN);
+    return 0;
+  }
+
+  gcry_error = gcry_cipher_reset(cipher_handle);
+  if (!gcry_error) {
+    gcry_error = gcry_cipher_setiv(cipher_handle, iv, XB_CRYPT_GCM_IV_LEN);
+  }
+  if (gcry_error) {
+    msg("encrypt: unable to set cipher iv - %s : %s\n",
+        gcry_strsource(gcry_error), gcry_strerror(gcry_error));
+    return gcry_error;
+  }
+
+  /* the data may be encrypted in place */
+  gcry_error = gcry_cipher_encrypt(cipher_handle, to, from_len,
+                                   to != from ? from : nullptr,
+                                   to != from ? from_len : 0);
+  if (!gcry_error) {
+    gcry_error =
+        gcry_cipher_gettag(cipher_handle, to + from_len, XB_CRYPT_GCM_TAG_LEN);
+  }
+  if (gcry_error) {
+    msg("encrypt: unable to encrypt buffer - %s : %s\n",
+        gcry_strsource(gcry_error), gcry_strerror(gcry_error));
+    return gcry_error;
+  }
+
+  return 0;
+}
+
+gcry_error_t xb_crypt_decrypt_gcm(gcry_cipher_hd_t cipher_handle,
+                                  const uchar *from, size_t from_len,
+                                  uchar *to, size_t *to_len, const uchar *iv,
+                                  size_t iv_len) {
+  gcry_error_t gcry_error;
+
+  if (from_len < XB_CRYPT_GCM_TAG_LEN) {
+    msg("%s:encryption: chunk is too short for the authentication tag\n",
+        my_progname);
+    return 1;
+  }
+  *to_len = from_len - XB_CRYPT_GCM_TAG_LEN;
+
+  if (encrypt_algo == GCRY_CIPHER_NONE) {
+    memcpy(to, from, *to_len);
+    return 0;
+  }
+
+  gcry_error = gcry_cipher_reset(cipher_handle);
+  if (!gcry_error) {
+    gcry_error = gcry_cipher_setiv(cipher_handle, iv, iv_len);
+  }
+  if (gcry_error) {
+    msg("%s:encryption: unable to set cipher iv - %s : %s\n", my_progname,
+        gcry_strsource(gcry_error), gcry_strerror(gcry_error));
+    return gcry_error;
+  }
+
+  gcry_error =
+      gcry_cipher_decrypt(cipher_handle, to, *to_len, from, *to_len);
+  if (gcry_error) {
+    msg("%s:encryption: unable to decrypt chunk - %s : %s\n", my_progname,
+        gcry_strsource(gcry_error), gcry_strerror(gcry_error));
+    return gcry_error;
+  }
+
+  gcry_error = gcry_cipher_checktag(cipher_handle, from + *to_len,
+                                    XB_CRYPT_GCM_TAG_LEN);
+  if (gcry_error) {
+    msg("%s:%s invalid authentication tag. Wrong encrytion key specified?\n",
+        my_progname, __FUNCTION__);
+    return gcry_error;
+  }
+
+  return 0;
+}
+
 void get_env_value(char *&var, const char *env) {
   char *val;
   if (var == nullptr && (val = getenv(env)) != nullptr) {
@@ -50,6 +50,9 @@ gcry_error_t xb_crypt_init(uint *iv_len);
 /* Setup gcrypt cipher */
 gcry_error_t xb_crypt_cipher_open(gcry_cipher_hd_t *cipher_handle);
 
+/* Setup gcrypt cipher for the AES-GCM chunks of version 4 */
+gcry_error_t xb_crypt_cipher_open_gcm(gcry_cipher_hd_t *cipher_handle);
+
 /* Close gcrypt cipher */
 void xb_crypt_cipher_close(gcry_cipher_hd_t cipher_handle);
 
@@ -67,11 +70,25 @@ gcry_error_t xb_crypt_decrypt(gcry_cipher_hd_t cipher_handle, const uchar *from,
                               const uchar *iv, size_t iv_len,
                               bool hash_appended);
 
-/* Encrypt buffer */
+/* Encrypt buffer, to may be from. to must have room for from_len +
+XB_CRYPT_HASH_LEN bytes. */
 gcry_error_t xb_crypt_encrypt(gcry_cipher_hd_t cipher_handle, const uchar *from,
                               size_t from_len, uchar *to, size_t *to_len,
                               uchar *iv);
 
+/* Encrypt buffer with AES-GCM, to may be from. A fresh iv of
+XB_CRYPT_GCM_IV_LEN bytes is created and the authentication tag is appended,
+to must have room for from_len + XB_CRYPT_GCM_TAG_LEN bytes. */
+gcry_error_t xb_crypt_encrypt_gcm(gcry_cipher_hd_t cipher_handle,
+                                  const uchar *from, size_t from_len,
+                                  uchar *to, size_t *to_len, uchar *iv);
+
+/* Decrypt an AES-GCM buffer and verify its authentication tag */
+gcry_error_t xb_crypt_decrypt_gcm(gcry_cipher_hd_t cipher_handle,
+                                  const uchar *from, size_t from_len,
+                                  uchar *to, size_t *to_len, const uchar *iv,
+                                  size_t iv_len);
+
 /* Get the enviorment variable env value into var */
 void get_env_value(char *&var, const char *env);
 
@@ -26,10 +26,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 struct xb_wcrypt_struct {
   void *userdata;
   xb_crypt_write_callback *write;
+  xb_crypt_writev_callback *writev;
 };
 
 xb_wcrypt_t *xb_crypt_write_open(void *userdata,
-                                 xb_crypt_write_callback *onwrite) {
+                                 xb_crypt_write_callback *onwrite,
+                                 xb_crypt_writev_callback *onwritev) {
   xb_wcrypt_t *crypt;
 
   xb_ad(onwrite);
@@ -39,28 +41,17 @@ xb_wcrypt_t *xb_crypt_write_open(void *userdata,
 
   crypt->userdata = userdata;
   crypt->write = onwrite;
+  crypt->writev = onwritev;
 
   return crypt;
 }
 
-int xb_crypt_write_chunk(xb_wcrypt_t *crypt, const void *buf, size_t olen,
-                         size_t elen, const void *iv, size_t ivlen) {
-  uchar tmpbuf[XB_CRYPT_CHUNK_MAGIC_SIZE + 8 + 8 + 8 + 4 + 8];
-  uchar *ptr;
-  ulong checksum;
-
-  xb_ad(olen <= INT_MAX);
-  if (olen > INT_MAX) return 0;
-
-  xb_ad(elen <= INT_MAX);
-  if (elen > INT_MAX) return 0;
+void xb_crypt_format_chunk_header(uchar *header, const void *buf, size_t olen,
+                                  size_t elen, size_t ivlen, bool gcm) {
+  uchar *ptr = header;
 
-  xb_ad(ivlen <= INT_MAX);
-  if (ivlen > INT_MAX) return 0;
-
-  ptr = tmpbuf;
-
-  memcpy(ptr, XB_CRYPT_CHUNK_MAGIC_CURRENT, XB_CRYPT_CHUNK_MAGIC_SIZE);
+  memcpy(ptr, gcm ? XB_CRYPT_CHUNK_MAGIC4 : XB_CRYPT_CHUNK_MAGIC_CURRENT,
+         XB_CRYPT_CHUNK_MAGIC_SIZE);
   ptr += XB_CRYPT_CHUNK_MAGIC_SIZE;
 
   int8store(ptr, (ulonglong)0); /* reserved */
@@ -72,14 +63,47 @@ int xb_crypt_write_chunk(xb_wcrypt_t *crypt, const void *buf, size_t olen,
   int8store(ptr, (ulonglong)elen); /* encrypted (actual) size */
   ptr += 8;
 
-  checksum = crc32_iso3309(0, static_cast<const uchar *>(buf), elen);
+  /* the authentication tag of version 4 chunks covers the data */
+  const ulong checksum =
+      gcm ? 0 : crc32_iso3309(0, static_cast<const uchar *>(buf), elen);
   int4store(ptr, checksum); /* checksum */
   ptr += 4;
 
   int8store(ptr, (ulonglong)ivlen); /* iv size */
   ptr += 8;
 
-  xb_ad(ptr <= tmpbuf + sizeof(tmpbuf));
+  xb_ad(ptr == header + XB_CRYPT_CHUNK_HEADER_SIZE);
+}
+
+int xb_crypt_write_chunk(xb_wcrypt_t *crypt, const void *buf, size_t olen,
+                         size_t elen, const void *iv, size_t ivlen, bool gcm) {
+  uchar tmpbuf[XB_CRYPT_CHUNK_HEADER_SIZE];
+  uchar *ptr;
+
+  xb_ad(olen <= INT_MAX);
+  if (olen > INT_MAX) return 0;
+
+  xb_ad(elen <= INT_MAX);
+  if (elen > INT_MAX) return 0;
+
+  xb_ad(ivlen <= INT_MAX);
+  if (ivlen > INT_MAX) return 0;
+
+  xb_crypt_format_chunk_header(tmpbuf, buf, olen, elen, ivlen, gcm);
+  ptr = tmpbuf + XB_CRYPT_CHUNK_HEADER_SIZE;
+
+  if (crypt->writev != NULL) {
+    /* header, iv and payload in a single write */
+    const struct iovec iov[] = {
+        {tmpbuf, static_cast<size_t>(ptr - tmpbuf)},
+        {const_cast<void *>(iv), ivlen},
+        {const_cast<void *>(buf), elen}};
+
+    if (crypt->writev(crypt->userdata, iov, array_elements(iov)) == -1)
+      return 1;
+
+    return 0;
+  }
 
   if (crypt->write(crypt->userdata, tmpbuf, ptr - tmpbuf) == -1) return 1;
 
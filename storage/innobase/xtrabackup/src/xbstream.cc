@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 #include "xbstream.h"
 #include <gcrypt.h>
+#include <mf_wcomp.h>
 #include <my_base.h>
 #include <my_getopt.h>
 #include <my_thread.h>
@@ -30,6 +31,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <list>
 #include <mutex>
 #include <thread>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
 #include <unordered_map>
 #include <vector>
 #include "common.h"
@@ -39,8 +45,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "ds_decompress_lz4.h"
 #include "ds_decompress_zstd.h"
 #include "ds_decrypt.h"
+#include "file_checksums.h"
 #include "file_utils.h"
 #include "msg.h"
+#include "net_utils.h"
+#include "restore_order.h"
 #include "template_utils.h"
 #include "xbcrypt_common.h"
 #include "xtrabackup_version.h"
@@ -49,7 +58,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #define XBSTREAM_REVISION XTRABACKUP_REVISION
 #define XBSTREAM_BUFFER_SIZE (10 * 1024 * 1024UL)
 
-typedef enum { RUN_MODE_NONE, RUN_MODE_CREATE, RUN_MODE_EXTRACT } run_mode_t;
+typedef enum {
+  RUN_MODE_NONE,
+  RUN_MODE_CREATE,
+  RUN_MODE_EXTRACT,
+  RUN_MODE_VERIFY
+} run_mode_t;
 
 const char *xbstream_encrypt_algo_names[] = {"NONE", "AES128", "AES192",
                                              "AES256", NullS};
@@ -82,6 +96,16 @@ static int opt_encrypt_threads = 1;
 static bool opt_decompress = 0;
 static uint opt_decompress_threads = 1;
 static bool opt_absolute_names = 0;
+static bool opt_crc32c = 0;
+static bool opt_index = 0;
+static char *opt_only = nullptr;
+static bool opt_restore_order = 0;
+static ulonglong opt_chunk_size = XB_STREAM_DEFAULT_CHUNK_SIZE;
+static bool opt_detect_holes = 0;
+static bool opt_skip_checksum = 0;
+static char *opt_stream_fds = nullptr;
+static char *opt_listen = nullptr;
+static uint opt_connections = 1;
 
 static const int compression_prefix_len = 4;
 static const int compression_and_encryption_prefix_len = 12;
@@ -92,7 +116,18 @@ enum {
   OPT_ENCRYPT_THREADS,
   OPT_PARALLEL,
   OPT_FIFO_DIR,
-  OPT_FIFO_TIMEOUT
+  OPT_FIFO_TIMEOUT,
+  OPT_CRC32C,
+  OPT_INDEX,
+  OPT_ONLY,
+  OPT_RESTORE_ORDER,
+  OPT_CHUNK_SIZE,
+  OPT_DETECT_HOLES,
+  OPT_SKIP_CHECKSUM,
+  OPT_VERIFY,
+  OPT_STREAM_FDS,
+  OPT_LISTEN,
+  OPT_CONNECTIONS
 };
 
 static struct my_option my_long_options[] = {
@@ -113,6 +148,13 @@ static struct my_option my_long_options[] = {
      "Extract to disk files from the stream on the "
      "standard input.",
      0, 0, 0, GET_NO_ARG, NO_ARG, 0, 0, 0, 0, 0, 0},
+    {"verify", OPT_VERIFY,
+     "Read the stream on the standard input and validate the checksums and "
+     "offsets of its chunks without creating any files. With --decompress "
+     "and --decrypt the files are also decompressed and decrypted to validate "
+     "their own checksums. A summary of every file is printed to the "
+     "standard output.",
+     0, 0, 0, GET_NO_ARG, NO_ARG, 0, 0, 0, 0, 0, 0},
     {"directory", 'C',
      "Change the current directory to the specified one "
      "before streaming or extracting.",
@@ -152,6 +194,58 @@ static struct my_option my_long_options[] = {
      "Don't strip leading slashes from file names when creating archives.",
      &opt_absolute_names, &opt_absolute_names, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0,
      0, 0},
+    {"crc32c", OPT_CRC32C,
+     "Checksum the chunks created with CRC-32C instead of CRC-32. Extraction "
+     "handles both.",
+     &opt_crc32c, &opt_crc32c, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+    {"index", OPT_INDEX,
+     "Write an index of the chunks at the end of the created stream, so that "
+     "--only can extract files from it without reading the whole stream.",
+     &opt_index, &opt_index, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+    {"only", OPT_ONLY,
+     "Only extract the files whose path in the stream matches the given "
+     "pattern, '*' matches any number of characters and '?' a single one. "
+     "If the standard input is a file written with --index, only the chunks "
+     "of the matching files are read.",
+     &opt_only, &opt_only, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+    {"restore-order", OPT_RESTORE_ORDER,
+     "If the standard input is a file written with --index and has the "
+     "xtrabackup_restore_order of a backup taken with --restore-order, "
+     "extract the files in this order instead of the order of the stream, "
+     "the files needed by --prepare and the hottest tables first.",
+     &opt_restore_order, &opt_restore_order, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0,
+     0, 0},
+    {"chunk-size", OPT_CHUNK_SIZE,
+     "Size of the chunks of the created stream. The default value is 10M.",
+     &opt_chunk_size, &opt_chunk_size, 0, GET_ULL, REQUIRED_ARG,
+     XB_STREAM_DEFAULT_CHUNK_SIZE, (1 << 16), (1ULL << 30), 0, 1024, 0},
+    {"detect-holes", OPT_DETECT_HOLES,
+     "Store the zero filled 4K blocks of .ibd files as holes of sparse "
+     "chunks, they are punched again on extraction.",
+     &opt_detect_holes, &opt_detect_holes, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0,
+     0},
+    {"skip-checksum", OPT_SKIP_CHECKSUM,
+     "Do not checksum the chunks created. Extraction skips the validation of "
+     "such chunks.",
+     &opt_skip_checksum, &opt_skip_checksum, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0,
+     0, 0},
+    {"stream-fds", OPT_STREAM_FDS,
+     "Comma separated list of open file descriptors to read the streams of "
+     "xtrabackup --stream-fds or --fifo-streams from in parallel, instead of "
+     "the standard input, e.g. --stream-fds=3,4 3<pipe1 4<pipe2. The "
+     "manifests of the streams are checked to belong to the same backup.",
+     &opt_stream_fds, &opt_stream_fds, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0,
+     0, 0, 0, 0},
+    {"listen", OPT_LISTEN,
+     "Listen on [host:]port and read the streams of xtrabackup --stream-to "
+     "from the TCP connections accepted, instead of the standard input.",
+     &opt_listen, &opt_listen, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0, 0, 0,
+     0},
+    {"connections", OPT_CONNECTIONS,
+     "Number of connections to accept with --listen, the value of "
+     "xtrabackup --stream-connections.",
+     &opt_connections, &opt_connections, 0, GET_UINT, REQUIRED_ARG, 1, 1, 1024,
+     0, 0, 0},
 
     {0, 0, 0, 0, 0, 0, GET_NO_ARG, NO_ARG, 0, 0, 0, 0, 0, 0}};
 
@@ -159,14 +253,52 @@ typedef struct {
   char *path;
   uint pathlen;
   my_off_t offset;
+  ulonglong chunks;
   ds_file_t *file;
   std::mutex *mutex;
+  /* checksum of the chunks, as the file is stored in the backup */
+  xb::file_checksums::File_checksum *checksum;
+  /* contents of xtrabackup_checksums, nullptr for the other files */
+  std::string *contents;
 } file_entry_t;
 
+/* Chunks handed by the reader threads to a worker */
+typedef struct {
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<xb_rstream_chunk_t *> chunks;
+  int readers; /* reader threads still running */
+} chunk_queue_t;
+
+/* Chunks not in use, their number bounds the memory of the chunks in flight */
+typedef struct {
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<xb_rstream_chunk_t *> chunks;
+} chunk_pool_t;
+
+/* Manifests of the streams read, to check that they are all of one backup */
+typedef struct {
+  std::mutex mutex;
+  std::string id;
+  std::vector<bool> seen; /* by stream number */
+} stream_manifests_t;
+
+typedef struct {
+  xb_rstream_t *stream;
+  chunk_queue_t *queues;
+  int n_queues;
+  chunk_pool_t *pool;
+  int n_streams;
+  stream_manifests_t *manifests;
+  std::atomic<bool> *has_errors;
+} extract_reader_ctxt_t;
+
 typedef struct {
   int thread_id;
   std::unordered_map<std::string, file_entry_t *> *filehash;
-  std::list<xb_rstream_t *> *streams;
+  chunk_queue_t *queue; /* chunks of the files of this worker */
+  chunk_pool_t *pool;
   ds_ctxt_t *ds_ctxt;
   ds_ctxt_t *ds_decompress_quicklz_ctxt;
   ds_ctxt_t *ds_decompress_lz4_ctxt;
@@ -195,7 +327,16 @@ int main(int argc, char **argv) {
   crc_init();
 
   if (opt_mode == RUN_MODE_NONE) {
-    msg("%s: either -c or -x must be specified.\n", my_progname);
+    msg("%s: either -c, -x or --verify must be specified.\n", my_progname);
+    goto err;
+  }
+
+  if ((opt_stream_fds != nullptr || opt_listen != nullptr) &&
+      (opt_mode == RUN_MODE_CREATE || opt_fifo_streams > 1 ||
+       (opt_stream_fds != nullptr && opt_listen != nullptr))) {
+    msg("%s: --stream-fds and --listen can only be used with -x and "
+        "--verify, one at a time and not with --fifo-streams.\n",
+        my_progname);
     goto err;
   }
 
@@ -204,7 +345,8 @@ int main(int argc, char **argv) {
     goto err;
   }
 
-  if (opt_mode == RUN_MODE_EXTRACT && opt_fifo_streams > 1) {
+  if ((opt_mode == RUN_MODE_EXTRACT || opt_mode == RUN_MODE_VERIFY) &&
+      opt_fifo_streams > 1) {
     if (opt_fifo_dir == nullptr) {
       msg("%s: --fifo-streams requires --fifo-dir parameter.\n", my_progname);
       goto err;
@@ -225,7 +367,7 @@ int main(int argc, char **argv) {
 
   if (opt_mode == RUN_MODE_CREATE && mode_create(argc, argv)) {
     goto err;
-  } else if (opt_mode == RUN_MODE_EXTRACT &&
+  } else if ((opt_mode == RUN_MODE_EXTRACT || opt_mode == RUN_MODE_VERIFY) &&
              mode_extract(opt_parallel, argc, argv)) {
     goto err;
   }
@@ -278,6 +420,10 @@ static void usage(void) {
       "  %s -x [OPTIONS...]		# extract files from the stream"
       "on the standard input.\n",
       my_progname);
+  printf(
+      "  %s --verify [OPTIONS...]	# validate the stream on the "
+      "standard input.\n",
+      my_progname);
 
   puts("\nOptions:");
   my_print_help(my_long_options);
@@ -285,7 +431,8 @@ static void usage(void) {
 
 static int set_run_mode(run_mode_t mode) {
   if (opt_mode != RUN_MODE_NONE) {
-    msg("%s: can't set specify both -c and -x.\n", my_progname);
+    msg("%s: only one of -c, -x and --verify can be specified.\n",
+        my_progname);
     return 1;
   }
 
@@ -308,6 +455,11 @@ static bool get_one_option(int optid,
         return true;
       }
       break;
+    case OPT_VERIFY:
+      if (set_run_mode(RUN_MODE_VERIFY)) {
+        return true;
+      }
+      break;
     case 'k':
       hide_option(argument, &opt_encrypt_key);
       break;
@@ -367,6 +519,11 @@ static int mode_create(int argc, char **argv) {
     msg("%s: xb_stream_write_new() failed.\n", my_progname);
     return 1;
   }
+  xb_stream_write_set_crc32c(stream, opt_crc32c);
+  xb_stream_write_set_skip_checksum(stream, opt_skip_checksum);
+  xb_stream_write_set_index(stream, opt_index);
+  xb_stream_write_set_chunk_size(stream, opt_chunk_size);
+  xb_stream_write_set_detect_holes(stream, opt_detect_holes);
 
   for (i = 0; i < argc; i++) {
     char *filepath = argv[i];
@@ -391,7 +548,8 @@ static int mode_create(int argc, char **argv) {
     filepath_dst = opt_absolute_names
                        ? filepath
                        : safer_name_suffix(filepath, &filepath_prefix_len);
-    file = xb_stream_write_open(stream, filepath_dst, &mystat, NULL, NULL);
+    file = xb_stream_write_open(stream, filepath_dst, &mystat, NULL, NULL,
+                                NULL);
     if (file == NULL) {
       goto err;
     }
@@ -406,10 +564,14 @@ static int mode_create(int argc, char **argv) {
     }
   }
 
-  xb_stream_write_done(stream);
+  if (xb_stream_write_done(stream)) {
+    return 1;
+  }
 
   return 0;
 err:
+  /* do not index an incomplete stream */
+  xb_stream_write_set_index(stream, false);
   xb_stream_write_done(stream);
 
   return 1;
@@ -425,6 +587,136 @@ static bool ends_with(const char *str, const char *suffix) {
           strcmp(str + str_len - suffix_len, suffix) == 0);
 }
 
+/************************************************************************
+Check if a path in the stream matches --only.
+@return true if the file must be extracted. */
+static bool path_matches_only(const char *path, size_t pathlen) {
+  return opt_only == nullptr ||
+         wild_compare_full(path, pathlen, opt_only, strlen(opt_only), false,
+                           '\\', '?', '*') == 0;
+}
+
+/************************************************************************
+Read the xtrabackup_restore_order of a stream with an index.
+@param[in]   stream  stream to read
+@param[in]   index   index of the stream
+@param[out]  order   ranks of the files
+@return false if the stream has no valid order */
+static bool read_restore_order(xb_rstream_t *stream,
+                               const xb_stream_index_t &index,
+                               xb::restore_order::Order *order) {
+  const auto it = index.find(xb::restore_order::FILENAME);
+  if (it == index.end()) {
+    msg("%s: %s is not in the stream index.\n", my_progname,
+        xb::restore_order::FILENAME);
+    return false;
+  }
+
+  xb_rstream_chunk_t chunk;
+  xb_rstream_result_t res;
+  std::string text;
+  bool ok = true;
+
+  memset(&chunk, 0, sizeof(chunk));
+  xb_stream_read_set_plan(stream, &it->second);
+  while ((res = xb_stream_read_chunk(stream, &chunk)) ==
+         XB_STREAM_READ_CHUNK) {
+    if (chunk.type != XB_CHUNK_TYPE_PAYLOAD) {
+      continue;
+    }
+    if (xb_stream_validate_checksum(&chunk) != XB_STREAM_READ_CHUNK) {
+      ok = false;
+      break;
+    }
+    if (text.size() < chunk.offset + chunk.length) {
+      text.resize(chunk.offset + chunk.length);
+    }
+    memcpy(&text[chunk.offset], chunk.data, chunk.length);
+  }
+  xb_stream_read_set_plan(stream, nullptr);
+  my_free(chunk.raw_data);
+  my_free(chunk.sparse_map);
+
+  if (!ok || res == XB_STREAM_READ_ERROR) {
+    msg("%s: cannot read %s from the stream.\n", my_progname,
+        xb::restore_order::FILENAME);
+    return false;
+  }
+
+  return xb::restore_order::parse(text, order);
+}
+
+/* Datasink of --verify: the data of the files is only counted */
+typedef struct {
+  ulonglong bytes;
+} verify_file_t;
+
+/* Totals of the verified files, bytes after decryption and decompression */
+static std::atomic<ulonglong> verify_files{0};
+static std::atomic<ulonglong> verify_chunks{0};
+static std::atomic<ulonglong> verify_bytes{0};
+
+static ds_ctxt_t *verify_init(const char *root) {
+  ds_ctxt_t *ctxt = new ds_ctxt_t;
+  ctxt->datasink = nullptr;
+  ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
+  ctxt->ptr = nullptr;
+  ctxt->pipe_ctxt = nullptr;
+  return ctxt;
+}
+
+static ds_file_t *verify_open(ds_ctxt_t *ctxt __attribute__((unused)),
+                              const char *path,
+                              MY_STAT *mystat __attribute__((unused))) {
+  ds_file_t *file = static_cast<ds_file_t *>(
+      my_malloc(PSI_NOT_INSTRUMENTED, sizeof(ds_file_t) + sizeof(verify_file_t),
+                MYF(MY_FAE | MY_ZEROFILL)));
+  file->ptr = file + 1;
+  file->path = const_cast<char *>(path);
+  return file;
+}
+
+static int verify_write(ds_file_t *file,
+                        const void *buf __attribute__((unused)), size_t len) {
+  static_cast<verify_file_t *>(file->ptr)->bytes += len;
+  return 0;
+}
+
+static int verify_write_sparse(ds_file_t *file,
+                               const void *buf __attribute__((unused)),
+                               size_t len, size_t sparse_map_size,
+                               const ds_sparse_chunk_t *sparse_map,
+                               bool punch_hole_supported
+                               __attribute__((unused))) {
+  verify_file_t *verify_file = static_cast<verify_file_t *>(file->ptr);
+  for (size_t i = 0; i < sparse_map_size; i++) {
+    verify_file->bytes += sparse_map[i].skip;
+  }
+  verify_file->bytes += len;
+  return 0;
+}
+
+static int verify_close(ds_file_t *file) {
+  verify_bytes += static_cast<verify_file_t *>(file->ptr)->bytes;
+  my_free(file);
+  return 0;
+}
+
+static void verify_deinit(ds_ctxt_t *ctxt) {
+  my_free(ctxt->root);
+  delete ctxt;
+}
+
+static datasink_t datasink_verify = {
+    &verify_init,  &verify_open,  &verify_write, &verify_write_sparse,
+    nullptr,       nullptr,       &verify_close, &verify_deinit};
+
+/* Checksums of the files of the stream, checked against the
+xtrabackup_checksums file of the stream if it has one */
+static xb::file_checksums::Registry stream_checksums;
+static std::mutex stream_checksums_mutex;
+static std::string *stream_checksums_contents = nullptr;
+
 static file_entry_t *file_entry_new(extract_ctxt_t *ctxt, const char *path,
                                     uint pathlen) {
   file_entry_t *entry;
@@ -435,6 +727,7 @@ static file_entry_t *file_entry_new(extract_ctxt_t *ctxt, const char *path,
     return NULL;
   }
   entry->mutex = new std::mutex();
+  entry->checksum = new xb::file_checksums::File_checksum();
 
   entry->path = my_strndup(PSI_NOT_INSTRUMENTED, path, pathlen, MYF(MY_WME));
   if (entry->path == NULL) {
@@ -442,6 +735,13 @@ static file_entry_t *file_entry_new(extract_ctxt_t *ctxt, const char *path,
   }
   entry->pathlen = pathlen;
 
+  /* a file sent again replaces the previous one */
+  stream_checksums.reset(xb::file_checksums::normalize(entry->path));
+  if (xb::file_checksums::normalize(entry->path) ==
+      xb::file_checksums::FILENAME) {
+    entry->contents = new std::string();
+  }
+
   if (ctxt->ds_decrypt_quicklz_ctxt && ends_with(path, ".qp.xbcrypt")) {
     file = ds_open(ctxt->ds_decrypt_quicklz_ctxt, path, NULL);
   } else if (ctxt->ds_decrypt_lz4_ctxt && ends_with(path, ".lz4.xbcrypt")) {
@@ -477,6 +777,9 @@ err:
   if (entry->path != NULL) {
     my_free(entry->path);
   }
+  delete entry->contents;
+  delete entry->checksum;
+  delete entry->mutex;
   my_free(entry);
 
   return NULL;
@@ -485,164 +788,339 @@ err:
 static void file_entry_free(file_entry_t *entry) {
   ds_close(entry->file);
   my_free(entry->path);
+  delete entry->contents;
+  delete entry->checksum;
   delete entry->mutex;
   my_free(entry);
 }
 
-static void extract_worker_thread_func(extract_ctxt_t &ctxt) {
-  xb_rstream_t *stream = NULL;
-  xb_rstream_chunk_t chunk;
+/* Add a chunk to the checksum of its file. The checksum of a CRC-32C chunk is
+that of its payload. */
+static void file_entry_checksum(file_entry_t *entry,
+                                const xb_rstream_chunk_t &chunk) {
+  const uchar *data = static_cast<const uchar *>(chunk.data);
+
+  if (chunk.type == XB_CHUNK_TYPE_PAYLOAD) {
+    if ((chunk.flags & XB_STREAM_FLAG_CRC32C) &&
+        !(chunk.flags & XB_STREAM_FLAG_NO_CHECKSUM)) {
+      entry->checksum->add(entry->offset, chunk.length, chunk.checksum);
+    } else {
+      entry->checksum->update(entry->offset, data, chunk.length);
+    }
+    if (entry->contents != nullptr) {
+      entry->contents->append(reinterpret_cast<const char *>(data),
+                              chunk.length);
+    }
+    return;
+  }
+
+  my_off_t offset = entry->offset;
+  for (size_t i = 0; i < chunk.sparse_map_size; i++) {
+    entry->checksum->update_zeros(offset, chunk.sparse_map[i].skip);
+    offset += chunk.sparse_map[i].skip;
+    entry->checksum->update(offset, data, chunk.sparse_map[i].len);
+    offset += chunk.sparse_map[i].len;
+    data += chunk.sparse_map[i].len;
+  }
+}
+
+/* Write a chunk to its file
+@return XB_STREAM_READ_ERROR on error */
+static xb_rstream_result_t extract_chunk(extract_ctxt_t &ctxt,
+                                         xb_rstream_chunk_t &chunk) {
   file_entry_t *entry;
   xb_rstream_result_t res = XB_STREAM_READ_CHUNK;
 
   ctxt.mutex->lock();
-  stream = ctxt.streams->front();
-  ctxt.streams->pop_front();
-  ctxt.streams->push_back(stream);
-  ctxt.mutex->unlock();
+  /* See if we already have this file open */
+  std::unordered_map<std::string, file_entry_t *>::const_iterator entry_it =
+      ctxt.filehash->find(chunk.path);
 
-  my_thread_init();
+  if (entry_it == ctxt.filehash->end()) {
+    entry = file_entry_new(&ctxt, chunk.path, chunk.pathlen);
+    if (entry == NULL) {
+      ctxt.mutex->unlock();
+      return XB_STREAM_READ_ERROR;
+    }
+    ctxt.filehash->insert({chunk.path, entry});
+  } else {
+    entry = entry_it->second;
+  }
 
-  memset(&chunk, 0, sizeof(chunk));
+  entry->mutex->lock();
 
-  while (1) {
-    /* Abort in case of error in any thread */
-    if (ctxt.has_errors->load()) {
-      break;
-    }
+  ctxt.mutex->unlock();
 
-    stream->mutex->lock();
-    res = xb_stream_read_chunk(stream, &chunk);
-    if (res != XB_STREAM_READ_CHUNK) {
-      stream->mutex->unlock();
-      break;
-    }
+  if (chunk.type == XB_CHUNK_TYPE_PAYLOAD ||
+      chunk.type == XB_CHUNK_TYPE_SPARSE) {
+    res = xb_stream_validate_checksum(&chunk);
+  }
 
-    /* If unknown type and ignorable flag is set, skip this chunk */
-    if (chunk.type == XB_CHUNK_TYPE_UNKNOWN &&
-        !(chunk.flags & XB_STREAM_FLAG_IGNORABLE)) {
-      stream->mutex->unlock();
-      continue;
-    }
+  if (res != XB_STREAM_READ_CHUNK) {
+    entry->mutex->unlock();
+    return res;
+  }
 
-    if (!opt_absolute_names) {
-      int filepath_prefix_len;
-      safer_name_suffix(chunk.path, &filepath_prefix_len);
-      if (filepath_prefix_len != 0) {
-        msg("%s: absolute path not allowed: %.*s.\n", my_progname,
-            chunk.pathlen, chunk.path);
-        res = XB_STREAM_READ_ERROR;
-        stream->mutex->unlock();
-        break;
-      }
+  if (chunk.type == XB_CHUNK_TYPE_EOF) {
+    if (opt_mode == RUN_MODE_VERIFY) {
+      printf("%s: %llu chunks, %llu bytes, OK\n", entry->path, entry->chunks,
+             (ulonglong)entry->offset);
+      verify_files++;
+      verify_chunks += entry->chunks;
+    }
+    stream_checksums.merge(xb::file_checksums::normalize(entry->path),
+                           *entry->checksum);
+    if (entry->contents != nullptr) {
+      std::lock_guard<std::mutex> guard(stream_checksums_mutex);
+      delete stream_checksums_contents;
+      stream_checksums_contents = entry->contents;
+      entry->contents = nullptr;
     }
-
     ctxt.mutex->lock();
-    stream->mutex->unlock();
-    /* See if we already have this file open */
-    std::unordered_map<std::string, file_entry_t *>::const_iterator entry_it =
-        ctxt.filehash->find(chunk.path);
-
-    if (entry_it == ctxt.filehash->end()) {
-      entry = file_entry_new(&ctxt, chunk.path, chunk.pathlen);
-      if (entry == NULL) {
-        res = XB_STREAM_READ_ERROR;
-        ctxt.mutex->unlock();
-        break;
+    entry->mutex->unlock();
+    ctxt.filehash->erase(entry->path);
+    file_entry_free(entry);
+    ctxt.mutex->unlock();
+    /*
+     * no need for mutex here. At this point, we are guarantee that all other
+     * threads have completed its work with this file
+     */
+    if (opt_decompress && ctxt.ds_ctxt->fs_support_punch_hole &&
+        (is_compressed_suffix(chunk.path) ||
+         is_encrypted_and_compressed_suffix(chunk.path))) {
+      char path[FN_REFLEN] = {0};
+      memcpy(path, chunk.path, strlen(chunk.path));
+      unsigned short int qpress_offset = is_qpress_file(path) ? 1 : 0;
+      if (is_compressed_suffix(path))
+        path[strlen(path) - compression_prefix_len + qpress_offset] = 0;
+      if (is_encrypted_and_compressed_suffix(path))
+        path[strlen(path) - compression_and_encryption_prefix_len +
+             qpress_offset] = 0;
+
+      char error[512];
+      if (!restore_sparseness(path, XBSTREAM_BUFFER_SIZE, error)) {
+        msg("%s: restore_sparseness failed for file %s: %s\n", my_progname,
+            chunk.path, error);
       }
-      ctxt.filehash->insert({chunk.path, entry});
-    } else {
-      entry = entry_it->second;
     }
 
-    entry->mutex->lock();
+    return XB_STREAM_READ_CHUNK;
+  }
 
-    ctxt.mutex->unlock();
+  if (entry->offset != chunk.offset) {
+    msg("%s: out-of-order chunk: real offset = 0x%llx, "
+        "expected offset = 0x%llx\n",
+        my_progname, chunk.offset, entry->offset);
+    entry->mutex->unlock();
+    return XB_STREAM_READ_ERROR;
+  }
 
-    if (chunk.type == XB_CHUNK_TYPE_PAYLOAD ||
-        chunk.type == XB_CHUNK_TYPE_SPARSE) {
-      res = xb_stream_validate_checksum(&chunk);
-    }
+  if (chunk.type == XB_CHUNK_TYPE_PAYLOAD ||
+      chunk.type == XB_CHUNK_TYPE_SPARSE) {
+    file_entry_checksum(entry, chunk);
+  }
 
-    if (res != XB_STREAM_READ_CHUNK) {
+  if (chunk.type == XB_CHUNK_TYPE_PAYLOAD) {
+    if (ds_write(entry->file, chunk.data, chunk.length)) {
+      msg("%s: my_write() failed.\n", my_progname);
       entry->mutex->unlock();
-      break;
+      return XB_STREAM_READ_ERROR;
     }
 
-    if (chunk.type == XB_CHUNK_TYPE_EOF) {
-      ctxt.mutex->lock();
+    entry->offset += chunk.length;
+  } else if (chunk.type == XB_CHUNK_TYPE_SPARSE) {
+    if (ds_write_sparse(entry->file, chunk.data, chunk.length,
+                        chunk.sparse_map_size, chunk.sparse_map,
+                        ctxt.ds_ctxt->fs_support_punch_hole)) {
+      msg("%s: my_write() failed.\n", my_progname);
       entry->mutex->unlock();
-      ctxt.filehash->erase(entry->path);
-      file_entry_free(entry);
-      ctxt.mutex->unlock();
-      /*
-       * no need for mutex here. At this point, we are guarantee that all other
-       * threads have completed its work with this file
-       */
-      if (opt_decompress && ctxt.ds_ctxt->fs_support_punch_hole &&
-          (is_compressed_suffix(chunk.path) ||
-           is_encrypted_and_compressed_suffix(chunk.path))) {
-        char path[FN_REFLEN] = {0};
-        memcpy(path, chunk.path, strlen(chunk.path));
-        unsigned short int qpress_offset = is_qpress_file(path) ? 1 : 0;
-        if (is_compressed_suffix(path))
-          path[strlen(path) - compression_prefix_len + qpress_offset] = 0;
-        if (is_encrypted_and_compressed_suffix(path))
-          path[strlen(path) - compression_and_encryption_prefix_len +
-               qpress_offset] = 0;
-
-        char error[512];
-        if (!restore_sparseness(path, XBSTREAM_BUFFER_SIZE, error)) {
-          msg("%s: restore_sparseness failed for file %s: %s\n", my_progname,
-              chunk.path, error);
-        }
-      }
+      return XB_STREAM_READ_ERROR;
+    }
 
-      continue;
+    for (size_t i = 0; i < chunk.sparse_map_size; ++i)
+      entry->offset += chunk.sparse_map[i].skip;
+    entry->offset += chunk.length;
+  }
+  entry->chunks++;
+
+  entry->mutex->unlock();
+
+  return XB_STREAM_READ_CHUNK;
+}
+
+/* Take a chunk from the pool, waiting for one to be returned if needed */
+static xb_rstream_chunk_t *chunk_pool_get(chunk_pool_t *pool) {
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  pool->cond.wait(lock, [pool] { return !pool->chunks.empty(); });
+  xb_rstream_chunk_t *chunk = pool->chunks.back();
+  pool->chunks.pop_back();
+  return chunk;
+}
+
+static void chunk_pool_put(chunk_pool_t *pool, xb_rstream_chunk_t *chunk) {
+  {
+    std::lock_guard<std::mutex> guard(pool->mutex);
+    pool->chunks.push_back(chunk);
+  }
+  pool->cond.notify_one();
+}
+
+/* Next chunk of a worker
+@return nullptr when all readers are done and the queue is empty */
+static xb_rstream_chunk_t *chunk_queue_pop(chunk_queue_t *queue) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  queue->cond.wait(lock, [queue] {
+    return !queue->chunks.empty() || queue->readers == 0;
+  });
+  if (queue->chunks.empty()) {
+    return nullptr;
+  }
+  xb_rstream_chunk_t *chunk = queue->chunks.front();
+  queue->chunks.pop_front();
+  return chunk;
+}
+
+/* Check the manifest of a stream against the ones of the other streams
+@return false if the stream is not one of the backup being read */
+static bool check_manifest(extract_reader_ctxt_t &ctxt,
+                           xb_rstream_chunk_t *chunk) {
+  xb_stream_manifest_t manifest;
+
+  if (xb_stream_validate_checksum(chunk) != XB_STREAM_READ_CHUNK) {
+    return false;
+  }
+  if (!xb_stream_parse_manifest(chunk, &manifest)) {
+    msg("%s: corrupted stream manifest.\n", my_progname);
+    return false;
+  }
+
+  if (opt_verbose) {
+    msg("%s: reading stream %u of %u of backup %s.\n", my_progname,
+        manifest.stream_no + 1, manifest.n_streams, manifest.id.c_str());
+  }
+
+  /* The streams of a backup can also be extracted one by one */
+  if (ctxt.n_streams == 1) {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> guard(ctxt.manifests->mutex);
+  if (manifest.n_streams != (uint)ctxt.n_streams) {
+    msg("%s: the backup was streamed to %u streams but %d are read.\n",
+        my_progname, manifest.n_streams, ctxt.n_streams);
+    return false;
+  }
+  if (ctxt.manifests->seen.empty()) {
+    ctxt.manifests->id = manifest.id;
+    ctxt.manifests->seen.resize(manifest.n_streams);
+  } else if (ctxt.manifests->id != manifest.id) {
+    msg("%s: the streams read are of different backups.\n", my_progname);
+    return false;
+  }
+  if (ctxt.manifests->seen[manifest.stream_no]) {
+    msg("%s: stream %u of the backup is read twice.\n", my_progname,
+        manifest.stream_no + 1);
+    return false;
+  }
+  ctxt.manifests->seen[manifest.stream_no] = true;
+
+  return true;
+}
+
+/* Read the chunks of a stream and hand them to the workers. All chunks of a
+file go to the same worker, so that they are written in order. */
+static void extract_reader_thread_func(extract_reader_ctxt_t &ctxt) {
+  xb_rstream_t *stream = ctxt.stream;
+  xb_rstream_result_t res = XB_STREAM_READ_CHUNK;
+
+  my_thread_init();
+
+  while (1) {
+    /* Abort in case of error in any thread */
+    if (ctxt.has_errors->load()) {
+      break;
     }
 
-    if (entry->offset != chunk.offset) {
-      msg("%s: out-of-order chunk: real offset = 0x%llx, "
-          "expected offset = 0x%llx\n",
-          my_progname, chunk.offset, entry->offset);
-      entry->mutex->unlock();
-      res = XB_STREAM_READ_ERROR;
+    xb_rstream_chunk_t *chunk = chunk_pool_get(ctxt.pool);
+
+    res = xb_stream_read_chunk(stream, chunk);
+    if (res != XB_STREAM_READ_CHUNK) {
+      chunk_pool_put(ctxt.pool, chunk);
       break;
     }
 
-    if (chunk.type == XB_CHUNK_TYPE_PAYLOAD) {
-      if (ds_write(entry->file, chunk.data, chunk.length)) {
-        msg("%s: my_write() failed.\n", my_progname);
-        entry->mutex->unlock();
+    if (chunk->type == XB_CHUNK_TYPE_MANIFEST) {
+      const bool valid = check_manifest(ctxt, chunk);
+      chunk_pool_put(ctxt.pool, chunk);
+      if (!valid) {
         res = XB_STREAM_READ_ERROR;
         break;
       }
+      continue;
+    }
+
+    /* If unknown type and ignorable flag is set, skip this chunk */
+    if ((chunk->type == XB_CHUNK_TYPE_UNKNOWN &&
+         (chunk->flags & XB_STREAM_FLAG_IGNORABLE)) ||
+        chunk->type == XB_CHUNK_TYPE_INDEX ||
+        chunk->type == XB_CHUNK_TYPE_INDEX_TRAILER ||
+        !path_matches_only(chunk->path, chunk->pathlen)) {
+      chunk_pool_put(ctxt.pool, chunk);
+      continue;
+    }
 
-      entry->offset += chunk.length;
-    } else if (chunk.type == XB_CHUNK_TYPE_SPARSE) {
-      if (ds_write_sparse(entry->file, chunk.data, chunk.length,
-                          chunk.sparse_map_size, chunk.sparse_map,
-                          ctxt.ds_ctxt->fs_support_punch_hole)) {
-        msg("%s: my_write() failed.\n", my_progname);
-        entry->mutex->unlock();
+    /* Nothing is written when verifying */
+    if (!opt_absolute_names && opt_mode != RUN_MODE_VERIFY) {
+      int filepath_prefix_len;
+      safer_name_suffix(chunk->path, &filepath_prefix_len);
+      if (filepath_prefix_len != 0) {
+        msg("%s: absolute path not allowed: %.*s.\n", my_progname,
+            chunk->pathlen, chunk->path);
+        chunk_pool_put(ctxt.pool, chunk);
         res = XB_STREAM_READ_ERROR;
         break;
       }
-
-      for (size_t i = 0; i < chunk.sparse_map_size; ++i)
-        entry->offset += chunk.sparse_map[i].skip;
-      entry->offset += chunk.length;
     }
 
-    entry->mutex->unlock();
+    chunk_queue_t *queue =
+        &ctxt.queues[std::hash<std::string>()(chunk->path) % ctxt.n_queues];
+    {
+      std::lock_guard<std::mutex> guard(queue->mutex);
+      queue->chunks.push_back(chunk);
+    }
+    queue->cond.notify_one();
   }
 
-  my_free(chunk.raw_data);
-  my_free(chunk.sparse_map);
+  for (int i = 0; i < ctxt.n_queues; i++) {
+    chunk_queue_t *queue = &ctxt.queues[i];
+    {
+      std::lock_guard<std::mutex> guard(queue->mutex);
+      queue->readers--;
+    }
+    queue->cond.notify_all();
+  }
 
   my_thread_end();
 
-  if (res == XB_STREAM_READ_ERROR) ctxt.has_errors->store(res);
+  if (res == XB_STREAM_READ_ERROR) ctxt.has_errors->store(true);
+}
+
+static void extract_worker_thread_func(extract_ctxt_t &ctxt) {
+  xb_rstream_chunk_t *chunk;
+
+  my_thread_init();
+
+  while ((chunk = chunk_queue_pop(ctxt.queue)) != nullptr) {
+    /* After an error only give the chunks back, so that the readers do not
+    wait for them */
+    if (!ctxt.has_errors->load() &&
+        extract_chunk(ctxt, *chunk) == XB_STREAM_READ_ERROR) {
+      ctxt.has_errors->store(true);
+    }
+    chunk_pool_put(ctxt.pool, chunk);
+  }
+
+  my_thread_end();
 }
 
 static int mode_extract(int n_threads, int argc __attribute__((unused)),
@@ -664,10 +1142,21 @@ static int mode_extract(int n_threads, int argc __attribute__((unused)),
       new std::unordered_map<std::string, file_entry_t *>();
   int i;
   std::mutex mutex;
+  xb_stream_index_t index;
+  std::vector<xb_stream_index_entry_t> plan;
+  chunk_queue_t *queues = nullptr;
+  chunk_pool_t pool;
+  stream_manifests_t manifests;
+  std::vector<extract_reader_ctxt_t> readers;
+  std::vector<std::thread> reader_threads;
   int ret = 0;
 
   /* If --directory is specified, it is already set as CWD by now. */
-  ds_ctxt = ds_create(".", DS_TYPE_LOCAL);
+  if (opt_mode == RUN_MODE_VERIFY) {
+    ds_ctxt = ds_create_from(".", &datasink_verify, "verify");
+  } else {
+    ds_ctxt = ds_create(".", DS_TYPE_LOCAL);
+  }
   if (ds_ctxt == NULL) {
     ret = 1;
     goto exit;
@@ -690,6 +1179,7 @@ static int mode_extract(int n_threads, int argc __attribute__((unused)),
     }
     ds_set_pipe(ds_decompress_lz4_ctxt, ds_ctxt);
 
+    ds_decompress_zstd_threads = opt_decompress_threads;
     ds_decompress_zstd_ctxt = ds_create(".", DS_TYPE_DECOMPRESS_ZSTD);
     if (ds_decompress_zstd_ctxt == NULL) {
       ret = 1;
@@ -722,7 +1212,25 @@ static int mode_extract(int n_threads, int argc __attribute__((unused)),
       ds_set_pipe(ds_decrypt_zstd_ctxt, ds_decompress_zstd_ctxt);
     }
   }
-  if (opt_fifo_streams > 1) {
+  if (opt_stream_fds != nullptr || opt_listen != nullptr) {
+    std::vector<File> fds;
+    if (opt_listen != nullptr) {
+      if (opt_verbose) {
+        msg("%s: waiting for %u connection(s) on %s.\n", my_progname,
+            opt_connections, opt_listen);
+      }
+      if (!net_accept(opt_listen, opt_connections, &fds)) {
+        ret = 1;
+        goto exit;
+      }
+    } else if (!parse_fd_list(opt_stream_fds, &fds)) {
+      ret = 1;
+      goto exit;
+    }
+    for (auto fd : fds) {
+      streams->push_back(xb_stream_read_new_fd(fd));
+    }
+  } else if (opt_fifo_streams > 1) {
     for (int idx = 0; idx < opt_fifo_streams; idx++) {
       char filename[FN_REFLEN];
       snprintf(filename, sizeof(filename), "%s%s%lu", opt_fifo_dir, "/thread_",
@@ -748,6 +1256,71 @@ static int mode_extract(int n_threads, int argc __attribute__((unused)),
       goto exit;
     }
     streams->push_back(stream);
+
+    /* Seek to the chunks of the matching files if the stream has an index,
+    otherwise the other ones are skipped while reading it */
+    xb::restore_order::Order order;
+    if ((opt_only != nullptr || opt_restore_order) &&
+        xb_stream_read_index(stream, &index)) {
+      if (opt_restore_order && !read_restore_order(stream, index, &order)) {
+        msg("%s: extracting the files in the order of the stream.\n",
+            my_progname);
+      }
+      /* files by rank, then by their first chunk in the stream */
+      std::map<std::pair<size_t, my_off_t>,
+               const std::vector<xb_stream_index_entry_t> *>
+          files;
+      for (const auto &it : index) {
+        if (!it.second.empty() &&
+            path_matches_only(it.first.c_str(), it.first.length())) {
+          files[{xb::restore_order::rank(order, it.first),
+                 it.second.front().offset}] = &it.second;
+        }
+      }
+      for (const auto &it : files) {
+        plan.insert(plan.end(), it.second->begin(), it.second->end());
+      }
+      if (order.empty()) {
+        std::sort(plan.begin(), plan.end(),
+                  [](const xb_stream_index_entry_t &a,
+                     const xb_stream_index_entry_t &b) {
+                    return a.offset < b.offset;
+                  });
+      }
+      if (opt_verbose) {
+        msg("%s: reading %zu chunks using the stream index.\n", my_progname,
+            plan.size());
+      }
+      xb_stream_read_set_plan(stream, &plan);
+    }
+  }
+
+  /* Enough chunks for every worker to have one while the readers read ahead,
+  each grows up to the size of the largest chunk read in it */
+  for (int i = 0; i < n_threads + 2 * (int)streams->size(); i++) {
+    pool.chunks.push_back(static_cast<xb_rstream_chunk_t *>(
+        my_malloc(PSI_NOT_INSTRUMENTED, sizeof(xb_rstream_chunk_t),
+                  MYF(MY_FAE | MY_ZEROFILL))));
+  }
+
+  queues = new chunk_queue_t[n_threads];
+  for (int i = 0; i < n_threads; i++) {
+    queues[i].readers = streams->size();
+  }
+
+  readers.resize(streams->size());
+  i = 0;
+  for (auto s : *streams) {
+    readers[i].stream = s;
+    readers[i].queues = queues;
+    readers[i].n_queues = n_threads;
+    readers[i].pool = &pool;
+    readers[i].n_streams = streams->size();
+    readers[i].manifests = &manifests;
+    readers[i].has_errors = &has_errors;
+    reader_threads.push_back(
+        std::thread(extract_reader_thread_func, std::ref(readers[i])));
+    i++;
   }
 
   data_threads = (extract_ctxt_t *)my_malloc(
@@ -766,16 +1339,57 @@ static int mode_extract(int n_threads, int argc __attribute__((unused)),
     data_threads[i].ds_decrypt_zstd_ctxt = ds_decrypt_zstd_ctxt;
     data_threads[i].mutex = &mutex;
     data_threads[i].has_errors = &has_errors;
-    data_threads[i].streams = streams;
+    data_threads[i].queue = &queues[i];
+    data_threads[i].pool = &pool;
 
     threads.push_back(
         std::thread(extract_worker_thread_func, std::ref(data_threads[i])));
   }
 
+  for (auto &t : reader_threads) t.join();
   for (i = 0; i < n_threads; i++) threads.at(i).join();
 
   if (has_errors.load()) ret = 1;
 
+  if (opt_mode == RUN_MODE_VERIFY && !ret) {
+    /* Files still open did not get their EOF chunk */
+    for (const auto &it : *filehash) {
+      msg("%s: %s is incomplete, %llu bytes in %llu chunks.\n", my_progname,
+          it.second->path, (ulonglong)it.second->offset, it.second->chunks);
+      ret = 1;
+    }
+    /* Close the pipes of the files for the totals */
+    for (const auto &it : *filehash) {
+      file_entry_free(it.second);
+    }
+    filehash->clear();
+    if (!ret) {
+      printf("%llu files, %llu chunks, %llu bytes, OK\n", verify_files.load(),
+             verify_chunks.load(), verify_bytes.load());
+    }
+  }
+
+  /* Check the files against the checksums recorded by xtrabackup
+  --file-checksums. The files left out by --only are not required. */
+  if (!ret && stream_checksums_contents != nullptr) {
+    xb::file_checksums::Entries expected;
+    size_t n_checked;
+    if (!xb::file_checksums::parse(*stream_checksums_contents, &expected) ||
+        !xb::file_checksums::check(
+            expected, stream_checksums.entries(),
+            [](const std::string &path) {
+              return path_matches_only(path.c_str(), path.length());
+            },
+            &n_checked)) {
+      msg("%s: the files do not match %s.\n", my_progname,
+          xb::file_checksums::FILENAME);
+      ret = 1;
+    } else if (opt_verbose || opt_mode == RUN_MODE_VERIFY) {
+      msg("%s: %zu files match %s.\n", my_progname, n_checked,
+          xb::file_checksums::FILENAME);
+    }
+  }
+
 exit:
 
   for (uint i = 0; i < (uint)n_threads; i++) {
@@ -785,6 +1399,8 @@ exit:
     unlink(filename);
   }
   delete filehash;
+  delete stream_checksums_contents;
+  stream_checksums_contents = nullptr;
 
   if (ds_ctxt != NULL) {
     ds_destroy(ds_ctxt);
@@ -815,6 +1431,13 @@ exit:
     my_free(data_threads);
   }
 
+  delete[] queues;
+  for (auto chunk : pool.chunks) {
+    my_free(chunk->raw_data);
+    my_free(chunk->sparse_map);
+    my_free(chunk);
+  }
+
   std::for_each(streams->begin(), streams->end(),
                 [](xb_rstream_t *s) { xb_stream_read_done(s); });
   delete streams;
@@ -24,17 +24,35 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <my_base.h>
 #include <my_dir.h>
 #include <my_io.h>
+#include <map>
 #include <mutex>
 #include <string>
+#include <vector>
 
+#include "crc_glue.h"
 #include "datasink.h"
 
+/* Writes smaller than this are grouped into a single chunk by default */
+#define XB_STREAM_DEFAULT_CHUNK_SIZE (10 * 1024 * 1024)
+
 /* Magic value in a chunk header */
 #define XB_STREAM_CHUNK_MAGIC "XBSTCK01"
 
 /* Chunk flags */
 /* Chunk can be ignored if unknown version/format */
 #define XB_STREAM_FLAG_IGNORABLE 0x01
+/* Chunk checksum is CRC-32C instead of the zlib CRC-32 */
+#define XB_STREAM_FLAG_CRC32C 0x02
+/* Chunk has no checksum, it is always 0 */
+#define XB_STREAM_FLAG_NO_CHECKSUM 0x04
+
+/* Update the checksum of a chunk with the algorithm selected by its flags */
+static inline ulong xb_stream_checksum(uchar flags, ulong crc, const uchar *buf,
+                                       size_t len) {
+  if (flags & XB_STREAM_FLAG_NO_CHECKSUM) return 0;
+  return (flags & XB_STREAM_FLAG_CRC32C) ? crc32_castagnoli(crc, buf, len)
+                                         : crc32_iso3309(crc, buf, len);
+}
 
 /* Magic + flags + type + path len */
 #define CHUNK_HEADER_CONSTANT_LEN \
@@ -42,10 +60,35 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #define CHUNK_TYPE_OFFSET (sizeof(XB_STREAM_CHUNK_MAGIC) - 1 + 1)
 #define PATH_LENGTH_OFFSET (sizeof(XB_STREAM_CHUNK_MAGIC) - 1 + 1 + 1)
 
+/* Index entry of a chunk */
+typedef struct {
+  my_off_t offset; /* stream offset of the chunk */
+  size_t length;   /* chunk length including the header */
+  ulong checksum;  /* payload checksum, 0 for EOF chunks */
+} xb_stream_index_entry_t;
+
+/* Chunks of each file in stream order */
+typedef std::map<std::string, std::vector<xb_stream_index_entry_t>>
+    xb_stream_index_t;
+
+/* Manifest of one of several streams a backup is striped over */
+typedef struct {
+  std::string id; /* same for all streams of a backup */
+  uint n_streams;
+  uint stream_no; /* 0 .. n_streams - 1 */
+} xb_stream_manifest_t;
+
+/* Length of the chunk written at the end of an indexed stream, it holds the
+stream offset of the index chunk */
+#define XB_STREAM_INDEX_TRAILER_LEN (CHUNK_HEADER_CONSTANT_LEN + 8 + 8 + 4 + 8)
+
 struct xb_rstream_struct {
   my_off_t offset;
   File fd;
   std::mutex *mutex;
+  /* chunks to read, the whole stream is read sequentially if NULL */
+  const std::vector<xb_stream_index_entry_t> *plan;
+  size_t plan_pos;
 };
 
 typedef struct xb_wstream_struct xb_wstream_t;
@@ -61,18 +104,67 @@ typedef ssize_t xb_stream_write_callback(xb_wstream_file_t *file,
                                          void *userdata, const void *buf,
                                          size_t len);
 
+/* Gather write callback, must return # of bytes written or -1 on error */
+typedef ssize_t xb_stream_writev_callback(xb_wstream_file_t *file,
+                                          void *userdata,
+                                          const struct iovec *iov,
+                                          int iovcnt);
+
 xb_wstream_t *xb_stream_write_new(void);
 
+/* Checksum the chunks written to the stream with CRC-32C instead of CRC-32.
+Such chunks can not be read by older versions of xbstream. */
+void xb_stream_write_set_crc32c(xb_wstream_t *stream, bool crc32c);
+
+/* Do not checksum the data chunks, for pipes between trusted ends where the
+data already carries its own checksums. Such chunks can not be read by older
+versions of xbstream. */
+void xb_stream_write_set_skip_checksum(xb_wstream_t *stream, bool skip);
+
+/* Write an index of all chunks at the end of the stream, so that single files
+can be extracted from a seekable stream without reading all of it. The index
+is written with ignorable chunks. */
+void xb_stream_write_set_index(xb_wstream_t *stream, bool index);
+
+/* Group writes smaller than size bytes into chunks of up to size bytes. Chunk
+buffers are shared by the files of the stream and only held by a file while
+it has data buffered. Must be set before any data is written. */
+void xb_stream_write_set_chunk_size(xb_wstream_t *stream, size_t size);
+
+/* Write zero blocks of .ibd files as holes of sparse chunks, which are
+punched again on extraction. Applies to the files opened afterwards. */
+void xb_stream_write_set_detect_holes(xb_wstream_t *stream, bool detect);
+
+/* Write a manifest chunk when the first file is opened, telling a reader of
+several streams that this one is stream stream_no of n_streams of the backup
+id. The manifest is an ignorable chunk. Must be set before any file is
+opened. */
+void xb_stream_write_set_manifest(xb_wstream_t *stream, const char *id,
+                                  uint n_streams, uint stream_no);
+
+/* Chunks are written with onwritev if given, otherwise with one onwrite call
+per chunk part */
 xb_wstream_file_t *xb_stream_write_open(xb_wstream_t *stream, const char *path,
                                         MY_STAT *mystat, void *userdata,
-                                        xb_stream_write_callback *onwrite);
+                                        xb_stream_write_callback *onwrite,
+                                        xb_stream_writev_callback *onwritev);
 
 int xb_stream_write_data(xb_wstream_file_t *file, const void *buf, size_t len);
 
+int xb_stream_write_datav(xb_wstream_file_t *file, const struct iovec *iov,
+                          int iovcnt);
+
+/* Leased buffers are kept until they fill a chunk and written without
+copying. The lease is released in any case, also on error. */
+int xb_stream_write_lease(xb_wstream_file_t *file, ds_lease_t *lease);
+
 int xb_stream_write_sparse_data(xb_wstream_file_t *file, const void *buf,
                                 size_t len, size_t sparse_map_size,
                                 const ds_sparse_chunk_t *sparse_map);
 
+/* Write the data buffered for the file as a chunk */
+int xb_stream_write_flush(xb_wstream_file_t *file);
+
 int xb_stream_write_close(xb_wstream_file_t *file);
 
 int xb_stream_write_done(xb_wstream_t *stream);
@@ -90,7 +182,10 @@ typedef enum {
   XB_CHUNK_TYPE_UNKNOWN = '\0',
   XB_CHUNK_TYPE_PAYLOAD = 'P',
   XB_CHUNK_TYPE_SPARSE = 'S',
-  XB_CHUNK_TYPE_EOF = 'E'
+  XB_CHUNK_TYPE_EOF = 'E',
+  XB_CHUNK_TYPE_INDEX = 'I',
+  XB_CHUNK_TYPE_INDEX_TRAILER = 'T',
+  XB_CHUNK_TYPE_MANIFEST = 'M'
 } xb_chunk_type_t;
 
 typedef struct xb_rstream_struct xb_rstream_t;
@@ -131,11 +226,51 @@ xb_rstream_t *xb_stream_read_new_fifo(const char *path, int timeout);
  */
 xb_rstream_t *xb_stream_read_new_stdin(void);
 
+/**
+ * Read from an open file descriptor, e.g. one inherited from the shell
+ *
+ * @param[in] fd        descriptor, closed by xb_stream_read_done() if > 2
+ * @return pointer to xb_rstream_t object
+ */
+xb_rstream_t *xb_stream_read_new_fd(File fd);
+
 xb_rstream_result_t xb_stream_read_chunk(xb_rstream_t *stream,
                                          xb_rstream_chunk_t *chunk);
 
 int xb_stream_read_done(xb_rstream_t *stream);
 
+/**
+ * Read the index at the end of a seekable stream. The stream is positioned
+ * back where it was.
+ *
+ * @param[in]  stream   stream to read
+ * @param[out] index    chunks of each file
+ *
+ * @return false if the stream is not seekable, has no index or the index is
+ * corrupted
+ */
+bool xb_stream_read_index(xb_rstream_t *stream, xb_stream_index_t *index);
+
+/**
+ * Only read the given chunks of a seekable stream, in the given order.
+ * xb_stream_read_chunk() returns XB_STREAM_READ_EOF after the last one.
+ *
+ * @param[in] stream    stream to read
+ * @param[in] plan      chunks to read, must outlive the reads
+ */
+void xb_stream_read_set_plan(xb_rstream_t *stream,
+                             const std::vector<xb_stream_index_entry_t> *plan);
+
 xb_rstream_result_t xb_stream_validate_checksum(xb_rstream_chunk_t *chunk);
 
+/**
+ * Decode the payload of a manifest chunk.
+ *
+ * @param[in]  chunk     chunk of type XB_CHUNK_TYPE_MANIFEST
+ * @param[out] manifest  decoded manifest
+ * @return false if the payload is corrupted
+ */
+bool xb_stream_parse_manifest(const xb_rstream_chunk_t *chunk,
+                              xb_stream_manifest_t *manifest);
+
 #endif
@@ -52,6 +52,8 @@ xb_rstream_t *xb_stream_read_new_fifo(const char *path, int timeout) {
   stream->fd = fd;
   stream->offset = 0;
   stream->mutex = mutex;
+  stream->plan = NULL;
+  stream->plan_pos = 0;
 
 #ifdef __WIN__
   setmode(stream->fd, _O_BINARY);
@@ -61,14 +63,20 @@ xb_rstream_t *xb_stream_read_new_fifo(const char *path, int timeout) {
 }
 
 xb_rstream_t *xb_stream_read_new_stdin(void) {
+  return xb_stream_read_new_fd(fileno(stdin));
+}
+
+xb_rstream_t *xb_stream_read_new_fd(File fd) {
   xb_rstream_t *stream;
   std::mutex *mutex = new std::mutex();
   stream = (xb_rstream_t *)my_malloc(PSI_NOT_INSTRUMENTED, sizeof(xb_rstream_t),
                                      MYF(MY_FAE));
 
-  stream->fd = fileno(stdin);
+  stream->fd = fd;
   stream->offset = 0;
   stream->mutex = mutex;
+  stream->plan = NULL;
+  stream->plan_pos = 0;
 
 #ifdef __WIN__
   setmode(stream->fd, _O_BINARY);
@@ -82,6 +90,9 @@ static inline xb_chunk_type_t validate_chunk_type(uchar code) {
     case XB_CHUNK_TYPE_PAYLOAD:
     case XB_CHUNK_TYPE_SPARSE:
     case XB_CHUNK_TYPE_EOF:
+    case XB_CHUNK_TYPE_INDEX:
+    case XB_CHUNK_TYPE_INDEX_TRAILER:
+    case XB_CHUNK_TYPE_MANIFEST:
       return (xb_chunk_type_t)code;
     default:
       return XB_CHUNK_TYPE_UNKNOWN;
@@ -91,9 +102,9 @@ static inline xb_chunk_type_t validate_chunk_type(uchar code) {
 xb_rstream_result_t xb_stream_validate_checksum(xb_rstream_chunk_t *chunk) {
   ulong checksum;
 
-  checksum =
-      crc32_iso3309(chunk->checksum_part,
-                    static_cast<const uchar *>(chunk->data), chunk->length);
+  checksum = xb_stream_checksum(chunk->flags, chunk->checksum_part,
+                                static_cast<const uchar *>(chunk->data),
+                                chunk->length);
   if (checksum != chunk->checksum) {
     msg("xb_stream_read_chunk(): invalid checksum at offset "
         "0x%llx: expected 0x%lx, read 0x%lx.\n",
@@ -112,8 +123,8 @@ xb_rstream_result_t xb_stream_validate_checksum(xb_rstream_chunk_t *chunk) {
     }                                                             \
   } while (0)
 
-xb_rstream_result_t xb_stream_read_chunk(xb_rstream_t *stream,
-                                         xb_rstream_chunk_t *chunk) {
+static xb_rstream_result_t xb_stream_read_next_chunk(
+    xb_rstream_t *stream, xb_rstream_chunk_t *chunk) {
   uint pathlen;
   size_t tbytes;
   ulonglong ullval;
@@ -278,7 +289,8 @@ xb_rstream_result_t xb_stream_read_chunk(xb_rstream_t *stream,
     }
     for (size_t i = 0; i < chunk->sparse_map_size; ++i) {
       F_READ(ptr, 8);
-      chunk->checksum_part = crc32_iso3309(chunk->checksum_part, ptr, 8);
+      chunk->checksum_part =
+          xb_stream_checksum(chunk->flags, chunk->checksum_part, ptr, 8);
       chunk->sparse_map[i].skip = uint4korr(ptr);
       stream->offset += 4;
       ptr += 4;
@@ -301,6 +313,160 @@ err:
   return XB_STREAM_READ_ERROR;
 }
 
+xb_rstream_result_t xb_stream_read_chunk(xb_rstream_t *stream,
+                                         xb_rstream_chunk_t *chunk) {
+  if (stream->plan == NULL) {
+    return xb_stream_read_next_chunk(stream, chunk);
+  }
+
+  if (stream->plan_pos == stream->plan->size()) {
+    return XB_STREAM_READ_EOF;
+  }
+
+  const xb_stream_index_entry_t &entry = (*stream->plan)[stream->plan_pos++];
+
+  if (my_seek(stream->fd, entry.offset, MY_SEEK_SET, MYF(MY_WME)) !=
+      entry.offset) {
+    msg("xb_stream_read_chunk(): failed to seek to offset 0x%llx.\n",
+        (ulonglong)entry.offset);
+    return XB_STREAM_READ_ERROR;
+  }
+  stream->offset = entry.offset;
+
+  xb_rstream_result_t res = xb_stream_read_next_chunk(stream, chunk);
+  if (res == XB_STREAM_READ_EOF) {
+    msg("xb_stream_read_chunk(): unexpected end of stream at "
+        "offset 0x%llx.\n",
+        (ulonglong)entry.offset);
+    return XB_STREAM_READ_ERROR;
+  }
+
+  if (res == XB_STREAM_READ_CHUNK &&
+      (stream->offset - entry.offset != entry.length ||
+       (chunk->type != XB_CHUNK_TYPE_EOF &&
+        chunk->checksum != entry.checksum))) {
+    msg("xb_stream_read_chunk(): chunk at offset 0x%llx does not match the "
+        "stream index.\n",
+        (ulonglong)entry.offset);
+    return XB_STREAM_READ_ERROR;
+  }
+
+  return res;
+}
+
+bool xb_stream_read_index(xb_rstream_t *stream, xb_stream_index_t *index) {
+  uchar trailer[XB_STREAM_INDEX_TRAILER_LEN];
+  xb_rstream_chunk_t chunk;
+  my_off_t pos;
+  my_off_t end;
+  bool ret = false;
+
+  pos = my_tell(stream->fd, MYF(0));
+  if (pos == MY_FILEPOS_ERROR) {
+    /* not seekable */
+    return false;
+  }
+
+  end = my_seek(stream->fd, 0, MY_SEEK_END, MYF(0));
+  if (end == MY_FILEPOS_ERROR || end < XB_STREAM_INDEX_TRAILER_LEN ||
+      my_seek(stream->fd, end - XB_STREAM_INDEX_TRAILER_LEN, MY_SEEK_SET,
+              MYF(0)) == MY_FILEPOS_ERROR ||
+      xb_read_full(stream->fd, trailer, sizeof(trailer)) < sizeof(trailer)) {
+    my_seek(stream->fd, pos, MY_SEEK_SET, MYF(0));
+    return false;
+  }
+
+  const uchar *ptr = trailer;
+  if (memcmp(ptr, XB_STREAM_CHUNK_MAGIC, 8) != 0 ||
+      ptr[CHUNK_TYPE_OFFSET] != XB_CHUNK_TYPE_INDEX_TRAILER ||
+      uint4korr(ptr + PATH_LENGTH_OFFSET) != 0 ||
+      uint8korr(ptr + CHUNK_HEADER_CONSTANT_LEN) != 8) {
+    /* stream written without an index */
+    my_seek(stream->fd, pos, MY_SEEK_SET, MYF(0));
+    return false;
+  }
+  ptr += XB_STREAM_INDEX_TRAILER_LEN - 8;
+
+  /* read the index chunk as any other chunk */
+  xb_stream_index_entry_t entry = {uint8korr(ptr), 0, 0};
+  const std::vector<xb_stream_index_entry_t> *saved_plan = stream->plan;
+  const my_off_t saved_offset = stream->offset;
+
+  memset(&chunk, 0, sizeof(chunk));
+
+  if (entry.offset >= end - XB_STREAM_INDEX_TRAILER_LEN ||
+      my_seek(stream->fd, entry.offset, MY_SEEK_SET, MYF(0)) !=
+          entry.offset) {
+    goto done;
+  }
+  stream->offset = entry.offset;
+  stream->plan = NULL;
+
+  if (xb_stream_read_next_chunk(stream, &chunk) != XB_STREAM_READ_CHUNK ||
+      chunk.type != XB_CHUNK_TYPE_INDEX ||
+      xb_stream_validate_checksum(&chunk) != XB_STREAM_READ_CHUNK) {
+    goto done;
+  }
+
+  ptr = static_cast<const uchar *>(chunk.data);
+  for (const uchar *data_end = ptr + chunk.length; ptr < data_end;) {
+    if (data_end - ptr < 4) goto done;
+    const size_t path_len = uint4korr(ptr);
+    ptr += 4;
+    if (path_len >= FN_REFLEN || (size_t)(data_end - ptr) < path_len + 4)
+      goto done;
+    std::string path(reinterpret_cast<const char *>(ptr), path_len);
+    ptr += path_len;
+    const size_t n_chunks = uint4korr(ptr);
+    ptr += 4;
+    if ((size_t)(data_end - ptr) / 20 < n_chunks) goto done;
+    auto &chunks = (*index)[path];
+    for (size_t i = 0; i < n_chunks; i++) {
+      chunks.push_back({uint8korr(ptr), (size_t)uint8korr(ptr + 8),
+                        (ulong)uint4korr(ptr + 16)});
+      ptr += 20;
+    }
+  }
+  ret = true;
+
+done:
+  if (!ret) {
+    msg("xb_stream_read_index(): the stream index is corrupted, reading the "
+        "whole stream.\n");
+    index->clear();
+  }
+  stream->offset = saved_offset;
+  stream->plan = saved_plan;
+  my_seek(stream->fd, pos, MY_SEEK_SET, MYF(0));
+  my_free(chunk.raw_data);
+  my_free(chunk.sparse_map);
+
+  return ret;
+}
+
+/* Manifest payload: stream number, number of streams, backup id */
+bool xb_stream_parse_manifest(const xb_rstream_chunk_t *chunk,
+                              xb_stream_manifest_t *manifest) {
+  const uchar *ptr = static_cast<const uchar *>(chunk->data);
+
+  if (chunk->length < 8 || chunk->length - 8 >= FN_REFLEN) {
+    return false;
+  }
+
+  manifest->stream_no = uint4korr(ptr);
+  manifest->n_streams = uint4korr(ptr + 4);
+  manifest->id.assign(reinterpret_cast<const char *>(ptr + 8),
+                      chunk->length - 8);
+
+  return manifest->stream_no < manifest->n_streams;
+}
+
+void xb_stream_read_set_plan(xb_rstream_t *stream,
+                             const std::vector<xb_stream_index_entry_t> *plan) {
+  stream->plan = plan;
+  stream->plan_pos = 0;
+}
+
 int xb_stream_read_done(xb_rstream_t *stream) {
   /*
    * FIFO stream needs to close FD otherwise other part might not get notified
@@ -0,0 +1,307 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+Random access reader of xbstream files.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include "xbstream_reader.h"
+#include <fcntl.h>
+#include <my_byteorder.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include "common.h"
+#include "msg.h"
+
+my_off_t Xbstream_reader::Chunk::file_length() const {
+  my_off_t len = length;
+  for (size_t i = 0; i < sparse_map_size; i++) {
+    len += uint4korr(sparse_map + i * 8);
+  }
+  return len;
+}
+
+bool Xbstream_reader::open(const char *path) {
+  close();
+
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    msg("Xbstream_reader: failed to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    msg("Xbstream_reader: failed to stat %s: %s\n", path, strerror(errno));
+    ::close(fd);
+    return false;
+  }
+
+  if (st.st_size > 0) {
+    void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+      msg("Xbstream_reader: failed to map %s: %s\n", path, strerror(errno));
+      ::close(fd);
+      return false;
+    }
+    map = static_cast<const uchar *>(ptr);
+    map_size = st.st_size;
+  }
+
+  /* the mapping stays valid after the file is closed */
+  ::close(fd);
+
+  /* headers are read one after the other, payloads are skipped */
+  posix_madvise(const_cast<uchar *>(map), map_size, POSIX_MADV_RANDOM);
+
+  my_off_t pos = 0;
+  while (pos < map_size) {
+    Chunk chunk;
+    std::string file_path;
+    my_off_t next;
+
+    if (!parse(pos, &chunk, &file_path, &next)) {
+      close();
+      return false;
+    }
+    pos = next;
+
+    if (chunk.type == XB_CHUNK_TYPE_UNKNOWN ||
+        chunk.type == XB_CHUNK_TYPE_INDEX ||
+        chunk.type == XB_CHUNK_TYPE_INDEX_TRAILER ||
+        chunk.type == XB_CHUNK_TYPE_MANIFEST) {
+      continue;
+    }
+
+    auto it = by_path.find(file_path);
+    if (it == by_path.end()) {
+      it = by_path.emplace(file_path, File_chunks()).first;
+      paths.push_back(file_path);
+    }
+
+    if (chunk.type == XB_CHUNK_TYPE_EOF) {
+      it->second.eof = true;
+      continue;
+    }
+
+    std::vector<Chunk> &chunks = it->second.chunks;
+    const my_off_t expected =
+        chunks.empty() ? 0 : chunks.back().offset + chunks.back().file_length();
+    if (chunk.offset != expected) {
+      msg("Xbstream_reader: out-of-order chunk of %s at offset 0x%llx: "
+          "real offset = 0x%llx, expected offset = 0x%llx\n",
+          file_path.c_str(), (ulonglong)chunk.stream_offset,
+          (ulonglong)chunk.offset, (ulonglong)expected);
+      close();
+      return false;
+    }
+    chunks.push_back(chunk);
+  }
+
+  return true;
+}
+
+void Xbstream_reader::close() {
+  if (map != nullptr) {
+    munmap(const_cast<uchar *>(map), map_size);
+  }
+  map = nullptr;
+  map_size = 0;
+  paths.clear();
+  by_path.clear();
+}
+
+bool Xbstream_reader::parse(my_off_t pos, Chunk *chunk, std::string *path,
+                            my_off_t *next) const {
+  const uchar *ptr = map + pos;
+  size_t left = map_size - pos;
+
+  /* Check that the next n bytes are mapped */
+#define NEED(n)                                                          \
+  do {                                                                   \
+    if (left < (n)) {                                                    \
+      msg("Xbstream_reader: unexpected end of stream at offset 0x%llx\n", \
+          (ulonglong)pos);                                               \
+      return false;                                                      \
+    }                                                                    \
+  } while (0)
+
+  NEED(CHUNK_HEADER_CONSTANT_LEN);
+
+  if (memcmp(ptr, XB_STREAM_CHUNK_MAGIC, 8) != 0) {
+    msg("Xbstream_reader: wrong chunk magic at offset 0x%llx\n",
+        (ulonglong)pos);
+    return false;
+  }
+
+  chunk->stream_offset = pos;
+  chunk->flags = ptr[8];
+  chunk->type = static_cast<xb_chunk_type_t>(ptr[CHUNK_TYPE_OFFSET]);
+  switch (chunk->type) {
+    case XB_CHUNK_TYPE_PAYLOAD:
+    case XB_CHUNK_TYPE_SPARSE:
+    case XB_CHUNK_TYPE_EOF:
+    case XB_CHUNK_TYPE_INDEX:
+    case XB_CHUNK_TYPE_INDEX_TRAILER:
+    case XB_CHUNK_TYPE_MANIFEST:
+      break;
+    default:
+      if (!(chunk->flags & XB_STREAM_FLAG_IGNORABLE)) {
+        msg("Xbstream_reader: unknown chunk type 0x%lx at offset 0x%llx\n",
+            (ulong)ptr[CHUNK_TYPE_OFFSET], (ulonglong)pos);
+        return false;
+      }
+      chunk->type = XB_CHUNK_TYPE_UNKNOWN;
+  }
+
+  const size_t pathlen = uint4korr(ptr + PATH_LENGTH_OFFSET);
+  if (pathlen >= FN_REFLEN) {
+    msg("Xbstream_reader: path length (%lu) is too large at offset 0x%llx\n",
+        (ulong)pathlen, (ulonglong)pos);
+    return false;
+  }
+  ptr += CHUNK_HEADER_CONSTANT_LEN;
+  left -= CHUNK_HEADER_CONSTANT_LEN;
+
+  NEED(pathlen);
+  path->assign(reinterpret_cast<const char *>(ptr), pathlen);
+  ptr += pathlen;
+  left -= pathlen;
+
+  chunk->offset = 0;
+  chunk->length = 0;
+  chunk->checksum = 0;
+  chunk->sparse_map_size = 0;
+  chunk->sparse_map = nullptr;
+  chunk->data = nullptr;
+
+  if (chunk->type == XB_CHUNK_TYPE_EOF) {
+    *next = ptr - map;
+    return true;
+  }
+
+  if (chunk->type == XB_CHUNK_TYPE_SPARSE) {
+    NEED(4);
+    chunk->sparse_map_size = uint4korr(ptr);
+    ptr += 4;
+    left -= 4;
+  }
+
+  NEED(8 + 8 + 4);
+  const ulonglong length = uint8korr(ptr);
+  chunk->offset = uint8korr(ptr + 8);
+  chunk->checksum = uint4korr(ptr + 16);
+  ptr += 8 + 8 + 4;
+  left -= 8 + 8 + 4;
+
+  if (chunk->sparse_map_size > left / 8 ||
+      length > left - chunk->sparse_map_size * 8) {
+    msg("Xbstream_reader: chunk at offset 0x%llx is truncated\n",
+        (ulonglong)pos);
+    return false;
+  }
+
+  chunk->sparse_map = ptr;
+  ptr += chunk->sparse_map_size * 8;
+  chunk->length = length;
+  chunk->data = ptr;
+  ptr += length;
+
+#undef NEED
+
+  *next = ptr - map;
+  return true;
+}
+
+const std::vector<Xbstream_reader::Chunk> *Xbstream_reader::chunks(
+    const std::string &path) const {
+  auto it = by_path.find(path);
+  return it == by_path.end() ? nullptr : &it->second.chunks;
+}
+
+bool Xbstream_reader::complete(const std::string &path) const {
+  auto it = by_path.find(path);
+  return it != by_path.end() && it->second.eof;
+}
+
+bool Xbstream_reader::verify(const Chunk &chunk) const {
+  ulong checksum = xb_stream_checksum(chunk.flags, 0, chunk.sparse_map,
+                                      chunk.sparse_map_size * 8);
+  checksum = xb_stream_checksum(chunk.flags, checksum, chunk.data,
+                                chunk.length);
+  return checksum == chunk.checksum;
+}
+
+size_t Xbstream_reader::pread(const std::string &path, void *buf, size_t len,
+                              my_off_t offset) const {
+  const std::vector<Chunk> *file_chunks = chunks(path);
+  uchar *out = static_cast<uchar *>(buf);
+  size_t done = 0;
+
+  if (file_chunks == nullptr) {
+    return 0;
+  }
+
+  /* first chunk starting after offset, the data is in the one before */
+  auto it = std::upper_bound(
+      file_chunks->begin(), file_chunks->end(), offset,
+      [](my_off_t off, const Chunk &chunk) { return off < chunk.offset; });
+  if (it == file_chunks->begin()) {
+    return 0;
+  }
+  --it;
+
+  for (; it != file_chunks->end() && done < len; ++it) {
+    /* file offset and payload position of the current range */
+    my_off_t range_offset = it->offset;
+    const uchar *data = it->data;
+
+    /* a sparse chunk is a list of holes each followed by data, a regular
+    chunk is a single range of data */
+    const size_t n_ranges = std::max<size_t>(it->sparse_map_size, 1);
+    for (size_t i = 0; i < n_ranges && done < len; i++) {
+      my_off_t hole = 0;
+      my_off_t range_len = it->length;
+      if (it->sparse_map_size > 0) {
+        hole = uint4korr(it->sparse_map + i * 8);
+        range_len = uint4korr(it->sparse_map + i * 8 + 4);
+      }
+
+      const my_off_t pos = offset + done;
+      if (pos < range_offset + hole) {
+        const size_t n =
+            std::min<my_off_t>(range_offset + hole - pos, len - done);
+        memset(out + done, 0, n);
+        done += n;
+      }
+      range_offset += hole;
+
+      if (done < len && offset + done < range_offset + range_len) {
+        const my_off_t in_range = offset + done - range_offset;
+        const size_t n = std::min<my_off_t>(range_len - in_range, len - done);
+        memcpy(out + done, data + in_range, n);
+        done += n;
+      }
+      range_offset += range_len;
+      data += range_len;
+    }
+  }
+
+  return done;
+}
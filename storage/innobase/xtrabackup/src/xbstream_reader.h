@@ -0,0 +1,128 @@
+/******************************************************
+Copyright (c) 2024 Percona LLC and/or its affiliates.
+
+Random access reader of xbstream files.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef XBSTREAM_READER_H
+#define XBSTREAM_READER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xbstream.h"
+
+/** Reader of an xbstream saved to a local file. The file is mapped into
+memory and only the chunk headers are parsed when it is opened, payloads are
+accessed in place. Files can then be iterated, verified and read at any
+offset without going through the whole stream, which is what partial restore
+and verification tools need.
+
+  Xbstream_reader reader;
+  if (!reader.open("backup.xbstream")) ...
+  for (const auto &path : reader.files()) {
+    for (const auto &chunk : *reader.chunks(path)) ...
+  }
+  reader.pread("ibdata1", buf, sizeof(buf), 0);
+
+The reader does not change after open(), all const methods can be called
+from several threads. */
+class Xbstream_reader {
+ public:
+  /** Chunk of a file, pointers are into the mapped stream */
+  struct Chunk {
+    xb_chunk_type_t type;
+    uchar flags;
+    /** offset of the chunk header in the stream */
+    my_off_t stream_offset;
+    /** offset of the chunk data in the file */
+    my_off_t offset;
+    /** payload length */
+    size_t length;
+    ulong checksum;
+    /** number of (skip, length) pairs of 4 bytes each in sparse_map */
+    size_t sparse_map_size;
+    const uchar *sparse_map;
+    const uchar *data;
+
+    /** @return bytes of the file covered by the chunk, holes included */
+    my_off_t file_length() const;
+  };
+
+  Xbstream_reader() = default;
+  Xbstream_reader(const Xbstream_reader &) = delete;
+  Xbstream_reader &operator=(const Xbstream_reader &) = delete;
+  ~Xbstream_reader() { close(); }
+
+  /** Map a stream file and parse the headers of all chunks.
+  @param[in]  path  stream file
+  @return false if the file can not be mapped or is not a valid stream */
+  bool open(const char *path);
+
+  /** Unmap the stream, invalidates all chunks. */
+  void close();
+
+  /** @return paths of the files in the order they appear in the stream */
+  const std::vector<std::string> &files() const { return paths; }
+
+  /** Chunks of a file in stream order, the EOF chunk excluded.
+  @param[in]  path  file path in the stream
+  @return nullptr if there is no such file */
+  const std::vector<Chunk> *chunks(const std::string &path) const;
+
+  /** @return true if the whole file was streamed, up to its EOF chunk */
+  bool complete(const std::string &path) const;
+
+  /** Check the checksum of a chunk.
+  @param[in]  chunk  chunk of this stream
+  @return true if the payload matches its checksum */
+  bool verify(const Chunk &chunk) const;
+
+  /** Read file data at the given offset. Holes of sparse chunks read as
+  zeroes, the read stops at the end of the streamed data.
+  @param[in]  path    file path in the stream
+  @param[out] buf     buffer of at least len bytes
+  @param[in]  len     bytes to read
+  @param[in]  offset  offset in the file
+  @return bytes read */
+  size_t pread(const std::string &path, void *buf, size_t len,
+               my_off_t offset) const;
+
+ private:
+  struct File_chunks {
+    std::vector<Chunk> chunks;
+    bool eof{false};
+  };
+
+  /** Parse the chunk header at the given stream offset.
+  @param[in]   pos    stream offset
+  @param[out]  chunk  parsed chunk
+  @param[out]  path   file path of the chunk
+  @param[out]  next   stream offset of the next chunk
+  @return false if the chunk is truncated or corrupted */
+  bool parse(my_off_t pos, Chunk *chunk, std::string *path,
+             my_off_t *next) const;
+
+  const uchar *map{nullptr};
+  size_t map_size{0};
+
+  std::vector<std::string> paths;
+  std::unordered_map<std::string, File_chunks> by_path;
+};
+
+#endif
@@ -24,39 +24,87 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <mysql/service_mysql_alloc.h>
 #include <mysql_version.h>
 #include <zlib.h>
+#include <algorithm>
+#include <condition_variable>
 #include <mutex>
+#include <vector>
 #include "common.h"
 #include "crc_glue.h"
 #include "datasink.h"
+#include "memory_budget.h"
 #include "msg.h"
+#include "trace.h"
+#include "wait_state.h"
 #include "xbstream.h"
 
-/* Group writes smaller than this into a single chunk */
-#define XB_STREAM_MIN_CHUNK_SIZE (10 * 1024 * 1024)
+/* Do not keep more leased memory than this many times the chunk size waiting
+for a chunk to fill */
+#define XB_STREAM_MAX_LEASED_CHUNKS 2
+
+/* Zero blocks of this size aligned on it in the file are written as holes */
+#define XB_STREAM_HOLE_SIZE 4096
+
+/* Holes and data ranges of sparse maps are stored as 32-bit integers */
+#define XB_STREAM_MAX_SPARSE_RANGE (1UL << 30)
+
+/* A chunk queued for writing, owned by the thread waiting for it */
+typedef struct {
+  xb_wstream_file_t *file;
+  const struct iovec *iov;
+  int iovcnt;
+  bool done;
+  int rc;
+} xb_stream_pending_t;
 
 struct xb_wstream_struct {
   std::mutex *mutex;
+  uchar flags;              /* flags of the data chunks */
+  my_off_t offset;          /* bytes written to the stream */
+  xb_stream_index_t *index; /* chunks written, NULL if not indexed */
+  /* output of the first opened file, used for the index and manifest */
+  xb_wstream_file_t *index_file;
+  std::vector<uchar> *manifest; /* manifest payload, NULL if none */
+  /* chunks waiting for the thread writing to the stream */
+  std::vector<xb_stream_pending_t *> *pending;
+  std::condition_variable *written; /* signalled after each batch */
+  bool writing;                     /* a batch is being written */
+  bool failed;                      /* a write failed, the stream is broken */
+  size_t chunk_size; /* writes smaller than this are grouped into chunks */
+  bool detect_holes; /* write zero blocks of datafiles as holes */
+  /* chunk buffers not used by any file, protected by pool_mutex */
+  std::vector<char *> *free_chunks;
+  std::mutex *pool_mutex;
 };
 
 struct xb_wstream_file_struct {
   xb_wstream_t *stream;
   char *path;
   ulong path_len;
-  char chunk[XB_STREAM_MIN_CHUNK_SIZE];
+  char *chunk; /* taken from the pool while data is buffered */
   char *chunk_ptr;
   size_t chunk_free;
+  std::vector<ds_lease_t *> *leases; /* leased buffers of the next chunk */
+  size_t leases_len;                 /* bytes of data in leases */
+  size_t leases_size;                /* bytes of memory held by leases */
   char *sparse_map_buf;
   size_t sparse_map_buf_size;
   my_off_t offset;
+  bool detect_holes; /* find zero blocks in the chunks of this file */
   void *userdata;
   xb_stream_write_callback *write;
+  xb_stream_writev_callback *writev;
 };
 
 static int xb_stream_flush(xb_wstream_file_t *file);
-static int xb_stream_write_chunk(xb_wstream_file_t *file, const void *buf,
+static int xb_stream_flush_leases(xb_wstream_file_t *file);
+static int xb_stream_write_chunk(xb_wstream_file_t *file,
+                                 const struct iovec *iov, int iovcnt,
                                  size_t len, size_t sparse_map_size,
                                  const ds_sparse_chunk_t *sparse_map);
 static int xb_stream_write_eof(xb_wstream_file_t *file);
+static int xb_stream_write_index(xb_wstream_t *stream);
+static int xb_stream_write_ignorable(xb_wstream_t *stream, uchar type,
+                                     const uchar *buf, size_t len);
 
 static ssize_t xb_stream_default_write_callback(xb_wstream_file_t *file
                                                 __attribute__((unused)),
@@ -69,6 +117,19 @@ static ssize_t xb_stream_default_write_callback(xb_wstream_file_t *file
   return len;
 }
 
+static ssize_t xb_stream_default_writev_callback(xb_wstream_file_t *file
+                                                 __attribute__((unused)),
+                                                 void *userdata
+                                                 __attribute__((unused)),
+                                                 const struct iovec *iov,
+                                                 int iovcnt) {
+  if (ds_writev_fd(fileno(stdout), iov, iovcnt)) return -1;
+
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+  return len;
+}
+
 xb_wstream_t *xb_stream_write_new(void) {
   xb_wstream_t *stream;
   std::mutex *mutex = new std::mutex();
@@ -76,13 +137,111 @@ xb_wstream_t *xb_stream_write_new(void) {
   stream = (xb_wstream_t *)my_malloc(PSI_NOT_INSTRUMENTED, sizeof(xb_wstream_t),
                                      MYF(MY_FAE | MY_ZEROFILL));
   stream->mutex = mutex;
+  stream->flags = 0;
+  stream->offset = 0;
+  stream->index = NULL;
+  stream->index_file = NULL;
+  stream->manifest = NULL;
+  stream->pending = new std::vector<xb_stream_pending_t *>();
+  stream->written = new std::condition_variable();
+  stream->writing = false;
+  stream->failed = false;
+  stream->chunk_size = XB_STREAM_DEFAULT_CHUNK_SIZE;
+  stream->detect_holes = false;
+  stream->free_chunks = new std::vector<char *>();
+  stream->pool_mutex = new std::mutex();
   return stream;
 }
 
+void xb_stream_write_set_crc32c(xb_wstream_t *stream, bool crc32c) {
+  if (crc32c) {
+    stream->flags |= XB_STREAM_FLAG_CRC32C;
+  } else {
+    stream->flags &= ~XB_STREAM_FLAG_CRC32C;
+  }
+}
+
+void xb_stream_write_set_skip_checksum(xb_wstream_t *stream, bool skip) {
+  if (skip) {
+    stream->flags |= XB_STREAM_FLAG_NO_CHECKSUM;
+  } else {
+    stream->flags &= ~XB_STREAM_FLAG_NO_CHECKSUM;
+  }
+}
+
+void xb_stream_write_set_chunk_size(xb_wstream_t *stream, size_t size) {
+  xb_a(size > 0);
+  xb_ad(stream->free_chunks->empty());
+  stream->chunk_size = size;
+}
+
+/* Take a chunk buffer from the pool or allocate a new one */
+static char *xb_stream_chunk_get(xb_wstream_t *stream) {
+  {
+    std::lock_guard<std::mutex> guard(*stream->pool_mutex);
+    if (!stream->free_chunks->empty()) {
+      char *chunk = stream->free_chunks->back();
+      stream->free_chunks->pop_back();
+      return chunk;
+    }
+  }
+
+  xb::memory::charge(xb::memory::STREAM, stream->chunk_size);
+  return static_cast<char *>(
+      my_malloc(PSI_NOT_INSTRUMENTED, stream->chunk_size, MYF(MY_FAE)));
+}
+
+/* Return the chunk buffer of a file to the pool */
+static void xb_stream_chunk_put(xb_wstream_file_t *file) {
+  xb_wstream_t *stream = file->stream;
+
+  if (file->chunk == NULL) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(*stream->pool_mutex);
+    stream->free_chunks->push_back(file->chunk);
+  }
+
+  file->chunk = NULL;
+  file->chunk_ptr = NULL;
+  file->chunk_free = 0;
+}
+
+void xb_stream_write_set_detect_holes(xb_wstream_t *stream, bool detect) {
+  stream->detect_holes = detect;
+}
+
+void xb_stream_write_set_manifest(xb_wstream_t *stream, const char *id,
+                                  uint n_streams, uint stream_no) {
+  const size_t id_len = strlen(id);
+
+  xb_a(stream_no < n_streams);
+  xb_ad(stream->index_file == NULL);
+
+  delete stream->manifest;
+  stream->manifest = new std::vector<uchar>(8 + id_len);
+  uchar *ptr = stream->manifest->data();
+  int4store(ptr, stream_no);
+  int4store(ptr + 4, n_streams);
+  memcpy(ptr + 8, id, id_len);
+}
+
+void xb_stream_write_set_index(xb_wstream_t *stream, bool index) {
+  if (index && stream->index == NULL) {
+    stream->index = new xb_stream_index_t();
+  } else if (!index) {
+    delete stream->index;
+    stream->index = NULL;
+  }
+}
+
 xb_wstream_file_t *xb_stream_write_open(xb_wstream_t *stream, const char *path,
                                         MY_STAT *mystat __attribute__((unused)),
                                         void *userdata,
-                                        xb_stream_write_callback *onwrite) {
+                                        xb_stream_write_callback *onwrite,
+                                        xb_stream_writev_callback *onwritev) {
   xb_wstream_file_t *file;
   ulong path_len;
 
@@ -103,26 +262,85 @@ xb_wstream_file_t *xb_stream_write_open(xb_wstream_t *stream, const char *path,
 
   file->stream = stream;
   file->offset = 0;
-  file->chunk_ptr = file->chunk;
-  file->chunk_free = XB_STREAM_MIN_CHUNK_SIZE;
+  file->chunk = NULL;
+  file->chunk_ptr = NULL;
+  file->chunk_free = 0;
+  file->leases = NULL;
+  file->leases_len = 0;
+  file->leases_size = 0;
+  /* only datafiles are extracted with ds_local, which recreates holes */
+  file->detect_holes = stream->detect_holes && path_len > 4 &&
+                       strcmp(path + path_len - 4, ".ibd") == 0;
   if (onwrite) {
 #ifdef __WIN__
     setmode(fileno(stdout), _O_BINARY);
 #endif
     file->userdata = userdata;
     file->write = onwrite;
+    file->writev = onwritev;
   } else {
     file->userdata = NULL;
     file->write = xb_stream_default_write_callback;
+    file->writev = xb_stream_default_writev_callback;
+  }
+
+  bool write_manifest = false;
+  if (stream->index != NULL || stream->manifest != NULL) {
+    std::lock_guard<std::mutex> guard(*stream->mutex);
+    if (stream->index_file == NULL) {
+      /* a copy which is not closed with the file */
+      stream->index_file = static_cast<xb_wstream_file_t *>(
+          my_malloc(PSI_NOT_INSTRUMENTED, sizeof(xb_wstream_file_t),
+                    MYF(MY_FAE | MY_ZEROFILL)));
+      stream->index_file->stream = stream;
+      stream->index_file->path = const_cast<char *>("");
+      stream->index_file->userdata = file->userdata;
+      stream->index_file->write = file->write;
+      stream->index_file->writev = file->writev;
+      write_manifest = stream->manifest != NULL;
+    }
+  }
+
+  /* the stream mutex is taken again to append the chunk */
+  if (write_manifest &&
+      xb_stream_write_ignorable(stream, XB_CHUNK_TYPE_MANIFEST,
+                                stream->manifest->data(),
+                                stream->manifest->size())) {
+    msg("xb_stream_write_open(): failed to write the stream manifest.\n");
+    my_free(file);
+    return NULL;
   }
 
   return file;
 }
 
 int xb_stream_write_data(xb_wstream_file_t *file, const void *buf, size_t len) {
+  struct iovec iov = {const_cast<void *>(buf), len};
+
+  return xb_stream_write_datav(file, &iov, 1);
+}
+
+int xb_stream_write_datav(xb_wstream_file_t *file, const struct iovec *iov,
+                          int iovcnt) {
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+
+  if (file->chunk == NULL && len < file->stream->chunk_size) {
+    /* Most datafiles are written with large sparse writes which bypass the
+    chunk buffer, only take it from the pool when it is needed */
+    file->chunk = xb_stream_chunk_get(file->stream);
+    file->chunk_ptr = file->chunk;
+    file->chunk_free = file->stream->chunk_size;
+  }
+
   if (len < file->chunk_free) {
-    memcpy(file->chunk_ptr, buf, len);
-    file->chunk_ptr += len;
+    /* keep the data in order */
+    if (xb_stream_flush_leases(file)) return 1;
+
+    for (int i = 0; i < iovcnt; i++) {
+      memcpy(file->chunk_ptr, iov[i].iov_base, iov[i].iov_len);
+      file->chunk_ptr += iov[i].iov_len;
+    }
     file->chunk_free -= len;
 
     return 0;
@@ -130,7 +348,32 @@ int xb_stream_write_data(xb_wstream_file_t *file, const void *buf, size_t len) {
 
   if (xb_stream_flush(file)) return 1;
 
-  return xb_stream_write_chunk(file, buf, len, 0, nullptr);
+  return xb_stream_write_chunk(file, iov, iovcnt, len, 0, nullptr);
+}
+
+int xb_stream_write_lease(xb_wstream_file_t *file, ds_lease_t *lease) {
+  /* keep the data in order, the chunk buffer and the leases are never used
+  at the same time */
+  if (file->chunk_ptr != file->chunk && xb_stream_flush(file)) {
+    ds_lease_release(lease);
+    return 1;
+  }
+
+  if (file->leases == NULL) {
+    file->leases = new std::vector<ds_lease_t *>();
+  }
+
+  file->leases->push_back(lease);
+  file->leases_len += ds_lease_len(lease);
+  file->leases_size += lease->size;
+
+  if (file->leases_len >= file->stream->chunk_size ||
+      file->leases_size >=
+          XB_STREAM_MAX_LEASED_CHUNKS * file->stream->chunk_size) {
+    return xb_stream_flush_leases(file);
+  }
+
+  return 0;
 }
 
 int xb_stream_write_sparse_data(xb_wstream_file_t *file, const void *buf,
@@ -138,7 +381,14 @@ int xb_stream_write_sparse_data(xb_wstream_file_t *file, const void *buf,
                                 const ds_sparse_chunk_t *sparse_map) {
   if (xb_stream_flush(file)) return 1;
 
-  return xb_stream_write_chunk(file, buf, len, sparse_map_size, sparse_map);
+  struct iovec iov = {const_cast<void *>(buf), len};
+
+  return xb_stream_write_chunk(file, &iov, 1, len, sparse_map_size,
+                               sparse_map);
+}
+
+int xb_stream_write_flush(xb_wstream_file_t *file) {
+  return xb_stream_flush(file);
 }
 
 int xb_stream_write_close(xb_wstream_file_t *file) {
@@ -147,6 +397,8 @@ int xb_stream_write_close(xb_wstream_file_t *file) {
     rc = 1;
   }
 
+  xb_stream_chunk_put(file);
+  delete file->leases;
   my_free(file->sparse_map_buf);
   my_free(file);
 
@@ -154,31 +406,271 @@ int xb_stream_write_close(xb_wstream_file_t *file) {
 }
 
 int xb_stream_write_done(xb_wstream_t *stream) {
+  int rc = 0;
+
+  if (stream->index != NULL && stream->index_file != NULL) {
+    rc = xb_stream_write_index(stream);
+  }
+
+  xb_ad(stream->pending->empty());
+
+  delete stream->index;
+  delete stream->manifest;
+  my_free(stream->index_file);
+  for (auto chunk : *stream->free_chunks) {
+    my_free(chunk);
+  }
+  xb::memory::uncharge(xb::memory::STREAM,
+                       stream->free_chunks->size() * stream->chunk_size);
+  delete stream->free_chunks;
+  delete stream->pool_mutex;
+  delete stream->pending;
+  delete stream->written;
   delete stream->mutex;
   my_free(stream);
 
-  return 0;
+  return rc;
 }
 
 static int xb_stream_flush(xb_wstream_file_t *file) {
+  if (xb_stream_flush_leases(file)) {
+    return 1;
+  }
+
   if (file->chunk_ptr == file->chunk) {
     return 0;
   }
 
-  if (xb_stream_write_chunk(file, file->chunk, file->chunk_ptr - file->chunk, 0,
-                            nullptr)) {
+  struct iovec iov = {file->chunk,
+                      static_cast<size_t>(file->chunk_ptr - file->chunk)};
+
+  if (xb_stream_write_chunk(file, &iov, 1, iov.iov_len, 0, nullptr)) {
     return 1;
   }
 
-  file->chunk_ptr = file->chunk;
-  file->chunk_free = XB_STREAM_MIN_CHUNK_SIZE;
+  /* files only hold a buffer while they have data waiting in it */
+  xb_stream_chunk_put(file);
 
   return 0;
 }
 
-static int xb_stream_write_chunk(xb_wstream_file_t *file, const void *buf,
+/* Write the leased buffers as a single chunk and release them */
+static int xb_stream_flush_leases(xb_wstream_file_t *file) {
+  if (file->leases == NULL || file->leases->empty()) {
+    return 0;
+  }
+
+  std::vector<struct iovec> iov;
+  for (const auto lease : *file->leases) {
+    iov.insert(iov.end(), lease->iov, lease->iov + lease->iovcnt);
+  }
+
+  const int rc = xb_stream_write_chunk(file, iov.data(), iov.size(),
+                                       file->leases_len, 0, nullptr);
+
+  for (auto lease : *file->leases) {
+    ds_lease_release(lease);
+  }
+  file->leases->clear();
+  file->leases_len = 0;
+  file->leases_size = 0;
+
+  return rc;
+}
+
+/* Write a batch of chunks with as few calls as possible */
+static int xb_stream_write_batch(
+    const std::vector<xb_stream_pending_t *> &batch) {
+  std::vector<struct iovec> iov;
+
+  for (size_t i = 0; i < batch.size();) {
+    xb_wstream_file_t *file = batch[i]->file;
+
+    if (file->writev == NULL) {
+      for (int j = 0; j < batch[i]->iovcnt; j++) {
+        if (file->write(file, file->userdata, batch[i]->iov[j].iov_base,
+                        batch[i]->iov[j].iov_len) == -1)
+          return 1;
+      }
+      i++;
+      continue;
+    }
+
+    /* consecutive chunks going to the same output in a single write */
+    iov.clear();
+    for (; i < batch.size() && batch[i]->file->writev == file->writev &&
+           batch[i]->file->userdata == file->userdata;
+         i++) {
+      iov.insert(iov.end(), batch[i]->iov, batch[i]->iov + batch[i]->iovcnt);
+    }
+
+    if (file->writev(file, file->userdata, iov.data(), iov.size()) == -1)
+      return 1;
+  }
+
+  return 0;
+}
+
+/* Append a framed chunk to the stream and wait until it is written. The
+stream mutex is only held to queue the chunk: the first thread finding no
+write in progress writes all queued chunks, the others wait for it. */
+static int xb_stream_append(xb_wstream_file_t *file, const struct iovec *iov,
+                            int iovcnt, ulong checksum) {
+  xb_wstream_t *stream = file->stream;
+  xb_stream_pending_t chunk = {file, iov, iovcnt, false, 0};
+  size_t len = 0;
+
+  for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+
+  /* the batch written by this thread is accounted by the datasinks */
+  xb::wait_state::Scope wait(xb::wait_state::STREAM_WAIT);
+  std::unique_lock<std::mutex> lock(*stream->mutex);
+
+  if (stream->failed) {
+    return 1;
+  }
+
+  if (stream->index != NULL && file != stream->index_file) {
+    (*stream->index)[file->path].push_back({stream->offset, len, checksum});
+  }
+  stream->offset += len;
+
+  stream->pending->push_back(&chunk);
+
+  while (!chunk.done) {
+    if (stream->writing) {
+      stream->written->wait(lock);
+      continue;
+    }
+
+    std::vector<xb_stream_pending_t *> batch;
+    batch.swap(*stream->pending);
+    stream->writing = true;
+
+    lock.unlock();
+    int rc;
+    {
+      xb::trace::Span span("stream_write");
+      rc = xb_stream_write_batch(batch);
+    }
+    lock.lock();
+
+    for (auto pending : batch) {
+      pending->rc = rc;
+      pending->done = true;
+    }
+    if (rc) {
+      stream->failed = true;
+    }
+    stream->writing = false;
+    stream->written->notify_all();
+  }
+
+  return chunk.rc;
+}
+
+/* Check if a block is all zeroes. The inner loop is vectorized by the
+compiler, non-zero data is usually detected in the first stripe. */
+static bool xb_stream_is_zero_block(const uchar *buf) {
+  for (size_t i = 0; i < XB_STREAM_HOLE_SIZE; i += 256) {
+    uint64_t acc = 0;
+    for (size_t j = 0; j < 256; j += 8) {
+      uint64_t word;
+      memcpy(&word, buf + i + j, 8);
+      acc |= word;
+    }
+    if (acc != 0) return false;
+  }
+
+  return true;
+}
+
+/* Find the zero blocks in the data of a chunk.
+@param[in]  file      file the data is written to at file->offset
+@param[in]  iov       data
+@param[in]  iovcnt    number of data buffers
+@param[out] map       holes, each followed by data
+@param[out] data      data without the holes, pointing into iov
+@param[out] data_len  bytes of data without the holes
+@return true if there are holes */
+static bool xb_stream_find_holes(const xb_wstream_file_t *file,
+                                 const struct iovec *iov, int iovcnt,
+                                 std::vector<ds_sparse_chunk_t> *map,
+                                 std::vector<struct iovec> *data,
+                                 size_t *data_len) {
+  my_off_t pos = file->offset;
+  size_t skip = 0;
+  size_t len = 0;
+  bool found = false;
+
+  *data_len = 0;
+
+  for (int i = 0; i < iovcnt; i++) {
+    const uchar *ptr = static_cast<const uchar *>(iov[i].iov_base);
+    size_t left = iov[i].iov_len;
+
+    while (left > 0) {
+      const size_t n = std::min<size_t>(
+          XB_STREAM_HOLE_SIZE - pos % XB_STREAM_HOLE_SIZE, left);
+      const bool hole =
+          n == XB_STREAM_HOLE_SIZE && xb_stream_is_zero_block(ptr);
+
+      if (hole) {
+        if (len > 0 || skip + n > XB_STREAM_MAX_SPARSE_RANGE) {
+          map->push_back({skip, len});
+          skip = 0;
+          len = 0;
+        }
+        skip += n;
+        found = true;
+      } else {
+        if (len + n > XB_STREAM_MAX_SPARSE_RANGE) {
+          map->push_back({skip, len});
+          skip = 0;
+          len = 0;
+        }
+        if (!data->empty() &&
+            static_cast<uchar *>(data->back().iov_base) +
+                    data->back().iov_len ==
+                ptr) {
+          data->back().iov_len += n;
+        } else {
+          data->push_back({const_cast<uchar *>(ptr), n});
+        }
+        len += n;
+        *data_len += n;
+      }
+
+      ptr += n;
+      pos += n;
+      left -= n;
+    }
+  }
+
+  if (!found) {
+    return false;
+  }
+
+  map->push_back({skip, len});
+
+  return true;
+}
+
+static int xb_stream_write_chunk(xb_wstream_file_t *file,
+                                 const struct iovec *iov, int iovcnt,
                                  size_t len, size_t sparse_map_size,
                                  const ds_sparse_chunk_t *sparse_map) {
+  if (sparse_map_size == 0 && file->detect_holes) {
+    std::vector<ds_sparse_chunk_t> holes;
+    std::vector<struct iovec> data;
+    size_t data_len;
+
+    if (xb_stream_find_holes(file, iov, iovcnt, &holes, &data, &data_len)) {
+      return xb_stream_write_chunk(file, data.data(), data.size(), data_len,
+                                   holes.size(), holes.data());
+    }
+  }
+
   /* Chunk magic + flags + chunk type + path_len + path + len + offset +
   checksum + sparse_map_size + */
   uchar tmpbuf[sizeof(XB_STREAM_CHUNK_MAGIC) - 1 + 1 + 1 + 4 + FN_REFLEN + 4 +
@@ -194,7 +686,7 @@ static int xb_stream_write_chunk(xb_wstream_file_t *file, const void *buf,
   memcpy(ptr, XB_STREAM_CHUNK_MAGIC, sizeof(XB_STREAM_CHUNK_MAGIC) - 1);
   ptr += sizeof(XB_STREAM_CHUNK_MAGIC) - 1;
 
-  *ptr++ = 0; /* Chunk flags */
+  *ptr++ = stream->flags; /* Chunk flags */
 
   /* Chunk type */
   *ptr++ = (uchar)(sparse_map_size > 0 ? XB_CHUNK_TYPE_SPARSE
@@ -231,13 +723,17 @@ static int xb_stream_write_chunk(xb_wstream_file_t *file, const void *buf,
   }
 
   /* checksum */
-  checksum =
-      crc32_iso3309(0, reinterpret_cast<const uchar *>(file->sparse_map_buf),
-                    4 * 2 * sparse_map_size);
-  checksum = crc32_iso3309(checksum, static_cast<const uchar *>(buf), len);
-
-  stream->mutex->lock();
+  checksum = xb_stream_checksum(
+      stream->flags, 0, reinterpret_cast<const uchar *>(file->sparse_map_buf),
+      4 * 2 * sparse_map_size);
+  for (int i = 0; i < iovcnt; i++) {
+    checksum = xb_stream_checksum(stream->flags, checksum,
+                                  static_cast<const uchar *>(iov[i].iov_base),
+                                  iov[i].iov_len);
+  }
 
+  /* the payload offset only depends on the file, which is written by a single
+  thread */
   int8store(ptr, file->offset); /* Payload offset */
   ptr += 8;
 
@@ -246,37 +742,30 @@ static int xb_stream_write_chunk(xb_wstream_file_t *file, const void *buf,
 
   xb_ad(ptr <= tmpbuf + sizeof(tmpbuf));
 
-  if (file->write(file, file->userdata, tmpbuf, ptr - tmpbuf) == -1) goto err;
-
-  if (file->write(file, file->userdata, file->sparse_map_buf,
-                  4 * 2 * sparse_map_size) == -1)
-    goto err;
+  /* header, sparse map and payload */
+  std::vector<struct iovec> chunk_iov;
+  chunk_iov.reserve(iovcnt + 2);
+  chunk_iov.push_back({tmpbuf, static_cast<size_t>(ptr - tmpbuf)});
+  if (sparse_map_size > 0) {
+    chunk_iov.push_back({file->sparse_map_buf, 4 * 2 * sparse_map_size});
+  }
+  chunk_iov.insert(chunk_iov.end(), iov, iov + iovcnt);
 
-  if (file->write(file, file->userdata, buf, len) == -1) /* Payload */
-    goto err;
+  if (xb_stream_append(file, chunk_iov.data(), chunk_iov.size(), checksum)) {
+    return 1;
+  }
 
   for (size_t i = 0; i < sparse_map_size; ++i)
     file->offset += sparse_map[i].skip;
   file->offset += len;
 
-  stream->mutex->unlock();
-
   return 0;
-
-err:
-
-  stream->mutex->unlock();
-
-  return 1;
 }
 
 static int xb_stream_write_eof(xb_wstream_file_t *file) {
   /* Chunk magic + flags + chunk type + path_len + path */
   uchar tmpbuf[sizeof(XB_STREAM_CHUNK_MAGIC) - 1 + 1 + 1 + 4 + FN_REFLEN];
   uchar *ptr;
-  xb_wstream_t *stream = file->stream;
-
-  stream->mutex->lock();
 
   /* Write xbstream header */
   ptr = tmpbuf;
@@ -297,16 +786,88 @@ static int xb_stream_write_eof(xb_wstream_file_t *file) {
 
   xb_ad(ptr <= tmpbuf + sizeof(tmpbuf));
 
-  if (file->write(file, file->userdata, tmpbuf, (ulonglong)(ptr - tmpbuf)) ==
-      -1)
-    goto err;
+  struct iovec iov = {tmpbuf, static_cast<size_t>(ptr - tmpbuf)};
 
-  stream->mutex->unlock();
+  return xb_stream_append(file, &iov, 1, 0);
+}
 
-  return 0;
-err:
+/* Write an ignorable chunk without a path */
+static int xb_stream_write_ignorable(xb_wstream_t *stream, uchar type,
+                                     const uchar *buf, size_t len) {
+  /* Chunk magic + flags + chunk type + path_len + len + offset + checksum */
+  uchar tmpbuf[sizeof(XB_STREAM_CHUNK_MAGIC) - 1 + 1 + 1 + 4 + 8 + 8 + 4];
+  uchar *ptr = tmpbuf;
+  xb_wstream_file_t *file = stream->index_file;
+  /* the index is always checksummed */
+  const uchar flags =
+      (stream->flags & ~XB_STREAM_FLAG_NO_CHECKSUM) | XB_STREAM_FLAG_IGNORABLE;
+
+  memcpy(ptr, XB_STREAM_CHUNK_MAGIC, sizeof(XB_STREAM_CHUNK_MAGIC) - 1);
+  ptr += sizeof(XB_STREAM_CHUNK_MAGIC) - 1;
+
+  *ptr++ = flags; /* Chunk flags */
+
+  *ptr++ = type; /* Chunk type */
+
+  int4store(ptr, 0); /* Path length */
+  ptr += 4;
+
+  int8store(ptr, len); /* Payload length */
+  ptr += 8;
+
+  int8store(ptr, 0); /* Payload offset */
+  ptr += 8;
+
+  int4store(ptr, xb_stream_checksum(flags, 0, buf, len)); /* Checksum */
+  ptr += 4;
+
+  xb_ad(ptr == tmpbuf + sizeof(tmpbuf));
+
+  struct iovec iov[2] = {{tmpbuf, static_cast<size_t>(ptr - tmpbuf)},
+                         {const_cast<uchar *>(buf), len}};
+
+  return xb_stream_append(file, iov, 2, 0);
+}
 
-  stream->mutex->unlock();
+/* Write the index chunk followed by the trailer chunk which points to it.
+Index payload: for each file path length, path, number of chunks and for each
+chunk its offset, length and checksum. */
+static int xb_stream_write_index(xb_wstream_t *stream) {
+  std::vector<uchar> buf;
 
-  return 1;
+  for (const auto &it : *stream->index) {
+    size_t pos = buf.size();
+    buf.resize(pos + 4 + it.first.length() + 4 + it.second.size() * 20);
+    uchar *ptr = buf.data() + pos;
+
+    int4store(ptr, it.first.length());
+    ptr += 4;
+    memcpy(ptr, it.first.c_str(), it.first.length());
+    ptr += it.first.length();
+    int4store(ptr, it.second.size());
+    ptr += 4;
+    for (const auto &entry : it.second) {
+      int8store(ptr, entry.offset);
+      ptr += 8;
+      int8store(ptr, entry.length);
+      ptr += 8;
+      int4store(ptr, entry.checksum);
+      ptr += 4;
+    }
+    xb_ad(ptr == buf.data() + buf.size());
+  }
+
+  /* all files are closed, nothing else is written to the stream */
+  uchar trailer[8];
+  int8store(trailer, stream->offset);
+
+  if (xb_stream_write_ignorable(stream, XB_CHUNK_TYPE_INDEX, buf.data(),
+                                buf.size()) ||
+      xb_stream_write_ignorable(stream, XB_CHUNK_TYPE_INDEX_TRAILER, trailer,
+                                sizeof(trailer))) {
+    msg("xb_stream_write_index(): failed to write the stream index.\n");
+    return 1;
+  }
+
+  return 0;
 }
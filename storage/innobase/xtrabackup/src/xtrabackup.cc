@@ -57,12 +57,19 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #ifdef __linux__
 #include <sys/prctl.h>
+#include <sys/sysmacros.h>
+#endif
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
 #endif
 
 #include <sys/resource.h>
+#include <sys/wait.h>
 
 #include <btr0sea.h>
 #include <buf0dblwr.h>
+#include <buf0flu.h>
 #include <dict0dd.h>
 #include <dict0priv.h>
 #include <dict0stats.h>
@@ -75,6 +82,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <sql_locale.h>
 #include <srv0srv.h>
 #include <srv0start.h>
+#include <zdict.h>
 #include "sql/xa/transaction_cache.h"
 
 #include <clone0api.h>
@@ -83,9 +91,13 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <sql/current_thd.h>
 #include <sql/srv_session.h>
 #include <table_cache.h>
+#include <deque>
 #include <list>
+#include <queue>
 #include <set>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <api0api.h>
 #include <api0misc.h>
@@ -98,24 +110,50 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "datasink.h"
 #include "xtrabackup_version.h"
 
+#include "apply_benchmark.h"
 #include "backup_copy.h"
 #include "backup_mysql.h"
+#include "backup_plan.h"
 #include "changed_page_tracking.h"
 #include "crc_glue.h"
+#include "ds_async.h"
 #include "ds_buffer.h"
+#include "ds_checksum.h"
+#include "ds_compress.h"
+#include "ds_compress_zstd.h"
+#include "ds_decompress_lz4.h"
+#include "ds_decompress_zstd.h"
 #include "ds_encrypt.h"
-#include "ds_tmpfile.h"
+#include "ds_local.h"
+#include "ds_object_store.h"
+#include "ds_stdout.h"
+#include "ds_tee.h"
+#include "ds_xbstream.h"
 #include "fil_cur.h"
+#include "fil_cur_aio.h"
+#include "file_checksums.h"
+#include "file_utils.h"
+#include "io_buffer_pool.h"
+#include "io_throttle.h"
 #include "keyring_components.h"
 #include "keyring_plugins.h"
+#include "memory_budget.h"
+#include "net_utils.h"
 #include "read_filt.h"
 #include "redo_log.h"
+#include "restore_order.h"
 #include "space_map.h"
+#include "thread_pool.h"
+#include "trace.h"
 #include "utils.h"
+#include "verify.h"
+#include "wait_state.h"
 #include "write_filt.h"
 #include "wsrep.h"
 #include "xb0xb.h"
+#include "xb_metrics.h"
 #include "xb_regex.h"
+#include "xb_report.h"
 #include "xbcrypt_common.h"
 #include "xbstream.h"
 #include "xtrabackup.h"
@@ -154,10 +192,12 @@ bool xtrabackup_prepare = false;
 bool xtrabackup_copy_back = false;
 bool xtrabackup_move_back = false;
 bool xtrabackup_decrypt_decompress = false;
+bool xtrabackup_verify = false;
 bool xtrabackup_print_param = false;
 
 bool xtrabackup_export = false;
 bool xtrabackup_apply_log_only = false;
+bool xtrabackup_fast_prepare = false;
 
 longlong xtrabackup_use_memory = 100 * 1024 * 1024L;
 bool xtrabackup_use_memory_set = false;
@@ -168,6 +208,14 @@ bool xtrabackup_estimate_memory = false;
 bool xtrabackup_create_ib_logfile = false;
 
 long xtrabackup_throttle = 0; /* 0:unlimited */
+ulonglong opt_throttle_rate = 0; /* 0:unlimited */
+char *opt_throttle_group = nullptr;
+bool opt_adaptive_throttle = false;
+uint opt_adaptive_throttle_interval = 5;
+ulong opt_adaptive_throttle_max_pending_io = 64;
+ulong opt_adaptive_throttle_max_history_length = 1000000;
+uint opt_adaptive_throttle_max_checkpoint_age = 75;
+std::atomic<uint> xtrabackup_copy_threads_limit{UINT_MAX};
 lint io_ticket;
 os_event_t wait_throttle = NULL;
 
@@ -185,13 +233,16 @@ pagetracking::xb_space_map *changed_page_tracking = nullptr;
 char *xtrabackup_incremental_basedir = NULL; /* for --backup */
 char *xtrabackup_extra_lsndir = NULL;    /* for --backup with --extra-lsndir */
 char *xtrabackup_incremental_dir = NULL; /* for --prepare */
+uint xtrabackup_incremental_format = 1;  /* for --backup */
 char *xtrabackup_redo_log_arch_dir = NULL;
+bool xtrabackup_redo_log_arch_only = false;
 
 char xtrabackup_real_incremental_basedir[FN_REFLEN];
 char xtrabackup_real_extra_lsndir[FN_REFLEN];
 char xtrabackup_real_incremental_dir[FN_REFLEN];
 
 lsn_t xtrabackup_archived_to_lsn = 0; /* for --archived-to-lsn */
+lsn_t xtrabackup_stop_at_lsn = 0;     /* for --stop-at-lsn */
 
 char *xtrabackup_tables = NULL;
 char *xtrabackup_tables_file = NULL;
@@ -203,8 +254,36 @@ bool xtrabackup_register_redo_log_consumer = false;
 std::atomic<bool> redo_log_consumer_can_advance = false;
 
 typedef std::list<xb_regex_t> regex_list_t;
-static regex_list_t regex_include_list;
-static regex_list_t regex_exclude_list;
+
+/* Table filter rules given as regular expressions. Rules matching a single
+name, like ^db[.]t$, are looked up in a hash. The other rules are combined
+into alternations, so that a name is matched with a few regexec() calls
+instead of one call per rule. */
+struct regex_rules_t {
+  /* names matched by the literal rules */
+  std::unordered_set<std::string> literals;
+  /* rules not combined yet, see xb_regex_rules_compile() */
+  std::vector<std::string> pending;
+  regex_list_t compiled;
+
+  bool empty() const {
+    return literals.empty() && pending.empty() && compiled.empty();
+  }
+};
+
+static regex_rules_t regex_include_list;
+static regex_rules_t regex_exclude_list;
+
+/* Number of rules combined in a single regular expression */
+static constexpr size_t REGEX_RULES_PER_ALTERNATION = 256;
+
+/* Results of check_if_skip_table(). The same names are checked by the scan
+of the data directory, the copy and the copy back. */
+static std::unordered_map<std::string, bool> skip_table_cache;
+static std::mutex skip_table_cache_mutex;
+
+/* Maximum number of results kept in skip_table_cache */
+static constexpr size_t SKIP_TABLE_CACHE_MAX = 1024 * 1024;
 
 static hash_table_t *tables_include_hash = NULL;
 static hash_table_t *tables_exclude_hash = NULL;
@@ -233,13 +312,73 @@ bool xtrabackup_logfile_is_renamed = false;
 int xtrabackup_parallel;
 int xtrabackup_fifo_streams;
 bool xtrabackup_fifo_streams_set = false;
+bool opt_auto_threads = false;
+/* thread counts given explicitly, left alone by --auto-threads */
+static bool xtrabackup_parallel_set = false;
+static bool xtrabackup_compress_threads_set = false;
+static bool xtrabackup_encrypt_threads_set = false;
 uint xtrabackup_fifo_timeout = 60;
+ulonglong opt_stream_queue_size = 0;
+
+char *opt_tee_target_dir = nullptr;
+const char *tee_policy_names[] = {"strict", "best-effort", NullS};
+TYPELIB tee_policy_typelib = {array_elements(tee_policy_names) - 1, "",
+                              tee_policy_names, nullptr};
+enum tee_policy_t { TEE_POLICY_STRICT, TEE_POLICY_BEST_EFFORT };
+ulong opt_tee_policy = TEE_POLICY_STRICT;
+uint opt_tee_max_stall = 60;
+
+bool opt_file_checksums = false;
+
+bool opt_restore_order = false;
+
+/* files of the backup recorded by --restore-order */
+static xb::restore_order::Registry restore_order_files;
+
+char *opt_cloud_put = nullptr;
+uint opt_cloud_parallel = 8;
+uint opt_cloud_max_retries = 10;
+uint opt_cloud_max_backoff = 300000;
+char *opt_cloud_cacert = nullptr;
+bool opt_cloud_insecure = false;
+char *opt_s3_bucket = nullptr;
+char *opt_s3_region = nullptr;
+char *opt_s3_endpoint = nullptr;
+char *opt_s3_access_key = nullptr;
+char *opt_s3_secret_key = nullptr;
+char *opt_s3_session_token = nullptr;
+char *opt_s3_storage_class = nullptr;
+
+const char *s3_bucket_lookup_names[] = {"AUTO", "DNS", "PATH", NullS};
+TYPELIB s3_bucket_lookup_typelib = {array_elements(s3_bucket_lookup_names) - 1,
+                                    "", s3_bucket_lookup_names, nullptr};
+ulong opt_s3_bucket_lookup = 0;
+
+const char *s3_api_version_names[] = {"AUTO", "2", "4", NullS};
+TYPELIB s3_api_version_typelib = {array_elements(s3_api_version_names) - 1, "",
+                                  s3_api_version_names, nullptr};
+ulong opt_s3_api_version = 0;
 char *xtrabackup_fifo_dir = NULL;
 bool opt_strict = true;
 
 char *xtrabackup_stream_str = NULL;
 xb_stream_fmt_t xtrabackup_stream_fmt = XB_STREAM_FMT_NONE;
 bool xtrabackup_stream = false;
+bool xtrabackup_stream_crc32c = false;
+bool xtrabackup_stream_index = false;
+ulonglong xtrabackup_stream_chunk_size = XB_STREAM_DEFAULT_CHUNK_SIZE;
+bool xtrabackup_stream_detect_holes = false;
+bool xtrabackup_stream_skip_checksum = false;
+bool xtrabackup_stream_zero_copy = false;
+char *xtrabackup_stream_fds = nullptr;
+char *opt_stream_to = nullptr;
+uint opt_stream_connections = 1;
+
+const char *stream_balance_names[] = {"round-robin", "least-loaded",
+                                      "least-bytes", NullS};
+TYPELIB stream_balance_typelib = {array_elements(stream_balance_names) - 1, "",
+                                  stream_balance_names, NULL};
+ulong xtrabackup_stream_balance = DS_XBSTREAM_BALANCE_ROUND_ROBIN;
 
 const char *xtrabackup_compress_alg = NULL;
 xtrabackup_compress_t xtrabackup_compress = XTRABACKUP_COMPRESS_NONE;
@@ -247,6 +386,11 @@ ds_type_t xtrabackup_compress_ds;
 uint xtrabackup_compress_threads;
 ulonglong xtrabackup_compress_chunk_size = 0;
 uint xtrabackup_compress_zstd_level = 1;
+bool xtrabackup_compress_skip_incompressible = true;
+bool xtrabackup_compress_lz4_linked_blocks = false;
+ulonglong xtrabackup_compress_lz4_frame_size = 0;
+char *opt_compress_policy_file = nullptr;
+ulonglong opt_compress_zstd_dict_size = 0;
 
 const char *xtrabackup_encrypt_algo_names[] = {"NONE", "AES128", "AES192",
                                                "AES256", NullS};
@@ -260,14 +404,41 @@ char *xtrabackup_encrypt_key = NULL;
 char *xtrabackup_encrypt_key_file = NULL;
 uint xtrabackup_encrypt_threads;
 ulonglong xtrabackup_encrypt_chunk_size = 0;
+bool xtrabackup_encrypt_gcm = false;
 
 size_t redo_memory = 0;
 ulint redo_frames = 0;
 size_t real_redo_memory = 0;
 ulint real_redo_frames = UINT64_MAX;
+ulint xb_recv_planned_batches = 0;
+ulint xb_recv_applied_batches = 0;
+ulint xb_fil_scan_threads = 0;
 
 ulint xtrabackup_rebuild_threads = 1;
 
+uint xtrabackup_apply_log_threads = 1;
+
+uint xtrabackup_rollback_threads = 1;
+
+const char *prepare_huge_pages_names[] = {"off", "transparent", "explicit",
+                                          NullS};
+TYPELIB prepare_huge_pages_typelib = {
+    array_elements(prepare_huge_pages_names) - 1, "", prepare_huge_pages_names,
+    nullptr};
+enum prepare_huge_pages_t {
+  PREPARE_HUGE_PAGES_OFF,
+  PREPARE_HUGE_PAGES_TRANSPARENT,
+  PREPARE_HUGE_PAGES_EXPLICIT
+};
+ulong opt_prepare_huge_pages = PREPARE_HUGE_PAGES_OFF;
+
+const char *prepare_io_engine_names[] = {"aio", "io_uring", NullS};
+TYPELIB prepare_io_engine_typelib = {
+    array_elements(prepare_io_engine_names) - 1, "", prepare_io_engine_names,
+    nullptr};
+enum prepare_io_engine_t { PREPARE_IO_ENGINE_AIO, PREPARE_IO_ENGINE_IO_URING };
+ulong opt_prepare_io_engine = PREPARE_IO_ENGINE_AIO;
+
 /* sleep interval beetween log copy iterations in log copying thread
 in milliseconds (default is 1 second) */
 ulint xtrabackup_log_copy_interval = 1000;
@@ -286,8 +457,12 @@ static enum {
   METADATA_FULL_PREPARED
 } metadata_type;
 lsn_t metadata_from_lsn = 0;
+lsn_t backup_start_checkpoint_lsn = 0;
 lsn_t metadata_to_lsn = 0;
 lsn_t metadata_last_lsn = 0;
+/* the pages of the encrypted tablespaces are encrypted with keys of the
+backup */
+bool metadata_reencrypted = false;
 
 ds_file_t *dst_log_file = NULL;
 
@@ -353,6 +528,8 @@ char *opt_component_keyring_file_config = nullptr;
 
 bool opt_generate_new_master_key = false;
 bool opt_generate_transition_key = false;
+char *opt_transition_key_cache = nullptr;
+bool opt_reencrypt_tablespaces = false;
 
 bool use_dumped_tablespace_keys = false;
 
@@ -368,6 +545,7 @@ char *xtrabackup_debug_sync = NULL;
 static const char *dbug_setting = nullptr;
 
 bool xtrabackup_incremental_force_scan = false;
+bool xtrabackup_incremental_redo_scan = false;
 
 /* The flushed lsn which is read from data files */
 lsn_t min_flushed_lsn = 0;
@@ -388,6 +566,8 @@ ds_ctxt_t *ds_data = nullptr;
 ds_ctxt_t *ds_meta = nullptr;
 ds_ctxt_t *ds_redo = nullptr;
 ds_ctxt_t *ds_uncompressed_data = nullptr;
+/* checksums of the files of --file-checksums */
+static ds_ctxt_t *ds_file_checksums = nullptr;
 
 static long innobase_log_files_in_group_save;
 static char *srv_log_group_home_dir_save;
@@ -421,7 +601,33 @@ bool opt_page_tracking = false;
 bool opt_no_lock = false;
 bool opt_safe_slave_backup = false;
 bool opt_rsync = false;
+bool opt_precopy_non_innodb = false;
 bool opt_force_non_empty_dirs = false;
+bool opt_reflink_only = false;
+uint opt_restore_progress_interval = 0;
+char *opt_pitr_binlog_dir = nullptr;
+char *opt_metrics_file = nullptr;
+uint opt_metrics_interval = 10;
+uint opt_redo_lag_warn_time = 600;
+uint opt_redo_lag_abort_time = 0;
+bool opt_backup_plan = false;
+ulonglong opt_max_memory = 0;
+char *opt_trace_file = nullptr;
+char *opt_apply_benchmark_dir = nullptr;
+char *opt_snapshot_create_cmd = nullptr;
+char *opt_snapshot_dir = nullptr;
+char *opt_snapshot_remove_cmd = nullptr;
+uint opt_daemon_interval = 0;
+bool opt_archive_redo = false;
+ulonglong opt_archive_redo_segment_size = 1024 * 1024 * 1024;
+char *opt_apply_archived_redo = nullptr;
+ulong opt_stats_sample_pages = 0;
+bool opt_export_changed_only = false;
+const char *tablespace_discovery_names[] = {"scan", "dictionary", NullS};
+TYPELIB tablespace_discovery_typelib = {
+    array_elements(tablespace_discovery_names) - 1, "",
+    tablespace_discovery_names, NULL};
+ulong opt_tablespace_discovery = TABLESPACE_DISCOVERY_SCAN;
 #ifdef HAVE_VERSION_CHECK
 bool opt_noversioncheck = false;
 #endif
@@ -429,6 +635,7 @@ bool opt_no_server_version_check = false;
 bool opt_no_backup_locks = false;
 bool opt_decompress = false;
 bool opt_remove_original = false;
+char *opt_decompress_dir = nullptr;
 bool opt_tables_compatibility_check = true;
 static bool opt_check_privileges = false;
 
@@ -477,6 +684,44 @@ uint opt_backup_lock_retry_count = 0;
 const char *opt_history = NULL;
 bool opt_decrypt = false;
 uint opt_read_buffer_size = 0;
+uint opt_read_buffer_max_size = 0;
+uint opt_page_tracking_max_gap = 0;
+uint opt_page_tracking_read_ahead = 0;
+
+const char *read_io_engine_names[] = {"sync", "io_uring", "thread", NullS};
+TYPELIB read_io_engine_typelib = {array_elements(read_io_engine_names) - 1,
+                                  "", read_io_engine_names, NULL};
+ulong opt_read_io_engine = READ_IO_ENGINE_SYNC;
+uint opt_read_io_depth = 4;
+
+const char *source_read_mode_names[] = {"auto", "direct", "buffered", NullS};
+TYPELIB source_read_mode_typelib = {array_elements(source_read_mode_names) - 1,
+                                    "", source_read_mode_names, NULL};
+ulong opt_source_read_mode = SOURCE_READ_MODE_AUTO;
+
+const char *target_write_mode_names[] = {"buffered", "direct", NullS};
+TYPELIB target_write_mode_typelib = {
+    array_elements(target_write_mode_names) - 1, "", target_write_mode_names,
+    NULL};
+enum target_write_mode_t {
+  TARGET_WRITE_MODE_BUFFERED,
+  TARGET_WRITE_MODE_DIRECT
+};
+ulong opt_target_write_mode = TARGET_WRITE_MODE_BUFFERED;
+bool opt_preallocate = true;
+ulonglong opt_datafile_split_size = 0;
+uint opt_parallel_per_device = 0;
+
+const char *datafile_copy_order_names[] = {"natural", "largest-first", "table",
+                                           NullS};
+TYPELIB datafile_copy_order_typelib = {
+    array_elements(datafile_copy_order_names) - 1, "",
+    datafile_copy_order_names, NULL};
+ulong opt_datafile_copy_order = DATAFILE_COPY_ORDER_NATURAL;
+ulonglong opt_small_datafile_size = 0;
+bool opt_skip_free_extents = false;
+bool opt_sparse_zero_pages = false;
+bool opt_numa_bind_threads = false;
 
 char *opt_rocksdb_datadir = nullptr;
 char *opt_rocksdb_wal_dir = nullptr;
@@ -523,11 +768,11 @@ static std::vector<dict_table_t *> mysql_ibd_tables;
 
 /* Simple datasink creation tracking...add datasinks in the reverse order you
 want them destroyed. */
-#define XTRABACKUP_MAX_DATASINKS 10
+#define XTRABACKUP_MAX_DATASINKS 32
 static ds_ctxt_t *datasinks[XTRABACKUP_MAX_DATASINKS];
 static uint actual_datasinks = 0;
 static inline void xtrabackup_add_datasink(ds_ctxt_t *ds) {
-  xb_ad(actual_datasinks < XTRABACKUP_MAX_DATASINKS);
+  xb_a(actual_datasinks < XTRABACKUP_MAX_DATASINKS);
   datasinks[actual_datasinks] = ds;
   actual_datasinks++;
 }
@@ -577,7 +822,189 @@ fil_node_t *datafiles_iter_next(datafiles_iter_t *it) {
   return node;
 }
 
+/** Size of a datafile as found by xb_load_tablespaces().
+@param[in]  node  tablespace node
+@return size in bytes */
+static uint64_t datafile_size(const fil_node_t *node) {
+  return (static_cast<uint64_t>(node->size) *
+          page_size_t(node->space->flags).physical());
+}
+
+/** Reorder datafiles so that the largest ones are copied first, and report
+the completion order predicted by assigning each datafile to the least loaded
+thread.
+@param[in,out]  it         datafiles iterator, not started yet
+@param[in]      n_threads  number of copy threads */
+static void datafiles_iter_sort_largest_first(datafiles_iter_t *it,
+                                              uint n_threads) {
+  ut_ad(it->i == it->nodes.begin());
+
+  std::stable_sort(it->nodes.begin(), it->nodes.end(),
+                   [](const fil_node_t *a, const fil_node_t *b) {
+                     return (datafile_size(a) > datafile_size(b));
+                   });
+  it->i = it->nodes.begin();
+
+  /* thread load in bytes, smallest on top */
+  std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>>
+      load;
+  for (uint i = 0; i < n_threads; i++) {
+    load.push(0);
+  }
+
+  std::vector<std::pair<uint64_t, const fil_node_t *>> completion;
+  completion.reserve(it->nodes.size());
+  for (auto node : it->nodes) {
+    uint64_t finish = load.top() + datafile_size(node);
+    load.pop();
+    load.push(finish);
+    completion.emplace_back(finish, node);
+  }
+  std::stable_sort(completion.begin(), completion.end(),
+                   [](const std::pair<uint64_t, const fil_node_t *> &a,
+                      const std::pair<uint64_t, const fil_node_t *> &b) {
+                     return (a.first < b.first);
+                   });
+
+  uint64_t makespan = completion.empty() ? 0 : completion.back().first;
+  xb::info() << "Copying " << it->nodes.size()
+             << " datafiles largest first with " << n_threads
+             << " threads, predicted busiest thread copies " << makespan
+             << " bytes";
+
+  /* the last ones to complete are the ones defining the tail */
+  const size_t tail = std::min<size_t>(completion.size(), 10);
+  for (size_t i = completion.size() - tail; i < completion.size(); i++) {
+    xb::info() << "Predicted completion #" << i + 1 << ": "
+               << completion[i].second->name << " after "
+               << completion[i].first << " bytes";
+  }
+}
+
+/** Reorder datafiles so that the partitions of a table are copied one after
+the other, in the order the first partition of every table was loaded. The
+copy threads then work on the partitions of a few tables at a time instead
+of partitions scattered over all tables.
+@param[in,out]  it  datafiles iterator, not started yet */
+static void datafiles_iter_group_partitions(datafiles_iter_t *it) {
+  ut_ad(it->i == it->nodes.begin());
+
+  std::unordered_map<std::string, size_t> groups;
+  std::vector<std::pair<size_t, fil_node_t *>> order;
+  order.reserve(it->nodes.size());
+  size_t n_partitions = 0;
+
+  for (auto node : it->nodes) {
+    const char *name = node->space->name;
+    const char *sep = strcasestr(name, dict_name::PART_SEPARATOR);
+    if (sep != nullptr) {
+      n_partitions++;
+    }
+    const std::string table =
+        sep != nullptr ? std::string(name, sep - name) : std::string(name);
+    auto group = groups.emplace(table, groups.size()).first->second;
+    order.emplace_back(group, node);
+  }
+
+  std::stable_sort(order.begin(), order.end(),
+                   [](const std::pair<size_t, fil_node_t *> &a,
+                      const std::pair<size_t, fil_node_t *> &b) {
+                     return (a.first < b.first);
+                   });
+  for (size_t i = 0; i < order.size(); i++) {
+    it->nodes[i] = order[i].second;
+  }
+  it->i = it->nodes.begin();
+
+  xb::info() << "Copying " << it->nodes.size() << " datafiles of "
+             << groups.size() << " tables grouped by table, "
+             << n_partitions << " of them are partitions";
+}
+
+/** Find the device of every datafile for --parallel-per-device
+@param[in,out]  it  datafiles iterator */
+static void datafiles_iter_group_by_device(datafiles_iter_t *it) {
+  std::map<dev_t, std::pair<size_t, uint64_t>> groups;
+
+  for (const auto node : it->nodes) {
+    MY_STAT stat_info;
+    dev_t dev = 0;
+    if (my_stat(node->name, &stat_info, MYF(0)) != nullptr) {
+      dev = stat_info.st_dev;
+    }
+    it->devs[node] = dev;
+    groups[dev].first++;
+    groups[dev].second += datafile_size(node);
+  }
+
+  it->dev_released = os_event_create();
+
+  for (const auto &group : groups) {
+    xb::info() << "Device " << major(group.first) << ":"
+               << minor(group.first) << ": " << group.second.first
+               << " datafiles, " << group.second.second << " bytes";
+  }
+  xb::info() << "Copying at most " << opt_parallel_per_device
+             << " datafiles at a time from each of " << groups.size()
+             << " devices";
+}
+
+/** Get the next datafile from a device that has less than
+--parallel-per-device datafiles being copied. Waits while all datafiles left
+are on busy devices. The datafile must be released with
+datafiles_iter_release().
+@param[in,out]  it     datafiles iterator
+@param[in]      error  set when the backup has failed
+@return datafile or NULL if there are no datafiles left */
+static fil_node_t *datafiles_iter_next_on_device(datafiles_iter_t *it,
+                                                 const bool *error) {
+  fil_node_t *node = NULL;
+
+  mutex_enter(&it->mutex);
+
+  while (it->i != it->nodes.end() && !*error) {
+    auto candidate =
+        std::find_if(it->i, it->nodes.end(), [it](const fil_node_t *n) {
+          return (it->dev_active[it->devs[n]] < opt_parallel_per_device);
+        });
+
+    if (candidate != it->nodes.end()) {
+      /* keep the order of the skipped datafiles */
+      std::rotate(it->i, candidate, candidate + 1);
+      node = *it->i;
+      it->i++;
+      it->dev_active[it->devs[node]]++;
+      break;
+    }
+
+    const auto sig_count = os_event_reset(it->dev_released);
+    mutex_exit(&it->mutex);
+    os_event_wait_time_low(it->dev_released, std::chrono::seconds{1},
+                           sig_count);
+    mutex_enter(&it->mutex);
+  }
+
+  mutex_exit(&it->mutex);
+
+  return node;
+}
+
+/** Release the device of a datafile obtained with
+datafiles_iter_next_on_device().
+@param[in,out]  it    datafiles iterator
+@param[in]      node  datafile */
+static void datafiles_iter_release(datafiles_iter_t *it,
+                                   const fil_node_t *node) {
+  mutex_enter(&it->mutex);
+  it->dev_active[it->devs[node]]--;
+  os_event_set(it->dev_released);
+  mutex_exit(&it->mutex);
+}
+
 void datafiles_iter_free(datafiles_iter_t *it) {
+  if (it->dev_released != nullptr) {
+    os_event_destroy(it->dev_released);
+  }
   mutex_free(&it->mutex);
   delete it;
 }
@@ -601,6 +1028,7 @@ enum options_xtrabackup {
   OPT_XTRA_BACKUP,
   OPT_XTRA_STATS,
   OPT_XTRA_PREPARE,
+  OPT_XTRA_VERIFY,
   OPT_XTRA_EXPORT,
   OPT_XTRA_APPLY_LOG_ONLY,
   OPT_XTRA_PRINT_PARAM,
@@ -613,13 +1041,16 @@ enum options_xtrabackup {
   OPT_XTRA_INCREMENTAL_BASEDIR,
   OPT_XTRA_EXTRA_LSNDIR,
   OPT_XTRA_INCREMENTAL_DIR,
+  OPT_XTRA_INCREMENTAL_FORMAT,
   OPT_XTRA_ARCHIVED_TO_LSN,
+  OPT_XTRA_STOP_AT_LSN,
   OPT_XTRA_TABLES,
   OPT_XTRA_TABLES_FILE,
   OPT_XTRA_DATABASES,
   OPT_XTRA_DATABASES_FILE,
   OPT_XTRA_CREATE_IB_LOGFILE,
   OPT_XTRA_PARALLEL,
+  OPT_XTRA_AUTO_THREADS,
   OPT_XTRA_FIFO_STREAMS,
   OPT_XTRA_STREAM,
   OPT_XTRA_FIFO_DIR,
@@ -646,6 +1077,7 @@ enum options_xtrabackup {
   OPT_INNODB_FILE_PER_TABLE,
   OPT_INNODB_FLUSH_LOG_AT_TRX_COMMIT,
   OPT_INNODB_REDO_LOG_ARCHIVE_DIRS,
+  OPT_INNODB_REDO_LOG_ARCHIVE_ONLY,
   OPT_INNODB_FLUSH_METHOD,
   OPT_INNODB_LOG_ARCH_DIR,
   OPT_INNODB_LOG_ARCHIVE,
@@ -684,6 +1116,11 @@ enum options_xtrabackup {
   OPT_XTRA_COMPACT,
   OPT_XTRA_REBUILD_INDEXES,
   OPT_XTRA_REBUILD_THREADS,
+  OPT_XTRA_APPLY_LOG_THREADS,
+  OPT_XTRA_ROLLBACK_THREADS,
+  OPT_XTRA_PREPARE_HUGE_PAGES,
+  OPT_XTRA_PREPARE_IO_ENGINE,
+  OPT_XTRA_FAST_PREPARE,
   OPT_INNODB_CHECKSUM_ALGORITHM,
   OPT_INNODB_UNDO_DIRECTORY,
   OPT_INNODB_DIRECTORIES,
@@ -691,6 +1128,7 @@ enum options_xtrabackup {
   OPT_INNODB_UNDO_TABLESPACES,
   OPT_INNODB_LOG_CHECKSUMS,
   OPT_XTRA_INCREMENTAL_FORCE_SCAN,
+  OPT_XTRA_INCREMENTAL_REDO_SCAN,
   OPT_DEFAULTS_GROUP,
   OPT_OPEN_FILES_LIMIT,
   OPT_CLOSE_FILES,
@@ -717,7 +1155,29 @@ enum options_xtrabackup {
   OPT_DUMP_INNODB_BUFFER_PCT,
   OPT_SAFE_SLAVE_BACKUP,
   OPT_RSYNC,
+  OPT_PRECOPY_NON_INNODB,
   OPT_FORCE_NON_EMPTY_DIRS,
+  OPT_REFLINK_ONLY,
+  OPT_RESTORE_PROGRESS_INTERVAL,
+  OPT_PITR_BINLOG_DIR,
+  OPT_METRICS_FILE,
+  OPT_METRICS_INTERVAL,
+  OPT_REDO_LAG_WARN_TIME,
+  OPT_REDO_LAG_ABORT_TIME,
+  OPT_BACKUP_PLAN,
+  OPT_MAX_MEMORY,
+  OPT_TRACE_FILE,
+  OPT_APPLY_BENCHMARK_DIR,
+  OPT_SNAPSHOT_CREATE_CMD,
+  OPT_SNAPSHOT_DIR,
+  OPT_SNAPSHOT_REMOVE_CMD,
+  OPT_DAEMON_INTERVAL,
+  OPT_ARCHIVE_REDO,
+  OPT_ARCHIVE_REDO_SEGMENT_SIZE,
+  OPT_APPLY_ARCHIVED_REDO,
+  OPT_TABLESPACE_DISCOVERY,
+  OPT_STATS_SAMPLE_PAGES,
+  OPT_EXPORT_CHANGED_ONLY,
 #ifdef HAVE_VERSION_CHECK
   OPT_NO_VERSION_CHECK,
 #endif
@@ -729,6 +1189,7 @@ enum options_xtrabackup {
   OPT_INCREMENTAL_HISTORY_UUID,
   OPT_DECRYPT,
   OPT_REMOVE_ORIGINAL,
+  OPT_DECOMPRESS_DIR,
   OPT_LOCK_WAIT_QUERY_TYPE,
   OPT_KILL_LONG_QUERY_TYPE,
   OPT_HISTORY,
@@ -743,6 +1204,8 @@ enum options_xtrabackup {
   OPT_COMPONENT_KEYRING_CONFIG,
   OPT_COMPONENT_KEYRING_FILE_CONFIG,
   OPT_GENERATE_TRANSITION_KEY,
+  OPT_REENCRYPT_TABLESPACES,
+  OPT_TRANSITION_KEY_CACHE,
   OPT_XTRA_PLUGIN_DIR,
   OPT_XTRA_PLUGIN_LOAD,
   OPT_GENERATE_NEW_MASTER_KEY,
@@ -770,6 +1233,65 @@ enum options_xtrabackup {
   OPT_XTRA_TABLES_COMPATIBILITY_CHECK,
   OPT_XTRA_CHECK_PRIVILEGES,
   OPT_XTRA_READ_BUFFER_SIZE,
+  OPT_XTRA_READ_BUFFER_MAX_SIZE,
+  OPT_XTRA_PAGE_TRACKING_MAX_GAP,
+  OPT_XTRA_PAGE_TRACKING_READ_AHEAD,
+  OPT_XTRA_READ_IO_ENGINE,
+  OPT_XTRA_READ_IO_DEPTH,
+  OPT_XTRA_DATAFILE_SPLIT_SIZE,
+  OPT_XTRA_DATAFILE_COPY_ORDER,
+  OPT_XTRA_SMALL_DATAFILE_SIZE,
+  OPT_XTRA_SKIP_FREE_EXTENTS,
+  OPT_XTRA_SPARSE_ZERO_PAGES,
+  OPT_XTRA_NUMA_BIND_THREADS,
+  OPT_XTRA_THROTTLE_RATE,
+  OPT_XTRA_THROTTLE_GROUP,
+  OPT_XTRA_ADAPTIVE_THROTTLE,
+  OPT_XTRA_ADAPTIVE_THROTTLE_INTERVAL,
+  OPT_XTRA_ADAPTIVE_THROTTLE_MAX_PENDING_IO,
+  OPT_XTRA_ADAPTIVE_THROTTLE_MAX_HISTORY_LENGTH,
+  OPT_XTRA_ADAPTIVE_THROTTLE_MAX_CHECKPOINT_AGE,
+  OPT_XTRA_PARALLEL_PER_DEVICE,
+  OPT_XTRA_SOURCE_READ_MODE,
+  OPT_XTRA_STREAM_QUEUE_SIZE,
+  OPT_XTRA_CLOUD_PUT,
+  OPT_XTRA_CLOUD_PARALLEL,
+  OPT_XTRA_CLOUD_MAX_RETRIES,
+  OPT_XTRA_CLOUD_MAX_BACKOFF,
+  OPT_XTRA_CLOUD_CACERT,
+  OPT_XTRA_CLOUD_INSECURE,
+  OPT_XTRA_S3_BUCKET,
+  OPT_XTRA_S3_REGION,
+  OPT_XTRA_S3_ENDPOINT,
+  OPT_XTRA_S3_ACCESS_KEY,
+  OPT_XTRA_S3_SECRET_KEY,
+  OPT_XTRA_S3_SESSION_TOKEN,
+  OPT_XTRA_S3_STORAGE_CLASS,
+  OPT_XTRA_S3_BUCKET_LOOKUP,
+  OPT_XTRA_S3_API_VERSION,
+  OPT_XTRA_TEE_TARGET_DIR,
+  OPT_XTRA_TEE_POLICY,
+  OPT_XTRA_TEE_MAX_STALL,
+  OPT_XTRA_FILE_CHECKSUMS,
+  OPT_XTRA_RESTORE_ORDER,
+  OPT_XTRA_PREALLOCATE,
+  OPT_XTRA_TARGET_WRITE_MODE,
+  OPT_XTRA_COMPRESS_SKIP_INCOMPRESSIBLE,
+  OPT_XTRA_COMPRESS_POLICY_FILE,
+  OPT_XTRA_COMPRESS_ZSTD_DICT_SIZE,
+  OPT_XTRA_ENCRYPT_GCM,
+  OPT_XTRA_STREAM_CRC32C,
+  OPT_XTRA_COMPRESS_LZ4_LINKED_BLOCKS,
+  OPT_XTRA_COMPRESS_LZ4_FRAME_SIZE,
+  OPT_XTRA_STREAM_INDEX,
+  OPT_XTRA_STREAM_CHUNK_SIZE,
+  OPT_XTRA_STREAM_DETECT_HOLES,
+  OPT_XTRA_STREAM_SKIP_CHECKSUM,
+  OPT_XTRA_STREAM_ZERO_COPY,
+  OPT_XTRA_STREAM_FDS,
+  OPT_XTRA_STREAM_BALANCE,
+  OPT_XTRA_STREAM_TO,
+  OPT_XTRA_STREAM_CONNECTIONS,
 };
 
 struct my_option xb_client_options[] = {
@@ -790,6 +1312,12 @@ struct my_option xb_client_options[] = {
      "prepare a backup for starting mysql server on the backup.",
      (G_PTR *)&xtrabackup_prepare, (G_PTR *)&xtrabackup_prepare, 0, GET_BOOL,
      NO_ARG, 0, 0, 0, 0, 0, 0},
+    {"verify", OPT_XTRA_VERIFY,
+     "verify the page checksums and LSNs and the file sizes of the "
+     "tablespaces of a prepared backup in target-dir, reading them with "
+     "O_DIRECT in --parallel threads.",
+     (G_PTR *)&xtrabackup_verify, (G_PTR *)&xtrabackup_verify, 0, GET_BOOL,
+     NO_ARG, 0, 0, 0, 0, 0, 0},
     {"export", OPT_XTRA_EXPORT,
      "create files to import to another database when prepare.",
      (G_PTR *)&xtrabackup_export, (G_PTR *)&xtrabackup_export, 0, GET_BOOL,
@@ -824,6 +1352,55 @@ struct my_option xb_client_options[] = {
      "values (for '--backup')",
      (G_PTR *)&xtrabackup_throttle, (G_PTR *)&xtrabackup_throttle, 0, GET_LONG,
      REQUIRED_ARG, 0, 0, LONG_MAX, 0, 1, 0},
+    {"throttle-rate", OPT_XTRA_THROTTLE_RATE,
+     "Limit datafile reads and writes of the local datasink to this many "
+     "bytes per second each, in even steps rather than in one second "
+     "bursts. Accepts K, M and G suffixes. 0 means unlimited (for '--backup')",
+     &opt_throttle_rate, &opt_throttle_rate, 0, GET_ULL, REQUIRED_ARG, 0, 0,
+     ULLONG_MAX, 0, 1, 0},
+    {"throttle-group", OPT_XTRA_THROTTLE_GROUP,
+     "Share the --throttle-rate limits with the other xtrabackup processes "
+     "given the same file, e.g. the backups of the instances of a host, "
+     "instead of applying them to each process. A process which is idle "
+     "leaves its share of the rate to the others. The file is created if it "
+     "does not exist and should be on a local filesystem such as /dev/shm. "
+     "(for '--backup')",
+     &opt_throttle_group, &opt_throttle_group, 0, GET_STR_ALLOC, REQUIRED_ARG,
+     0, 0, 0, 0, 0, 0},
+    {"adaptive-throttle", OPT_XTRA_ADAPTIVE_THROTTLE,
+     "Watch the load of the server while copying datafiles and lower the "
+     "copy rate and the number of active --parallel threads when it is "
+     "under stress, raising them back up to --throttle-rate and --parallel "
+     "when the load goes away (for '--backup')",
+     &opt_adaptive_throttle, &opt_adaptive_throttle, 0, GET_BOOL, NO_ARG, 0, 0,
+     0, 0, 0, 0},
+    {"adaptive-throttle-interval", OPT_XTRA_ADAPTIVE_THROTTLE_INTERVAL,
+     "Seconds between two samples of the server load taken by "
+     "--adaptive-throttle. Default is 5.",
+     &opt_adaptive_throttle_interval, &opt_adaptive_throttle_interval, 0,
+     GET_UINT, REQUIRED_ARG, 5, 1, 3600, 0, 1, 0},
+    {"adaptive-throttle-max-pending-io",
+     OPT_XTRA_ADAPTIVE_THROTTLE_MAX_PENDING_IO,
+     "Number of pending InnoDB data file reads and writes above which "
+     "--adaptive-throttle considers the server under stress. Default is 64.",
+     &opt_adaptive_throttle_max_pending_io,
+     &opt_adaptive_throttle_max_pending_io, 0, GET_ULONG, REQUIRED_ARG, 64, 1,
+     ULONG_MAX, 0, 1, 0},
+    {"adaptive-throttle-max-history-length",
+     OPT_XTRA_ADAPTIVE_THROTTLE_MAX_HISTORY_LENGTH,
+     "InnoDB history list length above which --adaptive-throttle considers "
+     "the server under stress. Default is 1000000.",
+     &opt_adaptive_throttle_max_history_length,
+     &opt_adaptive_throttle_max_history_length, 0, GET_ULONG, REQUIRED_ARG,
+     1000000, 1, ULONG_MAX, 0, 1, 0},
+    {"adaptive-throttle-max-checkpoint-age",
+     OPT_XTRA_ADAPTIVE_THROTTLE_MAX_CHECKPOINT_AGE,
+     "Checkpoint age, in percent of the age at which the server starts "
+     "asynchronous flushing, above which --adaptive-throttle considers the "
+     "server under stress. Default is 75.",
+     &opt_adaptive_throttle_max_checkpoint_age,
+     &opt_adaptive_throttle_max_checkpoint_age, 0, GET_UINT, REQUIRED_ARG, 75,
+     1, 100, 0, 1, 0},
     {"log", OPT_LOG, "Ignored option for MySQL option compatibility",
      (G_PTR *)&log_ignored_opt, (G_PTR *)&log_ignored_opt, 0, GET_STR, OPT_ARG,
      0, 0, 0, 0, 0, 0},
@@ -857,15 +1434,42 @@ struct my_option xb_client_options[] = {
      (G_PTR *)&xtrabackup_redo_log_arch_dir,
      (G_PTR *)&xtrabackup_redo_log_arch_dir, 0, GET_STR, REQUIRED_ARG, 0, 0, 0,
      0, 0, 0},
+    {"redo_log_arch_only", OPT_INNODB_REDO_LOG_ARCHIVE_ONLY,
+     "Once the server's redo log archive is in use, stop polling the redo log "
+     "and copy the archive with large sequential reads after the datafiles "
+     "have been copied. Falls back to the regular redo log copy when the "
+     "archive is not available.",
+     (G_PTR *)&xtrabackup_redo_log_arch_only,
+     (G_PTR *)&xtrabackup_redo_log_arch_only, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0,
+     0, 0},
     {"incremental-dir", OPT_XTRA_INCREMENTAL_DIR,
      "(for --prepare): apply .delta files and logfile in the specified "
-     "directory.",
+     "directory. With --copy-back, the .delta files are applied to the data "
+     "files while copying back a full backup prepared with --apply-log-only, "
+     "and the datadir is left to --prepare for the redo log.",
      (G_PTR *)&xtrabackup_incremental_dir, (G_PTR *)&xtrabackup_incremental_dir,
      0, GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+    {"incremental-format", OPT_XTRA_INCREMENTAL_FORMAT,
+     "(for --backup): format of the .delta files. 1 stores a page of page "
+     "numbers per cluster of pages. 2 stores ranges of pages in a header only "
+     "as long as needed, which is smaller for sparse changes, and can only be "
+     "prepared by this version or later. Default is 1.",
+     (G_PTR *)&xtrabackup_incremental_format,
+     (G_PTR *)&xtrabackup_incremental_format, 0, GET_UINT, REQUIRED_ARG, 1, 1,
+     2, 0, 0, 0},
     {"to-archived-lsn", OPT_XTRA_ARCHIVED_TO_LSN,
      "Don't apply archived logs with bigger log sequence number.",
      (G_PTR *)&xtrabackup_archived_to_lsn, (G_PTR *)&xtrabackup_archived_to_lsn,
      0, GET_LL, REQUIRED_ARG, 0, 0, LLONG_MAX, 0, 0, 0},
+    {"stop-at-lsn", OPT_XTRA_STOP_AT_LSN,
+     "(for --backup): keep copying the redo log after the datafiles until "
+     "the specified log sequence number, so that the backup is prepared to "
+     "exactly that LSN. It must not be lower than the LSN the backup ends at "
+     "otherwise. The binary log coordinates are still those of the end of "
+     "the backup. (for --prepare with --apply-archived-redo): roll the "
+     "backup forward to this LSN instead of the end of the archive.",
+     (G_PTR *)&xtrabackup_stop_at_lsn, (G_PTR *)&xtrabackup_stop_at_lsn, 0,
+     GET_LL, REQUIRED_ARG, 0, 0, LLONG_MAX, 0, 0, 0},
     {"tables", OPT_XTRA_TABLES, "filtering by regexp for table names.",
      (G_PTR *)&xtrabackup_tables, (G_PTR *)&xtrabackup_tables, 0, GET_STR,
      REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
@@ -910,6 +1514,92 @@ struct my_option xb_client_options[] = {
      (G_PTR *)&xtrabackup_stream_str, (G_PTR *)&xtrabackup_stream_str, 0,
      GET_STR, OPT_ARG, 0, 0, 0, 0, 0, 0},
 
+    {"stream-crc32c", OPT_XTRA_STREAM_CRC32C,
+     "Checksum the xbstream chunks with CRC-32C, which is computed with the "
+     "SSE4.2 or ARMv8 CRC instructions, instead of CRC-32. Such streams can "
+     "not be extracted by older versions of xbstream. The default is OFF.",
+     (G_PTR *)&xtrabackup_stream_crc32c, (G_PTR *)&xtrabackup_stream_crc32c,
+     0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"stream-index", OPT_XTRA_STREAM_INDEX,
+     "Write an index of the xbstream chunks at the end of the stream. When "
+     "the stream is saved to a file, xbstream -x --only can then extract "
+     "single files without reading the whole stream. The default is OFF.",
+     (G_PTR *)&xtrabackup_stream_index, (G_PTR *)&xtrabackup_stream_index, 0,
+     GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"stream-chunk-size", OPT_XTRA_STREAM_CHUNK_SIZE,
+     "Size of the xbstream chunks small writes are grouped into. Chunk "
+     "buffers are only held by the files being written, larger chunks suit "
+     "large object uploads. The default value is 10M.",
+     (G_PTR *)&xtrabackup_stream_chunk_size,
+     (G_PTR *)&xtrabackup_stream_chunk_size, 0, GET_ULL, REQUIRED_ARG,
+     XB_STREAM_DEFAULT_CHUNK_SIZE, (1 << 16), (1ULL << 30), 0, 1024, 0},
+
+    {"stream-detect-holes", OPT_XTRA_STREAM_DETECT_HOLES,
+     "Find the zero filled 4K blocks of the .ibd files written to the "
+     "xbstream and send them as holes of sparse chunks, which xbstream -x "
+     "punches in the extracted files. Reduces the size of streams of page "
+     "compressed tablespaces. The default is OFF.",
+     (G_PTR *)&xtrabackup_stream_detect_holes,
+     (G_PTR *)&xtrabackup_stream_detect_holes, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0,
+     0, 0},
+
+    {"stream-skip-checksum", OPT_XTRA_STREAM_SKIP_CHECKSUM,
+     "Do not checksum the xbstream chunks, saving a pass over the data when "
+     "the stream goes to xbstream -x on the same host or is compressed or "
+     "encrypted, which carry their own checksums. Such streams can not be "
+     "extracted by older versions of xbstream. The default is OFF.",
+     (G_PTR *)&xtrabackup_stream_skip_checksum,
+     (G_PTR *)&xtrabackup_stream_skip_checksum, 0, GET_BOOL, NO_ARG, 0, 0, 0,
+     0, 0, 0},
+
+    {"stream-zero-copy", OPT_XTRA_STREAM_ZERO_COPY,
+     "Move the stream into STDOUT with vmsplice() instead of copying it when "
+     "STDOUT is a pipe, each write then waits until the reader has read the "
+     "pipe. Saves a copy of the whole stream, most with --stream-skip-checksum "
+     "which saves the pass over it too. The reader must read() the pipe: a "
+     "reader splicing it further, e.g. into a socket, could send memory "
+     "reused by the backup. The default is OFF.",
+     (G_PTR *)&xtrabackup_stream_zero_copy,
+     (G_PTR *)&xtrabackup_stream_zero_copy, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0,
+     0},
+
+    {"stream-fds", OPT_XTRA_STREAM_FDS,
+     "Comma separated list of open file descriptors to stream to instead of "
+     "STDOUT, e.g. --stream-fds=3,4 3>pipe1 4>pipe2. The files are spread "
+     "over the streams as with --fifo-streams, each stream starts with a "
+     "manifest so that xbstream -x --stream-fds reading all of them can check "
+     "that none is missing. Implies --stream=xbstream.",
+     &xtrabackup_stream_fds, &xtrabackup_stream_fds, 0, GET_STR_ALLOC,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"stream-balance", OPT_XTRA_STREAM_BALANCE,
+     "How files are spread over the streams of --fifo-streams and "
+     "--stream-fds. round-robin sends each file to the next stream, "
+     "least-loaded to the stream with the fewest files being written, so "
+     "that slower streams get less data, least-bytes to the stream with the "
+     "fewest bytes left to write of the files being written, so that huge "
+     "tablespaces are spread over the streams. The default is round-robin.",
+     &xtrabackup_stream_balance, &xtrabackup_stream_balance,
+     &stream_balance_typelib, GET_ENUM, REQUIRED_ARG,
+     DS_XBSTREAM_BALANCE_ROUND_ROBIN, 0, 0, 0, 0, 0},
+
+    {"stream-to", OPT_XTRA_STREAM_TO,
+     "Stream the backup over TCP to xbstream --listen at host:port, instead "
+     "of STDOUT. Connecting is retried for up to --fifo-timeout seconds. The "
+     "data is not encrypted on the wire, use --encrypt for untrusted "
+     "networks. Implies --stream=xbstream.",
+     &opt_stream_to, &opt_stream_to, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0,
+     0, 0, 0},
+
+    {"stream-connections", OPT_XTRA_STREAM_CONNECTIONS,
+     "Number of parallel TCP connections of --stream-to, the files are spread "
+     "over them as with --stream-fds. xbstream --listen must accept the same "
+     "number of connections.",
+     &opt_stream_connections, &opt_stream_connections, 0, GET_UINT,
+     REQUIRED_ARG, 1, 1, 1024, 0, 0, 0},
+
     {"compress", OPT_XTRA_COMPRESS,
      "Compress individual backup files using the specified compression "
      "algorithm. Supported algorithms are 'lz4' and 'zstd'. The "
@@ -936,6 +1626,55 @@ struct my_option xb_client_options[] = {
      (G_PTR *)&xtrabackup_compress_zstd_level, 0, GET_UINT, REQUIRED_ARG, 1, 1,
      19, 0, 0, 0},
 
+    {"compress-skip-incompressible", OPT_XTRA_COMPRESS_SKIP_INCOMPRESSIBLE,
+     "Store data that looks already compressed or encrypted without "
+     "compressing it, judging by the entropy of a sample of every chunk. The "
+     "data is marked as stored in the compression format itself, so the "
+     "backup decompresses as usual. Enabled by default, use "
+     "--skip-compress-skip-incompressible to compress everything.",
+     &xtrabackup_compress_skip_incompressible,
+     &xtrabackup_compress_skip_incompressible, 0, GET_BOOL, NO_ARG, 1, 0, 0, 0,
+     0, 0},
+
+    {"compress-lz4-linked-blocks", OPT_XTRA_COMPRESS_LZ4_LINKED_BLOCKS,
+     "Write LZ4 frames of linked blocks, every block of --compress-chunk-size "
+     "bytes may refer to the data of the blocks before it in the frame, which "
+     "improves the compression ratio. The frames are compressed and "
+     "decompressed in parallel. Such backups can not be decompressed by older "
+     "versions of xbstream and xtrabackup. The default is OFF.",
+     (G_PTR *)&xtrabackup_compress_lz4_linked_blocks,
+     (G_PTR *)&xtrabackup_compress_lz4_linked_blocks, 0, GET_BOOL, NO_ARG, 0,
+     0, 0, 0, 0, 0},
+
+    {"compress-lz4-frame-size", OPT_XTRA_COMPRESS_LZ4_FRAME_SIZE,
+     "Maximum size of the data of an LZ4 frame of linked blocks in bytes, "
+     "only has effect with --compress-lz4-linked-blocks. Larger frames "
+     "compress better, smaller frames leave more work to run in parallel. "
+     "The default value is 1M.",
+     (G_PTR *)&xtrabackup_compress_lz4_frame_size,
+     (G_PTR *)&xtrabackup_compress_lz4_frame_size, 0, GET_ULL, REQUIRED_ARG,
+     (1 << 20), (1 << 16), (1ULL << 30), 0, 1024, 0},
+
+    {"compress-zstd-dict-size", OPT_XTRA_COMPRESS_ZSTD_DICT_SIZE,
+     "Train a zstd dictionary of up to this many bytes on the first pages of "
+     "the small datafiles when the backup starts, and compress the datafiles "
+     "with it. Improves the compression of many similar small tables. The "
+     "dictionary is stored in the backup as " XTRABACKUP_ZSTD_DICT
+     " and used by xbstream --decompress and xtrabackup --decompress. 0 "
+     "disables the dictionary. Default is 0.",
+     &opt_compress_zstd_dict_size, &opt_compress_zstd_dict_size, 0, GET_ULL,
+     REQUIRED_ARG, 0, 0, 16 * 1024 * 1024, 0, 1024, 0},
+
+    {"compress-policy-file", OPT_XTRA_COMPRESS_POLICY_FILE,
+     "Choose the compression of every tablespace with the rules in this "
+     "file, one 'PATTERN METHOD' rule per line. PATTERN is a regular "
+     "expression matched against 'database.table' names like --tables, or "
+     "ROW_FORMAT=COMPRESSED to match tablespaces with compressed pages. "
+     "METHOD is 'none', 'lz4', 'zstd' or 'zstd:LEVEL'. The first matching "
+     "rule wins, other tablespaces use --compress. Requires --compress.",
+     &opt_compress_policy_file, &opt_compress_policy_file, 0, GET_STR,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
     {"encrypt", OPT_XTRA_ENCRYPT,
      "Encrypt individual backup files using the "
      "specified encryption algorithm.",
@@ -964,12 +1703,68 @@ struct my_option xb_client_options[] = {
      (G_PTR *)&xtrabackup_encrypt_chunk_size, 0, GET_ULL, REQUIRED_ARG,
      (1 << 16), 1024, ULLONG_MAX, 0, 0, 0},
 
+    {"encrypt-gcm", OPT_XTRA_ENCRYPT_GCM,
+     "Encrypt and authenticate the data with AES-GCM in a single pass instead "
+     "of AES-CTR with a separate hash and checksum. Backups made with this "
+     "option can not be decrypted by older versions of xbcrypt, xbstream and "
+     "xtrabackup. The default is OFF.",
+     (G_PTR *)&xtrabackup_encrypt_gcm, (G_PTR *)&xtrabackup_encrypt_gcm, 0,
+     GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+
     {"rebuild_threads", OPT_XTRA_REBUILD_THREADS,
      "Use this number of threads to rebuild indexes in a compact backup. "
-     "Only has effect with --prepare and --rebuild-indexes.",
+     "Compact backups are not supported by this version, the option has no "
+     "effect. --plan estimates the share of the secondary index pages.",
      (G_PTR *)&xtrabackup_rebuild_threads, (G_PTR *)&xtrabackup_rebuild_threads,
      0, GET_UINT, REQUIRED_ARG, 1, 1, UINT_MAX, 0, 0, 0},
 
+    {"apply-log-threads", OPT_XTRA_APPLY_LOG_THREADS,
+     "Use this number of threads to apply the redo log to the pages with "
+     "--prepare. The pages are split between the threads by page number. "
+     "Default is 1.",
+     &xtrabackup_apply_log_threads, &xtrabackup_apply_log_threads, 0,
+     GET_UINT, REQUIRED_ARG, 1, 1, 256, 0, 0, 0},
+
+    {"rollback-threads", OPT_XTRA_ROLLBACK_THREADS,
+     "Use this number of threads to roll back the uncommitted transactions "
+     "at the end of --prepare, one transaction per thread at a time. "
+     "Default is 1.",
+     &xtrabackup_rollback_threads, &xtrabackup_rollback_threads, 0, GET_UINT,
+     REQUIRED_ARG, 1, 1, 256, 0, 0, 0},
+
+    {"prepare-huge-pages", OPT_XTRA_PREPARE_HUGE_PAGES,
+     "Back the buffer pool of --prepare, which also holds the parsed redo "
+     "log records, with huge pages, to cut the TLB misses of the page apply "
+     "with a large --use-memory. 'transparent' advises the kernel to use "
+     "transparent huge pages. 'explicit' allocates the buffer pool from the "
+     "reserved huge pages of vm.nr_hugepages, falling back to normal pages "
+     "when there are not enough of them. Either way the buffer pool is "
+     "faulted in by several threads when it is created. Default is 'off'.",
+     &opt_prepare_huge_pages, &opt_prepare_huge_pages,
+     &prepare_huge_pages_typelib, GET_ENUM, REQUIRED_ARG,
+     PREPARE_HUGE_PAGES_OFF, 0, 0, 0, 0, 0},
+
+    {"prepare-io-engine", OPT_XTRA_PREPARE_IO_ENGINE,
+     "Engine used by --prepare to read pages into the buffer pool and to "
+     "flush them. 'aio' uses the InnoDB AIO selected by "
+     "--innodb-use-native-aio, which is simulated by the "
+     "--innodb-read-io-threads and --innodb-write-io-threads by default. "
+     "'io_uring' uses Linux native AIO through io_uring, which keeps up to "
+     "1024 requests in flight per IO thread and registers the buffer pool "
+     "with the kernel. It needs Linux 5.11 or newer and falls back to 'aio' "
+     "otherwise. Default is 'aio'.",
+     &opt_prepare_io_engine, &opt_prepare_io_engine,
+     &prepare_io_engine_typelib, GET_ENUM, REQUIRED_ARG,
+     PREPARE_IO_ENGINE_AIO, 0, 0, 0, 0, 0},
+
+    {"fast-prepare", OPT_XTRA_FAST_PREPARE,
+     "Do not sync the data and log files while --prepare writes them, and "
+     "sync every file once when it is done instead. A backup whose "
+     "--fast-prepare was interrupted cannot be used and must be restored "
+     "from a copy, which --prepare and --copy-back check.",
+     &xtrabackup_fast_prepare, &xtrabackup_fast_prepare, 0, GET_BOOL, NO_ARG,
+     0, 0, 0, 0, 0, 0},
+
     {"incremental-force-scan", OPT_XTRA_INCREMENTAL_FORCE_SCAN,
      "Perform a full-scan incremental backup even if page tracking is enabled "
      "on server",
@@ -977,6 +1772,14 @@ struct my_option xb_client_options[] = {
      (G_PTR *)&xtrabackup_incremental_force_scan, 0, GET_BOOL, NO_ARG, 0, 0, 0,
      0, 0, 0},
 
+    {"incremental-redo-scan", OPT_XTRA_INCREMENTAL_REDO_SCAN,
+     "Take the pages changed since the incremental LSN from the redo log "
+     "instead of scanning the data files, when the server still has the redo "
+     "log back to that LSN. Ignored with --page-tracking.",
+     (G_PTR *)&xtrabackup_incremental_redo_scan,
+     (G_PTR *)&xtrabackup_incremental_redo_scan, 0, GET_BOOL, NO_ARG, 0, 0, 0,
+     0, 0, 0},
+
     {"close_files", OPT_CLOSE_FILES,
      "do not keep files opened. Use at your own "
      "risk.",
@@ -1003,8 +1806,9 @@ struct my_option xb_client_options[] = {
      "This options creates the "
      "xtrabackup_galera_info file which contains the local node state at "
      "the time of the backup. Option should be used when performing the "
-     "backup of Percona-XtraDB-Cluster. Has no effect when backup locks "
-     "are used to create the backup.",
+     "backup of Percona-XtraDB-Cluster. The state is recovered from the "
+     "InnoDB system header on the prepare stage, so the node does not "
+     "have to be desynced or have its commits blocked during the backup.",
      (uchar *)&opt_galera_info, (uchar *)&opt_galera_info, 0, GET_BOOL, NO_ARG,
      0, 0, 0, 0, 0, 0},
 
@@ -1123,6 +1927,16 @@ struct my_option xb_client_options[] = {
      (uchar *)&opt_rsync, (uchar *)&opt_rsync, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0,
      0, 0},
 
+    {"precopy-non-innodb", OPT_PRECOPY_NON_INNODB,
+     "Copy the non-InnoDB files before taking the backup lock, and under "
+     "the lock only copy again the files which changed since, so that the "
+     "lock is held for less time when there are many such files. Needs a "
+     "local --target-dir with no --compress and no --encrypt, and is "
+     "ignored otherwise or with --rsync, which does the same with the rsync "
+     "utility.",
+     (uchar *)&opt_precopy_non_innodb, (uchar *)&opt_precopy_non_innodb, 0,
+     GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+
     {"force-non-empty-directories", OPT_FORCE_NON_EMPTY_DIRS,
      "This "
      "option, when specified, makes --copy-back or --move-back transfer "
@@ -1133,6 +1947,200 @@ struct my_option xb_client_options[] = {
      (uchar *)&opt_force_non_empty_dirs, (uchar *)&opt_force_non_empty_dirs, 0,
      GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
 
+    {"reflink-only", OPT_REFLINK_ONLY,
+     "Make --copy-back clone every file with a reflink and fail instead of "
+     "copying its data. With the backup on the XFS or btrfs filesystem of "
+     "the datadir, the restore then takes about the same time whatever the "
+     "size of the backup, and the datadir shares the blocks of the backup "
+     "until pages are modified. Cannot be used with --incremental-dir.",
+     (uchar *)&opt_reflink_only, (uchar *)&opt_reflink_only, 0, GET_BOOL,
+     NO_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"restore-progress-interval", OPT_RESTORE_PROGRESS_INTERVAL,
+     "Log the progress of --copy-back, --move-back, --decrypt and "
+     "--decompress every this many seconds, as a JSON line with the bytes "
+     "done and planned, the throughput over the last interval in MiB/s and "
+     "the estimated seconds left. 0 (the default) disables the reporting.",
+     (uchar *)&opt_restore_progress_interval,
+     (uchar *)&opt_restore_progress_interval, 0, GET_UINT, REQUIRED_ARG, 0, 0,
+     3600, 0, 1, 0},
+
+    {"pitr-binlog-dir", OPT_PITR_BINLOG_DIR,
+     "Directory of binary logs archived since the backup, e.g. by mysqlbinlog "
+     "--read-from-remote-server --raw --stop-never. --copy-back and "
+     "--move-back copy the ones from the binary log position of the backup "
+     "on to the datadir as the relay logs xtrabackup-pitr-relay.*, and write "
+     "xtrabackup_pitr_apply.sql, which replays them with the replication "
+     "applier. The applier runs the transactions on parallel workers "
+     "according to their logical clock or writeset dependencies, instead of "
+     "one by one as with mysqlbinlog | mysql.",
+     &opt_pitr_binlog_dir, &opt_pitr_binlog_dir, 0, GET_STR_ALLOC,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"metrics-file", OPT_METRICS_FILE,
+     "Write the progress of the backup to this file in the Prometheus text "
+     "format while it runs: bytes copied and planned, read throughput, redo "
+     "lag behind the server, datafile buffers and compression chunks and "
+     "cloud uploads in flight, and time slept by the throttling. Point the "
+     "textfile collector of node_exporter to its directory.",
+     (uchar *)&opt_metrics_file, (uchar *)&opt_metrics_file, 0, GET_STR,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"metrics-interval", OPT_METRICS_INTERVAL,
+     "Seconds between the writes of --metrics-file. Default is 10.",
+     (uchar *)&opt_metrics_interval, (uchar *)&opt_metrics_interval, 0,
+     GET_UINT, REQUIRED_ARG, 10, 1, 3600, 0, 1, 0},
+
+    {"redo-lag-warn-time", OPT_REDO_LAG_WARN_TIME,
+     "Compare the redo log generation rate of the server with the copy rate "
+     "and warn when the redo log not copied yet is predicted to be "
+     "overwritten within this many seconds. The datafile copy is slowed "
+     "down meanwhile, unless --adaptive-throttle is used. 0 disables the "
+     "prediction. Default is 600.",
+     (uchar *)&opt_redo_lag_warn_time, (uchar *)&opt_redo_lag_warn_time, 0,
+     GET_UINT, REQUIRED_ARG, 600, 0, 86400, 0, 1, 0},
+
+    {"redo-lag-abort-time", OPT_REDO_LAG_ABORT_TIME,
+     "Fail the backup as soon as the redo log not copied yet is predicted "
+     "to be overwritten within this many seconds, instead of when the copy "
+     "finds it overwritten. 0 (the default) never fails early.",
+     (uchar *)&opt_redo_lag_abort_time, (uchar *)&opt_redo_lag_abort_time, 0,
+     GET_UINT, REQUIRED_ARG, 0, 0, 86400, 0, 1, 0},
+
+    {"plan", OPT_BACKUP_PLAN,
+     "With --backup, do not copy anything. Find the tablespaces to back up, "
+     "sample the read throughput of the datafiles, the compression of their "
+     "pages and the redo log generation of the server, and print the "
+     "predicted duration, output size per compression algorithm, share of "
+     "the secondary index pages, peak memory and the recommended --parallel "
+     "and --compress-threads as JSON.",
+     (uchar *)&opt_backup_plan, (uchar *)&opt_backup_plan, 0, GET_BOOL, NO_ARG,
+     0, 0, 0, 0, 0, 0},
+
+    {"max-memory", OPT_MAX_MEMORY,
+     "Limit the memory of the datafile, redo log, stream, compression and "
+     "encryption buffers of the backup to this many bytes. Copy threads wait "
+     "before opening a datafile while their buffers do not fit, so the "
+     "backup runs with fewer --parallel threads instead of running out of "
+     "memory. At least one copy thread always runs. Accepts K, M and G "
+     "suffixes. 0 (the default) only accounts the memory.",
+     &opt_max_memory, &opt_max_memory, 0, GET_ULL, REQUIRED_ARG, 0, 0,
+     ULLONG_MAX, 0, 1, 0},
+
+    {"trace-file", OPT_TRACE_FILE,
+     "Record the datafile reads, compression and encryption tasks, stream "
+     "writes and uploads of every thread and write them to this file at the "
+     "end of the backup in the Chrome trace event format, which "
+     "chrome://tracing and Perfetto load. Meant for performance "
+     "investigations, every thread keeps up to a million events in memory.",
+     &opt_trace_file, &opt_trace_file, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0,
+     0, 0, 0},
+
+    {"apply-benchmark-dir", OPT_APPLY_BENCHMARK_DIR,
+     "With --prepare, clone the backup in --target-dir into this directory, "
+     "which must not contain a backup yet, apply the redo log to the clone "
+     "as --apply-log-only would and print the apply throughput, the pages "
+     "read and written, the number of apply batches and the peak memory as "
+     "JSON. The backup itself is not modified, so that runs with different "
+     "--use-memory and thread settings replay the same redo log against the "
+     "same snapshot.",
+     &opt_apply_benchmark_dir, &opt_apply_benchmark_dir, 0, GET_STR_ALLOC,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"snapshot-create-cmd", OPT_SNAPSHOT_CREATE_CMD,
+     "Shell command creating an atomic snapshot of the storage of the data "
+     "directory (LVM, ZFS, EBS...) and mounting it in --snapshot-dir. It is "
+     "run under the backup lock of --lock-ddl, right before the LSN and the "
+     "binary log position the backup is consistent at are read. The redo "
+     "log is copied up to that point only, the datafiles are then copied "
+     "from the snapshot once the lock is released. All InnoDB tablespaces "
+     "must be in the data directory.",
+     &opt_snapshot_create_cmd, &opt_snapshot_create_cmd, 0, GET_STR_ALLOC,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"snapshot-dir", OPT_SNAPSHOT_DIR,
+     "Directory where --snapshot-create-cmd mounts the snapshot of the data "
+     "directory.",
+     &opt_snapshot_dir, &opt_snapshot_dir, 0, GET_STR_ALLOC, REQUIRED_ARG, 0,
+     0, 0, 0, 0, 0},
+
+    {"snapshot-remove-cmd", OPT_SNAPSHOT_REMOVE_CMD,
+     "Shell command unmounting and removing the snapshot of "
+     "--snapshot-create-cmd once the datafiles are copied from it.",
+     &opt_snapshot_remove_cmd, &opt_snapshot_remove_cmd, 0, GET_STR_ALLOC,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"daemon-interval", OPT_DAEMON_INTERVAL,
+     "With --backup, keep running and take a backup every this many seconds "
+     "and whenever SIGHUP is received, each one in a new subdirectory of "
+     "--target-dir named after its start time. The first backup is a full "
+     "one, or an incremental one on top of --incremental-basedir, every "
+     "next one is an incremental backup on top of the previous successful "
+     "one. SIGTERM and SIGINT stop the scheduling once the running backup "
+     "completes. 0 (the default) takes a single backup.",
+     (uchar *)&opt_daemon_interval, (uchar *)&opt_daemon_interval, 0, GET_UINT,
+     REQUIRED_ARG, 0, 0, UINT_MAX, 0, 1, 0},
+
+    {"archive-redo", OPT_ARCHIVE_REDO,
+     "With --backup, do not copy any datafile. Copy the redo log from the "
+     "checkpoint into --target-dir or the stream until SIGTERM or SIGINT, "
+     "in segments of --archive-redo-segment-size bytes. The first segment "
+     "is xtrabackup_logfile, the next ones are named after the LSN they "
+     "start at. The server is registered as a redo log consumer, so that it "
+     "never overwrites redo log not archived yet. No backup lock is taken, "
+     "an in-place DDL without redo logging ends the archive with an error. "
+     "A full backup taken while the archive runs can be rolled forward with "
+     "--apply-archived-redo. The default is OFF.",
+     (uchar *)&opt_archive_redo, (uchar *)&opt_archive_redo, 0, GET_BOOL,
+     NO_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"archive-redo-segment-size", OPT_ARCHIVE_REDO_SEGMENT_SIZE,
+     "Size of the segments of the redo log archived by --archive-redo. Each "
+     "segment is closed, and with --stream or --cloud-put sent, once it "
+     "reaches this size. The default is 1G.",
+     (uchar *)&opt_archive_redo_segment_size,
+     (uchar *)&opt_archive_redo_segment_size, 0, GET_ULL, REQUIRED_ARG,
+     1024 * 1024 * 1024, 1024 * 1024, ULLONG_MAX, 0, 1024 * 1024, 0},
+
+    {"apply-archived-redo", OPT_APPLY_ARCHIVED_REDO,
+     "With --prepare of a full backup not prepared yet, append the redo log "
+     "archived by --archive-redo in this directory to the redo log of the "
+     "backup, so that the backup is prepared at the end of the archive, or "
+     "at --stop-at-lsn. The archive must cover the end of the backup and be "
+     "decompressed and decrypted already. The binary log coordinates of the "
+     "backup are those of its end.",
+     &opt_apply_archived_redo, &opt_apply_archived_redo, 0, GET_STR_ALLOC,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"tablespace-discovery", OPT_TABLESPACE_DISCOVERY,
+     "How --backup finds the .ibd files to copy. 'scan' (the default) walks "
+     "the data directories and reads the first page of every .ibd file "
+     "before the copy starts. 'dictionary' takes the tablespace IDs, paths "
+     "and flags from the data dictionary of the server and lets the copy "
+     "threads check the first page of each file before copying it, which "
+     "starts the copy much sooner on instances with many tables. .ibd "
+     "files unknown to the data dictionary are not copied then.",
+     &opt_tablespace_discovery, &opt_tablespace_discovery,
+     &tablespace_discovery_typelib, GET_ENUM, REQUIRED_ARG,
+     TABLESPACE_DISCOVERY_SCAN, 0, 0, 0, 0, 0},
+
+    {"stats-sample-pages", OPT_STATS_SAMPLE_PAGES,
+     "With --stats, estimate the statistics of the leaf level of an index "
+     "from this number of leaf pages picked at random instead of reading "
+     "every leaf page, for the indexes with more leaf pages than that. The "
+     "upper levels are always read. 0 (the default) reads every page. "
+     "--parallel sets the number of tables analyzed at the same time.",
+     &opt_stats_sample_pages, &opt_stats_sample_pages, 0, GET_ULONG,
+     REQUIRED_ARG, 0, 0, ULONG_MAX, 0, 1, 0},
+
+    {"export-changed-only", OPT_EXPORT_CHANGED_ONLY,
+     "With --export, keep the .cfg and .cfp files written by a previous "
+     "--export of the backup for the tablespaces whose .ibd file was not "
+     "modified since, for instance by an incremental backup prepared on top "
+     "of it, instead of writing them again for every table.",
+     (G_PTR *)&opt_export_changed_only, (G_PTR *)&opt_export_changed_only, 0,
+     GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+
     {"no-server-version-check", OPT_NO_SERVER_VERSION_CHECK,
      "This option allows backup to proceed when the server version is greater "
      "(newer) than the PXB supported version. (This option is deprecated).",
@@ -1245,6 +2253,16 @@ struct my_option xb_client_options[] = {
      (uchar *)&opt_remove_original, (uchar *)&opt_remove_original, 0, GET_BOOL,
      NO_ARG, 0, 0, 0, 0, 0, 0},
 
+    {"decompress-dir", OPT_DECOMPRESS_DIR,
+     "With --decrypt and --decompress, write the decrypted and decompressed "
+     "files to this directory instead of next to the originals, and copy "
+     "the other files of the backup there as well. The directory then holds "
+     "the whole backup, which can be prepared in place and used as the "
+     "datadir without --copy-back. The directory must be empty unless "
+     "--force-non-empty-directories is given.",
+     (uchar *)&opt_decompress_dir, (uchar *)&opt_decompress_dir, 0, GET_STR,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
     {"ftwrl-wait-query-type", OPT_LOCK_WAIT_QUERY_TYPE,
      "This option specifies which types of queries are allowed to complete "
      "before innobackupex will issue the global lock. Default is all.",
@@ -1319,6 +2337,137 @@ struct my_option xb_client_options[] = {
      10 * 1024 * 1024, 2 * UNIV_PAGE_SIZE_MAX, UINT_MAX, 0, UNIV_PAGE_SIZE_MAX,
      0},
 
+    {"read-buffer-max-size", OPT_XTRA_READ_BUFFER_MAX_SIZE,
+     "Let datafile cursors adapt their read batch size to the measured read "
+     "throughput, between a quarter of --read-buffer-size and this size. The "
+     "value is scaled up to page size. 0 disables adaptation. Default is 0.",
+     &opt_read_buffer_max_size, &opt_read_buffer_max_size, 0, GET_UINT,
+     REQUIRED_ARG, 0, 0, UINT_MAX, 0, UNIV_PAGE_SIZE_MAX, 0},
+
+    {"page-tracking-max-gap", OPT_XTRA_PAGE_TRACKING_MAX_GAP,
+     "Read runs of changed pages separated by at most this many unchanged "
+     "pages with a single read in incremental backups based on page "
+     "tracking. The unchanged pages are dropped by the incremental filter. "
+     "Default is 8, 0 reads every run on its own.",
+     &opt_page_tracking_max_gap, &opt_page_tracking_max_gap, 0, GET_UINT,
+     REQUIRED_ARG, 8, 0, UINT_MAX, 0, 0, 0},
+
+    {"page-tracking-read-ahead", OPT_XTRA_PAGE_TRACKING_READ_AHEAD,
+     "Number of runs of changed pages ahead of the current read that are "
+     "hinted to the kernel for read-ahead in incremental backups based on "
+     "page tracking. Not used when the data files are read with O_DIRECT. "
+     "Default is 16, 0 disables the hints.",
+     &opt_page_tracking_read_ahead, &opt_page_tracking_read_ahead, 0,
+     GET_UINT, REQUIRED_ARG, 16, 0, UINT_MAX, 0, 0, 0},
+
+    {"read-io-engine", OPT_XTRA_READ_IO_ENGINE,
+     "Engine used to read datafiles during backup. 'sync' reads one batch at "
+     "a time. 'io_uring' keeps up to --read-io-depth batches in flight per "
+     "copy thread and validates pages of the current batch while the next ones "
+     "are being read. 'thread' reads the next batches from a helper thread, so "
+     "that reading overlaps with compressing, encrypting or streaming of the "
+     "current batch. Default is 'sync'.",
+     &opt_read_io_engine, &opt_read_io_engine, &read_io_engine_typelib,
+     GET_ENUM, REQUIRED_ARG, READ_IO_ENGINE_SYNC, 0, 0, 0, 0, 0},
+
+    {"read-io-depth", OPT_XTRA_READ_IO_DEPTH,
+     "Number of datafile read batches kept in flight per copy thread when "
+     "--read-io-engine is not 'sync'. Each batch takes an additional "
+     "--read-buffer-size of memory. Default is 4.",
+     &opt_read_io_depth, &opt_read_io_depth, 0, GET_UINT, REQUIRED_ARG, 4, 1,
+     64, 0, 1, 0},
+
+    {"source-read-mode", OPT_XTRA_SOURCE_READ_MODE,
+     "How datafiles are read during backup. 'auto' opens datafiles with "
+     "O_DIRECT when --innodb-flush-method is O_DIRECT or O_DIRECT_NO_FSYNC "
+     "and drops the pages read from the page cache otherwise. 'direct' always "
+     "reads datafiles with O_DIRECT, bypassing the page cache, and falls back "
+     "to dropping the pages read when the filesystem does not support "
+     "O_DIRECT. 'buffered' reads through the page cache and leaves the pages "
+     "there. Default is 'auto'.",
+     &opt_source_read_mode, &opt_source_read_mode, &source_read_mode_typelib,
+     GET_ENUM, REQUIRED_ARG, SOURCE_READ_MODE_AUTO, 0, 0, 0, 0, 0},
+
+    {"preallocate", OPT_XTRA_PREALLOCATE,
+     "Preallocate the size of the source file for every file of a local "
+     "backup that is neither compressed nor encrypted, so that the "
+     "filesystem can allocate it in one go instead of extending it with "
+     "every write. Enabled by default, use --skip-preallocate to disable.",
+     &opt_preallocate, &opt_preallocate, 0, GET_BOOL, NO_ARG, 1, 0, 0, 0, 0,
+     0},
+
+    {"target-write-mode", OPT_XTRA_TARGET_WRITE_MODE,
+     "How the files of a local backup are written. 'buffered' writes through "
+     "the page cache and drops the pages written from it. 'direct' writes with "
+     "O_DIRECT, bypassing the page cache, and falls back to buffered writes "
+     "when the filesystem does not support O_DIRECT. Default is 'buffered'.",
+     &opt_target_write_mode, &opt_target_write_mode,
+     &target_write_mode_typelib, GET_ENUM, REQUIRED_ARG,
+     TARGET_WRITE_MODE_BUFFERED, 0, 0, 0, 0, 0},
+
+    {"datafile-split-size", OPT_XTRA_DATAFILE_SPLIT_SIZE,
+     "Split datafiles of at least twice this size into ranges of this size, "
+     "which idle --parallel threads copy concurrently. Only used by full, "
+     "uncompressed and unencrypted backups to a local directory and by "
+     "--copy-back without --incremental-dir. 0 disables splitting. Default "
+     "is 0.",
+     &opt_datafile_split_size, &opt_datafile_split_size, 0, GET_ULL,
+     REQUIRED_ARG, 0, 0, ULLONG_MAX, 0, UNIV_PAGE_SIZE_MAX, 0},
+
+    {"parallel-per-device", OPT_XTRA_PARALLEL_PER_DEVICE,
+     "Copy at most this many datafiles residing on the same device at a "
+     "time. With datafiles spread over several disks, idle --parallel "
+     "threads pick up datafiles from other disks instead of piling up on a "
+     "busy one. 0 means no limit. Default is 0.",
+     &opt_parallel_per_device, &opt_parallel_per_device, 0, GET_UINT,
+     REQUIRED_ARG, 0, 0, UINT_MAX, 0, 1, 0},
+
+    {"datafile-copy-order", OPT_XTRA_DATAFILE_COPY_ORDER,
+     "Order in which --parallel threads pick up datafiles. 'natural' copies "
+     "them in the order tablespaces were loaded. 'largest-first' starts with "
+     "the biggest datafiles to shorten the tail of the backup. 'table' "
+     "copies the partitions of a table one after the other, in the order "
+     "the first partition of every table was loaded. Default is 'natural'.",
+     &opt_datafile_copy_order, &opt_datafile_copy_order,
+     &datafile_copy_order_typelib, GET_ENUM, REQUIRED_ARG,
+     DATAFILE_COPY_ORDER_NATURAL, 0, 0, 0, 0, 0},
+
+    {"small-datafile-size", OPT_XTRA_SMALL_DATAFILE_SIZE,
+     "Datafiles up to this size are copied on a fast path: their first batch "
+     "is read together with the page size detection and they are not logged "
+     "one by one, every copy thread logs a summary instead. 0 disables the "
+     "fast path. Default is 0.",
+     &opt_small_datafile_size, &opt_small_datafile_size, 0, GET_ULL,
+     REQUIRED_ARG, 0, 0, ULLONG_MAX, 0, UNIV_PAGE_SIZE_MIN, 0},
+
+    {"skip-free-extents", OPT_XTRA_SKIP_FREE_EXTENTS,
+     "Do not copy extents that the tablespace extent descriptors mark as "
+     "free. They are written as holes, or as zeroes when the destination "
+     "does not support sparse files. Only used by full backups of "
+     "unencrypted single file tablespaces. Undo tablespaces are always "
+     "copied this way by full backups.",
+     &opt_skip_free_extents, &opt_skip_free_extents, 0, GET_BOOL, NO_ARG, 0,
+     0, 0, 0, 0, 0},
+
+    {"sparse-zero-pages", OPT_XTRA_SPARSE_ZERO_PAGES,
+     "Write the all-zero pages of the datafiles, e.g. of freshly extended "
+     "tablespaces, as holes of sparse chunks instead of data, whether or not "
+     "the destination can punch holes. The pages are not compressed, "
+     "encrypted or streamed, xbstream -x and the local datasink recreate "
+     "them as holes. Not used for the pages going through --compress or "
+     "--encrypt. The default is OFF.",
+     &opt_sparse_zero_pages, &opt_sparse_zero_pages, 0, GET_BOOL, NO_ARG, 0,
+     0, 0, 0, 0, 0},
+
+    {"numa-bind-threads", OPT_XTRA_NUMA_BIND_THREADS,
+     "Spread --parallel copy threads over the NUMA nodes of the host and bind "
+     "each of them, together with a share of the compression and encryption "
+     "threads processing its data, to its node. Buffers are allocated on the "
+     "node of the thread using them. Copy throughput is reported per node. "
+     "Requires a build with libnuma.",
+     &opt_numa_bind_threads, &opt_numa_bind_threads, 0, GET_BOOL, NO_ARG, 0, 0,
+     0, 0, 0, 0},
+
 #include "caching_sha2_passwordopt-longopts.h"
 #include "sslopt-longopts.h"
 
@@ -1351,6 +2500,26 @@ struct my_option xb_client_options[] = {
      &opt_generate_transition_key, &opt_generate_transition_key, 0, GET_BOOL,
      NO_ARG, 0, 0, 0, 0, 0, 0},
 
+    {"transition-key-cache", OPT_TRANSITION_KEY_CACHE,
+     "File keeping the keys derived from the transition key, so that the "
+     "--prepare and --copy-back runs of a restore derive the key of each "
+     "backup only once. It is created readable by its owner only and "
+     "ignored otherwise. It holds the keys of the tablespace keys of the "
+     "backups and should be removed once the restore is done. The "
+     "transition key is not checked against a key found in the file.",
+     &opt_transition_key_cache, &opt_transition_key_cache, 0, GET_STR,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"reencrypt-tablespaces", OPT_REENCRYPT_TABLESPACES,
+     "Encrypt the pages of the encrypted tablespaces with new keys generated "
+     "for the backup while copying them, instead of the keys of the server. "
+     "The keys are only saved in xtrabackup_keys, encrypted with the "
+     "transition key, which is required. Restoring the backup requires "
+     "--generate-new-master-key and the backup cannot be the base of an "
+     "incremental backup.",
+     &opt_reencrypt_tablespaces, &opt_reencrypt_tablespaces, 0, GET_BOOL,
+     NO_ARG, 0, 0, 0, 0, 0, 0},
+
     {"keyring-file-data", OPT_KEYRING_FILE_DATA, "Path to keyring file.",
      &opt_keyring_file_data, &opt_keyring_file_data, 0, GET_STR, OPT_ARG, 0, 0,
      0, 0, 0, 0},
@@ -1374,6 +2543,15 @@ struct my_option xb_client_options[] = {
      (G_PTR *)&xtrabackup_parallel, (G_PTR *)&xtrabackup_parallel, 0, GET_INT,
      REQUIRED_ARG, 1, 1, INT_MAX, 0, 0, 0},
 
+    {"auto-threads", OPT_XTRA_AUTO_THREADS,
+     "Set --parallel, --compress-threads and --encrypt-threads, unless they "
+     "are given, from the number of CPUs xtrabackup can use: the CPUs it may "
+     "run on, limited by the CPU quota of its cgroup, e.g. the CPU limit of a "
+     "container. The memory limit of the cgroup is always taken into "
+     "account by --use-free-memory-pct. The default is OFF.",
+     &opt_auto_threads, &opt_auto_threads, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0,
+     0},
+
     {"fifo-streams", OPT_XTRA_FIFO_STREAMS,
      "Number of FIFO files to use for parallel datafiles stream. Setting this "
      "parameter to 1 disables FIFO and stream is sent to STDOUT.",
@@ -1391,6 +2569,126 @@ struct my_option xb_client_options[] = {
      (G_PTR *)&xtrabackup_fifo_timeout, (G_PTR *)&xtrabackup_fifo_timeout, 0,
      GET_INT, REQUIRED_ARG, 60, 1, INT_MAX, 0, 0, 0},
 
+    {"stream-queue-size", OPT_XTRA_STREAM_QUEUE_SIZE,
+     "Queue up to this many bytes per stream in memory, written to STDOUT or "
+     "the FIFO files by a background thread. Copy threads keep reading while "
+     "the reader of the stream stalls, until the queue is full. 0 writes "
+     "directly from the copy threads. Default is 0.",
+     &opt_stream_queue_size, &opt_stream_queue_size, 0, GET_ULL, REQUIRED_ARG,
+     0, 0, ULLONG_MAX, 0, 1024 * 1024, 0},
+
+    {"tee-target-dir", OPT_XTRA_TEE_TARGET_DIR,
+     "Also write the backup to this local directory while streaming it. The "
+     "source files are read only once. The local copy holds the same files "
+     "as the stream, compressed and encrypted the same way. Implies "
+     "--stream=xbstream.",
+     &opt_tee_target_dir, &opt_tee_target_dir, 0, GET_STR_ALLOC, REQUIRED_ARG,
+     0, 0, 0, 0, 0, 0},
+
+    {"tee-policy", OPT_XTRA_TEE_POLICY,
+     "What to do when one of the destinations of --tee-target-dir fails. "
+     "'strict' fails the backup. 'best-effort' drops the failed destination "
+     "and completes the backup on the other one, a destination that accepts "
+     "no data for --tee-max-stall seconds is dropped as well. Default is "
+     "'strict'.",
+     &opt_tee_policy, &opt_tee_policy, &tee_policy_typelib, GET_ENUM,
+     REQUIRED_ARG, TEE_POLICY_STRICT, 0, 0, 0, 0, 0},
+
+    {"tee-max-stall", OPT_XTRA_TEE_MAX_STALL,
+     "Number of seconds a destination may stall before it is dropped with "
+     "--tee-policy=best-effort. Default is 60.",
+     &opt_tee_max_stall, &opt_tee_max_stall, 0, GET_UINT, REQUIRED_ARG, 60, 1,
+     UINT_MAX, 0, 1, 0},
+
+    {"file-checksums", OPT_XTRA_FILE_CHECKSUMS,
+     "Record the CRC-32C and the size of every file of the backup, as it is "
+     "written, in xtrabackup_checksums. xbstream -x and --copy-back check "
+     "the files they read against it. Copies of ranges of the files in "
+     "place, such as --precopy-non-innodb, are disabled. The default is OFF.",
+     &opt_file_checksums, &opt_file_checksums, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0,
+     0, 0},
+
+    {"restore-order", OPT_XTRA_RESTORE_ORDER,
+     "Record in xtrabackup_restore_order the order in which the files of the "
+     "backup are best restored: the files needed by --prepare, the system "
+     "tablespace, the undo tablespaces and mysql.ibd first, then the tables "
+     "with the most pages in the buffer pool dump. xbcloud get downloads the "
+     "files in this order, xbstream -x --restore-order extracts them in this "
+     "order. The order cannot be read from an encrypted backup. The default "
+     "is OFF.",
+     &opt_restore_order, &opt_restore_order, 0, GET_BOOL, NO_ARG, 0, 0, 0, 0,
+     0, 0},
+
+    {"cloud-put", OPT_XTRA_CLOUD_PUT,
+     "Upload the backup directly to the S3 bucket given by --s3-bucket under "
+     "this name, instead of writing the stream to STDOUT. The chunks are "
+     "stored the same way as by 'xbcloud put', the backup is restored with "
+     "'xbcloud get'. Implies --stream=xbstream.",
+     &opt_cloud_put, &opt_cloud_put, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0, 0,
+     0, 0},
+
+    {"cloud-parallel", OPT_XTRA_CLOUD_PARALLEL,
+     "Maximum number of chunks uploaded concurrently with --cloud-put. Each "
+     "upload holds its chunk in memory. Default is 8.",
+     &opt_cloud_parallel, &opt_cloud_parallel, 0, GET_UINT, REQUIRED_ARG, 8, 1,
+     UINT_MAX, 0, 1, 0},
+
+    {"cloud-max-retries", OPT_XTRA_CLOUD_MAX_RETRIES,
+     "Number of retries of a failed chunk upload with --cloud-put. Default is "
+     "10.",
+     &opt_cloud_max_retries, &opt_cloud_max_retries, 0, GET_UINT,
+     REQUIRED_ARG, 10, 0, UINT_MAX, 0, 1, 0},
+
+    {"cloud-max-backoff", OPT_XTRA_CLOUD_MAX_BACKOFF,
+     "Maximum backoff delay in milliseconds between retries of a chunk upload "
+     "with --cloud-put. Default is 300000.",
+     &opt_cloud_max_backoff, &opt_cloud_max_backoff, 0, GET_UINT,
+     REQUIRED_ARG, 300000, 1, UINT_MAX, 0, 1, 0},
+
+    {"cloud-cacert", OPT_XTRA_CLOUD_CACERT,
+     "CA certificate file used to verify the object store with --cloud-put.",
+     &opt_cloud_cacert, &opt_cloud_cacert, 0, GET_STR_ALLOC, REQUIRED_ARG, 0,
+     0, 0, 0, 0, 0},
+
+    {"cloud-insecure", OPT_XTRA_CLOUD_INSECURE,
+     "Do not verify the SSL certificate of the object store with --cloud-put.",
+     &opt_cloud_insecure, &opt_cloud_insecure, 0, GET_BOOL, NO_ARG, 0, 0, 0,
+     0, 0, 0},
+
+    {"s3-bucket", OPT_XTRA_S3_BUCKET, "S3 bucket used by --cloud-put.",
+     &opt_s3_bucket, &opt_s3_bucket, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0,
+     0, 0, 0},
+
+    {"s3-region", OPT_XTRA_S3_REGION, "S3 region.", &opt_s3_region,
+     &opt_s3_region, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"s3-endpoint", OPT_XTRA_S3_ENDPOINT, "S3 endpoint.", &opt_s3_endpoint,
+     &opt_s3_endpoint, 0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"s3-access-key", OPT_XTRA_S3_ACCESS_KEY, "S3 access key.",
+     &opt_s3_access_key, &opt_s3_access_key, 0, GET_STR_ALLOC, REQUIRED_ARG, 0,
+     0, 0, 0, 0, 0},
+
+    {"s3-secret-key", OPT_XTRA_S3_SECRET_KEY, "S3 secret key.", 0, 0, 0,
+     GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"s3-session-token", OPT_XTRA_S3_SESSION_TOKEN, "S3 session token.", 0, 0,
+     0, GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"s3-storage-class", OPT_XTRA_S3_STORAGE_CLASS,
+     "S3 storage class. STANDARD|STANDARD_IA|GLACIER|... or any other storage "
+     "class supported by the object store.",
+     &opt_s3_storage_class, &opt_s3_storage_class, 0, GET_STR_ALLOC,
+     REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"s3-bucket-lookup", OPT_XTRA_S3_BUCKET_LOOKUP, "Bucket lookup method.",
+     &opt_s3_bucket_lookup, &opt_s3_bucket_lookup, &s3_bucket_lookup_typelib,
+     GET_ENUM, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+    {"s3-api-version", OPT_XTRA_S3_API_VERSION, "S3 API version.",
+     &opt_s3_api_version, &opt_s3_api_version, &s3_api_version_typelib,
+     GET_ENUM, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
     {"strict", OPT_XTRA_STRICT,
      "Fail with error when invalid arguments were passed to the xtrabackup.",
      (uchar *)&opt_strict, (uchar *)&opt_strict, 0, GET_BOOL, NO_ARG, 1, 0, 0,
@@ -1646,8 +2944,6 @@ uint xb_server_options_count = array_elements(xb_server_options);
    and their link dependencies */
 datasink_t datasink_decrypt;
 datasink_t datasink_decompress;
-datasink_t datasink_decompress_lz4;
-datasink_t datasink_decompress_zstd;
 
 #ifndef __WIN__
 static int debug_sync_resumed;
@@ -1657,6 +2953,13 @@ static void sigcont_handler(int sig);
 static void sigcont_handler(int sig __attribute__((unused))) {
   debug_sync_resumed = 1;
 }
+
+/* set by SIGUSR1, the wait states are logged by io_watching_thread() */
+static std::atomic<bool> wait_state_dump_requested{false};
+
+static void sigusr1_handler(int sig __attribute__((unused))) {
+  wait_state_dump_requested = true;
+}
 #endif
 
 void debug_sync_point(const char *name) {
@@ -1755,7 +3058,8 @@ bool check_if_param_set(const char *param) {
 
 bool xb_get_one_option(int optid, const struct my_option *opt, char *argument) {
   static const char *hide_value[] = {"password", "encrypt-key",
-                                     "transition-key"};
+                                     "transition-key", "s3-secret-key",
+                                     "s3-session-token"};
 
   param_str << "--" << opt->name;
   if (argument) {
@@ -1878,6 +3182,15 @@ bool xb_get_one_option(int optid, const struct my_option *opt, char *argument) {
     case OPT_XTRA_FIFO_STREAMS:
       xtrabackup_fifo_streams_set = true;
       break;
+    case OPT_XTRA_PARALLEL:
+      xtrabackup_parallel_set = true;
+      break;
+    case OPT_XTRA_COMPRESS_THREADS:
+      xtrabackup_compress_threads_set = true;
+      break;
+    case OPT_XTRA_ENCRYPT_THREADS:
+      xtrabackup_encrypt_threads_set = true;
+      break;
     case OPT_XTRA_COMPRESS:
       if (argument == NULL) {
         xtrabackup_compress = XTRABACKUP_COMPRESS_ZSTD;
@@ -1897,6 +3210,24 @@ bool xb_get_one_option(int optid, const struct my_option *opt, char *argument) {
         return 1;
       }
       break;
+    case OPT_XTRA_READ_IO_ENGINE:
+#ifndef HAVE_LIBURING
+      if (opt_read_io_engine == READ_IO_ENGINE_IO_URING) {
+        xb::warn() << "xtrabackup was built without io_uring support, "
+                      "using --read-io-engine=sync.";
+        opt_read_io_engine = READ_IO_ENGINE_SYNC;
+      }
+#endif
+      break;
+    case OPT_XTRA_PREPARE_IO_ENGINE:
+#ifndef HAVE_LIBURING
+      if (opt_prepare_io_engine == PREPARE_IO_ENGINE_IO_URING) {
+        xb::warn() << "xtrabackup was built without io_uring support, "
+                      "using --prepare-io-engine=aio.";
+        opt_prepare_io_engine = PREPARE_IO_ENGINE_AIO;
+      }
+#endif
+      break;
     case OPT_XTRA_ENCRYPT:
       if (argument == NULL) {
         xb::error()
@@ -1954,6 +3285,12 @@ bool xb_get_one_option(int optid, const struct my_option *opt, char *argument) {
     case OPT_XTRA_ENCRYPT_KEY:
       hide_option(argument, &xtrabackup_encrypt_key);
       break;
+    case OPT_XTRA_S3_SECRET_KEY:
+      hide_option(argument, &opt_s3_secret_key);
+      break;
+    case OPT_XTRA_S3_SESSION_TOKEN:
+      hide_option(argument, &opt_s3_session_token);
+      break;
     case OPT_XTRA_USE_MEMORY:
       xtrabackup_use_memory_set = true;
       break;
@@ -1991,6 +3328,36 @@ inline ulong innodb_page_size_validate(ulong page_size) {
   return (0);
 }
 
+/** Plan the number of batches needed to apply the redo log at --prepare
+from the estimation of the backup. Every page changed by the redo log needs
+its parsed records and a frame in the buffer pool, so a batch holds as many
+pages as the buffer pool has room for both.
+@param[in]	buf_pool_size	buffer pool size
+@return number of batches */
+static ulint xb_plan_recv_batches(ulint buf_pool_size) {
+  const ulint page_memory =
+      real_redo_memory / real_redo_frames + UNIV_PAGE_SIZE;
+  const ulint batch_frames =
+      std::min(std::max<ulint>(buf_pool_size / page_memory, 1),
+               real_redo_frames);
+  const ulint batches = (real_redo_frames + batch_frames - 1) / batch_frames;
+
+  xb::info() << "Planning " << batches << " batch(es) to apply the redo log "
+             << "of " << real_redo_frames << " pages, with up to "
+             << batch_frames << " pages per batch, "
+             << batch_frames * (page_memory - UNIV_PAGE_SIZE)
+             << " bytes for parsing and " << batch_frames * UNIV_PAGE_SIZE
+             << " bytes for page frames.";
+
+  if (batches > 1) {
+    xb::info() << "Each batch reserves a frame for every page it parses. "
+                  "Increase --use-free-memory-pct to apply the redo log in "
+                  "fewer batches.";
+  }
+
+  return (batches);
+}
+
 static bool innodb_init_param(void) {
   /* innobase_init */
   static char current_dir[3]; /* Set if using current lib */
@@ -2236,9 +3603,15 @@ static bool innodb_init_param(void) {
   srv_buf_pool_size = (ulint)xtrabackup_use_memory;
   srv_buf_pool_size = buf_pool_size_align(srv_buf_pool_size);
 
+  if (estimate_memory) {
+    xb_recv_planned_batches = xb_plan_recv_batches(srv_buf_pool_size);
+  }
+
   srv_n_read_io_threads = (ulint)innobase_read_io_threads;
   srv_n_write_io_threads = (ulint)innobase_write_io_threads;
 
+  xb_fil_scan_threads = std::max(xtrabackup_parallel, 1);
+
   srv_force_recovery = (ulint)innobase_force_recovery;
 
   dblwr::g_mode = dblwr::Mode::OFF;
@@ -2252,6 +3625,22 @@ static bool innodb_init_param(void) {
   os_use_large_pages = (bool)innobase_use_large_pages;
   os_large_page_size = (ulint)innobase_large_page_size;
 
+  if (xtrabackup_prepare && opt_prepare_huge_pages != PREPARE_HUGE_PAGES_OFF) {
+    os_use_large_pages =
+        os_use_large_pages ||
+        opt_prepare_huge_pages == PREPARE_HUGE_PAGES_EXPLICIT;
+    buf_pool_madvise_hugepage =
+        opt_prepare_huge_pages == PREPARE_HUGE_PAGES_TRANSPARENT;
+    buf_pool_prefault = true;
+  }
+
+  if (xtrabackup_prepare &&
+      opt_prepare_io_engine == PREPARE_IO_ENGINE_IO_URING) {
+    /* falls back to libaio, then to simulated aio, in os_aio_init() */
+    srv_use_native_aio = true;
+    srv_use_io_uring = true;
+  }
+
   row_rollback_on_timeout = (bool)innobase_rollback_on_timeout;
 
   srv_file_per_table = (bool)innobase_file_per_table;
@@ -2347,7 +3736,9 @@ error:
   return (true);
 }
 
-static void xb_scan_for_tablespaces() {
+/** Find the tablespaces in the data directories.
+@param[in]  undo_only  only look for undo tablespaces */
+static void xb_scan_for_tablespaces(bool undo_only) {
   /* This is the default directory for IBD and IBU files. Put it first
   in the list of known directories. */
   fil_set_scan_dir(MySQL_datadir_path.path());
@@ -2366,11 +3757,106 @@ static void xb_scan_for_tablespaces() {
   --innodb-undo-directory also. */
   fil_set_scan_dir(Fil_path::remove_quotes(MySQL_undo_path), true);
 
-  if (fil_scan_for_tablespaces(true) != DB_SUCCESS) {
+  if (fil_scan_for_tablespaces(true, undo_only) != DB_SUCCESS) {
     exit(EXIT_FAILURE);
   }
 }
 
+/** Tablespaces added from the data dictionary whose first page has not been
+checked yet */
+static std::set<space_id_t> xb_unvalidated_spaces;
+static std::mutex xb_unvalidated_spaces_mutex;
+
+/** Add the .ibd tablespaces of the data dictionary of the server to the
+tablespace cache without opening their files.
+@param[in]  connection  connection to the server
+@return false on error */
+static bool xb_load_dictionary_tablespaces(MYSQL *connection) {
+  const char *query =
+      "SELECT t.SPACE, t.FLAG, t.FILE_SIZE, d.PATH "
+      "FROM INFORMATION_SCHEMA.INNODB_TABLESPACES t "
+      "JOIN INFORMATION_SCHEMA.INNODB_DATAFILES d ON d.SPACE = t.SPACE";
+
+  MYSQL_RES *result = xb_mysql_query_stream(connection, query, false);
+  if (result == nullptr) {
+    xb::error() << "failed to list the tablespaces of the data dictionary";
+    return (false);
+  }
+
+  size_t n_spaces = 0;
+  bool ok = true;
+  MYSQL_ROW row;
+  while ((row = mysql_fetch_row(result)) != nullptr) {
+    const space_id_t space_id = strtoul(row[0], nullptr, 10);
+    const uint32_t flags = strtoul(row[1], nullptr, 10);
+    const uint64_t file_size = strtoull(row[2], nullptr, 10);
+    const std::string path = row[3];
+
+    /* the system, undo and temporary tablespaces are found as usual */
+    if (space_id == 0 || fsp_is_undo_tablespace(space_id) ||
+        !Fil_path::has_suffix(IBD, path.c_str())) {
+      continue;
+    }
+
+    /* name the tablespaces in the data directory like the scan does */
+    const size_t prefix = path.compare(0, 2, "./") == 0 ? 2 : 0;
+    const std::string name = path.substr(prefix, path.length() - prefix - 4);
+    if (check_if_skip_table(name.c_str())) {
+      continue;
+    }
+
+    const dberr_t err = fil_register_for_xtrabackup(
+        path, name, space_id, flags,
+        file_size / page_size_t(flags).physical());
+    if (err == DB_TABLESPACE_EXISTS) {
+      continue;
+    } else if (err != DB_SUCCESS) {
+      xb::error() << "cannot add tablespace " << path;
+      ok = false;
+      break;
+    }
+
+    xb_unvalidated_spaces.insert(space_id);
+    n_spaces++;
+  }
+
+  if (!xb_mysql_stream_end(connection, result, false)) {
+    xb::error() << "failed to list the tablespaces of the data dictionary";
+    return (false);
+  }
+
+  xb::info() << "Found " << n_spaces << " tablespaces in the data dictionary";
+
+  return (ok);
+}
+
+/** Check the first page of a tablespace added from the data dictionary
+before its first copy.
+@param[in]  space  tablespace
+@return DB_SUCCESS, or DB_TABLESPACE_NOT_FOUND if the file is gone */
+static dberr_t xb_validate_dictionary_tablespace(fil_space_t *space) {
+  {
+    std::lock_guard<std::mutex> lock(xb_unvalidated_spaces_mutex);
+    if (xb_unvalidated_spaces.erase(space->id) == 0) {
+      return (DB_SUCCESS);
+    }
+  }
+
+  const dberr_t err = fil_validate_for_xtrabackup(space);
+  if (err == DB_CANNOT_OPEN_FILE &&
+      !os_file_exists(space->files.front().name)) {
+    return (DB_TABLESPACE_NOT_FOUND);
+  }
+  /* PXB-2275 - the encryption is checked at the end of the backup */
+  if (err != DB_SUCCESS && err != DB_INVALID_ENCRYPTION_META) {
+    xb::error() << "tablespace " << space->name << " does not match the "
+                << "data dictionary, error " << err;
+    return (err);
+  }
+
+  return (DB_SUCCESS);
+}
+
 static bool innodb_init(bool init_dd, bool for_apply_log) {
   os_event_global_init();
 
@@ -2567,6 +4053,11 @@ static bool xtrabackup_read_metadata(char *filename) {
   if (fscanf(fp, "redo_frames = %lu\n", &redo_frames) != 1) {
     redo_frames = 0;
   }
+  int reencrypted;
+  if (fscanf(fp, "reencrypted = %d\n", &reencrypted) != 1) {
+    reencrypted = 0;
+  }
+  metadata_reencrypted = reencrypted != 0;
 
 end:
   fclose(fp);
@@ -2590,10 +4081,11 @@ static void xtrabackup_print_metadata(char *buf, size_t buf_len) {
            "flushed_lsn = " LSN_PF
            "\n"
            "redo_memory = %ld\n"
-           "redo_frames = %ld\n",
+           "redo_frames = %ld\n"
+           "reencrypted = %d\n",
            metadata_type_str, metadata_from_lsn, metadata_to_lsn,
            metadata_last_lsn, opt_lock_ddl ? backup_redo_log_flushed_lsn : 0,
-           redo_memory, redo_frames);
+           redo_memory, redo_frames, metadata_reencrypted ? 1 : 0);
 }
 
 /***********************************************************************
@@ -2658,36 +4150,195 @@ static bool xtrabackup_write_metadata(const char *filepath) {
 }
 
 /***********************************************************************
-Read meta info for an incremental delta.
+Write the checksums of --file-checksums to the backup.
 @return true on success, false on failure. */
-static bool xb_read_delta_metadata(const char *filepath,
-                                   xb_delta_info_t *info) {
-  FILE *fp;
-  char key[51];
-  char value[51];
-  bool r = true;
+static bool xb_write_file_checksums(
+    const xb::file_checksums::Entries &entries) {
+  const std::string text = xb::file_checksums::serialize(entries);
+  ds_file_t *stream;
+  MY_STAT mystat;
+  bool rc = true;
 
-  /* set defaults */
-  info->page_size = ULINT_UNDEFINED;
-  info->zip_size = ULINT_UNDEFINED;
-  info->space_id = SPACE_UNKNOWN;
-  info->space_flags = 0;
+  mystat.st_size = text.size();
+  mystat.st_mtime = time(nullptr);
 
-  fp = fopen(filepath, "r");
-  if (!fp) {
-    /* Meta files for incremental deltas are optional */
-    return (true);
+  stream = ds_open(ds_meta, xb::file_checksums::FILENAME, &mystat);
+  if (stream == NULL) {
+    xb::error() << "cannot open output stream for "
+                << xb::file_checksums::FILENAME;
+    return (false);
   }
 
-  while (!feof(fp)) {
-    if (fscanf(fp, "%50s = %50s\n", key, value) == 2) {
-      if (strcmp(key, "page_size") == 0) {
-        info->page_size = strtoul(value, NULL, 10);
-      } else if (strcmp(key, "zip_size") == 0) {
-        info->zip_size = strtoul(value, NULL, 10);
-      } else if (strcmp(key, "space_id") == 0) {
-        info->space_id = strtoul(value, NULL, 10);
-      } else if (strcmp(key, "space_flags") == 0) {
+  if (ds_write(stream, text.c_str(), text.size())) {
+    rc = false;
+  }
+
+  if (ds_close(stream)) {
+    rc = false;
+  }
+
+  if (rc) {
+    xb::info() << "Recorded the checksums of " << entries.size()
+               << " files in " << xb::file_checksums::FILENAME;
+  }
+
+  return (rc);
+}
+
+/***********************************************************************
+Write the order of --restore-order to the backup. The tables are ranked by
+their pages in the buffer pool dump of the server, if there is one.
+@return true on success, false on failure. */
+static bool xb_write_restore_order() {
+  xb::restore_order::Hotness hotness;
+  ds_file_t *stream;
+  MY_STAT mystat;
+  bool rc = true;
+
+  /* needed by --prepare, the redo log is applied first */
+  restore_order_files.add(xb::restore_order::META, 0, "backup-my.cnf");
+  restore_order_files.add(xb::restore_order::META, 0,
+                          XTRABACKUP_METADATA_FILENAME);
+  restore_order_files.add(xb::restore_order::META, 0, XB_LOG_FILENAME);
+
+  if (buffer_pool_filename != nullptr && file_exists(buffer_pool_filename) &&
+      !xb::restore_order::read_hotness(buffer_pool_filename, &hotness)) {
+    xb::warn() << "the tables of " << xb::restore_order::FILENAME
+               << " are not ranked by the buffer pool dump";
+  }
+
+  const std::vector<std::string> paths = restore_order_files.sorted(hotness);
+  const std::string text = xb::restore_order::serialize(paths);
+
+  mystat.st_size = text.size();
+  mystat.st_mtime = time(nullptr);
+
+  stream = ds_open(ds_meta, xb::restore_order::FILENAME, &mystat);
+  if (stream == NULL) {
+    xb::error() << "cannot open output stream for "
+                << xb::restore_order::FILENAME;
+    return (false);
+  }
+
+  if (ds_write(stream, text.c_str(), text.size())) {
+    rc = false;
+  }
+
+  if (ds_close(stream)) {
+    rc = false;
+  }
+
+  if (rc) {
+    xb::info() << "Recorded the restore order of " << paths.size()
+               << " files in " << xb::restore_order::FILENAME
+               << (hotness.empty() ? "" : ", ranked by the buffer pool dump");
+  }
+
+  return (rc);
+}
+
+/***********************************************************************
+Check if the prepare modifies a file of the backup, so that its checksum
+does not hold anymore.
+@return true if the file is modified. */
+static bool xb_prepare_modifies_file(const std::string &path) {
+  const size_t slash = path.rfind('/');
+  const std::string name =
+      slash == std::string::npos ? path : path.substr(slash + 1);
+
+  for (const char *suffix : {".ibd", ".ibu", ".delta", ".meta"}) {
+    if (file_has_suffix(suffix, path)) {
+      return (true);
+    }
+  }
+
+  return (name.compare(0, 6, "ibdata") == 0 ||
+          name.compare(0, 5, "undo_") == 0 ||
+          path.compare(0, 13, "#innodb_redo/") == 0 ||
+          path == XB_LOG_FILENAME || path == XTRABACKUP_METADATA_FILENAME);
+}
+
+/***********************************************************************
+Update the checksums of --file-checksums after the prepare, leaving out the
+files it has modified. The files copied from an incremental backup get the
+checksums of that backup.
+@return true on success, false on failure. */
+static bool xb_prepare_file_checksums() {
+  namespace file_checksums = xb::file_checksums;
+  char filename[FN_REFLEN];
+  file_checksums::Entries entries;
+
+  snprintf(filename, sizeof(filename), "%s/%s", xtrabackup_target_dir,
+           file_checksums::FILENAME);
+  if (!file_exists(filename)) {
+    return (true);
+  }
+
+  if (!file_checksums::read(filename, &entries)) {
+    return (false);
+  }
+
+  if (xtrabackup_incremental_dir != nullptr) {
+    char inc_filename[FN_REFLEN];
+    file_checksums::Entries inc_entries;
+
+    snprintf(inc_filename, sizeof(inc_filename), "%s/%s",
+             xtrabackup_incremental_dir, file_checksums::FILENAME);
+    if (!file_exists(inc_filename)) {
+      xb::warn() << "the incremental backup has no "
+                 << file_checksums::FILENAME << ", removing it from "
+                 << xtrabackup_target_dir;
+      return (my_delete(filename, MYF(MY_WME)) == 0);
+    }
+    if (!file_checksums::read(inc_filename, &inc_entries)) {
+      return (false);
+    }
+    for (const auto &it : inc_entries) {
+      entries[it.first] = it.second;
+    }
+  }
+
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (xb_prepare_modifies_file(it->first)) {
+      it = entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  return (write_to_file(filename, file_checksums::serialize(entries).c_str()));
+}
+
+/***********************************************************************
+Read meta info for an incremental delta.
+@return true on success, false on failure. */
+bool xb_read_delta_metadata(const char *filepath, xb_delta_info_t *info) {
+  FILE *fp;
+  char key[51];
+  char value[51];
+  bool r = true;
+
+  /* set defaults */
+  info->page_size = ULINT_UNDEFINED;
+  info->zip_size = ULINT_UNDEFINED;
+  info->space_id = SPACE_UNKNOWN;
+  info->space_flags = 0;
+
+  fp = fopen(filepath, "r");
+  if (!fp) {
+    /* Meta files for incremental deltas are optional */
+    return (true);
+  }
+
+  while (!feof(fp)) {
+    if (fscanf(fp, "%50s = %50s\n", key, value) == 2) {
+      if (strcmp(key, "page_size") == 0) {
+        info->page_size = strtoul(value, NULL, 10);
+      } else if (strcmp(key, "zip_size") == 0) {
+        info->zip_size = strtoul(value, NULL, 10);
+      } else if (strcmp(key, "space_id") == 0) {
+        info->space_id = strtoul(value, NULL, 10);
+      } else if (strcmp(key, "space_flags") == 0) {
         info->space_flags = strtoul(value, NULL, 10);
       }
     }
@@ -2759,10 +4410,18 @@ static bool xtrabackup_write_info(const char *filepath) {
 }
 
 /* ================= backup ================= */
+/** microseconds slept in xtrabackup_io_throttling() */
+static std::atomic<uint64_t> io_throttling_usecs{0};
+
 void xtrabackup_io_throttling(void) {
   if (xtrabackup_throttle && (--io_ticket) < 0) {
+    xb::wait_state::Scope wait(xb::wait_state::THROTTLE);
+    const auto start = std::chrono::steady_clock::now();
     os_event_reset(wait_throttle);
     os_event_wait(wait_throttle);
+    const auto slept = std::chrono::steady_clock::now() - start;
+    io_throttling_usecs +=
+        std::chrono::duration_cast<std::chrono::microseconds>(slept).count();
   }
 }
 
@@ -2792,19 +4451,29 @@ static bool find_filter_in_hashtable(const char *name, hash_table_t *table,
   return (found != NULL);
 }
 
+static bool regex_rules_check_match(const regex_rules_t &rules,
+                                    const char *name) {
+  ut_ad(rules.pending.empty());
+  if (!rules.literals.empty() &&
+      rules.literals.find(name) != rules.literals.end()) {
+    return (true);
+  }
+  return (regex_list_check_match(rules.compiled, name));
+}
+
 /************************************************************************
 Checks if a given table name matches any of specifications given in
-regex_list or tables_hash.
+regex_rules or tables_hash.
 
-@return true on match or both regex_list and tables_hash are empty.*/
+@return true on match or both regex_rules and tables_hash are empty.*/
 static bool check_if_table_matches_filters(const char *name,
-                                           const regex_list_t &regex_list,
+                                           const regex_rules_t &regex_rules,
                                            hash_table_t *tables_hash) {
-  if (regex_list.empty() && !tables_hash) {
+  if (regex_rules.empty() && !tables_hash) {
     return (false);
   }
 
-  if (regex_list_check_match(regex_list, name)) {
+  if (regex_rules_check_match(regex_rules, name)) {
     return (true);
   }
 
@@ -2880,12 +4549,44 @@ bool check_if_skip_database_by_path(
 }
 
 /************************************************************************
-Checks if a table specified as a name in the form "database/name" (InnoDB 5.6)
-or "./database/name.ibd" (InnoDB 5.5-) should be skipped from backup based on
-the --tables or --tables-file options.
+Spell the partition and subpartition separators of a table name in upper
+case, as in the 5.7 file names.
+
+@return true if the name has separators */
+static bool xb_partition_name_upper(
+    const char *name, /*!< in: db.table#p#partition */
+    char *upper)      /*!< out: db.table#P#partition, FN_REFLEN bytes */
+{
+  bool found = false;
+  size_t i = 0;
+
+  for (const char *p = name; *p != '\0' && i + 3 < FN_REFLEN; ++p, ++i) {
+    upper[i] = *p;
+    if (*p != '#') {
+      continue;
+    }
+    if (strncmp(p, "#p#", 3) == 0) {
+      upper[++i] = 'P';
+      ++p;
+      found = true;
+    } else if (strncmp(p, "#sp#", 4) == 0) {
+      upper[++i] = 'S';
+      upper[++i] = 'P';
+      p += 2;
+      found = true;
+    }
+  }
+  upper[i] = '\0';
+
+  return (found);
+}
+
+/************************************************************************
+Checks if a table should be skipped from backup, without the cache of
+check_if_skip_table().
 
 @return true if the table should be skipped. */
-bool check_if_skip_table(
+static bool check_if_skip_table_low(
     /******************/
     const char *name) /*!< in: path to the table */
 {
@@ -2894,12 +4595,6 @@ bool check_if_skip_table(
   const char *ptr;
   char *eptr;
 
-  if (regex_exclude_list.empty() && regex_include_list.empty() &&
-      tables_include_hash == NULL && tables_exclude_hash == NULL &&
-      databases_include_hash == NULL && databases_exclude_hash == NULL) {
-    return (false);
-  }
-
   dbname = NULL;
   tbname = name;
   while ((ptr = strchr(tbname, OS_PATH_SEPARATOR)) != NULL) {
@@ -2931,13 +4626,22 @@ bool check_if_skip_table(
 
   /* For partitioned tables first try to match against the regexp
   without truncating the #P#... suffix so we can backup individual
-  partitions with regexps like '^test[.]t#P#p5' */
+  partitions with regexps like '^test[.]t#P#p5'. The partition files are
+  named with lower case separators since 8.0, the rules are matched
+  against both spellings. */
+  char upper[FN_REFLEN];
+  const bool has_upper = xb_partition_name_upper(buf, upper);
+
   if (check_if_table_matches_filters(buf, regex_exclude_list,
-                                     tables_exclude_hash)) {
+                                     tables_exclude_hash) ||
+      (has_upper && check_if_table_matches_filters(upper, regex_exclude_list,
+                                                   tables_exclude_hash))) {
     return (true);
   }
   if (check_if_table_matches_filters(buf, regex_include_list,
-                                     tables_include_hash)) {
+                                     tables_include_hash) ||
+      (has_upper && check_if_table_matches_filters(upper, regex_include_list,
+                                                   tables_include_hash))) {
     return (false);
   }
   if ((eptr = strcasestr(buf, "#P#")) != NULL) {
@@ -2959,51 +4663,1167 @@ bool check_if_skip_table(
     return (false);
   }
 
-  if (skip_database == DATABASE_SKIP_SOME_TABLES ||
-      !regex_include_list.empty() || tables_include_hash) {
-    /* Include lists are present, but qualified name
-       failed to match any.*/
-    return (true);
+  if (skip_database == DATABASE_SKIP_SOME_TABLES ||
+      !regex_include_list.empty() || tables_include_hash) {
+    /* Include lists are present, but qualified name
+       failed to match any.*/
+    return (true);
+  }
+
+  return (false);
+}
+
+/************************************************************************
+Checks if a table specified as a name in the form "database/name" (InnoDB 5.6)
+or "./database/name.ibd" (InnoDB 5.5-) should be skipped from backup based on
+the --tables or --tables-file options.
+
+@return true if the table should be skipped. */
+bool check_if_skip_table(
+    /******************/
+    const char *name) /*!< in: path to the table */
+{
+  if (regex_exclude_list.empty() && regex_include_list.empty() &&
+      tables_include_hash == NULL && tables_exclude_hash == NULL &&
+      databases_include_hash == NULL && databases_exclude_hash == NULL) {
+    return (false);
+  }
+
+  std::string key(name);
+  {
+    std::lock_guard<std::mutex> lock(skip_table_cache_mutex);
+    auto it = skip_table_cache.find(key);
+    if (it != skip_table_cache.end()) {
+      return (it->second);
+    }
+  }
+
+  const bool skip = check_if_skip_table_low(name);
+
+  std::lock_guard<std::mutex> lock(skip_table_cache_mutex);
+  if (skip_table_cache.size() < SKIP_TABLE_CACHE_MAX) {
+    skip_table_cache.emplace(std::move(key), skip);
+  }
+
+  return (skip);
+}
+
+const char *xb_get_copy_action(const char *dflt) {
+  const char *action;
+
+  if (xtrabackup_stream) {
+    if (xtrabackup_compress != XTRABACKUP_COMPRESS_NONE) {
+      if (xtrabackup_encrypt) {
+        action = "Compressing, encrypting and streaming";
+      } else {
+        action = "Compressing and streaming";
+      }
+    } else if (xtrabackup_encrypt) {
+      action = "Encrypting and streaming";
+    } else {
+      action = "Streaming";
+    }
+  } else {
+    if (xtrabackup_compress != XTRABACKUP_COMPRESS_NONE) {
+      if (xtrabackup_encrypt) {
+        action = "Compressing and encrypting";
+      } else {
+        action = "Compressing";
+      }
+    } else if (xtrabackup_encrypt) {
+      action = "Encrypting";
+    } else {
+      action = dflt;
+    }
+  }
+
+  return (action);
+}
+
+/* Datafile copied in ranges by several threads */
+struct datafile_split_t {
+  const xb_fil_cur_t *cursor; /*!< cursor of the thread that opened the
+                              datafile, owns the file handle */
+  const char *dst_name;       /*!< destination file name */
+  uint64_t next;              /*!< start of the next unclaimed range */
+  uint64_t end;               /*!< end of the last range */
+  uint n_active;              /*!< number of threads copying ranges */
+  bool error;                 /*!< true if copying of a range failed */
+};
+
+/** Check if a datafile can be copied in ranges by several threads. This
+requires a destination file that can be written at any offset, i.e. a plain
+local copy.
+@param[in]  cursor        opened source file cursor
+@param[in]  write_filter  page write filter
+@return true if the datafile should be split */
+static bool datafile_can_split(const xb_fil_cur_t *cursor,
+                               const xb_write_filt_t *write_filter) {
+  return (opt_datafile_split_size > 0 && write_filter == &wf_write_through &&
+          cursor->read_filter == &rf_pass_through &&
+          ds_data->datasink == &datasink_local &&
+          static_cast<uint64_t>(cursor->statinfo.st_size) >=
+              2 * opt_datafile_split_size);
+}
+
+/** Claim the next range of a split datafile. Must be called with the
+iterator mutex held.
+@param[in,out]  split  split datafile
+@param[out]     start  range start
+@param[out]     end    range end
+@return false if there are no unclaimed ranges left */
+static bool datafile_split_claim_low(datafile_split_t *split, uint64_t *start,
+                                     uint64_t *end) {
+  if (split->next >= split->end || split->error) {
+    return (false);
+  }
+
+  *start = split->next;
+  *end = std::min<uint64_t>(split->next + opt_datafile_split_size, split->end);
+  split->next = *end;
+  split->n_active++;
+
+  return (true);
+}
+
+/** Claim the next range of a split datafile.
+@param[in,out]  it     datafiles iterator
+@param[in,out]  split  split datafile
+@param[out]     start  range start
+@param[out]     end    range end
+@return false if there are no unclaimed ranges left */
+static bool datafile_split_claim(datafiles_iter_t *it, datafile_split_t *split,
+                                 uint64_t *start, uint64_t *end) {
+  mutex_enter(&it->mutex);
+  bool claimed = datafile_split_claim_low(split, start, end);
+  mutex_exit(&it->mutex);
+
+  return (claimed);
+}
+
+/** Release a range claimed with datafile_split_claim().
+@param[in,out]  it     datafiles iterator
+@param[in,out]  split  split datafile
+@param[in]      error  true if the range copy failed */
+static void datafile_split_release(datafiles_iter_t *it,
+                                   datafile_split_t *split, bool error) {
+  mutex_enter(&it->mutex);
+  ut_ad(split->n_active > 0);
+  split->n_active--;
+  if (error) {
+    split->error = true;
+  }
+  mutex_exit(&it->mutex);
+}
+
+/** Copy a range of a datafile.
+@param[in,out]  cursor        source file cursor
+@param[in]      dst_name      destination file name
+@param[in]      dstfile       destination file positioned at the range start
+                              or NULL to open one
+@param[in]      write_filter  page write filter
+@param[in]      start         range start
+@param[in]      end           range end
+@return true on success */
+static bool xtrabackup_copy_datafile_range(xb_fil_cur_t *cursor,
+                                           const char *dst_name,
+                                           ds_file_t *dstfile,
+                                           xb_write_filt_t *write_filter,
+                                           uint64_t start, uint64_t end) {
+  xb_write_filt_ctxt_t write_filt_ctxt;
+  char name[FN_REFLEN];
+  bool own_dstfile = (dstfile == NULL);
+  bool rc = true;
+
+  if (own_dstfile) {
+    dstfile = ds_local_open_at(ds_data, dst_name, start);
+    if (dstfile == NULL) {
+      xb::error() << "cannot open the destination stream for " << dst_name;
+      return (false);
+    }
+  }
+
+  strncpy(name, dst_name, sizeof(name) - 1);
+  name[sizeof(name) - 1] = '\0';
+
+  memset(&write_filt_ctxt, 0, sizeof(xb_write_filt_ctxt_t));
+  if (write_filter->init != NULL &&
+      !write_filter->init(&write_filt_ctxt, name, cursor)) {
+    xb::error() << "failed to initialize page write filter.";
+    rc = false;
+  }
+
+  for (uint64_t offset = start; rc && offset < end;
+       offset += cursor->buf_read) {
+    auto res = xb_fil_cur_read_from_offset(cursor, offset, end - offset);
+    if (res == XB_FIL_CUR_EOF ||
+        (res == XB_FIL_CUR_SUCCESS && cursor->buf_read == 0)) {
+      break;
+    }
+    if (res == XB_FIL_CUR_ERROR ||
+        !write_filter->process(&write_filt_ctxt, dstfile)) {
+      rc = false;
+    }
+  }
+
+  if (write_filter->deinit != NULL) {
+    write_filter->deinit(&write_filt_ctxt);
+  }
+
+  if (own_dstfile && ds_close(dstfile)) {
+    rc = false;
+  }
+
+  return (rc);
+}
+
+/** Copy a datafile in ranges, letting idle threads steal the ranges not yet
+claimed by this thread.
+@param[in,out]  it            datafiles iterator
+@param[in,out]  cursor        opened source file cursor
+@param[in]      dst_name      destination file name
+@param[in]      dstfile       destination file opened at offset 0
+@param[in]      write_filter  page write filter
+@return true on success */
+static bool xtrabackup_copy_datafile_split(datafiles_iter_t *it,
+                                           xb_fil_cur_t *cursor,
+                                           const char *dst_name,
+                                           ds_file_t *dstfile,
+                                           xb_write_filt_t *write_filter) {
+  datafile_split_t split;
+  uint64_t start;
+  uint64_t end;
+
+  split.cursor = cursor;
+  split.dst_name = dst_name;
+  split.next = 0;
+  split.end = cursor->statinfo.st_size;
+  split.n_active = 0;
+  split.error = false;
+
+  /* ranges are not read sequentially */
+  delete cursor->aio;
+  cursor->aio = NULL;
+
+  xb::info() << "Splitting " << cursor->abs_path << " into "
+             << ut_uint64_align_up(split.end, opt_datafile_split_size) /
+                    opt_datafile_split_size
+             << " ranges";
+
+  mutex_enter(&it->mutex);
+  ut_a(datafile_split_claim_low(&split, &start, &end));
+  it->splits.push_back(&split);
+  mutex_exit(&it->mutex);
+
+  bool rc = xtrabackup_copy_datafile_range(cursor, dst_name, dstfile,
+                                           write_filter, start, end);
+  datafile_split_release(it, &split, !rc);
+
+  while (rc && datafile_split_claim(it, &split, &start, &end)) {
+    rc = xtrabackup_copy_datafile_range(cursor, dst_name, NULL, write_filter,
+                                        start, end);
+    datafile_split_release(it, &split, !rc);
+  }
+
+  /* Wait for the ranges copied by other threads, they use the file handle of
+  this cursor */
+  while (true) {
+    mutex_enter(&it->mutex);
+    bool done = (split.n_active == 0);
+    if (done) {
+      it->splits.erase(
+          std::find(it->splits.begin(), it->splits.end(), &split));
+    }
+    mutex_exit(&it->mutex);
+
+    if (done) {
+      break;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  return (!split.error);
+}
+
+/** Copy a range of a datafile split by another copy thread.
+@param[in,out]  it        datafiles iterator
+@param[in]      thread_n  thread number for diagnostics
+@param[out]     error     set to true if the copy failed
+@return false if there was nothing left to copy */
+static bool datafiles_iter_steal(datafiles_iter_t *it, uint thread_n,
+                                 bool *error) {
+  datafile_split_t *split = NULL;
+  uint64_t start;
+  uint64_t end;
+
+  mutex_enter(&it->mutex);
+  for (auto candidate : it->splits) {
+    if (datafile_split_claim_low(candidate, &start, &end)) {
+      split = candidate;
+      break;
+    }
+  }
+  mutex_exit(&it->mutex);
+
+  if (split == NULL) {
+    return (false);
+  }
+
+  xb_fil_cur_t cursor;
+  xb_fil_cur_open_shared(&cursor, split->cursor, thread_n);
+
+  bool rc = xtrabackup_copy_datafile_range(&cursor, split->dst_name, NULL,
+                                           &wf_write_through, start, end);
+  xb_fil_cur_close(&cursor);
+
+  if (!rc) {
+    xb::error() << "failed to copy range " << start << "-" << end << " of "
+                << split->cursor->abs_path;
+    *error = true;
+  }
+
+  datafile_split_release(it, split, !rc);
+
+  return (true);
+}
+
+/* Tablespaces bulk loaded by an in-place DDL which finished during the copy
+of the datafiles, with the lsn of their last MLOG_INDEX_LOAD record */
+static std::map<space_id_t, lsn_t> index_load_spaces;
+static std::mutex index_load_mutex;
+
+/* Undo tablespaces truncated or dropped during the backup, by the space id
+they had before, with the lsn of their MLOG_FILE_DELETE record. Protected by
+index_load_mutex, they are re-copied along with index_load_spaces. */
+static std::map<space_id_t, lsn_t> undo_truncate_spaces;
+
+/* set once the backup lock was requested for index_load_spaces */
+static bool index_load_lock_needed = false;
+
+/* set once index_load_spaces are re-copied, later records fail the backup */
+static bool index_load_recopied = false;
+
+/* size of the ranges of a datafile re-copied by the threads */
+static constexpr uint64_t INDEX_LOAD_RANGE_SIZE = 64 * 1024 * 1024;
+
+/** Record a tablespace bulk loaded by an in-place DDL, set as
+xb_index_load_hook.
+@param[in]  space_id  tablespace id
+@param[in]  lsn       lsn of the MLOG_INDEX_LOAD record
+@return true if the tablespace will be re-copied */
+static bool xb_index_load_add(space_id_t space_id, lsn_t lsn) {
+  std::lock_guard<std::mutex> lock(index_load_mutex);
+  if (index_load_recopied) {
+    return (false);
+  }
+
+  xb::info() << "Tablespace " << space_id << " was bulk loaded by an "
+             << "in-place DDL at lsn " << lsn
+             << ", its modified pages will be re-copied under the backup lock";
+  index_load_spaces[space_id] = lsn;
+
+  return (true);
+}
+
+/** Record an undo tablespace truncated during the backup, set as
+xb_undo_truncate_hook.
+@param[in]  space_id  space id of the undo tablespace before the truncation
+@param[in]  lsn       lsn of the MLOG_FILE_DELETE record
+@return true if the undo tablespace will be re-copied */
+static bool xb_undo_truncate_add(space_id_t space_id, lsn_t lsn) {
+  std::lock_guard<std::mutex> lock(index_load_mutex);
+  if (index_load_recopied) {
+    return (false);
+  }
+
+  if (undo_truncate_spaces.emplace(space_id, lsn).second) {
+    xb::info() << "Undo tablespace " << space_id << " was truncated at lsn "
+               << lsn << ", it will be re-copied under the backup lock";
+  }
+
+  return (true);
+}
+
+/** Start recording the tablespaces bulk loaded by in-place DDL and the
+truncated undo tablespaces instead of failing the backup. The pages are
+re-copied in place and the undo tablespaces replaced, which requires a plain
+local copy of full datafiles, and under the backup lock taken at the end of
+the backup, which --lock-ddl and --lock-ddl-per-table take earlier. */
+static void xb_index_load_init() {
+  if (opt_lock_ddl || opt_lock_ddl_per_table || opt_no_lock ||
+      opt_archive_redo || xtrabackup_incremental != nullptr ||
+      ds_data->datasink != &datasink_local) {
+    return;
+  }
+
+  xb_index_load_hook = xb_index_load_add;
+  xb_undo_truncate_hook = xb_undo_truncate_add;
+}
+
+/** Get the current lsn of the server.
+@param[in]  connection  MySQL connection handle
+@return lsn or 0 if it is not available */
+static lsn_t xb_server_current_lsn(MYSQL *connection) {
+  char *lsn_current = nullptr;
+  mysql_variable metrics[] = {{"log_lsn_current", &lsn_current},
+                              {nullptr, nullptr}};
+
+  read_mysql_variables(connection,
+                       "SELECT NAME, COUNT FROM "
+                       "information_schema.INNODB_METRICS WHERE NAME = "
+                       "'log_lsn_current'",
+                       metrics, true);
+  const lsn_t lsn =
+      lsn_current != nullptr ? strtoull(lsn_current, nullptr, 10) : 0;
+  free_mysql_variables(metrics);
+
+  return (lsn);
+}
+
+/** Wait until the redo log written by the server so far is parsed, so that
+index_load_spaces has the in-place DDL which finished meanwhile.
+@param[in]      connection  MySQL connection handle
+@param[in,out]  redo_mgr    redo log copy
+@return false on error */
+static bool xb_index_load_catch_up(MYSQL *connection,
+                                   Redo_Log_Data_Manager *redo_mgr) {
+  const lsn_t lsn = xb_server_current_lsn(connection);
+  if (lsn == 0) {
+    xb::error() << "cannot read the current lsn from the log_lsn_current "
+                << "InnoDB metric";
+    return (false);
+  }
+
+  if (!redo_mgr->wait_parsed(lsn)) {
+    xb::error() << "log copying failed.";
+    return (false);
+  }
+
+  return (true);
+}
+
+bool xb_index_load_wait(MYSQL *connection, Redo_Log_Data_Manager *redo_mgr) {
+  if (xb_index_load_hook == nullptr) {
+    return (true);
+  }
+
+  if (!xb_index_load_catch_up(connection, redo_mgr)) {
+    return (false);
+  }
+
+  std::lock_guard<std::mutex> lock(index_load_mutex);
+  index_load_lock_needed =
+      !index_load_spaces.empty() || !undo_truncate_spaces.empty();
+
+  return (true);
+}
+
+bool xb_index_load_pending() { return (index_load_lock_needed); }
+
+/** Re-copy the pages of a range of a datafile modified since the start
+checkpoint. Other pages are skipped over, the destination file was written by
+the copy of the datafile already.
+@param[in,out]  cursor    source file cursor
+@param[in]      dst_name  destination file name
+@param[in]      start     range start
+@param[in]      end       range end
+@param[out]     n_pages   number of re-copied pages
+@return true on success */
+static bool xb_index_load_recopy_range(xb_fil_cur_t *cursor,
+                                       const char *dst_name, uint64_t start,
+                                       uint64_t end, uint64_t *n_pages) {
+  ds_file_t *dstfile = ds_local_open_at(ds_data, dst_name, start);
+  if (dstfile == NULL) {
+    xb::error() << "cannot open the destination stream for " << dst_name;
+    return (false);
+  }
+
+  const ulint page_size = cursor->page_size;
+  /* bytes between the last written page and the next one */
+  size_t skip = 0;
+  bool rc = true;
+
+  *n_pages = 0;
+
+  for (uint64_t offset = start; rc && offset < end;
+       offset += cursor->buf_read) {
+    auto res = xb_fil_cur_read_from_offset(cursor, offset, end - offset);
+    if (res == XB_FIL_CUR_EOF ||
+        (res == XB_FIL_CUR_SUCCESS && cursor->buf_read == 0)) {
+      break;
+    }
+    if (res == XB_FIL_CUR_ERROR) {
+      rc = false;
+      break;
+    }
+
+    ulint i = 0;
+    while (rc && i < cursor->buf_npages) {
+      /* the run of pages modified since the start checkpoint */
+      ulint n = 0;
+      while (i + n < cursor->buf_npages &&
+             mach_read_from_8(cursor->buf + (i + n) * page_size +
+                              FIL_PAGE_LSN) > xtrabackup_start_checkpoint) {
+        n++;
+      }
+
+      if (n == 0) {
+        skip += page_size;
+        i++;
+        continue;
+      }
+
+      ds_sparse_chunk_t chunk;
+      chunk.skip = skip;
+      chunk.len = n * page_size;
+      if (ds_write_sparse(dstfile, cursor->buf + i * page_size, chunk.len, 1,
+                          &chunk, false)) {
+        rc = false;
+      }
+
+      skip = 0;
+      i += n;
+      *n_pages += n;
+    }
+  }
+
+  if (ds_close(dstfile)) {
+    rc = false;
+  }
+
+  return (rc);
+}
+
+/** Re-copy the pages of a datafile modified since the start checkpoint, in
+ranges copied by xtrabackup_parallel threads.
+@param[in]  node  datafile
+@return true on success */
+static bool xb_index_load_recopy_node(fil_node_t *node) {
+  xb_fil_cur_t cursor;
+
+  auto res = xb_fil_cur_open(&cursor, &rf_pass_through, node, 0);
+  if (res == XB_FIL_CUR_SKIP) {
+    return (true);
+  } else if (res == XB_FIL_CUR_ERROR) {
+    return (false);
+  }
+
+  /* ranges are not read sequentially */
+  delete cursor.aio;
+  cursor.aio = NULL;
+
+  const uint64_t size = cursor.statinfo.st_size;
+  const size_t n_threads = std::min<uint64_t>(
+      std::max(xtrabackup_parallel, 1),
+      ut_uint64_align_up(size, INDEX_LOAD_RANGE_SIZE) / INDEX_LOAD_RANGE_SIZE);
+
+  std::atomic<uint64_t> next{0};
+  std::atomic<uint64_t> n_pages{0};
+  std::atomic<bool> error{false};
+
+  Thread_pool pool(std::max<size_t>(n_threads, 1));
+  std::vector<std::future<void>> copied;
+  for (size_t i = 0; i < n_threads; i++) {
+    copied.push_back(pool.add_task([&](size_t thread_n) {
+      xb_fil_cur_t range_cursor;
+      xb_fil_cur_open_shared(&range_cursor, &cursor, thread_n + 1);
+
+      uint64_t start;
+      while (!error &&
+             (start = next.fetch_add(INDEX_LOAD_RANGE_SIZE)) < size) {
+        const uint64_t end = std::min(start + INDEX_LOAD_RANGE_SIZE, size);
+        uint64_t range_pages;
+        if (!xb_index_load_recopy_range(&range_cursor, cursor.rel_path, start,
+                                        end, &range_pages)) {
+          xb::error() << "failed to re-copy range " << start << "-" << end
+                      << " of " << cursor.abs_path;
+          error = true;
+        }
+        n_pages += range_pages;
+      }
+
+      xb_fil_cur_close(&range_cursor);
+    }));
+  }
+  for (auto &f : copied) {
+    f.get();
+  }
+
+  xb::info() << "Re-copied " << n_pages << " of " << size / cursor.page_size
+             << " pages of " << cursor.abs_path;
+
+  xb_fil_cur_close(&cursor);
+
+  return (!error);
+}
+
+static bool xtrabackup_copy_datafile(fil_node_t *node, uint thread_n,
+                                     datafiles_iter_t *it);
+
+/** Replace the copy of an undo tablespace truncated during the backup by a
+copy of its current file, which has the new space id. The redo log records
+of the old space id are skipped on --prepare, since no file has it, and the
+file is not created again by the MLOG_FILE_CREATE record of the truncation.
+@param[in]      space_id  space id of the undo tablespace before the
+                          truncation
+@param[in,out]  copied    paths of the undo tablespaces re-copied already
+@return true on success */
+static bool xb_undo_truncate_recopy_space(space_id_t space_id,
+                                          std::set<std::string> *copied) {
+  fil_space_t *space = fil_space_get(space_id);
+  if (space == nullptr) {
+    /* created during the backup, its file is created by --prepare */
+    return (true);
+  }
+
+  const std::string name = space->name;
+  const std::string path = space->files.front().name;
+  if (!copied->insert(path).second) {
+    /* truncated more than once */
+    return (true);
+  }
+
+  const std::string dst_path = std::string(ds_data->root) + "/" +
+                               xb_get_relative_path(space, path.c_str());
+  if (unlink(dst_path.c_str()) != 0 && errno != ENOENT) {
+    xb::error() << "cannot remove " << dst_path << ", errno " << errno;
+    return (false);
+  }
+
+  if (!Fil_path(path).is_file_and_exists()) {
+    xb::info() << "Undo tablespace " << path << " was dropped";
+    return (true);
+  }
+
+  /* the tablespace cache still has the old space under the name */
+  dberr_t err;
+  space_id_t new_space_id;
+  std::tie(err, new_space_id) =
+      fil_open_for_xtrabackup(path, name + "_truncated");
+  fil_space_t *new_space =
+      err == DB_SUCCESS ? fil_space_get(new_space_id) : nullptr;
+  if (new_space == nullptr) {
+    xb::error() << "cannot open the truncated undo tablespace " << path
+                << ". Retry the backup operation";
+    return (false);
+  }
+
+  xb::info() << "Re-copying undo tablespace " << path << " truncated from "
+             << "space id " << space_id << " to " << new_space_id;
+
+  return (!xtrabackup_copy_datafile(&new_space->files.front(), 0, nullptr));
+}
+
+bool xb_index_load_recopy(MYSQL *connection, Redo_Log_Data_Manager *redo_mgr) {
+  if (xb_index_load_hook == nullptr) {
+    return (true);
+  }
+
+  /* the DDL which finished before the lock was granted */
+  if (!xb_index_load_catch_up(connection, redo_mgr)) {
+    return (false);
+  }
+
+  std::map<space_id_t, lsn_t> spaces;
+  std::map<space_id_t, lsn_t> undo_spaces;
+  {
+    std::lock_guard<std::mutex> lock(index_load_mutex);
+    spaces.swap(index_load_spaces);
+    undo_spaces.swap(undo_truncate_spaces);
+    index_load_recopied = true;
+  }
+
+  if (spaces.empty() && undo_spaces.empty()) {
+    return (true);
+  }
+
+  if (!index_load_lock_needed) {
+    xb::error() << "An optimized (without redo logging) DDL operation or "
+                << "an undo truncation finished while the backup lock was "
+                << "not held. PXB will not be able to take a consistent "
+                << "backup. Retry the backup operation";
+    return (false);
+  }
+
+  if (!undo_spaces.empty()) {
+    xb::report::Phase undo_phase("recopy_undo_truncate");
+
+    std::set<std::string> copied;
+    for (const auto &space_lsn : undo_spaces) {
+      if (!xb_undo_truncate_recopy_space(space_lsn.first, &copied)) {
+        return (false);
+      }
+    }
+
+    undo_phase.end();
+  }
+
+  if (spaces.empty()) {
+    return (true);
+  }
+
+  xb::report::Phase recopy_phase("recopy_index_load");
+
+  /* pages bulk loaded before the start checkpoint were flushed before it,
+  the copy of the datafiles has them already. Pages flushed later have a
+  higher lsn, either bulk loaded or redo logged ones. */
+  for (const auto &space_lsn : spaces) {
+    fil_space_t *space = fil_space_get(space_lsn.first);
+    if (space == nullptr) {
+      xb::error() << "cannot re-copy tablespace " << space_lsn.first
+                  << " bulk loaded by an in-place DDL, it was not found "
+                  << "when the backup started. Retry the backup operation";
+      return (false);
+    }
+
+    for (auto &node : space->files) {
+      if (!xb_index_load_recopy_node(&node)) {
+        return (false);
+      }
+    }
+  }
+
+  recopy_phase.end();
+
+  return (true);
+}
+
+/* set once --snapshot-create-cmd succeeded, until --snapshot-remove-cmd */
+static bool snapshot_created = false;
+
+/** Run --snapshot-remove-cmd once the datafiles are copied from the snapshot
+or the backup failed after it was created.
+@return false on error */
+static bool xb_snapshot_remove() {
+  if (!snapshot_created || opt_snapshot_remove_cmd == nullptr) {
+    return (true);
+  }
+  snapshot_created = false;
+
+  xb::info() << "Removing the storage snapshot: " << opt_snapshot_remove_cmd;
+  int ret = system(opt_snapshot_remove_cmd);
+  if (ret != 0) {
+    xb::error() << "--snapshot-remove-cmd failed with exit code " << ret;
+    return (false);
+  }
+
+  return (true);
+}
+
+bool xb_snapshot_create() {
+  if (opt_snapshot_create_cmd == nullptr) {
+    return (true);
+  }
+
+  xb::report::Phase snapshot_phase("snapshot_create");
+
+  xb::info() << "Creating the storage snapshot: " << opt_snapshot_create_cmd;
+  int ret = system(opt_snapshot_create_cmd);
+  if (ret != 0) {
+    xb::error() << "--snapshot-create-cmd failed with exit code " << ret;
+    return (false);
+  }
+  snapshot_created = true;
+
+  MY_STAT stat_info;
+  if (!my_stat(opt_snapshot_dir, &stat_info, MYF(0)) ||
+      !MY_S_ISDIR(stat_info.st_mode)) {
+    xb::error() << "--snapshot-dir " << opt_snapshot_dir
+                << " is not a directory once the snapshot is created";
+    xb_snapshot_remove();
+    return (false);
+  }
+
+  snapshot_phase.end();
+
+  return (true);
+}
+
+bool xb_snapshot_path(const char *path, char *snapshot_path, size_t size) {
+  const std::string datadir = MySQL_datadir_path.abs_path();
+  const std::string real_path = Fil_path::get_real_path(path);
+
+  /* the snapshot mirrors the data directory only */
+  if (!Fil_path::is_ancestor(datadir, real_path)) {
+    xb::error() << path << " is outside of the data directory "
+                << datadir << ", it is not in the storage snapshot";
+    return (false);
+  }
+
+  size_t pos = datadir.length();
+  while (pos < real_path.length() && real_path[pos] == OS_PATH_SEPARATOR) {
+    pos++;
+  }
+
+  if (snprintf(snapshot_path, size, "%s%c%s", opt_snapshot_dir,
+               OS_PATH_SEPARATOR, real_path.c_str() + pos) >= (int)size) {
+    xb::error() << "path of " << path << " in the storage snapshot is too "
+                << "long";
+    return (false);
+  }
+
+  return (true);
+}
+
+/* NUMA nodes the copy threads are bound to by --numa-bind-threads, empty if
+the threads are not bound */
+static std::vector<int> numa_nodes;
+
+/* bytes of datafiles copied by the threads of each of numa_nodes */
+static std::unique_ptr<std::atomic<uint64_t>[]> numa_node_bytes;
+
+/** Bind the calling thread to a NUMA node and make it allocate memory there.
+@param[in]  i  index of the node in numa_nodes */
+static void xb_numa_bind_thread(size_t i [[maybe_unused]]) {
+#ifdef HAVE_LIBNUMA
+  const int node = numa_nodes[i % numa_nodes.size()];
+  if (numa_run_on_node(node) != 0) {
+    xb::warn() << "numa_run_on_node(" << node
+               << ") failed: " << strerror(errno);
+  }
+  numa_set_preferred(node);
+#endif
+}
+
+/** Set up binding of the copy threads and the datasink worker threads to NUMA
+nodes as requested by --numa-bind-threads. Must be called before the datasinks
+are initialized. */
+static void xb_numa_init() {
+  if (!opt_numa_bind_threads) {
+    return;
+  }
+
+#ifdef HAVE_LIBNUMA
+  if (numa_available() < 0) {
+    xb::warn() << "NUMA is not available, ignoring --numa-bind-threads";
+    return;
+  }
+
+  for (int node = 0; node <= numa_max_node(); node++) {
+    if (numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+      numa_nodes.push_back(node);
+    }
+  }
+
+  if (numa_nodes.size() < 2) {
+    xb::info() << "Single NUMA node, ignoring --numa-bind-threads";
+    numa_nodes.clear();
+    return;
+  }
+
+  numa_node_bytes.reset(new std::atomic<uint64_t>[numa_nodes.size()]());
+
+  Thread_pool_numa::n_nodes = numa_nodes.size();
+  Thread_pool_numa::bind = &xb_numa_bind_thread;
+
+  xb::info() << "Binding copy threads to " << numa_nodes.size()
+             << " NUMA nodes";
+#else
+  xb::warn() << "xtrabackup is built without libnuma, ignoring "
+                "--numa-bind-threads";
+#endif
+}
+
+/** Log the copy throughput of the threads bound to every NUMA node.
+@param[in]  usecs  time spent copying datafiles */
+static void xb_numa_report(uint64_t usecs) {
+  for (size_t i = 0; i < numa_nodes.size(); i++) {
+    const uint64_t bytes = numa_node_bytes[i];
+    const double rate =
+        usecs > 0 ? static_cast<double>(bytes) / usecs * 1000000 / 1048576 : 0;
+    xb::info() << "NUMA node " << numa_nodes[i] << ": copied " << bytes
+               << " bytes, " << rate << " MiB/s";
+  }
+}
+
+/* Rule of --compress-policy-file */
+struct compress_rule_t {
+  bool row_format_compressed; /* matches tablespaces with compressed pages
+                              instead of names */
+  xb_regex_t regex;
+  xtrabackup_compress_t method;
+  uint level; /* zstd level */
+  ds_ctxt_t *ds; /* compression stage the rule picks */
+};
+
+static std::vector<compress_rule_t> compress_rules;
+
+/** Parse the compression method of a --compress-policy-file rule.
+@param[in]   str     method
+@param[out]  rule    rule to fill
+@return false if the method is invalid */
+static bool compress_rule_parse_method(const char *str,
+                                       compress_rule_t *rule) {
+  rule->level = xtrabackup_compress_zstd_level;
+
+  if (strcasecmp(str, "none") == 0) {
+    rule->method = XTRABACKUP_COMPRESS_NONE;
+  } else if (strcasecmp(str, "lz4") == 0) {
+    rule->method = XTRABACKUP_COMPRESS_LZ4;
+  } else if (strcasecmp(str, "zstd") == 0) {
+    rule->method = XTRABACKUP_COMPRESS_ZSTD;
+  } else if (strncasecmp(str, "zstd:", 5) == 0) {
+    char *end;
+    const long level = strtol(str + 5, &end, 10);
+    if (*end != '\0' || level < 1 || level > 19) {
+      return false;
+    }
+    rule->method = XTRABACKUP_COMPRESS_ZSTD;
+    rule->level = level;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+/** Create the compression stage for a rule, or reuse the stage of an earlier
+rule with the same method.
+@param[in,out]  rule  rule */
+static void compress_rule_init_ds(compress_rule_t *rule) {
+  if (rule->method == XTRABACKUP_COMPRESS_NONE) {
+    rule->ds = ds_uncompressed_data;
+    return;
+  }
+
+  if (rule->method == xtrabackup_compress &&
+      (rule->method != XTRABACKUP_COMPRESS_ZSTD ||
+       rule->level == xtrabackup_compress_zstd_level)) {
+    rule->ds = ds_data;
+    return;
+  }
+
+  for (const auto &other : compress_rules) {
+    if (&other != rule && other.ds != nullptr &&
+        other.method == rule->method && other.level == rule->level) {
+      rule->ds = other.ds;
+      return;
+    }
+  }
+
+  ds_ctxt_t *ds = ds_create(xtrabackup_target_dir, DS_TYPE_BUFFER);
+  ds_buffer_set_size(ds, opt_read_buffer_size);
+  xtrabackup_add_datasink(ds);
+  ds_set_pipe(ds, ds_uncompressed_data);
+
+  ds_ctxt_t *comp = ds_create(xtrabackup_target_dir,
+                              rule->method == XTRABACKUP_COMPRESS_LZ4
+                                  ? DS_TYPE_COMPRESS_LZ4
+                                  : DS_TYPE_COMPRESS_ZSTD);
+  if (rule->method == XTRABACKUP_COMPRESS_ZSTD) {
+    ds_compress_zstd_set_level(comp, rule->level);
+  }
+  xtrabackup_add_datasink(comp);
+  ds_set_pipe(comp, ds);
+
+  rule->ds = comp;
+}
+
+/** Load --compress-policy-file and create the compression stages its rules
+pick. Exits on errors. */
+static void xb_compress_policy_init() {
+  char line[1024];
+  uint line_no = 0;
+
+  FILE *fp = fopen(opt_compress_policy_file, "r");
+  if (fp == nullptr) {
+    xb::error() << "cannot open " << opt_compress_policy_file;
+    exit(EXIT_FAILURE);
+  }
+
+  while (fgets(line, sizeof(line), fp) != nullptr) {
+    char *saveptr;
+    line_no++;
+
+    char *pattern = strtok_r(line, " \t\r\n", &saveptr);
+    if (pattern == nullptr || *pattern == '#') {
+      continue;
+    }
+    char *method = strtok_r(nullptr, " \t\r\n", &saveptr);
+
+    compress_rule_t rule;
+    if (method == nullptr || strtok_r(nullptr, " \t\r\n", &saveptr) ||
+        !compress_rule_parse_method(method, &rule)) {
+      xb::error() << opt_compress_policy_file << ":" << line_no
+                  << ": expected 'PATTERN none|lz4|zstd[:LEVEL]'";
+      exit(EXIT_FAILURE);
+    }
+
+    rule.row_format_compressed =
+        (strcasecmp(pattern, "ROW_FORMAT=COMPRESSED") == 0);
+    if (!rule.row_format_compressed &&
+        !compile_regex(pattern, "compress-policy-file", &rule.regex)) {
+      exit(EXIT_FAILURE);
+    }
+    rule.ds = nullptr;
+
+    compress_rules.push_back(rule);
+  }
+
+  fclose(fp);
+
+  for (auto &rule : compress_rules) {
+    compress_rule_init_ds(&rule);
+  }
+}
+
+static void xb_compress_policy_free() {
+  for (auto &rule : compress_rules) {
+    if (!rule.row_format_compressed) {
+      xb_regfree(&rule.regex);
+    }
+  }
+  compress_rules.clear();
+}
+
+/** Pick the compression stage for a tablespace with --compress-policy-file.
+@param[in]  name    tablespace name, "database/table" for file-per-table
+@param[in]  cursor  opened source file cursor
+@return datasink to open the tablespace copy in */
+static ds_ctxt_t *xb_compress_policy_ds(const char *name,
+                                        const xb_fil_cur_t *cursor) {
+  char buf[FN_REFLEN];
+
+  if (compress_rules.empty()) {
+    return ds_data;
+  }
+
+  /* match "database.table" like the table filters do */
+  strncpy(buf, name, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  char *sep = strchr(buf, OS_PATH_SEPARATOR);
+  if (sep != nullptr) {
+    *sep = '.';
+  }
+
+  for (const auto &rule : compress_rules) {
+    if (rule.row_format_compressed) {
+      if (cursor->zip_size != 0) {
+        return rule.ds;
+      }
+    } else {
+      xb_regmatch_t regmatch[1];
+      if (xb_regexec(&rule.regex, buf, 1, regmatch, 0) != REG_NOMATCH) {
+        return rule.ds;
+      }
+    }
+  }
+
+  return ds_data;
+}
+
+/* Datafiles up to this size are sampled for the zstd dictionary */
+#define ZSTD_DICT_MAX_FILE_SIZE (16 * 1024 * 1024)
+
+/* Pages sampled from the start of every datafile: the space header, the
+change buffer bitmap, the inodes, the SDI and the first index pages */
+#define ZSTD_DICT_PAGES_PER_FILE 8
+
+/** Train the dictionary of --compress-zstd-dict-size on the first pages of
+the small datafiles, write it to the backup and give it to the zstd
+compression stages of the datafiles. Exits if it cannot be written.
+@param[in]  it  datafiles iterator, not started yet */
+static void xb_zstd_dict_init(const datafiles_iter_t *it) {
+  const size_t dict_capacity = opt_compress_zstd_dict_size;
+  /* zstd recommends samples of about 100 times the dictionary size */
+  const size_t max_samples_size = 100 * dict_capacity;
+  std::vector<char> samples;
+  std::vector<size_t> sample_sizes;
+
+  for (const fil_node_t *node : it->nodes) {
+    if (samples.size() >= max_samples_size) {
+      break;
+    }
+    if (!fsp_is_ibd_tablespace(node->space->id) ||
+        FSP_FLAGS_GET_ENCRYPTION(node->space->flags) ||
+        datafile_size(node) > ZSTD_DICT_MAX_FILE_SIZE) {
+      continue;
+    }
+
+    File fd = my_open(node->name, O_RDONLY, MYF(0));
+    if (fd < 0) {
+      continue;
+    }
+    const size_t page_size = page_size_t(node->space->flags).physical();
+    for (uint i = 0; i < ZSTD_DICT_PAGES_PER_FILE; i++) {
+      const size_t pos = samples.size();
+      samples.resize(pos + page_size);
+      if (my_pread(fd, reinterpret_cast<uchar *>(&samples[pos]), page_size,
+                   i * page_size, MYF(MY_NABP)) != 0) {
+        samples.resize(pos);
+        break;
+      }
+      sample_sizes.push_back(page_size);
+    }
+    my_close(fd, MYF(0));
+  }
+
+  std::vector<char> dict(dict_capacity);
+  const size_t dict_size =
+      ZDICT_trainFromBuffer(dict.data(), dict.size(), samples.data(),
+                            sample_sizes.data(), sample_sizes.size());
+  if (ZDICT_isError(dict_size)) {
+    xb::warn() << "cannot train a zstd dictionary on " << sample_sizes.size()
+               << " pages: " << ZDICT_getErrorName(dict_size)
+               << ". Compressing without a dictionary.";
+    return;
+  }
+
+  /* stored as is, encrypted with the backup if it is encrypted */
+  MY_STAT mystat;
+  memset(&mystat, 0, sizeof(mystat));
+  mystat.st_size = dict_size;
+  mystat.st_mtime = my_time(0);
+  ds_file_t *file =
+      ds_open(ds_uncompressed_data, XTRABACKUP_ZSTD_DICT, &mystat);
+  if (file == nullptr || ds_write(file, dict.data(), dict_size) ||
+      ds_close(file)) {
+    xb::error() << "cannot write " << XTRABACKUP_ZSTD_DICT;
+    exit(EXIT_FAILURE);
+  }
+
+  std::vector<ds_ctxt_t *> stages = {ds_data};
+  for (const auto &rule : compress_rules) {
+    stages.push_back(rule.ds);
+  }
+  std::sort(stages.begin(), stages.end());
+  stages.erase(std::unique(stages.begin(), stages.end()), stages.end());
+  for (auto ds : stages) {
+    if (ds->datasink == &datasink_compress_zstd) {
+      ds_compress_zstd_set_dict(ds, dict.data(), dict_size);
+    }
   }
 
-  return (false);
+  xb::info() << "Trained a zstd dictionary of " << dict_size << " bytes on "
+             << sample_sizes.size() << " pages";
 }
 
-const char *xb_get_copy_action(const char *dflt) {
-  const char *action;
+/* datafiles copied on the small datafile fast path by this thread */
+static thread_local uint64_t small_datafiles_copied = 0;
+static thread_local uint64_t small_datafiles_bytes = 0;
 
-  if (xtrabackup_stream) {
-    if (xtrabackup_compress != XTRABACKUP_COMPRESS_NONE) {
-      if (xtrabackup_encrypt) {
-        action = "Compressing, encrypting and streaming";
-      } else {
-        action = "Compressing and streaming";
-      }
-    } else if (xtrabackup_encrypt) {
-      action = "Encrypting and streaming";
-    } else {
-      action = "Streaming";
-    }
-  } else {
-    if (xtrabackup_compress != XTRABACKUP_COMPRESS_NONE) {
-      if (xtrabackup_encrypt) {
-        action = "Compressing and encrypting";
-      } else {
-        action = "Compressing";
-      }
-    } else if (xtrabackup_encrypt) {
-      action = "Encrypting";
-    } else {
-      action = dflt;
-    }
+/** Record a tablespace file copied to the backup for --restore-order.
+@param[in]  space_id  space id of the tablespace
+@param[in]  dst_name  path of the file in the backup */
+static void xb_restore_order_add(space_id_t space_id, const char *dst_name) {
+  xb::restore_order::Kind kind = xb::restore_order::TABLE;
+
+  if (fsp_is_system_tablespace(space_id)) {
+    kind = xb::restore_order::SYSTEM;
+  } else if (fsp_is_undo_tablespace(space_id)) {
+    kind = xb::restore_order::UNDO;
+  } else if (space_id == dict_sys_t::s_dict_space_id) {
+    kind = xb::restore_order::DICTIONARY;
   }
 
-  return (action);
+  restore_order_files.add(kind, space_id, dst_name);
 }
 
 /* TODO: We may tune the behavior (e.g. by fil_aio)*/
 
-static bool xtrabackup_copy_datafile(fil_node_t *node, uint thread_n) {
+static bool xtrabackup_copy_datafile(fil_node_t *node, uint thread_n,
+                                     datafiles_iter_t *it) {
   char dst_name[FN_REFLEN];
   ds_file_t *dstfile = NULL;
   xb_fil_cur_t cursor;
@@ -3012,6 +5832,7 @@ static bool xtrabackup_copy_datafile(fil_node_t *node, uint thread_n) {
   xb_write_filt_ctxt_t write_filt_ctxt;
   const char *action;
   xb_read_filt_t *read_filter;
+  bool is_small;
   bool rc = false;
 
   /* Get the name and the path for the tablespace. node->name always
@@ -3035,9 +5856,26 @@ static bool xtrabackup_copy_datafile(fil_node_t *node, uint thread_n) {
 
   if (changed_page_tracking) {
     read_filter = &rf_page_tracking;
+  } else if ((opt_skip_free_extents ||
+              fsp_is_undo_tablespace(node->space->id)) &&
+             !xtrabackup_incremental && node->space->files.size() == 1) {
+    /* the undo logs purged since a long transaction leave most of an undo
+    tablespace free until it is truncated */
+    read_filter = &rf_free_extents;
   } else {
     read_filter = &rf_pass_through;
   }
+
+  switch (xb_validate_dictionary_tablespace(node->space)) {
+    case DB_SUCCESS:
+      break;
+    case DB_TABLESPACE_NOT_FOUND:
+      goto skip;
+    default:
+      xb::error() << "xtrabackup_copy_datafile() failed";
+      return (true);
+  }
+
   res = xb_fil_cur_open(&cursor, read_filter, node, thread_n);
   if (res == XB_FIL_CUR_SKIP) {
     goto skip;
@@ -3049,7 +5887,8 @@ static bool xtrabackup_copy_datafile(fil_node_t *node, uint thread_n) {
 
   /* Setup the page write filter */
   if (xtrabackup_incremental) {
-    write_filter = &wf_incremental;
+    write_filter = xtrabackup_incremental_format == 2 ? &wf_incremental_v2
+                                                      : &wf_incremental;
   } else {
     write_filter = &wf_write_through;
   }
@@ -3067,7 +5906,8 @@ static bool xtrabackup_copy_datafile(fil_node_t *node, uint thread_n) {
   if (cursor.is_encrypted) {
     dstfile = ds_open(ds_uncompressed_data, dst_name, &cursor.statinfo);
   } else {
-    dstfile = ds_open(ds_data, dst_name, &cursor.statinfo);
+    dstfile = ds_open(xb_compress_policy_ds(node_name, &cursor), dst_name,
+                      &cursor.statinfo);
   }
   if (dstfile == NULL) {
     xb::error() << "cannot open the destination stream for " << dst_name;
@@ -3076,21 +5916,34 @@ static bool xtrabackup_copy_datafile(fil_node_t *node, uint thread_n) {
 
   action = xb_get_copy_action();
 
-  if (xtrabackup_stream) {
+  is_small = opt_small_datafile_size > 0 &&
+             static_cast<uint64_t>(cursor.statinfo.st_size) <=
+                 opt_small_datafile_size;
+
+  if (is_small) {
+    /* logged in summary by data_copy_thread_func() */
+  } else if (xtrabackup_stream) {
     xb::info() << action << " " << node_path;
   } else {
     xb::info() << action << " " << node_path << " to " << dstfile->path;
   }
 
-  /* The main copy loop */
-  while ((res = xb_fil_cur_read(&cursor)) == XB_FIL_CUR_SUCCESS) {
-    if (!write_filter->process(&write_filt_ctxt, dstfile)) {
+  if (it != NULL && datafile_can_split(&cursor, write_filter)) {
+    if (!xtrabackup_copy_datafile_split(it, &cursor, dst_name, dstfile,
+                                        write_filter)) {
       goto error;
     }
-  }
+  } else {
+    /* The main copy loop */
+    while ((res = xb_fil_cur_read(&cursor)) == XB_FIL_CUR_SUCCESS) {
+      if (!write_filter->process(&write_filt_ctxt, dstfile)) {
+        goto error;
+      }
+    }
 
-  if (res == XB_FIL_CUR_ERROR) {
-    goto error;
+    if (res == XB_FIL_CUR_ERROR) {
+      goto error;
+    }
   }
 
   if (write_filter->finalize &&
@@ -3098,8 +5951,16 @@ static bool xtrabackup_copy_datafile(fil_node_t *node, uint thread_n) {
     goto error;
   }
 
+  if (numa_node_bytes) {
+    numa_node_bytes[Thread_pool_numa::node % numa_nodes.size()] +=
+        cursor.statinfo.st_size;
+  }
+
   /* close */
-  if (xtrabackup_stream) {
+  if (is_small) {
+    small_datafiles_copied++;
+    small_datafiles_bytes += cursor.statinfo.st_size;
+  } else if (xtrabackup_stream) {
     xb::info() << "Done: " << action << " " << node_path;
   } else {
     xb::info() << "Done: " << action << " " << node_path << " to "
@@ -3113,6 +5974,9 @@ static bool xtrabackup_copy_datafile(fil_node_t *node, uint thread_n) {
   if (write_filter && write_filter->deinit) {
     write_filter->deinit(&write_filt_ctxt);
   }
+  if (opt_restore_order && !rc) {
+    xb_restore_order_add(node->space->id, dst_name);
+  }
   return (rc);
 
 error:
@@ -3156,6 +6020,11 @@ void io_watching_thread() {
     std::this_thread::sleep_for(std::chrono::seconds(1)); /*1 sec*/
     io_ticket = xtrabackup_throttle;
     os_event_set(wait_throttle);
+#ifndef __WIN__
+    if (wait_state_dump_requested.exchange(false)) {
+      xb::wait_state::dump();
+    }
+#endif
   }
 
   /* stop io throttle */
@@ -3167,11 +6036,59 @@ void io_watching_thread() {
 }
 
 
+/** Pause a copy thread numbered above the limit set by --adaptive-throttle
+until it may copy again or there are no datafiles left to copy.
+@param[in]  ctxt  copy thread context */
+static void data_copy_thread_throttle(data_thread_ctxt_t *ctxt) {
+  while (ctxt->num > xtrabackup_copy_threads_limit && !*(ctxt->error)) {
+    mutex_enter(&ctxt->it->mutex);
+    const bool done = ctxt->it->i == ctxt->it->nodes.end();
+    mutex_exit(&ctxt->it->mutex);
+
+    if (done) {
+      break;
+    }
+
+    xb::wait_state::Scope wait(xb::wait_state::THROTTLE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+}
+
 /**************************************************************************
 Datafiles copying thread.*/
+/** Datafile buffers a copy thread reserves under --max-memory, in bytes */
+static size_t copy_thread_memory = 0;
+
+/** Reserve the datafile buffers of a copy thread before it opens the next
+datafile. A thread already holding a reservation gives it back and waits for
+a new one while the accounted memory is over --max-memory, so the number of
+threads copying adapts to the memory the rest of the backup uses.
+@param[in]      num       copy thread number
+@param[in,out]  reserved  true if the thread holds a reservation */
+static void data_copy_thread_reserve(uint num, bool *reserved) {
+  if (*reserved) {
+    if (!xb::memory::over_limit()) {
+      return;
+    }
+    xb::memory::unreserve(copy_thread_memory);
+    Io_buffer_pool::instance().trim();
+    *reserved = false;
+  }
+
+  if (!xb::memory::try_reserve(copy_thread_memory)) {
+    xb::info() << "Thread " << num << " waits for memory: "
+               << xb::memory::usage() << " bytes of --max-memory "
+               << opt_max_memory << " in use";
+    xb::memory::reserve(copy_thread_memory);
+    xb::info() << "Thread " << num << " resumes copying";
+  }
+  *reserved = true;
+}
+
 static void data_copy_thread_func(data_thread_ctxt_t *ctxt) {
   uint num = ctxt->num;
   fil_node_t *node;
+  bool reserved = false;
 
   /*
     Initialize mysys thread-specific memory so we can
@@ -3179,22 +6096,65 @@ static void data_copy_thread_func(data_thread_ctxt_t *ctxt) {
   */
   my_thread_init();
 
+  /* bind to a NUMA node before any buffer is allocated */
+  if (!numa_nodes.empty()) {
+    Thread_pool_numa::node = (num - 1) % numa_nodes.size();
+    xb_numa_bind_thread(Thread_pool_numa::node);
+  }
+
   /* create THD to get thread number in the error log */
   THD *thd = create_thd(false, false, true, 0, 0);
   debug_sync_point("data_copy_thread_func");
 
-  while ((node = datafiles_iter_next(ctxt->it)) != NULL && !*(ctxt->error)) {
+  xb::wait_state::thread_start("copy");
+  xb::trace::set_thread_name("copy");
+
+  while ((node = opt_parallel_per_device > 0
+                     ? datafiles_iter_next_on_device(ctxt->it, ctxt->error)
+                     : datafiles_iter_next(ctxt->it)) != NULL &&
+         !*(ctxt->error)) {
+    data_copy_thread_reserve(num, &reserved);
+
     /* copy the datafile */
-    if (xtrabackup_copy_datafile(node, num)) {
-      xb::error() << "failed to copy datafile " << node->name;
-      *(ctxt->error) = true;
+    {
+      xb::trace::Span span("datafile");
+      if (xtrabackup_copy_datafile(node, num, ctxt->it)) {
+        xb::error() << "failed to copy datafile " << node->name;
+        *(ctxt->error) = true;
+      }
+    }
+
+    if (opt_parallel_per_device > 0) {
+      datafiles_iter_release(ctxt->it, node);
+    }
+
+    data_copy_thread_throttle(ctxt);
+  }
+
+  /* help with the datafiles still being copied by other threads */
+  while (!*(ctxt->error)) {
+    data_copy_thread_reserve(num, &reserved);
+    if (!datafiles_iter_steal(ctxt->it, num, ctxt->error)) {
+      break;
     }
   }
 
+  if (reserved) {
+    Io_buffer_pool::instance().trim();
+    xb::memory::unreserve(copy_thread_memory);
+  }
+
+  if (small_datafiles_copied > 0) {
+    xb::info() << "Thread " << num << " done: " << xb_get_copy_action() << " "
+               << small_datafiles_copied << " small datafiles, "
+               << small_datafiles_bytes << " bytes";
+  }
+
   mutex_enter(ctxt->count_mutex);
   (*ctxt->count)--;
   mutex_exit(ctxt->count_mutex);
 
+  xb::wait_state::thread_end();
   destroy_thd(thd);
   my_thread_end();
 }
@@ -3239,7 +6199,18 @@ files first, and then streams them in a serialized way when closed. */
 static void xtrabackup_init_datasinks(void) {
   /* Start building out the pipelines from the terminus back */
   if (xtrabackup_stream) {
-    if (xtrabackup_fifo_streams > 1) {
+    if (opt_cloud_put != nullptr) {
+      /* The chunks are uploaded without going through a pipe */
+      ds_data = ds_meta = ds_redo =
+          ds_create_from(xtrabackup_target_dir, &datasink_object_store,
+                         "object_store");
+    } else if (xtrabackup_stream_fds != nullptr) {
+      /* Use the descriptors given, the FIFO datasink takes them as is */
+      xb::info() << "Streaming to " << xtrabackup_fifo_streams
+                 << " file descriptor(s): " << xtrabackup_stream_fds;
+      ds_data = ds_meta = ds_redo =
+          ds_create(xtrabackup_target_dir, DS_TYPE_FIFO);
+    } else if (xtrabackup_fifo_streams > 1) {
       /* Use Named PIPEs */
       xb::info() << "Creating " << xtrabackup_fifo_streams
                  << " Named Pipes(FIFO) at folder " << xtrabackup_target_dir
@@ -3252,40 +6223,84 @@ static void xtrabackup_init_datasinks(void) {
       /* All streaming goes to stdout */
       ds_data = ds_meta = ds_redo =
           ds_create(xtrabackup_target_dir, DS_TYPE_STDOUT);
+      ds_stdout_set_zero_copy(ds_data, xtrabackup_stream_zero_copy);
     }
   } else {
     /* Local filesystem */
     ds_data = ds_meta = ds_redo =
         ds_create(xtrabackup_target_dir, DS_TYPE_LOCAL);
     punch_hole_supported = ds_data->fs_support_punch_hole;
+    /* the source size is only a good estimate for plain copies */
+    ds_local_set_preallocate(ds_data,
+                             opt_preallocate && !xtrabackup_encrypt &&
+                                 xtrabackup_compress ==
+                                     XTRABACKUP_COMPRESS_NONE);
+    ds_local_set_direct(ds_data,
+                        opt_target_write_mode == TARGET_WRITE_MODE_DIRECT);
   }
 
   /* Track it for destruction */
   xtrabackup_add_datasink(ds_data);
 
-  /* Stream formatting */
-  if (xtrabackup_stream) {
-    ds_ctxt_t *ds;
-    if (xtrabackup_stream_fmt == XB_STREAM_FMT_XBSTREAM) {
-      ds = ds_create(xtrabackup_target_dir, DS_TYPE_XBSTREAM);
-    } else {
-      /* bad juju... */
-      ds = NULL;
-    }
+  /* Decouple copy threads from the stream reader */
+  if (xtrabackup_stream && opt_cloud_put == nullptr &&
+      opt_stream_queue_size > 0) {
+    ds_ctxt_t *ds = ds_create(xtrabackup_target_dir, DS_TYPE_ASYNC);
+    ds_async_set_size(ds, opt_stream_queue_size);
+    xtrabackup_add_datasink(ds);
+    ds_set_pipe(ds, ds_data);
+    ds_data = ds_meta = ds_redo = ds;
+  }
+
+  /* Stream formatting, done by the object store datasink itself. xbstream
+  is the only format, its chunks interleave the files of parallel copy
+  threads, so the metadata and the redo log are streamed directly. */
+  if (xtrabackup_stream && opt_cloud_put == nullptr) {
+    ut_a(xtrabackup_stream_fmt == XB_STREAM_FMT_XBSTREAM);
+    ds_ctxt_t *ds = ds_create(xtrabackup_target_dir, DS_TYPE_XBSTREAM);
 
     xtrabackup_add_datasink(ds);
 
     ds_set_pipe(ds, ds_data);
-    ds_data = ds;
-
-    if (xtrabackup_stream_fmt != XB_STREAM_FMT_XBSTREAM) {
-      /* 'tar' does not allow parallel streams */
-      ds_redo = ds_meta = ds_create(xtrabackup_target_dir, DS_TYPE_TMPFILE);
-      xtrabackup_add_datasink(ds_meta);
-      ds_set_pipe(ds_meta, ds);
-    } else {
-      ds_redo = ds_meta = ds_data;
+    ds_data = ds_meta = ds_redo = ds;
+  }
+
+  /* Copy of the stream contents to a local directory */
+  if (opt_tee_target_dir != nullptr) {
+    ds_ctxt_t *tee = ds_create(xtrabackup_target_dir, DS_TYPE_TEE);
+    ds_ctxt_t *local = ds_create(opt_tee_target_dir, DS_TYPE_LOCAL);
+    xtrabackup_add_datasink(tee);
+    xtrabackup_add_datasink(local);
+
+    ds_ctxt_t *branches[] = {ds_data, local};
+    const char *names[] = {"stream", opt_tee_target_dir};
+    for (size_t i = 0; i < array_elements(branches); i++) {
+      ds_ctxt_t *ds = branches[i];
+      if (opt_tee_policy == TEE_POLICY_BEST_EFFORT) {
+        /* A stalled destination must not hold up the other one */
+        ds = ds_create(xtrabackup_target_dir, DS_TYPE_ASYNC);
+        if (opt_stream_queue_size > 0) {
+          ds_async_set_size(ds, opt_stream_queue_size);
+        }
+        ds_async_set_max_wait(ds, opt_tee_max_stall);
+        xtrabackup_add_datasink(ds);
+        ds_set_pipe(ds, branches[i]);
+      }
+      ds_tee_add_pipe(tee, ds, names[i]);
     }
+    ds_tee_set_best_effort(tee, opt_tee_policy == TEE_POLICY_BEST_EFFORT);
+
+    ds_data = ds_meta = ds_redo = tee;
+  }
+
+  /* Checksums of the files as they are stored, after compression and
+  encryption */
+  if (opt_file_checksums) {
+    ds_file_checksums =
+        ds_create_from(xtrabackup_target_dir, &datasink_checksum, "checksum");
+    xtrabackup_add_datasink(ds_file_checksums);
+    ds_set_pipe(ds_file_checksums, ds_data);
+    ds_data = ds_meta = ds_redo = ds_file_checksums;
   }
 
   /* Encryption */
@@ -3297,6 +6312,7 @@ static void xtrabackup_init_datasinks(void) {
     ds_encrypt_key_file = xtrabackup_encrypt_key_file;
     ds_encrypt_encrypt_threads = xtrabackup_encrypt_threads;
     ds_encrypt_encrypt_chunk_size = xtrabackup_encrypt_chunk_size;
+    ds_encrypt_gcm = xtrabackup_encrypt_gcm;
 
     ds = ds_create(xtrabackup_target_dir, DS_TYPE_ENCRYPT);
     xtrabackup_add_datasink(ds);
@@ -3361,6 +6377,10 @@ static void xtrabackup_init_datasinks(void) {
       }
     }
   }
+
+  if (opt_compress_policy_file != nullptr) {
+    xb_compress_policy_init();
+  }
 }
 
 /************************************************************************
@@ -3373,6 +6393,7 @@ static void xtrabackup_destroy_datasinks(void) {
     ds_destroy(datasinks[i - 1]);
     datasinks[i - 1] = NULL;
   }
+  xb_compress_policy_free();
   ds_data = NULL;
   ds_meta = NULL;
   ds_redo = NULL;
@@ -3441,7 +6462,13 @@ static dberr_t xb_load_tablespaces(void)
   }
 
   xb::info() << "Generating a list of tablespaces";
-  xb_scan_for_tablespaces();
+  const bool from_dictionary =
+      opt_tablespace_discovery == TABLESPACE_DISCOVERY_DICTIONARY &&
+      srv_backup_mode && mysql_connection != nullptr;
+  xb_scan_for_tablespaces(from_dictionary);
+  if (from_dictionary && !xb_load_dictionary_tablespaces(mysql_connection)) {
+    return (DB_ERROR);
+  }
 
   /* Add separate undo tablespaces to fil_system */
 
@@ -3664,17 +6691,106 @@ bool compile_regex(const char *regex_string, const char *error_context,
   return true;
 }
 
+/***********************************************************************
+Get the name matched by a rule matching a single name: anchored at both ends,
+without other metacharacters than escaped or bracketed dots.
+
+@return true if the rule matches a single name */
+static bool xb_regex_get_literal(
+    const char *regex,    /*!< in: regex */
+    std::string *literal) /*!< out: name matched by the rule */
+{
+  const size_t len = strlen(regex);
+  if (len < 2 || regex[0] != '^' || regex[len - 1] != '$') {
+    return (false);
+  }
+
+  literal->clear();
+  for (size_t i = 1; i < len - 1; ++i) {
+    const char c = regex[i];
+    if (strncmp(regex + i, "[.]", 3) == 0) {
+      literal->push_back('.');
+      i += 2;
+    } else if (c == '\\' && regex[i + 1] == '.') {
+      literal->push_back('.');
+      ++i;
+    } else if (isalnum(static_cast<unsigned char>(c)) || c == '_' ||
+               c == '#' || c == '@' || c == '-') {
+      literal->push_back(c);
+    } else {
+      return (false);
+    }
+  }
+  return (true);
+}
+
 static void xb_add_regex_to_list(
     const char *regex,         /*!< in: regex */
     const char *error_context, /*!< in: context to error message */
-    regex_list_t *list)        /*! in: list to put new regex to */
+    regex_rules_t *rules)      /*! in: rules to put new regex to */
 {
   xb_regex_t compiled_regex;
   if (!compile_regex(regex, error_context, &compiled_regex)) {
     exit(EXIT_FAILURE);
   }
 
-  list->push_back(compiled_regex);
+  std::string literal;
+  if (xb_regex_get_literal(regex, &literal)) {
+    xb_regfree(&compiled_regex);
+    rules->literals.insert(literal);
+    return;
+  }
+
+  /* back-references would refer to other rules once combined */
+  for (const char *p = strchr(regex, '\\'); p != NULL;
+       p = strchr(p + 2, '\\')) {
+    if (p[1] == '\0') {
+      break;
+    }
+    if (isdigit(static_cast<unsigned char>(p[1]))) {
+      rules->compiled.push_back(compiled_regex);
+      return;
+    }
+  }
+
+  xb_regfree(&compiled_regex);
+  rules->pending.push_back(regex);
+}
+
+/***********************************************************************
+Combine the pending rules into alternations of REGEX_RULES_PER_ALTERNATION
+rules. Rules are compiled one by one if an alternation fails to compile. */
+static void xb_regex_rules_compile(
+    const char *error_context, /*!< in: context to error message */
+    regex_rules_t *rules)      /*! in/out: rules */
+{
+  const auto &pending = rules->pending;
+  for (size_t i = 0; i < pending.size(); i += REGEX_RULES_PER_ALTERNATION) {
+    const size_t end =
+        std::min(pending.size(), i + REGEX_RULES_PER_ALTERNATION);
+
+    std::string alternation;
+    for (size_t j = i; j < end; ++j) {
+      if (j > i) {
+        alternation.push_back('|');
+      }
+      alternation.append("(").append(pending[j]).append(")");
+    }
+
+    xb_regex_t compiled_regex;
+    if (xb_regcomp(&compiled_regex, alternation.c_str(), REG_EXTENDED) == 0) {
+      rules->compiled.push_back(compiled_regex);
+      continue;
+    }
+
+    for (size_t j = i; j < end; ++j) {
+      if (!compile_regex(pending[j].c_str(), error_context, &compiled_regex)) {
+        exit(EXIT_FAILURE);
+      }
+      rules->compiled.push_back(compiled_regex);
+    }
+  }
+  rules->pending.clear();
 }
 
 /***********************************************************************
@@ -3775,6 +6891,9 @@ static void xb_filters_init() {
     xb_load_list_string(xtrabackup_tables_exclude, ",",
                         xb_register_exclude_regex);
   }
+
+  xb_regex_rules_compile("tables", &regex_include_list);
+  xb_regex_rules_compile("tables-exclude", &regex_exclude_list);
 }
 
 static void xb_filter_hash_free(hash_table_t *hash) {
@@ -3802,11 +6921,14 @@ static void xb_filter_hash_free(hash_table_t *hash) {
   ut::delete_(hash);
 }
 
-static void xb_regex_list_free(regex_list_t *list) {
+static void xb_regex_list_free(regex_rules_t *rules) {
+  regex_list_t *list = &rules->compiled;
   while (list->size() > 0) {
     xb_regfree(&list->front());
     list->pop_front();
   }
+  rules->literals.clear();
+  rules->pending.clear();
 }
 
 /************************************************************************
@@ -3815,6 +6937,8 @@ static void xb_filters_free() {
   xb_regex_list_free(&regex_include_list);
   xb_regex_list_free(&regex_exclude_list);
 
+  skip_table_cache.clear();
+
   if (tables_include_hash) {
     xb_filter_hash_free(tables_include_hash);
   }
@@ -3966,22 +7090,297 @@ static void cleanup_mysql_environment() {
   Srv_session::module_deinit();
   component_infrastructure_deinit();
 
-  mysql_mutex_destroy(&LOCK_status);
-  mysql_mutex_destroy(&LOCK_global_system_variables);
-  mysql_mutex_destroy(&LOCK_sql_rand);
-  mysql_mutex_destroy(&LOCK_keyring_operations);
-  mysql_mutex_destroy(&LOCK_replica_list);
+  mysql_mutex_destroy(&LOCK_status);
+  mysql_mutex_destroy(&LOCK_global_system_variables);
+  mysql_mutex_destroy(&LOCK_sql_rand);
+  mysql_mutex_destroy(&LOCK_keyring_operations);
+  mysql_mutex_destroy(&LOCK_replica_list);
+}
+
+/** Every copy thread keeps the buffers of one cursor with its read-ahead
+slots for the next cursor.
+@return bytes of datafile buffers of a copy thread */
+static size_t xb_cursor_buffers_size() {
+  return (
+      (opt_read_io_engine == READ_IO_ENGINE_SYNC ? 1 : 1 + opt_read_io_depth) *
+          std::max(opt_read_buffer_size, opt_read_buffer_max_size) +
+      3 * UNIV_PAGE_SIZE_MAX);
+}
+
+/** Run --backup --plan: find the datafiles the backup would copy and print
+the plan made from samples of them. */
+static void xtrabackup_backup_plan() {
+  Tablespace_map::instance().scan(mysql_connection);
+
+  dberr_t err = xb_load_tablespaces();
+  if (err != DB_SUCCESS) {
+    xb::error() << "xb_load_tablespaces() failed with error code " << err;
+    exit(EXIT_FAILURE);
+  }
+
+  auto it = datafiles_iter_new(nullptr);
+  std::vector<xb::plan::Datafile> files;
+  for (const fil_node_t *node : it->nodes) {
+    files.push_back({node->name, datafile_size(node),
+                     page_size_t(node->space->flags).physical()});
+  }
+  datafiles_iter_free(it);
+
+  if (!xb::plan::run(mysql_connection, files, xb_cursor_buffers_size())) {
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* connection the metrics thread reads the server LSN with */
+static MYSQL *metrics_connection = nullptr;
+
+/** Register the backup metrics and start writing them to --metrics-file.
+@param[in]  redo_mgr  redo log copy
+@param[in]  it        datafiles to copy
+@return false if the metrics file cannot be written */
+static bool xb_metrics_start(const Redo_Log_Data_Manager &redo_mgr,
+                             const datafiles_iter_t *it) {
+  using xb::metrics::Type;
+
+  metrics_connection = xb_mysql_connect();
+  if (metrics_connection == nullptr) {
+    return (false);
+  }
+
+  uint64_t datafiles_bytes = 0;
+  for (const auto node : it->nodes) {
+    datafiles_bytes += datafile_size(node);
+  }
+
+  xb::metrics::add("xtrabackup_datafiles_bytes",
+                   "Size of the InnoDB datafiles to copy.", Type::GAUGE,
+                   [datafiles_bytes] { return datafiles_bytes; });
+  xb::metrics::add("xtrabackup_read_bytes_total",
+                   "Bytes read from the datafiles and the other files.",
+                   Type::COUNTER,
+                   [] { return io_throttle_read.transferred(); });
+
+  /* throughput since the previous write of the file */
+  auto last_time = std::chrono::steady_clock::now();
+  uint64_t last_bytes = io_throttle_read.transferred();
+  xb::metrics::add("xtrabackup_read_bytes_per_second",
+                   "Read throughput over the last metrics interval.",
+                   Type::GAUGE, [last_time, last_bytes]() mutable {
+                     const auto now = std::chrono::steady_clock::now();
+                     const uint64_t bytes = io_throttle_read.transferred();
+                     const double sec =
+                         std::chrono::duration<double>(now - last_time)
+                             .count();
+                     const double rate =
+                         sec > 0 ? (bytes - last_bytes) / sec : 0;
+                     last_time = now;
+                     last_bytes = bytes;
+                     return rate;
+                   });
+
+  /* the server LSN is read once per write and shared with the lag */
+  static lsn_t server_lsn = 0;
+  xb::metrics::add(
+      "xtrabackup_server_lsn", "Current LSN of the server.", Type::GAUGE, [] {
+        MYSQL_RES *result = xb_mysql_query(
+            metrics_connection,
+            "SELECT COUNT FROM information_schema.INNODB_METRICS "
+            "WHERE NAME = 'log_lsn_current'",
+            true, false);
+        if (result != nullptr) {
+          MYSQL_ROW row = mysql_fetch_row(result);
+          if (row != nullptr && row[0] != nullptr) {
+            server_lsn = strtoull(row[0], nullptr, 10);
+          }
+          mysql_free_result(result);
+        }
+        return server_lsn;
+      });
+  xb::metrics::add("xtrabackup_redo_copied_lsn",
+                   "LSN up to which the redo log is copied.", Type::GAUGE,
+                   [&redo_mgr] { return redo_mgr.get_copied_lsn(); });
+  xb::metrics::add("xtrabackup_redo_lag_bytes",
+                   "Redo log written by the server and not copied yet.",
+                   Type::GAUGE, [&redo_mgr] {
+                     const lsn_t copied = redo_mgr.get_copied_lsn();
+                     return server_lsn > copied ? server_lsn - copied : 0;
+                   });
+
+  xb::metrics::add("xtrabackup_buffer_pool_bytes",
+                   "Memory held by the datafile read buffers.", Type::GAUGE,
+                   [] { return Io_buffer_pool::usage(); });
+  xb::metrics::add("xtrabackup_memory_bytes",
+                   "Memory of the backup buffers accounted against "
+                   "--max-memory.",
+                   Type::GAUGE, [] { return xb::memory::usage(); });
+  xb::metrics::add("xtrabackup_compress_chunks_in_flight",
+                   "Chunks queued for or being compressed by the "
+                   "compression threads.",
+                   Type::GAUGE,
+                   [] { return ds_compress_chunks_in_flight.load(); });
+  xb::metrics::add("xtrabackup_cloud_uploads_in_flight",
+                   "Chunk uploads to the object store not completed yet.",
+                   Type::GAUGE,
+                   [] { return ds_object_store_uploads_in_flight.load(); });
+  xb::metrics::add("xtrabackup_throttle_sleep_seconds_total",
+                   "Time the I/O threads slept to stay under --throttle and "
+                   "--throttle-rate.",
+                   Type::COUNTER, [] {
+                     return (io_throttling_usecs +
+                             io_throttle_read.slept_usecs() +
+                             io_throttle_write.slept_usecs()) /
+                            1000000.0;
+                   });
+
+  return (xb::metrics::start(opt_metrics_file, opt_metrics_interval));
+}
+
+/** Write the metrics a last time and close the metrics connection. */
+static void xb_metrics_stop() {
+  xb::metrics::stop();
+  if (metrics_connection != nullptr) {
+    mysql_close(metrics_connection);
+    metrics_connection = nullptr;
+  }
+}
+
+/* set by SIGTERM and SIGINT, --archive-redo stops then */
+static volatile sig_atomic_t archive_redo_stop_requested = 0;
+
+static void archive_redo_sigterm_handler(int sig __attribute__((unused))) {
+  archive_redo_stop_requested = 1;
+}
+
+/** Archive the redo log for --archive-redo until SIGTERM or SIGINT, then
+write the lsn range of the archive to xtrabackup_checkpoints.
+@param[in,out]  redo_mgr  started redo log copy
+@return false on error */
+static bool xtrabackup_archive_redo(Redo_Log_Data_Manager &redo_mgr) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = archive_redo_sigterm_handler;
+  sigaction(SIGTERM, &sa, nullptr);
+  sigaction(SIGINT, &sa, nullptr);
+
+  if (!xtrabackup_register_redo_log_consumer) {
+    xb::warn() << "The server does not support redo log consumers, it can "
+                  "overwrite the redo log before it is archived";
+  }
+
+  xb::info() << "Archiving the redo log from lsn "
+             << redo_mgr.get_start_checkpoint_lsn() << " in segments of "
+             << opt_archive_redo_segment_size
+             << " bytes until SIGTERM or SIGINT";
+
+  while (!archive_redo_stop_requested) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    if (redo_mgr.is_error()) {
+      xb::error() << "log copying failed.";
+      return (false);
+    }
+  }
+
+  if (!redo_mgr.stop_at(redo_mgr.get_copied_lsn(),
+                        redo_mgr.get_start_checkpoint_lsn())) {
+    return (false);
+  }
+
+  strcpy(metadata_type_str, "redo-archive");
+  metadata_from_lsn = redo_mgr.get_start_checkpoint_lsn();
+  metadata_to_lsn = redo_mgr.get_start_checkpoint_lsn();
+  metadata_last_lsn = redo_mgr.get_stop_lsn();
+
+  if (!xtrabackup_stream_metadata(ds_meta)) {
+    xb::error() << "failed to stream metadata.";
+    return (false);
+  }
+
+  xb::info() << "Redo log of lsn (" << redo_mgr.get_start_checkpoint_lsn()
+             << ") to (" << redo_mgr.get_stop_lsn() << ") was archived.";
+
+  return (true);
+}
+
+/** Copy the datafiles with the --parallel copy threads, from the snapshot of
+the storage if --snapshot-create-cmd is set.
+@param[in,out]  it        datafiles iterator, freed
+@param[in]      redo_mgr  redo log copy
+@return false on error */
+static bool xtrabackup_copy_datafiles(datafiles_iter_t *it,
+                                      Redo_Log_Data_Manager &redo_mgr) {
+  uint count;
+  ib_mutex_t count_mutex;
+  data_thread_ctxt_t *data_threads;
+  bool data_copying_error = false;
+
+  /* Create data copying threads */
+  data_threads = (data_thread_ctxt_t *)ut::malloc_withkey(
+      UT_NEW_THIS_FILE_PSI_KEY,
+      sizeof(data_thread_ctxt_t) * xtrabackup_parallel);
+  count = xtrabackup_parallel;
+  mutex_create(LATCH_ID_XTRA_COUNT_MUTEX, &count_mutex);
+
+  const auto copy_start = std::chrono::steady_clock::now();
+  xb::report::Phase copy_phase("copy_innodb");
+
+  for (uint i = 0; i < (uint)xtrabackup_parallel; i++) {
+    data_threads[i].it = it;
+    data_threads[i].num = i + 1;
+    data_threads[i].count = &count;
+    data_threads[i].count_mutex = &count_mutex;
+    data_threads[i].error = &data_copying_error;
+    os_thread_create(PFS_NOT_INSTRUMENTED, i, data_copy_thread_func,
+                     data_threads + i)
+        .start();
+  }
+
+  /* Wait for threads to exit */
+  while (1) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    mutex_enter(&count_mutex);
+    if (count == 0) {
+      mutex_exit(&count_mutex);
+      break;
+    }
+    if (redo_mgr.is_error()) {
+      xb::error() << "log copying failed.";
+      exit(EXIT_FAILURE);
+    }
+    mutex_exit(&count_mutex);
+  }
+
+  mutex_free(&count_mutex);
+  ut::free(data_threads);
+  datafiles_iter_free(it);
+
+  copy_phase.add_bytes(xb_fil_cur_read_direct + xb_fil_cur_read_dropped +
+                       xb_fil_cur_read_cached);
+  copy_phase.end();
+
+  xb::info() << "Datafile buffer pool peak usage: "
+             << Io_buffer_pool::peak_usage() << " bytes";
+
+  xb::info() << "Datafile reads: " << xb_fil_cur_read_direct
+             << " bytes with O_DIRECT, " << xb_fil_cur_read_dropped
+             << " bytes dropped from the page cache, "
+             << xb_fil_cur_read_cached << " bytes left in the page cache";
+
+  xb_numa_report(std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - copy_start)
+                     .count());
+
+  if (changed_page_tracking) {
+    pagetracking::deinit(changed_page_tracking);
+  }
+
+  return (!data_copying_error);
 }
 
 void xtrabackup_backup_func(void) {
   MY_STAT stat_info;
-  uint i;
-  uint count;
-  ib_mutex_t count_mutex;
-  data_thread_ctxt_t *data_threads;
 
   recv_is_making_a_backup = true;
-  bool data_copying_error = false;
   std::shared_ptr<xb::backup::dd_space_ids> xb_dd_spaces;
   init_mysql_environment();
 
@@ -4014,11 +7413,6 @@ void xtrabackup_backup_func(void) {
 
   srv_backup_mode = true;
 
-  if (opt_lock_ddl) {
-    xb_dd_spaces = xb::backup::build_space_id_set(mysql_connection);
-    ut_ad(xb_dd_spaces->size());
-  }
-
   /* We can safely close files if we don't allow DDL during the
   backup */
   srv_close_files = xb_close_files || opt_lock_ddl;
@@ -4133,6 +7527,16 @@ void xtrabackup_backup_func(void) {
   if (!validate_options("my", orig_argc, orig_argv)) {
     exit(EXIT_FAILURE);
   }
+
+  if (opt_backup_plan) {
+    xtrabackup_backup_plan();
+    return;
+  }
+
+  if (opt_trace_file != nullptr) {
+    xb::trace::start();
+  }
+
   /* create extra LSN dir if it does not exist. */
   if (xtrabackup_extra_lsndir &&
       !my_stat(xtrabackup_extra_lsndir, &stat_info, MYF(0)) &&
@@ -4146,6 +7550,78 @@ void xtrabackup_backup_func(void) {
     xtrabackup_target_dir = xtrabackup_fifo_dir;
   }
 
+  if (opt_stream_to != nullptr) {
+    std::string fd_list;
+    if (xtrabackup_stream_fds != nullptr) {
+      xb::error() << "Options --stream-to and --stream-fds can not be used "
+                     "together.";
+      exit(EXIT_FAILURE);
+    }
+    /* The connections are then used as --stream-fds */
+    for (uint i = 0; i < opt_stream_connections; i++) {
+      const File fd = net_connect(opt_stream_to, xtrabackup_fifo_timeout);
+      if (fd < 0) {
+        exit(EXIT_FAILURE);
+      }
+      fd_list += (i > 0 ? "," : "") + std::to_string(fd);
+    }
+    xb::info() << "Connected to " << opt_stream_to << " with "
+               << opt_stream_connections << " connection(s)";
+    xtrabackup_stream_fds =
+        my_strdup(PSI_NOT_INSTRUMENTED, fd_list.c_str(), MYF(MY_FAE));
+  }
+
+  if (xtrabackup_stream_fds != nullptr) {
+    std::vector<File> fds;
+    if (xtrabackup_fifo_streams_set || opt_cloud_put != nullptr) {
+      xb::error() << "Option --stream-fds can not be used with --fifo-streams "
+                     "or --cloud-put.";
+      exit(EXIT_FAILURE);
+    }
+    if (!parse_fd_list(xtrabackup_stream_fds, &fds)) {
+      exit(EXIT_FAILURE);
+    }
+    xtrabackup_fifo_streams = fds.size();
+    if (!xtrabackup_stream) {
+      xb::info() << "Option --stream-fds requires xbstream format. Setting "
+                    "--stream to xbstream.";
+      xtrabackup_stream_fmt = XB_STREAM_FMT_XBSTREAM;
+      xtrabackup_stream = true;
+    }
+    if (xtrabackup_fifo_streams > xtrabackup_parallel) {
+      xb::info() << "Option --stream-fds has more descriptors than "
+                    "--parallel. Adjusting --parallel to "
+                 << xtrabackup_fifo_streams;
+      xtrabackup_parallel = xtrabackup_fifo_streams;
+    }
+  }
+
+  if (opt_cloud_put != nullptr && xtrabackup_fifo_streams_set) {
+    xb::error() << "Options --cloud-put and --fifo-streams cannot be used "
+                   "together.";
+    exit(EXIT_FAILURE);
+  }
+
+  if (opt_cloud_put != nullptr && !xtrabackup_stream) {
+    xb::info() << "Option --cloud-put requires xbstream format. Setting "
+                  "--stream to xbstream.";
+    xtrabackup_stream_fmt = XB_STREAM_FMT_XBSTREAM;
+    xtrabackup_stream = true;
+  }
+
+  if (opt_tee_target_dir != nullptr && !xtrabackup_stream) {
+    xb::info() << "Option --tee-target-dir requires xbstream format. Setting "
+                  "--stream to xbstream.";
+    xtrabackup_stream_fmt = XB_STREAM_FMT_XBSTREAM;
+    xtrabackup_stream = true;
+  }
+
+  if (opt_compress_policy_file != nullptr &&
+      xtrabackup_compress == XTRABACKUP_COMPRESS_NONE) {
+    xb::error() << "Option --compress-policy-file requires --compress.";
+    exit(EXIT_FAILURE);
+  }
+
   if (xtrabackup_fifo_streams_set && !xtrabackup_stream) {
     xb::info() << "Option --fifo-streams require xbstream format. Setting "
                   "--stream to xbstream.";
@@ -4169,7 +7645,10 @@ void xtrabackup_backup_func(void) {
     exit(EXIT_FAILURE);
   }
 
+  xb_numa_init();
+
   xtrabackup_init_datasinks();
+  xb_index_load_init();
 
   if (!select_history()) {
     exit(EXIT_FAILURE);
@@ -4177,14 +7656,57 @@ void xtrabackup_backup_func(void) {
 
   io_ticket = xtrabackup_throttle;
   wait_throttle = os_event_create();
+  if (opt_throttle_group != nullptr &&
+      !io_throttle_join_group(opt_throttle_group)) {
+    exit(EXIT_FAILURE);
+  }
+  io_throttle_read.set_rate(opt_throttle_rate);
+  io_throttle_write.set_rate(opt_throttle_rate);
   os_thread_create(PFS_NOT_INSTRUMENTED, 0, io_watching_thread).start();
 
   if (!redo_mgr.start()) {
     exit(EXIT_FAILURE);
   }
+  backup_start_checkpoint_lsn = redo_mgr.get_start_checkpoint_lsn();
+
+  if (opt_archive_redo) {
+    if (!xtrabackup_archive_redo(redo_mgr)) {
+      exit(EXIT_FAILURE);
+    }
+    io_watching_thread_stop = true;
+    xtrabackup_destroy_datasinks();
+    while (io_watching_thread_running) {
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    return;
+  }
+
+  xb::report::Phase scan_phase("tablespace_scan");
+
+  /* the dictionary space ids and the tablespace map come from independent
+  catalog queries, run them at the same time on separate connections */
+  MYSQL *dd_spaces_connection = nullptr;
+  std::thread dd_spaces_thread;
+  if (opt_lock_ddl) {
+    dd_spaces_connection = xb_mysql_connect();
+    if (dd_spaces_connection == nullptr) {
+      exit(EXIT_FAILURE);
+    }
+    dd_spaces_thread = std::thread([dd_spaces_connection, &xb_dd_spaces] {
+      my_thread_init();
+      xb_dd_spaces = xb::backup::build_space_id_set(dd_spaces_connection);
+      my_thread_end();
+    });
+  }
 
   Tablespace_map::instance().scan(mysql_connection);
 
+  if (dd_spaces_thread.joinable()) {
+    dd_spaces_thread.join();
+    mysql_close(dd_spaces_connection);
+    ut_ad(xb_dd_spaces->size());
+  }
+
   /* Populate fil_system with tablespaces to copy */
   dberr_t err = xb_load_tablespaces();
   if (err != DB_SUCCESS) {
@@ -4192,6 +7714,8 @@ void xtrabackup_backup_func(void) {
     exit(EXIT_FAILURE);
   }
 
+  scan_phase.end();
+
   debug_sync_point("xtrabackup_suspend_at_start");
 
   lsn_t page_tracking_start_lsn = 0;
@@ -4206,9 +7730,13 @@ void xtrabackup_backup_func(void) {
     if (!xtrabackup_incremental_force_scan && opt_page_tracking) {
       changed_page_tracking = pagetracking::init(
           redo_mgr.get_start_checkpoint_lsn(), mysql_connection);
+    } else {
+      changed_page_tracking = redo_mgr.take_changed_pages();
     }
 
-    if (changed_page_tracking) {
+    if (changed_page_tracking && !opt_page_tracking) {
+      xb::info() << "Using the redo log changed pages for incremental backup";
+    } else if (changed_page_tracking) {
       xb::info() << "Using pagetracking feature for incremental backup";
     } else {
       xb::info() << "using the full scan for incremental backup";
@@ -4228,49 +7756,52 @@ void xtrabackup_backup_func(void) {
     exit(EXIT_FAILURE);
   }
 
-  /* Create data copying threads */
-  data_threads = (data_thread_ctxt_t *)ut::malloc_withkey(
-      UT_NEW_THIS_FILE_PSI_KEY,
-      sizeof(data_thread_ctxt_t) * xtrabackup_parallel);
-  count = xtrabackup_parallel;
-  mutex_create(LATCH_ID_XTRA_COUNT_MUTEX, &count_mutex);
+  if (opt_datafile_copy_order == DATAFILE_COPY_ORDER_LARGEST_FIRST) {
+    datafiles_iter_sort_largest_first(it, xtrabackup_parallel);
+  } else if (opt_datafile_copy_order == DATAFILE_COPY_ORDER_TABLE) {
+    datafiles_iter_group_partitions(it);
+  }
 
-  for (i = 0; i < (uint)xtrabackup_parallel; i++) {
-    data_threads[i].it = it;
-    data_threads[i].num = i + 1;
-    data_threads[i].count = &count;
-    data_threads[i].count_mutex = &count_mutex;
-    data_threads[i].error = &data_copying_error;
-    os_thread_create(PFS_NOT_INSTRUMENTED, i, data_copy_thread_func,
-                     data_threads + i)
-        .start();
+  if (opt_metrics_file != nullptr && !xb_metrics_start(redo_mgr, it)) {
+    xb::error() << "failed to start writing the metrics to "
+                << opt_metrics_file;
+    exit(EXIT_FAILURE);
   }
 
-  /* Wait for threads to exit */
-  while (1) {
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-    mutex_enter(&count_mutex);
-    if (count == 0) {
-      mutex_exit(&count_mutex);
-      break;
-    }
-    if (redo_mgr.is_error()) {
-      xb::error() << "log copying failed.";
-      exit(EXIT_FAILURE);
-    }
-    mutex_exit(&count_mutex);
+  if (opt_parallel_per_device > 0) {
+    datafiles_iter_group_by_device(it);
   }
 
-  mutex_free(&count_mutex);
-  ut::free(data_threads);
-  datafiles_iter_free(it);
+  if (xtrabackup_compress == XTRABACKUP_COMPRESS_ZSTD &&
+      opt_compress_zstd_dict_size > 0) {
+    xb_zstd_dict_init(it);
+  }
 
-  if (data_copying_error) {
-    exit(EXIT_FAILURE);
+  const size_t cursor_buffers = xb_cursor_buffers_size();
+  Io_buffer_pool::set_cache_limit(cursor_buffers);
+  copy_thread_memory = cursor_buffers;
+  xb::memory::set_limit(opt_max_memory);
+  if (opt_max_memory > 0 &&
+      opt_max_memory < xb::memory::usage() + cursor_buffers) {
+    xb::warn() << "--max-memory " << opt_max_memory
+               << " is lower than the memory of one copy thread: "
+               << cursor_buffers << " bytes of datafile buffers and "
+               << xb::memory::usage()
+               << " bytes used by the rest of the backup";
   }
+  xb::info() << "Datafile buffer pool: up to " << cursor_buffers
+             << " bytes cached by each of " << xtrabackup_parallel
+             << " copy threads";
 
-  if (changed_page_tracking) {
-    pagetracking::deinit(changed_page_tracking);
+  if (opt_adaptive_throttle) {
+    start_adaptive_throttle();
+  }
+
+  /* with a snapshot of the storage the datafiles are copied from the snapshot
+  once the backup lock is released */
+  if (opt_snapshot_create_cmd == nullptr &&
+      !xtrabackup_copy_datafiles(it, redo_mgr)) {
+    exit(EXIT_FAILURE);
   }
 
   Backup_context backup_ctxt;
@@ -4291,18 +7822,40 @@ void xtrabackup_backup_func(void) {
     exit(EXIT_FAILURE);
   }
 
-  if (!redo_mgr.stop_at(log_status.lsn, log_status.lsn_checkpoint)) {
-    xb::error() << "Error stopping copy thread at LSN " << log_status.lsn;
+  lsn_t stop_lsn = log_status.lsn;
+
+  if (xtrabackup_stop_at_lsn != 0) {
+    if (xtrabackup_stop_at_lsn < log_status.lsn) {
+      xb::error() << "--stop-at-lsn " << xtrabackup_stop_at_lsn
+                  << " is lower than the LSN " << log_status.lsn
+                  << " the datafiles are consistent at.";
+      exit(EXIT_FAILURE);
+    }
+    stop_lsn = xtrabackup_stop_at_lsn;
+    xb::info() << "Waiting for the redo log to reach LSN " << stop_lsn;
+  }
+
+  xb::report::Phase redo_phase("redo_catchup");
+  if (!redo_mgr.stop_at(stop_lsn, log_status.lsn_checkpoint)) {
+    xb::error() << "Error stopping copy thread at LSN " << stop_lsn;
     exit(EXIT_FAILURE);
   }
+  redo_phase.end();
 
   io_watching_thread_stop = true;
+  if (opt_adaptive_throttle) {
+    stop_adaptive_throttle();
+  }
+  io_throttle_read.set_rate(0);
+  io_throttle_write.set_rate(0);
 
   /* smart memory estimation */
   if (xtrabackup_estimate_memory) {
     auto redo_memory_requirements = xtrabackup::recv_backup_heap_used();
     redo_memory = redo_memory_requirements.first;
     redo_frames = redo_memory_requirements.second;
+    xb::info() << "Memory used to estimate the memory of --prepare: "
+               << xtrabackup::recv_backup_estimate_size() << " bytes";
   }
 
   if (!validate_missing_encryption_tablespaces()) {
@@ -4318,15 +7871,28 @@ void xtrabackup_backup_func(void) {
   }
   metadata_to_lsn = redo_mgr.get_last_checkpoint_lsn();
   metadata_last_lsn = redo_mgr.get_stop_lsn();
+  metadata_reencrypted = opt_reencrypt_tablespaces;
 
   if (!xtrabackup_stream_metadata(ds_meta)) {
     xb::error() << "failed to stream metadata.";
     exit(EXIT_FAILURE);
   }
 
+  xb::report::Phase finish_phase("finish");
   if (!backup_finish(backup_ctxt)) {
     exit(EXIT_FAILURE);
   }
+  finish_phase.end();
+
+  if (opt_snapshot_create_cmd != nullptr) {
+    xb::info() << "Copying the datafiles from the storage snapshot in "
+               << opt_snapshot_dir;
+    const bool copied = xtrabackup_copy_datafiles(it, redo_mgr);
+    if (!xb_snapshot_remove() || !copied ||
+        !validate_missing_encryption_tablespaces()) {
+      exit(EXIT_FAILURE);
+    }
+  }
 
   if (xtrabackup_extra_lsndir) {
     char filename[FN_REFLEN];
@@ -4351,6 +7917,10 @@ void xtrabackup_backup_func(void) {
 
   Tablespace_map::instance().serialize(ds_data);
 
+  if (opt_restore_order && !xb_write_restore_order()) {
+    exit(EXIT_FAILURE);
+  }
+
   if (opt_transition_key != NULL || opt_generate_transition_key) {
     if (!xb_tablespace_keys_dump(
             ds_data, opt_transition_key,
@@ -4360,6 +7930,27 @@ void xtrabackup_backup_func(void) {
     }
   }
 
+  xb::report::add_stage("read", 0,
+                        xb_fil_cur_read_direct + xb_fil_cur_read_dropped +
+                            xb_fil_cur_read_cached,
+                        xb_fil_cur_read_usecs);
+  xb::wait_state::dump();
+  xb::memory::report();
+  xb_metrics_stop();
+  if (opt_trace_file != nullptr && !xb::trace::write(opt_trace_file)) {
+    exit(EXIT_FAILURE);
+  }
+  if (!xb::report::write(ds_meta, XTRABACKUP_REPORT)) {
+    xb::error() << "failed to write " << XTRABACKUP_REPORT;
+    exit(EXIT_FAILURE);
+  }
+
+  /* last, so that all the other files are in it */
+  if (ds_file_checksums != nullptr &&
+      !xb_write_file_checksums(ds_checksum_entries(ds_file_checksums))) {
+    exit(EXIT_FAILURE);
+  }
+
   xtrabackup_destroy_datasinks();
 
   if (wait_throttle) {
@@ -4407,7 +7998,179 @@ void xtrabackup_backup_func(void) {
 }
 
 /* ================= stats ================= */
-static bool xtrabackup_stats_level(dict_index_t *index, ulint level) {
+
+/* Statistics of a table computed by a worker of stats_pool, printed in the
+order of the data dictionary once done */
+struct xb_stats_task_t {
+  dict_table_t *table;
+  MDL_ticket *mdl;
+  std::string out;
+  std::future<void> done;
+};
+
+/* Workers computing the statistics of the tables with --parallel, nullptr
+when the statistics are computed by the calling thread */
+static Thread_pool *stats_pool = nullptr;
+
+/* Tables opened for stats_pool, oldest first */
+static std::deque<std::unique_ptr<xb_stats_task_t>> stats_tasks;
+
+/** Append formatted text to the statistics of a table. */
+static void xb_stats_printf(std::string &out, const char *fmt, ...)
+    MY_ATTRIBUTE((format(printf, 2, 3)));
+
+static void xb_stats_printf(std::string &out, const char *fmt, ...) {
+  char buf[1024];
+  va_list args;
+
+  va_start(args, fmt);
+  const int len = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+
+  if (len > 0) {
+    out.append(buf, std::min<size_t>(len, sizeof(buf) - 1));
+  }
+}
+
+/** Count the external pages of the BLOBs of the records of a leaf page. */
+static void xtrabackup_stats_leaf(dict_index_t *index, buf_block_t *block,
+                                  const page_size_t &page_size,
+                                  ulonglong *n_pages_extern,
+                                  ulonglong *sum_data_extern) {
+  page_cur_t cur;
+  ulint n_fields;
+  ulint i;
+  mem_heap_t *local_heap = NULL;
+  ulint offsets_[REC_OFFS_NORMAL_SIZE];
+  ulint *local_offsets = offsets_;
+
+  *offsets_ = (sizeof offsets_) / sizeof *offsets_;
+
+  page_cur_set_before_first(block, &cur);
+  page_cur_move_to_next(&cur);
+
+  for (;;) {
+    if (page_cur_is_after_last(&cur)) {
+      break;
+    }
+
+    local_offsets =
+        rec_get_offsets(cur.rec, index, local_offsets, ULINT_UNDEFINED,
+                        UT_LOCATION_HERE, &local_heap);
+    n_fields = rec_offs_n_fields(local_offsets);
+
+    for (i = 0; i < n_fields; i++) {
+      if (rec_offs_nth_extern(nullptr, local_offsets, i)) {
+        page_t *local_page;
+        ulint space_id;
+        ulint page_no;
+        ulint offset;
+        byte *blob_header;
+        ulint part_len;
+        mtr_t local_mtr;
+        ulint local_len;
+        byte *data;
+        buf_block_t *local_block;
+
+        data =
+
+            rec_get_nth_field(nullptr, cur.rec, local_offsets, i, &local_len);
+
+        ut_a(local_len >= BTR_EXTERN_FIELD_REF_SIZE);
+        local_len -= BTR_EXTERN_FIELD_REF_SIZE;
+
+        space_id =
+            mach_read_from_4(data + local_len + lob::BTR_EXTERN_SPACE_ID);
+        page_no = mach_read_from_4(data + local_len + lob::BTR_EXTERN_PAGE_NO);
+        offset = mach_read_from_4(data + local_len + lob::BTR_EXTERN_OFFSET);
+
+        if (offset == 1) {
+          // see lob0impl.cc::insert
+          part_len =
+              mach_read_from_4(data + local_len + lob::BTR_EXTERN_LEN + 4);
+          *sum_data_extern += part_len;
+          continue;
+        }
+
+        for (;;) {
+          mtr_start(&local_mtr);
+
+          local_block =
+              btr_block_get(page_id_t(space_id, page_no), page_size,
+                            RW_S_LATCH, UT_LOCATION_HERE, index, &local_mtr);
+          local_page = buf_block_get_frame(local_block);
+          blob_header = local_page + offset;
+#define BTR_BLOB_HDR_PART_LEN 0
+#define BTR_BLOB_HDR_NEXT_PAGE_NO 4
+          // part_len = btr_blob_get_part_len(blob_header);
+          part_len = mach_read_from_4(blob_header + BTR_BLOB_HDR_PART_LEN);
+
+          // page_no = btr_blob_get_next_page_no(blob_header);
+          page_no = mach_read_from_4(blob_header + BTR_BLOB_HDR_NEXT_PAGE_NO);
+
+          offset = FIL_PAGE_DATA;
+
+          /*=================================*/
+          // fprintf(stdout, "[%lu] ", (ulint) buf_frame_get_page_no(page));
+
+          (*n_pages_extern)++;
+          *sum_data_extern += part_len;
+
+          mtr_commit(&local_mtr);
+
+          if (page_no == FIL_NULL) break;
+        }
+      }
+    }
+
+    page_cur_move_to_next(&cur);
+  }
+
+  if (local_heap != NULL) {
+    mem_heap_free(local_heap);
+  }
+}
+
+/** Gather the statistics of the leaf level from opt_stats_sample_pages leaf
+pages picked at random, as the persistent statistics of InnoDB are sampled.
+@return number of pages sampled, 0 if the index is unavailable */
+static ulint xtrabackup_stats_sample(dict_index_t *index,
+                                     const page_size_t &page_size,
+                                     ulonglong *sum_data, ulonglong *n_recs,
+                                     ulonglong *n_pages_extern,
+                                     ulonglong *sum_data_extern) {
+  ulint n_sampled = 0;
+
+  for (ulint i = 0; i < opt_stats_sample_pages; i++) {
+    mtr_t mtr;
+    btr_cur_t cursor;
+
+    mtr_start(&mtr);
+
+    if (!btr_cur_open_at_rnd_pos(index, BTR_SEARCH_LEAF, &cursor, __FILE__,
+                                 __LINE__, &mtr)) {
+      mtr_commit(&mtr);
+      break;
+    }
+
+    buf_block_t *block = btr_cur_get_block(&cursor);
+    const page_t *page = buf_block_get_frame(block);
+
+    n_sampled++;
+    *sum_data += page_get_data_size(page);
+    *n_recs += page_get_n_recs(page);
+
+    xtrabackup_stats_leaf(index, block, page_size, n_pages_extern,
+                          sum_data_extern);
+
+    mtr_commit(&mtr);
+  }
+
+  return (n_sampled);
+}
+
+static bool xtrabackup_stats_level(dict_index_t *index, ulint level,
+                                   std::string &out) {
   ulint space;
   page_t *page;
 
@@ -4425,6 +8188,7 @@ static bool xtrabackup_stats_level(dict_index_t *index, ulint level) {
   ulonglong n_pages, n_pages_extern;
   ulonglong sum_data, sum_data_extern;
   ulonglong n_recs;
+  ulint n_sampled = 0;
   buf_block_t *block;
   page_size_t page_size(0, 0, false);
   bool found;
@@ -4433,9 +8197,32 @@ static bool xtrabackup_stats_level(dict_index_t *index, ulint level) {
   n_pages_extern = sum_data_extern = 0;
 
   if (level == 0)
-    fprintf(stdout, "        leaf pages: ");
+    xb_stats_printf(out, "        leaf pages: ");
   else
-    fprintf(stdout, "     level %lu pages: ", level);
+    xb_stats_printf(out, "     level %lu pages: ", level);
+
+  if (level == 0 && opt_stats_sample_pages > 0 &&
+      index->stat_n_leaf_pages > opt_stats_sample_pages) {
+    page_size.copy_from(fil_space_get_page_size(index->space, &found));
+    ut_a(found);
+
+    n_sampled = xtrabackup_stats_sample(index, page_size, &sum_data, &n_recs,
+                                        &n_pages_extern, &sum_data_extern);
+  }
+
+  if (n_sampled > 0) {
+    /* extrapolate the sample to the leaf pages of the index */
+    const double scale =
+        static_cast<double>(index->stat_n_leaf_pages) / n_sampled;
+
+    n_pages = index->stat_n_leaf_pages;
+    sum_data = static_cast<ulonglong>(sum_data * scale);
+    n_recs = static_cast<ulonglong>(n_recs * scale);
+    n_pages_extern = static_cast<ulonglong>(n_pages_extern * scale);
+    sum_data_extern = static_cast<ulonglong>(sum_data_extern * scale);
+
+    goto print;
+  }
 
   mtr_start(&mtr);
 
@@ -4475,185 +8262,148 @@ loop:
   n_recs += page_get_n_recs(page);
 
   if (level == 0) {
-    page_cur_t cur;
-    ulint n_fields;
-    ulint i;
-    mem_heap_t *local_heap = NULL;
-    ulint offsets_[REC_OFFS_NORMAL_SIZE];
-    ulint *local_offsets = offsets_;
-
-    *offsets_ = (sizeof offsets_) / sizeof *offsets_;
-
-    page_cur_set_before_first(block, &cur);
-    page_cur_move_to_next(&cur);
-
-    for (;;) {
-      if (page_cur_is_after_last(&cur)) {
-        break;
-      }
-
-      local_offsets =
-          rec_get_offsets(cur.rec, index, local_offsets, ULINT_UNDEFINED,
-                          UT_LOCATION_HERE, &local_heap);
-      n_fields = rec_offs_n_fields(local_offsets);
-
-      for (i = 0; i < n_fields; i++) {
-        if (rec_offs_nth_extern(nullptr, local_offsets, i)) {
-          page_t *local_page;
-          ulint space_id;
-          ulint page_no;
-          ulint offset;
-          byte *blob_header;
-          ulint part_len;
-          mtr_t local_mtr;
-          ulint local_len;
-          byte *data;
-          buf_block_t *local_block;
-
-          data =
-
-              rec_get_nth_field(nullptr, cur.rec, local_offsets, i, &local_len);
-
-          ut_a(local_len >= BTR_EXTERN_FIELD_REF_SIZE);
-          local_len -= BTR_EXTERN_FIELD_REF_SIZE;
-
-          space_id =
-              mach_read_from_4(data + local_len + lob::BTR_EXTERN_SPACE_ID);
-          page_no =
-              mach_read_from_4(data + local_len + lob::BTR_EXTERN_PAGE_NO);
-          offset = mach_read_from_4(data + local_len + lob::BTR_EXTERN_OFFSET);
-
-          if (offset == 1) {
-            // see lob0impl.cc::insert
-            part_len =
-                mach_read_from_4(data + local_len + lob::BTR_EXTERN_LEN + 4);
-            sum_data_extern += part_len;
-            continue;
-          }
-
-          for (;;) {
-            mtr_start(&local_mtr);
-
-            local_block =
-                btr_block_get(page_id_t(space_id, page_no), page_size,
-                              RW_S_LATCH, UT_LOCATION_HERE, index, &local_mtr);
-            local_page = buf_block_get_frame(local_block);
-            blob_header = local_page + offset;
-#define BTR_BLOB_HDR_PART_LEN 0
-#define BTR_BLOB_HDR_NEXT_PAGE_NO 4
-            // part_len = btr_blob_get_part_len(blob_header);
-            part_len = mach_read_from_4(blob_header + BTR_BLOB_HDR_PART_LEN);
-
-            // page_no = btr_blob_get_next_page_no(blob_header);
-            page_no = mach_read_from_4(blob_header + BTR_BLOB_HDR_NEXT_PAGE_NO);
-
-            offset = FIL_PAGE_DATA;
-
-            /*=================================*/
-            // fprintf(stdout, "[%lu] ", (ulint) buf_frame_get_page_no(page));
-
-            n_pages_extern++;
-            sum_data_extern += part_len;
-
-            mtr_commit(&local_mtr);
-
-            if (page_no == FIL_NULL) break;
-          }
-        }
-      }
-
-      page_cur_move_to_next(&cur);
-    }
+    xtrabackup_stats_leaf(index, block, page_size, &n_pages_extern,
+                          &sum_data_extern);
   }
 
   mtr_commit(&mtr);
   if (right_page_no != FIL_NULL) {
     mtr_start(&mtr);
-    block = btr_block_get(page_id_t(space, dict_index_get_page(index)),
-                          page_size, RW_X_LATCH, UT_LOCATION_HERE, index, &mtr);
+    block = btr_block_get(page_id_t(space, right_page_no), page_size,
+                          RW_X_LATCH, UT_LOCATION_HERE, index, &mtr);
     page = buf_block_get_frame(block);
     goto loop;
   }
+
+print:
   mem_heap_free(heap);
 
-  if (level == 0) fprintf(stdout, "recs=%llu, ", n_recs);
+  if (level == 0) xb_stats_printf(out, "recs=%llu, ", n_recs);
 
-  fprintf(stdout, "pages=%llu, data=%llu bytes, data/pages=%lld%%", n_pages,
-          sum_data, ((sum_data * 100) / page_size.physical()) / n_pages);
+  xb_stats_printf(out, "pages=%llu, data=%llu bytes, data/pages=%lld%%",
+                  n_pages, sum_data,
+                  ((sum_data * 100) / page_size.physical()) / n_pages);
+
+  if (n_sampled > 0) {
+    xb_stats_printf(out, " (estimated from %lu sampled pages)", n_sampled);
+  }
 
   if (level == 0 && n_pages_extern) {
-    putc('\n', stdout);
+    out.push_back('\n');
     /* also scan blob pages*/
-    fprintf(stdout, "    external pages: ");
+    xb_stats_printf(out, "    external pages: ");
 
-    fprintf(stdout, "pages=%llu, data=%llu bytes, data/pages=%lld%%",
-            n_pages_extern, sum_data_extern,
-            ((sum_data_extern * 100) / page_size.physical()) / n_pages_extern);
+    xb_stats_printf(
+        out, "pages=%llu, data=%llu bytes, data/pages=%lld%%", n_pages_extern,
+        sum_data_extern,
+        ((sum_data_extern * 100) / page_size.physical()) / n_pages_extern);
   }
 
-  putc('\n', stdout);
+  out.push_back('\n');
 
   if (level > 0) {
-    xtrabackup_stats_level(index, level - 1);
+    xtrabackup_stats_level(index, level - 1, out);
   }
 
   return (true);
 }
 
-static void stat_with_rec(dict_table_t *table, THD *thd,
-                          MDL_ticket *mdl_on_tab) {
-  mutex_exit(&(dict_sys->mutex));
-  if (table != nullptr) {
-    if (!check_if_skip_table(table->name.m_name)) {
-      dict_index_t *index;
-      if (table->first_index()) {
-        dict_stats_update_transient(table);
-      }
+/** Gather the statistics of the indexes of a table.
+@param[in]      table   table
+@param[out]     out     text of the statistics */
+static void xtrabackup_stats_table(dict_table_t *table, std::string &out) {
+  dict_index_t *index;
+  if (table->first_index()) {
+    dict_stats_update_transient(table);
+  }
 
-      index = UT_LIST_GET_FIRST(table->indexes);
-      while (index != NULL) {
-        uint64_t n_vals;
-        bool found;
+  index = UT_LIST_GET_FIRST(table->indexes);
+  while (index != NULL) {
+    uint64_t n_vals;
+    bool found;
 
-        if (index->n_user_defined_cols > 0) {
-          n_vals = index->stat_n_diff_key_vals[index->n_user_defined_cols];
-        } else {
-          n_vals = index->stat_n_diff_key_vals[1];
-        }
+    if (index->n_user_defined_cols > 0) {
+      n_vals = index->stat_n_diff_key_vals[index->n_user_defined_cols];
+    } else {
+      n_vals = index->stat_n_diff_key_vals[1];
+    }
 
-        fprintf(
-            stdout,
-            "	table: %s, index: %s, space id: %lu, root page: %lu"
-            ", zip size: %lu"
-            "\n	estimated statistics in dictionary:\n"
-            "		key vals: %lu, leaf pages: %lu, size pages: %lu\n"
-            "	real statistics:\n",
-            table->name.m_name, index->name(), (ulong)index->space,
-            (ulong)index->page,
-            (ulong)fil_space_get_page_size(index->space, &found).physical(),
-            (ulong)n_vals, (ulong)index->stat_n_leaf_pages,
-            (ulong)index->stat_index_size);
-
-        {
-          mtr_t local_mtr;
-          page_t *root;
-          ulint page_level;
+    xb_stats_printf(
+        out,
+        "	table: %s, index: %s, space id: %lu, root page: %lu"
+        ", zip size: %lu"
+        "\n	estimated statistics in dictionary:\n"
+        "		key vals: %lu, leaf pages: %lu, size pages: %lu\n"
+        "	real statistics:\n",
+        table->name.m_name, index->name(), (ulong)index->space,
+        (ulong)index->page,
+        (ulong)fil_space_get_page_size(index->space, &found).physical(),
+        (ulong)n_vals, (ulong)index->stat_n_leaf_pages,
+        (ulong)index->stat_index_size);
 
-          mtr_start(&local_mtr);
+    {
+      mtr_t local_mtr;
+      page_t *root;
+      ulint page_level;
+
+      mtr_start(&local_mtr);
+
+      mtr_x_lock(&(index->lock), &local_mtr, UT_LOCATION_HERE);
+
+      root = btr_root_get(index, &local_mtr);
+      page_level = btr_page_get_level(root);
+
+      xtrabackup_stats_level(index, page_level, out);
+
+      mtr_commit(&local_mtr);
+    }
+
+    out.push_back('\n');
+    index = UT_LIST_GET_NEXT(indexes, index);
+  }
+}
 
-          mtr_x_lock(&(index->lock), &local_mtr, UT_LOCATION_HERE);
+/** Print the statistics of the tables computed by stats_pool and close the
+tables, oldest first. The caller owns the dictionary mutex.
+@param[in]      thd     thread that opened the tables
+@param[in]      keep    number of tables that may stay in progress */
+static void xtrabackup_stats_drain(THD *thd, size_t keep) {
+  while (stats_tasks.size() > keep) {
+    std::unique_ptr<xb_stats_task_t> task = std::move(stats_tasks.front());
+    stats_tasks.pop_front();
 
-          root = btr_root_get(index, &local_mtr);
-          page_level = btr_page_get_level(root);
+    mutex_exit(&(dict_sys->mutex));
+    task->done.get();
+    fputs(task->out.c_str(), stdout);
+    mutex_enter(&(dict_sys->mutex));
 
-          xtrabackup_stats_level(index, page_level);
+    dd_table_close(task->table, thd, &task->mdl, true);
+  }
+}
 
-          mtr_commit(&local_mtr);
-        }
+static void stat_with_rec(dict_table_t *table, THD *thd,
+                          MDL_ticket *mdl_on_tab) {
+  if (table != nullptr && stats_pool != nullptr &&
+      !check_if_skip_table(table->name.m_name)) {
+    /* the dictionary mutex is released while waiting for a worker only */
+    auto task = std::make_unique<xb_stats_task_t>();
+    xb_stats_task_t *t = task.get();
+    t->table = table;
+    t->mdl = mdl_on_tab;
+    t->done = stats_pool->add_task(
+        [t](size_t) { xtrabackup_stats_table(t->table, t->out); });
+    stats_tasks.push_back(std::move(task));
+
+    xtrabackup_stats_drain(thd, 2 * xtrabackup_parallel);
+    return;
+  }
 
-        putc('\n', stdout);
-        index = UT_LIST_GET_NEXT(indexes, index);
-      }
+  mutex_exit(&(dict_sys->mutex));
+  if (table != nullptr && stats_pool == nullptr) {
+    if (!check_if_skip_table(table->name.m_name)) {
+      std::string out;
+      xtrabackup_stats_table(table, out);
+      fputs(out.c_str(), stdout);
     }
   }
   mutex_enter(&(dict_sys->mutex));
@@ -4736,6 +8486,10 @@ static void xtrabackup_stats_func(int argc, char **argv) {
 
   xb_filters_init();
 
+  if (xtrabackup_parallel > 1) {
+    stats_pool = new Thread_pool(xtrabackup_parallel, [] { my_thread_init(); });
+  }
+
   fprintf(stdout, "\n\n<INDEX STATISTICS>\n");
 
   /* gather stats */
@@ -4771,6 +8525,7 @@ static void xtrabackup_stats_func(int argc, char **argv) {
     }
 
     mtr_commit(&mtr);
+    xtrabackup_stats_drain(thd, 0);
     dd_table_close(sys_tables, thd, &mdl, true);
     mem_heap_empty(heap);
 
@@ -4794,6 +8549,7 @@ static void xtrabackup_stats_func(int argc, char **argv) {
     }
 
     mtr_commit(&mtr);
+    xtrabackup_stats_drain(thd, 0);
     dd_table_close(sys_tables, thd, &mdl, true);
     mem_heap_free(heap);
 
@@ -4801,6 +8557,9 @@ static void xtrabackup_stats_func(int argc, char **argv) {
 
   }
 
+  delete stats_pool;
+  stats_pool = nullptr;
+
   putc('\n', stdout);
 
   fflush(stdout);
@@ -4831,6 +8590,107 @@ void update_log_temp_checkpoint(byte *buf, lsn_t lsn) {
                          log_block_calc_checksum_crc32(buf + LOG_CHECKPOINT_2));
 }
 
+/** Decompress xtrabackup_logfile of a backup taken with --compress that was
+not decompressed before --prepare. The compressed copy is removed, a later
+--decompress would overwrite the prepared log otherwise.
+@param[in]  dir  backup directory
+@return false in case of error */
+static bool xtrabackup_decompress_temp_log(const char *dir) {
+  static const struct {
+    const char *ext;
+    ds_type_t type;
+  } formats[] = {{".zst", DS_TYPE_DECOMPRESS_ZSTD},
+                 {".lz4", DS_TYPE_DECOMPRESS_LZ4}};
+  char path[FN_REFLEN];
+  MY_STAT stat_info;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, XB_LOG_FILENAME);
+  if (my_stat(path, &stat_info, MYF(0)) != nullptr) {
+    return (true);
+  }
+
+  for (const auto &format : formats) {
+    std::string name = std::string(XB_LOG_FILENAME) + format.ext;
+    snprintf(path, sizeof(path), "%s/%s", dir, name.c_str());
+    if (my_stat(path, &stat_info, MYF(0)) == nullptr) {
+      continue;
+    }
+
+    xb::info() << "decompressing " << path;
+
+    ds_decompress_lz4_threads = ds_decompress_zstd_threads =
+        std::max(xtrabackup_parallel, 1);
+    ds_ctxt_t *local = ds_create(dir, DS_TYPE_LOCAL);
+    ds_ctxt_t *ds = ds_create(dir, format.type);
+    ds_set_pipe(ds, local);
+
+    const size_t buf_size = 10 * 1024 * 1024;
+    auto buf = ut::make_unique<uchar[]>(UT_NEW_THIS_FILE_PSI_KEY, buf_size);
+    bool success = false;
+
+    File fd = my_open(path, O_RDONLY, MYF(MY_WME));
+    ds_file_t *file =
+        fd < 0 ? nullptr : ds_open(ds, name.c_str(), &stat_info);
+    if (file != nullptr) {
+      while (true) {
+        size_t len = my_read(fd, buf.get(), buf_size, MYF(MY_WME));
+        if (len == MY_FILE_ERROR) break;
+        if (len == 0) {
+          success = true;
+          break;
+        }
+        if (ds_write(file, buf.get(), len)) break;
+      }
+      if (ds_close(file) != 0) success = false;
+    }
+    if (fd >= 0) my_close(fd, MYF(MY_WME));
+
+    ds_destroy(ds);
+    ds_destroy(local);
+
+    if (!success) {
+      xb::error() << "failed to decompress " << path;
+      return (false);
+    }
+
+    return (my_delete(path, MYF(MY_WME)) == 0);
+  }
+
+  return (true);
+}
+
+/** Check whether a previous --prepare was interrupted after it had moved
+xtrabackup_logfile into the redo log directory.
+@param[in]	log_path	path to xtrabackup_logfile
+@param[in]	redo_path	path to #ib_redo0
+@return true if redo_path is still the untouched backup redo log */
+static bool xb_prepare_was_interrupted(const char *log_path,
+                                       const char *redo_path) {
+  bool exists;
+  os_file_type_t type;
+
+  if (!os_file_status(log_path, &exists, &type) || exists) {
+    return (false);
+  }
+  if (!os_file_status(redo_path, &exists, &type) || !exists) {
+    return (false);
+  }
+
+  File fd = my_open(redo_path, O_RDONLY, MYF(MY_WME));
+  if (fd < 0) {
+    return (false);
+  }
+
+  byte creator[(sizeof LOG_HEADER_CREATOR_PXB) - 1];
+  bool ret = my_pread(fd, creator, sizeof creator, LOG_HEADER_CREATOR,
+                      MYF(MY_WME | MY_NABP)) == 0 &&
+             memcmp(creator, LOG_HEADER_CREATOR_PXB, sizeof creator) == 0;
+
+  my_close(fd, MYF(MY_WME));
+
+  return (ret);
+}
+
 static bool xtrabackup_init_temp_log(void) {
   pfs_os_file_t src_file = XB_FILE_UNDEFINED;
   char src_path[FN_REFLEN];
@@ -4849,6 +8709,7 @@ static bool xtrabackup_init_temp_log(void) {
   lsn_t start_lsn = 0;
 
   bool checkpoint_found;
+  bool resuming;
 
   IORequest read_request(IORequest::READ);
   IORequest write_request(IORequest::WRITE);
@@ -4882,6 +8743,25 @@ static bool xtrabackup_init_temp_log(void) {
   Fil_path::normalize(dst_path);
   Fil_path::normalize(src_path);
 
+  if (!xtrabackup_decompress_temp_log(!xtrabackup_incremental_dir
+                                          ? xtrabackup_target_dir
+                                          : xtrabackup_incremental_dir)) {
+    goto error;
+  }
+
+  /* InnoDB recreates the redo log with its own creator tag only once
+  recovery completes, so a log still created by xtrabackup can be replayed
+  again from the backup checkpoint. Pages flushed by the interrupted run
+  carry a newer LSN and are skipped by recovery. */
+  resuming = xb_prepare_was_interrupted(src_path, dst_path);
+  if (resuming) {
+    xb::info() << "Resuming an interrupted --prepare, moving " << dst_path
+               << " back to " << src_path;
+    if (!os_file_rename(0, dst_path, src_path)) {
+      goto error;
+    }
+  }
+
   src_file = os_file_create_simple_no_error_handling(
       0, src_path, OS_FILE_OPEN, OS_FILE_READ_WRITE, srv_read_only_mode,
       &success);
@@ -5002,8 +8882,8 @@ static bool xtrabackup_init_temp_log(void) {
     file_size = os_file_get_size(src_file);
   }
 
-  /* TODO: We should judge whether the file is already expanded or not... */
-  {
+  /* the interrupted run has already expanded the file */
+  if (!resuming) {
     ulint expand;
 
     memset(log_buf, 0, UNIV_PAGE_SIZE_MAX * 128);
@@ -5566,6 +9446,288 @@ exit:
   return file;
 }
 
+/** serializes matching the .delta files to the tablespaces of the full
+backup, which renames and creates tablespaces, while the deltas are applied in
+parallel. */
+static std::mutex apply_delta_mutex;
+
+/** Write a run of consecutive pages of a .delta file to the data file and
+punch the holes of the compressed pages.
+@param[in]	write_request	write request
+@param[in]	dst_path	path of the data file
+@param[in]	dst_file	data file
+@param[in]	pages		pages to write
+@param[in]	page_no		number of the first page
+@param[in]	n_pages		number of pages
+@param[in]	page_size	page size
+@param[in]	block_size	file system block size of the data file
+@return true on success */
+static bool xb_delta_write_pages(IORequest &write_request, const char *dst_path,
+                                 pfs_os_file_t dst_file, const page_t *pages,
+                                 ulint page_no, ulint n_pages, ulint page_size,
+                                 size_t block_size) {
+  const os_offset_t offset_in_file = os_offset_t{page_no} * page_size;
+
+  if (!os_file_write(write_request, dst_path, dst_file, pages, offset_in_file,
+                     n_pages * page_size)) {
+    return (false);
+  }
+
+  const page_t *page = pages;
+  for (ulint i = 0; i < n_pages; i++, page += page_size) {
+    if (IORequest::is_punch_hole_supported() &&
+        (Compression::is_compressed_page(page) ||
+         fil_page_get_type(page) == FIL_PAGE_COMPRESSED_AND_ENCRYPTED)) {
+      size_t compressed_len =
+          mach_read_from_2(page + FIL_PAGE_COMPRESS_SIZE_V1) + FIL_PAGE_DATA;
+      compressed_len = ut_calc_align(compressed_len, block_size);
+      if (compressed_len < page_size) {
+        if (os_file_punch_hole(dst_file.m_file,
+                               offset_in_file + i * page_size + compressed_len,
+                               page_size - compressed_len) != DB_SUCCESS) {
+          xb::error() << "os_file_punch_hole returned error";
+          return (false);
+        }
+      }
+    }
+  }
+
+  return (true);
+}
+
+bool xb_delta_read_page_map(const char *path, ulint page_size,
+                            xb_delta_page_map_t *pages) {
+  IORequest read_request(IORequest::READ);
+  bool success;
+  bool last_buffer = false;
+  os_offset_t offset = 0;
+  const ulint hdr_align = std::min<ulint>(page_size, 4096);
+
+  pfs_os_file_t file = os_file_create_simple_no_error_handling(
+      0, path, OS_FILE_OPEN, OS_FILE_READ_ONLY, srv_read_only_mode, &success);
+  if (!success) {
+    os_file_get_last_error(true);
+    xb::error() << "cannot open " << path;
+    return (false);
+  }
+
+  byte *buf_base = static_cast<byte *>(ut::malloc_withkey(
+      UT_NEW_THIS_FILE_PSI_KEY, page_size + UNIV_PAGE_SIZE_MAX));
+  byte *buf = static_cast<byte *>(ut_align(buf_base, UNIV_PAGE_SIZE_MAX));
+
+  pages->clear();
+
+  while (!last_buffer) {
+    success =
+        os_file_read(read_request, path, file, buf, offset, hdr_align);
+    if (!success) {
+      break;
+    }
+
+    const ulint cluster_header = mach_read_from_4(buf);
+    switch (cluster_header) {
+      case 0x78747261UL: /*"xtra"*/
+      case XB_DELTA_V2_MAGIC:
+        break;
+      case 0x58545241UL: /*"XTRA"*/
+      case XB_DELTA_V2_LAST_MAGIC:
+        last_buffer = true;
+        break;
+      default:
+        success = false;
+    }
+
+    if (!success) {
+      break;
+    }
+
+    if (cluster_header == XB_DELTA_V2_MAGIC ||
+        cluster_header == XB_DELTA_V2_LAST_MAGIC) {
+      const ulint hdr_len = mach_read_from_4(buf + 4);
+      const ulint n_ranges = mach_read_from_4(buf + 8);
+
+      success = hdr_len >= XB_DELTA_V2_HDR_SIZE + n_ranges * 8 &&
+                hdr_len <= page_size &&
+                (hdr_len <= hdr_align ||
+                 os_file_read(read_request, path, file, buf, offset, hdr_len));
+      if (!success) {
+        break;
+      }
+
+      os_offset_t page_offset = offset + hdr_len;
+      for (ulint i = 0; i < n_ranges; i++) {
+        const byte *range = buf + XB_DELTA_V2_HDR_SIZE + i * 8;
+        const page_no_t first = mach_read_from_4(range);
+        const ulint range_pages = mach_read_from_4(range + 4);
+
+        for (ulint j = 0; j < range_pages; j++, page_offset += page_size) {
+          pages->emplace_back(first + j, page_offset);
+        }
+      }
+
+      offset = page_offset;
+      continue;
+    }
+
+    if (hdr_align < page_size &&
+        !os_file_read(read_request, path, file, buf, offset, page_size)) {
+      success = false;
+      break;
+    }
+
+    ulint page_in_buffer;
+    for (page_in_buffer = 1; page_in_buffer < page_size / 4; page_in_buffer++) {
+      if (mach_read_from_4(buf + page_in_buffer * 4) == 0xFFFFFFFFUL) break;
+    }
+
+    if (!last_buffer && page_in_buffer != page_size / 4) {
+      success = false;
+      break;
+    }
+
+    for (ulint i = 1; i < page_in_buffer; i++) {
+      pages->emplace_back(mach_read_from_4(buf + i * 4),
+                          offset + i * page_size);
+    }
+
+    offset += page_in_buffer * page_size;
+  }
+
+  ut::free(buf_base);
+  os_file_close(file);
+
+  if (!success) {
+    xb::error() << path << " is not valid .delta file.";
+    return (false);
+  }
+
+  /* a page is in a single cluster, keep the last copy if it is not */
+  std::stable_sort(pages->begin(), pages->end(),
+                   [](const xb_delta_page_map_t::value_type &a,
+                      const xb_delta_page_map_t::value_type &b) {
+                     return a.first < b.first;
+                   });
+  if (!pages->empty()) {
+    auto last = pages->begin();
+    for (auto it = last + 1; it != pages->end(); ++it) {
+      if (it->first != last->first) {
+        ++last;
+      }
+      *last = *it;
+    }
+    pages->erase(last + 1, pages->end());
+  }
+
+  return (true);
+}
+
+/** Bytes read at once from a .delta file when it is applied */
+static const ulint XB_DELTA_READ_SIZE = 16 * 1024 * 1024;
+
+/** Sequential reader of a .delta file. The file is read with large aligned
+reads into a window, the clusters are walked in it without reading their
+header pages again. */
+class Delta_reader {
+ public:
+  /**
+  @param[in]  path   path of the file
+  @param[in]  file   file opened for reading
+  @param[in]  size   size of the file
+  @param[in]  align  alignment of the reads */
+  Delta_reader(const char *path, pfs_os_file_t file, os_offset_t size,
+               ulint align)
+      : m_path(path), m_file(file), m_size(size), m_align(align) {
+    m_buf_base = static_cast<byte *>(ut::malloc_withkey(
+        UT_NEW_THIS_FILE_PSI_KEY, XB_DELTA_READ_SIZE + UNIV_PAGE_SIZE_MAX));
+    m_buf = static_cast<byte *>(ut_align(m_buf_base, UNIV_PAGE_SIZE_MAX));
+  }
+
+  ~Delta_reader() { ut::free(m_buf_base); }
+
+  /** Get the bytes of the file at an offset, reading the window that starts
+  there if they are not in the current one.
+  @param[in]   offset  offset in the file
+  @param[in]   n       bytes needed, at most a page
+  @param[out]  avail   bytes available at offset, at least n
+  @return the bytes, nullptr if they cannot be read */
+  const byte *get(os_offset_t offset, ulint n, ulint *avail) {
+    if (offset < m_start || offset + n > m_start + m_len) {
+      const os_offset_t start = ut_uint64_align_down(offset, m_align);
+      if (offset + n > m_size) {
+        xb::error() << m_path << " is truncated at offset " << m_size;
+        return (nullptr);
+      }
+
+      if (m_len > 0) {
+        posix_fadvise(m_file.m_file, m_start, m_len, POSIX_FADV_DONTNEED);
+      }
+      m_start = start;
+      m_len = std::min<os_offset_t>(XB_DELTA_READ_SIZE, m_size - start);
+
+      IORequest read_request(IORequest::READ);
+      if (!os_file_read(read_request, m_path, m_file, m_buf, m_start,
+                        m_len)) {
+        m_len = 0;
+        return (nullptr);
+      }
+    }
+
+    *avail = m_start + m_len - offset;
+    return (m_buf + (offset - m_start));
+  }
+
+ private:
+  const char *m_path;
+  pfs_os_file_t m_file;
+  os_offset_t m_size;
+  ulint m_align;
+
+  byte *m_buf_base;
+  byte *m_buf;
+
+  /** offset and length of the window in the file */
+  os_offset_t m_start{0};
+  ulint m_len{0};
+};
+
+/** Write the consecutive pages of a .delta file to the data file, with one
+write for each window of the reader they are in.
+@param[in,out]	reader		reader of the .delta file
+@param[in]	offset		offset of the first page in the .delta file
+@param[in]	write_request	write request
+@param[in]	dst_path	path of the data file
+@param[in]	dst_file	data file
+@param[in]	page_no		number of the first page
+@param[in]	n_pages		number of pages
+@param[in]	page_size	page size
+@param[in]	block_size	file system block size of the data file
+@return true on success */
+static bool xb_delta_apply_pages(Delta_reader &reader, os_offset_t offset,
+                                 IORequest &write_request,
+                                 const char *dst_path, pfs_os_file_t dst_file,
+                                 ulint page_no, ulint n_pages, ulint page_size,
+                                 size_t block_size) {
+  while (n_pages > 0) {
+    ulint avail;
+    const page_t *pages = reader.get(offset, page_size, &avail);
+    if (pages == nullptr) {
+      return (false);
+    }
+
+    const ulint n = std::min<ulint>(n_pages, avail / page_size);
+    if (!xb_delta_write_pages(write_request, dst_path, dst_file, pages,
+                              page_no, n, page_size, block_size)) {
+      return (false);
+    }
+
+    offset += n * page_size;
+    page_no += n;
+    n_pages -= n;
+  }
+
+  return (true);
+}
+
 /************************************************************************
 Applies a given .delta file to the corresponding data file.
 @return true on success */
@@ -5582,7 +9744,6 @@ static bool xtrabackup_apply_delta(
 
   bool last_buffer = false;
   ulint page_in_buffer;
-  ulint incremental_buffers = 0;
 
   xb_delta_info_t info;
   ulint page_size;
@@ -5597,7 +9758,6 @@ static bool xtrabackup_apply_delta(
     return true;
   }
 
-  IORequest read_request(IORequest::READ);
   IORequest write_request(IORequest::WRITE | IORequest::PUNCH_HOLE);
 
   ut_a(xtrabackup_incremental);
@@ -5652,10 +9812,13 @@ static bool xtrabackup_apply_delta(
 
   os_file_set_nocache(src_file.m_file, src_path, "OPEN");
 
-  dst_file = xb_delta_open_matching_space(
-      entry.db_name.empty() ? nullptr : entry.db_name.c_str(), space_name,
-      info.space_id, info.space_flags, info.zip_size, dst_path,
-      sizeof(dst_path), &success);
+  {
+    std::lock_guard<std::mutex> lock(apply_delta_mutex);
+    dst_file = xb_delta_open_matching_space(
+        entry.db_name.empty() ? nullptr : entry.db_name.c_str(), space_name,
+        info.space_id, info.space_flags, info.zip_size, dst_path,
+        sizeof(dst_path), &success);
+  }
   if (!success) {
     xb::error() << "cannot open " << dst_path;
     goto error;
@@ -5667,90 +9830,132 @@ static bool xtrabackup_apply_delta(
 
   os_file_get_status(dst_path, &stat_info, false, false);
 
-  /* allocate buffer for incremental backup */
-  incremental_buffer_base = static_cast<byte *>(
-      ut::malloc_withkey(UT_NEW_THIS_FILE_PSI_KEY,
-                         (page_size / 4 + 1) * page_size + UNIV_PAGE_SIZE_MAX));
+  /* the header page of the cluster, kept while its pages are read */
+  incremental_buffer_base = static_cast<byte *>(ut::malloc_withkey(
+      UT_NEW_THIS_FILE_PSI_KEY, page_size + UNIV_PAGE_SIZE_MAX));
   incremental_buffer = static_cast<byte *>(
       ut_align(incremental_buffer_base, UNIV_PAGE_SIZE_MAX));
 
   xb::info() << "Applying " << src_path << " to " << dst_path;
 
-  while (!last_buffer) {
-    ulint cluster_header;
+  offset = 0;
 
-    /* read to buffer */
-    /* first block of block cluster */
-    offset = ((incremental_buffers * (page_size / 4)) << page_size_shift);
-    success = os_file_read(read_request, src_path, src_file, incremental_buffer,
-                           offset, page_size);
-    if (!success) {
-      goto error;
-    }
+  {
+    const ulint hdr_align = std::min<ulint>(page_size, 4096);
+    Delta_reader reader(src_path, src_file, os_file_get_size(src_file),
+                        hdr_align);
 
-    cluster_header = mach_read_from_4(incremental_buffer);
-    switch (cluster_header) {
-      case 0x78747261UL: /*"xtra"*/
-        break;
-      case 0x58545241UL: /*"XTRA"*/
-        last_buffer = true;
-        break;
-      default:
-        xb::info() << src_path << " is not valid .delta file.";
+    while (!last_buffer) {
+      ulint cluster_header;
+      ulint avail;
+
+      /* first block of block cluster */
+      const byte *ptr = reader.get(offset, hdr_align, &avail);
+      if (ptr == nullptr) {
         goto error;
-    }
+      }
 
-    for (page_in_buffer = 1; page_in_buffer < page_size / 4; page_in_buffer++) {
-      if (mach_read_from_4(incremental_buffer + page_in_buffer * 4) ==
-          0xFFFFFFFFUL)
-        break;
-    }
+      cluster_header = mach_read_from_4(ptr);
+      switch (cluster_header) {
+        case 0x78747261UL: /*"xtra"*/
+        case XB_DELTA_V2_MAGIC:
+          break;
+        case 0x58545241UL: /*"XTRA"*/
+        case XB_DELTA_V2_LAST_MAGIC:
+          last_buffer = true;
+          break;
+        default:
+          xb::info() << src_path << " is not valid .delta file.";
+          goto error;
+      }
 
-    ut_a(last_buffer || page_in_buffer == page_size / 4);
+      if (cluster_header == XB_DELTA_V2_MAGIC ||
+          cluster_header == XB_DELTA_V2_LAST_MAGIC) {
+        const ulint hdr_len = mach_read_from_4(ptr + 4);
+        const ulint n_ranges = mach_read_from_4(ptr + 8);
 
-    /* read whole of the cluster */
-    success = os_file_read(read_request, src_path, src_file, incremental_buffer,
-                           offset, page_in_buffer * page_size);
-    if (!success) {
-      goto error;
-    }
+        if (hdr_len < XB_DELTA_V2_HDR_SIZE + n_ranges * 8 ||
+            hdr_len > page_size) {
+          xb::info() << src_path << " is not valid .delta file.";
+          goto error;
+        }
 
-    posix_fadvise(src_file.m_file, offset, page_in_buffer * page_size,
-                  POSIX_FADV_DONTNEED);
+        ptr = reader.get(offset, hdr_len, &avail);
+        if (ptr == nullptr) {
+          goto error;
+        }
+        memcpy(incremental_buffer, ptr, hdr_len);
 
-    for (page_in_buffer = 1; page_in_buffer < page_size / 4; page_in_buffer++) {
-      const page_t *page = incremental_buffer + page_in_buffer * page_size;
-      const ulint offset_on_page =
-          mach_read_from_4(incremental_buffer + page_in_buffer * 4);
+        ulint n_pages = 0;
+        for (ulint i = 0; i < n_ranges; i++) {
+          n_pages += mach_read_from_4(incremental_buffer +
+                                      XB_DELTA_V2_HDR_SIZE + i * 8 + 4);
+        }
+        if (n_pages >= page_size / 4) {
+          xb::info() << src_path << " is not valid .delta file.";
+          goto error;
+        }
 
-      if (offset_on_page == 0xFFFFFFFFUL) break;
+        /* the pages of the cluster follow its header page */
+        os_offset_t page_offset = offset + hdr_len;
+        for (ulint i = 0; i < n_ranges; i++) {
+          const byte *range =
+              incremental_buffer + XB_DELTA_V2_HDR_SIZE + i * 8;
+          const ulint range_pages = mach_read_from_4(range + 4);
+
+          if (!xb_delta_apply_pages(reader, page_offset, write_request,
+                                    dst_path, dst_file,
+                                    mach_read_from_4(range), range_pages,
+                                    page_size, stat_info.block_size)) {
+            goto error;
+          }
+          page_offset += range_pages * page_size;
+        }
 
-      const auto offset_in_file = offset_on_page << page_size_shift;
+        offset = page_offset;
+        continue;
+      }
 
-      success = os_file_write(write_request, dst_path, dst_file, page,
-                              offset_in_file, page_size);
-      if (!success) {
+      ptr = reader.get(offset, page_size, &avail);
+      if (ptr == nullptr) {
         goto error;
       }
+      memcpy(incremental_buffer, ptr, page_size);
 
-      if (IORequest::is_punch_hole_supported() &&
-          (Compression::is_compressed_page(page) ||
-           fil_page_get_type(page) == FIL_PAGE_COMPRESSED_AND_ENCRYPTED)) {
-        size_t compressed_len =
-            mach_read_from_2(page + FIL_PAGE_COMPRESS_SIZE_V1) + FIL_PAGE_DATA;
-        compressed_len = ut_calc_align(compressed_len, stat_info.block_size);
-        if (compressed_len < page_size) {
-          if (os_file_punch_hole(dst_file.m_file,
-                                 offset_in_file + compressed_len,
-                                 page_size - compressed_len) != DB_SUCCESS) {
-            xb::error() << "os_file_punch_hole returned error";
-            goto error;
-          }
+      for (page_in_buffer = 1; page_in_buffer < page_size / 4;
+           page_in_buffer++) {
+        if (mach_read_from_4(incremental_buffer + page_in_buffer * 4) ==
+            0xFFFFFFFFUL)
+          break;
+      }
+
+      ut_a(last_buffer || page_in_buffer == page_size / 4);
+
+      for (ulint i = 1; i < page_in_buffer;) {
+        const ulint offset_on_page =
+            mach_read_from_4(incremental_buffer + i * 4);
+
+        /* the pages of a cluster are sorted, write a run of consecutive
+        pages with a single write */
+        ulint n_pages = 1;
+        while (i + n_pages < page_in_buffer &&
+               mach_read_from_4(incremental_buffer + (i + n_pages) * 4) ==
+                   offset_on_page + n_pages) {
+          n_pages++;
+        }
+
+        if (!xb_delta_apply_pages(reader, offset + i * page_size,
+                                  write_request, dst_path, dst_file,
+                                  offset_on_page, n_pages, page_size,
+                                  stat_info.block_size)) {
+          goto error;
         }
+
+        i += n_pages;
       }
-    }
 
-    incremental_buffers++;
+      offset += page_in_buffer * page_size;
+    }
   }
 
   if (incremental_buffer_base) ut::free(incremental_buffer_base);
@@ -5833,7 +10038,8 @@ xb_process_datadir
 @param[in]	data	additional argument for callback */
 void process_datadir_l2cbk(const char *datadir, const char *dbname,
                            const char *path, const char *name,
-                           const char *suffix, handle_datadir_entry_func_t func,
+                           const char *suffix,
+                           const handle_datadir_entry_func_t &func,
                            void *data) {
   struct stat statinfo;
   size_t suffix_len = strlen(suffix);
@@ -5846,7 +10052,9 @@ void process_datadir_l2cbk(const char *datadir, const char *dbname,
       (strlen(name) > suffix_len &&
        strcmp(name + strlen(name) - suffix_len, suffix) == 0)) {
     check_datadir_enctry_access(name, &statinfo);
-    func(datadir_entry_t(datadir, path, dbname, name, false), data);
+    func(datadir_entry_t(datadir, path, dbname, name, false,
+                         statinfo.st_size),
+         data);
   }
 }
 
@@ -5856,10 +10064,15 @@ void process_datadir_l2cbk(const char *datadir, const char *dbname,
 @param[in]	name	name of the file
 @param[in]	suffix	suffix to match against
 @param[in]	func	callback
-@param[in]	data	additional argument for callback */
+@param[in]	data	additional argument for callback
+@param[in]	pool	if not null, the database directory is scanned by a
+                        task of the pool
+@param[out]	tasks	futures of the tasks added to the pool */
 void process_datadir_l1cbk(const char *datadir, const char *path,
                            const char *name, const char *suffix,
-                           handle_datadir_entry_func_t func, void *data) {
+                           const handle_datadir_entry_func_t &func, void *data,
+                           Thread_pool *pool = nullptr,
+                           std::vector<std::future<void>> *tasks = nullptr) {
   struct stat statinfo;
   size_t suffix_len = strlen(suffix);
 
@@ -5868,56 +10081,107 @@ void process_datadir_l1cbk(const char *datadir, const char *path,
   }
 
   if (S_ISDIR(statinfo.st_mode) && !check_if_skip_database_by_path(name)) {
-    bool is_empty_dir = true;
     check_datadir_enctry_access(name, &statinfo);
-    os_file_scan_directory(
+    auto scan = [&func, data, dir = std::string(datadir),
+                 dbpath = std::string(path), dbname = std::string(name),
+                 sfx = std::string(suffix)](size_t) {
+      bool is_empty_dir = true;
+      os_file_scan_directory(
+          dbpath.c_str(),
+          [&](const char *l2path, const char *l2name) mutable -> void {
+            if (strcmp(l2name, ".") == 0 || strcmp(l2name, "..") == 0) {
+              return;
+            }
+            is_empty_dir = false;
+            char fullpath[FN_REFLEN];
+            snprintf(fullpath, sizeof(fullpath), "%s/%s", l2path, l2name);
+            process_datadir_l2cbk(dir.c_str(), dbname.c_str(), fullpath,
+                                  l2name, sfx.c_str(), func, data);
+          },
+          false);
+      if (is_empty_dir) {
+        func(datadir_entry_t(dir.c_str(), dbpath.c_str(), dbname.c_str(), "",
+                             true),
+             data);
+      }
+    };
+    if (pool != nullptr) {
+      tasks->push_back(pool->add_task(scan));
+    } else {
+      scan(0);
+    }
+  }
+
+  if (S_ISREG(statinfo.st_mode) &&
+      (strlen(name) > suffix_len &&
+       strcmp(name + strlen(name) - suffix_len, suffix) == 0)) {
+    check_datadir_enctry_access(name, &statinfo);
+    func(datadir_entry_t(datadir, path, "", name, false, statinfo.st_size),
+         data);
+  }
+}
+
+/************************************************************************
+Function enumerates files in datadir (provided by path) which are matched
+by provided suffix. For each entry callback is called.
+@return false if callback for some entry returned false */
+bool xb_process_datadir(const char *path,   /*!<in: datadir path */
+                        const char *suffix, /*!<in: suffix to match
+                                            against */
+                        handle_datadir_entry_func_t func, /*!<in: callback */
+                        void *data, /*!<in: additional argument for
+                                    callback */
+                        uint n_threads) /*!<in: number of threads
+                                        scanning the database
+                                        directories */
+{
+  if (n_threads <= 1) {
+    return os_file_scan_directory(
         path,
-        [&](const char *l2path, const char *l2name) mutable -> void {
-          if (strcmp(l2name, ".") == 0 || strcmp(l2name, "..") == 0) {
+        [&](const char *l1path, const char *l1name) -> void {
+          if (strcmp(l1name, ".") == 0 || strcmp(l1name, "..") == 0) {
             return;
           }
-          is_empty_dir = false;
           char fullpath[FN_REFLEN];
-          snprintf(fullpath, sizeof(fullpath), "%s/%s", l2path, l2name);
-          process_datadir_l2cbk(datadir, name, fullpath, l2name, suffix, func,
-                                data);
+          snprintf(fullpath, sizeof(fullpath), "%s/%s", l1path, l1name);
+          process_datadir_l1cbk(path, fullpath, l1name, suffix, func, data);
         },
         false);
-    if (is_empty_dir) {
-      func(datadir_entry_t(datadir, path, name, "", true), data);
-    }
   }
 
-  if (S_ISREG(statinfo.st_mode) &&
-      (strlen(name) > suffix_len &&
-       strcmp(name + strlen(name) - suffix_len, suffix) == 0)) {
-    check_datadir_enctry_access(name, &statinfo);
-    func(datadir_entry_t(datadir, path, "", name, false), data);
+  /* a datadir with many tables spends most of the walk in readdir() and
+  stat() of the database directories, scan them in parallel and only
+  serialize the callback */
+  std::mutex func_mutex;
+  const handle_datadir_entry_func_t locked_func =
+      [&](const datadir_entry_t &entry, void *arg) {
+        std::lock_guard<std::mutex> lock(func_mutex);
+        return func(entry, arg);
+      };
+
+  std::vector<std::future<void>> tasks;
+  bool ret;
+  {
+    Thread_pool pool(n_threads, [] { my_thread_init(); });
+
+    ret = os_file_scan_directory(
+        path,
+        [&](const char *l1path, const char *l1name) -> void {
+          if (strcmp(l1name, ".") == 0 || strcmp(l1name, "..") == 0) {
+            return;
+          }
+          char fullpath[FN_REFLEN];
+          snprintf(fullpath, sizeof(fullpath), "%s/%s", l1path, l1name);
+          process_datadir_l1cbk(path, fullpath, l1name, suffix, locked_func,
+                                data, &pool, &tasks);
+        },
+        false);
+
+    for (auto &f : tasks) {
+      f.get();
+    }
   }
-}
 
-/************************************************************************
-Function enumerates files in datadir (provided by path) which are matched
-by provided suffix. For each entry callback is called.
-@return false if callback for some entry returned false */
-bool xb_process_datadir(const char *path,   /*!<in: datadir path */
-                        const char *suffix, /*!<in: suffix to match
-                                            against */
-                        handle_datadir_entry_func_t func, /*!<in: callback */
-                        void *data) /*!<in: additional argument for
-                                    callback */
-{
-  bool ret = os_file_scan_directory(
-      path,
-      [&](const char *l1path, const char *l1name) -> void {
-        if (strcmp(l1name, ".") == 0 || strcmp(l1name, "..") == 0) {
-          return;
-        }
-        char fullpath[FN_REFLEN];
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", l1path, l1name);
-        process_datadir_l1cbk(path, fullpath, l1name, suffix, func, data);
-      },
-      false);
   return ret;
 }
 
@@ -5925,8 +10189,34 @@ bool xb_process_datadir(const char *path,   /*!<in: datadir path */
 Applies all .delta files from incremental_dir to the full backup.
 @return true on success. */
 static bool xtrabackup_apply_deltas() {
-  return xb_process_datadir(xtrabackup_incremental_dir, ".delta",
-                            xtrabackup_apply_delta, NULL);
+  std::vector<datadir_entry_t> entries;
+
+  if (!xb_process_datadir(
+          xtrabackup_incremental_dir, ".delta",
+          [&entries](const datadir_entry_t &entry, void *) {
+            entries.push_back(entry);
+            return true;
+          },
+          NULL)) {
+    return false;
+  }
+
+  /* the deltas of different tablespaces are independent, apply them on
+  --parallel threads */
+  Thread_pool pool(std::max(xtrabackup_parallel, 1),
+                   [] { my_thread_init(); });
+  std::vector<std::future<void>> applied;
+
+  for (const auto &entry : entries) {
+    applied.push_back(pool.add_task(
+        [&entry](size_t) { xtrabackup_apply_delta(entry, nullptr); }));
+  }
+
+  for (auto &f : applied) {
+    f.get();
+  }
+
+  return true;
 }
 
 /* replace log file in redo directory to xtrabackup_log
@@ -6718,82 +11008,649 @@ static bool xb_export_cfg_write(
 
   srv_get_encryption_data_filename(table, name, sizeof(name));
 
-  ib::info() << "Writing table encryption data to '" << name << "'";
+  ib::info() << "Writing table encryption data to '" << name << "'";
+
+  FILE *file = fopen(name, "w+b");
+
+  if (file == NULL) {
+    xb::error() << "Can't create file " << SQUOTE(name) << " (errno: " << errno
+                << " - " << strerror(errno) << ")";
+
+    err = DB_IO_ERROR;
+  } else {
+    err = xb_export_write_transfer_key(space->m_encryption_metadata, file);
+
+    if (fflush(file) != 0) {
+      char buf[BUFSIZ];
+
+      snprintf(buf, sizeof(buf), "%s flush() failed", name);
+
+      xb::error() << "IO Write error: (" << errno << ", " << strerror(errno)
+                  << ") " << buf;
+
+      err = DB_IO_ERROR;
+    }
+
+    if (fclose(file) != 0) {
+      char buf[BUFSIZ];
+
+      snprintf(buf, sizeof(buf), "%s flose() failed", name);
+
+      xb::error() << "IO Write error: (" << errno << ", " << strerror(errno)
+                  << ") " << buf;
+      err = DB_IO_ERROR;
+    }
+  }
+
+  return (err);
+}
+
+/** Check whether the export metadata written by a previous --export of a
+file-per-table tablespace is still valid. The .cfg file, and the .cfp file of
+an encrypted tablespace, must have been written after the last write to the
+.ibd file. The pages changed by this prepare must have been flushed before.
+Files written within the same second as the .ibd file are not trusted.
+@param[in]	space	tablespace
+@return true if the .cfg and .cfp files can be kept */
+static bool xb_export_is_current(const fil_space_t *space) {
+  const char *ibd = space->files[0].name;
+  const size_t len = strlen(ibd);
+  if (len < 4 || len >= FN_REFLEN) {
+    return (false);
+  }
+
+  MY_STAT ibd_stat;
+  if (my_stat(ibd, &ibd_stat, MYF(0)) == nullptr) {
+    return (false);
+  }
+
+  char path[FN_REFLEN];
+  strcpy(path, ibd);
+
+  MY_STAT meta_stat;
+  strcpy(path + len - 4, ".cfg");
+  if (my_stat(path, &meta_stat, MYF(0)) == nullptr ||
+      meta_stat.st_mtime <= ibd_stat.st_mtime) {
+    return (false);
+  }
+
+  if (FSP_FLAGS_GET_ENCRYPTION(space->flags)) {
+    strcpy(path + len - 4, ".cfp");
+    if (my_stat(path, &meta_stat, MYF(0)) == nullptr ||
+        meta_stat.st_mtime <= ibd_stat.st_mtime) {
+      return (false);
+    }
+  }
+
+  return (true);
+}
+
+/** Number of tablespaces whose export metadata was kept by
+--export-changed-only */
+static std::atomic<ulint> xb_export_kept{0};
+
+/** Write the .cfp and .cfg files of the tables of a file-per-table
+tablespace for --export.
+@param[in]	space_id	tablespace id
+@param[in]	thd		thread context */
+static void xb_export_space(space_id_t space_id, THD *thd) {
+  if (opt_export_changed_only &&
+      xb_export_is_current(fil_space_get(space_id))) {
+    xb_export_kept++;
+    return;
+  }
+
+  auto result = xb::prepare::dict_load_from_spaces_sdi(space_id);
+  dberr_t err = std::get<0>(result);
+  auto table_vec = std::get<1>(result);
+  if (err != DB_SUCCESS) {
+    xb::error() << "cannot find dictionary record of table "
+                << fil_space_get(space_id)->name;
+    ut_ad(table_vec.empty());
+    return;
+  }
+
+  // It is possible that partition IBD has multiple tables
+  for (auto table : table_vec) {
+    /* Write transfer key for tablespace file */
+    fil_space_t *sp = fil_space_get(table->space);
+    if (xb_export_cfp_write(table) == DB_SUCCESS) {
+      /* Write MySQL 8.0 .cfg file */
+      xb_export_cfg_write(&sp->files[0], table);
+    }
+
+    mutex_enter(&(dict_sys->mutex));
+    dd_table_close(table, thd, nullptr, true);
+    mutex_exit(&(dict_sys->mutex));
+  }
+}
+
+/** Write the export metadata of all file-per-table tablespaces. The
+tablespaces are independent, the tables are loaded from their SDI and their
+files written on --parallel threads, each with its own THD for the
+dictionary client.
+@param[in]	thd	thread context of the caller
+@return true in case of success */
+static bool xb_export_tables(THD *thd) {
+  std::vector<space_id_t> space_ids;
+
+  datafiles_iter_t *it = datafiles_iter_new(nullptr);
+  if (it == NULL) {
+    xb::error() << "datafiles_iter_new() "
+                   "failed.";
+    return (false);
+  }
+
+  fil_node_t *node;
+  while ((node = datafiles_iter_next(it)) != NULL) {
+    /* treat file_per_table only */
+    if (fsp_is_file_per_table(node->space->id, node->space->flags)) {
+      space_ids.push_back(node->space->id);
+    }
+  }
+
+  datafiles_iter_free(it);
+
+  const size_t n_threads =
+      std::min<size_t>(std::max(xtrabackup_parallel, 1), space_ids.size());
+  std::atomic<size_t> next{0};
+
+  if (n_threads <= 1) {
+    for (auto space_id : space_ids) {
+      xb_export_space(space_id, thd);
+    }
+    return (true);
+  }
+
+  std::vector<IB_thread> threads;
+
+  for (size_t i = 0; i < n_threads; ++i) {
+    threads.push_back(os_thread_create(PFS_NOT_INSTRUMENTED, i, [&]() {
+      THD *worker_thd = create_internal_thd();
+
+      for (size_t n = next++; n < space_ids.size(); n = next++) {
+        xb_export_space(space_ids[n], worker_thd);
+      }
+
+      destroy_internal_thd(worker_thd);
+    }));
+    threads.back().start();
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  return (true);
+}
+
+static void innodb_free_param() {
+  srv_sys_space.shutdown();
+  srv_tmp_space.shutdown();
+  free(internal_innobase_data_file_path);
+  internal_innobase_data_file_path = NULL;
+  free_tmpdir(&mysql_tmpdir_list);
+  ibt::srv_temp_dir = srv_temp_dir;
+}
+
+static void read_metadata() {
+  char metadata_path[FN_REFLEN];
+  char xtrabackup_info_path[FN_REFLEN];
+
+  /* cd to target-dir */
+  if (my_setwd(xtrabackup_real_target_dir, MYF(MY_WME))) {
+    xb::error() << "cannot my_setwd " << xtrabackup_real_target_dir;
+    exit(EXIT_FAILURE);
+  }
+  xb::info() << "cd to " << xtrabackup_real_target_dir;
+
+  xtrabackup_target_dir = mysql_data_home_buff;
+  xtrabackup_target_dir[0] = FN_CURLIB;  // all paths are relative from here
+  xtrabackup_target_dir[1] = 0;
+
+  sprintf(metadata_path, "%s/%s", xtrabackup_target_dir,
+          XTRABACKUP_METADATA_FILENAME);
+
+  if (!xtrabackup_read_metadata(metadata_path)) {
+    xb::error() << "failed to read metadata from " << SQUOTE(metadata_path);
+    exit(EXIT_FAILURE);
+  }
+
+  if (metadata_reencrypted && xtrabackup_incremental_dir != nullptr) {
+    xb::error() << "the backup was taken with --reencrypt-tablespaces, "
+                << "incremental backups cannot be applied to it.";
+    exit(EXIT_FAILURE);
+  }
+  /* read xtrabackup_info file to read server version and version of
+   * xtrabackup used during backup */
+  sprintf(xtrabackup_info_path, "%s/%s", xtrabackup_target_dir,
+          XTRABACKUP_INFO);
+
+  if (!xtrabackup_read_info(xtrabackup_info_path)) {
+    xb::error() << "Failed to parse xtrabackup_info from "
+                << SQUOTE(xtrabackup_info_path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/** Sync every file of the target directory once, after --fast-prepare
+wrote them without syncing.
+@return true on success */
+static bool xb_sync_target_dir() {
+  bool ret = true;
+
+  xb_process_datadir(
+      xtrabackup_target_dir, "",
+      [&ret](const datadir_entry_t &entry, void *) {
+        if (entry.is_empty_dir) {
+          return (true);
+        }
+
+        File fd = my_open(entry.path.c_str(), O_RDWR, MYF(MY_WME));
+        if (fd < 0 || my_sync(fd, MYF(MY_WME)) != 0) {
+          xb::error() << "failed to sync " << SQUOTE(entry.path.c_str());
+          ret = false;
+        }
+        if (fd >= 0) {
+          my_close(fd, MYF(MY_WME));
+        }
+        return (ret);
+      },
+      nullptr);
+
+  return (ret);
+}
+
+/** A file of the redo log archived by --archive-redo */
+struct archived_redo_segment_t {
+  std::string path;
+  /* lsn of the first block */
+  lsn_t start_lsn;
+  /* lsn following the last complete block */
+  lsn_t end_lsn;
+  /* offset of the first block in the file */
+  os_offset_t offset;
+};
+
+/** Find the checkpoint lsn in the header of a copy of the redo log.
+@param[in]  hdr  LOG_FILE_HDR_SIZE bytes of log file header
+@return checkpoint lsn, 0 if no checkpoint is valid */
+static lsn_t xb_log_header_checkpoint_lsn(const byte *hdr) {
+  lsn_t checkpoint_lsn = 0;
+  for (ulint field = LOG_CHECKPOINT_1; field <= LOG_CHECKPOINT_2;
+       field += LOG_CHECKPOINT_2 - LOG_CHECKPOINT_1) {
+    if (log_block_get_checksum(hdr + field) ==
+        log_block_calc_checksum_crc32(hdr + field)) {
+      checkpoint_lsn = std::max<lsn_t>(
+          checkpoint_lsn, mach_read_from_8(hdr + field + LOG_CHECKPOINT_LSN));
+    }
+  }
+  return (checkpoint_lsn);
+}
+
+/** List the segments of the redo log archived by --archive-redo.
+@param[in]   dir       archive directory
+@param[in]   format    redo log format of the backup
+@param[out]  segments  segments, sorted by lsn
+@return false on error */
+static bool xb_archived_redo_segments(
+    const char *dir, uint32_t format,
+    std::vector<archived_redo_segment_t> &segments) {
+  std::vector<std::string> names;
+  const std::string prefix = std::string(XB_LOG_FILENAME) + ".";
+  if (!os_file_scan_directory(
+          dir,
+          [&names, &prefix](const char *, const char *name) {
+            if (strcmp(name, XB_LOG_FILENAME) == 0 ||
+                (strncmp(name, prefix.c_str(), prefix.length()) == 0 &&
+                 strspn(name + prefix.length(), "0123456789") ==
+                     strlen(name + prefix.length()))) {
+              names.push_back(name);
+            }
+          },
+          false)) {
+    xb::error() << "cannot list " << dir;
+    return (false);
+  }
+
+  byte hdr[LOG_FILE_HDR_SIZE];
+  for (const auto &name : names) {
+    archived_redo_segment_t segment;
+    segment.path = std::string(dir) + "/" + name;
+
+    MY_STAT stat_info;
+    if (my_stat(segment.path.c_str(), &stat_info, MYF(MY_WME)) == nullptr) {
+      return (false);
+    }
+
+    if (name == XB_LOG_FILENAME) {
+      File fd = my_open(segment.path.c_str(), O_RDONLY, MYF(MY_WME));
+      if (fd < 0) {
+        return (false);
+      }
+      const bool read = my_read(fd, hdr, sizeof(hdr),
+                                MYF(MY_WME | MY_NABP)) == 0;
+      my_close(fd, MYF(MY_WME));
+      if (!read) {
+        return (false);
+      }
+      if (mach_read_from_4(hdr + LOG_HEADER_FORMAT) != format) {
+        xb::error() << segment.path << " has the redo log format "
+                    << mach_read_from_4(hdr + LOG_HEADER_FORMAT)
+                    << ", the format of the backup is " << format;
+        return (false);
+      }
+      segment.offset = LOG_FILE_HDR_SIZE;
+      segment.start_lsn = ut_uint64_align_down(
+          xb_log_header_checkpoint_lsn(hdr), OS_FILE_LOG_BLOCK_SIZE);
+      if (segment.start_lsn == 0) {
+        xb::error() << "No valid checkpoint found in " << segment.path;
+        return (false);
+      }
+    } else {
+      segment.offset = 0;
+      segment.start_lsn =
+          strtoull(name.c_str() + prefix.length(), nullptr, 10);
+    }
+
+    if (static_cast<os_offset_t>(stat_info.st_size) < segment.offset) {
+      xb::error() << segment.path << " is truncated";
+      return (false);
+    }
+    segment.end_lsn =
+        segment.start_lsn +
+        ut_uint64_align_down(stat_info.st_size - segment.offset,
+                             OS_FILE_LOG_BLOCK_SIZE);
+    segments.push_back(segment);
+  }
+
+  std::sort(segments.begin(), segments.end(),
+            [](const archived_redo_segment_t &a,
+               const archived_redo_segment_t &b) {
+              return (a.start_lsn < b.start_lsn);
+            });
+
+  return (true);
+}
+
+/** Roll a full backup forward with the redo log archived by --archive-redo:
+the xtrabackup_logfile of the backup is continued with the archived redo log
+from the lsn the backup ends at up to --stop-at-lsn or the end of the
+archive. Must run before xtrabackup_init_temp_log().
+@return false on error */
+static bool xb_apply_archived_redo() {
+  if (!xtrabackup_decompress_temp_log(xtrabackup_target_dir)) {
+    return (false);
+  }
+
+  char path[FN_REFLEN];
+  snprintf(path, sizeof(path), "%s/%s", xtrabackup_target_dir,
+           XB_LOG_FILENAME);
+
+  File fd = my_open(path, O_RDWR, MYF(MY_WME));
+  if (fd < 0) {
+    xb::error() << "--apply-archived-redo must run before the redo log of "
+                << "the backup is applied";
+    return (false);
+  }
+
+  bool success = false;
+  byte hdr[LOG_FILE_HDR_SIZE];
+  std::vector<archived_redo_segment_t> segments;
+  std::vector<byte> buf(1024 * 1024);
+  lsn_t log_start_lsn;
+  lsn_t log_end_lsn;
+  lsn_t lsn;
+  lsn_t end_lsn;
+  MY_STAT stat_info;
+
+  if (my_fstat(fd, &stat_info) != 0 ||
+      my_read(fd, hdr, sizeof(hdr), MYF(MY_WME | MY_NABP)) != 0) {
+    goto cleanup;
+  }
+
+  if (ut_memcmp(hdr + LOG_HEADER_CREATOR, (byte *)LOG_HEADER_CREATOR_PXB,
+                (sizeof LOG_HEADER_CREATOR_PXB) - 1) != 0) {
+    xb::error() << "xtrabackup_logfile was already used to '--prepare', "
+                << "the archived redo log cannot be applied anymore";
+    goto cleanup;
+  }
+
+  log_start_lsn = ut_uint64_align_down(xb_log_header_checkpoint_lsn(hdr),
+                                       OS_FILE_LOG_BLOCK_SIZE);
+  if (log_start_lsn == 0) {
+    xb::error() << "No valid checkpoint found in " << path;
+    goto cleanup;
+  }
+  log_end_lsn = log_start_lsn + stat_info.st_size - LOG_FILE_HDR_SIZE;
+
+  /* the last block of the backup is incomplete, it is taken from the
+  archive */
+  lsn = ut_uint64_align_down(
+      metadata_last_lsn > 0 ? std::min(metadata_last_lsn, log_end_lsn)
+                            : log_end_lsn,
+      OS_FILE_LOG_BLOCK_SIZE);
+  lsn = std::max(lsn, log_start_lsn);
+
+  if (!xb_archived_redo_segments(opt_apply_archived_redo,
+                                 mach_read_from_4(hdr + LOG_HEADER_FORMAT),
+                                 segments)) {
+    goto cleanup;
+  }
+  if (segments.empty()) {
+    xb::error() << "no archived redo log found in " << opt_apply_archived_redo;
+    goto cleanup;
+  }
+
+  end_lsn = xtrabackup_stop_at_lsn != 0 ? xtrabackup_stop_at_lsn
+                                        : segments.back().end_lsn;
+  if (end_lsn <= metadata_last_lsn) {
+    xb::error() << "the backup already ends at lsn " << metadata_last_lsn
+                << ", beyond lsn " << end_lsn;
+    goto cleanup;
+  }
+
+  xb::info() << "Rolling the backup forward from lsn " << metadata_last_lsn
+             << " to lsn " << end_lsn << " with the redo log archived in "
+             << opt_apply_archived_redo;
+
+  for (const auto &segment : segments) {
+    if (lsn >= end_lsn) {
+      break;
+    }
+    if (segment.end_lsn <= lsn) {
+      continue;
+    }
+    if (segment.start_lsn > lsn) {
+      xb::error() << "the archived redo log has no redo log from lsn " << lsn
+                  << ", the next segment " << segment.path
+                  << " starts at lsn " << segment.start_lsn;
+      goto cleanup;
+    }
+
+    File seg_fd = my_open(segment.path.c_str(), O_RDONLY, MYF(MY_WME));
+    if (seg_fd < 0) {
+      goto cleanup;
+    }
+
+    while (lsn < std::min(segment.end_lsn, end_lsn)) {
+      const size_t len = std::min<lsn_t>(
+          buf.size(), ut_uint64_align_up(std::min(segment.end_lsn, end_lsn),
+                                         OS_FILE_LOG_BLOCK_SIZE) -
+                          lsn);
+      if (my_pread(seg_fd, buf.data(), len,
+                   segment.offset + (lsn - segment.start_lsn),
+                   MYF(MY_WME | MY_NABP)) != 0) {
+        my_close(seg_fd, MYF(MY_WME));
+        goto cleanup;
+      }
+
+      for (size_t block = 0; block < len; block += OS_FILE_LOG_BLOCK_SIZE) {
+        if (log_block_get_hdr_no(buf.data() + block) !=
+            log_block_convert_lsn_to_hdr_no(lsn + block)) {
+          xb::error() << segment.path << " does not contain the redo log "
+                      << "block of lsn " << lsn + block
+                      << ", it is not archived from the server of the backup";
+          my_close(seg_fd, MYF(MY_WME));
+          goto cleanup;
+        }
+      }
+
+      if (my_pwrite(fd, buf.data(), len,
+                    LOG_FILE_HDR_SIZE + (lsn - log_start_lsn),
+                    MYF(MY_WME | MY_NABP)) != 0) {
+        my_close(seg_fd, MYF(MY_WME));
+        goto cleanup;
+      }
+      lsn += len;
+    }
+
+    my_close(seg_fd, MYF(MY_WME));
+  }
 
-  FILE *file = fopen(name, "w+b");
+  if (lsn < end_lsn) {
+    xb::error() << "the archived redo log ends at lsn " << lsn
+                << ", before lsn " << end_lsn;
+    goto cleanup;
+  }
 
-  if (file == NULL) {
-    xb::error() << "Can't create file " << SQUOTE(name) << " (errno: " << errno
-                << " - " << strerror(errno) << ")";
+  /* end the redo log at end_lsn: recovery stops at the first incomplete
+  block, a mini-transaction crossing end_lsn is not applied. The checksum of
+  an encrypted block covers its encrypted data, it is cut whole then. */
+  if (end_lsn % OS_FILE_LOG_BLOCK_SIZE != 0) {
+    byte *block = buf.data();
+    const lsn_t block_lsn =
+        ut_uint64_align_down(end_lsn, OS_FILE_LOG_BLOCK_SIZE);
+    const os_offset_t offset = LOG_FILE_HDR_SIZE + (block_lsn - log_start_lsn);
+    if (my_pread(fd, block, OS_FILE_LOG_BLOCK_SIZE, offset,
+                 MYF(MY_WME | MY_NABP)) != 0) {
+      goto cleanup;
+    }
+    if (log_block_get_checksum(block) ==
+        log_block_calc_checksum_crc32(block)) {
+      const uint32_t data_len = std::max<uint32_t>(
+          end_lsn % OS_FILE_LOG_BLOCK_SIZE, LOG_BLOCK_HDR_SIZE);
+      if (data_len < log_block_get_data_len(block)) {
+        log_block_set_data_len(block, data_len);
+      }
+      if (log_block_get_first_rec_group(block) > data_len) {
+        log_block_set_first_rec_group(block, 0);
+      }
+      log_block_set_checksum(block, log_block_calc_checksum_crc32(block));
+      if (my_pwrite(fd, block, OS_FILE_LOG_BLOCK_SIZE, offset,
+                    MYF(MY_WME | MY_NABP)) != 0) {
+        goto cleanup;
+      }
+      lsn = block_lsn + OS_FILE_LOG_BLOCK_SIZE;
+    } else {
+      xb::info() << "The redo log block of lsn " << end_lsn
+                 << " is encrypted, the backup is rolled forward up to lsn "
+                 << block_lsn << " only";
+      end_lsn = block_lsn;
+      lsn = block_lsn;
+    }
+  }
 
-    err = DB_IO_ERROR;
-  } else {
-    err = xb_export_write_transfer_key(space->m_encryption_metadata, file);
+  if (my_chsize(fd, LOG_FILE_HDR_SIZE + (lsn - log_start_lsn), 0,
+                MYF(MY_WME)) != 0 ||
+      my_sync(fd, MYF(MY_WME)) != 0) {
+    goto cleanup;
+  }
 
-    if (fflush(file) != 0) {
-      char buf[BUFSIZ];
+  metadata_last_lsn = end_lsn;
+  snprintf(path, sizeof(path), "%s/%s", xtrabackup_target_dir,
+           XTRABACKUP_METADATA_FILENAME);
+  if (!xtrabackup_write_metadata(path)) {
+    xb::error() << "failed to write metadata to " << path;
+    goto cleanup;
+  }
 
-      snprintf(buf, sizeof(buf), "%s flush() failed", name);
+  xb::info() << "The backup is rolled forward to lsn " << end_lsn
+             << ", the binary log coordinates of the backup are those of "
+             << "its end, before the roll forward";
+  success = true;
 
-      xb::error() << "IO Write error: (" << errno << ", " << strerror(errno)
-                  << ") " << buf;
+cleanup:
+  my_close(fd, MYF(MY_WME));
 
-      err = DB_IO_ERROR;
-    }
+  return (success);
+}
 
-    if (fclose(file) != 0) {
-      char buf[BUFSIZ];
+/** Find the checkpoint lsn written at the end of --prepare, in the copy of
+the redo log or in the redo log files created by the prepare.
+@param[in]  dir  backup directory
+@return newest checkpoint lsn, 0 if no checkpoint is valid */
+static lsn_t xb_prepared_checkpoint_lsn(const char *dir) {
+  std::vector<std::string> paths;
+  paths.push_back(std::string(dir) + "/" + XB_LOG_FILENAME);
 
-      snprintf(buf, sizeof(buf), "%s flose() failed", name);
+  const std::string redo_dir = std::string(dir) + "/" + LOG_DIRECTORY_NAME;
+  if (file_exists(redo_dir.c_str())) {
+    os_file_scan_directory(
+        redo_dir.c_str(),
+        [&paths, &redo_dir](const char *, const char *name) {
+          if (strncmp(name, LOG_FILE_BASE_NAME, strlen(LOG_FILE_BASE_NAME)) ==
+                  0 &&
+              !file_has_suffix("_tmp", name)) {
+            paths.push_back(redo_dir + "/" + name);
+          }
+        },
+        false);
+  }
 
-      xb::error() << "IO Write error: (" << errno << ", " << strerror(errno)
-                  << ") " << buf;
-      err = DB_IO_ERROR;
+  lsn_t checkpoint_lsn = 0;
+  byte hdr[LOG_FILE_HDR_SIZE];
+  for (const auto &path : paths) {
+    File fd = my_open(path.c_str(), O_RDONLY, MYF(0));
+    if (fd < 0) {
+      continue;
+    }
+    if (my_pread(fd, hdr, sizeof(hdr), 0, MYF(MY_NABP)) == 0) {
+      checkpoint_lsn =
+          std::max(checkpoint_lsn, xb_log_header_checkpoint_lsn(hdr));
     }
+    my_close(fd, MYF(MY_WME));
   }
 
-  return (err);
-}
-
-static void innodb_free_param() {
-  srv_sys_space.shutdown();
-  srv_tmp_space.shutdown();
-  free(internal_innobase_data_file_path);
-  internal_innobase_data_file_path = NULL;
-  free_tmpdir(&mysql_tmpdir_list);
-  ibt::srv_temp_dir = srv_temp_dir;
+  return (checkpoint_lsn);
 }
 
-static void read_metadata() {
-  char metadata_path[FN_REFLEN];
-  char xtrabackup_info_path[FN_REFLEN];
+/** Verify the tablespaces of a prepared backup for --verify. Exits on
+error. */
+static void xtrabackup_verify_func() {
+  read_metadata();
 
-  /* cd to target-dir */
-  if (my_setwd(xtrabackup_real_target_dir, MYF(MY_WME))) {
-    xb::error() << "cannot my_setwd " << xtrabackup_real_target_dir;
+  if (strcmp(metadata_type_str, "full-prepared") != 0) {
+    xb::error() << "--verify needs a backup prepared without "
+                << "--apply-log-only, the backup type of "
+                << xtrabackup_real_target_dir << " is " << metadata_type_str;
     exit(EXIT_FAILURE);
   }
-  xb::info() << "cd to " << xtrabackup_real_target_dir;
 
-  xtrabackup_target_dir = mysql_data_home_buff;
-  xtrabackup_target_dir[0] = FN_CURLIB;  // all paths are relative from here
-  xtrabackup_target_dir[1] = 0;
+  /* the system tablespace and the doublewrite buffer use the page size of
+  the server, read from backup-my.cnf */
+  srv_page_size_shift = innodb_page_size_validate(innobase_page_size);
+  if (!srv_page_size_shift) {
+    xb::error() << "Invalid page size=" << innobase_page_size;
+    exit(EXIT_FAILURE);
+  }
+  srv_page_size = innobase_page_size;
+  univ_page_size.copy_from(page_size_t(srv_page_size, srv_page_size, false));
 
-  sprintf(metadata_path, "%s/%s", xtrabackup_target_dir,
-          XTRABACKUP_METADATA_FILENAME);
+  ut_crc32_init();
 
-  if (!xtrabackup_read_metadata(metadata_path)) {
-    xb::error() << "failed to read metadata from " << SQUOTE(metadata_path);
-    exit(EXIT_FAILURE);
+  lsn_t checkpoint_lsn = xb_prepared_checkpoint_lsn(xtrabackup_target_dir);
+  if (checkpoint_lsn == 0) {
+    checkpoint_lsn = std::max(metadata_to_lsn, metadata_last_lsn);
+    xb::warn() << "no valid checkpoint found in the redo log of the backup, "
+               << "checking the page LSNs against the last lsn "
+               << checkpoint_lsn << " of the backup";
   }
-  /* read xtrabackup_info file to read server version and version of
-   * xtrabackup used during backup */
-  sprintf(xtrabackup_info_path, "%s/%s", xtrabackup_target_dir,
-          XTRABACKUP_INFO);
 
-  if (!xtrabackup_read_info(xtrabackup_info_path)) {
-    xb::error() << "Failed to parse xtrabackup_info from "
-                << SQUOTE(xtrabackup_info_path);
+  if (!xb::verify::run(xtrabackup_target_dir, checkpoint_lsn,
+                       xtrabackup_parallel)) {
+    xb::error() << "verification of " << xtrabackup_real_target_dir
+                << " failed";
     exit(EXIT_FAILURE);
   }
 }
@@ -6804,6 +11661,30 @@ static void xtrabackup_prepare_func(int argc, char **argv) {
   fil_node_t *node;
   fil_space_t *space;
   IORequest write_request(IORequest::WRITE);
+  char fast_prepare_path[FN_REFLEN];
+  uint64_t benchmark_log_bytes = 0;
+  uint64_t benchmark_apply_usecs = 0;
+
+  if (opt_apply_benchmark_dir != nullptr) {
+    /* the clone is prepared, the backup stays the snapshot to replay */
+    if (!xb::apply_benchmark::clone(xtrabackup_real_target_dir,
+                                    opt_apply_benchmark_dir)) {
+      exit(EXIT_FAILURE);
+    }
+    snprintf(xtrabackup_real_target_dir, sizeof(xtrabackup_real_target_dir),
+             "%s", opt_apply_benchmark_dir);
+    xtrabackup_target_dir = xtrabackup_real_target_dir;
+    xtrabackup_apply_log_only = true;
+  }
+
+  snprintf(fast_prepare_path, sizeof(fast_prepare_path), "%s/%s",
+           xtrabackup_target_dir, XB_FAST_PREPARE_FILENAME);
+  if (file_exists(fast_prepare_path)) {
+    xb::error() << "A --fast-prepare of " << SQUOTE(xtrabackup_target_dir)
+                << " was interrupted and left its files in an unknown state. "
+                   "Restore the backup from a copy and prepare it again.";
+    exit(EXIT_FAILURE);
+  }
 
   read_metadata();
 
@@ -6841,6 +11722,13 @@ skip_check:
     backup_redo_log_flushed_lsn = incremental_flushed_lsn;
   }
 
+  if (opt_apply_benchmark_dir != nullptr) {
+    MY_STAT stat_info;
+    if (my_stat(XB_LOG_FILENAME, &stat_info, MYF(0)) != nullptr) {
+      benchmark_log_bytes = stat_info.st_size;
+    }
+  }
+
   init_mysql_environment();
   my_thread_init();
   THD *thd = create_internal_thd();
@@ -6865,12 +11753,30 @@ skip_check:
 
   xb_filters_init();
 
+  if (opt_apply_archived_redo != nullptr && !xb_apply_archived_redo()) {
+    goto error_cleanup;
+  }
+
   if (xtrabackup_init_temp_log()) goto error_cleanup;
 
   if (innodb_init_param()) {
     goto error_cleanup;
   }
 
+  if (xtrabackup_fast_prepare) {
+    /* created before the first write, removed after the last sync */
+    File fd = my_create(fast_prepare_path, 0, O_WRONLY, MYF(MY_WME));
+    if (fd < 0 || my_sync(fd, MYF(MY_WME)) != 0) {
+      goto error_cleanup;
+    }
+    my_close(fd, MYF(MY_WME));
+
+#ifndef _WIN32
+    srv_unix_file_flush_method = SRV_UNIX_NOSYNC;
+#endif
+    xb::info() << "Files are synced once at the end of --fast-prepare.";
+  }
+
   if (opt_transition_key && !xb_tablespace_keys_exist()) {
     xb::error() << "--transition-key specified, but "
                    "xtrabackup_keys is not found.";
@@ -6969,8 +11875,25 @@ skip_check:
              << ((estimate_memory) ? "--use-free-memory-pct" : "--use-memory")
              << " parameter)";
 
-  if (innodb_init(true, true)) {
-    goto error_cleanup;
+  {
+    xb::report::Phase recovery_phase("recovery");
+    const auto recovery_start = std::chrono::steady_clock::now();
+    if (innodb_init(true, true)) {
+      goto error_cleanup;
+    }
+    benchmark_apply_usecs =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - recovery_start)
+            .count();
+  }
+
+  if (opt_apply_benchmark_dir != nullptr) {
+    xb::apply_benchmark::print(benchmark_log_bytes, benchmark_apply_usecs);
+  }
+
+  if (estimate_memory) {
+    xb::info() << "Applied the redo log in " << xb_recv_applied_batches
+               << " batch(es), " << xb_recv_planned_batches << " planned";
   }
 
   it = datafiles_iter_new(nullptr);
@@ -7019,53 +11942,21 @@ skip_check:
     /* flush insert buffer at shutdwon */
     innobase_fast_shutdown = 0;
 
-    it = datafiles_iter_new(nullptr);
-    if (it == NULL) {
-      xb::error() << "datafiles_iter_new() "
-                     "failed.";
-      exit(EXIT_FAILURE);
+    /* the modification times of the .ibd files tell which tablespaces
+    changed only once the pages changed by this prepare are written */
+    if (opt_export_changed_only) {
+      buf_flush_sync_all_buf_pools();
     }
 
-    while ((node = datafiles_iter_next(it)) != NULL) {
-      space = node->space;
-
-      /* treat file_per_table only */
-      if (!fsp_is_file_per_table(space->id, space->flags)) {
-        continue;
-      }
-
-      auto result = xb::prepare::dict_load_from_spaces_sdi(space->id);
-      dberr_t err = std::get<0>(result);
-      auto table_vec = std::get<1>(result);
-      if (err != DB_SUCCESS) {
-        xb::error() << "cannot find dictionary record of table " << space->name;
-        ut_ad(table_vec.empty());
-        continue;
-      }
-
-      // It is possible that partition IBD has multiple tables
-      for (auto table : table_vec) {
-        mutex_enter(&(dict_sys->mutex));
-        /* Write transfer key for tablespace file */
-        fil_space_t *sp = fil_space_get(table->space);
-        if (!xb_export_cfp_write(table)) {
-          goto next_node;
-        }
-
-        /* Write MySQL 8.0 .cfg file */
-        if (!xb_export_cfg_write(&sp->files[0], table)) {
-          goto next_node;
-        }
-
-      next_node:
-        if (table != nullptr) {
-          dd_table_close(table, thd, nullptr, true);
-        }
-        mutex_exit(&(dict_sys->mutex));
-      }
+    xb::report::Phase export_phase("export");
+    if (!xb_export_tables(thd)) {
+      exit(EXIT_FAILURE);
     }
 
-    datafiles_iter_free(it);
+    if (opt_export_changed_only) {
+      xb::info() << "Kept the export metadata of " << xb_export_kept.load()
+                 << " tablespaces unchanged since the previous export";
+    }
   }
 
   /* Check whether the log is applied enough or not. */
@@ -7084,7 +11975,10 @@ skip_check:
 
   xb_write_galera_info(xtrabackup_incremental);
 
-  if (innodb_end()) goto error_cleanup;
+  {
+    xb::report::Phase shutdown_phase("shutdown");
+    if (innodb_end()) goto error_cleanup;
+  }
 
   innodb_free_param();
 
@@ -7130,10 +12024,24 @@ skip_check:
     }
   }
 
+  if (!xb_prepare_file_checksums()) {
+    xb::error() << "failed to update " << xb::file_checksums::FILENAME;
+    exit(EXIT_FAILURE);
+  }
+
   if (!apply_log_finish()) {
     exit(EXIT_FAILURE);
   }
 
+  if (xtrabackup_fast_prepare) {
+    if (!xb_sync_target_dir()) {
+      exit(EXIT_FAILURE);
+    }
+    if (my_delete(fast_prepare_path, MYF(MY_WME))) {
+      exit(EXIT_FAILURE);
+    }
+  }
+
   trx_pool_close();
 
   fil_close();
@@ -7149,6 +12057,10 @@ skip_check:
   my_thread_end();
   Tablespace_map::instance().serialize();
 
+  if (!xb::report::write(XTRABACKUP_PREPARE_REPORT)) {
+    exit(EXIT_FAILURE);
+  }
+
   cleanup_mysql_environment();
 
   xb_filters_free();
@@ -7170,6 +12082,119 @@ error_cleanup:
   exit(EXIT_FAILURE);
 }
 
+/* set by SIGHUP, the --daemon-interval scheduler takes a backup right away */
+static volatile sig_atomic_t daemon_backup_requested = 0;
+
+/* set by SIGTERM and SIGINT, the scheduler stops after the running backup */
+static volatile sig_atomic_t daemon_stop_requested = 0;
+
+static void daemon_sighup_handler(int sig __attribute__((unused))) {
+  daemon_backup_requested = 1;
+}
+
+static void daemon_sigterm_handler(int sig __attribute__((unused))) {
+  daemon_stop_requested = 1;
+}
+
+/** Take a backup every --daemon-interval seconds and on SIGHUP. Every backup
+runs in a child process, forked before anything is initialized, which takes
+an incremental backup on top of the previous successful one into a new
+subdirectory of --target-dir. Returns in the child processes only, the
+scheduler exits once stopped by SIGTERM or SIGINT. */
+static void xb_daemon_run() {
+  if (!xtrabackup_backup) {
+    xb::error() << "--daemon-interval requires --backup";
+    exit(EXIT_FAILURE);
+  }
+
+  if (xtrabackup_stream || xtrabackup_incremental != nullptr ||
+      opt_incremental_history_name != nullptr ||
+      opt_incremental_history_uuid != nullptr) {
+    xb::error() << "--daemon-interval cannot be used with --stream, "
+                << "--incremental-lsn or --incremental-history-*, the "
+                << "backups are taken into --target-dir on top of each other";
+    exit(EXIT_FAILURE);
+  }
+
+  std::string basedir = xtrabackup_incremental_basedir != nullptr
+                            ? xtrabackup_incremental_basedir
+                            : "";
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = daemon_sighup_handler;
+  sigaction(SIGHUP, &sa, nullptr);
+  sa.sa_handler = daemon_sigterm_handler;
+  sigaction(SIGTERM, &sa, nullptr);
+  sigaction(SIGINT, &sa, nullptr);
+
+  xb::info() << "Taking a backup into " << xtrabackup_target_dir << " every "
+             << opt_daemon_interval << " seconds and on SIGHUP";
+
+  while (!daemon_stop_requested) {
+    char name[32];
+    const time_t now = time(nullptr);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(name, sizeof(name), "%Y-%m-%d_%H-%M-%S", &tm);
+    const std::string dir = std::string(xtrabackup_target_dir) + name;
+
+    daemon_backup_requested = 0;
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+      xb::error() << "fork() failed with errno = " << errno;
+      exit(EXIT_FAILURE);
+    }
+
+    if (pid == 0) {
+      signal(SIGHUP, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      signal(SIGINT, SIG_DFL);
+
+      strmake(xtrabackup_real_target_dir, dir.c_str(),
+              sizeof(xtrabackup_real_target_dir) - 1);
+      xtrabackup_target_dir = xtrabackup_real_target_dir;
+      if (basedir.empty()) {
+        xtrabackup_incremental_basedir = nullptr;
+      } else {
+        strmake(xtrabackup_real_incremental_basedir, basedir.c_str(),
+                sizeof(xtrabackup_real_incremental_basedir) - 1);
+        xtrabackup_incremental_basedir = xtrabackup_real_incremental_basedir;
+      }
+      return;
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+      if (errno != EINTR) {
+        xb::error() << "waitpid() failed with errno = " << errno;
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+      xb::info() << (basedir.empty() ? "Full" : "Incremental")
+                 << " backup completed in " << dir;
+      basedir = dir;
+    } else {
+      xb::error() << "The backup in " << dir << " failed, the next one is "
+                  << "taken on top of "
+                  << (basedir.empty() ? "nothing" : basedir.c_str());
+    }
+
+    for (uint i = 0; i < opt_daemon_interval && !daemon_backup_requested &&
+                     !daemon_stop_requested;
+         i++) {
+      sleep(1);
+    }
+  }
+
+  xb::info() << "Backup scheduling stopped";
+  exit(EXIT_SUCCESS);
+}
+
 /**************************************************************************
 Signals-related setup. */
 static void setup_signals()
@@ -7225,6 +12250,27 @@ bool xb_init() {
 
   if (opt_no_lock || opt_no_backup_locks) opt_lock_ddl = false;
 
+  if (opt_archive_redo) {
+    if (!xtrabackup_backup || xtrabackup_incremental != nullptr ||
+        opt_snapshot_create_cmd != nullptr || opt_daemon_interval > 0 ||
+        opt_lock_ddl_per_table) {
+      xb::error() << "option --archive-redo requires --backup and cannot be "
+                  << "used with incremental backups, --snapshot-create-cmd, "
+                  << "--daemon-interval or --lock-ddl-per-table.";
+      return (false);
+    }
+    /* the archive runs for days, DDL cannot be blocked meanwhile */
+    opt_lock_ddl = false;
+    xtrabackup_register_redo_log_consumer = true;
+  }
+
+  if (opt_apply_archived_redo != nullptr &&
+      (!xtrabackup_prepare || xtrabackup_incremental != nullptr)) {
+    xb::error() << "option --apply-archived-redo requires --prepare of a "
+                << "full backup.";
+    return (false);
+  }
+
   /* sanity checks */
   if (opt_lock_ddl && opt_lock_ddl_per_table) {
     xb::error()
@@ -7251,6 +12297,33 @@ bool xb_init() {
     return (false);
   }
 
+  if (opt_reencrypt_tablespaces && xtrabackup_backup) {
+    if (!opt_transition_key && !opt_generate_transition_key) {
+      xb::error() << "option --reencrypt-tablespaces requires "
+                  << "--transition-key or --generate-transition-key.";
+      return (false);
+    }
+    if (xtrabackup_incremental) {
+      xb::error() << "option --reencrypt-tablespaces cannot be used with "
+                  << "incremental backups.";
+      return (false);
+    }
+  }
+
+  if ((opt_snapshot_create_cmd != nullptr) != (opt_snapshot_dir != nullptr)) {
+    xb::error() << "options --snapshot-create-cmd and --snapshot-dir must be "
+                << "used together.";
+    return (false);
+  }
+
+  if (opt_snapshot_create_cmd != nullptr && xtrabackup_backup &&
+      !opt_lock_ddl) {
+    xb::error() << "option --snapshot-create-cmd requires --lock-ddl, the "
+                << "tablespaces must not change until the snapshot is "
+                << "created.";
+    return (false);
+  }
+
   n_mixed_options = 0;
 
   if (opt_decompress) {
@@ -7670,6 +12743,10 @@ static void handle_options(int argc, char **argv, int *argc_client,
       prepare = true;
     }
 
+    if (!strncmp(argv[i], "--verify", optend - argv[i])) {
+      prepare = true;
+    }
+
     if (!strncmp(argv[i], "--target-dir", optend - argv[i]) && *optend) {
       target_dir = optend + 1;
     }
@@ -7796,6 +12873,39 @@ void xb_set_plugin_dir() {
 
 /* ================= main =================== */
 
+/** Set the thread counts not given explicitly from the number of CPUs the
+process can use, for --auto-threads. Compression and encryption are CPU
+bound, while the copy threads mostly wait for reads, so the copy threads get
+a quarter of the CPUs when the data is compressed or encrypted and the rest
+is shared by the compression and encryption threads. */
+static void xb_auto_threads() {
+  const uint n_cpus = xtrabackup::utils::host_cpu_count();
+  const bool compress = xtrabackup_compress != XTRABACKUP_COMPRESS_NONE;
+  const uint n_kinds = (compress ? 1 : 0) + (xtrabackup_encrypt ? 1 : 0);
+
+  if (!xtrabackup_parallel_set) {
+    xtrabackup_parallel = n_kinds == 0 ? n_cpus : std::max(1U, n_cpus / 4);
+  }
+
+  const uint n_left =
+      n_cpus > static_cast<uint>(xtrabackup_parallel)
+          ? n_cpus - xtrabackup_parallel
+          : 1;
+  const uint n_each = std::max(1U, n_left / std::max(1U, n_kinds));
+
+  if (compress && !xtrabackup_compress_threads_set) {
+    xtrabackup_compress_threads = n_each;
+  }
+  if (xtrabackup_encrypt && !xtrabackup_encrypt_threads_set) {
+    xtrabackup_encrypt_threads = n_each;
+  }
+
+  xb::info() << "--auto-threads: " << n_cpus << " CPUs available, using "
+             << "--parallel=" << xtrabackup_parallel
+             << " --compress-threads=" << xtrabackup_compress_threads
+             << " --encrypt-threads=" << xtrabackup_encrypt_threads;
+}
+
 int main(int argc, char **argv) {
   char **client_defaults, **server_defaults;
   int client_argc, server_argc;
@@ -7807,8 +12917,8 @@ int main(int argc, char **argv) {
   /* Logs xtrabackup generated timestamps in local timezone instead of UTC */
   opt_log_timestamps = 1;
   /* This variable determines the size of dict_table_t* cache in InnoDB. This is
-  default and it is sufficient because rollback is single threaded and we only
-  open tables one by one */
+  default and it is sufficient because each rollback thread only opens tables
+  one by one */
   table_def_size = 4000;
 
   setup_signals();
@@ -7857,6 +12967,10 @@ int main(int argc, char **argv) {
     exit(EXIT_FAILURE);
   }
 
+  if (opt_auto_threads) {
+    xb_auto_threads();
+  }
+
   if (xtrabackup_fifo_streams_set && xtrabackup_fifo_dir == NULL &&
       strcmp(xtrabackup_target_dir, "./xtrabackup_backupfiles/") == 0) {
     xb::error() << "Option --fifo-streams requires --fifo-dir to be set.";
@@ -7893,6 +13007,10 @@ int main(int argc, char **argv) {
     xtrabackup_extra_lsndir = xtrabackup_real_extra_lsndir;
   }
 
+  if (opt_daemon_interval > 0) {
+    xb_daemon_run();
+  }
+
   /* get default temporary directory */
   if (!opt_mysql_tmpdir || !opt_mysql_tmpdir[0]) {
     opt_mysql_tmpdir = getenv("TMPDIR");
@@ -7937,6 +13055,13 @@ int main(int argc, char **argv) {
       exit(EXIT_FAILURE);
     }
 
+    if (metadata_reencrypted) {
+      xb::error() << xtrabackup_incremental_basedir << " was taken with "
+                  << "--reencrypt-tablespaces, it cannot be the base of an "
+                  << "incremental backup.";
+      exit(EXIT_FAILURE);
+    }
+
     incremental_lsn = metadata_to_lsn;
     xtrabackup_incremental = xtrabackup_incremental_basedir;  // dummy
   } else if (xtrabackup_prepare && xtrabackup_incremental_dir) {
@@ -7993,6 +13118,38 @@ int main(int argc, char **argv) {
     xb::warn() << "--throttle has effect only with --backup";
   }
 
+  if (opt_throttle_rate && !xtrabackup_backup) {
+    opt_throttle_rate = 0;
+    xb::warn() << "--throttle-rate has effect only with --backup";
+  }
+
+  if (opt_throttle_group != nullptr && opt_throttle_rate == 0) {
+    xb::warn() << "--throttle-group has effect only with --throttle-rate";
+  }
+
+  if (opt_adaptive_throttle && !xtrabackup_backup) {
+    opt_adaptive_throttle = false;
+    xb::warn() << "--adaptive-throttle has effect only with --backup";
+  }
+
+  if (opt_backup_plan && !xtrabackup_backup) {
+    xb::error() << "--plan requires --backup";
+    exit(EXIT_FAILURE);
+  }
+
+  if (opt_apply_benchmark_dir != nullptr && !xtrabackup_prepare) {
+    xb::error() << "--apply-benchmark-dir requires --prepare";
+    exit(EXIT_FAILURE);
+  }
+
+  if (opt_stats_sample_pages > 0 && !xtrabackup_stats) {
+    xb::warn() << "--stats-sample-pages has effect only with --stats";
+  }
+
+  if (opt_export_changed_only && !xtrabackup_export) {
+    xb::warn() << "--export-changed-only has effect only with --export";
+  }
+
   /* cannot execute both for now */
   {
     int num = 0;
@@ -8003,6 +13160,7 @@ int main(int argc, char **argv) {
     if (xtrabackup_copy_back) num++;
     if (xtrabackup_move_back) num++;
     if (xtrabackup_decrypt_decompress) num++;
+    if (xtrabackup_verify) num++;
     if (num != 1) { /* !XOR (for now) */
       usage();
       exit(EXIT_FAILURE);
@@ -8023,6 +13181,7 @@ int main(int argc, char **argv) {
 
 #ifndef __WIN__
   signal(SIGCONT, sigcont_handler);
+  signal(SIGUSR1, sigusr1_handler);
 #endif
 
   /* --backup */
@@ -8048,7 +13207,42 @@ int main(int argc, char **argv) {
 
     /* abort backup  if target is not prepared */
     read_metadata();
-    if (strcmp(metadata_type_str, "full-prepared") != 0) {
+    if (metadata_reencrypted && !opt_generate_new_master_key) {
+      /* the headers of the tablespaces still have the keys of the source
+      server */
+      xb::error() << "the backup was taken with --reencrypt-tablespaces, "
+                  << "it must be restored with --generate-new-master-key.";
+      exit(EXIT_FAILURE);
+    }
+    if (xtrabackup_incremental_dir != nullptr) {
+      /* the incremental backup is overlaid while copying back the full
+      backup, which must be ready to take it */
+      char filename[FN_REFLEN];
+      const lsn_t to_lsn = metadata_to_lsn;
+
+      if (!xtrabackup_copy_back ||
+          strcmp(metadata_type_str, "log-applied") != 0) {
+        xb::error() << "Option --incremental-dir needs --copy-back and the "
+                       "target prepared with --apply-log-only";
+        exit(EXIT_FAILURE);
+      }
+
+      snprintf(filename, sizeof(filename), "%s/%s",
+               xtrabackup_incremental_dir, XTRABACKUP_METADATA_FILENAME);
+      if (!xtrabackup_read_metadata(filename)) {
+        xb::error() << "failed to read metadata from " << filename;
+        exit(EXIT_FAILURE);
+      }
+
+      if (strcmp(metadata_type_str, "incremental") != 0 ||
+          metadata_from_lsn != to_lsn) {
+        xb::error() << "This incremental backup seems not to be proper for "
+                       "the target.";
+        xb::error() << "Check 'to_lsn' of the target and 'from_lsn' of the "
+                       "incremental.";
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(metadata_type_str, "full-prepared") != 0) {
       xb::error() << "The target is not fully prepared. Please prepare it "
                      "without option --apply-log-only";
       exit(EXIT_FAILURE);
@@ -8059,12 +13253,35 @@ int main(int argc, char **argv) {
       exit(EXIT_FAILURE);
     }
     cleanup_mysql_environment();
+
+    if (xtrabackup_incremental_dir != nullptr) {
+      /* the datadir holds a full backup now, with the redo log of the
+      incremental backup left to apply */
+      char filename[FN_REFLEN];
+
+      strcpy(metadata_type_str, "full-backuped");
+      metadata_from_lsn = 0;
+      snprintf(filename, sizeof(filename), "%s/%s", mysql_data_home,
+               XTRABACKUP_METADATA_FILENAME);
+      if (!xtrabackup_write_metadata(filename)) {
+        xb::error() << "failed to write metadata to " << filename;
+        exit(EXIT_FAILURE);
+      }
+
+      xb::info() << "Run --prepare with --target-dir=" << mysql_data_home
+                 << " to apply the redo log of the incremental backup";
+    }
   }
 
   if (xtrabackup_decrypt_decompress && !decrypt_decompress()) {
     exit(EXIT_FAILURE);
   }
 
+  /* --verify */
+  if (xtrabackup_verify) {
+    xtrabackup_verify_func();
+  }
+
   backup_cleanup();
 
   xb_regex_end();
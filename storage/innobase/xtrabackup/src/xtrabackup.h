@@ -22,6 +22,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #define XB_XTRABACKUP_H
 
 #include <my_getopt.h>
+#include <atomic>
+#include <map>
 #include "changed_page_tracking.h"
 #include "datasink.h"
 #include "mysql.h"
@@ -32,6 +34,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 #define XB_LOG_FILENAME "xtrabackup_logfile"
 
+/* present in the target directory while --fast-prepare writes it */
+#define XB_FAST_PREPARE_FILENAME "xtrabackup_fast_prepare"
+
 #ifdef __WIN__
 #define XB_FILE_UNDEFINED {NULL};
 #else
@@ -52,9 +57,19 @@ typedef struct {
 } xb_delta_info_t;
 
 /* ======== Datafiles iterator ======== */
+struct datafile_split_t;
+
 typedef struct {
   std::vector<fil_node_t *> nodes;
   std::vector<fil_node_t *>::iterator i;
+  std::vector<datafile_split_t *> splits; /*!< datafiles with ranges
+                                          left for idle threads */
+  std::map<const fil_node_t *, dev_t> devs; /*!< device of every datafile,
+                                            with --parallel-per-device */
+  std::map<dev_t, uint> dev_active;       /*!< datafiles being copied
+                                          from every device */
+  os_event_t dev_released;                /*!< set when a datafile copy
+                                          releases its device */
   ib_mutex_t mutex;
 } datafiles_iter_t;
 
@@ -73,6 +88,7 @@ extern char xtrabackup_real_target_dir[FN_REFLEN];
 extern char *xtrabackup_incremental_dir;
 extern char *xtrabackup_incremental_basedir;
 extern char *xtrabackup_redo_log_arch_dir;
+extern bool xtrabackup_redo_log_arch_only;
 extern char *innobase_data_home_dir;
 extern char *innobase_buffer_pool_filename;
 extern ds_ctxt_t *ds_meta;
@@ -87,11 +103,19 @@ extern char *xtrabackup_incremental;
 extern bool xtrabackup_incremental_force_scan;
 
 extern lsn_t metadata_from_lsn;
+extern lsn_t backup_start_checkpoint_lsn;
 extern lsn_t metadata_to_lsn;
 extern lsn_t metadata_last_lsn;
 
 extern xb_stream_fmt_t xtrabackup_stream_fmt;
 extern bool xtrabackup_stream;
+extern bool xtrabackup_stream_crc32c;
+extern bool xtrabackup_stream_index;
+extern ulonglong xtrabackup_stream_chunk_size;
+extern bool xtrabackup_stream_detect_holes;
+extern bool xtrabackup_stream_skip_checksum;
+extern char *xtrabackup_stream_fds;
+extern ulong xtrabackup_stream_balance;
 
 extern char *xtrabackup_tables;
 extern char *xtrabackup_tables_file;
@@ -105,8 +129,10 @@ extern bool xtrabackup_encrypt;
 
 extern bool xtrabackup_backup;
 extern bool xtrabackup_prepare;
+extern bool xtrabackup_verify;
 extern bool xtrabackup_stats;
 extern bool xtrabackup_apply_log_only;
+extern bool xtrabackup_fast_prepare;
 extern bool xtrabackup_copy_back;
 extern bool xtrabackup_move_back;
 extern bool xtrabackup_decrypt_decompress;
@@ -131,6 +157,7 @@ extern uint xtrabackup_compress_zstd_level;
 extern ulong xtrabackup_encrypt_algo;
 extern uint xtrabackup_encrypt_threads;
 extern ulonglong xtrabackup_encrypt_chunk_size;
+extern bool xtrabackup_encrypt_gcm;
 extern bool xtrabackup_export;
 extern char *xtrabackup_incremental_basedir;
 extern char *xtrabackup_extra_lsndir;
@@ -138,6 +165,15 @@ extern char *xtrabackup_incremental_dir;
 extern ulint xtrabackup_log_copy_interval;
 extern char *xtrabackup_stream_str;
 extern long xtrabackup_throttle;
+extern ulonglong opt_throttle_rate;
+extern bool opt_adaptive_throttle;
+extern uint opt_adaptive_throttle_interval;
+extern ulong opt_adaptive_throttle_max_pending_io;
+extern ulong opt_adaptive_throttle_max_history_length;
+extern uint opt_adaptive_throttle_max_checkpoint_age;
+/* number of copy threads allowed to copy datafiles, lowered by
+--adaptive-throttle */
+extern std::atomic<uint> xtrabackup_copy_threads_limit;
 extern longlong xtrabackup_use_memory;
 
 extern bool opt_galera_info;
@@ -146,13 +182,40 @@ extern bool opt_page_tracking;
 extern bool opt_no_lock;
 extern bool opt_safe_slave_backup;
 extern bool opt_rsync;
+extern bool opt_precopy_non_innodb;
 extern bool opt_force_non_empty_dirs;
+extern bool opt_reflink_only;
+extern uint opt_restore_progress_interval;
+extern char *opt_pitr_binlog_dir;
+extern char *opt_metrics_file;
+extern uint opt_metrics_interval;
+extern uint opt_redo_lag_warn_time;
+extern uint opt_redo_lag_abort_time;
+extern bool opt_backup_plan;
+extern ulonglong opt_max_memory;
+extern char *opt_trace_file;
+extern char *opt_apply_benchmark_dir;
+extern char *opt_snapshot_create_cmd;
+extern char *opt_snapshot_dir;
+extern char *opt_snapshot_remove_cmd;
+extern bool opt_archive_redo;
+extern ulonglong opt_archive_redo_segment_size;
+extern char *opt_apply_archived_redo;
+
+enum tablespace_discovery_t {
+  TABLESPACE_DISCOVERY_SCAN,
+  TABLESPACE_DISCOVERY_DICTIONARY
+};
+extern ulong opt_tablespace_discovery;
+extern ulong opt_stats_sample_pages;
+extern bool opt_export_changed_only;
 #ifdef HAVE_VERSION_CHECK
 extern bool opt_noversioncheck;
 #endif
 extern bool opt_no_backup_locks;
 extern bool opt_decompress;
 extern bool opt_remove_original;
+extern char *opt_decompress_dir;
 extern bool opt_no_tables_compatibility_check;
 
 extern char *opt_incremental_history_name;
@@ -196,6 +259,36 @@ extern const char *opt_history;
 extern bool opt_decrypt;
 
 extern uint opt_read_buffer_size;
+extern uint opt_read_buffer_max_size;
+extern uint opt_page_tracking_max_gap;
+extern uint opt_page_tracking_read_ahead;
+
+enum read_io_engine_t {
+  READ_IO_ENGINE_SYNC,
+  READ_IO_ENGINE_IO_URING,
+  READ_IO_ENGINE_THREAD
+};
+extern ulong opt_read_io_engine;
+extern uint opt_read_io_depth;
+
+enum source_read_mode_t {
+  SOURCE_READ_MODE_AUTO,
+  SOURCE_READ_MODE_DIRECT,
+  SOURCE_READ_MODE_BUFFERED
+};
+extern ulong opt_source_read_mode;
+extern ulonglong opt_datafile_split_size;
+extern uint opt_parallel_per_device;
+
+enum datafile_copy_order_t {
+  DATAFILE_COPY_ORDER_NATURAL,
+  DATAFILE_COPY_ORDER_LARGEST_FIRST,
+  DATAFILE_COPY_ORDER_TABLE
+};
+extern ulong opt_datafile_copy_order;
+extern ulonglong opt_small_datafile_size;
+extern bool opt_skip_free_extents;
+extern bool opt_sparse_zero_pages;
 
 extern char *opt_xtra_plugin_dir;
 extern char *server_plugin_dir;
@@ -203,6 +296,8 @@ extern char *opt_transition_key;
 extern char *opt_keyring_file_data;
 extern char *opt_component_keyring_config;
 extern bool opt_generate_transition_key;
+extern char *opt_transition_key_cache;
+extern bool opt_reencrypt_tablespaces;
 extern bool opt_generate_new_master_key;
 
 extern uint opt_dump_innodb_buffer_pool_timeout;
@@ -238,6 +333,23 @@ enum binlog_info_enum {
 void xtrabackup_io_throttling(void);
 bool xb_write_delta_metadata(const char *filename, const xb_delta_info_t *info);
 
+/** Read meta info for an incremental delta.
+@param[in]  filepath  path of the .meta file
+@param[out] info      delta info
+@return true on success, false on failure. */
+bool xb_read_delta_metadata(const char *filepath, xb_delta_info_t *info);
+
+/** pages of a .delta file as (page number, offset in the .delta file) */
+typedef std::vector<std::pair<page_no_t, os_offset_t>> xb_delta_page_map_t;
+
+/** Read the cluster headers of a .delta file of either format.
+@param[in]  path       path of the .delta file
+@param[in]  page_size  page size of the tablespace
+@param[out] pages      pages of the .delta file, sorted by page number
+@return true on success, false on failure. */
+bool xb_delta_read_page_map(const char *path, ulint page_size,
+                            xb_delta_page_map_t *pages);
+
 datafiles_iter_t *datafiles_iter_new(
     const std::shared_ptr<const xb::backup::dd_space_ids>);
 fil_node_t *datafiles_iter_next(datafiles_iter_t *it);
@@ -268,6 +380,41 @@ bool check_if_param_set(const char *param);
 
 void xtrabackup_backup_func(void);
 
+class Redo_Log_Data_Manager;
+
+/** Wait until the in-place DDL and the undo truncations which finished so
+far are known from the redo log, before the backup lock is taken at the end
+of the backup.
+@param[in]      connection  MySQL connection handle
+@param[in,out]  redo_mgr    redo log copy
+@return false on error */
+bool xb_index_load_wait(MYSQL *connection, Redo_Log_Data_Manager *redo_mgr);
+
+/** @return true if the backup lock is needed to re-copy the tablespaces
+bulk loaded by an in-place DDL or the truncated undo tablespaces */
+bool xb_index_load_pending();
+
+/** Re-copy the pages of the tablespaces bulk loaded by an in-place DDL and
+the undo tablespaces truncated during the copy of the datafiles. Must be
+called under the backup lock, before the lsn the backup is consistent at is
+read.
+@param[in]      connection  MySQL connection handle
+@param[in,out]  redo_mgr    redo log copy
+@return false on error */
+bool xb_index_load_recopy(MYSQL *connection, Redo_Log_Data_Manager *redo_mgr);
+
+/** Run --snapshot-create-cmd. Must be called under the backup lock, before
+the lsn the backup is consistent at is read.
+@return false on error */
+bool xb_snapshot_create();
+
+/** Get the path of a datafile in the storage snapshot of --snapshot-dir.
+@param[in]   path           path of the datafile
+@param[out]  snapshot_path  path in the snapshot
+@param[in]   size           size of snapshot_path
+@return false if the datafile is not in the snapshot */
+bool xb_snapshot_path(const char *path, char *snapshot_path, size_t size);
+
 bool xb_get_one_option(int optid,
                        const struct my_option *opt __attribute__((unused)),
                        char *argument);
@@ -282,6 +429,9 @@ struct datadir_entry_t {
   std::string rel_path;
   bool is_empty_dir;
   ssize_t file_size;
+  /* range of the file to copy, the whole file if range_end is 0 */
+  uint64_t range_start = 0;
+  uint64_t range_end = 0;
 
   datadir_entry_t()
       : datadir(), path(), db_name(), file_name(), rel_path(), is_empty_dir() {}
@@ -326,8 +476,11 @@ bool xb_process_datadir(const char *path,   /*!<in: datadir path */
                         const char *suffix, /*!<in: suffix to match
                                             against */
                         handle_datadir_entry_func_t func, /*!<in: callback */
-                        void *data); /*!<in: additional argument for
-                                     callback */
+                        void *data, /*!<in: additional argument for
+                                    callback */
+                        uint n_threads = 1); /*!<in: number of threads
+                                             scanning the database
+                                             directories */
 
 /** update the checkpoint and recalculate the checksum of log header
 @param[in,out]	buf		log header buffer